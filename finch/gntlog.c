@@ -128,17 +128,14 @@ static void search_cb(GntWidget *button, FinchLogViewer *lv)
 	gnt_tree_remove_all(GNT_TREE(lv->tree));
 	gnt_text_view_clear(GNT_TEXT_VIEW(lv->text));
 
-	for (logs = lv->logs; logs != NULL; logs = logs->next) {
-		char *read = purple_log_read((PurpleLog*)logs->data, NULL);
-		if (read && *read && purple_strcasestr(read, search_term)) {
-			PurpleLog *log = logs->data;
+	logs = purple_log_search(lv->logs, search_term, 0, 0);
+	for (; logs != NULL; logs = g_list_delete_link(logs, logs)) {
+		PurpleLog *log = logs->data;
 
-			gnt_tree_add_row_last(GNT_TREE(lv->tree),
-									log,
-									gnt_tree_create_row(GNT_TREE(lv->tree), log_get_date(log)),
-									NULL);
-		}
-		g_free(read);
+		gnt_tree_add_row_last(GNT_TREE(lv->tree),
+								log,
+								gnt_tree_create_row(GNT_TREE(lv->tree), log_get_date(log)),
+								NULL);
 	}
 
 }
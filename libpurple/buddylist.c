@@ -55,6 +55,14 @@ static GObjectClass *parent_class;
  */
 static GHashTable *buddies_cache = NULL;
 
+/*
+ * A hash table used for efficient lookups of chats by name.
+ * PurpleAccount* => struct _purple_account_chats*. The index of an account
+ * is only built when it's first searched while the account is connected, as
+ * the component naming a chat is only known to the protocol then.
+ */
+static GHashTable *chats_cache = NULL;
+
 /*
  * A hash table used for efficient lookups of groups by name.
  * UTF-8 collate-key => PurpleGroup*.
@@ -63,8 +71,35 @@ static GHashTable *groups_cache = NULL;
 
 static guint          save_timer = 0;
 static gboolean       blist_loaded = FALSE;
+static gboolean       blist_loading = FALSE;
 static gchar *localized_default_group_name = NULL;
 
+/*
+ * Changes to the buddy list are appended to a journal next to blist.xml, so
+ * that saving costs as much as the change rather than as much as the list.
+ * Every saved node has an ID: the ones in blist.xml are numbered in document
+ * order, new ones get theirs from the journal records. Once the journal grows
+ * too big, it is folded back into a new blist.xml.
+ */
+#define BLIST_JOURNAL_FILE "blist-journal.xml"
+
+/* Past this many changes at once, rewriting blist.xml is cheaper. */
+#define BLIST_JOURNAL_MAX_DIRTY 1000
+
+/* The journal is compacted once it is bigger than half of blist.xml, or this */
+#define BLIST_JOURNAL_MIN_COMPACT_SIZE (64 * 1024)
+
+static GHashTable *journal_ids = NULL;     /* PurpleBlistNode* => ID */
+static GHashTable *journal_nodes = NULL;   /* ID => PurpleBlistNode*, while loading */
+static GHashTable *dirty_nodes = NULL;     /* Set of PurpleBlistNode* */
+static GHashTable *dirty_accounts = NULL;  /* Set of PurpleAccount* */
+static GString *journal_pending = NULL;    /* Removals not written yet */
+static guint journal_next_id = 1;
+static guint journal_generation = 0;
+static gsize journal_size = 0;
+static gsize snapshot_size = 0;
+static gboolean journal_needs_compaction = FALSE;
+
 /*********************************************************************
  * Private utility functions                                         *
  *********************************************************************/
@@ -145,6 +180,129 @@ static void
 purple_blist_buddies_cache_remove_account(const PurpleAccount *account)
 {
 	g_hash_table_remove(buddies_cache, account);
+	g_hash_table_remove(chats_cache, account);
+}
+
+struct _purple_account_chats {
+	char *identifier;      /* The component naming the chats */
+	GHashTable *chats;     /* Normalized name => PurpleChat* */
+	GHashTable *names;     /* PurpleChat* => normalized name */
+	guint duplicates;      /* Chats not in chats as they share a name */
+};
+
+static void
+purple_blist_account_chats_free(struct _purple_account_chats *ac)
+{
+	g_hash_table_destroy(ac->chats);
+	g_hash_table_destroy(ac->names);
+	g_free(ac->identifier);
+	g_free(ac);
+}
+
+static void
+purple_blist_account_chats_add(struct _purple_account_chats *ac, PurpleChat *chat)
+{
+	PurpleAccount *account = purple_chat_get_account(chat);
+	const char *name;
+	char *key;
+
+	if (g_hash_table_contains(ac->names, chat))
+		return;
+
+	name = g_hash_table_lookup(purple_chat_get_components(chat), ac->identifier);
+	if (name == NULL)
+		return;
+
+	key = g_strdup(purple_normalize(account, name));
+	g_hash_table_insert(ac->names, chat, key);
+
+	/* Only the first chat indexed under a name is found */
+	if (g_hash_table_contains(ac->chats, key))
+		ac->duplicates++;
+	else
+		g_hash_table_insert(ac->chats, key, chat);
+}
+
+static void
+purple_blist_chats_cache_remove(PurpleChat *chat)
+{
+	PurpleAccount *account = purple_chat_get_account(chat);
+	struct _purple_account_chats *ac;
+	const char *key;
+
+	ac = g_hash_table_lookup(chats_cache, account);
+	if (ac == NULL)
+		return;
+
+	key = g_hash_table_lookup(ac->names, chat);
+	if (key == NULL)
+		return;
+
+	if (g_hash_table_lookup(ac->chats, key) != chat) {
+		ac->duplicates--;
+	} else if (ac->duplicates > 0) {
+		/* Another chat takes its place, it will be found on the next build */
+		g_hash_table_remove(chats_cache, account);
+		return;
+	} else {
+		g_hash_table_remove(ac->chats, key);
+	}
+
+	g_hash_table_remove(ac->names, chat);
+}
+
+static struct _purple_account_chats *
+purple_blist_chats_cache_get(PurpleAccount *account, PurpleProtocol *protocol)
+{
+	struct _purple_account_chats *ac;
+	PurpleProtocolChatEntry *pce;
+	PurpleBlistNode *group, *node;
+	PurpleConnection *gc;
+	GList *parts;
+
+	ac = g_hash_table_lookup(chats_cache, account);
+	if (ac != NULL)
+		return ac;
+
+	/* The chat info can depend on the connection, so only index while
+	 * there is one; the index is dropped again when it signs off. */
+	gc = purple_account_get_connection(account);
+	if (gc == NULL)
+		return NULL;
+
+	parts = purple_protocol_chat_iface_info(protocol, gc);
+	if (parts == NULL)
+		return NULL;
+
+	pce = parts->data;
+
+	ac = g_new0(struct _purple_account_chats, 1);
+	ac->identifier = g_strdup(pce->identifier);
+	ac->chats = g_hash_table_new(g_str_hash, g_str_equal);
+	ac->names = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+			NULL, g_free);
+
+	g_list_foreach(parts, (GFunc)g_free, NULL);
+	g_list_free(parts);
+
+	for (group = purplebuddylist->root; group != NULL; group = group->next) {
+		for (node = group->child; node != NULL; node = node->next) {
+			if (PURPLE_IS_CHAT(node) &&
+					purple_chat_get_account(PURPLE_CHAT(node)) == account)
+				purple_blist_account_chats_add(ac, PURPLE_CHAT(node));
+		}
+	}
+
+	g_hash_table_insert(chats_cache, account, ac);
+
+	return ac;
+}
+
+static void
+purple_blist_chats_cache_signed_off(PurpleConnection *gc)
+{
+	/* The names may be normalized differently on the next connection. */
+	g_hash_table_remove(chats_cache, purple_connection_get_account(gc));
 }
 
 /*********************************************************************
@@ -230,7 +388,7 @@ buddy_to_xmlnode(PurpleBuddy *buddy)
 }
 
 static PurpleXmlNode *
-contact_to_xmlnode(PurpleContact *contact)
+contact_to_xmlnode(PurpleContact *contact, gboolean with_children)
 {
 	PurpleXmlNode *node, *child;
 	PurpleBlistNode *bnode;
@@ -245,7 +403,8 @@ contact_to_xmlnode(PurpleContact *contact)
 	}
 
 	/* Write buddies */
-	for (bnode = PURPLE_BLIST_NODE(contact)->child; bnode != NULL; bnode = bnode->next)
+	for (bnode = PURPLE_BLIST_NODE(contact)->child;
+			with_children && bnode != NULL; bnode = bnode->next)
 	{
 		if (purple_blist_node_is_transient(bnode))
 			continue;
@@ -296,7 +455,7 @@ chat_to_xmlnode(PurpleChat *chat)
 }
 
 static PurpleXmlNode *
-group_to_xmlnode(PurpleGroup *group)
+group_to_xmlnode(PurpleGroup *group, gboolean with_children)
 {
 	PurpleXmlNode *node, *child;
 	PurpleBlistNode *cnode;
@@ -310,13 +469,14 @@ group_to_xmlnode(PurpleGroup *group)
 			value_to_xmlnode, node);
 
 	/* Write contacts and chats */
-	for (cnode = PURPLE_BLIST_NODE(group)->child; cnode != NULL; cnode = cnode->next)
+	for (cnode = PURPLE_BLIST_NODE(group)->child;
+			with_children && cnode != NULL; cnode = cnode->next)
 	{
 		if (purple_blist_node_is_transient(cnode))
 			continue;
 		if (PURPLE_IS_CONTACT(cnode))
 		{
-			child = contact_to_xmlnode(PURPLE_CONTACT(cnode));
+			child = contact_to_xmlnode(PURPLE_CONTACT(cnode), TRUE);
 			purple_xmlnode_insert_child(node, child);
 		}
 		else if (PURPLE_IS_CHAT(cnode))
@@ -364,6 +524,7 @@ blist_to_xmlnode(void)
 	PurpleBlistNode *gnode;
 	GList *cur;
 	const gchar *localized_default;
+	char buf[11];
 
 	node = purple_xmlnode_new("purple");
 	purple_xmlnode_set_attrib(node, "version", "1.0");
@@ -379,13 +540,16 @@ blist_to_xmlnode(void)
 			"localized-default-group", localized_default);
 	}
 
+	g_snprintf(buf, sizeof(buf), "%u", journal_generation);
+	purple_xmlnode_set_attrib(child, "journal", buf);
+
 	for (gnode = purplebuddylist->root; gnode != NULL; gnode = gnode->next)
 	{
 		if (purple_blist_node_is_transient(gnode))
 			continue;
 		if (PURPLE_IS_GROUP(gnode))
 		{
-			grandchild = group_to_xmlnode(PURPLE_GROUP(gnode));
+			grandchild = group_to_xmlnode(PURPLE_GROUP(gnode), TRUE);
 			purple_xmlnode_insert_child(child, grandchild);
 		}
 	}
@@ -401,11 +565,217 @@ blist_to_xmlnode(void)
 	return node;
 }
 
+static guint
+journal_get_id(PurpleBlistNode *node)
+{
+	return GPOINTER_TO_UINT(g_hash_table_lookup(journal_ids, node));
+}
+
 static void
-purple_blist_sync(void)
+journal_set_id(PurpleBlistNode *node, guint id)
+{
+	g_hash_table_insert(journal_ids, node, GUINT_TO_POINTER(id));
+
+	if (id >= journal_next_id)
+		journal_next_id = id + 1;
+}
+
+static guint
+journal_number_node(PurpleBlistNode *node, guint id)
+{
+	PurpleBlistNode *child;
+
+	journal_set_id(node, id++);
+
+	if (PURPLE_IS_CHAT(node))
+		return id;
+
+	for (child = node->child; child != NULL; child = child->next) {
+		if (purple_blist_node_is_transient(child))
+			continue;
+		if (PURPLE_IS_CONTACT(child) || PURPLE_IS_CHAT(child) ||
+				PURPLE_IS_BUDDY(child))
+			id = journal_number_node(child, id);
+	}
+
+	return id;
+}
+
+/* Gives every node the ID load_blist() will find it with in blist.xml. */
+static void
+journal_number_nodes(void)
+{
+	PurpleBlistNode *gnode;
+	guint id = 1;
+
+	g_hash_table_remove_all(journal_ids);
+	journal_next_id = 1;
+
+	for (gnode = purplebuddylist->root; gnode != NULL; gnode = gnode->next) {
+		if (purple_blist_node_is_transient(gnode))
+			continue;
+		if (PURPLE_IS_GROUP(gnode))
+			id = journal_number_node(gnode, id);
+	}
+}
+
+static PurpleBlistNode *
+journal_get_previous(PurpleBlistNode *node)
+{
+	for (node = node->prev; node != NULL; node = node->prev) {
+		if (!purple_blist_node_is_transient(node))
+			return node;
+	}
+
+	return NULL;
+}
+
+static gboolean
+journal_node_needs_write(PurpleBlistNode *node)
+{
+	if (purple_blist_node_is_transient(node))
+		return FALSE;
+
+	return g_hash_table_contains(dirty_nodes, node) ||
+		journal_get_id(node) == 0;
+}
+
+/*
+ * Records are single lines, so the line breaks which may be in the data are
+ * written as character references.
+ */
+static void
+journal_append_record(GString *out, PurpleXmlNode *record)
+{
+	char *str, *c;
+
+	str = purple_xmlnode_to_str(record, NULL);
+	for (c = str; *c != '\0'; c++) {
+		if (*c == '\n')
+			g_string_append(out, "&#10;");
+		else if (*c == '\r')
+			g_string_append(out, "&#13;");
+		else
+			g_string_append_c(out, *c);
+	}
+	g_string_append_c(out, '\n');
+
+	g_free(str);
+	purple_xmlnode_free(record);
+}
+
+static void
+journal_write_record(GString *out, PurpleBlistNode *node)
+{
+	PurpleXmlNode *record;
+	PurpleBlistNode *prev;
+	guint id;
+	char buf[11];
+
+	g_hash_table_remove(dirty_nodes, node);
+
+	if (PURPLE_IS_GROUP(node))
+		record = group_to_xmlnode(PURPLE_GROUP(node), FALSE);
+	else if (PURPLE_IS_CONTACT(node))
+		record = contact_to_xmlnode(PURPLE_CONTACT(node), FALSE);
+	else if (PURPLE_IS_BUDDY(node))
+		record = buddy_to_xmlnode(PURPLE_BUDDY(node));
+	else if (PURPLE_IS_CHAT(node))
+		record = chat_to_xmlnode(PURPLE_CHAT(node));
+	else
+		return;
+
+	id = journal_get_id(node);
+	if (id == 0) {
+		id = journal_next_id;
+		journal_set_id(node, id);
+	}
+
+	g_snprintf(buf, sizeof(buf), "%u", id);
+	purple_xmlnode_set_attrib(record, "id", buf);
+
+	if (node->parent != NULL) {
+		g_snprintf(buf, sizeof(buf), "%u", journal_get_id(node->parent));
+		purple_xmlnode_set_attrib(record, "parent", buf);
+	}
+
+	prev = journal_get_previous(node);
+	if (prev != NULL) {
+		g_snprintf(buf, sizeof(buf), "%u", journal_get_id(prev));
+		purple_xmlnode_set_attrib(record, "after", buf);
+	}
+
+	journal_append_record(out, record);
+}
+
+/*
+ * A record refers to the parent of the node and to the sibling it follows,
+ * so those are written first when they changed too.
+ */
+static void
+journal_write_node(GString *out, PurpleBlistNode *node)
+{
+	PurpleBlistNode *first, *prev, *n;
+
+	if (!journal_node_needs_write(node))
+		return;
+
+	if (node->parent != NULL)
+		journal_write_node(out, node->parent);
+
+	first = node;
+	while ((prev = journal_get_previous(first)) != NULL &&
+			journal_node_needs_write(prev))
+		first = prev;
+
+	for (n = first; n != node->next; n = n->next) {
+		if (journal_node_needs_write(n))
+			journal_write_record(out, n);
+	}
+}
+
+static void
+blist_write_snapshot(void)
 {
 	PurpleXmlNode *node;
-	char *data;
+	char *data, *filename;
+	gboolean written;
+
+	journal_generation++;
+
+	node = blist_to_xmlnode();
+	data = purple_xmlnode_to_formatted_str(node, NULL);
+	written = purple_util_write_data_to_file("blist.xml", data, -1);
+	snapshot_size = strlen(data);
+	g_free(data);
+	purple_xmlnode_free(node);
+
+	if (!written) {
+		/* The old blist.xml is still there, and so is its journal. */
+		journal_generation--;
+		journal_needs_compaction = TRUE;
+		return;
+	}
+
+	/* The journal of the old generation would be ignored anyway */
+	filename = g_build_filename(purple_user_dir(), BLIST_JOURNAL_FILE, NULL);
+	g_unlink(filename);
+	g_free(filename);
+
+	journal_size = 0;
+	journal_needs_compaction = FALSE;
+	g_string_truncate(journal_pending, 0);
+	g_hash_table_remove_all(dirty_nodes);
+	g_hash_table_remove_all(dirty_accounts);
+
+	journal_number_nodes();
+}
+
+static void
+purple_blist_sync(void)
+{
+	GString *out;
+	GList *dirty, *cur;
 
 	if (!blist_loaded)
 	{
@@ -414,11 +784,37 @@ purple_blist_sync(void)
 		return;
 	}
 
-	node = blist_to_xmlnode();
-	data = purple_xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_file("blist.xml", data, -1);
-	g_free(data);
-	purple_xmlnode_free(node);
+	if (journal_needs_compaction ||
+			g_hash_table_size(dirty_nodes) > BLIST_JOURNAL_MAX_DIRTY ||
+			journal_size > MAX(BLIST_JOURNAL_MIN_COMPACT_SIZE, snapshot_size / 2)) {
+		blist_write_snapshot();
+		return;
+	}
+
+	out = g_string_new(NULL);
+	if (journal_size == 0)
+		g_string_printf(out, "<journal generation='%u'/>\n", journal_generation);
+	g_string_append_len(out, journal_pending->str, journal_pending->len);
+
+	dirty = g_hash_table_get_keys(dirty_nodes);
+	for (cur = dirty; cur != NULL; cur = cur->next)
+		journal_write_node(out, cur->data);
+	g_list_free(dirty);
+
+	for (cur = purple_accounts_get_all(); cur != NULL; cur = cur->next) {
+		if (g_hash_table_contains(dirty_accounts, cur->data))
+			journal_append_record(out, accountprivacy_to_xmlnode(cur->data));
+	}
+
+	g_string_truncate(journal_pending, 0);
+	g_hash_table_remove_all(dirty_accounts);
+
+	if (purple_util_append_data_to_file(BLIST_JOURNAL_FILE, out->str, out->len))
+		journal_size += out->len;
+	else
+		blist_write_snapshot();
+
+	g_string_free(out, TRUE);
 }
 
 static gboolean
@@ -439,20 +835,60 @@ _purple_blist_schedule_save()
 static void
 purple_blist_save_account(PurpleAccount *account)
 {
-#if 1
-	_purple_blist_schedule_save();
-#else
+	/* Nothing is saved before the list is loaded, nor while it is */
+	if (dirty_nodes == NULL || blist_loading)
+		return;
+
 	if (account != NULL) {
-		/* Save the buddies and privacy data for this account */
+		/* Save the privacy data for this account */
+		g_hash_table_add(dirty_accounts, account);
 	} else {
-		/* Save all buddies and privacy data */
+		/* Save everything */
+		journal_needs_compaction = TRUE;
 	}
-#endif
+
+	_purple_blist_schedule_save();
 }
 
 static void
 purple_blist_save_node(PurpleBlistNode *node)
 {
+	if (dirty_nodes == NULL || blist_loading)
+		return;
+
+	g_hash_table_add(dirty_nodes, node);
+
+	_purple_blist_schedule_save();
+}
+
+static void
+purple_blist_remove_node(PurpleBlistNode *node)
+{
+	PurpleXmlNode *record;
+	guint id;
+	char buf[11];
+
+	if (dirty_nodes == NULL)
+		return;
+
+	g_hash_table_remove(dirty_nodes, node);
+
+	id = journal_get_id(node);
+	if (id == 0)
+		return;
+
+	g_hash_table_remove(journal_ids, node);
+
+	if (blist_loading) {
+		g_hash_table_remove(journal_nodes, GUINT_TO_POINTER(id));
+		return;
+	}
+
+	record = purple_xmlnode_new("remove");
+	g_snprintf(buf, sizeof(buf), "%u", id);
+	purple_xmlnode_set_attrib(record, "id", buf);
+	journal_append_record(journal_pending, record);
+
 	_purple_blist_schedule_save();
 }
 
@@ -490,7 +926,15 @@ parse_setting(PurpleBlistNode *node, PurpleXmlNode *setting)
 }
 
 static void
-parse_buddy(PurpleGroup *group, PurpleContact *contact, PurpleXmlNode *bnode)
+journal_loaded_node(PurpleBlistNode *node, guint id)
+{
+	journal_set_id(node, id);
+	g_hash_table_insert(journal_nodes, GUINT_TO_POINTER(id), node);
+}
+
+static void
+parse_buddy(PurpleGroup *group, PurpleContact *contact, PurpleXmlNode *bnode,
+		guint id)
 {
 	PurpleAccount *account;
 	PurpleBuddy *buddy;
@@ -521,6 +965,7 @@ parse_buddy(PurpleGroup *group, PurpleContact *contact, PurpleXmlNode *bnode)
 	buddy = purple_buddy_new(account, name, alias);
 	purple_blist_add_buddy(buddy, contact, group,
 			_purple_blist_get_last_child((PurpleBlistNode*)contact));
+	journal_loaded_node(PURPLE_BLIST_NODE(buddy), id);
 
 	for (x = purple_xmlnode_get_child(bnode, "setting"); x; x = purple_xmlnode_get_next_twin(x)) {
 		parse_setting((PurpleBlistNode*)buddy, x);
@@ -530,8 +975,8 @@ parse_buddy(PurpleGroup *group, PurpleContact *contact, PurpleXmlNode *bnode)
 	g_free(alias);
 }
 
-static void
-parse_contact(PurpleGroup *group, PurpleXmlNode *cnode)
+static guint
+parse_contact(PurpleGroup *group, PurpleXmlNode *cnode, guint id)
 {
 	PurpleContact *contact = purple_contact_new();
 	PurpleXmlNode *x;
@@ -539,6 +984,7 @@ parse_contact(PurpleGroup *group, PurpleXmlNode *cnode)
 
 	purple_blist_add_contact(contact, group,
 			_purple_blist_get_last_child((PurpleBlistNode*)group));
+	journal_loaded_node(PURPLE_BLIST_NODE(contact), id++);
 
 	if ((alias = purple_xmlnode_get_attrib(cnode, "alias"))) {
 		purple_contact_set_alias(contact, alias);
@@ -548,7 +994,7 @@ parse_contact(PurpleGroup *group, PurpleXmlNode *cnode)
 		if (x->type != PURPLE_XMLNODE_TYPE_TAG)
 			continue;
 		if (purple_strequal(x->name, "buddy"))
-			parse_buddy(group, contact, x);
+			parse_buddy(group, contact, x, id++);
 		else if (purple_strequal(x->name, "setting"))
 			parse_setting(PURPLE_BLIST_NODE(contact), x);
 	}
@@ -556,10 +1002,12 @@ parse_contact(PurpleGroup *group, PurpleXmlNode *cnode)
 	/* if the contact is empty, don't keep it around.  it causes problems */
 	if (!PURPLE_BLIST_NODE(contact)->child)
 		purple_blist_remove_contact(contact);
+
+	return id;
 }
 
 static void
-parse_chat(PurpleGroup *group, PurpleXmlNode *cnode)
+parse_chat(PurpleGroup *group, PurpleXmlNode *cnode, guint id)
 {
 	PurpleChat *chat;
 	PurpleAccount *account;
@@ -596,6 +1044,7 @@ parse_chat(PurpleGroup *group, PurpleXmlNode *cnode)
 	chat = purple_chat_new(account, alias, components);
 	purple_blist_add_chat(chat, group,
 			_purple_blist_get_last_child((PurpleBlistNode*)group));
+	journal_loaded_node(PURPLE_BLIST_NODE(chat), id);
 
 	for (x = purple_xmlnode_get_child(cnode, "setting"); x; x = purple_xmlnode_get_next_twin(x)) {
 		parse_setting((PurpleBlistNode*)chat, x);
@@ -604,8 +1053,12 @@ parse_chat(PurpleGroup *group, PurpleXmlNode *cnode)
 	g_free(alias);
 }
 
-static void
-parse_group(PurpleXmlNode *groupnode)
+/*
+ * Nodes are numbered in document order, so the IDs of the skipped ones are
+ * used up all the same.
+ */
+static guint
+parse_group(PurpleXmlNode *groupnode, guint id)
 {
 	const char *name = purple_xmlnode_get_attrib(groupnode, "name");
 	PurpleGroup *group;
@@ -614,6 +1067,7 @@ parse_group(PurpleXmlNode *groupnode)
 	group = purple_group_new(name);
 	purple_blist_add_group(group,
 			purple_blist_get_last_sibling(purplebuddylist->root));
+	journal_loaded_node(PURPLE_BLIST_NODE(group), id++);
 
 	for (cnode = groupnode->child; cnode; cnode = cnode->next) {
 		if (cnode->type != PURPLE_XMLNODE_TYPE_TAG)
@@ -622,27 +1076,467 @@ parse_group(PurpleXmlNode *groupnode)
 			parse_setting((PurpleBlistNode*)group, cnode);
 		else if (purple_strequal(cnode->name, "contact") ||
 				purple_strequal(cnode->name, "person"))
-			parse_contact(group, cnode);
+			id = parse_contact(group, cnode, id);
 		else if (purple_strequal(cnode->name, "chat"))
-			parse_chat(group, cnode);
+			parse_chat(group, cnode, id++);
 	}
+
+	return id;
+}
+
+static void
+parse_privacy_account(PurpleXmlNode *anode, gboolean replace)
+{
+	PurpleXmlNode *x;
+	PurpleAccount *account;
+	int imode;
+	const char *acct_name, *proto, *mode;
+
+	acct_name = purple_xmlnode_get_attrib(anode, "name");
+	proto = purple_xmlnode_get_attrib(anode, "proto");
+	mode = purple_xmlnode_get_attrib(anode, "mode");
+
+	if (!acct_name || !proto || !mode)
+		return;
+
+	account = purple_accounts_find(acct_name, proto);
+
+	if (!account)
+		return;
+
+	if (replace) {
+		while (purple_account_privacy_get_permitted(account) != NULL) {
+			purple_account_privacy_permit_remove(account,
+				purple_account_privacy_get_permitted(account)->data, TRUE);
+		}
+		while (purple_account_privacy_get_denied(account) != NULL) {
+			purple_account_privacy_deny_remove(account,
+				purple_account_privacy_get_denied(account)->data, TRUE);
+		}
+	}
+
+	imode = atoi(mode);
+	purple_account_set_privacy_type(account, (imode != 0 ? imode : PURPLE_ACCOUNT_PRIVACY_ALLOW_ALL));
+
+	for (x = anode->child; x; x = x->next) {
+		char *name;
+		if (x->type != PURPLE_XMLNODE_TYPE_TAG)
+			continue;
+
+		if (purple_strequal(x->name, "permit")) {
+			name = purple_xmlnode_get_data(x);
+			purple_account_privacy_permit_add(account, name, TRUE);
+			g_free(name);
+		} else if (purple_strequal(x->name, "block")) {
+			name = purple_xmlnode_get_data(x);
+			purple_account_privacy_deny_add(account, name, TRUE);
+			g_free(name);
+		}
+	}
+}
+
+/*********************************************************************
+ * Replaying the journal                                             *
+ *********************************************************************/
+
+static guint
+journal_record_get_id(PurpleXmlNode *record, const char *attrib)
+{
+	const char *id = purple_xmlnode_get_attrib(record, attrib);
+
+	if (id == NULL)
+		return 0;
+
+	return strtoul(id, NULL, 10);
+}
+
+static PurpleBlistNode *
+journal_record_get_node(PurpleXmlNode *record, const char *attrib)
+{
+	guint id = journal_record_get_id(record, attrib);
+
+	if (id == 0)
+		return NULL;
+
+	return g_hash_table_lookup(journal_nodes, GUINT_TO_POINTER(id));
+}
+
+/* A record whose ID belongs to a node of another type is corrupt. */
+static void
+journal_skip_record(PurpleXmlNode *record, guint id, PurpleBlistNode *node)
+{
+	purple_debug_warning("buddylist", "Journal record %s %u is for a %s, "
+			"skipping it\n", record->name, id, G_OBJECT_TYPE_NAME(node));
+}
+
+/* Whether node has to be moved to come right after prev in parent. */
+static gboolean
+journal_node_is_misplaced(PurpleBlistNode *node, PurpleBlistNode *parent,
+		PurpleBlistNode *prev)
+{
+	return node->parent != parent || journal_get_previous(node) != prev;
+}
+
+static void
+journal_replace_settings(PurpleBlistNode *node, PurpleXmlNode *record)
+{
+	PurpleXmlNode *x;
+
+	g_hash_table_remove_all(purple_blist_node_get_settings(node));
+
+	for (x = purple_xmlnode_get_child(record, "setting"); x; x = purple_xmlnode_get_next_twin(x)) {
+		parse_setting(node, x);
+	}
+}
+
+static void
+journal_replay_group(PurpleXmlNode *record, guint id)
+{
+	PurpleBlistNode *node, *prev;
+	PurpleGroup *group;
+	const char *name = purple_xmlnode_get_attrib(record, "name");
+
+	node = g_hash_table_lookup(journal_nodes, GUINT_TO_POINTER(id));
+	if (node != NULL && !PURPLE_IS_GROUP(node)) {
+		journal_skip_record(record, id, node);
+		return;
+	}
+
+	prev = journal_record_get_node(record, "after");
+	if (prev != NULL && !PURPLE_IS_GROUP(prev))
+		prev = NULL;
+
+	if (node == NULL) {
+		group = purple_group_new(name);
+		purple_blist_add_group(group, prev);
+		journal_loaded_node(PURPLE_BLIST_NODE(group), id);
+		node = PURPLE_BLIST_NODE(group);
+	} else {
+		group = PURPLE_GROUP(node);
+		if (name != NULL && !purple_strequal(name, purple_group_get_name(group)))
+			purple_group_set_name(group, name);
+		if (journal_node_is_misplaced(node, NULL, prev))
+			purple_blist_add_group(group, prev);
+	}
+
+	journal_replace_settings(node, record);
+}
+
+static void
+journal_replay_contact(PurpleXmlNode *record, guint id)
+{
+	PurpleBlistNode *node, *gnode, *prev;
+	PurpleContact *contact;
+
+	gnode = journal_record_get_node(record, "parent");
+	if (gnode == NULL || !PURPLE_IS_GROUP(gnode))
+		return;
+
+	node = g_hash_table_lookup(journal_nodes, GUINT_TO_POINTER(id));
+	if (node != NULL && !PURPLE_IS_CONTACT(node)) {
+		journal_skip_record(record, id, node);
+		return;
+	}
+
+	prev = journal_record_get_node(record, "after");
+	if (prev != NULL && prev->parent != gnode)
+		prev = NULL;
+
+	if (node == NULL) {
+		contact = purple_contact_new();
+		purple_blist_add_contact(contact, PURPLE_GROUP(gnode), prev);
+		journal_loaded_node(PURPLE_BLIST_NODE(contact), id);
+		node = PURPLE_BLIST_NODE(contact);
+	} else {
+		contact = PURPLE_CONTACT(node);
+		if (journal_node_is_misplaced(node, gnode, prev))
+			purple_blist_add_contact(contact, PURPLE_GROUP(gnode), prev);
+	}
+
+	purple_contact_set_alias(contact, purple_xmlnode_get_attrib(record, "alias"));
+	journal_replace_settings(node, record);
+}
+
+static void
+journal_replay_buddy(PurpleXmlNode *record, guint id)
+{
+	PurpleBlistNode *node, *cnode, *prev;
+	PurpleAccount *account;
+	PurpleBuddy *buddy;
+	PurpleXmlNode *x;
+	char *name = NULL, *alias = NULL;
+	const char *acct_name, *proto;
+
+	cnode = journal_record_get_node(record, "parent");
+	if (cnode == NULL || !PURPLE_IS_CONTACT(cnode))
+		return;
+
+	node = g_hash_table_lookup(journal_nodes, GUINT_TO_POINTER(id));
+	if (node != NULL && !PURPLE_IS_BUDDY(node)) {
+		journal_skip_record(record, id, node);
+		return;
+	}
+
+	acct_name = purple_xmlnode_get_attrib(record, "account");
+	proto = purple_xmlnode_get_attrib(record, "proto");
+	if (!acct_name || !proto)
+		return;
+
+	account = purple_accounts_find(acct_name, proto);
+	if (!account)
+		return;
+
+	if ((x = purple_xmlnode_get_child(record, "name")))
+		name = purple_xmlnode_get_data(x);
+	if (!name)
+		return;
+
+	if ((x = purple_xmlnode_get_child(record, "alias")))
+		alias = purple_xmlnode_get_data(x);
+
+	prev = journal_record_get_node(record, "after");
+	if (prev != NULL && prev->parent != cnode)
+		prev = NULL;
+
+	if (node == NULL) {
+		buddy = purple_buddy_new(account, name, alias);
+		purple_blist_add_buddy(buddy, PURPLE_CONTACT(cnode), NULL, prev);
+		journal_loaded_node(PURPLE_BLIST_NODE(buddy), id);
+		node = PURPLE_BLIST_NODE(buddy);
+	} else {
+		buddy = PURPLE_BUDDY(node);
+		if (!purple_strequal(name, purple_buddy_get_name(buddy)))
+			purple_buddy_set_name(buddy, name);
+		purple_buddy_set_local_alias(buddy, alias);
+		if (journal_node_is_misplaced(node, cnode, prev))
+			purple_blist_add_buddy(buddy, PURPLE_CONTACT(cnode), NULL, prev);
+	}
+
+	journal_replace_settings(node, record);
+
+	g_free(name);
+	g_free(alias);
+}
+
+static void
+journal_replay_chat(PurpleXmlNode *record, guint id)
+{
+	PurpleBlistNode *node, *gnode, *prev;
+	PurpleAccount *account;
+	PurpleChat *chat;
+	PurpleXmlNode *x;
+	GHashTable *components;
+	char *alias = NULL;
+	const char *acct_name, *proto;
+
+	gnode = journal_record_get_node(record, "parent");
+	if (gnode == NULL || !PURPLE_IS_GROUP(gnode))
+		return;
+
+	node = g_hash_table_lookup(journal_nodes, GUINT_TO_POINTER(id));
+	if (node != NULL && !PURPLE_IS_CHAT(node)) {
+		journal_skip_record(record, id, node);
+		return;
+	}
+
+	acct_name = purple_xmlnode_get_attrib(record, "account");
+	proto = purple_xmlnode_get_attrib(record, "proto");
+	if (!acct_name || !proto)
+		return;
+
+	account = purple_accounts_find(acct_name, proto);
+	if (!account)
+		return;
+
+	if ((x = purple_xmlnode_get_child(record, "alias")))
+		alias = purple_xmlnode_get_data(x);
+
+	prev = journal_record_get_node(record, "after");
+	if (prev != NULL && prev->parent != gnode)
+		prev = NULL;
+
+	if (node == NULL) {
+		components = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+		chat = purple_chat_new(account, alias, components);
+		purple_blist_add_chat(chat, PURPLE_GROUP(gnode), prev);
+		journal_loaded_node(PURPLE_BLIST_NODE(chat), id);
+		node = PURPLE_BLIST_NODE(chat);
+	} else {
+		chat = PURPLE_CHAT(node);
+		components = purple_chat_get_components(chat);
+		g_hash_table_remove_all(components);
+		purple_chat_set_alias(chat, alias);
+		if (journal_node_is_misplaced(node, gnode, prev))
+			purple_blist_add_chat(chat, PURPLE_GROUP(gnode), prev);
+	}
+
+	for (x = purple_xmlnode_get_child(record, "component"); x; x = purple_xmlnode_get_next_twin(x)) {
+		g_hash_table_replace(components,
+			g_strdup(purple_xmlnode_get_attrib(x, "name")),
+			purple_xmlnode_get_data(x));
+	}
+
+	journal_replace_settings(node, record);
+
+	g_free(alias);
+}
+
+static void
+journal_replay_remove(guint id)
+{
+	PurpleBlistNode *node;
+
+	node = g_hash_table_lookup(journal_nodes, GUINT_TO_POINTER(id));
+	if (node == NULL)
+		return;
+
+	if (PURPLE_IS_BUDDY(node))
+		purple_blist_remove_buddy(PURPLE_BUDDY(node));
+	else if (PURPLE_IS_CONTACT(node))
+		purple_blist_remove_contact(PURPLE_CONTACT(node));
+	else if (PURPLE_IS_CHAT(node))
+		purple_blist_remove_chat(PURPLE_CHAT(node));
+	else if (PURPLE_IS_GROUP(node))
+		purple_blist_remove_group(PURPLE_GROUP(node));
+}
+
+static void
+journal_replay_record(PurpleXmlNode *record)
+{
+	guint id = journal_record_get_id(record, "id");
+
+	if (purple_strequal(record->name, "account")) {
+		parse_privacy_account(record, TRUE);
+		return;
+	}
+
+	if (id == 0)
+		return;
+
+	/* Even records which can't be applied keep the ID used. */
+	if (id >= journal_next_id)
+		journal_next_id = id + 1;
+
+	if (purple_strequal(record->name, "group"))
+		journal_replay_group(record, id);
+	else if (purple_strequal(record->name, "contact"))
+		journal_replay_contact(record, id);
+	else if (purple_strequal(record->name, "buddy"))
+		journal_replay_buddy(record, id);
+	else if (purple_strequal(record->name, "chat"))
+		journal_replay_chat(record, id);
+	else if (purple_strequal(record->name, "remove"))
+		journal_replay_remove(id);
+}
+
+static void
+journal_remove_empty_contacts(void)
+{
+	PurpleBlistNode *gnode, *cnode, *next;
+
+	for (gnode = purplebuddylist->root; gnode != NULL; gnode = gnode->next) {
+		for (cnode = gnode->child; cnode != NULL; cnode = next) {
+			next = cnode->next;
+			if (PURPLE_IS_CONTACT(cnode) && cnode->child == NULL)
+				purple_blist_remove_contact(PURPLE_CONTACT(cnode));
+		}
+	}
+}
+
+/*
+ * Applies the changes saved after blist.xml was written. A record cut short
+ * by a crash ends the replay, and the next save compacts the journal so
+ * nothing gets appended after the broken line.
+ */
+static void
+journal_replay(void)
+{
+	PurpleXmlNode *record;
+	gchar *filename, *contents = NULL;
+	gchar **lines;
+	gsize length = 0;
+	guint i, count = 0;
+
+	filename = g_build_filename(purple_user_dir(), BLIST_JOURNAL_FILE, NULL);
+
+	if (!g_file_get_contents(filename, &contents, &length, NULL)) {
+		g_free(filename);
+		return;
+	}
+
+	lines = g_strsplit(contents, "\n", -1);
+	g_free(contents);
+
+	record = purple_xmlnode_from_str(lines[0], -1);
+	if (record == NULL || !purple_strequal(record->name, "journal") ||
+			journal_record_get_id(record, "generation") != journal_generation) {
+		purple_debug_info("buddylist", "Ignoring the journal of an older "
+				"buddy list\n");
+		purple_xmlnode_free(record);
+		g_strfreev(lines);
+		g_unlink(filename);
+		g_free(filename);
+		return;
+	}
+	purple_xmlnode_free(record);
+
+	for (i = 1; lines[i] != NULL; i++) {
+		if (*lines[i] == '\0')
+			continue;
+
+		record = purple_xmlnode_from_str(lines[i], -1);
+		if (record == NULL) {
+			purple_debug_warning("buddylist", "Truncated journal record "
+					"%u, ignoring the rest of the journal\n", i);
+			journal_needs_compaction = TRUE;
+			break;
+		}
+
+		journal_replay_record(record);
+		purple_xmlnode_free(record);
+		count++;
+	}
+
+	if (count > 0)
+		journal_remove_empty_contacts();
+
+	purple_debug_info("buddylist", "Replayed %u buddy list changes\n", count);
+
+	journal_size = length;
+
+	g_strfreev(lines);
+	g_free(filename);
 }
 
 static void
 load_blist(void)
 {
 	PurpleXmlNode *purple, *blist, *privacy;
+	GStatBuf st;
+	gchar *filename;
+	guint id = 1;
 
 	blist_loaded = TRUE;
 
 	purple = purple_util_read_xml_from_file("blist.xml", _("buddy list"));
 
-	if (purple == NULL)
+	if (purple == NULL) {
+		journal_needs_compaction = TRUE;
 		return;
+	}
+
+	filename = g_build_filename(purple_user_dir(), "blist.xml", NULL);
+	if (g_stat(filename, &st) == 0)
+		snapshot_size = st.st_size;
+	g_free(filename);
+
+	blist_loading = TRUE;
+	journal_nodes = g_hash_table_new(g_direct_hash, g_direct_equal);
 
 	blist = purple_xmlnode_get_child(purple, "blist");
 	if (blist) {
 		PurpleXmlNode *groupnode;
+		const char *generation;
 
 		localized_default_group_name = g_strdup(
 			purple_xmlnode_get_attrib(blist,
@@ -650,57 +1544,40 @@ load_blist(void)
 
 		for (groupnode = purple_xmlnode_get_child(blist, "group"); groupnode != NULL;
 				groupnode = purple_xmlnode_get_next_twin(groupnode)) {
-			parse_group(groupnode);
+			id = parse_group(groupnode, id);
 		}
+
+		/* Lists written without a journal get rewritten with one. */
+		generation = purple_xmlnode_get_attrib(blist, "journal");
+		if (generation != NULL)
+			journal_generation = strtoul(generation, NULL, 10);
+		else
+			journal_needs_compaction = TRUE;
 	} else {
 		g_free(localized_default_group_name);
 		localized_default_group_name = NULL;
+		journal_needs_compaction = TRUE;
 	}
 
+	journal_next_id = MAX(journal_next_id, id);
+
 	privacy = purple_xmlnode_get_child(purple, "privacy");
 	if (privacy) {
 		PurpleXmlNode *anode;
 		for (anode = privacy->child; anode; anode = anode->next) {
-			PurpleXmlNode *x;
-			PurpleAccount *account;
-			int imode;
-			const char *acct_name, *proto, *mode;
-
-			acct_name = purple_xmlnode_get_attrib(anode, "name");
-			proto = purple_xmlnode_get_attrib(anode, "proto");
-			mode = purple_xmlnode_get_attrib(anode, "mode");
-
-			if (!acct_name || !proto || !mode)
-				continue;
-
-			account = purple_accounts_find(acct_name, proto);
-
-			if (!account)
-				continue;
-
-			imode = atoi(mode);
-			purple_account_set_privacy_type(account, (imode != 0 ? imode : PURPLE_ACCOUNT_PRIVACY_ALLOW_ALL));
-
-			for (x = anode->child; x; x = x->next) {
-				char *name;
-				if (x->type != PURPLE_XMLNODE_TYPE_TAG)
-					continue;
-
-				if (purple_strequal(x->name, "permit")) {
-					name = purple_xmlnode_get_data(x);
-					purple_account_privacy_permit_add(account, name, TRUE);
-					g_free(name);
-				} else if (purple_strequal(x->name, "block")) {
-					name = purple_xmlnode_get_data(x);
-					purple_account_privacy_deny_add(account, name, TRUE);
-					g_free(name);
-				}
-			}
+			parse_privacy_account(anode, FALSE);
 		}
 	}
 
 	purple_xmlnode_free(purple);
 
+	if (!journal_needs_compaction)
+		journal_replay();
+
+	g_hash_table_destroy(journal_nodes);
+	journal_nodes = NULL;
+	blist_loading = FALSE;
+
 	/* This tells the buddy icon code to do its thing. */
 	_purple_buddy_icons_blist_loaded_cb();
 }
@@ -725,6 +1602,14 @@ purple_blist_boot(void)
 					 (GEqualFunc)g_str_equal,
 					 (GDestroyNotify)g_free, NULL);
 
+	chats_cache = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					 NULL, (GDestroyNotify)purple_blist_account_chats_free);
+
+	journal_ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+	dirty_nodes = g_hash_table_new(g_direct_hash, g_direct_equal);
+	dirty_accounts = g_hash_table_new(g_direct_hash, g_direct_equal);
+	journal_pending = g_string_new(NULL);
+
 	for (account = purple_accounts_get_all(); account != NULL; account = account->next)
 	{
 		purple_blist_buddies_cache_add_account(account->data);
@@ -848,6 +1733,7 @@ void purple_blist_add_chat(PurpleChat *chat, PurpleGroup *group, PurpleBlistNode
 	PurpleBlistNode *cnode = PURPLE_BLIST_NODE(chat);
 	PurpleBlistUiOps *ops = purple_blist_get_ui_ops();
 	PurpleCountingNode *group_counter;
+	struct _purple_account_chats *ac;
 
 	g_return_if_fail(PURPLE_IS_CHAT(chat));
 
@@ -921,6 +1807,10 @@ void purple_blist_add_chat(PurpleChat *chat, PurpleGroup *group, PurpleBlistNode
 		}
 	}
 
+	ac = g_hash_table_lookup(chats_cache, purple_chat_get_account(chat));
+	if (ac != NULL)
+		purple_blist_account_chats_add(ac, chat);
+
 	if (ops) {
 		if (ops->save_node)
 			ops->save_node(cnode);
@@ -1474,6 +2364,8 @@ void purple_blist_remove_chat(PurpleChat *chat)
 		purple_counting_node_change_total_size(group_counter, -1);
 	}
 
+	purple_blist_chats_cache_remove(chat);
+
 	/* Update the UI */
 	if (ops && ops->remove)
 		ops->remove(purplebuddylist, node);
@@ -1665,12 +2557,10 @@ purple_blist_get_default_group(void)
 PurpleChat *
 purple_blist_find_chat(PurpleAccount *account, const char *name)
 {
-	char *chat_name;
+	const char *chat_name;
 	PurpleChat *chat;
 	PurpleProtocol *protocol = NULL;
-	PurpleProtocolChatEntry *pce;
-	PurpleBlistNode *node, *group;
-	GList *parts;
+	struct _purple_account_chats *ac;
 	char *normname;
 
 	g_return_val_if_fail(PURPLE_IS_BUDDY_LIST(purplebuddylist), NULL);
@@ -1684,36 +2574,52 @@ purple_blist_find_chat(PurpleAccount *account, const char *name)
 	if (PURPLE_PROTOCOL_IMPLEMENTS(protocol, CLIENT_IFACE, find_blist_chat))
 		return purple_protocol_client_iface_find_blist_chat(protocol, account, name);
 
-	normname = g_strdup(purple_normalize(account, name));
-	for (group = purplebuddylist->root; group != NULL; group = group->next) {
-		for (node = group->child; node != NULL; node = node->next) {
-			if (PURPLE_IS_CHAT(node)) {
-
-				chat = (PurpleChat*)node;
+	ac = purple_blist_chats_cache_get(account, protocol);
+	if (ac == NULL)
+		return NULL;
 
-				if (account != purple_chat_get_account(chat))
-					continue;
+	normname = g_strdup(purple_normalize(account, name));
+	if (normname == NULL)
+		return NULL;
 
-				parts = purple_protocol_chat_iface_info(protocol, 
-					purple_account_get_connection(purple_chat_get_account(chat)));
+	chat = g_hash_table_lookup(ac->chats, normname);
 
-				pce = parts->data;
-				chat_name = g_hash_table_lookup(purple_chat_get_components(chat),
-												pce->identifier);
-				g_list_foreach(parts, (GFunc)g_free, NULL);
-				g_list_free(parts);
+	if (chat != NULL) {
+		/* The components may have been changed in place since. */
+		chat_name = g_hash_table_lookup(purple_chat_get_components(chat),
+				ac->identifier);
 
-				if (purple_chat_get_account(chat) == account && chat_name != NULL &&
-					normname != NULL && !strcmp(purple_normalize(account, chat_name), normname)) {
-					g_free(normname);
-					return chat;
-				}
-			}
+		if (chat_name == NULL ||
+				!purple_strequal(purple_normalize(account, chat_name), normname)) {
+			g_hash_table_remove(chats_cache, account);
+			ac = purple_blist_chats_cache_get(account, protocol);
+			chat = ac ? g_hash_table_lookup(ac->chats, normname) : NULL;
 		}
 	}
 
 	g_free(normname);
-	return NULL;
+	return chat;
+}
+
+void purple_blist_update_chats_cache(PurpleChat *chat)
+{
+	PurpleBlistUiOps *ops = purple_blist_get_ui_ops();
+	struct _purple_account_chats *ac;
+
+	g_return_if_fail(PURPLE_IS_CHAT(chat));
+
+	ac = g_hash_table_lookup(chats_cache, purple_chat_get_account(chat));
+	if (ac != NULL) {
+		purple_blist_chats_cache_remove(chat);
+
+		/* Unless removing it dropped the whole index */
+		ac = g_hash_table_lookup(chats_cache, purple_chat_get_account(chat));
+		if (ac != NULL)
+			purple_blist_account_chats_add(ac, chat);
+	}
+
+	if (ops && ops->save_node)
+		ops->save_node(PURPLE_BLIST_NODE(chat));
 }
 
 void purple_blist_add_account(PurpleAccount *account)
@@ -1901,7 +2807,7 @@ purple_blist_set_ui_ops(PurpleBlistUiOps *ops)
 		overrode = TRUE;
 	}
 	if (!ops->remove_node) {
-		ops->remove_node = purple_blist_save_node;
+		ops->remove_node = purple_blist_remove_node;
 		overrode = TRUE;
 	}
 	if (!ops->save_account) {
@@ -1910,7 +2816,7 @@ purple_blist_set_ui_ops(PurpleBlistUiOps *ops)
 	}
 
 	if (overrode && (ops->save_node    != purple_blist_save_node ||
-	                 ops->remove_node  != purple_blist_save_node ||
+	                 ops->remove_node  != purple_blist_remove_node ||
 	                 ops->save_account != purple_blist_save_account)) {
 		purple_debug_warning("buddylist", "Only some of the blist saving UI ops "
 				"were overridden. This probably is not what you want!\n");
@@ -2007,6 +2913,11 @@ purple_blist_init(void)
 			handle,
 			PURPLE_CALLBACK(purple_blist_buddies_cache_remove_account),
 			NULL);
+
+	purple_signal_connect(purple_connections_get_handle(), "signed-off",
+			handle,
+			PURPLE_CALLBACK(purple_blist_chats_cache_signed_off),
+			NULL);
 }
 
 static void
@@ -2065,9 +2976,29 @@ purple_blist_uninit(void)
 
 	g_hash_table_destroy(buddies_cache);
 	g_hash_table_destroy(groups_cache);
+	g_hash_table_destroy(chats_cache);
 
 	buddies_cache = NULL;
 	groups_cache = NULL;
+	chats_cache = NULL;
+
+	g_hash_table_destroy(journal_ids);
+	g_hash_table_destroy(dirty_nodes);
+	g_hash_table_destroy(dirty_accounts);
+	g_string_free(journal_pending, TRUE);
+
+	journal_ids = NULL;
+	dirty_nodes = NULL;
+	dirty_accounts = NULL;
+	journal_pending = NULL;
+
+	/* The next list is read from scratch */
+	blist_loaded = FALSE;
+	journal_next_id = 1;
+	journal_generation = 0;
+	journal_size = 0;
+	snapshot_size = 0;
+	journal_needs_compaction = FALSE;
 
 	g_object_unref(purplebuddylist);
 	purplebuddylist = NULL;
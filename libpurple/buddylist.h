@@ -254,6 +254,15 @@ void purple_blist_update_buddies_cache(PurpleBuddy *buddy, const char *new_name)
  */
 void purple_blist_update_groups_cache(PurpleGroup *group, const char *new_name);
 
+/**
+ * purple_blist_update_chats_cache:
+ * @chat: The chat whose components were changed.
+ *
+ * Updates the chats hash table, and saves the chat, after its components were
+ * changed in the hash table returned by purple_chat_get_components().
+ */
+void purple_blist_update_chats_cache(PurpleChat *chat);
+
 /**
  * purple_blist_add_chat:
  * @chat:  The new chat who gets added
@@ -56,7 +56,12 @@ struct _PurpleConversationPrivate
 	PurpleConversationUiOps *ui_ops;  /* UI-specific operations.           */
 
 	PurpleConnectionFlags features;   /* The supported features            */
-	GList *message_history; /* Message history, as a GList of PurpleMessages */
+
+	PurpleMessage **message_history;  /* Message history, a ring buffer    */
+	guint history_size;               /* Number of slots in the buffer     */
+	guint history_start;              /* Slot of the oldest message        */
+	guint history_length;             /* Number of messages in the history */
+	guint history_limit;              /* Maximum length, 0 for no limit    */
 
 	PurpleE2eeState *e2ee_state;      /* End-to-end encryption state.      */
 
@@ -207,16 +212,70 @@ open_log(PurpleConversation *conv)
 
 /* Functions that deal with PurpleMessage history */
 
+#define MESSAGE_HISTORY_MIN_SIZE 16
+
+/* Moves the history to a buffer of the given size, the oldest message first. */
+static void
+resize_message_history(PurpleConversationPrivate *priv, guint size)
+{
+	PurpleMessage **history;
+	guint i;
+
+	g_return_if_fail(size >= priv->history_length);
+
+	history = g_new0(PurpleMessage *, size);
+	for (i = 0; i < priv->history_length; i++) {
+		history[i] = priv->message_history[
+			(priv->history_start + i) % priv->history_size];
+	}
+
+	g_free(priv->message_history);
+	priv->message_history = history;
+	priv->history_size = size;
+	priv->history_start = 0;
+}
+
+/* Drops the oldest messages, until there are no more than length of them. */
+static void
+trim_message_history(PurpleConversationPrivate *priv, guint length)
+{
+	while (priv->history_length > length) {
+		PurpleMessage **slot = &priv->message_history[priv->history_start];
+
+		g_object_unref(*slot);
+		*slot = NULL;
+		priv->history_start = (priv->history_start + 1) % priv->history_size;
+		priv->history_length--;
+	}
+}
+
 static void
 add_message_to_history(PurpleConversation *conv, PurpleMessage *msg)
 {
 	PurpleConversationPrivate *priv = PURPLE_CONVERSATION_GET_PRIVATE(conv);
+	guint slot;
 
 	g_return_if_fail(priv != NULL);
 	g_return_if_fail(msg != NULL);
 
-	g_object_ref(msg);
-	priv->message_history = g_list_prepend(priv->message_history, msg);
+	if (priv->history_length == priv->history_size) {
+		if (priv->history_limit == 0 ||
+				priv->history_size < priv->history_limit) {
+			guint size = MAX(priv->history_size * 2,
+					MESSAGE_HISTORY_MIN_SIZE);
+
+			if (priv->history_limit > 0)
+				size = MIN(size, priv->history_limit);
+			resize_message_history(priv, size);
+		} else {
+			/* The history is full, the oldest message makes room. */
+			trim_message_history(priv, priv->history_length - 1);
+		}
+	}
+
+	slot = (priv->history_start + priv->history_length) % priv->history_size;
+	priv->message_history[slot] = g_object_ref(msg);
+	priv->history_length++;
 }
 
 /**************************************************************************
@@ -775,26 +834,103 @@ purple_conversation_get_extended_menu(PurpleConversation *conv)
 
 void purple_conversation_clear_message_history(PurpleConversation *conv)
 {
-	GList *list;
 	PurpleConversationPrivate *priv = PURPLE_CONVERSATION_GET_PRIVATE(conv);
 
 	g_return_if_fail(priv != NULL);
 
-	list = priv->message_history;
-	g_list_free_full(list, g_object_unref);
+	trim_message_history(priv, 0);
+	g_free(priv->message_history);
 	priv->message_history = NULL;
+	priv->history_size = 0;
+	priv->history_start = 0;
 
 	purple_signal_emit(purple_conversations_get_handle(),
 			"cleared-message-history", conv);
 }
 
-GList *purple_conversation_get_message_history(PurpleConversation *conv)
+void
+purple_conversation_set_message_history_limit(PurpleConversation *conv,
+		guint limit)
+{
+	PurpleConversationPrivate *priv = PURPLE_CONVERSATION_GET_PRIVATE(conv);
+
+	g_return_if_fail(priv != NULL);
+
+	priv->history_limit = limit;
+	if (limit == 0 || priv->history_size <= limit)
+		return;
+
+	trim_message_history(priv, limit);
+	resize_message_history(priv, limit);
+}
+
+guint
+purple_conversation_get_message_history_limit(PurpleConversation *conv)
 {
 	PurpleConversationPrivate *priv = PURPLE_CONVERSATION_GET_PRIVATE(conv);
 
+	g_return_val_if_fail(priv != NULL, 0);
+
+	return priv->history_limit;
+}
+
+guint
+purple_conversation_get_message_history_length(PurpleConversation *conv)
+{
+	PurpleConversationPrivate *priv = PURPLE_CONVERSATION_GET_PRIVATE(conv);
+
+	g_return_val_if_fail(priv != NULL, 0);
+
+	return priv->history_length;
+}
+
+PurpleMessage *
+purple_conversation_get_message_history_nth(PurpleConversation *conv, guint n)
+{
+	PurpleConversationPrivate *priv = PURPLE_CONVERSATION_GET_PRIVATE(conv);
+	guint slot;
+
 	g_return_val_if_fail(priv != NULL, NULL);
 
-	return priv->message_history;
+	if (n >= priv->history_length)
+		return NULL;
+
+	slot = (priv->history_start + priv->history_length - 1 - n) %
+		priv->history_size;
+
+	return priv->message_history[slot];
+}
+
+void
+purple_conversation_message_history_iter_init(
+		PurpleConversationMessageHistoryIter *iter,
+		PurpleConversation *conv)
+{
+	g_return_if_fail(iter != NULL);
+	g_return_if_fail(PURPLE_IS_CONVERSATION(conv));
+
+	iter->conv = conv;
+	iter->position = 0;
+}
+
+gboolean
+purple_conversation_message_history_iter_next(
+		PurpleConversationMessageHistoryIter *iter, PurpleMessage **msg)
+{
+	PurpleMessage *next;
+
+	g_return_val_if_fail(iter != NULL, FALSE);
+
+	next = purple_conversation_get_message_history_nth(iter->conv,
+			iter->position);
+	if (next == NULL)
+		return FALSE;
+
+	iter->position++;
+	if (msg != NULL)
+		*msg = next;
+
+	return TRUE;
 }
 
 void purple_conversation_set_ui_data(PurpleConversation *conv, gpointer ui_data)
@@ -974,6 +1110,9 @@ purple_conversation_constructed(GObject *object)
 	/* copy features from the connection. */
 	purple_conversation_set_features(conv, purple_connection_get_flags(gc));
 
+	purple_conversation_set_message_history_limit(conv,
+		MAX(purple_prefs_get_int("/purple/conversations/message_history_limit"), 0));
+
 	/* add the conversation to the appropriate lists */
 	purple_conversations_add(conv);
 
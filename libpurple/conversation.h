@@ -53,6 +53,8 @@ typedef struct _PurpleConversationClass      PurpleConversationClass;
 
 typedef struct _PurpleConversationUiOps      PurpleConversationUiOps;
 
+typedef struct _PurpleConversationMessageHistoryIter PurpleConversationMessageHistoryIter;
+
 /**
  * PurpleConversationUpdateType:
  * @PURPLE_CONVERSATION_UPDATE_ADD:      The buddy associated with the
@@ -283,6 +285,20 @@ struct _PurpleConversationUiOps
 	void (*_purple_reserved4)(void);
 };
 
+/**
+ * PurpleConversationMessageHistoryIter:
+ *
+ * An iterator over the message history of a conversation, from the newest
+ * message to the oldest. It is usually allocated on the stack and set up with
+ * purple_conversation_message_history_iter_init().
+ */
+struct _PurpleConversationMessageHistoryIter
+{
+	/*< private >*/
+	PurpleConversation *conv;
+	guint position;
+};
+
 G_BEGIN_DECLS
 
 /**************************************************************************/
@@ -554,17 +570,73 @@ gboolean purple_conversation_has_focus(PurpleConversation *conv);
 void purple_conversation_update(PurpleConversation *conv, PurpleConversationUpdateType type);
 
 /**
- * purple_conversation_get_message_history:
+ * purple_conversation_set_message_history_limit:
+ * @conv:   The conversation
+ * @limit:  The maximum number of messages, or 0 for no limit
+ *
+ * Sets how many messages the history of a conversation keeps. Once it is
+ * full, the oldest message is dropped for each new one. It defaults to the
+ * /purple/conversations/message_history_limit preference, and changing that
+ * preference sets it for every open conversation.
+ */
+void purple_conversation_set_message_history_limit(PurpleConversation *conv,
+		guint limit);
+
+/**
+ * purple_conversation_get_message_history_limit:
  * @conv:   The conversation
  *
- * Retrieve the message history of a conversation.
+ * Gets how many messages the history of a conversation keeps.
+ *
+ * Returns: The maximum number of messages, or 0 if there is no limit.
+ */
+guint purple_conversation_get_message_history_limit(PurpleConversation *conv);
+
+/**
+ * purple_conversation_get_message_history_length:
+ * @conv:   The conversation
+ *
+ * Gets the number of messages in the history of a conversation.
+ *
+ * Returns: The number of messages.
+ */
+guint purple_conversation_get_message_history_length(PurpleConversation *conv);
+
+/**
+ * purple_conversation_get_message_history_nth:
+ * @conv:   The conversation
+ * @n:      The position of the message, 0 being the newest one
+ *
+ * Retrieves a message from the history of a conversation.
+ *
+ * Returns: (transfer none): The message, or %NULL if the history is shorter.
+ */
+PurpleMessage *purple_conversation_get_message_history_nth(
+		PurpleConversation *conv, guint n);
+
+/**
+ * purple_conversation_message_history_iter_init:
+ * @iter:   An uninitialized #PurpleConversationMessageHistoryIter
+ * @conv:   The conversation
+ *
+ * Initializes an iterator over the message history of a conversation. The
+ * history must not be changed while iterating.
+ */
+void purple_conversation_message_history_iter_init(
+		PurpleConversationMessageHistoryIter *iter,
+		PurpleConversation *conv);
+
+/**
+ * purple_conversation_message_history_iter_next:
+ * @iter:   The iterator
+ * @msg:    (out) (transfer none) (optional): The next message
+ *
+ * Advances the iterator to the next (older) message in the history.
  *
- * Returns: (element-type PurpleMessage) (transfer none):
- *          A GList of PurpleMessage's. You must not modify the
- *          list or the data within. The list contains the newest message at
- *          the beginning, and the oldest message at the end.
+ * Returns: %FALSE if the end of the history was reached.
  */
-GList *purple_conversation_get_message_history(PurpleConversation *conv);
+gboolean purple_conversation_message_history_iter_next(
+		PurpleConversationMessageHistoryIter *iter, PurpleMessage **msg);
 
 /**
  * purple_conversation_clear_message_history:
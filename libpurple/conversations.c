@@ -33,6 +33,8 @@ static PurpleConversationUiOps *default_ops = NULL;
  */
 static GHashTable *conversation_cache = NULL;
 
+static gulong signal_ids[PURPLE_CONVERSATIONS_SIGNAL_COUNT];
+
 struct _purple_hconv {
 	gboolean im;
 	char *name;
@@ -255,6 +257,17 @@ purple_conversations_get_handle(void)
 	return &handle;
 }
 
+static void
+message_history_limit_pref_cb(const char *name, PurplePrefType type,
+		gconstpointer value, gpointer data)
+{
+	guint limit = MAX(GPOINTER_TO_INT(value), 0);
+	GList *l;
+
+	for (l = conversations; l != NULL; l = l->next)
+		purple_conversation_set_message_history_limit(l->data, limit);
+}
+
 void
 purple_conversations_init(void)
 {
@@ -270,6 +283,10 @@ purple_conversations_init(void)
 
 	/* Conversations */
 	purple_prefs_add_none("/purple/conversations");
+	purple_prefs_add_int("/purple/conversations/message_history_limit", 1000);
+	purple_prefs_connect_callback(handle,
+		"/purple/conversations/message_history_limit",
+		message_history_limit_pref_cb, NULL);
 
 	/* Conversations -> Chat */
 	purple_prefs_add_none("/purple/conversations/chat");
@@ -309,7 +326,8 @@ purple_conversations_init(void)
 		purple_marshal_VOID__POINTER_POINTER, G_TYPE_NONE,
 		2, PURPLE_TYPE_ACCOUNT, PURPLE_TYPE_MESSAGE);
 
-	purple_signal_register(handle, "receiving-im-msg",
+	signal_ids[PURPLE_CONVERSATIONS_SIGNAL_RECEIVING_IM_MSG] =
+		purple_signal_register(handle, "receiving-im-msg",
 						 purple_marshal_BOOLEAN__POINTER_POINTER_POINTER_POINTER_POINTER,
 						 G_TYPE_BOOLEAN, 5, PURPLE_TYPE_ACCOUNT,
 						 G_TYPE_POINTER, /* pointer to a string */
@@ -317,7 +335,8 @@ purple_conversations_init(void)
 						 PURPLE_TYPE_IM_CONVERSATION,
 						 G_TYPE_POINTER); /* pointer to a string */
 
-	purple_signal_register(handle, "received-im-msg",
+	signal_ids[PURPLE_CONVERSATIONS_SIGNAL_RECEIVED_IM_MSG] =
+		purple_signal_register(handle, "received-im-msg",
 						 purple_marshal_VOID__POINTER_POINTER_POINTER_POINTER_UINT,
 						 G_TYPE_NONE, 5, PURPLE_TYPE_ACCOUNT, G_TYPE_STRING,
 						 G_TYPE_STRING, PURPLE_TYPE_IM_CONVERSATION, G_TYPE_UINT);
@@ -343,7 +362,8 @@ purple_conversations_init(void)
 		purple_marshal_VOID__POINTER_POINTER_UINT, G_TYPE_NONE,
 		3, PURPLE_TYPE_ACCOUNT, PURPLE_TYPE_MESSAGE, G_TYPE_UINT);
 
-	purple_signal_register(handle, "receiving-chat-msg",
+	signal_ids[PURPLE_CONVERSATIONS_SIGNAL_RECEIVING_CHAT_MSG] =
+		purple_signal_register(handle, "receiving-chat-msg",
 						 purple_marshal_BOOLEAN__POINTER_POINTER_POINTER_POINTER_POINTER,
 						 G_TYPE_BOOLEAN, 5, PURPLE_TYPE_ACCOUNT,
 						 G_TYPE_POINTER, /* pointer to a string */
@@ -351,7 +371,8 @@ purple_conversations_init(void)
 						 PURPLE_TYPE_CHAT_CONVERSATION,
 						 G_TYPE_POINTER); /* pointer to an unsigned int */
 
-	purple_signal_register(handle, "received-chat-msg",
+	signal_ids[PURPLE_CONVERSATIONS_SIGNAL_RECEIVED_CHAT_MSG] =
+		purple_signal_register(handle, "received-chat-msg",
 						 purple_marshal_VOID__POINTER_POINTER_POINTER_POINTER_UINT,
 						 G_TYPE_NONE, 5, PURPLE_TYPE_ACCOUNT, G_TYPE_STRING,
 						 G_TYPE_STRING, PURPLE_TYPE_CHAT_CONVERSATION, G_TYPE_UINT);
@@ -368,15 +389,18 @@ purple_conversations_init(void)
 						 purple_marshal_VOID__POINTER, G_TYPE_NONE, 1,
 						 PURPLE_TYPE_CONVERSATION);
 
-	purple_signal_register(handle, "buddy-typing",
+	signal_ids[PURPLE_CONVERSATIONS_SIGNAL_BUDDY_TYPING] =
+		purple_signal_register(handle, "buddy-typing",
 						 purple_marshal_VOID__POINTER_POINTER, G_TYPE_NONE, 2,
 						 PURPLE_TYPE_ACCOUNT, G_TYPE_STRING);
 
-	purple_signal_register(handle, "buddy-typed",
+	signal_ids[PURPLE_CONVERSATIONS_SIGNAL_BUDDY_TYPED] =
+		purple_signal_register(handle, "buddy-typed",
 						 purple_marshal_VOID__POINTER_POINTER, G_TYPE_NONE, 2,
 						 PURPLE_TYPE_ACCOUNT, G_TYPE_STRING);
 
-	purple_signal_register(handle, "buddy-typing-stopped",
+	signal_ids[PURPLE_CONVERSATIONS_SIGNAL_BUDDY_TYPING_STOPPED] =
+		purple_signal_register(handle, "buddy-typing-stopped",
 						 purple_marshal_VOID__POINTER_POINTER, G_TYPE_NONE, 2,
 						 PURPLE_TYPE_ACCOUNT, G_TYPE_STRING);
 
@@ -390,6 +414,12 @@ purple_conversations_init(void)
 						 G_TYPE_NONE, 4, PURPLE_TYPE_CHAT_CONVERSATION,
 						 G_TYPE_STRING, G_TYPE_UINT, G_TYPE_BOOLEAN);
 
+	purple_signal_register(handle, "chat-users-joined",
+						 purple_marshal_VOID__POINTER_POINTER_UINT,
+						 G_TYPE_NONE, 3, PURPLE_TYPE_CHAT_CONVERSATION,
+						 G_TYPE_POINTER, /* GList of PurpleChatUser */
+						 G_TYPE_BOOLEAN);
+
 	purple_signal_register(handle, "chat-user-flags",
 						 purple_marshal_VOID__POINTER_UINT_UINT, G_TYPE_NONE, 3,
 						 PURPLE_TYPE_CHAT_USER, G_TYPE_UINT, G_TYPE_UINT);
@@ -404,6 +434,12 @@ purple_conversations_init(void)
 						 G_TYPE_NONE, 3, PURPLE_TYPE_CHAT_CONVERSATION,
 						 G_TYPE_STRING, G_TYPE_STRING);
 
+	purple_signal_register(handle, "chat-users-left",
+						 purple_marshal_VOID__POINTER_POINTER_POINTER,
+						 G_TYPE_NONE, 3, PURPLE_TYPE_CHAT_CONVERSATION,
+						 G_TYPE_POINTER, /* GList of names */
+						 G_TYPE_STRING);
+
 	purple_signal_register(handle, "deleting-chat-user",
 						 purple_marshal_VOID__POINTER, G_TYPE_NONE, 1,
 						 PURPLE_TYPE_CHAT_USER);
@@ -464,5 +500,15 @@ purple_conversations_uninit(void)
 		g_object_unref(G_OBJECT(conversations->data));
 
 	g_hash_table_destroy(conversation_cache);
+	purple_prefs_disconnect_by_handle(purple_conversations_get_handle());
 	purple_signals_unregister_by_instance(purple_conversations_get_handle());
+	memset(signal_ids, 0, sizeof(signal_ids));
+}
+
+gulong
+_purple_conversations_get_signal_id(PurpleConversationsSignal signal)
+{
+	g_return_val_if_fail(signal < PURPLE_CONVERSATIONS_SIGNAL_COUNT, 0);
+
+	return signal_ids[signal];
 }
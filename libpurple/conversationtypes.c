@@ -49,12 +49,15 @@ typedef struct _PurpleChatUserPrivate  PurpleChatUserPrivate;
 struct _PurpleChatConversationPrivate
 {
 	GList *ignored;     /* Ignored users.                            */
+	GHashTable *ignored_keys; /* Queues of the ignored users matching
+	                             each casefolded key, in list order. */
 	char  *who;         /* The person who set the topic.             */
 	char  *topic;       /* The topic.                                */
 	int    id;          /* The chat ID.                              */
 	char *nick;         /* Your nick in this chat.                   */
 	gboolean left;      /* We left the chat and kept the window open */
 	GHashTable *users;  /* Hash table of the users in the room.      */
+	GSequence *sorted;  /* The users in the room, in display order.  */
 };
 
 /* Chat Property enums */
@@ -102,11 +105,17 @@ struct _PurpleChatUserPrivate
 	                                  sorted, or @c NULL if the user should be
 	                                  sorted by its @name.
 	                                  (This is currently always NULL.       */
+	char *sort_key;                /* The collation key of whichever of
+	                                  alias_key or name this user is sorted
+	                                  by.                                   */
 	gboolean buddy;                /* TRUE if this chat participant is on
 	                                  the buddy list; FALSE otherwise.      */
 	PurpleChatUserFlags flags;     /* A bitwise OR of flags for this
 	                                  participant, such as whether they
 	                                  are a channel operator.               */
+	GSequenceIter *sorted;         /* The position of this participant in
+	                                  the chat's sorted user index, or NULL
+	                                  if they are not in the room.          */
 };
 
 /* Chat User Property enums */
@@ -590,6 +599,11 @@ _purple_conversation_user_hash(gconstpointer data)
 	gchar *collated;
 	guint hash;
 
+	/* A name which isn't valid UTF-8 has no collation key, and is only
+	 * equal to itself. */
+	if (!g_utf8_validate(name, -1, NULL))
+		return g_str_hash(name);
+
 	collated = g_utf8_collate_key(name, -1);
 	hash     = g_str_hash(collated);
 	g_free(collated);
@@ -599,9 +613,119 @@ _purple_conversation_user_hash(gconstpointer data)
 static gboolean
 _purple_conversation_user_equal(gconstpointer a, gconstpointer b)
 {
+	if (!g_utf8_validate(a, -1, NULL) || !g_utf8_validate(b, -1, NULL))
+		return g_str_equal(a, b);
+
 	return !g_utf8_collate(a, b);
 }
 
+static gint
+_purple_conversation_user_sort(gconstpointer a, gconstpointer b, gpointer data)
+{
+	return purple_chat_user_compare((PurpleChatUser *)a, (PurpleChatUser *)b);
+}
+
+/* Drops a user from the sorted index as it leaves the users table. */
+static void
+_purple_conversation_user_free(gpointer data)
+{
+	PurpleChatUserPrivate *priv = PURPLE_CHAT_USER_GET_PRIVATE(data);
+
+	if (priv->sorted != NULL) {
+		g_sequence_remove(priv->sorted);
+		priv->sorted = NULL;
+	}
+
+	g_object_unref(data);
+}
+
+/*
+ * Returns a key that compares with strcmp() the way purple_utf8_strcasecmp()
+ * compares the names themselves, or NULL if the name is not valid UTF-8.
+ */
+static gchar *
+_purple_conversation_casefold_key(const char *name)
+{
+	gchar *folded, *key;
+
+	if (!g_utf8_validate(name, -1, NULL))
+		return NULL;
+
+	folded = g_utf8_casefold(name, -1);
+	key = g_utf8_collate_key(folded, -1);
+	g_free(folded);
+
+	return key;
+}
+
+/*
+ * Adds an entry of the ignore list to the queue for the key of name, or
+ * takes it out again.  Entries are added in list order, so that, as with a
+ * linear scan, the first matching entry is at the head.
+ */
+static void
+_purple_conversation_ignored_update(GHashTable *keys, const char *name,
+		const char *ign, gboolean add)
+{
+	gchar *key = _purple_conversation_casefold_key(name);
+	GQueue *entries;
+
+	if (key == NULL)
+		return;
+
+	entries = g_hash_table_lookup(keys, key);
+	if (add) {
+		if (entries == NULL) {
+			entries = g_queue_new();
+			g_hash_table_insert(keys, key, entries);
+			key = NULL;
+		}
+		g_queue_push_tail(entries, (gpointer)ign);
+	} else if (entries != NULL) {
+		g_queue_remove(entries, ign);
+		if (g_queue_is_empty(entries))
+			g_hash_table_remove(keys, key);
+	}
+
+	g_free(key);
+}
+
+/*
+ * Adds the keys of one entry of the ignore list to the lookup table, or
+ * removes them.  An entry also matches the bare name behind its '+', '%',
+ * '@' or '@+' prefix.
+ */
+static void
+_purple_conversation_ignored_update_keys(PurpleChatConversationPrivate *priv,
+		const char *ign, gboolean add)
+{
+	if (*ign == '@') {
+		if (ign[1] == '+')
+			_purple_conversation_ignored_update(priv->ignored_keys,
+					ign + 2, ign + 1, add);
+		else
+			_purple_conversation_ignored_update(priv->ignored_keys,
+					ign + 1, ign + 1, add);
+	} else if (*ign == '+' || *ign == '%') {
+		_purple_conversation_ignored_update(priv->ignored_keys,
+				ign + 1, ign, add);
+	}
+
+	_purple_conversation_ignored_update(priv->ignored_keys, ign, ign, add);
+}
+
+/* Rebuilds the lookup table for a whole new ignore list. */
+static void
+_purple_conversation_ignored_rebuild(PurpleChatConversationPrivate *priv)
+{
+	GList *l;
+
+	g_hash_table_remove_all(priv->ignored_keys);
+
+	for (l = priv->ignored; l != NULL; l = l->next)
+		_purple_conversation_ignored_update_keys(priv, l->data, TRUE);
+}
+
 GList *
 purple_chat_conversation_get_users(const PurpleChatConversation *chat)
 {
@@ -622,6 +746,24 @@ purple_chat_conversation_get_users_count(const PurpleChatConversation *chat)
 	return g_hash_table_size(priv->users);
 }
 
+GList *
+purple_chat_conversation_get_sorted_users(const PurpleChatConversation *chat)
+{
+	PurpleChatConversationPrivate *priv = PURPLE_CHAT_CONVERSATION_GET_PRIVATE(chat);
+	GSequenceIter *iter;
+	GList *users = NULL;
+
+	g_return_val_if_fail(priv != NULL, NULL);
+
+	iter = g_sequence_get_end_iter(priv->sorted);
+	while (!g_sequence_iter_is_begin(iter)) {
+		iter = g_sequence_iter_prev(iter);
+		users = g_list_prepend(users, g_sequence_get(iter));
+	}
+
+	return users;
+}
+
 void
 purple_chat_conversation_ignore(PurpleChatConversation *chat, const char *name)
 {
@@ -634,28 +776,39 @@ purple_chat_conversation_ignore(PurpleChatConversation *chat, const char *name)
 	if (purple_chat_conversation_is_ignored_user(chat, name))
 		return;
 
-	purple_chat_conversation_set_ignored(chat,
-		g_list_append(priv->ignored, g_strdup(name)));
+	/* Only the new entry's keys change; it goes last, behind any others
+	 * with the same keys. */
+	priv->ignored = g_list_append(priv->ignored, g_strdup(name));
+	_purple_conversation_ignored_update_keys(priv,
+		g_list_last(priv->ignored)->data, TRUE);
 }
 
 void
 purple_chat_conversation_unignore(PurpleChatConversation *chat, const char *name)
 {
 	GList *item;
+	const char *ign;
 	PurpleChatConversationPrivate *priv = PURPLE_CHAT_CONVERSATION_GET_PRIVATE(chat);
 
 	g_return_if_fail(priv != NULL);
 	g_return_if_fail(name != NULL);
 
 	/* Make sure the user is actually ignored. */
-	if (!purple_chat_conversation_is_ignored_user(chat, name))
+	ign = purple_chat_conversation_get_ignored_user(chat, name);
+	if (ign == NULL)
 		return;
 
-	item = g_list_find(purple_chat_conversation_get_ignored(chat),
-					   purple_chat_conversation_get_ignored_user(chat, name));
+	/* The match is either an entry or the bare name behind its prefix. */
+	for (item = priv->ignored; item != NULL; item = item->next) {
+		const char *entry = item->data;
 
-	purple_chat_conversation_set_ignored(chat,
-		g_list_remove_link(priv->ignored, item));
+		if (ign == entry || ign == entry + 1)
+			break;
+	}
+	g_return_if_fail(item != NULL);
+
+	_purple_conversation_ignored_update_keys(priv, item->data, FALSE);
+	priv->ignored = g_list_remove_link(priv->ignored, item);
 
 	g_free(item->data);
 	g_list_free_1(item);
@@ -669,6 +822,8 @@ purple_chat_conversation_set_ignored(PurpleChatConversation *chat, GList *ignore
 	g_return_val_if_fail(priv != NULL, NULL);
 
 	priv->ignored = ignored;
+	_purple_conversation_ignored_rebuild(priv);
+
 	return ignored;
 }
 
@@ -685,31 +840,26 @@ purple_chat_conversation_get_ignored(const PurpleChatConversation *chat)
 const char *
 purple_chat_conversation_get_ignored_user(const PurpleChatConversation *chat, const char *user)
 {
-	GList *ignored;
+	PurpleChatConversationPrivate *priv = PURPLE_CHAT_CONVERSATION_GET_PRIVATE(chat);
+	GQueue *entries;
+	const char *ign;
+	gchar *key;
 
-	g_return_val_if_fail(PURPLE_IS_CHAT_CONVERSATION(chat), NULL);
+	g_return_val_if_fail(priv != NULL, NULL);
 	g_return_val_if_fail(user != NULL, NULL);
 
-	for (ignored = purple_chat_conversation_get_ignored(chat);
-		 ignored != NULL;
-		 ignored = ignored->next) {
-
-		const char *ign = (const char *)ignored->data;
+	if (priv->ignored == NULL)
+		return NULL;
 
-		if (!purple_utf8_strcasecmp(user, ign) ||
-			((*ign == '+' || *ign == '%') && !purple_utf8_strcasecmp(user, ign + 1)))
-			return ign;
+	key = _purple_conversation_casefold_key(user);
+	if (key == NULL)
+		return NULL;
 
-		if (*ign == '@') {
-			ign++;
+	entries = g_hash_table_lookup(priv->ignored_keys, key);
+	ign = entries ? g_queue_peek_head(entries) : NULL;
+	g_free(key);
 
-			if ((*ign == '+' && !purple_utf8_strcasecmp(user, ign + 1)) ||
-				(*ign != '+' && !purple_utf8_strcasecmp(user, ign)))
-				return ign;
-		}
-	}
-
-	return NULL;
+	return ign;
 }
 
 gboolean
@@ -825,6 +975,24 @@ chat_conversation_write_message(PurpleConversation *conv, PurpleMessage *msg)
 	_purple_conversation_write_common(conv, msg);
 }
 
+/*
+ * Puts a batch of newly added users in display order.  When the batch is the
+ * whole room, as it is right after joining, the index already holds that
+ * order and no comparisons are needed.
+ */
+static GList *
+chat_conversation_sort_users(PurpleChatConversation *chat, GList *users)
+{
+	PurpleChatConversationPrivate *priv = PURPLE_CHAT_CONVERSATION_GET_PRIVATE(chat);
+
+	if (g_list_length(users) != (guint)g_sequence_get_length(priv->sorted))
+		return g_list_sort(users, (GCompareFunc)purple_chat_user_compare);
+
+	g_list_free(users);
+
+	return purple_chat_conversation_get_sorted_users(chat);
+}
+
 void
 purple_chat_conversation_add_user(PurpleChatConversation *chat, const char *user,
 						const char *extra_msg, PurpleChatUserFlags flags,
@@ -854,6 +1022,8 @@ purple_chat_conversation_add_users(PurpleChatConversation *chat, GList *users, G
 	PurpleProtocol *protocol;
 	GList *ul, *fl;
 	GList *cbuddies = NULL;
+	void *handle;
+	gboolean joining, joined;
 
 	priv = PURPLE_CHAT_CONVERSATION_GET_PRIVATE(chat);
 
@@ -869,6 +1039,11 @@ purple_chat_conversation_add_users(PurpleChatConversation *chat, GList *users, G
 	protocol = purple_connection_get_protocol(gc);
 	g_return_if_fail(PURPLE_IS_PROTOCOL(protocol));
 
+	/* Look the per-user signals up once rather than for every user. */
+	handle  = purple_conversations_get_handle();
+	joining = purple_signal_has_handlers(handle, "chat-user-joining");
+	joined  = purple_signal_has_handlers(handle, "chat-user-joined");
+
 	ul = users;
 	fl = flags;
 	while ((ul != NULL) && (fl != NULL)) {
@@ -896,8 +1071,8 @@ purple_chat_conversation_add_users(PurpleChatConversation *chat, GList *users, G
 			}
 		}
 
-		quiet = GPOINTER_TO_INT(purple_signal_emit_return_1(purple_conversations_get_handle(),
-						 "chat-user-joining", chat, user, flag)) ||
+		quiet = (joining && GPOINTER_TO_INT(purple_signal_emit_return_1(handle,
+						 "chat-user-joining", chat, user, flag))) ||
 				purple_chat_conversation_is_ignored_user(chat, user);
 
 		chatuser = purple_chat_user_new(chat, user, alias, flag);
@@ -905,6 +1080,9 @@ purple_chat_conversation_add_users(PurpleChatConversation *chat, GList *users, G
 		g_hash_table_replace(priv->users,
 			g_strdup(purple_chat_user_get_name(chatuser)),
 			chatuser);
+		PURPLE_CHAT_USER_GET_PRIVATE(chatuser)->sorted =
+			g_sequence_insert_sorted(priv->sorted, chatuser,
+				_purple_conversation_user_sort, NULL);
 
 		cbuddies = g_list_prepend(cbuddies, chatuser);
 
@@ -927,19 +1105,23 @@ purple_chat_conversation_add_users(PurpleChatConversation *chat, GList *users, G
 			g_free(tmp);
 		}
 
-		purple_signal_emit(purple_conversations_get_handle(),
-						 "chat-user-joined", chat, user, flag, new_arrivals);
+		if (joined)
+			purple_signal_emit(handle, "chat-user-joined",
+					chat, user, flag, new_arrivals);
 		ul = ul->next;
 		fl = fl->next;
 		if (extra_msgs != NULL)
 			extra_msgs = extra_msgs->next;
 	}
 
-	cbuddies = g_list_sort(cbuddies, (GCompareFunc)purple_chat_user_compare);
+	cbuddies = chat_conversation_sort_users(chat, cbuddies);
 
 	if (ops != NULL && ops->chat_add_users != NULL)
 		ops->chat_add_users(chat, cbuddies, new_arrivals);
 
+	purple_signal_emit(handle, "chat-users-joined", chat, cbuddies,
+			new_arrivals);
+
 	g_list_free(cbuddies);
 }
 
@@ -1002,6 +1184,9 @@ purple_chat_conversation_rename_user(PurpleChatConversation *chat, const char *o
 
 	g_hash_table_replace(priv->users,
 		g_strdup(purple_chat_user_get_name(cb)), cb);
+	PURPLE_CHAT_USER_GET_PRIVATE(cb)->sorted =
+		g_sequence_insert_sorted(priv->sorted, cb,
+			_purple_conversation_user_sort, NULL);
 
 	if (ops != NULL && ops->chat_rename_user != NULL)
 		ops->chat_rename_user(chat, old_user, new_user, new_alias);
@@ -1143,6 +1328,9 @@ purple_chat_conversation_remove_users(PurpleChatConversation *chat, GList *users
 
 	if (ops != NULL && ops->chat_remove_users != NULL)
 		ops->chat_remove_users(chat, users);
+
+	purple_signal_emit(purple_conversations_get_handle(), "chat-users-left",
+					 chat, users, reason);
 }
 
 void
@@ -1151,22 +1339,19 @@ purple_chat_conversation_clear_users(PurpleChatConversation *chat)
 	PurpleConversationUiOps *ops;
 	GHashTableIter it;
 	PurpleChatConversationPrivate *priv = PURPLE_CHAT_CONVERSATION_GET_PRIVATE(chat);
+	GList *names = NULL;
 	gchar *name;
 
 	g_return_if_fail(priv != NULL);
 
 	ops = purple_conversation_get_ui_ops(PURPLE_CONVERSATION(chat));
 
-	if (ops != NULL && ops->chat_remove_users != NULL) {
-		GList *names = NULL;
-
-		g_hash_table_iter_init(&it, priv->users);
-		while (g_hash_table_iter_next(&it, (gpointer*)&name, NULL))
-			names = g_list_prepend(names, name);
+	g_hash_table_iter_init(&it, priv->users);
+	while (g_hash_table_iter_next(&it, (gpointer*)&name, NULL))
+		names = g_list_prepend(names, name);
 
+	if (ops != NULL && ops->chat_remove_users != NULL)
 		ops->chat_remove_users(chat, names);
-		g_list_free(names);
-	}
 
 	g_hash_table_iter_init(&it, priv->users);
 	while (g_hash_table_iter_next(&it, (gpointer*)&name, NULL)) {
@@ -1176,6 +1361,11 @@ purple_chat_conversation_clear_users(PurpleChatConversation *chat)
 						 "chat-user-left", chat, name, NULL);
 	}
 
+	if (names != NULL)
+		purple_signal_emit(purple_conversations_get_handle(),
+						 "chat-users-left", chat, names, NULL);
+	g_list_free(names);
+
 	g_hash_table_remove_all(priv->users);
 }
 
@@ -1404,7 +1594,11 @@ static void purple_chat_conversation_init(GTypeInstance *instance, gpointer klas
 			PurpleChatConversation);
 
 	priv->users = g_hash_table_new_full(_purple_conversation_user_hash,
-		_purple_conversation_user_equal, g_free, g_object_unref);
+		_purple_conversation_user_equal, g_free,
+		_purple_conversation_user_free);
+	priv->sorted = g_sequence_new(NULL);
+	priv->ignored_keys = g_hash_table_new_full(g_str_hash, g_str_equal,
+		g_free, (GDestroyNotify)g_queue_free);
 }
 
 /* Called when done constructing */
@@ -1500,10 +1694,16 @@ purple_chat_conversation_finalize(GObject *object)
 	g_hash_table_destroy(priv->users);
 	priv->users = NULL;
 
+	g_sequence_free(priv->sorted);
+	priv->sorted = NULL;
+
 	g_list_foreach(priv->ignored, (GFunc)g_free, NULL);
 	g_list_free(priv->ignored);
 	priv->ignored = NULL;
 
+	g_hash_table_destroy(priv->ignored_keys);
+	priv->ignored_keys = NULL;
+
 	g_free(priv->who);
 	g_free(priv->topic);
 	g_free(priv->nick);
@@ -1674,6 +1874,14 @@ purple_chat_user_compare(PurpleChatUser *a, PurpleChatUser *b)
 		ret = (f1 > f2) ? -1 : 1;
 	} else if (priva->buddy != privb->buddy) {
 		ret = priva->buddy ? -1 : 1;
+	} else if (priva->sort_key && privb->sort_key) {
+		ret = strcmp(priva->sort_key, privb->sort_key);
+	} else if (priva->sort_key || privb->sort_key) {
+		/* names which aren't valid UTF-8 have no key, and go last */
+		ret = priva->sort_key ? -1 : 1;
+	} else if (!g_utf8_validate(user1, -1, NULL) ||
+	           !g_utf8_validate(user2, -1, NULL)) {
+		ret = strcmp(user1, user2);
 	} else {
 		ret = purple_utf8_strcasecmp(user1, user2);
 	}
@@ -1720,6 +1928,10 @@ purple_chat_user_set_flags(PurpleChatUser *cb,
 	oldflags = priv->flags;
 	priv->flags = flags;
 
+	if (priv->sorted != NULL)
+		g_sequence_sort_changed(priv->sorted,
+				_purple_conversation_user_sort, NULL);
+
 	g_object_notify_by_pspec(G_OBJECT(cb), cu_properties[CU_PROP_FLAGS]);
 
 	ops = purple_conversation_get_ui_ops(PURPLE_CONVERSATION(priv->chat));
@@ -1783,6 +1995,20 @@ purple_chat_user_get_chat(const PurpleChatUser *cb)
 	return priv->chat;
 }
 
+gint
+purple_chat_user_get_index(const PurpleChatUser *cb)
+{
+	PurpleChatUserPrivate *priv;
+	priv = PURPLE_CHAT_USER_GET_PRIVATE(cb);
+
+	g_return_val_if_fail(priv != NULL, -1);
+
+	if (priv->sorted == NULL)
+		return -1;
+
+	return g_sequence_iter_get_position(priv->sorted);
+}
+
 gboolean
 purple_chat_user_is_buddy(const PurpleChatUser *cb)
 {
@@ -1873,6 +2099,10 @@ purple_chat_user_constructed(GObject *object)
 
 	if (purple_blist_find_buddy(account, priv->name) != NULL)
 		priv->buddy = TRUE;
+
+	/* The same key purple_utf8_strcasecmp() compares by, computed once. */
+	priv->sort_key = _purple_conversation_casefold_key(
+			priv->alias_key ? priv->alias_key : priv->name);
 }
 
 /* GObject finalize function */
@@ -1887,6 +2117,7 @@ purple_chat_user_finalize(GObject *object)
 
 	g_free(priv->alias);
 	g_free(priv->alias_key);
+	g_free(priv->sort_key);
 	g_free(priv->name);
 
 	PURPLE_DBUS_UNREGISTER_POINTER(cb);
@@ -397,6 +397,21 @@ GList *purple_chat_conversation_get_users(const PurpleChatConversation *chat);
 guint
 purple_chat_conversation_get_users_count(const PurpleChatConversation *chat);
 
+/**
+ * purple_chat_conversation_get_sorted_users:
+ * @chat: The chat.
+ *
+ * Returns the users in the chat room in the order they should be displayed:
+ * more important users first, then buddies, then everyone else by name.
+ * The order is kept up to date as users come and go, so this does not sort.
+ *
+ * Returns: (element-type PurpleChatUser) (transfer container):
+ *          The sorted list of users. Use g_list_free() when done
+ *          using the list.
+ */
+GList *
+purple_chat_conversation_get_sorted_users(const PurpleChatConversation *chat);
+
 /**
  * purple_chat_conversation_ignore:
  * @chat: The chat.
@@ -801,6 +816,18 @@ PurpleChatUserFlags purple_chat_user_get_flags(const PurpleChatUser *cb);
  */
 gboolean purple_chat_user_is_buddy(const PurpleChatUser *cb);
 
+/**
+ * purple_chat_user_get_index:
+ * @cb:	The chat user.
+ *
+ * Gets the position of a chat user in the list returned by
+ * purple_chat_conversation_get_sorted_users().  UIs can use this to insert
+ * a new user at the right place without sorting their own list.
+ *
+ * Returns: The position of the user, or -1 if they are no longer in the chat.
+ */
+gint purple_chat_user_get_index(const PurpleChatUser *cb);
+
 G_END_DECLS
 
 #endif /* _PURPLE_CONVERSATION_TYPES_H_ */
@@ -59,6 +59,35 @@ excluded = [
 
     # Similiar to the above:
     "purple_notify_is_valid_ui_handle",
+
+    # These take an iterator allocated by the caller.
+    "purple_conversation_message_history_iter_init",
+    "purple_conversation_message_history_iter_next",
+
+    # This fills in a struct allocated by the caller.
+    "purple_log_get_stats",
+
+    # This takes a GList of logs, like purple_presence_add_list.
+    "purple_log_search",
+
+    # These are for the streams of chunked file transfers, and the chunk
+    # maps they work on aren't objects DBus knows about.
+    "purple_xfer_get_chunk_map",
+    "purple_xfer_write_file_at",
+    "purple_xfer_read_file_at",
+    "purple_xfer_chunk_sent",
+    "purple_xfer_chunk_map_new",
+    "purple_xfer_chunk_map_free",
+    "purple_xfer_chunk_map_claim",
+    "purple_xfer_chunk_map_release",
+    "purple_xfer_chunk_map_mark",
+    "purple_xfer_chunk_map_get_completed_size",
+    "purple_xfer_chunk_map_is_complete",
+    "purple_xfer_chunk_map_save",
+    "purple_xfer_chunk_map_load",
+
+    # This takes a callback to call for each debug message.
+    "purple_debug_ring_buffer_foreach",
 ]
 
 # This is a list of functions that return a GList* or GSList * whose elements
@@ -95,7 +124,6 @@ constlists = [
     "purple_savedstatuses_get_all",
     "purple_status_type_get_attrs",
     "purple_presence_get_statuses",
-    "purple_conversation_get_message_history",
 ]
 
 pointer = "#pointer#"
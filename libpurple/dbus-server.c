@@ -36,14 +36,18 @@
 #include <string.h>
 
 #include "account.h"
+#include "accounts.h"
 #include "buddylist.h"
 #include "conversation.h"
+#include "conversations.h"
+#include "conversationtypes.h"
 #include "dbus-purple.h"
 #include "dbus-server.h"
 #include "dbus-useful.h"
 #include "dbus-bindings.h"
 #include "debug.h"
 #include "core.h"
+#include "eventloop.h"
 #include "savedstatuses.h"
 #include "smiley.h"
 #include "smiley-list.h"
@@ -75,6 +79,77 @@ static GHashTable *map_id_type;
 static gchar *init_error;
 static int dbus_request_name_reply = DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER;
 
+/*
+ * The methods of each registered bindings array, by name, so that a method
+ * call is found with a single lookup.  They are built when an array is
+ * registered, and kept by the address of the (static) array.
+ */
+static GHashTable *bindings_indexes;
+
+/*
+ * The match rules other connections added on the bus, so that signals
+ * nobody listens to aren't built and sent at all.  Only rules that can match
+ * our signals are kept.  If the bus doesn't let us see the rules,
+ * match_rules_tracked stays FALSE and every signal is sent.
+ *
+ * Monitors (dbus-monitor and the like) don't use AddMatch, so the rules
+ * they pass to BecomeMonitor are counted instead, and one without any
+ * counts as matching everything.  A monitor that was already running when
+ * we started is only seen if the bus lists its rules in GetAllMatchRules.
+ */
+#define PURPLE_DBUS_MATCH_RULES_TIMEOUT 1000
+#define PURPLE_DBUS_INTERFACE_MONITORING "org.freedesktop.DBus.Monitoring"
+
+/* What we ask the bus to tell us about, to keep track of the rules */
+static const char *match_rules_watches[] = {
+	"type='signal',sender='" DBUS_SERVICE_DBUS "',"
+	"interface='" DBUS_INTERFACE_DBUS "',member='NameOwnerChanged'",
+	"eavesdrop='true',type='method_call',"
+	"destination='" DBUS_SERVICE_DBUS "',"
+	"interface='" DBUS_INTERFACE_DBUS "',member='AddMatch'",
+	"eavesdrop='true',type='method_call',"
+	"destination='" DBUS_SERVICE_DBUS "',"
+	"interface='" DBUS_INTERFACE_DBUS "',member='RemoveMatch'",
+	"eavesdrop='true',type='method_call',"
+	"destination='" DBUS_SERVICE_DBUS "',"
+	"interface='" PURPLE_DBUS_INTERFACE_MONITORING "',member='BecomeMonitor'"
+};
+
+typedef struct {
+	char *rule;
+	char *member;   /* NULL if the rule matches every signal */
+} PurpleDBusMatchRule;
+
+static gboolean match_rules_tracked = FALSE;
+static GHashTable *match_rules_clients;  /* unique name -> GList of rules */
+static GHashTable *match_rules_members;  /* member -> number of rules */
+static guint match_rules_any = 0;        /* rules without a member */
+
+/* purple signal name -> D-Bus signal name */
+static GHashTable *signal_names;
+
+/*
+ * The buddies that changed since the last BuddiesChanged signal, by D-Bus
+ * ID so that a buddy that is freed in the meantime is simply skipped, and
+ * the IDs of the buddies that were removed.  Changes are collected for a
+ * while and sent together, and only while someone listens for them.
+ */
+#define PURPLE_DBUS_BUDDIES_CHANGED_DELAY 250
+
+/* The structs the bulk queries return, BuddiesChanged sends buddy ones:
+ *   buddy: ID, account ID, group, name, alias, online, status ID, status
+ *          message, idle since (0 if not idle)
+ *   account: ID, username, protocol ID, connected, status ID
+ *   conversation: ID, account ID, is a chat, name, title
+ */
+#define PURPLE_DBUS_BUDDY_INFO "(iisssbssx)"
+#define PURPLE_DBUS_ACCOUNT_INFO "(issbs)"
+#define PURPLE_DBUS_CONVERSATION_INFO "(iibss)"
+
+static GHashTable *changed_buddies;
+static GArray *removed_buddies;
+static guint buddies_changed_timer = 0;
+
 gboolean purple_dbus_is_owner(void)
 {
 	return(DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER == dbus_request_name_reply);
@@ -419,10 +494,12 @@ purple_dbus_dispatch_cb(DBusConnection *connection,
 		DBusMessage *message, void *user_data)
 {
 	const char *name;
-	PurpleDBusBinding *bindings;
-	int i;
+	GHashTable *index;
+	PurpleDBusBinding *binding;
+	DBusMessage *reply;
+	DBusError error;
 
-	bindings = (PurpleDBusBinding*) user_data;
+	index = (GHashTable *)user_data;
 
 	if (!dbus_message_has_path(message, PURPLE_DBUS_PATH))
 		return FALSE;
@@ -435,30 +512,54 @@ purple_dbus_dispatch_cb(DBusConnection *connection,
 	if (dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_METHOD_CALL)
 		return FALSE;
 
-	for (i = 0; bindings[i].name; i++)
-		if (!strcmp(name, bindings[i].name))
-		{
-			DBusMessage *reply;
-			DBusError error;
+	binding = g_hash_table_lookup(index, name);
+	if (binding == NULL)
+		return FALSE;
 
-			dbus_error_init(&error);
+	dbus_error_init(&error);
 
-			reply = bindings[i].handler(message, &error);
+	reply = binding->handler(message, &error);
 
-			if (reply == NULL && dbus_error_is_set(&error))
-				reply = dbus_message_new_error (message,
-						error.name, error.message);
+	if (reply == NULL && dbus_error_is_set(&error))
+		reply = dbus_message_new_error (message,
+				error.name, error.message);
 
-			if (reply != NULL)
-			{
-				dbus_connection_send(connection, reply, NULL);
-				dbus_message_unref(reply);
-			}
+	if (reply != NULL)
+	{
+		dbus_connection_send(connection, reply, NULL);
+		dbus_message_unref(reply);
+	}
 
-			return TRUE; /* return reply! */
-		}
+	return TRUE; /* return reply! */
+}
 
-	return FALSE;
+static GHashTable *
+purple_dbus_bindings_index(PurpleDBusBinding *bindings)
+{
+	GHashTable *index;
+	int i;
+
+	if (bindings_indexes == NULL)
+		bindings_indexes = g_hash_table_new_full(g_direct_hash,
+				g_direct_equal, NULL, (GDestroyNotify)g_hash_table_destroy);
+
+	index = g_hash_table_lookup(bindings_indexes, bindings);
+	if (index == NULL) {
+		index = g_hash_table_new(g_str_hash, g_str_equal);
+		g_hash_table_insert(bindings_indexes, bindings, index);
+	} else {
+		/* The array may be a plugin's that was unloaded and loaded
+		 * again, so it's rebuilt every time it is registered. */
+		g_hash_table_remove_all(index);
+	}
+
+	/* if a name is bound twice, the first binding wins */
+	for (i = 0; bindings[i].name; i++)
+		if (!g_hash_table_contains(index, bindings[i].name))
+			g_hash_table_insert(index, (gpointer)bindings[i].name,
+					&bindings[i]);
+
+	return index;
 }
 
 
@@ -539,6 +640,12 @@ static DBusMessage *purple_dbus_introspect(DBusMessage *message)
 	}
 	g_string_append(str, signals);
 
+	g_string_append(str,
+			"    <signal name='BuddiesChanged'>\n"
+			"      <arg name='changed' type='a" PURPLE_DBUS_BUDDY_INFO "'/>\n"
+			"      <arg name='removed' type='ai'/>\n"
+			"    </signal>\n");
+
 	g_string_append(str, "  </interface>\n</node>\n");
 
 	reply = dbus_message_new_method_return(message);
@@ -577,13 +684,715 @@ purple_dbus_register_bindings(void *handle, PurpleDBusBinding *bindings)
 	purple_signal_connect(purple_dbus_get_handle(), "dbus-method-called",
 			handle,
 			PURPLE_CALLBACK(purple_dbus_dispatch_cb),
-			bindings);
+			purple_dbus_bindings_index(bindings));
 	purple_signal_connect(purple_dbus_get_handle(), "dbus-introspect",
 			handle,
 			PURPLE_CALLBACK(purple_dbus_introspect_cb),
 			bindings);
 }
 
+/**************************************************************************/
+/* Match rules                                                            */
+/**************************************************************************/
+
+/* Checks one key of a match rule against our signals, which are sent by
+ * us, from our path and interface, to nobody in particular. */
+static gboolean
+purple_dbus_match_rule_check(const char *key, const char *value,
+		char **member)
+{
+	const char *unique_name;
+	gsize len;
+
+	if (!strcmp(key, "type"))
+		return !strcmp(value, "signal");
+
+	if (!strcmp(key, "interface"))
+		return !strcmp(value, PURPLE_DBUS_INTERFACE);
+
+	if (!strcmp(key, "path"))
+		return !strcmp(value, PURPLE_DBUS_PATH);
+
+	if (!strcmp(key, "path_namespace")) {
+		len = strlen(value);
+		return !strcmp(value, "/") ||
+			(!strncmp(PURPLE_DBUS_PATH, value, len) &&
+			 (PURPLE_DBUS_PATH[len] == '/' || PURPLE_DBUS_PATH[len] == '\0'));
+	}
+
+	if (!strcmp(key, "sender")) {
+		unique_name = purple_dbus_connection != NULL ?
+			dbus_bus_get_unique_name(purple_dbus_connection) : NULL;
+		return !strcmp(value, PURPLE_DBUS_SERVICE) ||
+			(unique_name != NULL && !strcmp(value, unique_name));
+	}
+
+	if (!strcmp(key, "destination"))
+		return FALSE;
+
+	if (!strcmp(key, "member")) {
+		g_free(*member);
+		*member = g_strdup(value);
+	}
+
+	/* eavesdrop, the arguments and anything else only narrow the rule
+	 * down, so it may still match */
+	return TRUE;
+}
+
+gboolean
+_purple_dbus_match_rule_parse(const char *rule, char **member)
+{
+	GString *key = g_string_new(NULL);
+	GString *value = g_string_new(NULL);
+	const char *p = rule;
+	gboolean matches = TRUE;
+
+	*member = NULL;
+
+	while (*p != '\0' && matches) {
+		g_string_truncate(key, 0);
+		g_string_truncate(value, 0);
+
+		while (*p != '\0' && *p != '=')
+			g_string_append_c(key, *p++);
+		if (*p != '=') {
+			matches = FALSE;
+			break;
+		}
+		p++;
+
+		/* values are quoted with ', and outside of the quotes \' is a
+		 * quote */
+		while (*p != '\0' && *p != ',') {
+			if (*p == '\'') {
+				for (p++; *p != '\0' && *p != '\''; p++)
+					g_string_append_c(value, *p);
+				if (*p != '\0')
+					p++;
+			} else if (p[0] == '\\' && p[1] == '\'') {
+				g_string_append_c(value, '\'');
+				p += 2;
+			} else {
+				g_string_append_c(value, *p++);
+			}
+		}
+		if (*p == ',')
+			p++;
+
+		matches = purple_dbus_match_rule_check(g_strstrip(key->str),
+				value->str, member);
+	}
+
+	g_string_free(key, TRUE);
+	g_string_free(value, TRUE);
+
+	if (!matches) {
+		g_free(*member);
+		*member = NULL;
+	}
+
+	return matches;
+}
+
+static void
+purple_dbus_match_rule_count(PurpleDBusMatchRule *match, int change)
+{
+	int count;
+
+	if (match->member == NULL) {
+		match_rules_any += change;
+		return;
+	}
+
+	count = GPOINTER_TO_INT(g_hash_table_lookup(match_rules_members,
+			match->member)) + change;
+	if (count > 0)
+		g_hash_table_insert(match_rules_members, g_strdup(match->member),
+				GINT_TO_POINTER(count));
+	else
+		g_hash_table_remove(match_rules_members, match->member);
+}
+
+static void
+purple_dbus_match_rule_free(PurpleDBusMatchRule *match)
+{
+	g_free(match->rule);
+	g_free(match->member);
+	g_free(match);
+}
+
+static void
+purple_dbus_match_rule_add(const char *client, const char *rule)
+{
+	PurpleDBusMatchRule *match;
+	char *member;
+	GList *rules;
+
+	if (!_purple_dbus_match_rule_parse(rule, &member))
+		return;
+
+	match = g_new(PurpleDBusMatchRule, 1);
+	match->rule = g_strdup(rule);
+	match->member = member;
+	purple_dbus_match_rule_count(match, 1);
+
+	rules = g_hash_table_lookup(match_rules_clients, client);
+	g_hash_table_insert(match_rules_clients, g_strdup(client),
+			g_list_prepend(rules, match));
+}
+
+static void
+purple_dbus_match_rule_remove(const char *client, const char *rule)
+{
+	GList *rules, *l;
+
+	rules = g_hash_table_lookup(match_rules_clients, client);
+
+	for (l = rules; l != NULL; l = l->next) {
+		PurpleDBusMatchRule *match = l->data;
+
+		if (strcmp(match->rule, rule))
+			continue;
+
+		purple_dbus_match_rule_count(match, -1);
+		purple_dbus_match_rule_free(match);
+
+		rules = g_list_delete_link(rules, l);
+		if (rules != NULL)
+			g_hash_table_insert(match_rules_clients, g_strdup(client), rules);
+		else
+			g_hash_table_remove(match_rules_clients, client);
+		return;
+	}
+}
+
+static void
+purple_dbus_match_rules_remove_client(const char *client)
+{
+	GList *rules, *l;
+
+	rules = g_hash_table_lookup(match_rules_clients, client);
+	if (rules == NULL)
+		return;
+
+	for (l = rules; l != NULL; l = l->next) {
+		purple_dbus_match_rule_count(l->data, -1);
+		purple_dbus_match_rule_free(l->data);
+	}
+	g_list_free(rules);
+
+	g_hash_table_remove(match_rules_clients, client);
+}
+
+static void
+purple_dbus_match_rules_add_monitor(const char *client, DBusMessage *message)
+{
+	DBusMessageIter iter, rules;
+	const char *rule;
+	gboolean any = TRUE;
+
+	if (dbus_message_iter_init(message, &iter) &&
+			dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_ARRAY) {
+		dbus_message_iter_recurse(&iter, &rules);
+
+		while (dbus_message_iter_get_arg_type(&rules) == DBUS_TYPE_STRING) {
+			dbus_message_iter_get_basic(&rules, &rule);
+			purple_dbus_match_rule_add(client, rule);
+			any = FALSE;
+			dbus_message_iter_next(&rules);
+		}
+	}
+
+	/* A monitor without rules sees every message */
+	if (any)
+		purple_dbus_match_rule_add(client, "");
+}
+
+static DBusHandlerResult
+purple_dbus_match_rules_filter(DBusConnection *connection,
+		DBusMessage *message, void *user_data)
+{
+	const char *sender, *rule, *name, *old_owner, *new_owner;
+
+	if (dbus_message_is_signal(message, DBUS_INTERFACE_DBUS,
+			"NameOwnerChanged")) {
+		/* a client that went away takes its rules with it */
+		if (dbus_message_get_args(message, NULL,
+				DBUS_TYPE_STRING, &name,
+				DBUS_TYPE_STRING, &old_owner,
+				DBUS_TYPE_STRING, &new_owner,
+				DBUS_TYPE_INVALID) && *new_owner == '\0')
+			purple_dbus_match_rules_remove_client(name);
+
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+	}
+
+	if (dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_METHOD_CALL ||
+			!dbus_message_has_destination(message, DBUS_SERVICE_DBUS))
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	sender = dbus_message_get_sender(message);
+
+	if (sender != NULL && dbus_message_is_method_call(message,
+			PURPLE_DBUS_INTERFACE_MONITORING, "BecomeMonitor"))
+		purple_dbus_match_rules_add_monitor(sender, message);
+	else if (sender != NULL && dbus_message_get_args(message, NULL,
+			DBUS_TYPE_STRING, &rule, DBUS_TYPE_INVALID)) {
+		if (dbus_message_is_method_call(message, DBUS_INTERFACE_DBUS,
+				"AddMatch"))
+			purple_dbus_match_rule_add(sender, rule);
+		else if (dbus_message_is_method_call(message, DBUS_INTERFACE_DBUS,
+				"RemoveMatch"))
+			purple_dbus_match_rule_remove(sender, rule);
+	}
+
+	/* This was sent to the bus, not to us, so libdbus mustn't answer it
+	 * with an error. */
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static void purple_dbus_match_rules_uninit(void);
+
+static void
+purple_dbus_match_rules_init(void)
+{
+	DBusMessage *message, *reply = NULL;
+	DBusMessageIter iter, clients, entry, rules;
+	DBusError error;
+	gsize added;
+
+	match_rules_tracked = FALSE;
+	match_rules_any = 0;
+	match_rules_clients = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, NULL);
+	match_rules_members = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, NULL);
+
+	dbus_connection_add_filter(purple_dbus_connection,
+			purple_dbus_match_rules_filter, NULL, NULL);
+
+	dbus_error_init(&error);
+
+	for (added = 0; added < G_N_ELEMENTS(match_rules_watches); added++) {
+		dbus_bus_add_match(purple_dbus_connection,
+				match_rules_watches[added], &error);
+		if (dbus_error_is_set(&error))
+			break;
+	}
+
+	/* the rules that were added before we were watching */
+	if (!dbus_error_is_set(&error)) {
+		message = dbus_message_new_method_call(DBUS_SERVICE_DBUS,
+				DBUS_PATH_DBUS, "org.freedesktop.DBus.Debug.Stats",
+				"GetAllMatchRules");
+		reply = dbus_connection_send_with_reply_and_block(
+				purple_dbus_connection, message,
+				PURPLE_DBUS_MATCH_RULES_TIMEOUT, &error);
+		dbus_message_unref(message);
+	}
+
+	if (dbus_error_is_set(&error)) {
+		purple_debug_info("dbus", "Can't track match rules, so every "
+				"signal will be sent: %s\n", error.message);
+		dbus_error_free(&error);
+
+		/* Don't have the bus wake us up for every AddMatch for nothing */
+		while (added > 0)
+			dbus_bus_remove_match(purple_dbus_connection,
+					match_rules_watches[--added], NULL);
+		purple_dbus_match_rules_uninit();
+		return;
+	}
+
+	dbus_message_iter_init(reply, &iter);
+	if (dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_ARRAY) {
+		dbus_message_iter_recurse(&iter, &clients);
+
+		while (dbus_message_iter_get_arg_type(&clients) == DBUS_TYPE_DICT_ENTRY) {
+			const char *client, *rule;
+
+			dbus_message_iter_recurse(&clients, &entry);
+			dbus_message_iter_get_basic(&entry, &client);
+			dbus_message_iter_next(&entry);
+			dbus_message_iter_recurse(&entry, &rules);
+
+			while (dbus_message_iter_get_arg_type(&rules) == DBUS_TYPE_STRING) {
+				dbus_message_iter_get_basic(&rules, &rule);
+				purple_dbus_match_rule_add(client, rule);
+				dbus_message_iter_next(&rules);
+			}
+
+			dbus_message_iter_next(&clients);
+		}
+	}
+	dbus_message_unref(reply);
+
+	match_rules_tracked = TRUE;
+}
+
+static void
+purple_dbus_match_rules_uninit(void)
+{
+	GHashTableIter iter;
+	gpointer client, rules;
+
+	if (match_rules_clients == NULL)
+		return;
+
+	if (match_rules_tracked) {
+		gsize i;
+
+		for (i = 0; i < G_N_ELEMENTS(match_rules_watches); i++)
+			dbus_bus_remove_match(purple_dbus_connection,
+					match_rules_watches[i], NULL);
+	}
+
+	dbus_connection_remove_filter(purple_dbus_connection,
+			purple_dbus_match_rules_filter, NULL);
+
+	g_hash_table_iter_init(&iter, match_rules_clients);
+	while (g_hash_table_iter_next(&iter, &client, &rules))
+		g_list_free_full(rules, (GDestroyNotify)purple_dbus_match_rule_free);
+
+	g_hash_table_destroy(match_rules_clients);
+	match_rules_clients = NULL;
+	g_hash_table_destroy(match_rules_members);
+	match_rules_members = NULL;
+	match_rules_any = 0;
+	match_rules_tracked = FALSE;
+}
+
+/**************************************************************************/
+/* Bulk queries                                                           */
+/**************************************************************************/
+
+/*
+ * Methods that return whole lists of objects with their details in one
+ * message, for clients that would otherwise make a call per object and
+ * detail.
+ */
+
+static void
+purple_dbus_append_string(DBusMessageIter *iter, const char *str)
+{
+	gchar *tmp;
+
+	str = purple_null_to_emptystr(str);
+	if (g_utf8_validate(str, -1, NULL)) {
+		dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &str);
+		return;
+	}
+
+	tmp = purple_utf8_salvage(str);
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &tmp);
+	g_free(tmp);
+}
+
+static void
+purple_dbus_append_id(DBusMessageIter *iter, gconstpointer ptr)
+{
+	dbus_int32_t id = purple_dbus_pointer_to_id(ptr);
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_INT32, &id);
+}
+
+static void
+purple_dbus_append_buddy_info(DBusMessageIter *array, PurpleBuddy *buddy)
+{
+	DBusMessageIter info;
+	PurplePresence *presence = purple_buddy_get_presence(buddy);
+	PurpleStatus *status = purple_presence_get_active_status(presence);
+	PurpleGroup *group = purple_buddy_get_group(buddy);
+	dbus_bool_t online = purple_presence_is_online(presence);
+	dbus_int64_t idle = 0;
+
+	if (purple_presence_is_idle(presence))
+		idle = purple_presence_get_idle_time(presence);
+
+	dbus_message_iter_open_container(array, DBUS_TYPE_STRUCT, NULL, &info);
+	purple_dbus_append_id(&info, buddy);
+	purple_dbus_append_id(&info, purple_buddy_get_account(buddy));
+	purple_dbus_append_string(&info, group ? purple_group_get_name(group) : NULL);
+	purple_dbus_append_string(&info, purple_buddy_get_name(buddy));
+	purple_dbus_append_string(&info, purple_buddy_get_alias(buddy));
+	dbus_message_iter_append_basic(&info, DBUS_TYPE_BOOLEAN, &online);
+	purple_dbus_append_string(&info, status ? purple_status_get_id(status) : NULL);
+	purple_dbus_append_string(&info, status ?
+			purple_status_get_attr_string(status, "message") : NULL);
+	dbus_message_iter_append_basic(&info, DBUS_TYPE_INT64, &idle);
+	dbus_message_iter_close_container(array, &info);
+}
+
+DBusMessage *
+_purple_dbus_get_buddies_info(DBusMessage *message, DBusError *error)
+{
+	DBusMessage *reply;
+	DBusMessageIter iter, array;
+	dbus_int32_t account_ID;
+	PurpleAccount *account;
+	GSList *buddies, *l;
+
+	purple_dbus_message_get_args(message, error, DBUS_TYPE_INT32, &account_ID,
+			DBUS_TYPE_INVALID);
+	CHECK_ERROR(error);
+	PURPLE_DBUS_ID_TO_POINTER(account, account_ID, PurpleAccount, error);
+
+	if (account != NULL)
+		buddies = purple_blist_find_buddies(account, NULL);
+	else
+		buddies = purple_blist_get_buddies();
+
+	reply = dbus_message_new_method_return(message);
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+			PURPLE_DBUS_BUDDY_INFO, &array);
+	for (l = buddies; l != NULL; l = l->next)
+		purple_dbus_append_buddy_info(&array, l->data);
+	dbus_message_iter_close_container(&iter, &array);
+
+	g_slist_free(buddies);
+
+	return reply;
+}
+
+DBusMessage *
+_purple_dbus_get_accounts_info(DBusMessage *message, DBusError *error)
+{
+	DBusMessage *reply;
+	DBusMessageIter iter, array, info;
+	GList *l;
+
+	reply = dbus_message_new_method_return(message);
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+			PURPLE_DBUS_ACCOUNT_INFO, &array);
+
+	for (l = purple_accounts_get_all(); l != NULL; l = l->next) {
+		PurpleAccount *account = l->data;
+		PurpleStatus *status = purple_account_get_active_status(account);
+		dbus_bool_t connected = purple_account_is_connected(account);
+
+		dbus_message_iter_open_container(&array, DBUS_TYPE_STRUCT, NULL, &info);
+		purple_dbus_append_id(&info, account);
+		purple_dbus_append_string(&info, purple_account_get_username(account));
+		purple_dbus_append_string(&info, purple_account_get_protocol_id(account));
+		dbus_message_iter_append_basic(&info, DBUS_TYPE_BOOLEAN, &connected);
+		purple_dbus_append_string(&info, status ? purple_status_get_id(status) : NULL);
+		dbus_message_iter_close_container(&array, &info);
+	}
+
+	dbus_message_iter_close_container(&iter, &array);
+
+	return reply;
+}
+
+DBusMessage *
+_purple_dbus_get_conversations_info(DBusMessage *message, DBusError *error)
+{
+	DBusMessage *reply;
+	DBusMessageIter iter, array, info;
+	GList *l;
+
+	reply = dbus_message_new_method_return(message);
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+			PURPLE_DBUS_CONVERSATION_INFO, &array);
+
+	for (l = purple_conversations_get_all(); l != NULL; l = l->next) {
+		PurpleConversation *conv = l->data;
+		dbus_bool_t chat = PURPLE_IS_CHAT_CONVERSATION(conv);
+
+		dbus_message_iter_open_container(&array, DBUS_TYPE_STRUCT, NULL, &info);
+		purple_dbus_append_id(&info, conv);
+		purple_dbus_append_id(&info, purple_conversation_get_account(conv));
+		dbus_message_iter_append_basic(&info, DBUS_TYPE_BOOLEAN, &chat);
+		purple_dbus_append_string(&info, purple_conversation_get_name(conv));
+		purple_dbus_append_string(&info, purple_conversation_get_title(conv));
+		dbus_message_iter_close_container(&array, &info);
+	}
+
+	dbus_message_iter_close_container(&iter, &array);
+
+	return reply;
+}
+
+static PurpleDBusBinding bulk_bindings[] = {
+	{"PurpleBlistGetBuddiesInfo",
+		"in\0i\0account\0out\0a" PURPLE_DBUS_BUDDY_INFO "\0buddies\0",
+		_purple_dbus_get_buddies_info},
+	{"PurpleAccountsGetAllInfo",
+		"out\0a" PURPLE_DBUS_ACCOUNT_INFO "\0accounts\0",
+		_purple_dbus_get_accounts_info},
+	{"PurpleConversationsGetAllInfo",
+		"out\0a" PURPLE_DBUS_CONVERSATION_INFO "\0conversations\0",
+		_purple_dbus_get_conversations_info},
+	{NULL, NULL, NULL}
+};
+
+/* The tables are only needed once something changed. */
+static void
+purple_dbus_buddies_changed_init(void)
+{
+	if (changed_buddies != NULL)
+		return;
+
+	changed_buddies = g_hash_table_new(g_direct_hash, g_direct_equal);
+	removed_buddies = g_array_new(FALSE, FALSE, sizeof(dbus_int32_t));
+}
+
+void
+_purple_dbus_buddy_changed(PurpleBuddy *buddy)
+{
+	purple_dbus_buddies_changed_init();
+	g_hash_table_add(changed_buddies,
+			GINT_TO_POINTER(purple_dbus_pointer_to_id(buddy)));
+}
+
+void
+_purple_dbus_buddy_removed(PurpleBuddy *buddy)
+{
+	dbus_int32_t id = purple_dbus_pointer_to_id(buddy);
+
+	purple_dbus_buddies_changed_init();
+	g_hash_table_remove(changed_buddies, GINT_TO_POINTER(id));
+	g_array_append_val(removed_buddies, id);
+}
+
+DBusMessage *
+_purple_dbus_buddies_changed_take(void)
+{
+	DBusMessage *signal;
+	DBusMessageIter iter, array;
+	GHashTableIter changed;
+	gpointer id;
+	const dbus_int32_t *removed;
+
+	purple_dbus_buddies_changed_init();
+	removed = (const dbus_int32_t *)removed_buddies->data;
+
+	signal = dbus_message_new_signal(PURPLE_DBUS_PATH,
+			PURPLE_DBUS_INTERFACE, "BuddiesChanged");
+	dbus_message_iter_init_append(signal, &iter);
+
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+			PURPLE_DBUS_BUDDY_INFO, &array);
+	g_hash_table_iter_init(&changed, changed_buddies);
+	while (g_hash_table_iter_next(&changed, &id, NULL)) {
+		PurpleBuddy *buddy = purple_dbus_id_to_pointer(
+				GPOINTER_TO_INT(id), PURPLE_DBUS_TYPE(PurpleBuddy));
+
+		if (buddy != NULL)
+			purple_dbus_append_buddy_info(&array, buddy);
+	}
+	dbus_message_iter_close_container(&iter, &array);
+
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+			DBUS_TYPE_INT32_AS_STRING, &array);
+	dbus_message_iter_append_fixed_array(&array, DBUS_TYPE_INT32,
+			&removed, removed_buddies->len);
+	dbus_message_iter_close_container(&iter, &array);
+
+	g_hash_table_remove_all(changed_buddies);
+	g_array_set_size(removed_buddies, 0);
+
+	return signal;
+}
+
+static gboolean
+purple_dbus_buddies_changed_flush(gpointer data)
+{
+	DBusMessage *signal = _purple_dbus_buddies_changed_take();
+
+	buddies_changed_timer = 0;
+
+	if (purple_dbus_signal_is_subscribed("buddies-changed"))
+		dbus_connection_send(purple_dbus_connection, signal, NULL);
+	dbus_message_unref(signal);
+
+	return FALSE;
+}
+
+static void
+purple_dbus_buddies_changed_schedule(void)
+{
+	if (buddies_changed_timer == 0)
+		buddies_changed_timer = purple_timeout_add(
+				PURPLE_DBUS_BUDDIES_CHANGED_DELAY,
+				purple_dbus_buddies_changed_flush, NULL);
+}
+
+static void
+purple_dbus_buddy_changed_cb(PurpleBlistNode *node)
+{
+	if (!PURPLE_IS_BUDDY(node) ||
+			!purple_dbus_signal_is_subscribed("buddies-changed"))
+		return;
+
+	_purple_dbus_buddy_changed(PURPLE_BUDDY(node));
+	purple_dbus_buddies_changed_schedule();
+}
+
+static void
+purple_dbus_buddy_removed_cb(PurpleBlistNode *node)
+{
+	if (!PURPLE_IS_BUDDY(node) ||
+			!purple_dbus_signal_is_subscribed("buddies-changed"))
+		return;
+
+	_purple_dbus_buddy_removed(PURPLE_BUDDY(node));
+	purple_dbus_buddies_changed_schedule();
+}
+
+/* The buddy list isn't set up yet when we are, so this waits for it. */
+static void
+purple_dbus_bulk_core_initialized_cb(void)
+{
+	void *blist_handle = purple_blist_get_handle();
+	const char *changed_signals[] = {
+		"buddy-status-changed", "buddy-idle-changed", "buddy-signed-on",
+		"buddy-signed-off", "blist-node-added", "blist-node-aliased",
+		"buddy-removed-from-group", NULL
+	};
+	int i;
+
+	for (i = 0; changed_signals[i] != NULL; i++)
+		purple_signal_connect(blist_handle, changed_signals[i],
+				purple_dbus_get_handle(),
+				PURPLE_CALLBACK(purple_dbus_buddy_changed_cb), NULL);
+
+	purple_signal_connect(blist_handle, "blist-node-removed",
+			purple_dbus_get_handle(),
+			PURPLE_CALLBACK(purple_dbus_buddy_removed_cb), NULL);
+}
+
+static void
+purple_dbus_bulk_init(void)
+{
+	purple_dbus_register_bindings(purple_dbus_get_handle(), bulk_bindings);
+
+	purple_signal_connect(purple_get_core(), "core-initialized",
+			purple_dbus_get_handle(),
+			PURPLE_CALLBACK(purple_dbus_bulk_core_initialized_cb), NULL);
+}
+
+static void
+purple_dbus_bulk_uninit(void)
+{
+	if (changed_buddies == NULL)
+		return;
+
+	if (buddies_changed_timer != 0) {
+		purple_timeout_remove(buddies_changed_timer);
+		buddies_changed_timer = 0;
+	}
+
+	g_hash_table_destroy(changed_buddies);
+	changed_buddies = NULL;
+	g_array_free(removed_buddies, TRUE);
+	removed_buddies = NULL;
+}
+
 static void
 purple_dbus_dispatch_init(void)
 {
@@ -626,6 +1435,8 @@ purple_dbus_dispatch_init(void)
 
 	dbus_connection_setup_with_g_main(purple_dbus_connection, NULL);
 
+	purple_dbus_match_rules_init();
+
 	purple_signal_register(purple_dbus_get_handle(), "dbus-method-called",
 			 purple_marshal_BOOLEAN__POINTER_POINTER,
 			 G_TYPE_BOOLEAN, 2, G_TYPE_POINTER, G_TYPE_POINTER);
@@ -635,6 +1446,7 @@ purple_dbus_dispatch_init(void)
 			 G_TYPE_POINTER); /* pointer to a pointer */
 
 	PURPLE_DBUS_REGISTER_BINDINGS(purple_dbus_get_handle());
+	purple_dbus_bulk_init();
 
 	if (purple_debug_is_verbose())
 		purple_debug_misc("dbus", "initialized");
@@ -671,6 +1483,43 @@ purple_dbus_convert_signal_name(const char *purple_name)
 	return g_name;
 }
 
+/* Returns the D-Bus name of a signal, converting it only the first time. */
+static const char *
+purple_dbus_get_signal_name(const char *purple_name)
+{
+	char *name;
+
+	if (signal_names == NULL)
+		signal_names = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, g_free);
+
+	name = g_hash_table_lookup(signal_names, purple_name);
+	if (name == NULL) {
+		name = purple_dbus_convert_signal_name(purple_name);
+		g_hash_table_insert(signal_names, g_strdup(purple_name), name);
+	}
+
+	return name;
+}
+
+gboolean
+purple_dbus_signal_is_subscribed(const char *name)
+{
+	g_return_val_if_fail(name != NULL, FALSE);
+
+	if (purple_dbus_connection == NULL)
+		return FALSE;
+
+	if (!match_rules_tracked || match_rules_any > 0)
+		return TRUE;
+
+	if (g_hash_table_size(match_rules_members) == 0)
+		return FALSE;
+
+	return g_hash_table_contains(match_rules_members,
+			purple_dbus_get_signal_name(name));
+}
+
 #define my_arg(type) (ptr != NULL ? * ((type *)ptr) : va_arg(data, type))
 
 static gboolean
@@ -766,15 +1615,11 @@ purple_dbus_signal_emit_purple(const char *name, int num_values,
 {
 	DBusMessage *signal;
 	DBusMessageIter iter;
-	char *newname;
+	const char *newname;
 
-#if 0 /* this is noisy with no dbus connection */
-	g_return_if_fail(purple_dbus_connection);
-#else
-	if (purple_dbus_connection == NULL)
+	/* this is also FALSE without a dbus connection */
+	if (!purple_dbus_signal_is_subscribed(name))
 		return;
-#endif
-
 
 	/*
 	 * The test below is a hack that prevents our "dbus-method-called"
@@ -785,7 +1630,7 @@ purple_dbus_signal_emit_purple(const char *name, int num_values,
 	if (!strcmp(name, "dbus-method-called"))
 		return;
 
-	newname = purple_dbus_convert_signal_name(name);
+	newname = purple_dbus_get_signal_name(name);
 	signal = dbus_message_new_signal(PURPLE_DBUS_PATH, PURPLE_DBUS_INTERFACE, newname);
 	dbus_message_iter_init_append(signal, &iter);
 
@@ -798,7 +1643,6 @@ purple_dbus_signal_emit_purple(const char *name, int num_values,
 
 	dbus_connection_send(purple_dbus_connection, signal, NULL);
 
-	g_free(newname);
 	dbus_message_unref(signal);
 }
 
@@ -835,9 +1679,14 @@ void
 purple_dbus_uninit(void)
 {
 	DBusError error;
+
+	purple_dbus_bulk_uninit();
+
 	if (!purple_dbus_connection)
 		return;
 
+	purple_dbus_match_rules_uninit();
+
 	dbus_error_init(&error);
 	dbus_connection_unregister_object_path(purple_dbus_connection, PURPLE_DBUS_PATH);
 	dbus_bus_release_name(purple_dbus_connection, PURPLE_DBUS_SERVICE, &error);
@@ -845,6 +1694,14 @@ purple_dbus_uninit(void)
 	dbus_connection_unref(purple_dbus_connection);
 	purple_dbus_connection = NULL;
 	purple_signals_disconnect_by_handle(purple_dbus_get_handle());
+	if (bindings_indexes != NULL) {
+		g_hash_table_destroy(bindings_indexes);
+		bindings_indexes = NULL;
+	}
+	if (signal_names != NULL) {
+		g_hash_table_destroy(signal_names);
+		signal_names = NULL;
+	}
 	g_free(init_error);
 	init_error = NULL;
 }
@@ -29,6 +29,7 @@
  * @see_also: <link linkend="chapter-signals-dbus-server">D-Bus Server signals</link>
  */
 
+#include "buddy.h"
 #include "dbus-purple.h"
 
 G_BEGIN_DECLS
@@ -152,6 +153,19 @@ void purple_dbus_unregister_pointer(gpointer node);
 void purple_dbus_signal_emit_purple(const char *name, int num_values,
 				GType *types, va_list vargs);
 
+/**
+ * purple_dbus_signal_is_subscribed:
+ * @name: The name of the signal ("bla-bla-blaa")
+ *
+ * Checks whether any other connection on the bus has a match rule for a
+ * signal.  If the bus doesn't allow watching the match rules of other
+ * connections, every signal is considered subscribed.
+ *
+ * Returns: TRUE if the signal needs to be sent over DBus, FALSE if nobody
+ *          would receive it.
+ */
+gboolean purple_dbus_signal_is_subscribed(const char *name);
+
 /**
  * purple_dbus_get_init_error:
  *
@@ -201,6 +215,82 @@ void purple_dbus_init(void);
  */
 void purple_dbus_uninit(void);
 
+/**
+ * _purple_dbus_match_rule_parse: (skip)
+ * @rule:   A match rule another connection added on the bus.
+ * @member: Return location for the signal member the rule is for, or
+ *          %NULL if it is for every member.  Free it with g_free().
+ *
+ * Works out whether a match rule can match any of Purple's signals.
+ *
+ * Returns: %TRUE if the rule can match one of our signals.
+ */
+gboolean _purple_dbus_match_rule_parse(const char *rule, char **member);
+
+/**
+ * _purple_dbus_get_buddies_info: (skip)
+ * @message: A PurpleBlistGetBuddiesInfo method call.
+ * @error:   Return location for an error.
+ *
+ * Handles PurpleBlistGetBuddiesInfo, which lists the buddies of an
+ * account, or of every account if the account ID is 0.
+ *
+ * Returns: The reply, or %NULL if @error was set.
+ */
+DBusMessage *_purple_dbus_get_buddies_info(DBusMessage *message,
+		DBusError *error);
+
+/**
+ * _purple_dbus_get_accounts_info: (skip)
+ * @message: A PurpleAccountsGetAllInfo method call.
+ * @error:   Return location for an error.
+ *
+ * Handles PurpleAccountsGetAllInfo, which lists every account.
+ *
+ * Returns: The reply.
+ */
+DBusMessage *_purple_dbus_get_accounts_info(DBusMessage *message,
+		DBusError *error);
+
+/**
+ * _purple_dbus_get_conversations_info: (skip)
+ * @message: A PurpleConversationsGetAllInfo method call.
+ * @error:   Return location for an error.
+ *
+ * Handles PurpleConversationsGetAllInfo, which lists every conversation.
+ *
+ * Returns: The reply.
+ */
+DBusMessage *_purple_dbus_get_conversations_info(DBusMessage *message,
+		DBusError *error);
+
+/**
+ * _purple_dbus_buddy_changed: (skip)
+ * @buddy: The buddy.
+ *
+ * Adds a buddy to the next BuddiesChanged signal.
+ */
+void _purple_dbus_buddy_changed(PurpleBuddy *buddy);
+
+/**
+ * _purple_dbus_buddy_removed: (skip)
+ * @buddy: The buddy, which is about to be freed.
+ *
+ * Adds a buddy's ID to the removed ones of the next BuddiesChanged signal,
+ * and drops it from the changed ones.
+ */
+void _purple_dbus_buddy_removed(PurpleBuddy *buddy);
+
+/**
+ * _purple_dbus_buddies_changed_take: (skip)
+ *
+ * Builds the BuddiesChanged signal for the changes collected so far, and
+ * forgets them.  Buddies that were freed in the meantime are left out.
+ *
+ * Returns: The signal.  Unref it with dbus_message_unref().
+ */
+DBusMessage *_purple_dbus_buddies_changed_take(void);
+
 /**
  * DBUS_EXPORT:
  *
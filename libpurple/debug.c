@@ -23,6 +23,118 @@
 #include "prefs.h"
 #include "util.h"
 
+#include <stddef.h>
+#include <stdint.h>
+
+/* The most arguments a message can have and still be formatted lazily. */
+#define DEBUG_RING_MAX_ARGS 16
+
+/* The longest conversion specification that is formatted lazily. */
+#define DEBUG_RING_MAX_SPEC 32
+
+/* Formats beyond this many are formatted right away instead of being kept
+ * around for the ring buffer, which stops formats that are built at runtime
+ * from growing the format table forever. */
+#define DEBUG_RING_MAX_FORMATS 4096
+#define DEBUG_RING_MAX_CACHED_FORMATS 1024
+
+/* The most rings of exited threads that are kept until they have been read.
+ * Beyond this, the oldest one is dropped to make room. */
+#define DEBUG_RING_MAX_EXITED 64
+
+#define DEBUG_RING_ALIGN(size) (((size) + 7) & ~(gsize)7)
+
+typedef enum
+{
+	DEBUG_ARG_INT,
+	DEBUG_ARG_LONG,
+	DEBUG_ARG_LLONG,
+	DEBUG_ARG_SIZE,
+	DEBUG_ARG_PTRDIFF,
+	DEBUG_ARG_INTMAX,
+	DEBUG_ARG_DOUBLE,
+	DEBUG_ARG_POINTER,
+	DEBUG_ARG_STRING
+} DebugArgType;
+
+/*
+ * A parsed format string.  These are shared by all threads and never freed,
+ * so that records can point at them.
+ */
+typedef struct
+{
+	const char *format;
+	guint n_args;
+	guint8 types[DEBUG_RING_MAX_ARGS];
+
+	/* The precision of string arguments: -1 if there is none, -2 if it is
+	 * taken from the previous argument. */
+	gint precisions[DEBUG_RING_MAX_ARGS];
+} DebugFormat;
+
+typedef union
+{
+	gint i;
+	glong l;
+	long long ll;
+	gsize z;
+	ptrdiff_t t;
+	intmax_t j;
+	gdouble d;
+	gpointer p;
+
+	/* the offset of a string from the start of the record, 0 for NULL */
+	gsize s;
+} DebugArg;
+
+/*
+ * A message in a ring buffer.  The arguments follow the header, then the
+ * category and the string arguments.  A message that could not be recorded
+ * lazily has no format and its text as its only argument.
+ */
+typedef struct
+{
+	guint32 size;  /* 0 marks the unused space at the end of the buffer */
+	guint32 category;
+	guint8 level;
+	guint8 n_args;
+	guint seq;
+	gint64 time;
+	const DebugFormat *format;
+} DebugRecord;
+
+#define DEBUG_RECORD_ARGS(record) ((DebugArg *)((guint8 *)(record) + sizeof(DebugRecord)))
+
+/*
+ * The ring buffer of one thread.  Only the owning thread writes to it, so
+ * logging never takes a lock; readers copy it and use the serial, which is
+ * odd while a record is being written, to check that the copy is whole.
+ */
+typedef struct
+{
+	gint serial;
+	gint generation;
+
+	guint8 *data;
+	gsize size;
+	gsize head;  /* where the next record goes */
+	gsize tail;  /* the oldest record */
+	gsize used;  /* bytes between the tail and the head */
+
+	/* format pointer -> DebugFormat, only used by the owning thread */
+	GHashTable *formats;
+
+	/* The thread that owned it has exited.  Its messages are kept until
+	 * they have been read, and then the ring is handed to a new thread. */
+	gboolean exited;
+} DebugRing;
+
+typedef struct
+{
+	guint seq;
+	const DebugRecord *record;
+} DebugRingEntry;
+
 static PurpleDebugUiOps *debug_ui_ops = NULL;
 
 /*
@@ -47,25 +159,775 @@ static gboolean debug_unsafe = FALSE;
 
 static gboolean debug_colored = FALSE;
 
+/*
+ * The lowest level that is output, and the per-category overrides of it.
+ * These are checked before anything else is done with a message.
+ */
+static PurpleDebugLevel debug_level = PURPLE_DEBUG_ALL;
+static GHashTable *debug_category_levels = NULL;
+static GRWLock debug_category_lock;
+
+static gint debug_ring_enabled = FALSE;
+static gint debug_ring_generation = 0;
+static gsize debug_ring_size = 0;
+static guint debug_ring_seq = 0;
+static guint debug_ring_cleared = 0;
+static void debug_ring_thread_exit(gpointer data);
+static GPrivate debug_ring_private = G_PRIVATE_INIT(debug_ring_thread_exit);
+
+/* Protects the lists of rings and the replacement of their buffers. */
+static GMutex debug_ring_lock;
+static GSList *debug_rings = NULL;
+static GSList *debug_rings_unused = NULL;
+static guint debug_rings_exited = 0;
+
+/* Protects the shared table of parsed formats. */
+static GMutex debug_format_lock;
+static GHashTable *debug_formats = NULL;
+
+/**************************************************************************/
+/* Ring buffer                                                            */
+/**************************************************************************/
+
+/*
+ * Parses the conversion specification at p, which points just past its '%',
+ * and appends the types of the arguments it takes.  Returns the end of the
+ * specification, or NULL if it can't be recorded lazily.
+ */
+static const char *
+debug_format_parse_spec(const char *p, DebugFormat *fmt)
+{
+	const char *start = p;
+	DebugArgType type;
+	gint precision = -1;
+	int longs = 0;
+	gboolean big_l = FALSE, j = FALSE, z = FALSE, t = FALSE;
+
+	/* room for both stars and the value */
+	if (fmt->n_args + 3 > DEBUG_RING_MAX_ARGS)
+		return NULL;
+
+	while (*p != '\0' && strchr("-+ #0'", *p) != NULL)
+		p++;
+
+	if (*p == '*') {
+		fmt->types[fmt->n_args++] = DEBUG_ARG_INT;
+		p++;
+		if (g_ascii_isdigit(*p))
+			return NULL;
+	} else {
+		while (g_ascii_isdigit(*p))
+			p++;
+		/* positional arguments */
+		if (*p == '$')
+			return NULL;
+	}
+
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			fmt->types[fmt->n_args++] = DEBUG_ARG_INT;
+			precision = -2;
+			p++;
+			if (g_ascii_isdigit(*p))
+				return NULL;
+		} else {
+			precision = 0;
+			while (g_ascii_isdigit(*p))
+				precision = MIN(precision * 10 + (*p++ - '0'), G_MAXINT / 10);
+		}
+	}
+
+	/* 'h' doesn't matter, as the argument is promoted to an int anyway */
+	for (;; p++) {
+		if (*p == 'h')
+			continue;
+		else if (*p == 'l')
+			longs++;
+		else if (*p == 'q')
+			longs += 2;
+		else if (*p == 'L')
+			big_l = TRUE;
+		else if (*p == 'j')
+			j = TRUE;
+		else if (*p == 'z')
+			z = TRUE;
+		else if (*p == 't')
+			t = TRUE;
+		else
+			break;
+	}
+
+	switch (*p) {
+		case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+			if (j)
+				type = DEBUG_ARG_INTMAX;
+			else if (z)
+				type = DEBUG_ARG_SIZE;
+			else if (t)
+				type = DEBUG_ARG_PTRDIFF;
+			else if (longs >= 2)
+				type = DEBUG_ARG_LLONG;
+			else if (longs == 1)
+				type = DEBUG_ARG_LONG;
+			else
+				type = DEBUG_ARG_INT;
+			break;
+		case 'c':
+			if (longs > 0)
+				return NULL;
+			type = DEBUG_ARG_INT;
+			break;
+		case 'e': case 'E': case 'f': case 'F':
+		case 'g': case 'G': case 'a': case 'A':
+			if (big_l)
+				return NULL;
+			type = DEBUG_ARG_DOUBLE;
+			break;
+		case 'p':
+			type = DEBUG_ARG_POINTER;
+			break;
+		case 's':
+			if (longs > 0)
+				return NULL;
+			type = DEBUG_ARG_STRING;
+			break;
+		default:
+			/* %n, %m, wide characters and anything unknown */
+			return NULL;
+	}
+
+	if (p + 1 - start > DEBUG_RING_MAX_SPEC)
+		return NULL;
+
+	fmt->precisions[fmt->n_args] = precision;
+	fmt->types[fmt->n_args++] = type;
+
+	return p + 1;
+}
+
+/* Returns the parsed form of a format, or NULL if it can't be recorded
+ * lazily. */
+static const DebugFormat *
+debug_format_lookup(DebugRing *ring, const char *format)
+{
+	DebugFormat *fmt, parsed;
+	const char *p;
+
+	fmt = g_hash_table_lookup(ring->formats, format);
+	if (fmt != NULL && (fmt->format == format || strcmp(fmt->format, format) == 0))
+		return fmt;
+
+	memset(&parsed, 0, sizeof(parsed));
+	for (p = format; (p = strchr(p, '%')) != NULL; ) {
+		if (p[1] == '%') {
+			p += 2;
+			continue;
+		}
+
+		p = debug_format_parse_spec(p + 1, &parsed);
+		if (p == NULL)
+			return NULL;
+	}
+
+	g_mutex_lock(&debug_format_lock);
+
+	if (debug_formats == NULL)
+		debug_formats = g_hash_table_new(g_str_hash, g_str_equal);
+
+	fmt = g_hash_table_lookup(debug_formats, format);
+	if (fmt == NULL && g_hash_table_size(debug_formats) < DEBUG_RING_MAX_FORMATS) {
+		fmt = g_new(DebugFormat, 1);
+		*fmt = parsed;
+		fmt->format = g_intern_string(format);
+		g_hash_table_insert(debug_formats, (gpointer)fmt->format, fmt);
+	}
+
+	g_mutex_unlock(&debug_format_lock);
+
+	if (fmt == NULL)
+		return NULL;
+
+	if (g_hash_table_size(ring->formats) >= DEBUG_RING_MAX_CACHED_FORMATS)
+		g_hash_table_remove_all(ring->formats);
+	g_hash_table_insert(ring->formats, (gpointer)format, fmt);
+
+	return fmt;
+}
+
+/* Returns the ring of the calling thread, setting it up or resizing it when
+ * the size was changed, or NULL if the ring buffer is disabled. */
+static DebugRing *
+debug_ring_get(void)
+{
+	DebugRing *ring = g_private_get(&debug_ring_private);
+	gint generation = g_atomic_int_get(&debug_ring_generation);
+
+	if (ring != NULL && ring->generation == generation)
+		return ring->data != NULL ? ring : NULL;
+
+	g_mutex_lock(&debug_ring_lock);
+
+	if (ring == NULL) {
+		/* Take over the ring of a thread that has exited, if its
+		 * messages have been read. */
+		if (debug_rings_unused != NULL) {
+			ring = debug_rings_unused->data;
+			debug_rings_unused = g_slist_delete_link(debug_rings_unused,
+					debug_rings_unused);
+			ring->exited = FALSE;
+			g_hash_table_remove_all(ring->formats);
+		} else {
+			ring = g_new0(DebugRing, 1);
+			ring->formats = g_hash_table_new(g_direct_hash, g_direct_equal);
+		}
+		debug_rings = g_slist_prepend(debug_rings, ring);
+		g_private_set(&debug_ring_private, ring);
+	}
+
+	if (ring->data == NULL || ring->size != debug_ring_size) {
+		g_free(ring->data);
+		ring->size = debug_ring_size;
+		ring->data = ring->size > 0 ? g_malloc(ring->size) : NULL;
+	}
+	ring->head = ring->tail = ring->used = 0;
+	ring->generation = g_atomic_int_get(&debug_ring_generation);
+
+	g_mutex_unlock(&debug_ring_lock);
+
+	return ring->data != NULL ? ring : NULL;
+}
+
+/* Moves the ring of an exited thread to the unused list, dropping whatever
+ * is left in it.  debug_ring_lock must be held. */
+static void
+debug_ring_retire(DebugRing *ring)
+{
+	debug_rings = g_slist_remove(debug_rings, ring);
+	debug_rings_unused = g_slist_prepend(debug_rings_unused, ring);
+	debug_rings_exited--;
+}
+
+/* Called when a thread that has logged exits.  Rings outlive their threads,
+ * so that what a thread logged before exiting can still be read. */
+static void
+debug_ring_thread_exit(gpointer data)
+{
+	DebugRing *ring = data;
+	GSList *l;
+
+	g_mutex_lock(&debug_ring_lock);
+
+	ring->exited = TRUE;
+	debug_rings_exited++;
+
+	if (ring->data == NULL || ring->used == 0) {
+		debug_ring_retire(ring);
+	} else if (debug_rings_exited > DEBUG_RING_MAX_EXITED) {
+		/* New rings are prepended, so the last one exited is the oldest */
+		DebugRing *oldest = NULL;
+
+		for (l = debug_rings; l != NULL; l = l->next)
+			if (((DebugRing *)l->data)->exited)
+				oldest = l->data;
+		debug_ring_retire(oldest);
+	}
+
+	g_mutex_unlock(&debug_ring_lock);
+}
+
+static void
+debug_ring_drop_oldest(DebugRing *ring)
+{
+	guint32 size = *(guint32 *)(ring->data + ring->tail);
+
+	if (size == 0) {
+		/* skip the unused space at the end */
+		ring->used -= ring->size - ring->tail;
+		ring->tail = 0;
+		return;
+	}
+
+	ring->used -= size;
+	ring->tail += size;
+	if (ring->tail == ring->size)
+		ring->tail = 0;
+}
+
+/* Makes room for a record of size bytes at the head, dropping the oldest
+ * records as needed. */
+static DebugRecord *
+debug_ring_reserve(DebugRing *ring, gsize size)
+{
+	DebugRecord *record;
+
+	for (;;) {
+		if (ring->used == 0)
+			ring->head = ring->tail = 0;
+
+		if (ring->used == 0 || ring->head > ring->tail) {
+			if (ring->size - ring->head >= size)
+				break;
+
+			/* mark the rest as unused and continue at the start */
+			if (ring->head < ring->size)
+				*(guint32 *)(ring->data + ring->head) = 0;
+			ring->used += ring->size - ring->head;
+			ring->head = 0;
+		} else if (ring->tail - ring->head >= size) {
+			break;
+		} else {
+			debug_ring_drop_oldest(ring);
+		}
+	}
+
+	record = (DebugRecord *)(ring->data + ring->head);
+	ring->head += size;
+	ring->used += size;
+
+	return record;
+}
+
+static DebugRecord *
+debug_ring_begin(DebugRing *ring, gsize size, PurpleDebugLevel level,
+		const char *category, gsize category_len)
+{
+	DebugRecord *record;
+
+	g_atomic_int_inc(&ring->serial);
+
+	record = debug_ring_reserve(ring, size);
+	record->size = size;
+	record->level = level;
+	record->seq = (guint)g_atomic_int_add((gint *)&debug_ring_seq, 1);
+	record->time = g_get_real_time();
+	record->format = NULL;
+	record->n_args = 0;
+	record->category = 0;
+
+	if (category != NULL) {
+		record->category = size - DEBUG_RING_ALIGN(category_len + 1);
+		memcpy((guint8 *)record + record->category, category, category_len + 1);
+	}
+
+	return record;
+}
+
+static void
+debug_ring_end(DebugRing *ring)
+{
+	g_atomic_int_inc(&ring->serial);
+}
+
+/* Records a message that was already formatted, cutting it short if it
+ * takes up too much of the ring. */
+static void
+debug_ring_record_message(DebugRing *ring, PurpleDebugLevel level,
+		const char *category, const char *message)
+{
+	DebugRecord *record;
+	gsize category_len = category ? strlen(category) : 0;
+	gsize len = strlen(message);
+	gsize size, max;
+
+	size = sizeof(DebugRecord) + sizeof(DebugArg) +
+		DEBUG_RING_ALIGN(category_len + 1);
+	max = ring->size / 2;
+	if (size >= max)
+		return;
+
+	if (size + len + 1 > max) {
+		const gchar *end;
+
+		len = max - size - 1;
+		g_utf8_validate(message, len, &end);
+		len = end - message;
+	}
+
+	record = debug_ring_begin(ring, DEBUG_RING_ALIGN(size + len + 1), level,
+			category, category_len);
+	record->n_args = 1;
+	DEBUG_RECORD_ARGS(record)[0].s = sizeof(DebugRecord) + sizeof(DebugArg);
+	memcpy((guint8 *)record + sizeof(DebugRecord) + sizeof(DebugArg),
+			message, len);
+	((guint8 *)record)[sizeof(DebugRecord) + sizeof(DebugArg) + len] = '\0';
+	debug_ring_end(ring);
+}
+
+/* Records the format and arguments of a message without formatting it. */
+static void
+debug_ring_record(DebugRing *ring, PurpleDebugLevel level,
+		const char *category, const char *format, va_list args)
+{
+	const DebugFormat *fmt;
+	DebugRecord *record;
+	DebugArg values[DEBUG_RING_MAX_ARGS];
+	gsize lengths[DEBUG_RING_MAX_ARGS];
+	gsize category_len = category ? strlen(category) : 0;
+	gsize size, offset;
+	va_list values_args;
+	guint i;
+
+	fmt = debug_format_lookup(ring, format);
+	if (fmt == NULL) {
+		char *message = g_strdup_vprintf(format, args);
+		g_strchomp(message);
+		debug_ring_record_message(ring, level, category, message);
+		g_free(message);
+		return;
+	}
+
+	size = sizeof(DebugRecord) + fmt->n_args * sizeof(DebugArg);
+
+	G_VA_COPY(values_args, args);
+	for (i = 0; i < fmt->n_args; i++) {
+		const char *str;
+		gsize max;
+
+		switch (fmt->types[i]) {
+			case DEBUG_ARG_INT:
+				values[i].i = va_arg(values_args, gint);
+				break;
+			case DEBUG_ARG_LONG:
+				values[i].l = va_arg(values_args, glong);
+				break;
+			case DEBUG_ARG_LLONG:
+				values[i].ll = va_arg(values_args, long long);
+				break;
+			case DEBUG_ARG_SIZE:
+				values[i].z = va_arg(values_args, gsize);
+				break;
+			case DEBUG_ARG_PTRDIFF:
+				values[i].t = va_arg(values_args, ptrdiff_t);
+				break;
+			case DEBUG_ARG_INTMAX:
+				values[i].j = va_arg(values_args, intmax_t);
+				break;
+			case DEBUG_ARG_DOUBLE:
+				values[i].d = va_arg(values_args, gdouble);
+				break;
+			case DEBUG_ARG_POINTER:
+				values[i].p = va_arg(values_args, gpointer);
+				break;
+			case DEBUG_ARG_STRING:
+				str = va_arg(values_args, const char *);
+				values[i].p = (gpointer)str;
+				if (str == NULL) {
+					lengths[i] = 0;
+					break;
+				}
+
+				/* a precision allows strings that aren't terminated */
+				if (fmt->precisions[i] == -2)
+					max = values[i - 1].i < 0 ? G_MAXSIZE : (gsize)values[i - 1].i;
+				else if (fmt->precisions[i] >= 0)
+					max = fmt->precisions[i];
+				else
+					max = G_MAXSIZE;
+
+				for (lengths[i] = 0; lengths[i] < max && str[lengths[i]]; lengths[i]++)
+					;
+				size += lengths[i] + 1;
+				break;
+		}
+	}
+	va_end(values_args);
+
+	size = DEBUG_RING_ALIGN(size) + DEBUG_RING_ALIGN(category_len + 1);
+	if (size > ring->size / 2) {
+		char *message = g_strdup_vprintf(format, args);
+		g_strchomp(message);
+		debug_ring_record_message(ring, level, category, message);
+		g_free(message);
+		return;
+	}
+
+	record = debug_ring_begin(ring, size, level, category, category_len);
+	record->format = fmt;
+	record->n_args = fmt->n_args;
+
+	offset = sizeof(DebugRecord) + fmt->n_args * sizeof(DebugArg);
+	for (i = 0; i < fmt->n_args; i++) {
+		if (fmt->types[i] == DEBUG_ARG_STRING && values[i].p != NULL) {
+			guint8 *dest = (guint8 *)record + offset;
+
+			memcpy(dest, values[i].p, lengths[i]);
+			dest[lengths[i]] = '\0';
+			values[i].s = offset;
+			offset += lengths[i] + 1;
+		} else if (fmt->types[i] == DEBUG_ARG_STRING) {
+			values[i].s = 0;
+		}
+	}
+	memcpy(DEBUG_RECORD_ARGS(record), values, fmt->n_args * sizeof(DebugArg));
+
+	debug_ring_end(ring);
+}
+
+/* Formats a record the way g_strdup_printf() would have. */
+static void
+debug_record_format(const DebugRecord *record, GString *str)
+{
+	const DebugArg *args = DEBUG_RECORD_ARGS(record);
+	const char *p, *pct, *end;
+	DebugFormat spec_fmt;
+	guint arg = 0;
+
+	if (record->format == NULL) {
+		g_string_append(str, (const char *)record + args[0].s);
+		return;
+	}
+
+	for (p = record->format->format; (pct = strchr(p, '%')) != NULL; p = end) {
+		char spec[DEBUG_RING_MAX_SPEC * 2];
+		gsize len = 0;
+		const char *c;
+
+		g_string_append_len(str, p, pct - p);
+
+		if (pct[1] == '%') {
+			g_string_append_c(str, '%');
+			end = pct + 2;
+			continue;
+		}
+
+		spec_fmt.n_args = 0;
+		end = debug_format_parse_spec(pct + 1, &spec_fmt);
+
+		/* put the values of any stars into the specification */
+		for (c = pct; c < end; c++) {
+			if (*c == '*')
+				len += g_snprintf(spec + len, sizeof(spec) - len, "%d",
+						args[arg++].i);
+			else
+				spec[len++] = *c;
+		}
+		spec[len] = '\0';
+
+		switch (record->format->types[arg]) {
+			case DEBUG_ARG_INT:
+				g_string_append_printf(str, spec, args[arg].i);
+				break;
+			case DEBUG_ARG_LONG:
+				g_string_append_printf(str, spec, args[arg].l);
+				break;
+			case DEBUG_ARG_LLONG:
+				g_string_append_printf(str, spec, args[arg].ll);
+				break;
+			case DEBUG_ARG_SIZE:
+				g_string_append_printf(str, spec, args[arg].z);
+				break;
+			case DEBUG_ARG_PTRDIFF:
+				g_string_append_printf(str, spec, args[arg].t);
+				break;
+			case DEBUG_ARG_INTMAX:
+				g_string_append_printf(str, spec, args[arg].j);
+				break;
+			case DEBUG_ARG_DOUBLE:
+				g_string_append_printf(str, spec, args[arg].d);
+				break;
+			case DEBUG_ARG_POINTER:
+				g_string_append_printf(str, spec, args[arg].p);
+				break;
+			case DEBUG_ARG_STRING:
+				g_string_append_printf(str, spec, args[arg].s == 0 ? NULL :
+						(const char *)record + args[arg].s);
+				break;
+		}
+		arg++;
+	}
+
+	g_string_append(str, p);
+}
+
+static gint
+debug_ring_entry_compare(gconstpointer a, gconstpointer b)
+{
+	const DebugRingEntry *entry_a = a, *entry_b = b;
+
+	return (gint)(entry_a->seq - entry_b->seq);
+}
+
+void
+purple_debug_ring_buffer_foreach(PurpleDebugRingFunc func, gpointer data)
+{
+	GArray *entries;
+	GSList *copies = NULL, *exited = NULL, *l;
+	GString *message;
+	guint cleared, i;
+
+	g_return_if_fail(func != NULL);
+
+	entries = g_array_new(FALSE, FALSE, sizeof(DebugRingEntry));
+	cleared = g_atomic_int_get((gint *)&debug_ring_cleared);
+
+	g_mutex_lock(&debug_ring_lock);
+
+	for (l = debug_rings; l != NULL; l = l->next) {
+		DebugRing *ring = l->data;
+		guint8 *copy;
+		gsize pos, remaining, tail;
+		gint serial;
+
+		if (ring->exited)
+			exited = g_slist_prepend(exited, ring);
+
+		/* skip rings that haven't been resized since the size changed */
+		if (ring->data == NULL ||
+				ring->generation != g_atomic_int_get(&debug_ring_generation))
+			continue;
+
+		/* The owning thread may be logging right now, so copy the ring
+		 * until the copy is of a ring nobody was writing to. */
+		copy = g_malloc(ring->size);
+		do {
+			while ((serial = g_atomic_int_get(&ring->serial)) & 1)
+				g_thread_yield();
+			memcpy(copy, ring->data, ring->size);
+			tail = ring->tail;
+			remaining = ring->used;
+		} while (g_atomic_int_get(&ring->serial) != serial);
+		copies = g_slist_prepend(copies, copy);
+
+		for (pos = tail; remaining > 0; ) {
+			DebugRecord *record = (DebugRecord *)(copy + pos);
+
+			if (record->size == 0) {
+				remaining -= ring->size - pos;
+				pos = 0;
+				continue;
+			}
+
+			if ((gint)(record->seq - cleared) >= 0) {
+				DebugRingEntry entry = { record->seq, record };
+				g_array_append_val(entries, entry);
+			}
+
+			remaining -= record->size;
+			pos += record->size;
+			if (pos == ring->size)
+				pos = 0;
+		}
+	}
+
+	/* The messages of exited threads have now been read, so their rings
+	 * can go to new threads. */
+	for (l = exited; l != NULL; l = l->next)
+		debug_ring_retire(l->data);
+	g_slist_free(exited);
+
+	g_mutex_unlock(&debug_ring_lock);
+
+	g_array_sort(entries, debug_ring_entry_compare);
+
+	message = g_string_new(NULL);
+	for (i = 0; i < entries->len; i++) {
+		const DebugRecord *record = g_array_index(entries, DebugRingEntry, i).record;
+
+		g_string_truncate(message, 0);
+		debug_record_format(record, message);
+		g_strchomp(message->str);
+
+		func(record->level,
+				record->category ? (const char *)record + record->category : NULL,
+				record->time, message->str, data);
+	}
+	g_string_free(message, TRUE);
+
+	g_array_free(entries, TRUE);
+	g_slist_free_full(copies, g_free);
+}
+
+static void
+debug_ring_dump_cb(PurpleDebugLevel level, const char *category,
+		gint64 time, const char *message, gpointer data)
+{
+	GString *str = data;
+	time_t mtime = time / G_USEC_PER_SEC;
+
+	g_string_append_printf(str, "(%s) ",
+			purple_utf8_strftime("%H:%M:%S", localtime(&mtime)));
+	if (category != NULL)
+		g_string_append_printf(str, "%s: ", category);
+	g_string_append(str, message);
+	g_string_append_c(str, '\n');
+}
+
+gchar *
+purple_debug_ring_buffer_dump(void)
+{
+	GString *str = g_string_new(NULL);
+
+	purple_debug_ring_buffer_foreach(debug_ring_dump_cb, str);
+
+	return g_string_free(str, FALSE);
+}
+
+void
+purple_debug_ring_buffer_clear(void)
+{
+	g_atomic_int_set((gint *)&debug_ring_cleared,
+			g_atomic_int_get((gint *)&debug_ring_seq));
+}
+
+void
+purple_debug_ring_buffer_set_size(gsize size)
+{
+	/* records are kept 8 byte aligned */
+	size = DEBUG_RING_ALIGN(size);
+
+	g_mutex_lock(&debug_ring_lock);
+	debug_ring_size = size;
+	g_atomic_int_inc(&debug_ring_generation);
+	g_atomic_int_set(&debug_ring_enabled, size > 0);
+	g_mutex_unlock(&debug_ring_lock);
+}
+
+gsize
+purple_debug_ring_buffer_get_size(void)
+{
+	return debug_ring_size;
+}
+
+/**************************************************************************/
+/* Debug API                                                              */
+/**************************************************************************/
+
 static void
 purple_debug_vargs(PurpleDebugLevel level, const char *category,
 				 const char *format, va_list args)
 {
 	PurpleDebugUiOps *ops;
+	DebugRing *ring = NULL;
+	gboolean ui_enabled;
 	char *arg_s = NULL;
 
 	g_return_if_fail(level != PURPLE_DEBUG_ALL);
 	g_return_if_fail(format != NULL);
 
+	if (!purple_debug_is_level_enabled(level, category))
+		return;
+
 	ops = purple_debug_get_ui_ops();
+	ui_enabled = ops != NULL && ops->print != NULL && (debug_enabled ||
+			ops->is_enabled == NULL || ops->is_enabled(level, category));
+
+	if (g_atomic_int_get(&debug_ring_enabled))
+		ring = debug_ring_get();
 
-	if (!debug_enabled && ((ops == NULL) || (ops->print == NULL) ||
-			(ops->is_enabled && !ops->is_enabled(level, category))))
+	if (!debug_enabled && !ui_enabled) {
+		/* nothing reads the message now, so don't format it yet */
+		if (ring != NULL)
+			debug_ring_record(ring, level, category, format, args);
 		return;
+	}
 
 	arg_s = g_strdup_vprintf(format, args);
 	g_strchomp(arg_s); /* strip trailing linefeeds */
 
+	if (ring != NULL)
+		debug_ring_record_message(ring, level, category, arg_s);
+
 	if (debug_enabled) {
 		gchar *ts_s;
 		const char *mdate;
@@ -102,7 +964,7 @@ purple_debug_vargs(PurpleDebugLevel level, const char *category,
 		g_free(ts_s);
 	}
 
-	if (ops != NULL && ops->print != NULL)
+	if (ui_enabled)
 		ops->print(level, category, arg_s);
 
 	g_free(arg_s);
@@ -257,6 +1119,75 @@ purple_debug_set_colored(gboolean colored)
 	debug_colored = colored;
 }
 
+void
+purple_debug_set_level(PurpleDebugLevel level)
+{
+	debug_level = level;
+}
+
+PurpleDebugLevel
+purple_debug_get_level(void)
+{
+	return debug_level;
+}
+
+void
+purple_debug_set_category_level(const char *category, PurpleDebugLevel level)
+{
+	g_return_if_fail(category != NULL);
+
+	g_rw_lock_writer_lock(&debug_category_lock);
+
+	if (debug_category_levels == NULL)
+		g_atomic_pointer_set(&debug_category_levels,
+				g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL));
+
+	g_hash_table_insert(debug_category_levels, g_strdup(category),
+			GINT_TO_POINTER(level));
+
+	g_rw_lock_writer_unlock(&debug_category_lock);
+}
+
+void
+purple_debug_unset_category_level(const char *category)
+{
+	g_return_if_fail(category != NULL);
+
+	g_rw_lock_writer_lock(&debug_category_lock);
+
+	if (debug_category_levels != NULL) {
+		g_hash_table_remove(debug_category_levels, category);
+		if (g_hash_table_size(debug_category_levels) == 0) {
+			g_hash_table_destroy(debug_category_levels);
+			g_atomic_pointer_set(&debug_category_levels, NULL);
+		}
+	}
+
+	g_rw_lock_writer_unlock(&debug_category_lock);
+}
+
+gboolean
+purple_debug_is_level_enabled(PurpleDebugLevel level, const char *category)
+{
+	gpointer category_level;
+	gboolean found = FALSE;
+
+	/* Without any overrides, which is the usual case, there's no need to
+	 * take the lock. */
+	if (category != NULL && g_atomic_pointer_get(&debug_category_levels) != NULL) {
+		g_rw_lock_reader_lock(&debug_category_lock);
+		found = debug_category_levels != NULL &&
+				g_hash_table_lookup_extended(debug_category_levels, category,
+					NULL, &category_level);
+		g_rw_lock_reader_unlock(&debug_category_lock);
+	}
+
+	if (found)
+		return level >= GPOINTER_TO_INT(category_level);
+
+	return level >= debug_level;
+}
+
 PurpleDebugUiOps *
 purple_debug_get_ui_ops(void)
 {
@@ -273,6 +1204,10 @@ purple_debug_init(void)
 	if(g_getenv("PURPLE_VERBOSE_DEBUG"))
 		purple_debug_set_verbose(TRUE);
 
+	if(g_getenv("PURPLE_DEBUG_RING_SIZE"))
+		purple_debug_ring_buffer_set_size(
+			g_ascii_strtoull(g_getenv("PURPLE_DEBUG_RING_SIZE"), NULL, 10));
+
 	purple_prefs_add_none("/purple/debug");
 }
 
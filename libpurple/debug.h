@@ -78,6 +78,21 @@ struct _PurpleDebugUiOps
 	void (*_purple_reserved4)(void);
 };
 
+/**
+ * PurpleDebugRingFunc:
+ * @level:    The debug level of the message.
+ * @category: The category of the message (or %NULL).
+ * @time:     The time the message was logged, in microseconds since the
+ *            epoch.
+ * @message:  The formatted message.
+ * @data:     User data passed to purple_debug_ring_buffer_foreach().
+ *
+ * The type of the function called for each message in the debug ring buffer.
+ */
+typedef void (*PurpleDebugRingFunc)(PurpleDebugLevel level,
+		const char *category, gint64 time, const char *message,
+		gpointer data);
+
 G_BEGIN_DECLS
 
 /**************************************************************************/
@@ -231,6 +246,118 @@ gboolean purple_debug_is_unsafe(void);
  */
 void purple_debug_set_colored(gboolean colored);
 
+/**
+ * purple_debug_set_level:
+ * @level: The lowest level of debug messages to output.
+ *
+ * Sets the lowest level of debug messages that are output for categories
+ * without a level of their own.  Messages below it are dropped before they
+ * are formatted.  Defaults to #PURPLE_DEBUG_ALL.
+ */
+void purple_debug_set_level(PurpleDebugLevel level);
+
+/**
+ * purple_debug_get_level:
+ *
+ * Returns the lowest level of debug messages that are output for categories
+ * without a level of their own.
+ *
+ * Returns: The default debug level.
+ */
+PurpleDebugLevel purple_debug_get_level(void);
+
+/**
+ * purple_debug_set_category_level:
+ * @category: The category.
+ * @level:    The lowest level of debug messages to output for @category.
+ *
+ * Sets the lowest level of debug messages that are output for a category,
+ * overriding the level set with purple_debug_set_level().
+ */
+void purple_debug_set_category_level(const char *category,
+		PurpleDebugLevel level);
+
+/**
+ * purple_debug_unset_category_level:
+ * @category: The category.
+ *
+ * Removes the level set with purple_debug_set_category_level(), so that
+ * @category uses the default level again.
+ */
+void purple_debug_unset_category_level(const char *category);
+
+/**
+ * purple_debug_is_level_enabled:
+ * @level:    The debug level.
+ * @category: The category (or %NULL).
+ *
+ * Checks whether messages of a level and category are output at all.  This
+ * can be used to skip building expensive debug messages.
+ *
+ * Returns: TRUE if the messages are output, FALSE if they are dropped.
+ */
+gboolean purple_debug_is_level_enabled(PurpleDebugLevel level,
+		const char *category);
+
+/**************************************************************************/
+/* Debug Ring Buffer API                                                  */
+/**************************************************************************/
+
+/**
+ * purple_debug_ring_buffer_set_size:
+ * @size: The size of the buffer of each thread in bytes, or 0 to disable it.
+ *
+ * Enables or disables the debug ring buffer.  While it is enabled, every
+ * thread keeps its most recent debug messages in a buffer of its own.  The
+ * format string and arguments are recorded as they are, and the message is
+ * only formatted when the buffer is read, so messages that no UI or console
+ * prints cost very little.  Once a buffer is full, the oldest messages are
+ * dropped.  Changing the size drops all messages.
+ *
+ * The buffer can also be enabled by setting the PURPLE_DEBUG_RING_SIZE
+ * environment variable before purple_debug_init() is called.
+ */
+void purple_debug_ring_buffer_set_size(gsize size);
+
+/**
+ * purple_debug_ring_buffer_get_size:
+ *
+ * Returns the size of the debug ring buffer of each thread.
+ *
+ * Returns: The size in bytes, or 0 if the buffer is disabled.
+ */
+gsize purple_debug_ring_buffer_get_size(void);
+
+/**
+ * purple_debug_ring_buffer_foreach:
+ * @func: The function to call for each message.
+ * @data: User data to pass to @func.
+ *
+ * Formats the messages in the debug ring buffers of all threads and calls
+ * @func for each of them, oldest first.  The messages of threads that have
+ * exited are only kept until they have been read once, so that their
+ * buffers can go to new threads.
+ */
+void purple_debug_ring_buffer_foreach(PurpleDebugRingFunc func,
+		gpointer data);
+
+/**
+ * purple_debug_ring_buffer_dump:
+ *
+ * Formats the messages in the debug ring buffers of all threads the same way
+ * they are printed to the console, oldest first.
+ *
+ * Returns: A newly allocated string with one message per line.
+ */
+gchar *purple_debug_ring_buffer_dump(void);
+
+/**
+ * purple_debug_ring_buffer_clear:
+ *
+ * Drops all messages from the debug ring buffers.
+ */
+void purple_debug_ring_buffer_clear(void);
+
 /**************************************************************************/
 /* UI Registration Functions                                              */
 /**************************************************************************/
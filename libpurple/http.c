@@ -37,8 +37,11 @@
 
 #define PURPLE_HTTP_URL_CREDENTIALS_CHARS "a-z0-9.,~_/*!&%?=+\\^-"
 #define PURPLE_HTTP_MAX_RECV_BUFFER_LEN 10240
-#define PURPLE_HTTP_MAX_READ_BUFFER_LEN 10240
-#define PURPLE_HTTP_GZ_BUFF_LEN 1024
+#define PURPLE_HTTP_MAX_READ_BUFFER_LEN 65536
+#define PURPLE_HTTP_GZ_BUFF_LEN 16384
+
+#define PURPLE_HTTP_SOCKET_READ_MIN_LEN 4096
+#define PURPLE_HTTP_SOCKET_READ_MAX_LEN 262144
 
 #define PURPLE_HTTP_REQUEST_DEFAULT_MAX_REDIRECTS 20
 #define PURPLE_HTTP_REQUEST_DEFAULT_TIMEOUT 30
@@ -68,8 +71,23 @@ struct _PurpleHttpSocket
 	guint output_source;
 
 	gboolean is_busy;
+	gboolean is_closing;
 	guint use_count;
 	PurpleHttpKeepaliveHost *host;
+
+	/* Connections using this socket, in the order their requests are sent.
+	 * The first one reads its response, the first one which is not reading
+	 * yet writes its request. */
+	GQueue pipeline;
+
+	/* The read buffer grows while the reads fill it. */
+	gchar *read_buffer;
+	gsize read_buffer_size;
+	gsize read_size;
+
+	/* Data read past the end of a response, for the next one. */
+	GBytes *leftover;
+	guint leftover_timeout;
 };
 
 struct _PurpleHttpRequest
@@ -88,6 +106,8 @@ struct _PurpleHttpRequest
 	gpointer contents_reader_data;
 	PurpleHttpContentWriter response_writer;
 	gpointer response_writer_data;
+	PurpleHttpContentBytesWriter response_bytes_writer;
+	gpointer response_bytes_writer_data;
 
 	int timeout;
 	int max_redirects;
@@ -103,6 +123,7 @@ struct _PurpleHttpConnection
 	gboolean is_reading;
 	gboolean is_keepalive;
 	gboolean is_cancelling;
+	gboolean is_truncated;
 
 	PurpleHttpURL *url;
 	PurpleHttpRequest *request;
@@ -125,7 +146,7 @@ struct _PurpleHttpConnection
 	int length_expected;
 	guint length_got, length_got_decompressed;
 
-	gboolean is_chunked, in_chunk, chunks_done;
+	gboolean is_chunked, in_chunk, in_trailer, chunks_done;
 	int chunk_length, chunk_got;
 
 	GList *link_global, *link_gc;
@@ -183,6 +204,7 @@ struct _PurpleHttpKeepaliveRequest
 	PurpleConnection *gc;
 	PurpleHttpSocketConnectCb cb;
 	gpointer user_data;
+	gboolean can_pipeline;
 
 	PurpleHttpKeepaliveHost *host;
 	PurpleHttpSocket *hs;
@@ -209,6 +231,7 @@ struct _PurpleHttpKeepalivePool
 	int ref_count;
 
 	guint limit_per_host;
+	guint pipeline_depth;
 
 	/* key: purple_http_socket_hash, value: PurpleHttpKeepaliveHost */
 	GHashTable *by_hash;
@@ -234,6 +257,7 @@ static time_t purple_http_rfc1123_to_time(const gchar *str);
 
 static gboolean purple_http_request_is_method(PurpleHttpRequest *request,
 	const gchar *method);
+static gboolean purple_http_request_can_pipeline(PurpleHttpRequest *request);
 
 static PurpleHttpConnection * purple_http_connection_new(
 	PurpleHttpRequest *request, PurpleConnection *gc);
@@ -253,11 +277,12 @@ gchar * purple_http_cookie_jar_dump(PurpleHttpCookieJar *cjar);
 static PurpleHttpKeepaliveRequest *
 purple_http_keepalive_pool_request(PurpleHttpKeepalivePool *pool,
 	PurpleConnection *gc, const gchar *host, int port, gboolean is_ssl,
-	PurpleHttpSocketConnectCb cb, gpointer user_data);
+	gboolean can_pipeline, PurpleHttpSocketConnectCb cb, gpointer user_data);
 static void
 purple_http_keepalive_pool_request_cancel(PurpleHttpKeepaliveRequest *req);
 static void
-purple_http_keepalive_pool_release(PurpleHttpSocket *hs, gboolean invalidate);
+purple_http_keepalive_pool_release(PurpleHttpSocket *hs,
+	PurpleHttpConnection *hc, gboolean invalidate);
 
 static void
 purple_http_connection_set_remove(PurpleHttpConnectionSet *set,
@@ -378,6 +403,7 @@ purple_http_gz_put(PurpleHttpGzStream *gzs, const gchar *buf, gsize len)
 	gsize compressed_len;
 	GString *ret;
 	z_stream *zs;
+	gboolean is_full = FALSE;
 
 	g_return_val_if_fail(gzs != NULL, NULL);
 	g_return_val_if_fail(buf != NULL, NULL);
@@ -399,21 +425,30 @@ purple_http_gz_put(PurpleHttpGzStream *gzs, const gchar *buf, gsize len)
 	zs->next_in = (z_const Bytef*)compressed_buff;
 	zs->avail_in = compressed_len;
 
-	ret = g_string_new(NULL);
-	while (zs->avail_in > 0) {
+	ret = g_string_sized_new(MAX(compressed_len * 4,
+		PURPLE_HTTP_GZ_BUFF_LEN));
+	while (zs->avail_in > 0 || is_full) {
 		int gzres;
-		gchar decompressed_buff[PURPLE_HTTP_GZ_BUFF_LEN];
-		gsize decompressed_len;
+		gsize room, decompressed_len, old_len;
+
+		/* Inflate straight into the result, doubling its size. */
+		old_len = ret->len;
+		room = MAX(old_len, PURPLE_HTTP_GZ_BUFF_LEN);
+		g_string_set_size(ret, old_len + room);
 
-		zs->next_out = (Bytef*)decompressed_buff;
-		zs->avail_out = sizeof(decompressed_buff);
-		decompressed_len = zs->avail_out = sizeof(decompressed_buff);
+		zs->next_out = (Bytef*)(ret->str + old_len);
+		zs->avail_out = room;
 		gzres = inflate(zs, Z_FULL_FLUSH);
-		decompressed_len -= zs->avail_out;
+		decompressed_len = room - zs->avail_out;
+		is_full = (zs->avail_out == 0);
+
+		/* There was no more output pending. */
+		if (gzres == Z_BUF_ERROR && zs->avail_in == 0) {
+			g_string_set_size(ret, old_len);
+			break;
+		}
 
 		if (gzres == Z_OK || gzres == Z_STREAM_END) {
-			if (decompressed_len == 0)
-				break;
 			if (gzs->decompressed + decompressed_len >=
 				gzs->max_output)
 			{
@@ -424,15 +459,15 @@ purple_http_gz_put(PurpleHttpGzStream *gzs, const gchar *buf, gsize len)
 				gzres = Z_STREAM_END;
 			}
 			gzs->decompressed += decompressed_len;
-			g_string_append_len(ret, decompressed_buff,
-				decompressed_len);
-			if (gzres == Z_STREAM_END)
+			g_string_set_size(ret, old_len + decompressed_len);
+			if (decompressed_len == 0 || gzres == Z_STREAM_END)
 				break;
 		} else {
 			purple_debug_error("http",
 				"Decompression failed (%d): %s\n", gzres,
 				zs->msg);
 			gzs->failed = TRUE;
+			g_string_free(ret, TRUE);
 			return NULL;
 		}
 	}
@@ -510,7 +545,7 @@ purple_http_socket_connect_new(PurpleConnection *gc, const gchar *host,
 	GError *error = NULL;
 
 	client = purple_gio_socket_client_new(
-			purple_connection_get_account(gc), &error);
+			gc ? purple_connection_get_account(gc) : NULL, &error);
 
 	if (client == NULL) {
 		purple_debug_error("http", "Error connecting to '%s:%d': %s",
@@ -567,9 +602,66 @@ purple_http_socket_close_free(PurpleHttpSocket *hs)
 		g_clear_object(&hs->conn);
 	}
 
+	if (hs->leftover_timeout > 0)
+		purple_timeout_remove(hs->leftover_timeout);
+	if (hs->leftover != NULL)
+		g_bytes_unref(hs->leftover);
+	g_queue_clear(&hs->pipeline);
+	g_free(hs->read_buffer);
+
 	g_free(hs);
 }
 
+static gssize
+purple_http_socket_read(PurpleHttpSocket *hs, gboolean take,
+	const gchar **buf, GBytes **bytes, GError **error)
+{
+	gssize len;
+
+	if (hs->read_size == 0)
+		hs->read_size = PURPLE_HTTP_SOCKET_READ_MIN_LEN;
+
+	if (hs->read_buffer != NULL && hs->read_buffer_size < hs->read_size) {
+		g_free(hs->read_buffer);
+		hs->read_buffer = NULL;
+	}
+	if (hs->read_buffer == NULL) {
+		hs->read_buffer = g_malloc(hs->read_size);
+		hs->read_buffer_size = hs->read_size;
+	}
+
+	len = g_pollable_input_stream_read_nonblocking(
+		G_POLLABLE_INPUT_STREAM(
+		g_io_stream_get_input_stream(G_IO_STREAM(hs->conn))),
+		hs->read_buffer, hs->read_buffer_size, hs->cancellable, error);
+
+	*buf = hs->read_buffer;
+	*bytes = NULL;
+	if (len <= 0)
+		return len;
+
+	/* The reads fill the buffer, so the next one may take more. */
+	if ((gsize)len == hs->read_buffer_size &&
+		hs->read_size < PURPLE_HTTP_SOCKET_READ_MAX_LEN)
+	{
+		hs->read_size *= 2;
+	}
+
+	/* Hand the buffer over, so the data can be passed on without a copy. */
+	if (take) {
+		gchar *data = hs->read_buffer;
+
+		if ((gsize)len < hs->read_buffer_size / 2)
+			data = g_realloc(data, len);
+
+		*buf = data;
+		*bytes = g_bytes_new_take(data, len);
+		hs->read_buffer = NULL;
+	}
+
+	return len;
+}
+
 /*** Headers collection *******************************************************/
 
 static PurpleHttpHeaders * purple_http_headers_new(void);
@@ -756,6 +848,8 @@ static void _purple_http_gen_headers(PurpleHttpConnection *hc);
 static gboolean _purple_http_recv_loopbody(PurpleHttpConnection *hc);
 static gboolean _purple_http_recv(GObject *source, gpointer _hc);
 static gboolean _purple_http_send(GObject *source, gpointer _hc);
+static void _purple_http_socket_start_writing(PurpleHttpSocket *hs);
+static void _purple_http_socket_start_reading(PurpleHttpSocket *hs);
 
 /* closes current connection (if exists), estabilishes one and proceeds with
  * request */
@@ -899,32 +993,44 @@ static void _purple_http_gen_headers(PurpleHttpConnection *hc)
 	}
 }
 
-static gboolean _purple_http_recv_headers(PurpleHttpConnection *hc,
-	const gchar *buf, int len)
+static gssize _purple_http_recv_headers(PurpleHttpConnection *hc,
+	const gchar *buf, gsize len)
 {
-	gchar *eol, *delim;
+	gsize pos = 0;
+	gchar *delim;
 
 	if (hc->headers_got) {
 		purple_debug_error("http", "Headers already got\n");
 		_purple_http_error(hc, _("Error parsing HTTP"));
-		return FALSE;
+		return -1;
 	}
 
-	g_string_append_len(hc->response_buffer, buf, len);
-	if (hc->response_buffer->len > PURPLE_HTTP_MAX_RECV_BUFFER_LEN) {
-		purple_debug_error("http",
-			"Buffer too big when parsing headers\n");
-		_purple_http_error(hc, _("Error parsing HTTP"));
-		return FALSE;
-	}
+	if (hc->response_buffer == NULL)
+		hc->response_buffer = g_string_new("");
 
-	while ((eol = strstr(hc->response_buffer->str, "\r\n"))
-		!= NULL)
-	{
-		gchar *hdrline = hc->response_buffer->str;
-		int hdrline_len = eol - hdrline;
+	while (pos < len && !hc->headers_got) {
+		const gchar *eol;
+		gchar *hdrline;
+		gsize line_len;
 
-		hdrline[hdrline_len] = '\0';
+		/* The body after the headers is left in buf. */
+		eol = memchr(buf + pos, '\n', len - pos);
+		line_len = (eol != NULL) ? (gsize)(eol - (buf + pos)) + 1 :
+			len - pos;
+		g_string_append_len(hc->response_buffer, buf + pos, line_len);
+		pos += line_len;
+
+		if (hc->response_buffer->len > PURPLE_HTTP_MAX_RECV_BUFFER_LEN) {
+			purple_debug_error("http",
+				"Buffer too big when parsing headers\n");
+			_purple_http_error(hc, _("Error parsing HTTP"));
+			return -1;
+		}
+
+		if (eol == NULL)
+			break;
+
+		hdrline = g_strchomp(hc->response_buffer->str);
 
 		if (hdrline[0] == '\0') {
 			if (!hc->main_header_got) {
@@ -955,7 +1061,7 @@ static gboolean _purple_http_recv_headers(PurpleHttpConnection *hc,
 				purple_debug_warning("http",
 					"Invalid response code\n");
 				_purple_http_error(hc, _("Error parsing HTTP"));
-				return FALSE;
+				return -1;
 			}
 			if (purple_debug_is_verbose())
 				purple_debug_misc("http",
@@ -971,7 +1077,7 @@ static gboolean _purple_http_recv_headers(PurpleHttpConnection *hc,
 				purple_debug_warning("http",
 					"Bad header delimiter\n");
 				_purple_http_error(hc, _("Error parsing HTTP"));
-				return FALSE;
+				return -1;
 			}
 			*delim++ = '\0';
 			while (*delim == ' ')
@@ -980,15 +1086,14 @@ static gboolean _purple_http_recv_headers(PurpleHttpConnection *hc,
 			purple_http_headers_add(hc->response->headers, hdrline, delim);
 		}
 
-		g_string_erase(hc->response_buffer, 0, hdrline_len + 2);
-		if (hc->headers_got)
-			break;
+		g_string_truncate(hc->response_buffer, 0);
 	}
-	return TRUE;
+
+	return pos;
 }
 
 static gboolean _purple_http_recv_body_data(PurpleHttpConnection *hc,
-	const gchar *buf, int len)
+	const gchar *buf, int len, GBytes *bytes)
 {
 	GString *decompressed = NULL;
 
@@ -1009,6 +1114,7 @@ static gboolean _purple_http_recv_body_data(PurpleHttpConnection *hc,
 		}
 		buf = decompressed->str;
 		len = decompressed->len;
+		bytes = NULL;
 	}
 
 	g_assert(hc->request->max_length <=
@@ -1018,6 +1124,7 @@ static gboolean _purple_http_recv_body_data(PurpleHttpConnection *hc,
 			"Maximum length exceeded, truncating\n");
 		len = hc->request->max_length - hc->length_got_decompressed;
 		hc->length_expected = hc->length_got;
+		hc->is_truncated = TRUE;
 	}
 	hc->length_got_decompressed += len;
 
@@ -1027,7 +1134,32 @@ static gboolean _purple_http_recv_body_data(PurpleHttpConnection *hc,
 		return TRUE;
 	}
 
-	if (hc->request->response_writer != NULL) {
+	if (hc->request->response_bytes_writer != NULL) {
+		GBytes *data;
+		gboolean succ;
+
+		if (decompressed != NULL) {
+			g_string_truncate(decompressed, len);
+			data = g_string_free_to_bytes(decompressed);
+			decompressed = NULL;
+		} else if (bytes != NULL) {
+			data = g_bytes_new_from_bytes(bytes, buf -
+				(const gchar *)g_bytes_get_data(bytes, NULL),
+				len);
+		} else
+			data = g_bytes_new(buf, len);
+
+		succ = hc->request->response_bytes_writer(hc, hc->response,
+			data, hc->request->response_bytes_writer_data);
+		g_bytes_unref(data);
+		if (!succ) {
+			purple_debug_error("http",
+				"Cannot write using callback\n");
+			_purple_http_error(hc,
+				_("Error handling retrieved data"));
+			return FALSE;
+		}
+	} else if (hc->request->response_writer != NULL) {
 		gboolean succ;
 		succ = hc->request->response_writer(hc, hc->response, buf,
 			hc->length_got_decompressed, len,
@@ -1054,62 +1186,64 @@ static gboolean _purple_http_recv_body_data(PurpleHttpConnection *hc,
 	return TRUE;
 }
 
-static gboolean _purple_http_recv_body_chunked(PurpleHttpConnection *hc,
-	const gchar *buf, int len)
+static gssize _purple_http_recv_body_chunked(PurpleHttpConnection *hc,
+	const gchar *buf, gsize len, GBytes *bytes)
 {
-	gchar *eol, *line;
-	int line_len;
+	gsize pos = 0;
+	gchar *line;
 
-	if (hc->chunks_done)
-		return FALSE;
-	if (!hc->response_buffer)
+	if (hc->response_buffer == NULL)
 		hc->response_buffer = g_string_new("");
 
-	g_string_append_len(hc->response_buffer, buf, len);
-	if (hc->response_buffer->len > PURPLE_HTTP_MAX_RECV_BUFFER_LEN) {
-		purple_debug_error("http",
-			"Buffer too big when searching for chunk\n");
-		_purple_http_error(hc, _("Error parsing HTTP"));
-		return FALSE;
-	}
+	while (pos < len && !hc->chunks_done) {
+		const gchar *eol;
+		gsize line_len;
 
-	while (hc->response_buffer->len > 0) {
+		/* The chunk data is passed on as it is in buf. */
 		if (hc->in_chunk) {
-			int got_now = hc->response_buffer->len;
-			if (hc->chunk_got + got_now > hc->chunk_length)
-				got_now = hc->chunk_length - hc->chunk_got;
-			hc->chunk_got += got_now;
+			gsize got_now = MIN(len - pos,
+				(gsize)(hc->chunk_length - hc->chunk_got));
 
-			if (!_purple_http_recv_body_data(hc,
-				hc->response_buffer->str, got_now))
-				return FALSE;
-
-			g_string_erase(hc->response_buffer, 0, got_now);
+			hc->chunk_got += got_now;
+			if (!_purple_http_recv_body_data(hc, buf + pos, got_now,
+				bytes))
+			{
+				return -1;
+			}
+			pos += got_now;
 			hc->in_chunk = (hc->chunk_got < hc->chunk_length);
 
 			continue;
 		}
 
-		line = hc->response_buffer->str;
-		eol = strstr(line, "\r\n");
-		if (eol == line) {
-			g_string_erase(hc->response_buffer, 0, 2);
-			line = hc->response_buffer->str;
-			eol = strstr(line, "\r\n");
-		}
-		if (eol == NULL) {
-			/* waiting for more data (unlikely, but possible) */
-			if (hc->response_buffer->len > 20) {
-				purple_debug_warning("http", "Chunk length not "
-					"found (buffer too large)\n");
-				_purple_http_error(hc, _("Error parsing HTTP"));
-				return FALSE;
-			}
-			return TRUE;
+		eol = memchr(buf + pos, '\n', len - pos);
+		line_len = (eol != NULL) ? (gsize)(eol - (buf + pos)) + 1 :
+			len - pos;
+		g_string_append_len(hc->response_buffer, buf + pos, line_len);
+		pos += line_len;
+
+		if (hc->response_buffer->len > PURPLE_HTTP_MAX_RECV_BUFFER_LEN) {
+			purple_debug_warning("http", "Chunk length not "
+				"found (buffer too large)\n");
+			_purple_http_error(hc, _("Error parsing HTTP"));
+			return -1;
 		}
-		line_len = eol - line;
 
-		if (1 != sscanf(line, "%x", &hc->chunk_length)) {
+		/* waiting for more data (unlikely, but possible) */
+		if (eol == NULL)
+			break;
+
+		line = g_strchomp(hc->response_buffer->str);
+
+		if (hc->in_trailer) {
+			/* Trailer headers are ignored, until the empty line. */
+			if (line[0] == '\0')
+				hc->chunks_done = TRUE;
+		} else if (line[0] == '\0') {
+			/* The line break after the chunk data. */
+		} else if (1 != sscanf(line, "%x", &hc->chunk_length) ||
+			hc->chunk_length < 0)
+		{
 			if (purple_debug_is_unsafe())
 				purple_debug_warning("http",
 					"Chunk length not found in [%s]\n",
@@ -1118,67 +1252,74 @@ static gboolean _purple_http_recv_body_chunked(PurpleHttpConnection *hc,
 				purple_debug_warning("http",
 					"Chunk length not found\n");
 			_purple_http_error(hc, _("Error parsing HTTP"));
-			return FALSE;
-		}
-		hc->chunk_got = 0;
-		hc->in_chunk = TRUE;
-
-		if (purple_debug_is_verbose())
-			purple_debug_misc("http", "Found chunk of length %d\n", hc->chunk_length);
-
-		g_string_erase(hc->response_buffer, 0, line_len + 2);
+			return -1;
+		} else if (hc->chunk_length == 0) {
+			hc->in_trailer = TRUE;
+		} else {
+			hc->chunk_got = 0;
+			hc->in_chunk = TRUE;
 
-		if (hc->chunk_length == 0) {
-			hc->chunks_done = TRUE;
-			hc->in_chunk = FALSE;
-			return TRUE;
+			if (purple_debug_is_verbose())
+				purple_debug_misc("http", "Found chunk of length %d\n", hc->chunk_length);
 		}
+
+		g_string_truncate(hc->response_buffer, 0);
 	}
 
-	return TRUE;
+	return pos;
 }
 
-static gboolean _purple_http_recv_body(PurpleHttpConnection *hc,
-	const gchar *buf, int len)
+static gssize _purple_http_recv_body(PurpleHttpConnection *hc,
+	const gchar *buf, gsize len, GBytes *bytes)
 {
 	if (hc->is_chunked)
-		return _purple_http_recv_body_chunked(hc, buf, len);
+		return _purple_http_recv_body_chunked(hc, buf, len, bytes);
 
-	return _purple_http_recv_body_data(hc, buf, len);
+	/* The rest belongs to the next pipelined response. */
+	if (hc->length_expected >= 0 &&
+		len > (guint)hc->length_expected - hc->length_got)
+	{
+		len = hc->length_expected - hc->length_got;
+	}
+
+	if (!_purple_http_recv_body_data(hc, buf, len, bytes))
+		return -1;
+
+	return len;
 }
 
-static gboolean _purple_http_recv_loopbody(PurpleHttpConnection *hc)
+static void _purple_http_recv_keep_leftover(PurpleHttpConnection *hc,
+	const gchar *buf, gsize len, GBytes *bytes)
 {
-	int len;
-	gchar buf[4096];
-	gboolean got_anything;
-	GError *error = NULL;
-
-	len = g_pollable_input_stream_read_nonblocking(
-				G_POLLABLE_INPUT_STREAM(
-				g_io_stream_get_input_stream(
-				G_IO_STREAM(hc->socket->conn))),
-				buf, sizeof(buf), hc->socket->cancellable,
-				&error);
-	got_anything = (len > 0);
+	PurpleHttpSocket *hs = hc->socket;
 
-	if (len < 0 && (g_error_matches(error,
-			G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK) ||
-			g_error_matches(error,
-			G_IO_ERROR, G_IO_ERROR_CANCELLED))) {
-		g_clear_error(&error);
-		return FALSE;
+	if (g_queue_get_length(&hs->pipeline) < 2) {
+		purple_debug_warning("http", "Dropping %" G_GSIZE_FORMAT
+			" bytes of data after the response\n", len);
+		return;
 	}
 
-	if (len < 0) {
-		_purple_http_error(hc, _("Error reading from %s: %s"),
-			hc->url->host, error->message);
-		g_clear_error(&error);
-		return FALSE;
-	}
+	g_return_if_fail(hs->leftover == NULL);
+
+	if (bytes != NULL) {
+		hs->leftover = g_bytes_new_from_bytes(bytes, buf -
+			(const gchar *)g_bytes_get_data(bytes, NULL), len);
+	} else
+		hs->leftover = g_bytes_new(buf, len);
+}
+
+static gboolean _purple_http_recv_process(PurpleHttpConnection *hc,
+	const gchar *buf, gssize len, GBytes *bytes)
+{
+	gssize consumed = 0, got;
+	gboolean got_anything = (len > 0);
 
 	/* EOF */
 	if (len == 0) {
+		if (hc->is_chunked && hc->in_trailer) {
+			/* Some servers don't send the last empty line. */
+			hc->chunks_done = TRUE;
+		}
 		if (hc->request->max_length == 0) {
 			/* It's definitely YHttpServer quirk. */
 			purple_debug_warning("http", "Got EOF, but no data was "
@@ -1222,9 +1363,9 @@ static gboolean _purple_http_recv_loopbody(PurpleHttpConnection *hc)
 	}
 
 	if (!hc->headers_got && len > 0) {
-		if (!_purple_http_recv_headers(hc, buf, len))
+		consumed = _purple_http_recv_headers(hc, buf, len);
+		if (consumed < 0)
 			return FALSE;
-		len = 0;
 		if (hc->headers_got) {
 			gboolean is_gzip, is_deflate;
 			if (!purple_http_headers_get_int(hc->response->headers,
@@ -1244,23 +1385,22 @@ static gboolean _purple_http_recv_loopbody(PurpleHttpConnection *hc)
 					hc->request->max_length + 1,
 					is_deflate);
 			}
-		}
-		if (hc->headers_got && hc->response_buffer &&
-			hc->response_buffer->len > 0)
-		{
-			int buffer_len = hc->response_buffer->len;
-			gchar *buffer = g_string_free(hc->response_buffer, FALSE);
-			hc->response_buffer = NULL;
-			_purple_http_recv_body(hc, buffer, buffer_len);
-			g_free(buffer);
+			if (purple_http_headers_match(hc->response->headers,
+				"Connection", "close"))
+			{
+				hc->socket->is_closing = TRUE;
+			}
 		}
 		if (!hc->headers_got)
 			return got_anything;
 	}
 
-	if (len > 0) {
-		if (!_purple_http_recv_body(hc, buf, len))
+	if (len > consumed) {
+		got = _purple_http_recv_body(hc, buf + consumed,
+			len - consumed, bytes);
+		if (got < 0)
 			return FALSE;
+		consumed += got;
 	}
 
 	if (hc->is_chunked && hc->chunks_done && hc->length_expected < 0)
@@ -1270,6 +1410,7 @@ static gboolean _purple_http_recv_loopbody(PurpleHttpConnection *hc)
 		hc->length_got >= (guint)hc->length_expected)
 	{
 		const gchar *redirect;
+		gboolean is_graceful;
 
 		if (hc->is_chunked && !hc->chunks_done) {
 			if (len == 0) {
@@ -1317,6 +1458,14 @@ static gboolean _purple_http_recv_loopbody(PurpleHttpConnection *hc)
 			return FALSE;
 		}
 
+		/* The socket can be used again, if the whole response was
+		 * read and the server doesn't close it. */
+		is_graceful = !hc->is_truncated && !hc->socket->is_closing;
+		if (is_graceful && len > consumed) {
+			_purple_http_recv_keep_leftover(hc, buf + consumed,
+				len - consumed, bytes);
+		}
+
 		redirect = purple_http_headers_get(hc->response->headers,
 			"location");
 		if (redirect && (hc->request->max_redirects == -1 ||
@@ -1335,16 +1484,18 @@ static gboolean _purple_http_recv_loopbody(PurpleHttpConnection *hc)
 					purple_debug_warning("http",
 						"Invalid redirect\n");
 				_purple_http_error(hc, _("Error parsing HTTP"));
+				return FALSE;
 			}
 
 			purple_http_url_relative(hc->url, url);
 			purple_http_url_free(url);
 
+			_purple_http_disconnect(hc, is_graceful);
 			_purple_http_reconnect(hc);
 			return FALSE;
 		}
 
-		_purple_http_disconnect(hc, TRUE);
+		_purple_http_disconnect(hc, is_graceful);
 		purple_http_connection_terminate(hc);
 		return FALSE;
 	}
@@ -1352,6 +1503,53 @@ static gboolean _purple_http_recv_loopbody(PurpleHttpConnection *hc)
 	return got_anything;
 }
 
+static gboolean _purple_http_recv_loopbody(PurpleHttpConnection *hc)
+{
+	PurpleHttpSocket *hs = hc->socket;
+	const gchar *buf;
+	gssize len;
+	GBytes *bytes = NULL;
+	gboolean ret;
+	GError *error = NULL;
+
+	if (hs->leftover != NULL) {
+		gsize size;
+
+		/* It was read along with the previous response. */
+		bytes = hs->leftover;
+		hs->leftover = NULL;
+		buf = g_bytes_get_data(bytes, &size);
+		len = size;
+	} else {
+		len = purple_http_socket_read(hs,
+			hc->request->response_bytes_writer != NULL,
+			&buf, &bytes, &error);
+	}
+
+	if (len < 0 && (g_error_matches(error,
+			G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK) ||
+			g_error_matches(error,
+			G_IO_ERROR, G_IO_ERROR_CANCELLED))) {
+		g_clear_error(&error);
+		return FALSE;
+	}
+
+	if (len < 0) {
+		_purple_http_error(hc, _("Error reading from %s: %s"),
+			hc->url->host, error->message);
+		g_clear_error(&error);
+		return FALSE;
+	}
+
+	/* hc may be gone after that */
+	ret = _purple_http_recv_process(hc, buf, len, bytes);
+
+	if (bytes != NULL)
+		g_bytes_unref(bytes);
+
+	return ret;
+}
+
 static gboolean _purple_http_recv(GObject *source, gpointer _hc)
 {
 	PurpleHttpConnection *hc = _hc;
@@ -1396,7 +1594,6 @@ static gboolean _purple_http_send(GObject *source, gpointer _hc)
 	const gchar *write_from;
 	gboolean writing_headers;
 	GError *error = NULL;
-	GSource *gsource;
 
 	/* Waiting for data. This could be written more efficiently, by removing
 	 * (and later, adding) hs->inpa. */
@@ -1494,20 +1691,82 @@ static gboolean _purple_http_send(GObject *source, gpointer _hc)
 		}
 	}
 
-	/* request is completely written, let's read the response */
+	/* request is completely written, let's read the response (once the
+	 * previous ones are read) and send the next pipelined request */
 	hc->is_reading = TRUE;
-	gsource = g_pollable_input_stream_create_source(
+	hc->socket->output_source = 0;
+	_purple_http_socket_start_writing(hc->socket);
+	_purple_http_socket_start_reading(hc->socket);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void _purple_http_socket_start_writing(PurpleHttpSocket *hs)
+{
+	PurpleHttpConnection *hc = NULL;
+	GSource *source;
+	GList *it;
+
+	if (hs->output_source > 0)
+		return;
+
+	for (it = hs->pipeline.head; it != NULL; it = g_list_next(it)) {
+		PurpleHttpConnection *hc_current = it->data;
+
+		if (!hc_current->is_reading) {
+			hc = hc_current;
+			break;
+		}
+	}
+
+	if (hc == NULL)
+		return;
+
+	source = g_pollable_output_stream_create_source(
+			G_POLLABLE_OUTPUT_STREAM(
+			g_io_stream_get_output_stream(G_IO_STREAM(hs->conn))),
+			NULL);
+	g_source_set_callback(source,
+			(GSourceFunc)_purple_http_send, hc, NULL);
+	hs->output_source = g_source_attach(source, NULL);
+	g_source_unref(source);
+}
+
+static gboolean _purple_http_socket_leftover_cb(gpointer _hs)
+{
+	PurpleHttpSocket *hs = _hs;
+	PurpleHttpConnection *hc = g_queue_peek_head(&hs->pipeline);
+
+	hs->leftover_timeout = 0;
+
+	if (hc != NULL && hc->is_reading)
+		_purple_http_recv(NULL, hc);
+
+	return FALSE;
+}
+
+static void _purple_http_socket_start_reading(PurpleHttpSocket *hs)
+{
+	PurpleHttpConnection *hc = g_queue_peek_head(&hs->pipeline);
+	GSource *source;
+
+	if (hc == NULL || !hc->is_reading || hs->input_source > 0)
+		return;
+
+	source = g_pollable_input_stream_create_source(
 			G_POLLABLE_INPUT_STREAM(
-			g_io_stream_get_input_stream(
-			G_IO_STREAM(hc->socket->conn))),
+			g_io_stream_get_input_stream(G_IO_STREAM(hs->conn))),
 			NULL);
-	g_source_set_callback(gsource,
+	g_source_set_callback(source,
 		(GSourceFunc)_purple_http_recv, hc, NULL);
-	hc->socket->input_source = g_source_attach(gsource, NULL);
-	g_source_unref(gsource);
+	hs->input_source = g_source_attach(source, NULL);
+	g_source_unref(source);
 
-	hc->socket->output_source = 0;
-	return G_SOURCE_REMOVE;
+	/* The socket won't be readable for what was already read. */
+	if (hs->leftover != NULL && hs->leftover_timeout == 0) {
+		hs->leftover_timeout = purple_timeout_add(0,
+			_purple_http_socket_leftover_cb, hs);
+	}
 }
 
 static void _purple_http_disconnect(PurpleHttpConnection *hc,
@@ -1526,8 +1785,10 @@ static void _purple_http_disconnect(PurpleHttpConnection *hc,
 	if (hc->socket_request)
 		purple_http_keepalive_pool_request_cancel(hc->socket_request);
 	else {
-		purple_http_keepalive_pool_release(hc->socket, !is_graceful);
+		PurpleHttpSocket *hs = hc->socket;
+
 		hc->socket = NULL;
+		purple_http_keepalive_pool_release(hs, hc, !is_graceful);
 	}
 }
 
@@ -1535,25 +1796,20 @@ static void
 _purple_http_connected(PurpleHttpSocket *hs, const gchar *error, gpointer _hc)
 {
 	PurpleHttpConnection *hc = _hc;
-	GSource *source;
 
 	hc->socket_request = NULL;
 	hc->socket = hs;
 
+	if (hs != NULL)
+		g_queue_push_tail(&hs->pipeline, hc);
+
 	if (error != NULL) {
 		_purple_http_error(hc, _("Unable to connect to %s: %s"),
 			hc->url->host, error);
 		return;
 	}
 
-	source = g_pollable_output_stream_create_source(
-			G_POLLABLE_OUTPUT_STREAM(
-			g_io_stream_get_output_stream(G_IO_STREAM(hs->conn))),
-			NULL);
-	g_source_set_callback(source,
-			(GSourceFunc)_purple_http_send, hc, NULL);
-	hc->socket->output_source = g_source_attach(source, NULL);
-	g_source_unref(source);
+	_purple_http_socket_start_writing(hs);
 }
 
 static gboolean _purple_http_reconnect(PurpleHttpConnection *hc)
@@ -1592,7 +1848,9 @@ static gboolean _purple_http_reconnect(PurpleHttpConnection *hc)
 	if (hc->request->keepalive_pool != NULL) {
 		hc->socket_request = purple_http_keepalive_pool_request(
 			hc->request->keepalive_pool, hc->gc, url->host,
-			url->port, is_ssl, _purple_http_connected, hc);
+			url->port, is_ssl,
+			purple_http_request_can_pipeline(hc->request),
+			_purple_http_connected, hc);
 	} else {
 		hc->socket = purple_http_socket_connect_new(hc->gc, url->host,
 			url->port, is_ssl, _purple_http_connected, hc);
@@ -1606,6 +1864,8 @@ static gboolean _purple_http_reconnect(PurpleHttpConnection *hc)
 	purple_http_headers_free(hc->response->headers);
 	hc->response->headers = purple_http_headers_new();
 	hc->response_buffer = g_string_new("");
+	hc->is_reading = FALSE;
+	hc->is_truncated = FALSE;
 	hc->main_header_got = FALSE;
 	hc->headers_got = FALSE;
 	if (hc->response->contents != NULL)
@@ -1616,7 +1876,10 @@ static gboolean _purple_http_reconnect(PurpleHttpConnection *hc)
 	hc->length_expected = -1;
 	hc->is_chunked = FALSE;
 	hc->in_chunk = FALSE;
+	hc->in_trailer = FALSE;
 	hc->chunks_done = FALSE;
+	purple_http_gz_free(hc->gz_stream);
+	hc->gz_stream = NULL;
 
 	purple_http_conn_notify_progress_watcher(hc);
 
@@ -2265,7 +2528,7 @@ purple_http_keepalive_pool_unref(PurpleHttpKeepalivePool *pool)
 static PurpleHttpKeepaliveRequest *
 purple_http_keepalive_pool_request(PurpleHttpKeepalivePool *pool,
 	PurpleConnection *gc, const gchar *host, int port, gboolean is_ssl,
-	PurpleHttpSocketConnectCb cb, gpointer user_data)
+	gboolean can_pipeline, PurpleHttpSocketConnectCb cb, gpointer user_data)
 {
 	PurpleHttpKeepaliveRequest *req;
 	PurpleHttpKeepaliveHost *kahost;
@@ -2298,6 +2561,7 @@ purple_http_keepalive_pool_request(PurpleHttpKeepalivePool *pool,
 	req->gc = gc;
 	req->cb = cb;
 	req->user_data = user_data;
+	req->can_pipeline = can_pipeline;
 	req->host = kahost;
 
 	kahost->queue = g_slist_append(kahost->queue, req);
@@ -2317,9 +2581,53 @@ _purple_http_keepalive_socket_connected(PurpleHttpSocket *hs,
 		hs->use_count++;
 
 	req->cb(hs, error, req->user_data);
+
+	/* The requests queued while it was connecting may be pipelined on it
+	 * now. */
+	if (hs != NULL && error == NULL && hs->host != NULL)
+		purple_http_keepalive_host_process_queue(hs->host);
+
 	g_free(req);
 }
 
+/* Finds the connected socket with the shortest pipeline, which a request can
+ * be sent on before the previous responses are read. */
+static PurpleHttpSocket *
+purple_http_keepalive_host_get_pipeline(PurpleHttpKeepaliveHost *host)
+{
+	PurpleHttpSocket *hs = NULL;
+	GSList *it;
+
+	if (host->pool->pipeline_depth < 2)
+		return NULL;
+
+	for (it = host->sockets; it != NULL; it = g_slist_next(it)) {
+		PurpleHttpSocket *hs_current = it->data;
+		guint depth = g_queue_get_length(&hs_current->pipeline);
+		GList *pit;
+
+		if (hs_current->conn == NULL || hs_current->is_closing)
+			continue;
+		if (depth == 0 || depth >= host->pool->pipeline_depth)
+			continue;
+		if (hs != NULL && depth >= g_queue_get_length(&hs->pipeline))
+			continue;
+
+		/* If the socket breaks, every request on it is sent again. */
+		for (pit = hs_current->pipeline.head; pit; pit = g_list_next(pit)) {
+			PurpleHttpConnection *hc = pit->data;
+
+			if (!purple_http_request_can_pipeline(hc->request))
+				break;
+		}
+
+		if (pit == NULL)
+			hs = hs_current;
+	}
+
+	return hs;
+}
+
 static gboolean
 _purple_http_keepalive_host_process_queue_cb(gpointer _host)
 {
@@ -2351,18 +2659,30 @@ _purple_http_keepalive_host_process_queue_cb(gpointer _host)
 		it = g_slist_next(it);
 	}
 
-	/* There are no free sockets and we cannot create another one. */
+	req = host->queue->data;
+
+	/* There are no free sockets and we cannot create another one, but the
+	 * request may be pipelined on a busy one. */
 	if (hs == NULL && sockets_count >= host->pool->limit_per_host &&
 		host->pool->limit_per_host > 0)
 	{
-		return FALSE;
+		if (!req->can_pipeline)
+			return FALSE;
+
+		hs = purple_http_keepalive_host_get_pipeline(host);
+		if (hs == NULL)
+			return FALSE;
+
+		if (purple_debug_is_verbose()) {
+			purple_debug_misc("http", "pipelining on a socket: "
+				"%p\n", hs);
+		}
 	}
 
-	req = host->queue->data;
 	host->queue = g_slist_remove(host->queue, req);
 
 	if (hs != NULL) {
-		if (purple_debug_is_verbose()) {
+		if (purple_debug_is_verbose() && !hs->is_busy) {
 			purple_debug_misc("http", "locking a (previously used) "
 				"socket: %p\n", hs);
 		}
@@ -2433,9 +2753,14 @@ purple_http_keepalive_pool_request_cancel(PurpleHttpKeepaliveRequest *req)
 }
 
 static void
-purple_http_keepalive_pool_release(PurpleHttpSocket *hs, gboolean invalidate)
+purple_http_keepalive_pool_release(PurpleHttpSocket *hs,
+	PurpleHttpConnection *hc, gboolean invalidate)
 {
 	PurpleHttpKeepaliveHost *host;
+	PurpleHttpConnection *writer = NULL;
+	gboolean was_reading;
+	GQueue orphans;
+	GList *it;
 
 	if (hs == NULL)
 		return;
@@ -2443,27 +2768,85 @@ purple_http_keepalive_pool_release(PurpleHttpSocket *hs, gboolean invalidate)
 	if (purple_debug_is_verbose())
 		purple_debug_misc("http", "releasing a socket: %p\n", hs);
 
-	if (hs->input_source > 0) {
+	for (it = hs->pipeline.head; it != NULL; it = g_list_next(it)) {
+		PurpleHttpConnection *hc_current = it->data;
+
+		if (!hc_current->is_reading) {
+			writer = hc_current;
+			break;
+		}
+	}
+
+	was_reading = (g_queue_peek_head(&hs->pipeline) == hc);
+	g_queue_remove(&hs->pipeline, hc);
+
+	if (was_reading && hs->input_source > 0) {
 		g_source_remove(hs->input_source);
 		hs->input_source = 0;
 	}
 
-	if (hs->output_source > 0) {
+	if (writer == hc && hs->output_source > 0) {
 		g_source_remove(hs->output_source);
 		hs->output_source = 0;
 	}
 
-	hs->is_busy = FALSE;
+	if (!was_reading && !g_queue_is_empty(&hs->pipeline)) {
+		/* Its response would be read by the next request. */
+		if (hc->is_reading)
+			invalidate = TRUE;
+		/* Nothing of it was sent yet, the others may go on. */
+		else if (hc->request_header_written == 0)
+			invalidate = FALSE;
+	}
+
 	host = hs->host;
 
-	if (host == NULL) {
+	if (invalidate) {
+		orphans = hs->pipeline;
+		g_queue_init(&hs->pipeline);
+
+		if (host != NULL)
+			host->sockets = g_slist_remove(host->sockets, hs);
 		purple_http_socket_close_free(hs);
+
+		/* The requests pipelined after it are sent again. */
+		for (it = orphans.head; it != NULL; it = g_list_next(it)) {
+			PurpleHttpConnection *hc_orphan = it->data;
+
+			purple_debug_info("http", "Pipelined request %p lost "
+				"its socket, retrying...\n", hc_orphan);
+			hc_orphan->socket = NULL;
+			_purple_http_reconnect(hc_orphan);
+		}
+		g_queue_clear(&orphans);
+
+		if (host != NULL)
+			purple_http_keepalive_host_process_queue(host);
 		return;
 	}
 
-	if (invalidate) {
-		host->sockets = g_slist_remove(host->sockets, hs);
+	if (!g_queue_is_empty(&hs->pipeline)) {
+		_purple_http_socket_start_writing(hs);
+		_purple_http_socket_start_reading(hs);
+		if (host != NULL)
+			purple_http_keepalive_host_process_queue(host);
+		return;
+	}
+
+	hs->is_busy = FALSE;
+
+	if (hs->leftover_timeout > 0) {
+		purple_timeout_remove(hs->leftover_timeout);
+		hs->leftover_timeout = 0;
+	}
+	if (hs->leftover != NULL) {
+		g_bytes_unref(hs->leftover);
+		hs->leftover = NULL;
+	}
+
+	if (host == NULL) {
 		purple_http_socket_close_free(hs);
+		return;
 	}
 
 	purple_http_keepalive_host_process_queue(host);
@@ -2486,6 +2869,23 @@ purple_http_keepalive_pool_get_limit_per_host(PurpleHttpKeepalivePool *pool)
 	return pool->limit_per_host;
 }
 
+void
+purple_http_keepalive_pool_set_pipelining(PurpleHttpKeepalivePool *pool,
+	guint depth)
+{
+	g_return_if_fail(pool != NULL);
+
+	pool->pipeline_depth = depth;
+}
+
+guint
+purple_http_keepalive_pool_get_pipelining(PurpleHttpKeepalivePool *pool)
+{
+	g_return_val_if_fail(pool != NULL, 0);
+
+	return pool->pipeline_depth;
+}
+
 /*** HTTP connection set API **************************************************/
 
 PurpleHttpConnectionSet *
@@ -2684,6 +3084,17 @@ purple_http_request_set_keepalive_pool(PurpleHttpRequest *request,
 		request->keepalive_pool = pool;
 }
 
+static gboolean purple_http_request_can_pipeline(PurpleHttpRequest *request)
+{
+	/* Requests on a broken pipeline are sent again, so only the idempotent
+	 * ones with a body known up front are allowed. HEAD is left out, as
+	 * the response length isn't checked for it. */
+	if (!request->http11 || request->contents_reader != NULL)
+		return FALSE;
+
+	return purple_http_request_is_method(request, "get");
+}
+
 PurpleHttpKeepalivePool *
 purple_http_request_get_keepalive_pool(PurpleHttpRequest *request)
 {
@@ -2739,6 +3150,17 @@ void purple_http_request_set_response_writer(PurpleHttpRequest *request,
 	request->response_writer_data = user_data;
 }
 
+void purple_http_request_set_response_bytes_writer(PurpleHttpRequest *request,
+	PurpleHttpContentBytesWriter writer, gpointer user_data)
+{
+	g_return_if_fail(request != NULL);
+
+	if (writer == NULL)
+		user_data = NULL;
+	request->response_bytes_writer = writer;
+	request->response_bytes_writer_data = user_data;
+}
+
 void purple_http_request_set_timeout(PurpleHttpRequest *request, int timeout)
 {
 	g_return_if_fail(request != NULL);
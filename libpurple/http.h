@@ -133,6 +133,22 @@ typedef gboolean (*PurpleHttpContentWriter)(PurpleHttpConnection *http_conn,
 	PurpleHttpResponse *response, const gchar *buffer, size_t offset,
 	size_t length, gpointer user_data);
 
+/**
+ * PurpleHttpContentBytesWriter:
+ * @http_conn: Connection, which requests data.
+ * @response:  Response at point got so far (may change later).
+ * @data:      (transfer none): The data read, usually a slice of the buffer
+ *             it was read into, so it may be kept without copying it.
+ * @user_data: The user data passed with callback function.
+ *
+ * An callback for writting large response contents, without copying them.
+ *
+ * Returns:          TRUE, if succeeded, FALSE otherwise.
+ */
+typedef gboolean (*PurpleHttpContentBytesWriter)(
+	PurpleHttpConnection *http_conn, PurpleHttpResponse *response,
+	GBytes *data, gpointer user_data);
+
 /**
  * PurpleHttpProgressWatcher:
  * @http_conn:     The HTTP Connection.
@@ -626,6 +642,19 @@ void purple_http_request_set_contents_reader(PurpleHttpRequest *request,
 void purple_http_request_set_response_writer(PurpleHttpRequest *request,
 	PurpleHttpContentWriter writer, gpointer user_data);
 
+/**
+ * purple_http_request_set_response_bytes_writer:
+ * @request:              The request.
+ * @writer: (scope call): The writer callback, or %NULL to remove existing.
+ * @user_data:            The user data to pass to the callback function.
+ *
+ * Set contents writer for HTTP response, which gets the data as #GBytes.
+ * The response contents are not collected then. It takes precedence over the
+ * writer set with purple_http_request_set_response_writer().
+ */
+void purple_http_request_set_response_bytes_writer(PurpleHttpRequest *request,
+	PurpleHttpContentBytesWriter writer, gpointer user_data);
+
 /**
  * purple_http_request_set_timeout:
  * @request: The request.
@@ -826,6 +855,31 @@ purple_http_keepalive_pool_set_limit_per_host(PurpleHttpKeepalivePool *pool,
 guint
 purple_http_keepalive_pool_get_limit_per_host(PurpleHttpKeepalivePool *pool);
 
+/**
+ * purple_http_keepalive_pool_set_pipelining:
+ * @pool:  The HTTP Keep-Alive pool.
+ * @depth: The maximum number of requests sent on a socket before their
+ *         responses are read, 0 or 1 to disable pipelining.
+ *
+ * Enables HTTP/1.1 pipelining. When the limit of connections per host is
+ * reached, GET requests are sent on the busy sockets, instead of waiting for
+ * a free one. If a socket breaks, the requests pipelined on it are sent again.
+ */
+void
+purple_http_keepalive_pool_set_pipelining(PurpleHttpKeepalivePool *pool,
+	guint depth);
+
+/**
+ * purple_http_keepalive_pool_get_pipelining:
+ * @pool: The HTTP Keep-Alive pool.
+ *
+ * Gets the maximum number of pipelined requests on a socket.
+ *
+ * Returns:     The pipeline depth, 0 if pipelining is disabled.
+ */
+guint
+purple_http_keepalive_pool_get_pipelining(PurpleHttpKeepalivePool *pool);
+
 
 /**************************************************************************/
 /* HTTP connection set API                                                */
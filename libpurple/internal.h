@@ -314,6 +314,36 @@ void _purple_connection_remove_active_chat(PurpleConnection *gc,
 void _purple_conversations_update_cache(PurpleConversation *conv,
 		const char *name, PurpleAccount *account);
 
+/**
+ * PurpleConversationsSignal:
+ *
+ * The conversation signals emitted for every incoming message or typing
+ * notification, whose IDs are cached by conversations.c.
+ */
+typedef enum
+{
+	PURPLE_CONVERSATIONS_SIGNAL_RECEIVING_IM_MSG = 0,
+	PURPLE_CONVERSATIONS_SIGNAL_RECEIVED_IM_MSG,
+	PURPLE_CONVERSATIONS_SIGNAL_RECEIVING_CHAT_MSG,
+	PURPLE_CONVERSATIONS_SIGNAL_RECEIVED_CHAT_MSG,
+	PURPLE_CONVERSATIONS_SIGNAL_BUDDY_TYPING,
+	PURPLE_CONVERSATIONS_SIGNAL_BUDDY_TYPED,
+	PURPLE_CONVERSATIONS_SIGNAL_BUDDY_TYPING_STOPPED,
+	PURPLE_CONVERSATIONS_SIGNAL_COUNT
+} PurpleConversationsSignal;
+
+/**
+ * _purple_conversations_get_signal_id:
+ * @signal: The signal.
+ *
+ * Note: This function should only be called by server.c, to emit these
+ *       signals with purple_signal_emit_by_id().
+ *
+ * Returns: The ID of the signal, or 0 if the conversations subsystem isn't
+ *          initialized.
+ */
+gulong _purple_conversations_get_signal_id(PurpleConversationsSignal signal);
+
 /**
  * _purple_statuses_get_primitive_scores:
  *
@@ -23,11 +23,13 @@
 #include "account.h"
 #include "dbus-maybe.h"
 #include "debug.h"
+#include "eventloop.h"
 #include "glibcompat.h"
 #include "image-store.h"
 #include "log.h"
 #include "prefs.h"
 #include "util.h"
+#include "xmlnode.h"
 #include "stringref.h"
 #include "time.h"
 
@@ -37,38 +39,1213 @@ static PurpleLogLogger *html_logger;
 static PurpleLogLogger *txt_logger;
 static PurpleLogLogger *old_logger;
 
-struct _purple_logsize_user {
-	char *name;
-	PurpleAccount *account;
-};
-static GHashTable *logsize_users = NULL;
-static GHashTable *logsize_users_decayed = NULL;
+/* Activity scores are decayed with a half-life of 14 days. */
+#define LOG_ACTIVITY_HALF_LIFE 1209600.0
+
+/* An entry of the log catalog. The stats are only valid if scanned is
+ * TRUE; otherwise all that is known is that the logs exist. score is the
+ * activity score at score_time. mtime is the modification time the log
+ * directory had when it was scanned. */
+typedef struct {
+	PurpleLogStats stats;
+	double score;
+	time_t score_time;
+	time_t mtime;
+	gboolean scanned;
+} PurpleLogCatalogEntry;
+
+/* The log catalog maps the log directory of a conversation, relative to the
+ * logs directory and with '/' as the separator, to its PurpleLogCatalogEntry.
+ * It is complete if every log directory is in it, which is found out by
+ * walking the logs. catalog_dirs maps the directories the walk went through
+ * (the logs directory itself, the protocol and the account directories) to
+ * their modification times, so that it is walked again when they change. */
+static GHashTable *catalog = NULL;
+static GHashTable *catalog_dirs = NULL;
+static gboolean catalog_complete = FALSE;
+static char *catalog_loggers = NULL;
+static guint catalog_save_timer = 0;
+
+/* Words longer than this aren't indexed. */
+#define LOG_INDEX_MAX_WORD_LEN 64
+
+/* An indexed log. key is NULL once the document is removed. It is complete
+ * if all of the log went into the index. */
+typedef struct {
+	char *key;
+	gboolean complete;
+} PurpleLogIndexDoc;
+
+/* The search index maps every word of the logs to the sorted GArray of the
+ * ids of the documents it is in. It is loaded by the first search. */
+static GHashTable *index_words = NULL;
+static GHashTable *index_docs = NULL;
+static GArray *index_doc_list = NULL;
+static guint index_live_docs = 0;
+static guint index_file_lines = 0;
+static gboolean index_needs_compact = FALSE;
+static GString *index_journal = NULL;
+static guint index_save_timer = 0;
+static GHashTable *index_written_logs = NULL;
+
+static char *log_get_relative_dir(PurpleLogType type, const char *name,
+		PurpleAccount *account, const char *separator);
+static void log_get_log_sets_common(GHashTable *sets);
+
+static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
+							  const char *from, time_t time, const char *message);
+static void html_logger_finalize(PurpleLog *log);
+static GList *html_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account);
+static GList *html_logger_list_syslog(PurpleAccount *account);
+static char *html_logger_read(PurpleLog *log, PurpleLogReadFlags *flags);
+static int html_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account);
+
+static GList *old_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account);
+static int old_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account);
+static char * old_logger_read (PurpleLog *log, PurpleLogReadFlags *flags);
+static int old_logger_size (PurpleLog *log);
+static void old_logger_get_log_sets(PurpleLogSetCallback cb, GHashTable *sets);
+static void old_logger_finalize(PurpleLog *log);
+
+static gsize txt_logger_write(PurpleLog *log,
+							 PurpleMessageFlags type,
+							 const char *from, time_t time, const char *message);
+static void txt_logger_finalize(PurpleLog *log);
+static GList *txt_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account);
+static GList *txt_logger_list_syslog(PurpleAccount *account);
+static char *txt_logger_read(PurpleLog *log, PurpleLogReadFlags *flags);
+static int txt_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account);
+
+/**************************************************************************
+ * LOG CATALOG ************************************************************
+ **************************************************************************/
+
+/* Returns the ids of the loggers that can list logs or size them, which are
+ * the loggers the catalog was built from. */
+static char *
+log_catalog_get_loggers(void)
+{
+	GSList *n;
+	GList *ids = NULL;
+	GString *str = g_string_new(NULL);
+
+	for (n = loggers; n; n = n->next) {
+		PurpleLogLogger *logger = n->data;
+
+		if (logger->list || logger->total_size)
+			ids = g_list_insert_sorted(ids, logger->id, (GCompareFunc)strcmp);
+	}
+
+	for (; ids; ids = g_list_delete_link(ids, ids)) {
+		if (str->len > 0)
+			g_string_append_c(str, ',');
+		g_string_append(str, ids->data);
+	}
+
+	return g_string_free(str, FALSE);
+}
+
+static void
+log_catalog_entry_free(PurpleLogCatalogEntry *entry)
+{
+	g_slice_free(PurpleLogCatalogEntry, entry);
+}
+
+static time_t
+log_catalog_get_time(PurpleXmlNode *node, const char *attr)
+{
+	const char *value = purple_xmlnode_get_attrib(node, attr);
+
+	return value ? (time_t)g_ascii_strtoll(value, NULL, 10) : 0;
+}
+
+static void
+log_catalog_set_number(PurpleXmlNode *node, const char *attr, gint64 value)
+{
+	char *str = g_strdup_printf("%" G_GINT64_FORMAT, value);
+
+	purple_xmlnode_set_attrib(node, attr, str);
+	g_free(str);
+}
+
+/* Returns the modification time of a directory under the logs directory,
+ * 0 if it doesn't exist, or -1 if it changed too recently for a later change
+ * in the same second to be noticed. */
+static time_t
+log_catalog_get_mtime(const char *key)
+{
+	char *path = g_build_filename(purple_user_dir(), "logs", key, NULL);
+	GStatBuf st;
+	time_t mtime = 0;
+
+	if (g_stat(path, &st) == 0)
+		mtime = (st.st_mtime < time(NULL)) ? st.st_mtime : -1;
+	g_free(path);
+
+	return mtime;
+}
+
+/* Whether nothing was added to or removed from the directories the catalog
+ * was built from. Changes within the conversation directories are checked
+ * for each entry as it is looked up. */
+static gboolean
+log_catalog_dirs_are_current(void)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_hash_table_iter_init(&iter, catalog_dirs);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		time_t mtime = *(time_t *)value;
+
+		if (mtime == -1 || log_catalog_get_mtime(key) != mtime)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+log_catalog_add_dir(const char *key)
+{
+	time_t *mtime = g_new(time_t, 1);
+
+	*mtime = log_catalog_get_mtime(key);
+	g_hash_table_replace(catalog_dirs, g_strdup(key), mtime);
+}
+
+static void
+log_catalog_load(void)
+{
+	PurpleXmlNode *root, *node;
+
+	catalog = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify)log_catalog_entry_free);
+	catalog_dirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			g_free);
+	catalog_complete = FALSE;
+	catalog_loggers = log_catalog_get_loggers();
+
+	root = purple_util_read_xml_from_file("logcatalog.xml", _("log catalog"));
+	if (root == NULL)
+		return;
+
+	if (!purple_strequal(purple_xmlnode_get_attrib(root, "loggers"), catalog_loggers)) {
+		purple_debug_info("log", "The loggers changed, rebuilding the log catalog\n");
+		purple_xmlnode_free(root);
+		return;
+	}
+
+	for (node = purple_xmlnode_get_child(root, "dir"); node;
+			node = purple_xmlnode_get_next_twin(node)) {
+		const char *path = purple_xmlnode_get_attrib(node, "path");
+		const char *value = purple_xmlnode_get_attrib(node, "mtime");
+		time_t *mtime;
+
+		if (path == NULL || value == NULL)
+			continue;
+
+		mtime = g_new(time_t, 1);
+		*mtime = (time_t)g_ascii_strtoll(value, NULL, 10);
+		g_hash_table_replace(catalog_dirs, g_strdup(path), mtime);
+	}
+
+	/* Without the logs directory itself, there is no telling whether the
+	 * walk is out of date. */
+	catalog_complete = purple_strequal(purple_xmlnode_get_attrib(root, "complete"), "1") &&
+		g_hash_table_contains(catalog_dirs, "");
+
+	for (node = purple_xmlnode_get_child(root, "set"); node;
+			node = purple_xmlnode_get_next_twin(node)) {
+		const char *dir = purple_xmlnode_get_attrib(node, "dir");
+		const char *value;
+		PurpleLogCatalogEntry *entry;
+
+		if (dir == NULL || *dir == '\0')
+			continue;
+
+		entry = g_slice_new0(PurpleLogCatalogEntry);
+		if ((value = purple_xmlnode_get_attrib(node, "count")) != NULL) {
+			entry->scanned = TRUE;
+			entry->stats.count = atoi(value);
+			if ((value = purple_xmlnode_get_attrib(node, "size")) != NULL)
+				entry->stats.size = atoi(value);
+			entry->stats.first = log_catalog_get_time(node, "first");
+			entry->stats.last = log_catalog_get_time(node, "last");
+			if ((value = purple_xmlnode_get_attrib(node, "score")) != NULL)
+				entry->score = g_ascii_strtod(value, NULL);
+			entry->score_time = log_catalog_get_time(node, "scoretime");
+			if ((value = purple_xmlnode_get_attrib(node, "mtime")) != NULL)
+				entry->mtime = (time_t)g_ascii_strtoll(value, NULL, 10);
+			else
+				entry->mtime = -1;
+		}
+		entry->stats.last_activity = log_catalog_get_time(node, "activity");
+
+		g_hash_table_replace(catalog, g_strdup(dir), entry);
+	}
+
+	purple_xmlnode_free(root);
+}
+
+static void
+log_catalog_sync(void)
+{
+	PurpleXmlNode *root;
+	GHashTableIter iter;
+	gpointer key, value;
+	char *data;
+
+	if (catalog == NULL)
+		return;
+
+	root = purple_xmlnode_new("logcatalog");
+	purple_xmlnode_set_attrib(root, "version", "1.0");
+	purple_xmlnode_set_attrib(root, "loggers", catalog_loggers);
+	if (catalog_complete)
+		purple_xmlnode_set_attrib(root, "complete", "1");
+
+	g_hash_table_iter_init(&iter, catalog_dirs);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		PurpleXmlNode *node = purple_xmlnode_new_child(root, "dir");
+
+		purple_xmlnode_set_attrib(node, "path", key);
+		log_catalog_set_number(node, "mtime", *(time_t *)value);
+	}
+
+	g_hash_table_iter_init(&iter, catalog);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		PurpleLogCatalogEntry *entry = value;
+		PurpleXmlNode *node = purple_xmlnode_new_child(root, "set");
+
+		purple_xmlnode_set_attrib(node, "dir", key);
+		if (entry->scanned) {
+			char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+			log_catalog_set_number(node, "count", entry->stats.count);
+			log_catalog_set_number(node, "size", entry->stats.size);
+			log_catalog_set_number(node, "first", entry->stats.first);
+			log_catalog_set_number(node, "last", entry->stats.last);
+			purple_xmlnode_set_attrib(node, "score",
+					g_ascii_dtostr(buf, sizeof(buf), entry->score));
+			log_catalog_set_number(node, "scoretime", entry->score_time);
+			log_catalog_set_number(node, "mtime", entry->mtime);
+		}
+		if (entry->stats.last_activity != 0)
+			log_catalog_set_number(node, "activity", entry->stats.last_activity);
+	}
+
+	data = purple_xmlnode_to_formatted_str(root, NULL);
+	purple_util_write_data_to_file("logcatalog.xml", data, -1);
+	g_free(data);
+	purple_xmlnode_free(root);
+}
+
+static gboolean
+log_catalog_save_cb(gpointer data)
+{
+	log_catalog_sync();
+	catalog_save_timer = 0;
+	return FALSE;
+}
+
+static void
+log_catalog_schedule_save(void)
+{
+	if (catalog_save_timer == 0)
+		catalog_save_timer = purple_timeout_add_seconds(5, log_catalog_save_cb, NULL);
+}
+
+static GHashTable *
+log_catalog_get(void)
+{
+	if (catalog == NULL)
+		log_catalog_load();
+
+	return catalog;
+}
+
+static char *
+log_catalog_get_key(PurpleLogType type, const char *name, PurpleAccount *account)
+{
+	if (account == NULL || name == NULL)
+		return NULL;
+
+	return log_get_relative_dir(type, name, account, "/");
+}
+
+static double
+log_catalog_entry_get_score(const PurpleLogCatalogEntry *entry, time_t now)
+{
+	return entry->score *
+		pow(0.5, difftime(now, entry->score_time) / LOG_ACTIVITY_HALF_LIFE);
+}
+
+/* Fills in the stats of entry by listing the logs of every logger. The size
+ * comes from the total_size function of the loggers that have one. */
+static void
+log_catalog_entry_scan(PurpleLogCatalogEntry *entry, PurpleLogType type,
+		const char *name, PurpleAccount *account)
+{
+	GSList *n;
+	time_t now = time(NULL);
+	time_t last_activity = entry->stats.last_activity;
+
+	memset(&entry->stats, 0, sizeof(entry->stats));
+	entry->score = 0.0;
+
+	for (n = loggers; n; n = n->next) {
+		PurpleLogLogger *logger = n->data;
+		GList *logs;
+
+		if (logger->total_size)
+			entry->stats.size += logger->total_size(type, name, account);
+
+		if (!logger->list)
+			continue;
+
+		for (logs = logger->list(type, name, account); logs;
+				logs = g_list_delete_link(logs, logs)) {
+			PurpleLog *log = logs->data;
+			int size;
+
+			if (!log) {
+				g_warn_if_reached();
+				continue;
+			}
+
+			size = purple_log_get_size(log);
+			entry->stats.count++;
+			if (!logger->total_size)
+				entry->stats.size += size;
+			if (entry->stats.first == 0 || log->time < entry->stats.first)
+				entry->stats.first = log->time;
+			if (log->time > entry->stats.last)
+				entry->stats.last = log->time;
+			/* Activity score counts bytes in the log, exponentially
+			   decayed with the age of the log. */
+			entry->score += size *
+				pow(0.5, difftime(now, log->time) / LOG_ACTIVITY_HALF_LIFE);
+
+			purple_log_free(log);
+		}
+	}
+
+	entry->score_time = now;
+	entry->stats.last_activity = MAX(last_activity, entry->stats.last);
+	entry->scanned = TRUE;
+}
+
+/* Returns the catalog entry for the logs of a conversation, adding it if
+ * needed, and scanning its logs if scan is TRUE and its stats aren't known
+ * or its log directory changed since. Returns NULL if the logs can't be
+ * cataloged. */
+static PurpleLogCatalogEntry *
+log_catalog_lookup(PurpleLogType type, const char *name,
+		PurpleAccount *account, gboolean scan)
+{
+	PurpleLogCatalogEntry *entry;
+	char *key;
+
+	key = log_catalog_get_key(type, name, account);
+	if (key == NULL)
+		return NULL;
+
+	entry = g_hash_table_lookup(log_catalog_get(), key);
+	if (entry == NULL) {
+		entry = g_slice_new0(PurpleLogCatalogEntry);
+		g_hash_table_insert(catalog, g_strdup(key), entry);
+	}
+
+	if (scan) {
+		time_t mtime = log_catalog_get_mtime(key);
+
+		/* The logs may have been added or removed by someone else. */
+		if (!entry->scanned || mtime == -1 || mtime != entry->mtime) {
+			log_catalog_entry_scan(entry, type, name, account);
+			entry->mtime = mtime;
+			log_catalog_schedule_save();
+		}
+	}
+	g_free(key);
+
+	return entry;
+}
+
+/* Returns the scanned catalog entry for the logs of a conversation. Logs that
+ * can't be cataloged are scanned into fallback every time. */
+static const PurpleLogCatalogEntry *
+log_catalog_get_entry(PurpleLogType type, const char *name,
+		PurpleAccount *account, PurpleLogCatalogEntry *fallback)
+{
+	PurpleLogCatalogEntry *entry;
+
+	entry = log_catalog_lookup(type, name, account, TRUE);
+	if (entry != NULL)
+		return entry;
+
+	memset(fallback, 0, sizeof(*fallback));
+	log_catalog_entry_scan(fallback, type, name, account);
+	return fallback;
+}
+
+static void
+log_catalog_update(PurpleLog *log, time_t when, gsize written)
+{
+	PurpleLogCatalogEntry *entry;
+
+	if (written == 0)
+		return;
+
+	entry = log_catalog_lookup(log->type, log->name, log->account, FALSE);
+	if (entry == NULL)
+		return;
+
+	if (entry->scanned) {
+		time_t now = time(NULL);
+
+		/* Logs are started in order, so a log newer than the newest one
+		 * we know about is being written for the first time. */
+		if (entry->stats.count == 0 || log->time > entry->stats.last) {
+			entry->stats.count++;
+			if (entry->stats.first == 0)
+				entry->stats.first = log->time;
+			entry->stats.last = log->time;
+		}
+		entry->stats.size += written;
+		entry->score = log_catalog_entry_get_score(entry, now) + written;
+		entry->score_time = now;
+	}
+
+	if (when > entry->stats.last_activity)
+		entry->stats.last_activity = when;
+
+	log_catalog_schedule_save();
+}
+
+static void
+log_catalog_invalidate(PurpleLog *log)
+{
+	PurpleLogCatalogEntry *entry;
+	char *key;
+
+	if (catalog == NULL)
+		return;
+
+	key = log_catalog_get_key(log->type, log->name, log->account);
+	if (key == NULL)
+		return;
+
+	entry = g_hash_table_lookup(catalog, key);
+	if (entry != NULL && entry->scanned) {
+		entry->scanned = FALSE;
+		log_catalog_schedule_save();
+	}
+	g_free(key);
+}
+
+/**************************************************************************
+ * LOG SEARCH INDEX *******************************************************
+ **************************************************************************/
+
+/* The search index is saved in logindex.txt as a journal of lines
+ *
+ *   <op>\t<document>\t<word> <word> ...
+ *
+ * where op is '*' for the first words of a document, '+' for more words of
+ * a document and '-' to remove a document. Documents are identified by the
+ * logger, the log directory and the start time of their log. Writing a log
+ * only appends to the journal; it is replayed and folded into one line per
+ * document by the first search. Logs that weren't indexed from their start
+ * are read and indexed when they are searched. */
+
+/* Adds the casefolded words of text to words, skipping those in seen, if it
+ * isn't NULL, and adding the new ones to it. */
+static void
+log_index_split_words(GPtrArray *words, GHashTable *seen, const char *text,
+		gboolean markup)
+{
+	char *plain, *folded;
+	const char *p, *start = NULL;
+
+	if (text == NULL || *text == '\0')
+		return;
+
+	plain = markup ? purple_markup_strip_html(text) : g_strdup(text);
+	if (!g_utf8_validate(plain, -1, NULL)) {
+		char *tmp = purple_utf8_salvage(plain);
+		g_free(plain);
+		plain = tmp;
+	}
+	folded = g_utf8_casefold(plain, -1);
+	g_free(plain);
+
+	for (p = folded; ; p = g_utf8_next_char(p)) {
+		gunichar c = g_utf8_get_char(p);
+
+		if (c != 0 && g_unichar_isalnum(c)) {
+			if (start == NULL)
+				start = p;
+			continue;
+		}
+
+		if (start != NULL && p - start <= LOG_INDEX_MAX_WORD_LEN) {
+			char *word = g_strndup(start, p - start);
+
+			if (seen == NULL) {
+				g_ptr_array_add(words, word);
+			} else if (!g_hash_table_contains(seen, word)) {
+				g_ptr_array_add(words, word);
+				g_hash_table_add(seen, word);
+			} else {
+				g_free(word);
+			}
+		}
+		start = NULL;
+
+		if (c == 0)
+			break;
+	}
+
+	g_free(folded);
+}
+
+static char *
+log_index_get_key(PurpleLog *log)
+{
+	char *dir, *key;
+
+	if (log->logger == NULL || log->account == NULL || log->name == NULL)
+		return NULL;
+
+	dir = log_get_relative_dir(log->type, log->name, log->account, "/");
+	if (dir == NULL)
+		return NULL;
+
+	key = g_strdup_printf("%s/%s/%" G_GINT64_FORMAT, log->logger->id, dir,
+			(gint64)log->time);
+	g_free(dir);
+
+	return key;
+}
+
+/* Returns the position of the first id in ids that isn't less than id. */
+static guint
+log_index_ids_lower_bound(GArray *ids, guint id)
+{
+	guint low = 0, high = ids->len;
+
+	while (low < high) {
+		guint mid = low + (high - low) / 2;
+
+		if (g_array_index(ids, guint, mid) < id)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static gboolean
+log_index_ids_contain(GArray *ids, guint id)
+{
+	guint pos = log_index_ids_lower_bound(ids, id);
+
+	return pos < ids->len && g_array_index(ids, guint, pos) == id;
+}
+
+static void
+log_index_free_ids(GArray *ids)
+{
+	g_array_free(ids, TRUE);
+}
+
+static PurpleLogIndexDoc *
+log_index_lookup_doc(const char *key, guint *id)
+{
+	gpointer value = g_hash_table_lookup(index_docs, key);
+
+	if (value == NULL)
+		return NULL;
+
+	*id = GPOINTER_TO_UINT(value) - 1;
+	return &g_array_index(index_doc_list, PurpleLogIndexDoc, *id);
+}
+
+static void
+log_index_remove_doc(const char *key)
+{
+	PurpleLogIndexDoc *doc;
+	guint id;
+
+	/* The document's id is left in the word lists, where it is ignored. */
+	doc = log_index_lookup_doc(key, &id);
+	if (doc == NULL)
+		return;
+
+	g_hash_table_remove(index_docs, doc->key);
+	g_free(doc->key);
+	doc->key = NULL;
+	index_live_docs--;
+}
+
+/* Returns the id of the document for key, adding it if needed. A document
+ * being started over replaces the old one. */
+static guint
+log_index_get_doc(const char *key, gboolean start)
+{
+	PurpleLogIndexDoc doc;
+	guint id;
+
+	if (start)
+		log_index_remove_doc(key);
+	else if (log_index_lookup_doc(key, &id) != NULL)
+		return id;
+
+	doc.key = g_strdup(key);
+	doc.complete = start;
+	id = index_doc_list->len;
+	g_array_append_val(index_doc_list, doc);
+	g_hash_table_insert(index_docs, doc.key, GUINT_TO_POINTER(id + 1));
+	index_live_docs++;
+
+	return id;
+}
+
+static void
+log_index_add_word(guint id, const char *word)
+{
+	GArray *ids = g_hash_table_lookup(index_words, word);
+	guint pos;
+
+	if (ids == NULL) {
+		ids = g_array_new(FALSE, FALSE, sizeof(guint));
+		g_hash_table_insert(index_words, g_strdup(word), ids);
+	}
+
+	/* Words are mostly added to the newest document. */
+	if (ids->len == 0 || g_array_index(ids, guint, ids->len - 1) < id) {
+		g_array_append_val(ids, id);
+		return;
+	}
+
+	pos = log_index_ids_lower_bound(ids, id);
+	if (g_array_index(ids, guint, pos) != id)
+		g_array_insert_val(ids, pos, id);
+}
+
+/* Applies a line of the journal to the index. The line is modified. */
+static void
+log_index_apply_line(char *line)
+{
+	char *key, *words, *word, *next;
+	guint id;
+
+	if (line[0] == '\0' || line[1] != '\t')
+		return;
+
+	key = line + 2;
+	if ((words = strchr(key, '\t')) != NULL)
+		*words++ = '\0';
+	if (*key == '\0')
+		return;
+
+	if (line[0] == '-') {
+		log_index_remove_doc(key);
+		return;
+	} else if (line[0] != '*' && line[0] != '+') {
+		return;
+	}
+
+	id = log_index_get_doc(key, line[0] == '*');
+	for (word = words; word != NULL && *word != '\0'; word = next) {
+		if ((next = strchr(word, ' ')) != NULL)
+			*next++ = '\0';
+		if (*word != '\0')
+			log_index_add_word(id, word);
+	}
+}
+
+/* Rewrites logindex.txt with one line per document. */
+static void
+log_index_compact(void)
+{
+	GString **doc_words;
+	GString *data;
+	GHashTableIter iter;
+	gpointer key, value;
+	guint i;
+
+	doc_words = g_new0(GString *, index_doc_list->len);
+
+	g_hash_table_iter_init(&iter, index_words);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		GArray *ids = value;
+
+		for (i = 0; i < ids->len; i++) {
+			guint id = g_array_index(ids, guint, i);
+
+			if (g_array_index(index_doc_list, PurpleLogIndexDoc, id).key == NULL)
+				continue;
+
+			if (doc_words[id] == NULL)
+				doc_words[id] = g_string_new(key);
+			else {
+				g_string_append_c(doc_words[id], ' ');
+				g_string_append(doc_words[id], key);
+			}
+		}
+	}
+
+	data = g_string_new(NULL);
+	index_file_lines = 0;
+	for (i = 0; i < index_doc_list->len; i++) {
+		PurpleLogIndexDoc *doc = &g_array_index(index_doc_list, PurpleLogIndexDoc, i);
+
+		if (doc->key != NULL) {
+			g_string_append_printf(data, "%c\t%s\t%s\n",
+					doc->complete ? '*' : '+', doc->key,
+					doc_words[i] ? doc_words[i]->str : "");
+			index_file_lines++;
+		}
+		if (doc_words[i] != NULL)
+			g_string_free(doc_words[i], TRUE);
+	}
+	g_free(doc_words);
+
+	purple_util_write_data_to_file("logindex.txt", data->str, data->len);
+	g_string_free(data, TRUE);
+	index_needs_compact = FALSE;
+}
+
+static void
+log_index_flush(void)
+{
+	if (index_words != NULL &&
+			(index_needs_compact || index_file_lines > 2 * index_live_docs + 1000)) {
+		/* The journal is already applied to the index in memory. */
+		log_index_compact();
+	} else if (index_journal != NULL && index_journal->len > 0) {
+		purple_util_append_data_to_file("logindex.txt", index_journal->str,
+				index_journal->len);
+	}
+
+	if (index_journal != NULL)
+		g_string_truncate(index_journal, 0);
+}
+
+static gboolean
+log_index_save_cb(gpointer data)
+{
+	log_index_flush();
+	index_save_timer = 0;
+	return FALSE;
+}
+
+static void
+log_index_load(void)
+{
+	char *filename, *contents = NULL;
+	char *line, *next;
+	GError *error = NULL;
+
+	/* Make sure everything written so far is in the file. */
+	log_index_flush();
+
+	index_words = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify)log_index_free_ids);
+	index_docs = g_hash_table_new(g_str_hash, g_str_equal);
+	index_doc_list = g_array_new(FALSE, FALSE, sizeof(PurpleLogIndexDoc));
+	index_live_docs = 0;
+	index_file_lines = 0;
+
+	filename = g_build_filename(purple_user_dir(), "logindex.txt", NULL);
+	if (!g_file_get_contents(filename, &contents, NULL, &error)) {
+		if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			purple_debug_error("log", "Error reading %s: %s\n", filename, error->message);
+		g_clear_error(&error);
+		g_free(filename);
+		return;
+	}
+	g_free(filename);
+
+	for (line = contents; *line != '\0'; line = next) {
+		if ((next = strchr(line, '\n')) == NULL) {
+			/* A write was cut short. Don't let the next one be appended to
+			 * the partial line. */
+			purple_debug_warning("log", "Dropping a truncated line of the log index\n");
+			index_needs_compact = TRUE;
+			break;
+		}
+		*next++ = '\0';
+		log_index_apply_line(line);
+		index_file_lines++;
+	}
+	g_free(contents);
+
+	if (index_needs_compact)
+		log_index_compact();
+}
+
+/* Adds a line to the journal, and to the index if it is loaded. */
+static void
+log_index_journal(char op, const char *key, GPtrArray *words)
+{
+	gsize start;
+	guint i;
+
+	if (index_journal == NULL)
+		index_journal = g_string_new(NULL);
+
+	start = index_journal->len;
+	g_string_append_c(index_journal, op);
+	g_string_append_c(index_journal, '\t');
+	g_string_append(index_journal, key);
+	if (words != NULL) {
+		g_string_append_c(index_journal, '\t');
+		for (i = 0; i < words->len; i++) {
+			if (i > 0)
+				g_string_append_c(index_journal, ' ');
+			g_string_append(index_journal, words->pdata[i]);
+		}
+	}
+	g_string_append_c(index_journal, '\n');
+	index_file_lines++;
+
+	if (index_words != NULL) {
+		char *line = g_strndup(index_journal->str + start,
+				index_journal->len - start - 1);
+		log_index_apply_line(line);
+		g_free(line);
+	}
+
+	if (index_save_timer == 0)
+		index_save_timer = purple_timeout_add_seconds(5, log_index_save_cb, NULL);
+}
+
+static void
+log_index_write(PurpleLog *log, const char *from, const char *message)
+{
+	GPtrArray *words;
+	GHashTable *seen;
+	gboolean start;
+	char *key;
+
+	key = log_index_get_key(log);
+	if (key == NULL)
+		return;
+
+	/* The first write of a log in this session is its start. */
+	start = !g_hash_table_contains(index_written_logs, log);
+	if (start)
+		g_hash_table_add(index_written_logs, log);
+
+	words = g_ptr_array_new_with_free_func(g_free);
+	seen = g_hash_table_new(g_str_hash, g_str_equal);
+	log_index_split_words(words, seen, from, FALSE);
+	log_index_split_words(words, seen, message, TRUE);
+	g_hash_table_destroy(seen);
+
+	if (start || words->len > 0)
+		log_index_journal(start ? '*' : '+', key, words);
+
+	g_ptr_array_free(words, TRUE);
+	g_free(key);
+}
+
+static void
+log_index_delete(PurpleLog *log)
+{
+	char *key = log_index_get_key(log);
+
+	if (key != NULL) {
+		log_index_journal('-', key, NULL);
+		g_free(key);
+	}
+}
+
+/* Reads all of a log into the index. */
+static void
+log_index_read_log(PurpleLog *log, const char *key)
+{
+	GPtrArray *words = g_ptr_array_new_with_free_func(g_free);
+	GHashTable *seen = g_hash_table_new(g_str_hash, g_str_equal);
+	char *text = purple_log_read(log, NULL);
+
+	log_index_split_words(words, seen, text, TRUE);
+	log_index_journal('*', key, words);
+
+	g_free(text);
+	g_hash_table_destroy(seen);
+	g_ptr_array_free(words, TRUE);
+}
+
+static gint
+log_index_compare_ids(gconstpointer a, gconstpointer b)
+{
+	guint id_a = *(const guint *)a, id_b = *(const guint *)b;
 
-static void log_get_log_sets_common(GHashTable *sets);
+	return (id_a > id_b) - (id_a < id_b);
+}
 
-static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
-							  const char *from, time_t time, const char *message);
-static void html_logger_finalize(PurpleLog *log);
-static GList *html_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account);
-static GList *html_logger_list_syslog(PurpleAccount *account);
-static char *html_logger_read(PurpleLog *log, PurpleLogReadFlags *flags);
-static int html_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account);
+/* Returns the sorted ids of the documents which have a word starting with
+ * prefix, or NULL if there are none. */
+static GArray *
+log_index_find_prefix(const char *prefix)
+{
+	GArray *result = NULL;
+	GHashTableIter iter;
+	gpointer key, value;
+	guint i, len;
 
-static GList *old_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account);
-static int old_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account);
-static char * old_logger_read (PurpleLog *log, PurpleLogReadFlags *flags);
-static int old_logger_size (PurpleLog *log);
-static void old_logger_get_log_sets(PurpleLogSetCallback cb, GHashTable *sets);
-static void old_logger_finalize(PurpleLog *log);
+	g_hash_table_iter_init(&iter, index_words);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		GArray *ids = value;
 
-static gsize txt_logger_write(PurpleLog *log,
-							 PurpleMessageFlags type,
-							 const char *from, time_t time, const char *message);
-static void txt_logger_finalize(PurpleLog *log);
-static GList *txt_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account);
-static GList *txt_logger_list_syslog(PurpleAccount *account);
-static char *txt_logger_read(PurpleLog *log, PurpleLogReadFlags *flags);
-static int txt_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account);
+		if (!g_str_has_prefix(key, prefix))
+			continue;
+
+		if (result == NULL)
+			result = g_array_new(FALSE, FALSE, sizeof(guint));
+		g_array_append_vals(result, ids->data, ids->len);
+	}
+
+	if (result == NULL)
+		return NULL;
+
+	g_array_sort(result, log_index_compare_ids);
+	for (i = 0, len = 0; i < result->len; i++) {
+		guint id = g_array_index(result, guint, i);
+
+		if (len == 0 || g_array_index(result, guint, len - 1) != id)
+			g_array_index(result, guint, len++) = id;
+	}
+	g_array_set_size(result, len);
+
+	return result;
+}
+
+/* Returns the ids of the documents which have all of terms. A term that
+ * isn't a word of any document matches the words it starts, so that a
+ * search finds what is being typed. */
+static GArray *
+log_index_find(GPtrArray *terms)
+{
+	GArray *result = g_array_new(FALSE, FALSE, sizeof(guint));
+	guint i;
+
+	for (i = 0; i < terms->len; i++) {
+		GArray *ids = g_hash_table_lookup(index_words, terms->pdata[i]);
+		GArray *prefixed = NULL;
+		guint j, k, len = 0;
+
+		if (ids == NULL)
+			ids = prefixed = log_index_find_prefix(terms->pdata[i]);
+
+		if (ids == NULL) {
+			g_array_set_size(result, 0);
+			break;
+		}
+
+		if (i == 0) {
+			g_array_append_vals(result, ids->data, ids->len);
+			if (prefixed != NULL)
+				g_array_free(prefixed, TRUE);
+			continue;
+		}
+
+		for (j = 0, k = 0; j < result->len && k < ids->len; ) {
+			guint a = g_array_index(result, guint, j);
+			guint b = g_array_index(ids, guint, k);
+
+			if (a < b) {
+				j++;
+			} else if (a > b) {
+				k++;
+			} else {
+				g_array_index(result, guint, len++) = a;
+				j++;
+				k++;
+			}
+		}
+		g_array_set_size(result, len);
+
+		if (prefixed != NULL)
+			g_array_free(prefixed, TRUE);
+	}
+
+	return result;
+}
+
+static void
+log_search_parse_query(const char *query, GPtrArray *terms, GPtrArray *phrases)
+{
+	GHashTable *seen = g_hash_table_new(g_str_hash, g_str_equal);
+	gchar **parts = g_strsplit(query, "\"", -1);
+	guint i, j;
+
+	for (i = 0; parts[i] != NULL; i++) {
+		GPtrArray *words = g_ptr_array_new_with_free_func(g_free);
+
+		log_index_split_words(words, NULL, parts[i], FALSE);
+		for (j = 0; j < words->len; j++) {
+			if (!g_hash_table_contains(seen, words->pdata[j])) {
+				char *term = g_strdup(words->pdata[j]);
+				g_ptr_array_add(terms, term);
+				g_hash_table_add(seen, term);
+			}
+		}
+
+		/* Every other part is in double quotes. */
+		if (i % 2 == 1 && words->len > 1)
+			g_ptr_array_add(phrases, words);
+		else
+			g_ptr_array_free(words, TRUE);
+	}
+
+	g_strfreev(parts);
+	g_hash_table_destroy(seen);
+}
+
+static gboolean
+log_search_has_phrase(GPtrArray *words, GPtrArray *phrase)
+{
+	guint i, j;
+
+	for (i = 0; i + phrase->len <= words->len; i++) {
+		for (j = 0; j < phrase->len; j++) {
+			if (!purple_strequal(words->pdata[i + j], phrase->pdata[j]))
+				break;
+		}
+		if (j == phrase->len)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static gboolean
+log_search_has_prefix(GPtrArray *words, const char *prefix)
+{
+	guint i;
+
+	for (i = 0; i < words->len; i++) {
+		if (g_str_has_prefix(words->pdata[i], prefix))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Reads a log to find out whether it matches a query. */
+static gboolean
+log_search_read_log(PurpleLog *log, GPtrArray *terms, GPtrArray *phrases)
+{
+	GPtrArray *words = g_ptr_array_new_with_free_func(g_free);
+	GHashTable *present = g_hash_table_new(g_str_hash, g_str_equal);
+	char *text = purple_log_read(log, NULL);
+	gboolean ret = TRUE;
+	guint i;
+
+	log_index_split_words(words, NULL, text, TRUE);
+	g_free(text);
+
+	for (i = 0; i < words->len; i++)
+		g_hash_table_add(present, words->pdata[i]);
+
+	/* As in the index, a term that isn't a word may start one. */
+	for (i = 0; ret && i < terms->len; i++) {
+		ret = g_hash_table_contains(present, terms->pdata[i]);
+		if (!ret)
+			ret = log_search_has_prefix(words, terms->pdata[i]);
+	}
+
+	for (i = 0; ret && i < phrases->len; i++)
+		ret = log_search_has_phrase(words, phrases->pdata[i]);
+
+	g_hash_table_destroy(present);
+	g_ptr_array_free(words, TRUE);
+
+	return ret;
+}
+
+/* Adds the casefolded tokens of a query that the index can't answer for to
+ * substrings. Those are tokens with characters that aren't part of words,
+ * like "C++", or with words too long to be indexed. */
+static void
+log_search_get_substrings(const char *query, GPtrArray *substrings)
+{
+	const char *p, *token = NULL, *word = NULL;
+	gboolean indexable = TRUE;
+
+	for (p = query; ; p = g_utf8_next_char(p)) {
+		gunichar c = g_utf8_get_char(p);
+
+		if (c != 0 && g_unichar_isalnum(c)) {
+			if (token == NULL)
+				token = p;
+			if (word == NULL)
+				word = p;
+			continue;
+		}
+
+		if (word != NULL && p - word > LOG_INDEX_MAX_WORD_LEN)
+			indexable = FALSE;
+		word = NULL;
+
+		if (c != 0 && c != '"' && !g_unichar_isspace(c)) {
+			if (token == NULL)
+				token = p;
+			indexable = FALSE;
+			continue;
+		}
+
+		if (token != NULL && !indexable)
+			g_ptr_array_add(substrings, g_utf8_casefold(token, p - token));
+		token = NULL;
+		indexable = TRUE;
+
+		if (c == 0)
+			break;
+	}
+}
+
+/* Reads a log to find out whether it contains all of substrings, the way
+ * the log viewers used to search. */
+static gboolean
+log_search_read_substrings(PurpleLog *log, GPtrArray *substrings)
+{
+	char *read = purple_log_read(log, NULL);
+	char *plain, *folded;
+	gboolean ret = TRUE;
+	guint i;
+
+	if (read == NULL)
+		return FALSE;
+
+	plain = purple_markup_strip_html(read);
+	g_free(read);
+	if (!g_utf8_validate(plain, -1, NULL)) {
+		char *tmp = purple_utf8_salvage(plain);
+		g_free(plain);
+		plain = tmp;
+	}
+	folded = g_utf8_casefold(plain, -1);
+	g_free(plain);
+
+	for (i = 0; ret && i < substrings->len; i++)
+		ret = strstr(folded, substrings->pdata[i]) != NULL;
+	g_free(folded);
+
+	return ret;
+}
+
+static gboolean
+log_search_in_range(PurpleLog *log, time_t start, time_t end)
+{
+	return (start == 0 || log->time >= start) && (end == 0 || log->time < end);
+}
 
 /**************************************************************************
  * PUBLIC LOGGING FUNCTIONS ***********************************************
@@ -122,6 +1299,8 @@ PurpleLog *purple_log_new(PurpleLogType type, const char *name, PurpleAccount *a
 void purple_log_free(PurpleLog *log)
 {
 	g_return_if_fail(log);
+	if (index_written_logs != NULL)
+		g_hash_table_remove(index_written_logs, log);
 	if (log->logger && log->logger->finalize)
 		log->logger->finalize(log);
 	g_free(log->name);
@@ -142,9 +1321,7 @@ void purple_log_free(PurpleLog *log)
 void purple_log_write(PurpleLog *log, PurpleMessageFlags type,
 		    const char *from, time_t time, const char *message)
 {
-	struct _purple_logsize_user *lu;
-	gsize written, total = 0;
-	gpointer ptrsize;
+	gsize written;
 
 	g_return_if_fail(log);
 	g_return_if_fail(log->logger);
@@ -152,33 +1329,8 @@ void purple_log_write(PurpleLog *log, PurpleMessageFlags type,
 
 	written = (log->logger->write)(log, type, from, time, message);
 
-	lu = g_new(struct _purple_logsize_user, 1);
-
-	lu->name = g_strdup(purple_normalize(log->account, log->name));
-	lu->account = log->account;
-
-	if(g_hash_table_lookup_extended(logsize_users, lu, NULL, &ptrsize)) {
-		char *tmp = lu->name;
-
-		total = GPOINTER_TO_INT(ptrsize);
-		total += written;
-		g_hash_table_replace(logsize_users, lu, GINT_TO_POINTER(total));
-
-		/* The hash table takes ownership of lu, so create a new one
-		 * for the logsize_users_decayed check below. */
-		lu = g_new(struct _purple_logsize_user, 1);
-		lu->name = g_strdup(tmp);
-		lu->account = log->account;
-	}
-
-	if(g_hash_table_lookup_extended(logsize_users_decayed, lu, NULL, &ptrsize)) {
-		total = GPOINTER_TO_INT(ptrsize);
-		total += written;
-		g_hash_table_replace(logsize_users_decayed, lu, GINT_TO_POINTER(total));
-	} else {
-		g_free(lu->name);
-		g_free(lu);
-	}
+	log_catalog_update(log, time, written);
+	log_index_write(log, from, message);
 }
 
 char *purple_log_read(PurpleLog *log, PurpleLogReadFlags *flags)
@@ -202,109 +1354,117 @@ int purple_log_get_size(PurpleLog *log)
 	return 0;
 }
 
-static guint _purple_logsize_user_hash(struct _purple_logsize_user *lu)
+int purple_log_get_total_size(PurpleLogType type, const char *name, PurpleAccount *account)
 {
-	return g_str_hash(lu->name);
+	PurpleLogCatalogEntry fallback;
+
+	return log_catalog_get_entry(type, name, account, &fallback)->stats.size;
 }
 
-static guint _purple_logsize_user_equal(struct _purple_logsize_user *lu1,
-		struct _purple_logsize_user *lu2)
+gint purple_log_get_activity_score(PurpleLogType type, const char *name, PurpleAccount *account)
 {
-	return (lu1->account == lu2->account && purple_strequal(lu1->name, lu2->name));
+	PurpleLogCatalogEntry fallback;
+	const PurpleLogCatalogEntry *entry;
+
+	entry = log_catalog_get_entry(type, name, account, &fallback);
+
+	return (gint)ceil(log_catalog_entry_get_score(entry, time(NULL)));
 }
 
-static void _purple_logsize_user_free_key(struct _purple_logsize_user *lu)
+void purple_log_get_stats(PurpleLogType type, const char *name, PurpleAccount *account, PurpleLogStats *stats)
 {
-	g_free(lu->name);
-	g_free(lu);
+	PurpleLogCatalogEntry fallback;
+
+	g_return_if_fail(stats != NULL);
+
+	*stats = log_catalog_get_entry(type, name, account, &fallback)->stats;
 }
 
-int purple_log_get_total_size(PurpleLogType type, const char *name, PurpleAccount *account)
+GList *purple_log_search(GList *logs, const char *query, time_t start, time_t end)
 {
-	gpointer ptrsize;
-	int size = 0;
-	GSList *n;
-	struct _purple_logsize_user *lu;
+	GPtrArray *terms, *phrases;
+	GArray *matches = NULL;
+	GPtrArray *substrings;
+	GList *l, *ret = NULL;
+
+	g_return_val_if_fail(query != NULL, NULL);
+
+	terms = g_ptr_array_new_with_free_func(g_free);
+	phrases = g_ptr_array_new_with_free_func((GDestroyNotify)g_ptr_array_unref);
+	log_search_parse_query(query, terms, phrases);
+
+	/* Tokens like "C++" are looked for as substrings of the logs that the
+	 * indexable words of the query, if there are any, match. */
+	substrings = g_ptr_array_new_with_free_func(g_free);
+	log_search_get_substrings(query, substrings);
+
+	if (terms->len == 0 && substrings->len == 0) {
+		g_ptr_array_free(terms, TRUE);
+		g_ptr_array_free(phrases, TRUE);
+		g_ptr_array_free(substrings, TRUE);
+		return NULL;
+	}
 
-	lu = g_new(struct _purple_logsize_user, 1);
-	lu->name = g_strdup(purple_normalize(account, name));
-	lu->account = account;
+	if (terms->len > 0 && index_words == NULL)
+		log_index_load();
 
-	if(g_hash_table_lookup_extended(logsize_users, lu, NULL, &ptrsize)) {
-		size = GPOINTER_TO_INT(ptrsize);
-		g_free(lu->name);
-		g_free(lu);
-	} else {
-		for (n = loggers; n; n = n->next) {
-			PurpleLogLogger *logger = n->data;
-
-			if(logger->total_size){
-				size += (logger->total_size)(type, name, account);
-			} else if(logger->list) {
-				GList *logs = (logger->list)(type, name, account);
-				int this_size = 0;
-
-				while (logs) {
-					PurpleLog *log = (PurpleLog*)(logs->data);
-					this_size += purple_log_get_size(log);
-					purple_log_free(log);
-					logs = g_list_delete_link(logs, logs);
-				}
+	/* Index the logs that aren't yet. */
+	for (l = logs; terms->len > 0 && l != NULL; l = l->next) {
+		PurpleLog *log = l->data;
+		PurpleLogIndexDoc *doc;
+		char *key;
+		guint id;
 
-				size += this_size;
-			}
-		}
+		if (!log_search_in_range(log, start, end))
+			continue;
+		if ((key = log_index_get_key(log)) == NULL)
+			continue;
 
-		g_hash_table_replace(logsize_users, lu, GINT_TO_POINTER(size));
+		doc = log_index_lookup_doc(key, &id);
+		if (doc == NULL || !doc->complete)
+			log_index_read_log(log, key);
+		g_free(key);
 	}
-	return size;
-}
 
-gint purple_log_get_activity_score(PurpleLogType type, const char *name, PurpleAccount *account)
-{
-	gpointer ptrscore;
-	int score;
-	GSList *n;
-	struct _purple_logsize_user *lu;
-	time_t now;
-	time(&now);
-
-	lu = g_new(struct _purple_logsize_user, 1);
-	lu->name = g_strdup(purple_normalize(account, name));
-	lu->account = account;
-
-	if(g_hash_table_lookup_extended(logsize_users_decayed, lu, NULL, &ptrscore)) {
-		score = GPOINTER_TO_INT(ptrscore);
-		g_free(lu->name);
-		g_free(lu);
-	} else {
-		double score_double = 0.0;
-		for (n = loggers; n; n = n->next) {
-			PurpleLogLogger *logger = n->data;
-
-			if(logger->list) {
-				GList *logs = (logger->list)(type, name, account);
-
-				while (logs) {
-					PurpleLog *log = (PurpleLog*)(logs->data);
-					if (!log) {
-						g_warn_if_reached();
-						continue;
-					}
-					/* Activity score counts bytes in the log, exponentially
-					   decayed with a half-life of 14 days. */
-					score_double += purple_log_get_size(log) *
-						pow(0.5, difftime(now, log->time)/1209600.0);
-					purple_log_free(log);
-					logs = g_list_delete_link(logs, logs);
-				}
-			}
+	if (terms->len > 0)
+		matches = log_index_find(terms);
+
+	for (l = logs; l != NULL; l = l->next) {
+		PurpleLog *log = l->data;
+		gboolean matched;
+		char *key;
+		guint id;
+
+		if (!log_search_in_range(log, start, end))
+			continue;
+
+		if (terms->len == 0) {
+			matched = TRUE;
+		} else if ((key = log_index_get_key(log)) != NULL) {
+			matched = log_index_lookup_doc(key, &id) != NULL &&
+				log_index_ids_contain(matches, id);
+			/* The index doesn't know the order of the words. */
+			if (matched && phrases->len > 0)
+				matched = log_search_read_log(log, terms, phrases);
+			g_free(key);
+		} else {
+			matched = log_search_read_log(log, terms, phrases);
 		}
 
-		score = (gint) ceil(score_double);
-		g_hash_table_replace(logsize_users_decayed, lu, GINT_TO_POINTER(score));
+		if (matched && substrings->len > 0)
+			matched = log_search_read_substrings(log, substrings);
+
+		if (matched)
+			ret = g_list_prepend(ret, log);
 	}
-	return score;
+
+	if (matches != NULL)
+		g_array_free(matches, TRUE);
+	g_ptr_array_free(terms, TRUE);
+	g_ptr_array_free(phrases, TRUE);
+	g_ptr_array_free(substrings, TRUE);
+
+	return g_list_reverse(ret);
 }
 
 gboolean purple_log_is_deletable(PurpleLog *log)
@@ -326,14 +1486,20 @@ gboolean purple_log_delete(PurpleLog *log)
 	g_return_val_if_fail(log != NULL, FALSE);
 	g_return_val_if_fail(log->logger != NULL, FALSE);
 
-	if (log->logger->remove != NULL)
-		return log->logger->remove(log);
+	if (log->logger->remove != NULL && log->logger->remove(log)) {
+		log_catalog_invalidate(log);
+		log_index_delete(log);
+		return TRUE;
+	}
 
 	return FALSE;
 }
 
-char *
-purple_log_get_log_dir(PurpleLogType type, const char *name, PurpleAccount *account)
+/* Returns the log directory of a conversation relative to the logs
+ * directory, with its components joined by separator. */
+static char *
+log_get_relative_dir(PurpleLogType type, const char *name, PurpleAccount *account,
+		const char *separator)
 {
 	PurpleProtocol *protocol;
 	const char *protocol_name;
@@ -360,13 +1526,29 @@ purple_log_get_log_dir(PurpleLogType type, const char *name, PurpleAccount *acco
 		target = purple_escape_filename(purple_normalize(account, name));
 	}
 
-	dir = g_build_filename(purple_user_dir(), "logs", protocol_name, acct_name, target, NULL);
+	dir = g_strjoin(separator, protocol_name, acct_name, target, NULL);
 
 	g_free(acct_name);
 
 	return dir;
 }
 
+char *
+purple_log_get_log_dir(PurpleLogType type, const char *name, PurpleAccount *account)
+{
+	char *relative_dir;
+	char *dir;
+
+	relative_dir = log_get_relative_dir(type, name, account, G_DIR_SEPARATOR_S);
+	if (relative_dir == NULL)
+		return NULL;
+
+	dir = g_build_filename(purple_user_dir(), "logs", relative_dir, NULL);
+	g_free(relative_dir);
+
+	return dir;
+}
+
 /****************************************************************************
  * LOGGER FUNCTIONS *********************************************************
  ****************************************************************************/
@@ -464,6 +1646,24 @@ void purple_log_logger_add (PurpleLogLogger *logger)
 	if (g_slist_find(loggers, logger))
 		return;
 	loggers = g_slist_append(loggers, logger);
+
+	/* The catalog doesn't know about the logs of a new logger. Removed
+	 * loggers are left alone, as they usually come back on the next start. */
+	if (catalog != NULL && logger->list) {
+		char *ids = log_catalog_get_loggers();
+
+		if (!purple_strequal(ids, catalog_loggers)) {
+			g_hash_table_remove_all(catalog);
+			g_hash_table_remove_all(catalog_dirs);
+			catalog_complete = FALSE;
+			g_free(catalog_loggers);
+			catalog_loggers = ids;
+			log_catalog_schedule_save();
+		} else {
+			g_free(ids);
+		}
+	}
+
 	if (purple_strequal(purple_prefs_get_string("/purple/logging/format"), logger->id)) {
 		purple_prefs_trigger_callback("/purple/logging/format");
 	}
@@ -715,12 +1915,7 @@ void purple_log_init(void)
 							    logger_pref_cb, NULL);
 	purple_prefs_trigger_callback("/purple/logging/format");
 
-	logsize_users = g_hash_table_new_full((GHashFunc)_purple_logsize_user_hash,
-			(GEqualFunc)_purple_logsize_user_equal,
-			(GDestroyNotify)_purple_logsize_user_free_key, NULL);
-	logsize_users_decayed = g_hash_table_new_full((GHashFunc)_purple_logsize_user_hash,
-				(GEqualFunc)_purple_logsize_user_equal,
-				(GDestroyNotify)_purple_logsize_user_free_key, NULL);
+	index_written_logs = g_hash_table_new(g_direct_hash, g_direct_equal);
 }
 
 void
@@ -728,6 +1923,44 @@ purple_log_uninit(void)
 {
 	purple_signals_unregister_by_instance(purple_log_get_handle());
 
+	if (catalog_save_timer != 0) {
+		purple_timeout_remove(catalog_save_timer);
+		catalog_save_timer = 0;
+		log_catalog_sync();
+	}
+	if (catalog != NULL) {
+		g_hash_table_destroy(catalog);
+		catalog = NULL;
+		g_hash_table_destroy(catalog_dirs);
+		catalog_dirs = NULL;
+	}
+	g_free(catalog_loggers);
+	catalog_loggers = NULL;
+
+	if (index_save_timer != 0) {
+		purple_timeout_remove(index_save_timer);
+		index_save_timer = 0;
+	}
+	log_index_flush();
+	if (index_words != NULL) {
+		guint i;
+
+		for (i = 0; i < index_doc_list->len; i++)
+			g_free(g_array_index(index_doc_list, PurpleLogIndexDoc, i).key);
+		g_array_free(index_doc_list, TRUE);
+		index_doc_list = NULL;
+		g_hash_table_destroy(index_docs);
+		index_docs = NULL;
+		g_hash_table_destroy(index_words);
+		index_words = NULL;
+	}
+	if (index_journal != NULL) {
+		g_string_free(index_journal, TRUE);
+		index_journal = NULL;
+	}
+	g_hash_table_destroy(index_written_logs);
+	index_written_logs = NULL;
+
 	purple_log_logger_remove(html_logger);
 	purple_log_logger_free(html_logger);
 	html_logger = NULL;
@@ -739,9 +1972,6 @@ purple_log_uninit(void)
 	purple_log_logger_remove(old_logger);
 	purple_log_logger_free(old_logger);
 	old_logger = NULL;
-
-	g_hash_table_destroy(logsize_users);
-	g_hash_table_destroy(logsize_users_decayed);
 }
 
 static PurpleLog *
@@ -1074,113 +2304,203 @@ int purple_log_common_sizer(PurpleLog *log)
 	return st.st_size;
 }
 
+/* Returns the accounts whose logs are in the (escaped) protocol directory. */
+static GList *log_get_protocol_accounts(const char *protocol_dir)
+{
+	gchar *protocol_unescaped;
+	GList *account_iter;
+	GList *accounts = NULL;
+
+	/* Using g_strdup() to cover the one-in-a-million chance that a
+	 * protocol's list_icon function uses purple_unescape_filename(). */
+	protocol_unescaped = g_strdup(purple_unescape_filename(protocol_dir));
+
+	/* Find all the accounts for protocol. */
+	for (account_iter = purple_accounts_get_all() ; account_iter != NULL ; account_iter = account_iter->next) {
+		PurpleProtocol *protocol;
+
+		protocol = purple_protocols_find(purple_account_get_protocol_id((PurpleAccount *)account_iter->data));
+		if (!protocol)
+			continue;
+
+		if (purple_strequal(protocol_unescaped, purple_protocol_class_list_icon(protocol, (PurpleAccount *)account_iter->data, NULL)))
+			accounts = g_list_prepend(accounts, account_iter->data);
+	}
+	g_free(protocol_unescaped);
+
+	return accounts;
+}
+
+/* Creates the log set for the (escaped) username/name log directory of a
+ * protocol, whose accounts are given. */
+static PurpleLogSet *log_set_new_common(GList *accounts, const char *username,
+		const char *dir_name)
+{
+	GList *account_iter;
+	const gchar *username_unescaped;
+	PurpleAccount *account = NULL;
+	PurpleLogSet *set;
+	gchar *name;
+	size_t len;
+
+	/* Find the account for username in the list of accounts for protocol. */
+	username_unescaped = purple_unescape_filename(username);
+	for (account_iter = g_list_first(accounts) ; account_iter != NULL ; account_iter = account_iter->next) {
+		if (purple_strequal(purple_account_get_username((PurpleAccount *)account_iter->data), username_unescaped)) {
+			account = account_iter->data;
+			break;
+		}
+	}
+
+	/* IMPORTANT: Always initialize all members of PurpleLogSet */
+	set = g_slice_new(PurpleLogSet);
+
+	/* Unescape the filename. */
+	name = g_strdup(purple_unescape_filename(dir_name));
+
+	/* Get the (possibly new) length of name. */
+	len = strlen(name);
+
+	set->type = PURPLE_LOG_IM;
+	set->name = name;
+	set->account = account;
+	/* set->buddy is always set below */
+	set->normalized_name = g_strdup(purple_normalize(account, name));
+
+	/* Check for .chat or .system at the end of the name to determine the type. */
+	if (len >= 7) {
+		gchar *tmp = &name[len - 7];
+		if (purple_strequal(tmp, ".system")) {
+			set->type = PURPLE_LOG_SYSTEM;
+			*tmp = '\0';
+		}
+	}
+	if (len > 5) {
+		gchar *tmp = &name[len - 5];
+		if (purple_strequal(tmp, ".chat")) {
+			set->type = PURPLE_LOG_CHAT;
+			*tmp = '\0';
+		}
+	}
+
+	/* Determine if this (account, name) combination exists as a buddy. */
+	if (account != NULL && *name != '\0')
+		set->buddy = (purple_blist_find_buddy(account, name) != NULL);
+	else
+		set->buddy = FALSE;
+
+	return set;
+}
+
+/* Builds the log sets of the common loggers from the log catalog, once it
+ * knows about every log directory. */
+static void log_get_log_sets_catalog(GHashTable *sets)
+{
+	GHashTable *protocols;
+	GHashTableIter iter;
+	gpointer key, value;
+
+	protocols = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify)g_list_free);
+
+	g_hash_table_iter_init(&iter, catalog);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		PurpleLogCatalogEntry *entry = value;
+		gchar **dirs;
+
+		if (entry->scanned && entry->stats.count == 0)
+			continue;
+
+		dirs = g_strsplit(key, "/", 3);
+		if (g_strv_length(dirs) == 3) {
+			GList *accounts;
+
+			if (!g_hash_table_lookup_extended(protocols, dirs[0], NULL, (gpointer *)&accounts)) {
+				accounts = log_get_protocol_accounts(dirs[0]);
+				g_hash_table_insert(protocols, g_strdup(dirs[0]), accounts);
+			}
+
+			log_add_log_set_to_hash(sets, log_set_new_common(accounts, dirs[1], dirs[2]));
+		}
+		g_strfreev(dirs);
+	}
+
+	g_hash_table_destroy(protocols);
+}
+
 /* This will build log sets for all loggers that use the common logger
  * functions because they use the same directory structure. */
 static void log_get_log_sets_common(GHashTable *sets)
 {
-	gchar *log_path = g_build_filename(purple_user_dir(), "logs", NULL);
-	GDir *log_dir = g_dir_open(log_path, 0, NULL);
+	gchar *log_path;
+	GDir *log_dir;
 	const gchar *protocol;
+	GHashTable *seen;
+	GHashTableIter iter;
+	gpointer key;
+
+	log_catalog_get();
+	if (catalog_complete && log_catalog_dirs_are_current()) {
+		log_get_log_sets_catalog(sets);
+		return;
+	}
 
+	/* The times are taken before reading the directories, so whatever
+	 * changes while they are read is found by the next walk. */
+	g_hash_table_remove_all(catalog_dirs);
+	log_catalog_add_dir("");
+
+	log_path = g_build_filename(purple_user_dir(), "logs", NULL);
+	log_dir = g_dir_open(log_path, 0, NULL);
 	if (log_dir == NULL) {
+		/* There are no logs at all. */
 		g_free(log_path);
+		g_hash_table_remove_all(catalog);
+		catalog_complete = TRUE;
+		log_catalog_schedule_save();
 		return;
 	}
 
+	seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
 	while ((protocol = g_dir_read_name(log_dir)) != NULL) {
 		gchar *protocol_path = g_build_filename(log_path, protocol, NULL);
 		GDir *protocol_dir;
 		const gchar *username;
-		gchar *protocol_unescaped;
-		GList *account_iter;
-		GList *accounts = NULL;
+		GList *accounts;
 
 		if ((protocol_dir = g_dir_open(protocol_path, 0, NULL)) == NULL) {
 			g_free(protocol_path);
 			continue;
 		}
 
-		/* Using g_strdup() to cover the one-in-a-million chance that a
-		 * protocol's list_icon function uses purple_unescape_filename(). */
-		protocol_unescaped = g_strdup(purple_unescape_filename(protocol));
-
-		/* Find all the accounts for protocol. */
-		for (account_iter = purple_accounts_get_all() ; account_iter != NULL ; account_iter = account_iter->next) {
-			PurpleProtocol *protocol;
-
-			protocol = purple_protocols_find(purple_account_get_protocol_id((PurpleAccount *)account_iter->data));
-			if (!protocol)
-				continue;
-
-			if (purple_strequal(protocol_unescaped, purple_protocol_class_list_icon(protocol, (PurpleAccount *)account_iter->data, NULL)))
-				accounts = g_list_prepend(accounts, account_iter->data);
-		}
-		g_free(protocol_unescaped);
+		log_catalog_add_dir(protocol);
+		accounts = log_get_protocol_accounts(protocol);
 
 		while ((username = g_dir_read_name(protocol_dir)) != NULL) {
 			gchar *username_path = g_build_filename(protocol_path, username, NULL);
 			GDir *username_dir;
-			const gchar *username_unescaped;
-			PurpleAccount *account = NULL;
-			gchar *name;
+			const gchar *name;
 
 			if ((username_dir = g_dir_open(username_path, 0, NULL)) == NULL) {
 				g_free(username_path);
 				continue;
 			}
 
-			/* Find the account for username in the list of accounts for protocol. */
-			username_unescaped = purple_unescape_filename(username);
-			for (account_iter = g_list_first(accounts) ; account_iter != NULL ; account_iter = account_iter->next) {
-				if (purple_strequal(purple_account_get_username((PurpleAccount *)account_iter->data), username_unescaped)) {
-					account = account_iter->data;
-					break;
-				}
-			}
-
-			/* Don't worry about the cast, name will point to dynamically allocated memory shortly. */
-			while ((name = (gchar *)g_dir_read_name(username_dir)) != NULL) {
-				size_t len;
-				PurpleLogSet *set;
-
-				/* IMPORTANT: Always initialize all members of PurpleLogSet */
-				set = g_slice_new(PurpleLogSet);
-
-				/* Unescape the filename. */
-				name = g_strdup(purple_unescape_filename(name));
-
-				/* Get the (possibly new) length of name. */
-				len = strlen(name);
-
-				set->type = PURPLE_LOG_IM;
-				set->name = name;
-				set->account = account;
-				/* set->buddy is always set below */
-				set->normalized_name = g_strdup(purple_normalize(account, name));
+			key = g_strjoin("/", protocol, username, NULL);
+			log_catalog_add_dir(key);
+			g_free(key);
 
-				/* Check for .chat or .system at the end of the name to determine the type. */
-				if (len >= 7) {
-					gchar *tmp = &name[len - 7];
-					if (purple_strequal(tmp, ".system")) {
-						set->type = PURPLE_LOG_SYSTEM;
-						*tmp = '\0';
-					}
-				}
-				if (len > 5) {
-					gchar *tmp = &name[len - 5];
-					if (purple_strequal(tmp, ".chat")) {
-						set->type = PURPLE_LOG_CHAT;
-						*tmp = '\0';
-					}
-				}
+			while ((name = g_dir_read_name(username_dir)) != NULL) {
+				key = g_strjoin("/", protocol, username, name, NULL);
 
-				/* Determine if this (account, name) combination exists as a buddy. */
-				if (account != NULL && *name != '\0')
-					set->buddy = (purple_blist_find_buddy(account, name) != NULL);
-				else
-					set->buddy = FALSE;
+				/* Remember the directory, so the next time the log sets
+				 * can be built from the catalog. */
+				if (g_hash_table_lookup(catalog, key) == NULL)
+					g_hash_table_insert(catalog, g_strdup(key), g_slice_new0(PurpleLogCatalogEntry));
+				g_hash_table_add(seen, key);
 
-				log_add_log_set_to_hash(sets, set);
+				log_add_log_set_to_hash(sets, log_set_new_common(accounts, username, name));
 			}
 			g_free(username_path);
 			g_dir_close(username_dir);
@@ -1191,6 +2511,17 @@ static void log_get_log_sets_common(GHashTable *sets)
 	}
 	g_free(log_path);
 	g_dir_close(log_dir);
+
+	/* Forget the directories that were removed. */
+	g_hash_table_iter_init(&iter, catalog);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		if (!g_hash_table_contains(seen, key))
+			g_hash_table_iter_remove(&iter);
+	}
+	g_hash_table_destroy(seen);
+
+	catalog_complete = TRUE;
+	log_catalog_schedule_save();
 }
 
 gboolean purple_log_common_deleter(PurpleLog *log)
@@ -41,6 +41,7 @@ typedef struct _PurpleLog PurpleLog;
 typedef struct _PurpleLogLogger PurpleLogLogger;
 typedef struct _PurpleLogCommonLoggerData PurpleLogCommonLoggerData;
 typedef struct _PurpleLogSet PurpleLogSet;
+typedef struct _PurpleLogStats PurpleLogStats;
 
 typedef enum {
 	PURPLE_LOG_IM,
@@ -201,6 +202,26 @@ struct _PurpleLogSet {
 	 * IMPORTANT: Update that code if you add members here. */
 };
 
+/**
+ * PurpleLogStats:
+ * @count:         The number of logs
+ * @size:          The total size of the logs, in bytes
+ * @first:         The time the oldest log started, or 0 if there are no logs
+ * @last:          The time the newest log started, or 0 if there are no logs
+ * @last_activity: The time of the last message written to the logs, or the
+ *                 time @last if that isn't known
+ *
+ * Summary information about the logs of a conversation, as kept by the log
+ * catalog.
+ */
+struct _PurpleLogStats {
+	int count;
+	int size;
+	time_t first;
+	time_t last;
+	time_t last_activity;
+};
+
 G_BEGIN_DECLS
 
 /***************************************/
@@ -348,6 +369,45 @@ int purple_log_get_total_size(PurpleLogType type, const char *name, PurpleAccoun
  */
 int purple_log_get_activity_score(PurpleLogType type, const char *name, PurpleAccount *account);
 
+/**
+ * purple_log_get_stats:
+ * @type:                The type of the log
+ * @name:                The name of the log
+ * @account:             The account
+ * @stats:               The return location for the summary
+ *
+ * Gets summary information about all available logs in this conversation.
+ *
+ * The information is kept in the log catalog, which is saved across
+ * sessions and updated as logs are written and deleted, so the logs are
+ * only looked at again when their directory changes.
+ */
+void purple_log_get_stats(PurpleLogType type, const char *name, PurpleAccount *account, PurpleLogStats *stats);
+
+/**
+ * purple_log_search:
+ * @logs:                The logs to search
+ * @query:               The words to look for. Words in double quotes must
+ *                       appear next to each other, as a phrase.
+ * @start:               If not 0, only logs started at or after this time
+ *                       are searched
+ * @end:                 If not 0, only logs started before this time are
+ *                       searched
+ *
+ * Finds the logs that contain all the words of a query, ignoring case and
+ * markup. A word of the query that isn't a word of any log matches the
+ * words it starts, so "hel" finds "hello".
+ *
+ * Logs are looked up in a search index, which is kept up to date as logs
+ * are written. Logs that aren't in the index yet are read and added to it,
+ * so only the first search of them is slow. Parts of the query that aren't
+ * plain words, like "C++", are matched as substrings of the logs instead.
+ *
+ * Returns: (transfer container): The logs from @logs that match, in the
+ *          same order. The logs still belong to @logs.
+ */
+GList *purple_log_search(GList *logs, const char *query, time_t start, time_t end);
+
 /**
  * purple_log_is_deletable:
  * @log:                 The log
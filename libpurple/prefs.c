@@ -91,7 +91,26 @@ static struct purple_pref prefs = {
 static GHashTable *prefs_hash = NULL;
 static guint       save_timer = 0;
 static gboolean    prefs_loaded = FALSE;
-static GSList     *ui_callbacks = NULL;
+
+/*
+ * The callbacks connected through the UI ops, by the name they were connected
+ * to (as a GSList) and by ID. A pref change only looks up the names which are
+ * prefixes of the pref, so it costs as much as the depth of the pref.
+ */
+static GHashTable *ui_callbacks_by_name = NULL;
+static GHashTable *ui_callbacks_by_id = NULL;
+
+/*
+ * Between purple_prefs_begin_batch() and purple_prefs_commit_batch(), the
+ * changed prefs (and the UI callbacks triggered by object) are queued, and
+ * called once each at the end.
+ */
+static guint       batch_depth = 0;
+static GHashTable *batch_names = NULL;
+static GQueue      batch_queue = G_QUEUE_INIT;
+static GHashTable *batch_ui_ids = NULL;
+static GQueue      batch_ui_queue = G_QUEUE_INIT;
+static gboolean    batch_save = FALSE;
 
 #define PURPLE_PREFS_UI_OP_CALL(member, ...) \
 	{ \
@@ -258,6 +277,11 @@ save_cb(gpointer data)
 static void
 schedule_prefs_save(void)
 {
+	if (batch_depth > 0) {
+		batch_save = TRUE;
+		return;
+	}
+
 	PURPLE_PREFS_UI_OP_CALL(schedule_save);
 
 	if (save_timer == 0)
@@ -826,11 +850,33 @@ purple_prefs_destroy()
 	purple_prefs_remove("/");
 }
 
+static void
+batch_queue_name(const char *name)
+{
+	char *key;
+
+	if (batch_names == NULL)
+		batch_names = g_hash_table_new(g_str_hash, g_str_equal);
+
+	if (g_hash_table_contains(batch_names, name))
+		return;
+
+	key = g_strdup(name);
+	g_hash_table_add(batch_names, key);
+	g_queue_push_tail(&batch_queue, key);
+}
+
 static void
 do_callbacks(const char* name, struct purple_pref *pref)
 {
 	GSList *cbs;
 	struct purple_pref *cb_pref;
+
+	if (batch_depth > 0) {
+		batch_queue_name(name);
+		return;
+	}
+
 	for(cb_pref = pref; cb_pref; cb_pref = cb_pref->parent) {
 		for(cbs = cb_pref->callbacks; cbs; cbs = cbs->next) {
 			PurplePrefCallbackData *cb = cbs->data;
@@ -840,30 +886,128 @@ do_callbacks(const char* name, struct purple_pref *pref)
 }
 
 static void
-do_ui_callbacks(const char *name)
+ui_callbacks_add(PurplePrefCallbackData *cb)
 {
 	GSList *cbs;
 
-	purple_debug_misc("prefs", "trigger callback %s\n", name);
+	if (ui_callbacks_by_name == NULL) {
+		ui_callbacks_by_name = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, NULL);
+		ui_callbacks_by_id = g_hash_table_new(g_direct_hash, g_direct_equal);
+	}
+
+	cbs = g_hash_table_lookup(ui_callbacks_by_name, cb->name);
+	if (cbs == NULL) {
+		g_hash_table_insert(ui_callbacks_by_name, g_strdup(cb->name),
+				g_slist_prepend(NULL, cb));
+	} else {
+		/* The list head stays the same */
+		cbs = g_slist_append(cbs, cb);
+	}
+
+	g_hash_table_insert(ui_callbacks_by_id, GUINT_TO_POINTER(cb->id), cb);
+}
+
+static void
+ui_callbacks_remove(PurplePrefCallbackData *cb)
+{
+	GSList *cbs;
+
+	cbs = g_hash_table_lookup(ui_callbacks_by_name, cb->name);
+	cbs = g_slist_remove(cbs, cb);
+
+	if (cbs == NULL)
+		g_hash_table_remove(ui_callbacks_by_name, cb->name);
+	else
+		g_hash_table_insert(ui_callbacks_by_name, g_strdup(cb->name), cbs);
+
+	g_hash_table_remove(ui_callbacks_by_id, GUINT_TO_POINTER(cb->id));
+}
+
+static void
+ui_callbacks_collect(GArray *ids, char *path, size_t len)
+{
+	GSList *cbs;
+	char c = path[len];
 
-	for (cbs = ui_callbacks; cbs; cbs = cbs->next) {
+	path[len] = '\0';
+	for (cbs = g_hash_table_lookup(ui_callbacks_by_name, path); cbs; cbs = cbs->next) {
 		PurplePrefCallbackData *cb = cbs->data;
-		const char *cb_name = cb->name;
-		size_t len = strlen(cb_name);
-		if (!strncmp(cb_name, name, len) &&
-		    (name[len] == 0 || name[len] == '/' ||
-		     (len && name[len - 1] == '/'))) {
-			/* This test should behave like this:
-			 * name    = /toto/tata
-			 * cb_name = /toto/tata --> true
-			 * cb_name = /toto/tatatiti --> false
-			 * cb_name = / --> true
-			 * cb_name = /toto --> true
-			 * cb_name = /toto/ --> true
-			 */
-			purple_prefs_trigger_callback_object(cbs->data);
-		}
+		g_array_append_val(ids, cb->id);
+	}
+	path[len] = c;
+}
+
+static gint
+ui_callbacks_id_compare(gconstpointer a, gconstpointer b)
+{
+	guint ida = *(const guint *)a;
+	guint idb = *(const guint *)b;
+
+	return (ida > idb) - (ida < idb);
+}
+
+static void
+do_ui_callbacks(const char *name)
+{
+	GArray *ids;
+	char *path;
+	size_t len, i;
+	guint last = 0;
+
+	purple_debug_misc("prefs", "trigger callback %s\n", name);
+
+	if (batch_depth > 0) {
+		batch_queue_name(name);
+		return;
+	}
+
+	if (ui_callbacks_by_name == NULL)
+		return;
+
+	/*
+	 * A callback is called for its own pref and the ones below:
+	 * name    = /toto/tata
+	 * cb_name = /toto/tata --> true
+	 * cb_name = /toto/tatatiti --> false
+	 * cb_name = / --> true
+	 * cb_name = /toto --> true
+	 * cb_name = /toto/ --> true
+	 */
+	path = g_strdup(name);
+	len = strlen(path);
+	ids = g_array_new(FALSE, FALSE, sizeof(guint));
+
+	ui_callbacks_collect(ids, path, 0);
+	for (i = 0; i < len; i++) {
+		if (path[i] != '/')
+			continue;
+		if (i > 0)
+			ui_callbacks_collect(ids, path, i);
+		ui_callbacks_collect(ids, path, i + 1);
 	}
+	if (len > 0 && path[len - 1] != '/')
+		ui_callbacks_collect(ids, path, len);
+
+	/* In the order they were connected, once each */
+	g_array_sort(ids, ui_callbacks_id_compare);
+
+	for (i = 0; i < ids->len; i++) {
+		guint id = g_array_index(ids, guint, i);
+		PurplePrefCallbackData *cb;
+
+		if (id == last)
+			continue;
+		last = id;
+
+		/* It may have been disconnected by an earlier one */
+		cb = g_hash_table_lookup(ui_callbacks_by_id, GUINT_TO_POINTER(id));
+		if (cb != NULL)
+			purple_prefs_trigger_callback_object(cb);
+	}
+
+	g_array_free(ids, TRUE);
+	g_free(path);
 }
 
 void
@@ -1426,7 +1570,7 @@ purple_prefs_connect_callback(void *handle, const char *name, PurplePrefCallback
 			return 0;
 		}
 
-		ui_callbacks = g_slist_append(ui_callbacks, cb);
+		ui_callbacks_add(cb);
 	} else {
 		pref->callbacks = g_slist_append(pref->callbacks, cb);
 	}
@@ -1481,6 +1625,17 @@ purple_prefs_trigger_callback_object(PurplePrefCallbackData *cb)
 	PurplePrefsUiOps *uiop = purple_prefs_get_ui_ops();
 
 	if (uiop && uiop->connect_callback && uiop->get_type) {
+		if (batch_depth > 0) {
+			if (batch_ui_ids == NULL)
+				batch_ui_ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+			if (!g_hash_table_contains(batch_ui_ids, GUINT_TO_POINTER(cb->id))) {
+				g_hash_table_add(batch_ui_ids, GUINT_TO_POINTER(cb->id));
+				g_queue_push_tail(&batch_ui_queue, GUINT_TO_POINTER(cb->id));
+			}
+			return;
+		}
+
 		purple_prefs_trigger_ui_callback_object(cb);
 	} else {
 		purple_prefs_trigger_callback(cb->name);
@@ -1517,20 +1672,21 @@ disco_callback_helper(struct purple_pref *pref, guint callback_id)
 static void
 disco_ui_callback_helper(guint callback_id)
 {
-	GSList *cbs;
+	PurplePrefCallbackData *cb;
 	PurplePrefsUiOps *uiop = purple_prefs_get_ui_ops();
 
-	for (cbs = ui_callbacks; cbs; cbs = cbs->next) {
-		PurplePrefCallbackData *cb = cbs->data;
-		if (cb->id == callback_id) {
-			uiop->disconnect_callback(cb->name, cb->ui_data);
+	if (ui_callbacks_by_id == NULL)
+		return;
 
-			ui_callbacks = g_slist_delete_link(ui_callbacks, cbs);
-			g_free(cb->name);
-			g_free(cb);
-			return;
-		}
-	}
+	cb = g_hash_table_lookup(ui_callbacks_by_id, GUINT_TO_POINTER(callback_id));
+	if (cb == NULL)
+		return;
+
+	uiop->disconnect_callback(cb->name, cb->ui_data);
+
+	ui_callbacks_remove(cb);
+	g_free(cb->name);
+	g_free(cb);
 }
 
 void
@@ -1573,24 +1729,88 @@ disco_callback_helper_handle(struct purple_pref *pref, void *handle)
 static void
 disco_ui_callback_helper_handle(void *handle)
 {
-	GSList *cbs;
+	GHashTableIter iter;
+	GSList *found = NULL, *cbs;
+	PurplePrefCallbackData *cb;
 	PurplePrefsUiOps *uiop = purple_prefs_get_ui_ops();
 
-	cbs = ui_callbacks;
-	for (cbs = ui_callbacks; cbs; cbs = cbs->next) {
-		PurplePrefCallbackData *cb = cbs->data;
-		if (cb->handle != handle) {
-			cbs = cbs->next;
-			continue;
-		}
+	if (ui_callbacks_by_id == NULL)
+		return;
+
+	g_hash_table_iter_init(&iter, ui_callbacks_by_id);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&cb)) {
+		if (cb->handle == handle)
+			found = g_slist_prepend(found, cb);
+	}
+
+	for (cbs = found; cbs; cbs = cbs->next) {
+		cb = cbs->data;
 
 		uiop->disconnect_callback(cb->name, cb->ui_data);
 
-		ui_callbacks = g_slist_delete_link(ui_callbacks, cbs);
+		ui_callbacks_remove(cb);
 		g_free(cb->name);
 		g_free(cb);
-		cbs = ui_callbacks;
 	}
+
+	g_slist_free(found);
+}
+
+void
+purple_prefs_begin_batch(void)
+{
+	batch_depth++;
+}
+
+void
+purple_prefs_commit_batch(void)
+{
+	GQueue names = G_QUEUE_INIT, ui_ids = G_QUEUE_INIT;
+	gboolean save;
+	char *name;
+	gpointer id;
+
+	g_return_if_fail(batch_depth > 0);
+
+	if (--batch_depth > 0)
+		return;
+
+	/* Whatever the callbacks change is dispatched right away. */
+	names = batch_queue;
+	g_queue_init(&batch_queue);
+	ui_ids = batch_ui_queue;
+	g_queue_init(&batch_ui_queue);
+	save = batch_save;
+	batch_save = FALSE;
+
+	if (batch_names != NULL)
+		g_hash_table_remove_all(batch_names);
+	if (batch_ui_ids != NULL)
+		g_hash_table_remove_all(batch_ui_ids);
+
+	while ((id = g_queue_pop_head(&ui_ids)) != NULL) {
+		PurplePrefCallbackData *cb = NULL;
+
+		if (ui_callbacks_by_id != NULL)
+			cb = g_hash_table_lookup(ui_callbacks_by_id, id);
+		if (cb != NULL)
+			purple_prefs_trigger_callback_object(cb);
+	}
+
+	while ((name = g_queue_pop_head(&names)) != NULL) {
+		PurplePrefsUiOps *uiop = purple_prefs_get_ui_ops();
+		struct purple_pref *pref;
+
+		if (uiop && uiop->connect_callback)
+			do_ui_callbacks(name);
+		else if ((pref = find_pref(name)) != NULL)
+			do_callbacks(name, pref);
+
+		g_free(name);
+	}
+
+	if (save)
+		schedule_prefs_save();
 }
 
 void
@@ -1754,6 +1974,20 @@ purple_prefs_uninit()
 	g_hash_table_destroy(prefs_hash);
 	prefs_hash = NULL;
 
+	batch_depth = 0;
+	batch_save = FALSE;
+	g_queue_foreach(&batch_queue, (GFunc)g_free, NULL);
+	g_queue_clear(&batch_queue);
+	g_queue_clear(&batch_ui_queue);
+	if (batch_names != NULL) {
+		g_hash_table_destroy(batch_names);
+		batch_names = NULL;
+	}
+	if (batch_ui_ids != NULL) {
+		g_hash_table_destroy(batch_ui_ids);
+		batch_ui_ids = NULL;
+	}
+
 }
 
 void
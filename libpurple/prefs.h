@@ -484,6 +484,26 @@ void purple_prefs_disconnect_callback(guint callback_id);
  */
 void purple_prefs_disconnect_by_handle(void *handle);
 
+/**
+ * purple_prefs_begin_batch:
+ *
+ * Start a batch of pref changes. Until the matching
+ * purple_prefs_commit_batch(), the callbacks of the changed prefs are not
+ * called and the prefs are not saved.
+ *
+ * Batches can be nested; only the outermost one is committed.
+ */
+void purple_prefs_begin_batch(void);
+
+/**
+ * purple_prefs_commit_batch:
+ *
+ * End a batch of pref changes started with purple_prefs_begin_batch(). Each
+ * changed pref triggers its callbacks once, in the order it was first changed,
+ * and the prefs are saved once.
+ */
+void purple_prefs_commit_batch(void);
+
 /**
  * purple_prefs_trigger_callback:
  *
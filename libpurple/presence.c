@@ -606,7 +606,7 @@ purple_account_presence_get_account(const PurpleAccountPresence *presence)
 	return priv->account;
 }
 
-static int
+int
 purple_buddy_presence_compute_score(const PurpleBuddyPresence *buddy_presence)
 {
 	GList *l;
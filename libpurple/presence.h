@@ -220,6 +220,18 @@ PurpleBuddyPresence *purple_buddy_presence_new(PurpleBuddy *buddy);
  */
 PurpleBuddy *purple_buddy_presence_get_buddy(const PurpleBuddyPresence *presence);
 
+/**
+ * purple_buddy_presence_compute_score:
+ * @buddy_presence: The presence.
+ *
+ * Computes the score of a buddy presence's active statuses, which
+ * purple_buddy_presence_compare() ranks online presences by.  It does not
+ * include the idle time score, which depends on the other presence.
+ *
+ * Returns: The score.  Higher scores are more available.
+ */
+int purple_buddy_presence_compute_score(const PurpleBuddyPresence *buddy_presence);
+
 /**
  * purple_buddy_presence_compare:
  * @buddy_presence1: The first presence.
@@ -31,6 +31,7 @@ struct _FbDataPrivate
 {
 	FbApi *api;
 	FbHttpConns *cons;
+	PurpleHttpKeepalivePool *kapool;
 	PurpleConnection *gc;
 	PurpleRoomlist *roomlist;
 	GQueue *msgs;
@@ -81,6 +82,7 @@ fb_data_dispose(GObject *obj)
 	}
 
 	fb_http_conns_free(priv->cons);
+	purple_http_keepalive_pool_unref(priv->kapool);
 	g_queue_free_full(priv->msgs, (GDestroyNotify) fb_api_message_free);
 
 	g_hash_table_destroy(priv->imgs);
@@ -106,6 +108,12 @@ fb_data_init(FbData *fata)
 	fata->priv = priv;
 
 	priv->cons = fb_http_conns_new();
+
+	/* Images come in bursts, mostly from the same few hosts */
+	priv->kapool = purple_http_keepalive_pool_new();
+	purple_http_keepalive_pool_set_limit_per_host(priv->kapool, 2);
+	purple_http_keepalive_pool_set_pipelining(priv->kapool, FB_DATA_ICON_MAX);
+
 	priv->msgs = g_queue_new();
 
 	priv->imgs = g_hash_table_new_full(g_direct_hash, g_direct_equal,
@@ -570,6 +578,7 @@ fb_data_image_queue(FbData *fata)
 	GHashTableIter iter;
 	guint active = 0;
 	PurpleHttpConnection *con;
+	PurpleHttpRequest *req;
 
 	g_return_if_fail(FB_IS_DATA(fata));
 	priv = fata->priv;
@@ -594,7 +603,10 @@ fb_data_image_queue(FbData *fata)
 
 		img->priv->active = TRUE;
 		url = fb_data_image_get_url(img);
-		con = purple_http_get(priv->gc, fb_data_image_cb, img, url);
+		req = purple_http_request_new(url);
+		purple_http_request_set_keepalive_pool(req, priv->kapool);
+		con = purple_http_request(priv->gc, req, fb_data_image_cb, img);
+		purple_http_request_unref(req);
 		fb_http_conns_add(priv->cons, con);
 
 		if (++active >= FB_DATA_ICON_MAX) {
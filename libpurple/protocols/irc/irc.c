@@ -151,6 +151,10 @@ gboolean irc_blist_timeout(struct irc_conn *irc)
 		return TRUE;
 	}
 
+	/* Nothing to poll when the server tells us about everyone */
+	if (irc->monitor && irc->monitor_count == g_hash_table_size(irc->buddies))
+		return TRUE;
+
 	g_hash_table_foreach(irc->buddies, (GHFunc)irc_ison_buddy_init,
 	                     (gpointer *)&irc->buddies_outstanding);
 
@@ -190,7 +194,8 @@ void irc_buddy_query(struct irc_conn *irc)
 
 static void irc_ison_buddy_init(char *name, struct irc_buddy *ib, GList **list)
 {
-	*list = g_list_append(*list, ib);
+	if (!ib->monitored)
+		*list = g_list_prepend(*list, ib);
 }
 
 
@@ -199,7 +204,7 @@ static void irc_ison_one(struct irc_conn *irc, struct irc_buddy *ib)
 	char *buf;
 
 	if (irc->buddies_outstanding != NULL) {
-		irc->buddies_outstanding = g_list_append(irc->buddies_outstanding, ib);
+		irc->buddies_outstanding = g_list_prepend(irc->buddies_outstanding, ib);
 		return;
 	}
 
@@ -209,6 +214,65 @@ static void irc_ison_one(struct irc_conn *irc, struct irc_buddy *ib)
 	g_free(buf);
 }
 
+static void irc_monitor_send(struct irc_conn *irc, const char *op, const char *targets)
+{
+	char *buf;
+
+	buf = irc_format(irc, "vvn", "MONITOR", op, targets);
+	irc_send(irc, buf);
+	g_free(buf);
+}
+
+/* Adds the buddies which aren't monitored yet to the MONITOR list, for as
+ * long as the server has room for them; the rest are polled with ISON. */
+void irc_buddy_monitor(struct irc_conn *irc)
+{
+	GHashTableIter iter;
+	GString *string;
+	struct irc_buddy *ib;
+
+	string = g_string_sized_new(512);
+
+	g_hash_table_iter_init(&iter, irc->buddies);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&ib)) {
+		if (ib->monitored)
+			continue;
+		if (irc->monitor_max && irc->monitor_count >= irc->monitor_max)
+			break;
+
+		if (string->len + strlen(ib->name) + 1 > 450) {
+			irc_monitor_send(irc, "+", string->str);
+			g_string_truncate(string, 0);
+		}
+
+		if (string->len)
+			g_string_append_c(string, ',');
+		g_string_append(string, ib->name);
+		ib->monitored = TRUE;
+		irc->monitor_count++;
+	}
+
+	if (string->len)
+		irc_monitor_send(irc, "+", string->str);
+
+	g_string_free(string, TRUE);
+}
+
+static void irc_monitor_one(struct irc_conn *irc, struct irc_buddy *ib)
+{
+	if (ib->monitored)
+		return;
+
+	if (irc->monitor_max && irc->monitor_count >= irc->monitor_max) {
+		irc_ison_one(irc, ib);
+		return;
+	}
+
+	irc_monitor_send(irc, "+", ib->name);
+	ib->monitored = TRUE;
+	irc->monitor_count++;
+}
+
 
 static const char *irc_blist_icon(PurpleAccount *a, PurpleBuddy *b)
 {
@@ -313,8 +377,7 @@ static void irc_login(PurpleAccount *account)
 					     NULL, (GDestroyNotify)irc_buddy_free);
 	irc->cmds = g_hash_table_new(g_str_hash, g_str_equal);
 	irc_cmd_table_build(irc);
-	irc->msgs = g_hash_table_new(g_str_hash, g_str_equal);
-	irc_msg_table_build(irc);
+	irc->caps = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 
 	purple_connection_update_progress(gc, _("Connecting"), 1, 2);
 
@@ -344,17 +407,24 @@ static gboolean do_login(PurpleConnection *gc) {
 	const char *nickname, *identname, *realname;
 	struct irc_conn *irc = purple_connection_get_protocol_data(gc);
 	const char *pass = purple_connection_get_password(gc);
+
+	/* Servers which know about capabilities hold registration until
+	 * CAP END; the others answer with an unknown command error. */
+	buf = irc_format(irc, "vvv", "CAP", "LS", "302");
+	if (irc_send(irc, buf) < 0) {
+		g_free(buf);
+		return FALSE;
+	}
+	g_free(buf);
+
 #ifdef HAVE_CYRUS_SASL
-	const gboolean use_sasl = purple_account_get_bool(irc->account, "sasl", FALSE);
+	/* The password is sent with SASL once the server acknowledges it. */
+	if (purple_account_get_bool(irc->account, "sasl", FALSE))
+		pass = NULL;
 #endif
 
 	if (pass && *pass) {
-#ifdef HAVE_CYRUS_SASL
-		if (use_sasl)
-			buf = irc_format(irc, "vv:", "CAP", "REQ", "sasl");
-		else /* intended to fall through */
-#endif
-			buf = irc_format(irc, "v:", "PASS", pass);
+		buf = irc_format(irc, "v:", "PASS", pass);
 		if (irc_send(irc, buf) < 0) {
 			g_free(buf);
 			return FALSE;
@@ -430,9 +500,8 @@ irc_login_cb(GObject *source, GAsyncResult *res, gpointer user_data)
 			g_io_stream_get_output_stream(G_IO_STREAM(irc->conn)));
 
 	if (do_login(gc)) {
-		irc->input = g_data_input_stream_new(
-				g_io_stream_get_input_stream(
-						G_IO_STREAM(irc->conn)));
+		irc->input = g_object_ref(g_io_stream_get_input_stream(
+				G_IO_STREAM(irc->conn)));
 		irc_read_input(irc);
 	}
 }
@@ -454,18 +523,25 @@ static void irc_close(PurpleConnection *gc)
 
 	if (irc->conn != NULL) {
 		purple_gio_graceful_close(G_IO_STREAM(irc->conn),
-				G_INPUT_STREAM(irc->input),
+				irc->input,
 				G_OUTPUT_STREAM(irc->output));
 	}
 
 	g_clear_object(&irc->input);
 	g_clear_object(&irc->output);
 	g_clear_object(&irc->conn);
+	g_free(irc->inbuf);
 
 	if (irc->timer)
 		purple_timeout_remove(irc->timer);
 	g_hash_table_destroy(irc->cmds);
-	g_hash_table_destroy(irc->msgs);
+	g_hash_table_destroy(irc->caps);
+	if (irc->cap_ls)
+		g_string_free(irc->cap_ls, TRUE);
+	if (irc->batches)
+		g_hash_table_destroy(irc->batches);
+	if (irc->chats_pending)
+		g_hash_table_destroy(irc->chats_pending);
 	g_hash_table_destroy(irc->buddies);
 	if (irc->motd)
 		g_string_free(irc->motd, TRUE);
@@ -560,39 +636,60 @@ static void irc_add_buddy(PurpleConnection *gc, PurpleBuddy *buddy, PurpleGroup
 	/* if the timer isn't set, this is during signon, so we don't want to flood
 	 * ourself off with ISON's, so we don't, but after that we want to know when
 	 * someone's online asap */
-	if (irc->timer)
-		irc_ison_one(irc, ib);
+	if (irc->timer) {
+		if (irc->monitor)
+			irc_monitor_one(irc, ib);
+		else
+			irc_ison_one(irc, ib);
+	}
 }
 
-static void irc_remove_buddy(PurpleConnection *gc, PurpleBuddy *buddy, PurpleGroup *group)
+/* Drops a reference to the buddy, and forgets it with the last one.  A
+ * buddy which was monitored makes room on a full MONITOR list, which goes
+ * to one that didn't fit before. */
+void irc_buddy_remove(struct irc_conn *irc, const char *name)
 {
-	struct irc_conn *irc = purple_connection_get_protocol_data(gc);
 	struct irc_buddy *ib;
+	gboolean monitored;
 
-	ib = g_hash_table_lookup(irc->buddies, purple_buddy_get_name(buddy));
+	ib = g_hash_table_lookup(irc->buddies, name);
 	if (ib && --ib->ref == 0) {
-		g_hash_table_remove(irc->buddies, purple_buddy_get_name(buddy));
+		monitored = ib->monitored;
+		if (monitored) {
+			irc_monitor_send(irc, "-", ib->name);
+			irc->monitor_count--;
+		}
+		irc->buddies_outstanding = g_list_remove(irc->buddies_outstanding, ib);
+		g_hash_table_remove(irc->buddies, name);
+
+		if (monitored && irc->monitor_max)
+			irc_buddy_monitor(irc);
 	}
 }
 
+static void irc_remove_buddy(PurpleConnection *gc, PurpleBuddy *buddy, PurpleGroup *group)
+{
+	struct irc_conn *irc = purple_connection_get_protocol_data(gc);
+
+	irc_buddy_remove(irc, purple_buddy_get_name(buddy));
+}
+
 static void
 irc_read_input_cb(GObject *source, GAsyncResult *res, gpointer data)
 {
 	PurpleConnection *gc = data;
 	struct irc_conn *irc;
-	gchar *line;
-	gsize len;
-	gsize start = 0;
+	gssize len;
+	gchar *cur, *end;
 	GError *error = NULL;
 
-	line = g_data_input_stream_read_line_finish(
-			G_DATA_INPUT_STREAM(source), res, &len, &error);
+	len = g_input_stream_read_finish(G_INPUT_STREAM(source), res, &error);
 
-	if (line == NULL && error != NULL) {
+	if (len < 0) {
 		g_prefix_error(&error, _("Lost connection with server: "));
 		purple_connection_take_error(gc, error);
 		return;
-	} else if (line == NULL) {
+	} else if (len == 0) {
 		purple_connection_take_error(gc, g_error_new_literal(
 			PURPLE_CONNECTION_ERROR,
 			PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
@@ -604,19 +701,34 @@ irc_read_input_cb(GObject *source, GAsyncResult *res, gpointer data)
 
 	purple_connection_update_last_received(gc);
 
-	if (len > 0 && line[len - 1] == '\r')
-		line[len - 1] = '\0';
-
-	/* This is a hack to work around the fact that marv gets messages
-	 * with null bytes in them while using some weird irc server at work
- 	 */
-	while (start < len && line[start] == '\0')
-		++start;
-
-	if (len - start > 0)
-		irc_parse_msg(irc, line + start);
+	irc->inbufused += len;
+	irc->inbuf[irc->inbufused] = '\0';
+
+	/* Lines are parsed where they were read; only a trailing partial
+	 * line is moved, to the start of the buffer. */
+	cur = irc->inbuf;
+	while (cur < irc->inbuf + irc->inbufused &&
+			(end = memchr(cur, '\n', irc->inbuf + irc->inbufused - cur))) {
+		gchar *line = cur;
+
+		cur = end + 1;
+		if (end > line && end[-1] == '\r')
+			end--;
+		*end = '\0';
+
+		/* This is a hack to work around the fact that marv gets messages
+		 * with null bytes in them while using some weird irc server at work
+		 */
+		while (line < end && *line == '\0')
+			++line;
+
+		if (line < end)
+			irc_parse_msg(irc, line);
+	}
 
-	g_free(line);
+	irc->inbufused -= cur - irc->inbuf;
+	if (irc->inbufused > 0 && cur != irc->inbuf)
+		memmove(irc->inbuf, cur, irc->inbufused);
 
 	irc_read_input(irc);
 }
@@ -626,7 +738,16 @@ irc_read_input(struct irc_conn *irc)
 {
 	PurpleConnection *gc = purple_account_get_connection(irc->account);
 
-	g_data_input_stream_read_line_async(irc->input,
+	/* Keep room for at least one full message and the terminator. */
+	if (irc->inbuflen < irc->inbufused + IRC_MAX_MSG_SIZE + 1) {
+		irc->inbuflen = MAX(irc->inbuflen + IRC_INITIAL_BUFSIZE,
+				irc->inbufused + IRC_MAX_MSG_SIZE + 1);
+		irc->inbuf = g_realloc(irc->inbuf, irc->inbuflen);
+	}
+
+	g_input_stream_read_async(irc->input,
+			irc->inbuf + irc->inbufused,
+			irc->inbuflen - irc->inbufused - 1,
 			G_PRIORITY_DEFAULT, irc->cancellable,
 			irc_read_input_cb, gc);
 }
@@ -974,6 +1095,7 @@ plugin_load(PurplePlugin *plugin, GError **error)
 	purple_prefs_remove("/plugins/prpl/irc/quitmsg");
 	purple_prefs_remove("/plugins/prpl/irc");
 
+	irc_msg_table_build();
 	irc_register_commands();
 
 	purple_signal_register(_irc_protocol, "irc-sending-text",
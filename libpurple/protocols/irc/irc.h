@@ -57,6 +57,11 @@
 
 #define IRC_MAX_MSG_SIZE 512
 
+#define IRC_MAX_MSG_ARGS 8
+
+/* The most lines a batch holds back; a longer one is replayed early */
+#define IRC_BATCH_MAX_LINES 10000
+
 #define IRC_NAMES_FLAG "irc-namelist"
 
 enum { IRC_USEROPT_SERVER, IRC_USEROPT_PORT, IRC_USEROPT_CHARSET };
@@ -74,7 +79,6 @@ typedef struct _IRCProtocolClass
 
 struct irc_conn {
 	PurpleAccount *account;
-	GHashTable *msgs;
 	GHashTable *cmds;
 	char *server;
 	GSocketConnection *conn;
@@ -85,7 +89,23 @@ struct irc_conn {
 	gboolean ison_outstanding;
 	GList *buddies_outstanding;
 
-	GDataInputStream *input;
+	GString *cap_ls;
+	GHashTable *caps;
+
+	GHashTable *batches;
+	guint batch_depth;
+	gboolean history;
+	GHashTable *chats_pending;
+	time_t msg_time;
+
+	gboolean monitor;
+	guint monitor_max;
+	guint monitor_count;
+
+	GInputStream *input;
+	gchar *inbuf;
+	gsize inbuflen;
+	gsize inbufused;
 	PurpleQueuedOutputStream *output;
 
 	GString *motd;
@@ -128,9 +148,19 @@ struct irc_buddy {
 	gboolean online;
 	gboolean flag;
  	gboolean new_online_status;
+	gboolean monitored;
 	int ref;
 };
 
+struct irc_batch {
+	char *ref;
+	char *type;
+	GQueue lines;
+	/* the batch this one was started within, which holds its lines back
+	 * until it is replayed itself */
+	struct irc_batch *parent;
+};
+
 typedef int (*IRCCmdCallback) (struct irc_conn *irc, const char *cmd, const char *target, const char **args);
 
 G_MODULE_EXPORT GType irc_protocol_get_type(void);
@@ -140,6 +170,8 @@ int irc_send_len(struct irc_conn *irc, const char *buf, int len);
 gboolean irc_blist_timeout(struct irc_conn *irc);
 gboolean irc_who_channel_timeout(struct irc_conn *irc);
 void irc_buddy_query(struct irc_conn *irc);
+void irc_buddy_monitor(struct irc_conn *irc);
+void irc_buddy_remove(struct irc_conn *irc, const char *name);
 
 char *irc_escape_privmsg(const char *text, gssize length);
 
@@ -152,8 +184,17 @@ gboolean irc_ischannel(const char *string);
 
 void irc_register_commands(void);
 void irc_unregister_commands(void);
-void irc_msg_table_build(struct irc_conn *irc);
+void irc_msg_table_build(void);
+const char *irc_msg_get_format(const char *name, gsize len);
+int irc_parse_args(char *cur, const char *format, char **args);
 void irc_parse_msg(struct irc_conn *irc, char *input);
+void irc_route_msg(struct irc_conn *irc, char *input);
+void irc_handle_msg(struct irc_conn *irc, char *input);
+struct irc_batch *irc_batch_open(struct irc_conn *irc, const char *ref,
+		const char *type, struct irc_batch *parent);
+void irc_batch_end(struct irc_conn *irc, struct irc_batch *batch);
+time_t irc_server_time(struct irc_conn *irc);
+void irc_chats_pending_flush(struct irc_conn *irc);
 char *irc_parse_ctcp(struct irc_conn *irc, const char *from, const char *to, const char *msg, int notice);
 char *irc_format(struct irc_conn *irc, const char *format, ...);
 
@@ -164,6 +205,7 @@ void irc_msg_badnick(struct irc_conn *irc, const char *name, const char *from, c
 void irc_msg_ban(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_banfull(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_banned(struct irc_conn *irc, const char *name, const char *from, char **args);
+void irc_msg_batch(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_chanmode(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_endwhois(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_features(struct irc_conn *irc, const char *name, const char *from, char **args);
@@ -174,6 +216,8 @@ void irc_msg_join(struct irc_conn *irc, const char *name, const char *from, char
 void irc_msg_kick(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_list(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_luser(struct irc_conn *irc, const char *name, const char *from, char **args);
+void irc_msg_monitor(struct irc_conn *irc, const char *name, const char *from, char **args);
+void irc_msg_monlistfull(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_mode(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_motd(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_names(struct irc_conn *irc, const char *name, const char *from, char **args);
@@ -200,8 +244,8 @@ void irc_msg_unknown(struct irc_conn *irc, const char *name, const char *from, c
 void irc_msg_wallops(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_whois(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_who(struct irc_conn *irc, const char *name, const char *from, char **args);
-#ifdef HAVE_CYRUS_SASL
 void irc_msg_cap(struct irc_conn *irc, const char *name, const char *from, char **args);
+#ifdef HAVE_CYRUS_SASL
 void irc_msg_auth(struct irc_conn *irc, char *arg);
 void irc_msg_authok(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_authtryagain(struct irc_conn *irc, const char *name, const char *from, char **args);
@@ -74,6 +74,118 @@ static char *irc_mask_userhost(const char *mask)
 	return g_strdup(strchr(mask, '!') + 1);
 }
 
+/* While a batch is replayed, joins and quits are collected per channel so
+ * that each channel is updated once for all of them. */
+struct irc_chat_pending {
+	gboolean quit;
+	char *reason;
+	GList *nicks;
+	GList *userhosts;
+};
+
+static void irc_chat_pending_free(struct irc_chat_pending *pending)
+{
+	g_free(pending->reason);
+	g_list_free_full(pending->nicks, g_free);
+	g_list_free_full(pending->userhosts, g_free);
+	g_free(pending);
+}
+
+static void irc_chat_pending_apply(PurpleChatConversation *chat, struct irc_chat_pending *pending)
+{
+	GList *nick, *userhost, *flags = NULL;
+	PurpleChatUser *cb;
+
+	if (pending->nicks == NULL)
+		return;
+
+	pending->nicks = g_list_reverse(pending->nicks);
+	pending->userhosts = g_list_reverse(pending->userhosts);
+
+	if (pending->quit) {
+		purple_chat_conversation_remove_users(chat, pending->nicks, pending->reason);
+		return;
+	}
+
+	for (nick = pending->nicks; nick; nick = nick->next)
+		flags = g_list_prepend(flags, GINT_TO_POINTER(PURPLE_CHAT_USER_NONE));
+
+	purple_chat_conversation_add_users(chat, pending->nicks, pending->userhosts, flags, TRUE);
+	g_list_free(flags);
+
+	for (nick = pending->nicks, userhost = pending->userhosts; nick && userhost;
+			nick = nick->next, userhost = userhost->next) {
+		if ((cb = purple_chat_conversation_find_user(chat, nick->data)) != NULL) {
+			g_object_set_data_full(G_OBJECT(cb), "userhost", userhost->data, (GDestroyNotify)g_free);
+			userhost->data = NULL;
+		}
+	}
+}
+
+static gboolean irc_chat_pending_flush_one(gpointer chat, gpointer pending, gpointer data)
+{
+	irc_chat_pending_apply(chat, pending);
+
+	return TRUE;
+}
+
+void irc_chats_pending_flush(struct irc_conn *irc)
+{
+	if (irc->chats_pending)
+		g_hash_table_foreach_remove(irc->chats_pending, irc_chat_pending_flush_one, NULL);
+}
+
+/* Returns the changes pending for chat, applying those first which can't
+ * be combined with a join, or a quit with the given reason. */
+static struct irc_chat_pending *irc_chat_pending_get(struct irc_conn *irc, PurpleChatConversation *chat, gboolean quit, const char *reason)
+{
+	struct irc_chat_pending *pending;
+
+	if (irc->chats_pending == NULL)
+		irc->chats_pending = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+				NULL, (GDestroyNotify)irc_chat_pending_free);
+
+	pending = g_hash_table_lookup(irc->chats_pending, chat);
+	if (pending != NULL && (pending->quit != quit || g_strcmp0(pending->reason, reason))) {
+		irc_chat_pending_apply(chat, pending);
+		g_hash_table_remove(irc->chats_pending, chat);
+		pending = NULL;
+	}
+
+	if (pending == NULL) {
+		pending = g_new0(struct irc_chat_pending, 1);
+		pending->quit = quit;
+		pending->reason = g_strdup(reason);
+		g_hash_table_insert(irc->chats_pending, chat, pending);
+	}
+
+	return pending;
+}
+
+static void irc_chat_pending_join(struct irc_conn *irc, PurpleChatConversation *chat, const char *nick, char *userhost)
+{
+	struct irc_chat_pending *pending = irc_chat_pending_get(irc, chat, FALSE, NULL);
+
+	pending->nicks = g_list_prepend(pending->nicks, g_strdup(nick));
+	pending->userhosts = g_list_prepend(pending->userhosts, userhost);
+}
+
+static void irc_chat_pending_quit(struct irc_conn *irc, PurpleChatConversation *chat, const char *nick, const char *reason)
+{
+	struct irc_chat_pending *pending;
+	char *message, *stripped;
+
+	stripped = reason ? irc_mirc2txt(reason) : NULL;
+	message = g_strdup_printf("quit: %s", stripped);
+	g_free(stripped);
+
+	pending = irc_chat_pending_get(irc, chat, TRUE, message);
+	g_free(message);
+
+	if (purple_chat_conversation_has_user(chat, nick))
+		pending->nicks = g_list_prepend(pending->nicks, g_strdup(nick));
+}
+
 static void irc_chat_remove_buddy(PurpleChatConversation *chat, char *data[2])
 {
 	char *message, *stripped;
@@ -121,6 +233,8 @@ static void irc_connected(struct irc_conn *irc, const char *nick)
 		g_hash_table_replace(irc->buddies, ib->name, ib);
 	}
 
+	if (irc->monitor)
+		irc_buddy_monitor(irc);
 	irc_blist_timeout(irc);
 	if (!irc->timer)
 		irc->timer = purple_timeout_add_seconds(45, (GSourceFunc)irc_blist_timeout, (gpointer)irc);
@@ -212,6 +326,12 @@ void irc_msg_features(struct irc_conn *irc, const char *name, const char *from,
 		if (!strncmp(features[i], "PREFIX=", 7)) {
 			if ((val = strchr(features[i] + 7, ')')) != NULL)
 				irc->mode_chars = g_strdup(val + 1);
+		} else if (!strcmp(features[i], "MONITOR")) {
+			irc->monitor = TRUE;
+			irc->monitor_max = 0;
+		} else if (!strncmp(features[i], "MONITOR=", 8)) {
+			irc->monitor = TRUE;
+			irc->monitor_max = strtoul(features[i] + 8, NULL, 10);
 		}
 	}
 
@@ -244,7 +364,7 @@ void irc_msg_away(struct irc_conn *irc, const char *name, const char *from, char
 	gc = purple_account_get_connection(irc->account);
 	if (gc) {
 		msg = g_markup_escape_text(args[2], -1);
-		purple_serv_got_im(gc, args[1], msg, PURPLE_MESSAGE_AUTO_RESP, time(NULL));
+		purple_serv_got_im(gc, args[1], msg, PURPLE_MESSAGE_AUTO_RESP, irc_server_time(irc));
 		g_free(msg);
 	}
 }
@@ -325,6 +445,94 @@ void irc_msg_banfull(struct irc_conn *irc, const char *name, const char *from, c
 	g_free(buf);
 }
 
+static void irc_batch_free(struct irc_batch *batch)
+{
+	char *line;
+
+	while ((line = g_queue_pop_head(&batch->lines)) != NULL)
+		g_free(line);
+	g_free(batch->ref);
+	g_free(batch->type);
+	g_free(batch);
+}
+
+struct irc_batch *irc_batch_open(struct irc_conn *irc, const char *ref,
+		const char *type, struct irc_batch *parent)
+{
+	struct irc_batch *batch;
+
+	if (irc->batches == NULL)
+		irc->batches = g_hash_table_new_full(g_str_hash, g_str_equal,
+				NULL, (GDestroyNotify)irc_batch_free);
+
+	batch = g_new0(struct irc_batch, 1);
+	batch->ref = g_strdup(ref);
+	batch->type = g_strdup(type);
+	batch->parent = parent;
+	g_queue_init(&batch->lines);
+	g_hash_table_replace(irc->batches, batch->ref, batch);
+
+	return batch;
+}
+
+static gboolean irc_batch_is_within(gpointer key, gpointer value, gpointer data)
+{
+	struct irc_batch *batch;
+
+	for (batch = ((struct irc_batch *)value)->parent; batch; batch = batch->parent)
+		if (batch == data)
+			return TRUE;
+
+	return FALSE;
+}
+
+void irc_batch_end(struct irc_conn *irc, struct irc_batch *batch)
+{
+	gboolean history;
+	char *line;
+
+	/* Batches started within this one were held back in it, and are
+	 * opened again as it is replayed. */
+	g_hash_table_foreach_remove(irc->batches, irc_batch_is_within, batch);
+	g_hash_table_steal(irc->batches, batch->ref);
+
+	purple_debug_info("irc", "Replaying %u lines of %s batch %s\n",
+			g_queue_get_length(&batch->lines), batch->type, batch->ref);
+
+	history = irc->history;
+	if (!strcmp(batch->type, "chathistory") || !strcmp(batch->type, "znc.in/playback"))
+		irc->history = TRUE;
+	irc->batch_depth++;
+
+	while ((line = g_queue_pop_head(&batch->lines)) != NULL) {
+		irc_route_msg(irc, line);
+		g_free(line);
+	}
+
+	irc->batch_depth--;
+	irc->history = history;
+	irc_chats_pending_flush(irc);
+
+	irc_batch_free(batch);
+}
+
+void irc_msg_batch(struct irc_conn *irc, const char *name, const char *from, char **args)
+{
+	struct irc_batch *batch = NULL;
+
+	if (args[0][0] != '\0' && args[0][1] != '\0' && irc->batches != NULL)
+		batch = g_hash_table_lookup(irc->batches, args[0] + 1);
+
+	if (args[0][0] == '+' && args[0][1] != '\0') {
+		/* A server reusing the reference of an open batch ends it. */
+		if (batch != NULL)
+			irc_batch_end(irc, batch);
+		irc_batch_open(irc, args[0] + 1, args[1] ? args[1] : "", NULL);
+	} else if (args[0][0] == '-' && batch != NULL) {
+		irc_batch_end(irc, batch);
+	}
+}
+
 void irc_msg_chanmode(struct irc_conn *irc, const char *name, const char *from, char **args)
 {
 	PurpleChatConversation *chat;
@@ -645,6 +853,10 @@ void irc_msg_unknown(struct irc_conn *irc, const char *name, const char *from, c
 
 	g_return_if_fail(gc);
 
+	/* The server doesn't do capability negotiation, see do_login() */
+	if (!g_ascii_strcasecmp(args[1], "CAP"))
+		return;
+
 	buf = g_strdup_printf(_("Unknown message '%s'"), args[1]);
 	purple_notify_error(gc, _("Unknown message"), buf, _("The IRC server "
 		"received a message it did not understand."),
@@ -911,8 +1123,13 @@ void irc_msg_ison(struct irc_conn *irc, const char *name, const char *from, char
 static void irc_buddy_status(char *name, struct irc_buddy *ib, struct irc_conn *irc)
 {
 	PurpleConnection *gc = purple_account_get_connection(irc->account);
-	PurpleBuddy *buddy = purple_blist_find_buddy(irc->account, name);
+	PurpleBuddy *buddy;
+
+	/* MONITOR keeps these up to date without ISON */
+	if (ib->monitored)
+		return;
 
+	buddy = purple_blist_find_buddy(irc->account, name);
 	if (!gc || !buddy)
 		return;
 
@@ -925,6 +1142,48 @@ static void irc_buddy_status(char *name, struct irc_buddy *ib, struct irc_conn *
 	}
 }
 
+void irc_msg_monitor(struct irc_conn *irc, const char *name, const char *from, char **args)
+{
+	gboolean online = !strcmp(name, "730");
+	char **targets;
+	struct irc_buddy *ib;
+	int i;
+
+	targets = g_strsplit(args[1], ",", -1);
+	for (i = 0; targets[i]; i++) {
+		char *nick = irc_mask_nick(targets[i]);
+
+		ib = g_hash_table_lookup(irc->buddies, nick);
+		if (ib != NULL && ib->online != online) {
+			ib->online = online;
+			purple_protocol_got_user_status(irc->account, nick,
+					online ? "available" : "offline", NULL);
+		}
+		g_free(nick);
+	}
+	g_strfreev(targets);
+}
+
+void irc_msg_monlistfull(struct irc_conn *irc, const char *name, const char *from, char **args)
+{
+	char **targets;
+	struct irc_buddy *ib;
+	int i;
+
+	/* Whoever didn't fit is polled with ISON instead */
+	irc->monitor_max = strtoul(args[1], NULL, 10);
+
+	targets = g_strsplit(args[2], ",", -1);
+	for (i = 0; targets[i]; i++) {
+		ib = g_hash_table_lookup(irc->buddies, targets[i]);
+		if (ib != NULL && ib->monitored) {
+			ib->monitored = FALSE;
+			irc->monitor_count--;
+		}
+	}
+	g_strfreev(targets);
+}
+
 void irc_msg_join(struct irc_conn *irc, const char *name, const char *from, char **args)
 {
 	PurpleConnection *gc = purple_account_get_connection(irc->account);
@@ -973,12 +1232,17 @@ void irc_msg_join(struct irc_conn *irc, const char *name, const char *from, char
 
 	userhost = irc_mask_userhost(from);
 	
-	purple_chat_conversation_add_user(chat, nick, userhost, PURPLE_CHAT_USER_NONE, TRUE);
-	
-	cb = purple_chat_conversation_find_user(chat, nick);
-	
-	if (cb) {
-		g_object_set_data_full(G_OBJECT(cb), "userhost", userhost, (GDestroyNotify)g_free);
+	if (irc->batch_depth > 0) {
+		irc_chat_pending_join(irc, chat, nick, userhost);
+	} else {
+		purple_chat_conversation_add_user(chat, nick, userhost, PURPLE_CHAT_USER_NONE, TRUE);
+
+		cb = purple_chat_conversation_find_user(chat, nick);
+
+		if (cb) {
+			g_object_set_data_full(G_OBJECT(cb), "userhost", userhost, (GDestroyNotify)g_free);
+		} else
+			g_free(userhost);
 	}
 	
 	if ((ib = g_hash_table_lookup(irc->buddies, nick)) != NULL) {
@@ -1286,6 +1550,7 @@ static void irc_msg_handle_privmsg(struct irc_conn *irc, const char *name, const
 {
 	PurpleConnection *gc = purple_account_get_connection(irc->account);
 	PurpleChatConversation *chat;
+	PurpleMessageFlags flags = irc->history ? PURPLE_MESSAGE_DELAYED : 0;
 	char *tmp;
 	char *msg;
 	char *nick;
@@ -1313,12 +1578,12 @@ static void irc_msg_handle_privmsg(struct irc_conn *irc, const char *name, const
 	}
 
 	if (!purple_utf8_strcasecmp(to, purple_connection_get_display_name(gc))) {
-		purple_serv_got_im(gc, nick, msg, 0, time(NULL));
+		purple_serv_got_im(gc, nick, msg, flags, irc_server_time(irc));
 	} else {
 		chat = purple_conversations_find_chat_with_account(irc_nick_skip_mode(irc, to), irc->account);
 		if (chat) {
 			purple_serv_got_chat_in(gc, purple_chat_conversation_get_id(chat),
-				nick, PURPLE_MESSAGE_RECV, msg, time(NULL));
+				nick, PURPLE_MESSAGE_RECV | flags, msg, irc_server_time(irc));
 		} else
 			purple_debug_error("irc", "Got a %s on %s, which does not exist\n",
 			                   notice ? "NOTICE" : "PRIVMSG", to);
@@ -1359,8 +1624,14 @@ void irc_msg_quit(struct irc_conn *irc, const char *name, const char *from, char
 	data[0] = irc_mask_nick(from);
 	data[1] = args[0];
 	/* XXX this should have an API, I shouldn't grab this directly */
-	g_slist_foreach(purple_connection_get_active_chats(gc),
-			(GFunc)irc_chat_remove_buddy, data);
+	if (irc->batch_depth > 0) {
+		GSList *chats;
+
+		for (chats = purple_connection_get_active_chats(gc); chats; chats = chats->next)
+			irc_chat_pending_quit(irc, chats->data, data[0], data[1]);
+	} else
+		g_slist_foreach(purple_connection_get_active_chats(gc),
+				(GFunc)irc_chat_remove_buddy, data);
 
 	if ((ib = g_hash_table_lookup(irc->buddies, data[0])) != NULL) {
 		ib->new_online_status = FALSE;
@@ -1556,9 +1827,31 @@ irc_auth_start_cyrus(struct irc_conn *irc)
 	g_free(buf);
 }
 
+static gboolean
+irc_sasl_wanted(struct irc_conn *irc)
+{
+	const char *pass = purple_connection_get_password(
+		purple_account_get_connection(irc->account));
+
+	return purple_account_get_bool(irc->account, "sasl", FALSE) &&
+		pass && *pass;
+}
+
+static void
+irc_sasl_unsupported(struct irc_conn *irc)
+{
+	purple_connection_take_error(purple_account_get_connection(irc->account),
+		g_error_new_literal(
+		PURPLE_CONNECTION_ERROR,
+		PURPLE_CONNECTION_ERROR_AUTHENTICATION_IMPOSSIBLE,
+		_("SASL authentication failed: Server does not support SASL authentication.")));
+
+	irc_sasl_finish(irc);
+}
+
 /* SASL authentication */
-void
-irc_msg_cap(struct irc_conn *irc, const char *name, const char *from, char **args)
+static void
+irc_sasl_start(struct irc_conn *irc)
 {
 	int ret = 0;
 	int id = 0;
@@ -1567,18 +1860,6 @@ irc_msg_cap(struct irc_conn *irc, const char *name, const char *from, char **arg
 	char *pos;
 	size_t index;
 
-	if (strncmp(args[2], "sasl ", 6))
-		return;
-	if (strncmp(args[1], "ACK", 4)) {
-		purple_connection_take_error(gc, g_error_new_literal(
-			PURPLE_CONNECTION_ERROR,
-			PURPLE_CONNECTION_ERROR_AUTHENTICATION_IMPOSSIBLE,
-			_("SASL authentication failed: Server does not support SASL authentication.")));
-
-		irc_sasl_finish(irc);
-		return;
-	}
-
 	if ((ret = sasl_client_init(NULL)) != SASL_OK) {
 		purple_connection_take_error(gc, g_error_new_literal(
 			PURPLE_CONNECTION_ERROR,
@@ -1788,3 +2069,155 @@ irc_sasl_finish(struct irc_conn *irc)
 	g_free(buf);
 }
 #endif
+
+/* Capability negotiation */
+static const char *irc_caps[] = {
+	"batch",
+	"message-tags",
+	"server-time",
+	NULL
+};
+
+static gboolean
+irc_cap_wanted(struct irc_conn *irc, const char *cap)
+{
+	int i;
+
+	for (i = 0; irc_caps[i]; i++) {
+		if (!strcmp(cap, irc_caps[i]))
+			return TRUE;
+	}
+
+#ifdef HAVE_CYRUS_SASL
+	if (!strcmp(cap, "sasl"))
+		return irc_sasl_wanted(irc);
+#endif
+
+	return FALSE;
+}
+
+static void
+irc_cap_end(struct irc_conn *irc)
+{
+	char *buf;
+
+	buf = irc_format(irc, "vv", "CAP", "END");
+	irc_send(irc, buf);
+	g_free(buf);
+}
+
+static void
+irc_cap_ls(struct irc_conn *irc, const char *list, gboolean more)
+{
+	GString *req;
+	gchar **caps;
+	char *buf;
+	int i;
+#ifdef HAVE_CYRUS_SASL
+	gboolean sasl = FALSE;
+#endif
+
+	/* Long lists are split up over several replies. */
+	if (irc->cap_ls == NULL)
+		irc->cap_ls = g_string_new(NULL);
+	g_string_append_printf(irc->cap_ls, "%s ", list);
+	if (more)
+		return;
+
+	req = g_string_new(NULL);
+	caps = g_strsplit(irc->cap_ls->str, " ", -1);
+	for (i = 0; caps[i]; i++) {
+		char *value;
+
+		/* Version 302 lists values along with some capabilities. */
+		if ((value = strchr(caps[i], '=')) != NULL)
+			*value = '\0';
+
+#ifdef HAVE_CYRUS_SASL
+		if (!strcmp(caps[i], "sasl"))
+			sasl = TRUE;
+#endif
+
+		if (*caps[i] && irc_cap_wanted(irc, caps[i])) {
+			if (req->len)
+				g_string_append_c(req, ' ');
+			g_string_append(req, caps[i]);
+		}
+	}
+	g_strfreev(caps);
+	g_string_free(irc->cap_ls, TRUE);
+	irc->cap_ls = NULL;
+
+#ifdef HAVE_CYRUS_SASL
+	if (irc_sasl_wanted(irc) && !sasl) {
+		g_string_free(req, TRUE);
+		irc_sasl_unsupported(irc);
+		return;
+	}
+#endif
+
+	if (req->len) {
+		buf = irc_format(irc, "vv:", "CAP", "REQ", req->str);
+		irc_send(irc, buf);
+		g_free(buf);
+	} else
+		irc_cap_end(irc);
+
+	g_string_free(req, TRUE);
+}
+
+static void
+irc_cap_ack(struct irc_conn *irc, const char *list)
+{
+	gchar **caps;
+	int i;
+
+	caps = g_strsplit(list, " ", -1);
+	for (i = 0; caps[i]; i++) {
+		if (*caps[i] == '-')
+			g_hash_table_remove(irc->caps, caps[i] + 1);
+		else if (*caps[i])
+			g_hash_table_replace(irc->caps, g_strdup(caps[i]), NULL);
+	}
+	g_strfreev(caps);
+
+#ifdef HAVE_CYRUS_SASL
+	/* SASL ends the negotiation itself, once it's done. */
+	if (irc_sasl_wanted(irc) && irc->sasl_conn == NULL &&
+			g_hash_table_contains(irc->caps, "sasl")) {
+		irc_sasl_start(irc);
+		return;
+	}
+#endif
+
+	irc_cap_end(irc);
+}
+
+void
+irc_msg_cap(struct irc_conn *irc, const char *name, const char *from, char **args)
+{
+	const char *list = args[2];
+	gboolean more = FALSE;
+
+	/* "CAP * LS * :caps" is followed by more of the list. */
+	if (list[0] == '*' && list[1] == ' ') {
+		more = TRUE;
+		list += 2;
+		if (*list == ':')
+			list++;
+	}
+
+	if (!strcmp(args[1], "LS")) {
+		irc_cap_ls(irc, list, more);
+	} else if (!strcmp(args[1], "ACK")) {
+		irc_cap_ack(irc, list);
+	} else if (!strcmp(args[1], "NAK")) {
+#ifdef HAVE_CYRUS_SASL
+		if (irc_sasl_wanted(irc)) {
+			irc_sasl_unsupported(irc);
+			return;
+		}
+#endif
+		irc_cap_end(irc);
+	}
+}
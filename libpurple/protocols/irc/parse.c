@@ -110,14 +110,18 @@ static struct _irc_msg {
 	{ "501", "n:", 2, irc_msg_badmode },		/* Unknown mode flag		*/
 	{ "506", "nc:", 3, irc_msg_nosend },		/* Must identify to send	*/
 	{ "515", "nc:", 3, irc_msg_regonly },		/* Registration required	*/
+	{ "730", "n:", 2, irc_msg_monitor },		/* Monitored nicks online	*/
+	{ "731", "n:", 2, irc_msg_monitor },		/* Monitored nicks offline	*/
+	{ "734", "nvv:", 3, irc_msg_monlistfull },	/* MONITOR list is full		*/
 #ifdef HAVE_CYRUS_SASL
 	{ "903", "*", 0, irc_msg_authok},		/* SASL auth successful		*/
 	{ "904", "*", 0, irc_msg_authtryagain },	/* SASL auth failed, can recover*/
 	{ "905", "*", 0, irc_msg_authfail },		/* SASL auth failed		*/
 	{ "906", "*", 0, irc_msg_authfail },		/* SASL auth failed		*/
 	{ "907", "*", 0, irc_msg_authfail },		/* SASL auth failed		*/
-	{ "cap", "vv:", 3, irc_msg_cap },		/* SASL capable			*/
 #endif
+	{ "batch", "vv:", 1, irc_msg_batch },		/* Start or end of a batch	*/
+	{ "cap", "vv:", 3, irc_msg_cap },		/* Capability negotiation	*/
 	{ "invite", "n:", 2, irc_msg_invite },		/* Invited			*/
 	{ "join", ":", 1, irc_msg_join },		/* Joined a channel		*/
 	{ "kick", "cn:", 3, irc_msg_kick },		/* KICK				*/
@@ -134,6 +138,12 @@ static struct _irc_msg {
 	{ NULL, NULL, 0, NULL }
 };
 
+/* Numerics are looked up by their value and commands by a binary search
+ * of their names, so neither needs a copy of the command to be made. */
+static struct _irc_msg *irc_numeric_msgs[1000];
+static struct _irc_msg *irc_named_msgs[G_N_ELEMENTS(_irc_msgs)];
+static guint irc_named_msgs_count = 0;
+
 static struct _irc_user_cmd {
 	char *name;
 	char *format;
@@ -323,6 +333,39 @@ static char *irc_recv_convert(struct irc_conn *irc, const char *string)
 	return purple_utf8_salvage(string);
 }
 
+/* Like irc_recv_convert(), but returns string itself where converting it
+ * would only have copied it.  Anything allocated is stored in *allocated. */
+static char *irc_recv_convert_lazy(struct irc_conn *irc, char *string,
+                                   char **allocated)
+{
+	const gchar *enclist;
+
+	if (purple_account_get_bool(irc->account, "autodetect_utf8", IRC_DEFAULT_AUTODETECT)) {
+		if (g_utf8_validate(string, -1, NULL))
+			return string;
+	} else {
+		enclist = purple_account_get_string(irc->account, "encoding", IRC_DEFAULT_CHARSET);
+		while (*enclist == ' ')
+			enclist++;
+		if (!g_ascii_strncasecmp(enclist, "UTF-8", 5) &&
+				(enclist[5] == '\0' || enclist[5] == ',') &&
+				g_utf8_validate(string, -1, NULL))
+			return string;
+	}
+
+	return *allocated = irc_recv_convert(irc, string);
+}
+
+/* Returns string if it is valid UTF-8, or a salvaged copy of it, which is
+ * also stored in *allocated, if not. */
+static char *irc_recv_salvage(char *string, char **allocated)
+{
+	if (g_utf8_validate(string, -1, NULL))
+		return string;
+
+	return *allocated = purple_utf8_salvage(string);
+}
+
 /* This function is shamelessly stolen from glib--it is an old version of the
  * private function append_escaped_text, used by g_markup_escape_text, whose
  * behavior changed in glib 2.12. */
@@ -612,18 +655,76 @@ char *irc_parse_ctcp(struct irc_conn *irc, const char *from, const char *to, con
 	return buf;
 }
 
-void irc_msg_table_build(struct irc_conn *irc)
+static gboolean irc_msg_is_numeric(const char *name, gsize len)
+{
+	return len == 3 && g_ascii_isdigit(name[0]) &&
+	       g_ascii_isdigit(name[1]) && g_ascii_isdigit(name[2]);
+}
+
+static int irc_msg_compare(const void *a, const void *b)
+{
+	return g_ascii_strcasecmp((*(struct _irc_msg * const *)a)->name,
+	                          (*(struct _irc_msg * const *)b)->name);
+}
+
+void irc_msg_table_build(void)
 {
 	int i;
 
-	if (!irc || !irc->msgs) {
-		purple_debug(PURPLE_DEBUG_ERROR, "irc", "Attempt to build a message table on a bogus structure\n");
+	if (irc_named_msgs_count > 0)
 		return;
-	}
 
 	for (i = 0; _irc_msgs[i].name; i++) {
-		g_hash_table_insert(irc->msgs, (gpointer)_irc_msgs[i].name, (gpointer)&_irc_msgs[i]);
+		const char *name = _irc_msgs[i].name;
+
+		if (strlen(_irc_msgs[i].format) > IRC_MAX_MSG_ARGS) {
+			purple_debug(PURPLE_DEBUG_ERROR, "irc", "Too many arguments for message '%s'\n", name);
+			continue;
+		}
+
+		if (irc_msg_is_numeric(name, strlen(name)))
+			irc_numeric_msgs[atoi(name)] = &_irc_msgs[i];
+		else
+			irc_named_msgs[irc_named_msgs_count++] = &_irc_msgs[i];
+	}
+
+	qsort(irc_named_msgs, irc_named_msgs_count, sizeof(irc_named_msgs[0]),
+	      irc_msg_compare);
+}
+
+/* Finds the message for the len bytes of command at name, ignoring case. */
+static struct _irc_msg *irc_msg_lookup(const char *name, gsize len)
+{
+	guint lo = 0, hi = irc_named_msgs_count;
+
+	if (irc_msg_is_numeric(name, len))
+		return irc_numeric_msgs[(name[0] - '0') * 100 +
+		                        (name[1] - '0') * 10 + (name[2] - '0')];
+
+	while (lo < hi) {
+		guint mid = (lo + hi) / 2;
+		const char *entry = irc_named_msgs[mid]->name;
+		int cmp = g_ascii_strncasecmp(name, entry, len);
+
+		if (cmp == 0 && entry[len] != '\0')
+			cmp = -1;
+
+		if (cmp == 0)
+			return irc_named_msgs[mid];
+		else if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
 	}
+
+	return NULL;
+}
+
+const char *irc_msg_get_format(const char *name, gsize len)
+{
+	struct _irc_msg *msgent = irc_msg_lookup(name, len);
+
+	return msgent ? msgent->format : NULL;
 }
 
 void irc_cmd_table_build(struct irc_conn *irc)
@@ -677,14 +778,115 @@ char *irc_format(struct irc_conn *irc, const char *format, ...)
 	return (g_string_free(string, FALSE));
 }
 
+int irc_parse_args(char *cur, const char *format, char **args)
+{
+	char *end;
+	gboolean more = (*cur != '\0');
+	int i;
+
+	for (i = 0; format[i] && more; i++) {
+		/* skip the separating space */
+		cur++;
+
+		switch (format[i]) {
+		case 'v':
+		case 't':
+		case 'n':
+		case 'c':
+			args[i] = cur;
+			if ((end = strchr(cur, ' ')) != NULL) {
+				*end = '\0';
+				cur = end;
+			} else
+				more = FALSE;
+			break;
+		case ':':
+			if (*cur == ':') cur++;
+			/* fallthrough */
+		case '*':
+			args[i] = cur;
+			more = FALSE;
+			break;
+		default:
+			purple_debug(PURPLE_DEBUG_ERROR, "irc", "invalid message format character '%c'\n", format[i]);
+			return -1;
+		}
+	}
+
+	return i;
+}
+
+/* Returns the open batch which the tags at the start of input put the line
+ * in, if any. */
+static struct irc_batch *irc_batch_find(struct irc_conn *irc, const char *input)
+{
+	const char *tag, *end;
+	struct irc_batch *batch;
+	char *ref;
+
+	for (tag = input + 1; *tag && *tag != ' '; tag = (*end == ';') ? end + 1 : end) {
+		end = tag + strcspn(tag, "; ");
+
+		if (!strncmp(tag, "batch=", 6) && end > tag + 6) {
+			ref = g_strndup(tag + 6, end - (tag + 6));
+			batch = g_hash_table_lookup(irc->batches, ref);
+			g_free(ref);
+			return batch;
+		}
+	}
+
+	return NULL;
+}
+
+static void irc_parse_tags(struct irc_conn *irc, char *tags)
+{
+	char *tag, *next;
+
+	for (tag = tags; tag != NULL; tag = next) {
+		if ((next = strchr(tag, ';')) != NULL)
+			*next++ = '\0';
+
+		if (!strncmp(tag, "time=", 5))
+			irc->msg_time = purple_str_to_time(tag + 5, TRUE, NULL, NULL, NULL);
+	}
+}
+
+time_t irc_server_time(struct irc_conn *irc)
+{
+	return irc->msg_time ? irc->msg_time : time(NULL);
+}
+
+/* Returns the reference of the batch a BATCH line starts or ends, and sets
+ * sign to '+' or '-'.  Returns NULL for any other line. */
+static char *irc_batch_line_ref(const char *input, char *sign)
+{
+	const char *cur = input;
+
+	if (*cur == '@' || *cur == ':') {
+		if ((cur = strchr(cur, ' ')) == NULL)
+			return NULL;
+		cur++;
+	}
+	if (*cur == ':') {
+		if ((cur = strchr(cur, ' ')) == NULL)
+			return NULL;
+		cur++;
+	}
+
+	if (g_ascii_strncasecmp(cur, "BATCH ", 6) != 0)
+		return NULL;
+	cur += 6;
+
+	if ((*cur != '+' && *cur != '-') || cur[1] == '\0' || cur[1] == ' ')
+		return NULL;
+	*sign = *cur++;
+
+	return g_strndup(cur, strcspn(cur, " "));
+}
+
 void irc_parse_msg(struct irc_conn *irc, char *input)
 {
-	struct _irc_msg *msgent;
-	char *cur, *end, *tmp, *from, *msgname, *fmt, **args, *msg;
-	guint i;
 	PurpleConnection *gc = purple_account_get_connection(irc->account);
-	gboolean fmt_valid;
-	int args_cnt;
 
 	irc->recv_time = time(NULL);
 
@@ -695,6 +897,69 @@ void irc_parse_msg(struct irc_conn *irc, char *input)
 	 */
 	purple_signal_emit(_irc_protocol, "irc-receiving-text", gc, &input);
 
+	irc_route_msg(irc, input);
+}
+
+/* Holds a line back if it is in a batch, and handles it otherwise.  The
+ * lines of a batch come through here again as it is replayed, so batches
+ * within it are held back in turn. */
+void irc_route_msg(struct irc_conn *irc, char *input)
+{
+	struct irc_batch *batch = NULL, *nested;
+	char *ref;
+	char sign;
+
+	if (irc->batches == NULL || g_hash_table_size(irc->batches) == 0) {
+		irc_handle_msg(irc, input);
+		return;
+	}
+
+	if (*input == '@' && (batch = irc_batch_find(irc, input)) != NULL) {
+		while (batch->parent != NULL)
+			batch = batch->parent;
+
+		/* A batch which never ends mustn't hold back everything. */
+		if (g_queue_get_length(&batch->lines) >= IRC_BATCH_MAX_LINES) {
+			purple_debug_warning("irc", "Batch %s is too long, "
+					"replaying it early\n", batch->ref);
+			irc_batch_end(irc, batch);
+			batch = NULL;
+		}
+	}
+
+	/* A batch started within another one is held back along with its
+	 * lines and its end, all in the order they came in. */
+	if ((ref = irc_batch_line_ref(input, &sign)) != NULL) {
+		nested = irc->batches ? g_hash_table_lookup(irc->batches, ref) : NULL;
+
+		if (sign == '+' && batch != NULL && nested == NULL) {
+			irc_batch_open(irc, ref, "", batch);
+		} else if (sign == '-' && nested != NULL && nested->parent != NULL) {
+			for (batch = nested; batch->parent; batch = batch->parent)
+				;
+			g_hash_table_remove(irc->batches, ref);
+		}
+
+		g_free(ref);
+	}
+
+	if (batch == NULL) {
+		irc_handle_msg(irc, input);
+		return;
+	}
+
+	g_queue_push_tail(&batch->lines, g_strdup(input));
+}
+
+static void irc_dispatch_msg(struct irc_conn *irc, char *input)
+{
+	struct _irc_msg *msgent;
+	char *cur, *end, *from, *msg, *tmp = NULL;
+	char *args[IRC_MAX_MSG_ARGS] = { NULL };
+	char *converted[IRC_MAX_MSG_ARGS] = { NULL };
+	PurpleConnection *gc = purple_account_get_connection(irc->account);
+	int i, args_cnt;
+
 	if (!strncmp(input, "PING ", 5)) {
 		msg = irc_format(irc, "vv", "PONG", input + 5);
 		irc_send(irc, msg);
@@ -724,85 +989,83 @@ void irc_parse_msg(struct irc_conn *irc, char *input)
 		return;
 	}
 
-	from = g_strndup(&input[1], cur - &input[1]);
 	cur++;
 	end = strchr(cur, ' ');
 	if (!end)
 		end = cur + strlen(cur);
 
-	tmp = g_strndup(cur, end - cur);
-	msgname = g_ascii_strdown(tmp, -1);
-	g_free(tmp);
-
-	if ((msgent = g_hash_table_lookup(irc->msgs, msgname)) == NULL) {
+	if ((msgent = irc_msg_lookup(cur, end - cur)) == NULL) {
+		from = g_strndup(&input[1], cur - 1 - &input[1]);
 		irc_msg_default(irc, "", from, &input);
-		g_free(msgname);
 		g_free(from);
 		return;
 	}
-	g_free(msgname);
 
-	fmt_valid = TRUE;
-	args = g_new0(char *, strlen(msgent->format));
-	args_cnt = 0;
-	for (cur = end, fmt = msgent->format, i = 0; fmt[i] && *cur++; i++) {
-		switch (fmt[i]) {
+	/* The line is split up in place from here on. */
+	from = &input[1];
+	cur[-1] = '\0';
+
+	args_cnt = irc_parse_args(end, msgent->format, args);
+	if (G_UNLIKELY(args_cnt < 0)) {
+		purple_debug_error("irc", "message format was invalid");
+		return;
+	} else if (G_UNLIKELY(args_cnt < msgent->req_cnt)) {
+		purple_debug_error("irc", "args count (%d) doesn't reach "
+			"expected value of %d for the '%s' command",
+			args_cnt, msgent->req_cnt, msgent->name);
+		return;
+	}
+
+	/* Arguments are only copied when they have to be converted. */
+	for (i = 0; i < args_cnt; i++) {
+		switch (msgent->format[i]) {
 		case 'v':
-			if (!(end = strchr(cur, ' '))) end = cur + strlen(cur);
+		case '*':
 			/* This is a string of unknown encoding which we do not
 			 * want to transcode, but it may or may not be valid
 			 * UTF-8, so we'll salvage it.  If a nick/channel/target
 			 * field has inadvertently been marked verbatim, this
 			 * could cause weirdness. */
-			tmp = g_strndup(cur, end - cur);
-			args[i] = purple_utf8_salvage(tmp);
-			g_free(tmp);
-			cur += end - cur;
-			break;
-		case 't':
-		case 'n':
-		case 'c':
-			if (!(end = strchr(cur, ' '))) end = cur + strlen(cur);
-			tmp = g_strndup(cur, end - cur);
-			args[i] = irc_recv_convert(irc, tmp);
-			g_free(tmp);
-			cur += end - cur;
-			break;
-		case ':':
-			if (*cur == ':') cur++;
-			args[i] = irc_recv_convert(irc, cur);
-			cur = cur + strlen(cur);
-			break;
-		case '*':
-			/* Ditto 'v' above; we're going to salvage this in case
-			 * it leaks past the IRC protocol */
-			args[i] = purple_utf8_salvage(cur);
-			cur = cur + strlen(cur);
+			args[i] = irc_recv_salvage(args[i], &converted[i]);
 			break;
 		default:
-			purple_debug(PURPLE_DEBUG_ERROR, "irc", "invalid message format character '%c'\n", fmt[i]);
-			fmt_valid = FALSE;
+			args[i] = irc_recv_convert_lazy(irc, args[i], &converted[i]);
 			break;
 		}
-		if (fmt_valid)
-			args_cnt = i + 1;
 	}
-	if (G_UNLIKELY(!fmt_valid)) {
-		purple_debug_error("irc", "message format was invalid");
-	} else if (G_LIKELY(args_cnt >= msgent->req_cnt)) {
-		tmp = irc_recv_convert(irc, from);
-		(msgent->cb)(irc, msgent->name, tmp, args);
-		g_free(tmp);
-	} else {
-		purple_debug_error("irc", "args count (%d) doesn't reach "
-			"expected value of %d for the '%s' command",
-			args_cnt, msgent->req_cnt, msgent->name);
-	}
-	for (i = 0; i < strlen(msgent->format); i++) {
-		g_free(args[i]);
+
+	/* Only joins and quits are collected while replaying a batch; anything
+	 * else sees the channels as they would be without batching. */
+	if (irc->batch_depth > 0 && msgent->cb != irc_msg_join &&
+			msgent->cb != irc_msg_quit)
+		irc_chats_pending_flush(irc);
+
+	from = irc_recv_convert_lazy(irc, from, &tmp);
+	(msgent->cb)(irc, msgent->name, from, args);
+
+	g_free(tmp);
+	for (i = 0; i < args_cnt; i++)
+		g_free(converted[i]);
+}
+
+void irc_handle_msg(struct irc_conn *irc, char *input)
+{
+	char *tags;
+
+	/* IRCv3 message tags */
+	if (*input == '@') {
+		tags = input + 1;
+		if ((input = strchr(tags, ' ')) == NULL) {
+			irc_parse_error_cb(irc, tags - 1);
+			return;
+		}
+		*input++ = '\0';
+		irc_parse_tags(irc, tags);
 	}
-	g_free(args);
-	g_free(from);
+
+	irc_dispatch_msg(irc, input);
+
+	irc->msg_time = 0;
 }
 
 static void irc_parse_error_cb(struct irc_conn *irc, char *input)
@@ -0,0 +1,612 @@
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <string.h>
+
+#include "account.h"
+#include "accounts.h"
+#include "connection.h"
+#include "conversations.h"
+#include "core.h"
+#include "eventloop.h"
+#include "protocols.h"
+#include "server.h"
+#include "signals.h"
+#include "util.h"
+
+#include "../irc.h"
+
+#define TEST_IRC_PARSE_UI "test-irc-parse"
+#define TEST_IRC_PARSE_PROTOCOL "prpl-test-irc-parse"
+#define TEST_IRC_PARSE_PERF_LINES 200000
+
+extern PurpleProtocol *_irc_protocol;
+
+/******************************************************************************
+ * Test protocol
+ *****************************************************************************/
+/* It stands in for the IRC protocol, so that the messages can be handled
+ * on a connection which never touches the network; it connects at once. */
+typedef PurpleProtocol TestProtocol;
+typedef PurpleProtocolClass TestProtocolClass;
+
+G_DEFINE_TYPE(TestProtocol, test_protocol, PURPLE_TYPE_PROTOCOL);
+
+static void
+test_protocol_login(PurpleAccount *account) {
+	PurpleConnection *gc = purple_account_get_connection(account);
+
+	purple_connection_set_display_name(gc, "me");
+	purple_connection_set_state(gc, PURPLE_CONNECTION_CONNECTED);
+}
+
+static void
+test_protocol_close(PurpleConnection *gc) {
+}
+
+static GList *
+test_protocol_status_types(PurpleAccount *account) {
+	GList *types = NULL;
+
+	types = g_list_append(types, purple_status_type_new(
+		PURPLE_STATUS_AVAILABLE, NULL, NULL, TRUE));
+	types = g_list_append(types, purple_status_type_new(
+		PURPLE_STATUS_OFFLINE, NULL, NULL, TRUE));
+
+	return types;
+}
+
+static const char *
+test_protocol_list_icon(PurpleAccount *account, PurpleBuddy *buddy) {
+	return "irc";
+}
+
+static void
+test_protocol_init(TestProtocol *protocol) {
+	protocol->id = TEST_IRC_PARSE_PROTOCOL;
+	protocol->name = "IRC Parse Test";
+	protocol->options = OPT_PROTO_NO_PASSWORD;
+}
+
+static void
+test_protocol_class_init(TestProtocolClass *klass) {
+	klass->login = test_protocol_login;
+	klass->close = test_protocol_close;
+	klass->status_types = test_protocol_status_types;
+	klass->list_icon = test_protocol_list_icon;
+}
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static PurpleEventLoopUiOps test_eventloop_ops = {
+	g_timeout_add,
+	g_source_remove,
+	NULL,
+	NULL,
+	NULL,
+	g_timeout_add_seconds,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+typedef struct {
+	gchar *dir;
+	struct irc_conn *irc;
+	PurpleChatConversation *chat;
+	gint received;
+	/* the lines sent, without their line endings */
+	GPtrArray *sent;
+} TestIrcParseConn;
+
+static void
+test_irc_parse_sending_text_cb(PurpleConnection *gc, char **msg,
+                               TestIrcParseConn *test)
+{
+	g_ptr_array_add(test->sent, g_strchomp(g_strdup(*msg)));
+}
+
+static void
+test_irc_parse_received_chat_msg_cb(PurpleAccount *account,
+                                    const char *sender, const char *message,
+                                    PurpleChatConversation *chat,
+                                    PurpleMessageFlags flags,
+                                    TestIrcParseConn *test)
+{
+	test->received++;
+}
+
+static void
+test_irc_parse_buddy_free(struct irc_buddy *ib) {
+	g_free(ib->name);
+	g_free(ib);
+}
+
+/* Sets up an irc_conn as irc_login() would, on a connected account, with
+ * "me" already in #busy.  What it sends is only kept in test->sent. */
+static void
+test_irc_parse_conn_setup(TestIrcParseConn *test, gconstpointer data) {
+	PurpleAccount *account;
+	PurpleConnection *gc;
+	GOutputStream *sink;
+	GError *error = NULL;
+
+	memset(test, 0, sizeof(*test));
+
+	test->dir = g_dir_make_tmp("purple-irc-parse-XXXXXX", NULL);
+	g_assert_nonnull(test->dir);
+	purple_util_set_user_dir(test->dir);
+
+	purple_eventloop_set_ui_ops(&test_eventloop_ops);
+	g_assert_true(purple_core_init(TEST_IRC_PARSE_UI));
+
+	_irc_protocol = purple_protocols_add(test_protocol_get_type(), &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(_irc_protocol);
+	purple_signal_register(_irc_protocol, "irc-sending-text",
+	                       purple_marshal_VOID__POINTER_POINTER,
+	                       G_TYPE_NONE, 2, PURPLE_TYPE_CONNECTION,
+	                       G_TYPE_POINTER);
+	purple_signal_register(_irc_protocol, "irc-receiving-text",
+	                       purple_marshal_VOID__POINTER_POINTER,
+	                       G_TYPE_NONE, 2, PURPLE_TYPE_CONNECTION,
+	                       G_TYPE_POINTER);
+
+	irc_msg_table_build();
+
+	account = purple_account_new("me@irc.example.net",
+	                             TEST_IRC_PARSE_PROTOCOL);
+	purple_accounts_add(account);
+	purple_account_set_status(account, "available", TRUE, NULL);
+	purple_account_set_enabled(account, TEST_IRC_PARSE_UI, TRUE);
+	g_assert_true(purple_account_is_connected(account));
+	gc = purple_account_get_connection(account);
+
+	sink = g_memory_output_stream_new_resizable();
+	test->irc = g_new0(struct irc_conn, 1);
+	test->irc->account = account;
+	test->irc->cancellable = g_cancellable_new();
+	test->irc->buddies = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+	                                           (GDestroyNotify)test_irc_parse_buddy_free);
+	test->irc->caps = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	                                        NULL);
+	test->irc->output = purple_queued_output_stream_new(sink);
+	g_object_unref(sink);
+
+	test->chat = purple_serv_got_joined_chat(gc, 1, "#busy");
+	g_assert_nonnull(test->chat);
+
+	test->sent = g_ptr_array_new_with_free_func(g_free);
+	purple_signal_connect(_irc_protocol, "irc-sending-text", test,
+	                      PURPLE_CALLBACK(test_irc_parse_sending_text_cb),
+	                      test);
+	purple_signal_connect(purple_conversations_get_handle(),
+	                      "received-chat-msg", test,
+	                      PURPLE_CALLBACK(test_irc_parse_received_chat_msg_cb),
+	                      test);
+}
+
+static void
+test_irc_parse_remove_dir(const gchar *path) {
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const gchar *name;
+
+	while (dir && (name = g_dir_read_name(dir)) != NULL) {
+		gchar *child = g_build_filename(path, name, NULL);
+
+		if (g_file_test(child, G_FILE_TEST_IS_DIR))
+			test_irc_parse_remove_dir(child);
+		else
+			g_unlink(child);
+		g_free(child);
+	}
+
+	if (dir)
+		g_dir_close(dir);
+	g_rmdir(path);
+}
+
+static void
+test_irc_parse_conn_teardown(TestIrcParseConn *test, gconstpointer data) {
+	purple_signals_disconnect_by_handle(test);
+	g_ptr_array_free(test->sent, TRUE);
+
+	g_cancellable_cancel(test->irc->cancellable);
+	g_object_unref(test->irc->cancellable);
+	g_object_unref(test->irc->output);
+	g_hash_table_destroy(test->irc->buddies);
+	g_hash_table_destroy(test->irc->caps);
+	if (test->irc->cap_ls)
+		g_string_free(test->irc->cap_ls, TRUE);
+	g_free(test->irc->mode_chars);
+	if (test->irc->names)
+		g_string_free(test->irc->names, TRUE);
+	g_free(test->irc);
+
+	purple_core_quit();
+	_irc_protocol = NULL;
+
+	test_irc_parse_remove_dir(test->dir);
+	g_free(test->dir);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_irc_parse_lookup(void) {
+	irc_msg_table_build();
+
+	g_assert_cmpstr(irc_msg_get_format("PRIVMSG", 7), ==, "t:");
+	g_assert_cmpstr(irc_msg_get_format("privmsg", 7), ==, "t:");
+	g_assert_cmpstr(irc_msg_get_format("PRIVMSG #chan", 7), ==, "t:");
+	g_assert_cmpstr(irc_msg_get_format("353", 3), ==, "nvc:");
+	g_assert_cmpstr(irc_msg_get_format("005", 3), ==, "n*");
+
+	/* prefixes and extensions of known commands are not commands */
+	g_assert_null(irc_msg_get_format("PRIV", 4));
+	g_assert_null(irc_msg_get_format("PRIVMSGS", 8));
+	g_assert_null(irc_msg_get_format("999", 3));
+	g_assert_null(irc_msg_get_format("3530", 4));
+	g_assert_null(irc_msg_get_format("", 0));
+}
+
+static void
+test_irc_parse_args(void) {
+	char line[] = " #chan :hello there world";
+	char *args[IRC_MAX_MSG_ARGS] = { NULL };
+
+	g_assert_cmpint(irc_parse_args(line, "t:", args), ==, 2);
+	g_assert_cmpstr(args[0], ==, "#chan");
+	g_assert_cmpstr(args[1], ==, "hello there world");
+
+	/* the arguments point into the line itself */
+	g_assert_true(args[0] == line + 1);
+}
+
+static void
+test_irc_parse_args_short(void) {
+	char line[] = " nick";
+	char empty[] = "";
+	char *args[IRC_MAX_MSG_ARGS] = { NULL };
+
+	g_assert_cmpint(irc_parse_args(line, "nvc:", args), ==, 1);
+	g_assert_cmpstr(args[0], ==, "nick");
+	g_assert_null(args[1]);
+
+	g_assert_cmpint(irc_parse_args(empty, "t:", args), ==, 0);
+}
+
+static void
+test_irc_parse_args_trailing(void) {
+	char line[] = " #chan :";
+	char spaced[] = " a b ";
+	char rest[] = " MODE #chan +o nick";
+	char *args[IRC_MAX_MSG_ARGS] = { NULL };
+
+	g_assert_cmpint(irc_parse_args(line, "c:", args), ==, 2);
+	g_assert_cmpstr(args[0], ==, "#chan");
+	g_assert_cmpstr(args[1], ==, "");
+
+	/* a trailing space still separates an empty argument */
+	g_assert_cmpint(irc_parse_args(spaced, "vvv", args), ==, 3);
+	g_assert_cmpstr(args[0], ==, "a");
+	g_assert_cmpstr(args[1], ==, "b");
+	g_assert_cmpstr(args[2], ==, "");
+
+	/* '*' takes the rest of the line verbatim, colons included */
+	g_assert_cmpint(irc_parse_args(rest, "*", args), ==, 1);
+	g_assert_cmpstr(args[0], ==, "MODE #chan +o nick");
+}
+
+static void
+test_irc_parse_args_invalid(void) {
+	char line[] = " foo bar";
+	char *args[IRC_MAX_MSG_ARGS] = { NULL };
+
+	g_assert_cmpint(irc_parse_args(line, "vx", args), ==, -1);
+}
+
+static void
+test_irc_parse_batch_nested(void) {
+	struct irc_conn irc;
+	struct irc_batch *outer;
+	gchar *lines[] = {
+		"@batch=outer :irc.example.com BATCH +inner chathistory #chan",
+		"@batch=inner :nick!user@host PRIVMSG #chan :hello",
+		":irc.example.com BATCH -inner",
+	};
+	gsize i;
+
+	memset(&irc, 0, sizeof(irc));
+	outer = irc_batch_open(&irc, "outer", "netsplit", NULL);
+
+	/* The inner batch, its lines and its end are all held back in the outer
+	 * one, so none of them reach irc_handle_msg. */
+	for (i = 0; i < G_N_ELEMENTS(lines); i++)
+		irc_route_msg(&irc, lines[i]);
+
+	g_assert_cmpuint(g_queue_get_length(&outer->lines), ==, 3);
+	g_assert_null(g_hash_table_lookup(irc.batches, "inner"));
+	g_assert_true(g_hash_table_lookup(irc.batches, "outer") == outer);
+
+	g_hash_table_destroy(irc.batches);
+}
+
+/* Handles the line as if it had just been read. */
+static void
+test_irc_parse_feed(TestIrcParseConn *test, const gchar *line) {
+	gchar *copy = g_strdup(line);
+
+	irc_parse_msg(test->irc, copy);
+	g_free(copy);
+}
+
+/* Checks that exactly these lines were sent since the last check. */
+static void
+test_irc_parse_assert_sent(TestIrcParseConn *test, ...) {
+	const gchar *line;
+	va_list args;
+	guint i = 0;
+
+	va_start(args, test);
+	while ((line = va_arg(args, const gchar *)) != NULL) {
+		g_assert_cmpuint(i, <, test->sent->len);
+		g_assert_cmpstr(g_ptr_array_index(test->sent, i), ==, line);
+		i++;
+	}
+	va_end(args);
+
+	g_assert_cmpuint(test->sent->len, ==, i);
+	g_ptr_array_set_size(test->sent, 0);
+}
+
+static struct irc_buddy *
+test_irc_parse_add_buddy(TestIrcParseConn *test, const gchar *name) {
+	struct irc_buddy *ib = g_new0(struct irc_buddy, 1);
+
+	ib->name = g_strdup(name);
+	ib->ref = 1;
+	g_hash_table_replace(test->irc->buddies, ib->name, ib);
+
+	return ib;
+}
+
+static void
+test_irc_parse_cap_ls(TestIrcParseConn *test, gconstpointer data) {
+	/* version 302 splits the list up and gives values with it */
+	test_irc_parse_feed(test, ":irc.example.net CAP * LS * "
+	                          ":multi-prefix batch sasl=PLAIN,EXTERNAL");
+	test_irc_parse_assert_sent(test, NULL);
+	g_assert_nonnull(test->irc->cap_ls);
+
+	test_irc_parse_feed(test, ":irc.example.net CAP * LS "
+	                          ":server-time=strict message-tags away-notify");
+	test_irc_parse_assert_sent(test,
+		"CAP REQ :batch server-time message-tags", NULL);
+	g_assert_null(test->irc->cap_ls);
+
+	/* nothing wanted goes straight to the end */
+	test_irc_parse_feed(test, ":irc.example.net CAP me LS :away-notify");
+	test_irc_parse_assert_sent(test, "CAP END", NULL);
+}
+
+static void
+test_irc_parse_cap_ack(TestIrcParseConn *test, gconstpointer data) {
+	test_irc_parse_feed(test, ":irc.example.net CAP me ACK "
+	                          ":batch server-time");
+	test_irc_parse_assert_sent(test, "CAP END", NULL);
+	g_assert_true(g_hash_table_contains(test->irc->caps, "batch"));
+	g_assert_true(g_hash_table_contains(test->irc->caps, "server-time"));
+	g_assert_false(g_hash_table_contains(test->irc->caps, "message-tags"));
+
+	/* a '-' takes one away again */
+	test_irc_parse_feed(test, ":irc.example.net CAP me ACK :-batch");
+	test_irc_parse_assert_sent(test, "CAP END", NULL);
+	g_assert_false(g_hash_table_contains(test->irc->caps, "batch"));
+	g_assert_true(g_hash_table_contains(test->irc->caps, "server-time"));
+}
+
+static void
+test_irc_parse_cap_nak(TestIrcParseConn *test, gconstpointer data) {
+	test_irc_parse_feed(test, ":irc.example.net CAP me NAK "
+	                          ":batch server-time");
+	test_irc_parse_assert_sent(test, "CAP END", NULL);
+	g_assert_cmpuint(g_hash_table_size(test->irc->caps), ==, 0);
+}
+
+static void
+test_irc_parse_monitor(TestIrcParseConn *test, gconstpointer data) {
+	struct irc_buddy *romeo, *mercutio;
+
+	test_irc_parse_feed(test, ":irc.example.net 005 me MONITOR "
+	                          ":are supported by this server");
+	g_assert_true(test->irc->monitor);
+	g_assert_cmpuint(test->irc->monitor_max, ==, 0);
+
+	romeo = test_irc_parse_add_buddy(test, "romeo");
+	irc_buddy_monitor(test->irc);
+	test_irc_parse_assert_sent(test, "MONITOR + romeo", NULL);
+	mercutio = test_irc_parse_add_buddy(test, "mercutio");
+	irc_buddy_monitor(test->irc);
+	test_irc_parse_assert_sent(test, "MONITOR + mercutio", NULL);
+	g_assert_cmpuint(test->irc->monitor_count, ==, 2);
+
+	test_irc_parse_feed(test, ":irc.example.net 730 me "
+	                          ":romeo!romeo@verona,tybalt!tybalt@verona");
+	g_assert_true(romeo->online);
+	g_assert_false(mercutio->online);
+
+	test_irc_parse_feed(test, ":irc.example.net 731 me :romeo");
+	g_assert_false(romeo->online);
+	test_irc_parse_assert_sent(test, NULL);
+
+	irc_buddy_remove(test->irc, "romeo");
+	test_irc_parse_assert_sent(test, "MONITOR - romeo", NULL);
+	g_assert_cmpuint(test->irc->monitor_count, ==, 1);
+	g_assert_null(g_hash_table_lookup(test->irc->buddies, "romeo"));
+}
+
+/* Whoever doesn't fit on the list is left out of it, until a monitored
+ * buddy is removed and makes room. */
+static void
+test_irc_parse_monitor_full(TestIrcParseConn *test, gconstpointer data) {
+	struct irc_buddy *mercutio, *tybalt;
+
+	test_irc_parse_feed(test, ":irc.example.net 005 me MONITOR=2 "
+	                          ":are supported by this server");
+	g_assert_cmpuint(test->irc->monitor_max, ==, 2);
+
+	test_irc_parse_add_buddy(test, "romeo");
+	irc_buddy_monitor(test->irc);
+	mercutio = test_irc_parse_add_buddy(test, "mercutio");
+	irc_buddy_monitor(test->irc);
+	tybalt = test_irc_parse_add_buddy(test, "tybalt");
+	irc_buddy_monitor(test->irc);
+	test_irc_parse_assert_sent(test, "MONITOR + romeo", "MONITOR + mercutio",
+	                           NULL);
+	g_assert_false(tybalt->monitored);
+
+	/* the server has less room than it said */
+	test_irc_parse_feed(test, ":irc.example.net 734 me 1 mercutio "
+	                          ":Monitor list is full.");
+	g_assert_cmpuint(test->irc->monitor_max, ==, 1);
+	g_assert_cmpuint(test->irc->monitor_count, ==, 1);
+	g_assert_false(mercutio->monitored);
+
+	/* there is room for one of the others now */
+	irc_buddy_remove(test->irc, "romeo");
+	g_assert_cmpuint(test->sent->len, ==, 2);
+	g_assert_cmpstr(g_ptr_array_index(test->sent, 0), ==, "MONITOR - romeo");
+	if (mercutio->monitored) {
+		g_assert_false(tybalt->monitored);
+		g_assert_cmpstr(g_ptr_array_index(test->sent, 1), ==,
+		                "MONITOR + mercutio");
+	} else {
+		g_assert_true(tybalt->monitored);
+		g_assert_cmpstr(g_ptr_array_index(test->sent, 1), ==,
+		                "MONITOR + tybalt");
+	}
+	g_assert_cmpuint(test->irc->monitor_count, ==, 1);
+}
+
+/******************************************************************************
+ * Benchmarks
+ *****************************************************************************/
+static gchar *
+test_irc_parse_build_log(void) {
+	GString *log = g_string_new(NULL);
+	gint i;
+
+	for (i = 0; i < TEST_IRC_PARSE_PERF_LINES; i++) {
+		switch (i % 10) {
+		case 0:
+			g_string_append_printf(log,
+				":user%d!~user%d@host-%d.example.net JOIN :#busy\n",
+				i % 500, i % 500, i);
+			break;
+		case 1:
+			g_string_append_printf(log,
+				":user%d!~user%d@host-%d.example.net PART #busy :Leaving.\n",
+				i % 500, i % 500, i);
+			break;
+		case 2:
+			g_string_append_printf(log,
+				":irc.example.net 353 me = #busy :@op%d +voice%d user%d user%d user%d\n",
+				i, i, i, i + 1, i + 2);
+			break;
+		case 3:
+			g_string_append_printf(log,
+				":user%d!~user%d@host.example.net QUIT :Ping timeout: 240 seconds\n",
+				i % 500, i % 500);
+			break;
+		default:
+			g_string_append_printf(log,
+				":user%d!~user%d@host.example.net PRIVMSG #busy :"
+				"message %d with some typical chatter in it\n",
+				i % 500, i % 500, i);
+			break;
+		}
+	}
+
+	return g_string_free(log, FALSE);
+}
+
+/* Replays the log through irc_parse_msg(), so the time covers everything a
+ * line goes through: the prefix, the command lookup, the lazy conversion of
+ * its arguments and its handler, which updates #busy. */
+static void
+test_irc_parse_perf_replay(void) {
+	TestIrcParseConn test;
+	gchar *log, *line, *end;
+	gint lines = 0;
+	gdouble elapsed;
+
+	test_irc_parse_conn_setup(&test, NULL);
+
+	log = test_irc_parse_build_log();
+
+	g_test_timer_start();
+	for (line = log; (end = strchr(line, '\n')) != NULL; line = end + 1) {
+		*end = '\0';
+		irc_parse_msg(test.irc, line);
+		lines++;
+	}
+	elapsed = g_test_timer_elapsed();
+
+	/* every PRIVMSG made it to the channel */
+	g_assert_cmpint(lines, ==, TEST_IRC_PARSE_PERF_LINES);
+	g_assert_cmpint(test.received, ==, TEST_IRC_PARSE_PERF_LINES / 10 * 6);
+	g_test_minimized_result(elapsed, "replayed %d lines: %.3fs (%.0f lines/s)",
+	                        TEST_IRC_PARSE_PERF_LINES, elapsed,
+	                        TEST_IRC_PARSE_PERF_LINES / elapsed);
+
+	g_free(log);
+	test_irc_parse_conn_teardown(&test, NULL);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/irc/parse/lookup",
+	                test_irc_parse_lookup);
+	g_test_add_func("/irc/parse/args",
+	                test_irc_parse_args);
+	g_test_add_func("/irc/parse/args/short",
+	                test_irc_parse_args_short);
+	g_test_add_func("/irc/parse/args/trailing",
+	                test_irc_parse_args_trailing);
+	g_test_add_func("/irc/parse/args/invalid",
+	                test_irc_parse_args_invalid);
+	g_test_add_func("/irc/parse/batch/nested",
+	                test_irc_parse_batch_nested);
+
+	g_test_add("/irc/parse/cap/ls", TestIrcParseConn, NULL,
+	           test_irc_parse_conn_setup, test_irc_parse_cap_ls,
+	           test_irc_parse_conn_teardown);
+	g_test_add("/irc/parse/cap/ack", TestIrcParseConn, NULL,
+	           test_irc_parse_conn_setup, test_irc_parse_cap_ack,
+	           test_irc_parse_conn_teardown);
+	g_test_add("/irc/parse/cap/nak", TestIrcParseConn, NULL,
+	           test_irc_parse_conn_setup, test_irc_parse_cap_nak,
+	           test_irc_parse_conn_teardown);
+	g_test_add("/irc/parse/monitor", TestIrcParseConn, NULL,
+	           test_irc_parse_conn_setup, test_irc_parse_monitor,
+	           test_irc_parse_conn_teardown);
+	g_test_add("/irc/parse/monitor/full", TestIrcParseConn, NULL,
+	           test_irc_parse_conn_setup, test_irc_parse_monitor_full,
+	           test_irc_parse_conn_teardown);
+
+	if (g_test_perf()) {
+		g_test_add_func("/irc/parse/perf/replay",
+		                test_irc_parse_perf_replay);
+	}
+
+	return g_test_run();
+}
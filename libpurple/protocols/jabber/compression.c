@@ -0,0 +1,268 @@
+/*
+ * purple - Jabber Protocol Plugin
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ *
+ */
+
+#include "internal.h"
+
+#include <zlib.h>
+
+#include "debug.h"
+#include "util.h"
+
+#include "compression.h"
+#include "namespaces.h"
+
+#define JABBER_COMPRESSION_CHUNK 4096
+
+struct _JabberCompression {
+	z_stream deflater;
+	z_stream inflater;
+
+	/* deflated data waiting for the next flush */
+	GByteArray *output;
+	gboolean pending;
+
+	/* the last inflated data */
+	GString *input;
+
+	guint64 raw_out;
+	guint64 compressed_out;
+	guint64 raw_in;
+	guint64 compressed_in;
+};
+
+gboolean
+jabber_compression_is_offered(PurpleXmlNode *features)
+{
+	PurpleXmlNode *compression, *method;
+
+	compression = purple_xmlnode_get_child_with_namespace(features,
+			"compression", NS_COMPRESS_FEATURE);
+	if (compression == NULL)
+		return FALSE;
+
+	for (method = purple_xmlnode_get_child(compression, "method"); method;
+			method = purple_xmlnode_get_next_twin(method)) {
+		char *name = purple_xmlnode_get_data(method);
+		gboolean zlib = purple_strequal(name, "zlib");
+
+		g_free(name);
+		if (zlib)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+PurpleXmlNode *
+jabber_compression_new_request(void)
+{
+	PurpleXmlNode *compress, *method;
+
+	compress = purple_xmlnode_new("compress");
+	purple_xmlnode_set_namespace(compress, NS_COMPRESS_PROTOCOL);
+	method = purple_xmlnode_new_child(compress, "method");
+	purple_xmlnode_insert_data(method, "zlib", -1);
+
+	return compress;
+}
+
+JabberCompression *
+jabber_compression_new(void)
+{
+	JabberCompression *compression = g_new0(JabberCompression, 1);
+
+	if (deflateInit(&compression->deflater, Z_DEFAULT_COMPRESSION) != Z_OK) {
+		purple_debug_error("jabber", "Unable to initialize deflate: %s\n",
+				compression->deflater.msg ? compression->deflater.msg : "");
+		g_free(compression);
+		return NULL;
+	}
+
+	if (inflateInit(&compression->inflater) != Z_OK) {
+		purple_debug_error("jabber", "Unable to initialize inflate: %s\n",
+				compression->inflater.msg ? compression->inflater.msg : "");
+		deflateEnd(&compression->deflater);
+		g_free(compression);
+		return NULL;
+	}
+
+	compression->output = g_byte_array_new();
+	compression->input = g_string_new(NULL);
+
+	return compression;
+}
+
+void
+jabber_compression_free(JabberCompression *compression)
+{
+	if (compression == NULL)
+		return;
+
+	deflateEnd(&compression->deflater);
+	inflateEnd(&compression->inflater);
+	g_byte_array_free(compression->output, TRUE);
+	g_string_free(compression->input, TRUE);
+	g_free(compression);
+}
+
+/* Runs deflate until it has consumed its input and, for a flush, produced
+ * all of its output. */
+static gboolean
+jabber_compression_run_deflate(JabberCompression *compression, int flush)
+{
+	z_stream *zs = &compression->deflater;
+	int ret;
+
+	do {
+		guint len = compression->output->len;
+
+		g_byte_array_set_size(compression->output,
+				len + JABBER_COMPRESSION_CHUNK);
+		zs->next_out = compression->output->data + len;
+		zs->avail_out = JABBER_COMPRESSION_CHUNK;
+
+		ret = deflate(zs, flush);
+
+		g_byte_array_set_size(compression->output,
+				len + JABBER_COMPRESSION_CHUNK - zs->avail_out);
+
+		/* Z_BUF_ERROR only means there was nothing left to do */
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			purple_debug_error("jabber", "deflate failed: %s\n",
+					zs->msg ? zs->msg : "");
+			return FALSE;
+		}
+	} while (zs->avail_out == 0);
+
+	return TRUE;
+}
+
+gboolean
+jabber_compression_deflate(JabberCompression *compression,
+		const void *data, gsize len)
+{
+	g_return_val_if_fail(compression != NULL, FALSE);
+	g_return_val_if_fail(len <= G_MAXUINT, FALSE);
+
+	if (len == 0)
+		return TRUE;
+
+	compression->deflater.next_in = (Bytef *)data;
+	compression->deflater.avail_in = len;
+	compression->raw_out += len;
+	compression->pending = TRUE;
+
+	return jabber_compression_run_deflate(compression, Z_NO_FLUSH);
+}
+
+gboolean
+jabber_compression_flush(JabberCompression *compression, GBytes **bytes)
+{
+	g_return_val_if_fail(compression != NULL, FALSE);
+	g_return_val_if_fail(bytes != NULL, FALSE);
+
+	*bytes = NULL;
+	if (!compression->pending)
+		return TRUE;
+
+	compression->deflater.next_in = NULL;
+	compression->deflater.avail_in = 0;
+	if (!jabber_compression_run_deflate(compression, Z_SYNC_FLUSH))
+		return FALSE;
+
+	compression->compressed_out += compression->output->len;
+	compression->pending = FALSE;
+
+	*bytes = g_byte_array_free_to_bytes(compression->output);
+	compression->output = g_byte_array_new();
+
+	return TRUE;
+}
+
+const char *
+jabber_compression_inflate(JabberCompression *compression,
+		const void *data, gsize len, gsize *out_len)
+{
+	z_stream *zs;
+	int ret;
+
+	g_return_val_if_fail(compression != NULL, NULL);
+	g_return_val_if_fail(len <= G_MAXUINT, NULL);
+
+	zs = &compression->inflater;
+	zs->next_in = (Bytef *)data;
+	zs->avail_in = len;
+	compression->compressed_in += len;
+
+	g_string_truncate(compression->input, 0);
+
+	do {
+		gsize pos = compression->input->len;
+
+		g_string_set_size(compression->input,
+				pos + JABBER_COMPRESSION_CHUNK);
+		zs->next_out = (Bytef *)compression->input->str + pos;
+		zs->avail_out = JABBER_COMPRESSION_CHUNK;
+
+		ret = inflate(zs, Z_SYNC_FLUSH);
+
+		g_string_set_size(compression->input,
+				pos + JABBER_COMPRESSION_CHUNK - zs->avail_out);
+
+		if (ret == Z_STREAM_END || ret == Z_BUF_ERROR)
+			break;
+		if (ret != Z_OK) {
+			purple_debug_error("jabber", "inflate failed: %s\n",
+					zs->msg ? zs->msg : "");
+			return NULL;
+		}
+	} while (zs->avail_in > 0 || zs->avail_out == 0);
+
+	if (ret == Z_STREAM_END && zs->avail_in > 0) {
+		purple_debug_error("jabber", "Data after the end of the "
+				"compressed stream\n");
+		return NULL;
+	}
+
+	compression->raw_in += compression->input->len;
+
+	if (out_len)
+		*out_len = compression->input->len;
+
+	return compression->input->str;
+}
+
+double
+jabber_compression_get_ratio(JabberCompression *compression)
+{
+	guint64 raw;
+
+	g_return_val_if_fail(compression != NULL, 1.0);
+
+	raw = compression->raw_out + compression->raw_in;
+	if (raw == 0)
+		return 1.0;
+
+	return (double)(compression->compressed_out +
+			compression->compressed_in) / raw;
+}
@@ -0,0 +1,70 @@
+/**
+ * @file compression.h XEP-0138 Stream Compression
+ *
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+#ifndef PURPLE_JABBER_COMPRESSION_H_
+#define PURPLE_JABBER_COMPRESSION_H_
+
+#include <glib.h>
+
+#include "xmlnode.h"
+
+/*
+ * The zlib streams of a compressed connection.  Outgoing data is deflated
+ * as it is sent and only leaves in a sync flush, so a whole batch of
+ * stanzas shares one flush; incoming data is inflated as it is read.
+ */
+typedef struct _JabberCompression JabberCompression;
+
+/* Whether the stream features offer the zlib method. */
+gboolean jabber_compression_is_offered(PurpleXmlNode *features);
+
+/* Creates the <compress/> request for the zlib method. */
+PurpleXmlNode *jabber_compression_new_request(void);
+
+/* Returns NULL if zlib could not be initialized. */
+JabberCompression *jabber_compression_new(void);
+void jabber_compression_free(JabberCompression *compression);
+
+/* Deflates outgoing data into the pending output. */
+gboolean jabber_compression_deflate(JabberCompression *compression,
+		const void *data, gsize len);
+
+/*
+ * Sync-flushes the pending output.  *bytes is set to the compressed data to
+ * write, or NULL if nothing was deflated since the last flush.
+ */
+gboolean jabber_compression_flush(JabberCompression *compression,
+		GBytes **bytes);
+
+/*
+ * Inflates incoming data.  The returned buffer is nul-terminated, owned by
+ * compression and valid until the next call.  Returns NULL on error.
+ */
+const char *jabber_compression_inflate(JabberCompression *compression,
+		const void *data, gsize len, gsize *out_len);
+
+/* The compressed size of everything sent and received, relative to the
+ * uncompressed size. */
+double jabber_compression_get_ratio(JabberCompression *compression);
+
+#endif /* PURPLE_JABBER_COMPRESSION_H_ */
@@ -485,6 +485,44 @@ void jabber_iq_parse(JabberStream *js, PurpleXmlNode *packet)
 	jabber_id_free(from_id);
 }
 
+gboolean jabber_iq_has_callback(JabberStream *js, const char *id,
+                                const char *from, JabberIqCallback *callback)
+{
+	JabberIqCallbackData *jcd;
+	JabberID *from_id;
+	gboolean ret;
+
+	g_return_val_if_fail(id != NULL, FALSE);
+
+	jcd = g_hash_table_lookup(js->iq_callbacks, id);
+	if (jcd == NULL || jcd->callback != callback)
+		return FALSE;
+
+	from_id = jabber_id_new(from);
+	if (from && !from_id)
+		return FALSE;
+
+	ret = does_reply_from_match_request_to(js, jcd->to, from_id);
+	jabber_id_free(from_id);
+
+	return ret;
+}
+
+gboolean jabber_iq_is_watched(const char *node, const char *xmlns)
+{
+	gchar *key;
+	gboolean ret;
+
+	if (node == NULL || xmlns == NULL)
+		return FALSE;
+
+	key = g_strdup_printf("%s %s", node, xmlns);
+	ret = g_hash_table_lookup(signal_iq_handlers, key) != NULL;
+	g_free(key);
+
+	return ret;
+}
+
 void jabber_iq_register_handler(const char *node, const char *xmlns, JabberIqHandler *handlerfunc)
 {
 	/*
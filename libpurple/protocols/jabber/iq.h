@@ -111,6 +111,17 @@ void jabber_iq_uninit(void);
 void jabber_iq_register_handler(const char *node, const char *xmlns,
                                 JabberIqHandler *func);
 
+/**
+ * Checks whether a callback is waiting for the result of an IQ with the
+ * given id, and whether @from is allowed to reply to it.
+ */
+gboolean jabber_iq_has_callback(JabberStream *js, const char *id,
+                                const char *from, JabberIqCallback *callback);
+
+/* Checks whether anyone is connected to the jabber-watched-iq signal for
+ * a child element and namespace. */
+gboolean jabber_iq_is_watched(const char *node, const char *xmlns);
+
 /* Connected to namespace-handler registration signals */
 void jabber_iq_signal_register(const gchar *node, const gchar *xmlns);
 void jabber_iq_signal_unregister(const gchar *node, const gchar *xmlns);
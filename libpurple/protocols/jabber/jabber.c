@@ -22,6 +22,10 @@
  */
 #include "internal.h"
 
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
 #include "account.h"
 #include "accountopt.h"
 #include "buddylist.h"
@@ -78,6 +82,14 @@
 #include "jingle/session.h"
 
 #define PING_TIMEOUT 60
+
+/* Queued data is gathered into writes of up to this size, which is also
+ * the largest TLS record, and at most this many chunks. */
+#define JABBER_MAX_WRITE_SIZE 16384
+#define JABBER_MAX_WRITE_CHUNKS 64
+
+/* How long to try resuming a session before giving up on it, in seconds */
+#define JABBER_SM_RESUME_TIMEOUT 60
 /* Send a whitespace keepalive to the server if we haven't sent
  * anything in the last 120 seconds
  */
@@ -181,6 +193,9 @@ static void jabber_bind_result_cb(JabberStream *js, const char *from,
 		return;
 	}
 
+	if ((js->server_caps & JABBER_CAP_STREAM_MANAGEMENT) && !js->bosh)
+		jabber_sm_enable(js);
+
 	jabber_session_init(js);
 }
 
@@ -266,6 +281,78 @@ jabber_process_starttls(JabberStream *js, PurpleXmlNode *packet)
 #endif
 }
 
+static void jabber_stream_bind(JabberStream *js)
+{
+	PurpleXmlNode *bind, *resource;
+	char *requested_resource;
+	JabberIq *iq = jabber_iq_new(js, JABBER_IQ_SET);
+	bind = purple_xmlnode_new_child(iq->node, "bind");
+	purple_xmlnode_set_namespace(bind, NS_XMPP_BIND);
+	requested_resource = jabber_prep_resource(js->user->resource);
+
+	if (requested_resource != NULL) {
+		resource = purple_xmlnode_new_child(bind, "resource");
+		purple_xmlnode_insert_data(resource, requested_resource, -1);
+		g_free(requested_resource);
+	}
+
+	jabber_iq_set_callback(iq, jabber_bind_result_cb, NULL);
+
+	jabber_iq_send(iq);
+}
+
+/* Asks for XEP-0138 zlib compression if the server offers it and we haven't
+ * asked before.  Compression sits beneath the XML stream, so it is not
+ * stacked on a SASL security layer and never used over BOSH.  Compressing
+ * beneath TLS can leak the contents of the stream (CRIME), so it is off
+ * unless the user turns it on. */
+static gboolean
+jabber_stream_request_compression(JabberStream *js, PurpleXmlNode *packet)
+{
+	PurpleAccount *account = purple_connection_get_account(js->gc);
+	PurpleXmlNode *compress;
+
+	if (js->compression_requested || js->bosh ||
+			!purple_account_get_bool(account, "compression", FALSE) ||
+			!jabber_compression_is_offered(packet))
+		return FALSE;
+#ifdef HAVE_CYRUS_SASL
+	if (js->sasl_maxbuf > 0)
+		return FALSE;
+#endif
+
+	js->compression_requested = TRUE;
+	compress = jabber_compression_new_request();
+	jabber_send(js, compress);
+	purple_xmlnode_free(compress);
+
+	return TRUE;
+}
+
+static void jabber_stream_handle_compression(JabberStream *js,
+		PurpleXmlNode *packet)
+{
+	if (!js->compression_requested || js->compression) {
+		purple_debug_warning("jabber", "Ignoring spurious %s\n",
+				packet->name);
+	} else if (g_str_equal(packet->name, "compressed")) {
+		js->compression = jabber_compression_new();
+		if (js->compression == NULL) {
+			purple_connection_error(js->gc,
+				PURPLE_CONNECTION_ERROR_OTHER_ERROR,
+				_("Unable to initialize stream compression"));
+			return;
+		}
+		/* Everything from here on, starting with the new stream
+		 * header, is compressed. */
+		js->reinit = TRUE;
+	} else if (g_str_equal(packet->name, "failure")) {
+		purple_debug_info("jabber",
+				"Server refused stream compression\n");
+		jabber_stream_bind(js);
+	}
+}
+
 void jabber_stream_features_parse(JabberStream *js, PurpleXmlNode *packet)
 {
 	PurpleAccount *account = purple_connection_get_account(js->gc);
@@ -284,28 +371,28 @@ void jabber_stream_features_parse(JabberStream *js, PurpleXmlNode *packet)
 		return;
 	}
 
+	if (jabber_sm_is_offered(packet))
+		js->server_caps |= JABBER_CAP_STREAM_MANAGEMENT;
+
 	if(js->registration) {
 		jabber_register_start(js);
 	} else if(purple_xmlnode_get_child(packet, "mechanisms")) {
 		jabber_stream_set_state(js, JABBER_STREAM_AUTHENTICATING);
 		jabber_auth_start(js, packet);
-	} else if(purple_xmlnode_get_child(packet, "bind")) {
-		PurpleXmlNode *bind, *resource;
-		char *requested_resource;
-		JabberIq *iq = jabber_iq_new(js, JABBER_IQ_SET);
-		bind = purple_xmlnode_new_child(iq->node, "bind");
-		purple_xmlnode_set_namespace(bind, NS_XMPP_BIND);
-		requested_resource = jabber_prep_resource(js->user->resource);
-
-		if (requested_resource != NULL) {
-			resource = purple_xmlnode_new_child(bind, "resource");
-			purple_xmlnode_insert_data(resource, requested_resource, -1);
-			g_free(requested_resource);
+	} else if (jabber_stream_request_compression(js, packet)) {
+		/* The stream restarts once the server answers */
+	} else if (js->sm && js->sm->resuming) {
+		if (jabber_sm_is_offered(packet)) {
+			PurpleXmlNode *resume = jabber_sm_new_resume(js->sm);
+			jabber_send(js, resume);
+			purple_xmlnode_free(resume);
+		} else {
+			purple_connection_error(js->gc,
+				PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+				_("Unable to resume the session"));
 		}
-
-		jabber_iq_set_callback(iq, jabber_bind_result_cb, NULL);
-
-		jabber_iq_send(iq);
+	} else if(purple_xmlnode_get_child(packet, "bind")) {
+		jabber_stream_bind(js);
 	} else if (purple_xmlnode_get_child_with_namespace(packet, "ver", NS_ROSTER_VERSIONING)) {
 		js->server_caps |= JABBER_CAP_ROSTER_VERSIONING;
 	} else /* if(purple_xmlnode_get_child_with_namespace(packet, "auth")) */ {
@@ -374,102 +461,228 @@ void jabber_process_packet(JabberStream *js, PurpleXmlNode **packet)
 				tls_init(js);
 			/* TODO: Handle <failure/>, I guess? */
 		}
+	} else if (purple_strequal(xmlns, NS_COMPRESS_PROTOCOL)) {
+		jabber_stream_handle_compression(js, *packet);
+	} else if (purple_strequal(xmlns, NS_STREAM_MANAGEMENT)) {
+		jabber_sm_parse(js, *packet);
 	} else {
 		purple_debug_warning("jabber", "Unknown packet: %s\n", (*packet)->name);
 	}
 }
 
-static int jabber_do_send(JabberStream *js, const char *data, int len)
+static void jabber_stream_connection_lost(JabberStream *js, const char *msg);
+
+static void jabber_stream_write_error(JabberStream *js)
 {
-	int ret;
+	int err = errno;
+	PurpleAccount *account = purple_connection_get_account(js->gc);
 
-	if (js->gsc)
-		ret = purple_ssl_write(js->gsc, data, len);
-	else
-		ret = write(js->fd, data, len);
+	/*
+	 * The server may have closed the socket (on a stream error), so if
+	 * we're disconnecting, don't generate (possibly another) error that
+	 * (for some UIs) would mask the first.
+	 */
+	if (!purple_account_is_disconnecting(account)) {
+		gchar *tmp = g_strdup_printf(_("Lost connection with server: %s"),
+				g_strerror(err));
+		jabber_stream_connection_lost(js, tmp);
+		g_free(tmp);
+	}
+}
 
-	return ret;
+/* Merges the first chunks of the write queue into one, so they go out
+ * together where the output can't be gathered. */
+static void jabber_stream_coalesce(JabberStream *js)
+{
+	GByteArray *buf;
+	GBytes *bytes;
+	GList *next = js->write_queue.head->next;
+
+	if (next == NULL || g_bytes_get_size(js->write_queue.head->data) -
+			js->write_offset + g_bytes_get_size(next->data) > JABBER_MAX_WRITE_SIZE)
+		return;
+
+	buf = g_byte_array_new();
+	while ((bytes = g_queue_peek_head(&js->write_queue)) != NULL) {
+		gsize size;
+		const guint8 *data = g_bytes_get_data(bytes, &size);
+
+		if (buf->len > 0 && buf->len + size > JABBER_MAX_WRITE_SIZE)
+			break;
+
+		g_byte_array_append(buf, data + js->write_offset, size - js->write_offset);
+		js->write_offset = 0;
+		g_bytes_unref(g_queue_pop_head(&js->write_queue));
+	}
+	g_queue_push_head(&js->write_queue, g_byte_array_free_to_bytes(buf));
 }
 
-static void jabber_send_cb(gpointer data, gint source, PurpleInputCondition cond)
+/* Writes as much of the write queue as the socket takes. Returns FALSE if
+ * the connection was lost. */
+static gboolean jabber_stream_flush(JabberStream *js)
 {
-	JabberStream *js = data;
-	const gchar *output = NULL;
-	int ret, writelen;
+	while (!g_queue_is_empty(&js->write_queue)) {
+		gssize ret, left;
+		gsize total = 0;
 
-	writelen = purple_circular_buffer_get_max_read(js->write_buffer);
-	output = purple_circular_buffer_get_output(js->write_buffer);
+		if (js->gsc == NULL && js->fd < 0)
+			return TRUE;
 
-	if (writelen == 0) {
-		purple_input_remove(js->writeh);
-		js->writeh = 0;
-		return;
+#ifndef _WIN32
+		if (js->gsc == NULL) {
+			struct iovec iov[JABBER_MAX_WRITE_CHUNKS];
+			GList *l;
+			int chunks = 0;
+
+			for (l = js->write_queue.head; l && chunks < JABBER_MAX_WRITE_CHUNKS; l = l->next) {
+				gsize size;
+				const guint8 *data = g_bytes_get_data(l->data, &size);
+				gsize offset = (chunks == 0) ? js->write_offset : 0;
+
+				iov[chunks].iov_base = (void *)(data + offset);
+				iov[chunks].iov_len = size - offset;
+				total += size - offset;
+				chunks++;
+			}
+
+			ret = writev(js->fd, iov, chunks);
+		} else
+#endif
+		{
+			gsize size;
+			const guint8 *data;
+
+			jabber_stream_coalesce(js);
+			data = g_bytes_get_data(g_queue_peek_head(&js->write_queue), &size);
+			total = size - js->write_offset;
+
+			if (js->gsc)
+				ret = (gssize)purple_ssl_write(js->gsc, data + js->write_offset, total);
+			else
+				ret = write(js->fd, data + js->write_offset, total);
+		}
+
+		if (ret < 0 && errno == EAGAIN)
+			return TRUE;
+		else if (ret <= 0) {
+			jabber_stream_write_error(js);
+			return FALSE;
+		}
+
+		js->bytes_written += ret;
+		js->write_count++;
+
+		/* Drop what was written. */
+		for (left = ret; left > 0; ) {
+			GBytes *bytes = g_queue_peek_head(&js->write_queue);
+			gsize size = g_bytes_get_size(bytes) - js->write_offset;
+
+			if ((gsize)left < size) {
+				js->write_offset += left;
+				break;
+			}
+
+			left -= size;
+			js->write_offset = 0;
+			g_bytes_unref(g_queue_pop_head(&js->write_queue));
+		}
+
+		/* The socket is full. */
+		if ((gsize)ret < total)
+			return TRUE;
 	}
 
-	ret = jabber_do_send(js, output, writelen);
+	return TRUE;
+}
+
+/* Queues what has been deflated since the last flush, so a whole batch
+ * of stanzas shares one sync flush. */
+static gboolean jabber_stream_flush_compression(JabberStream *js)
+{
+	GBytes *bytes;
 
-	if (ret < 0 && errno == EAGAIN)
-		return;
-	else if (ret <= 0) {
-		gchar *tmp = g_strdup_printf(_("Lost connection with server: %s"),
-				g_strerror(errno));
+	if (js->compression == NULL)
+		return TRUE;
+
+	if (!jabber_compression_flush(js->compression, &bytes)) {
 		purple_connection_error(js->gc,
-			PURPLE_CONNECTION_ERROR_NETWORK_ERROR, tmp);
-		g_free(tmp);
+			PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+			_("Stream compression error"));
+		return FALSE;
+	}
+
+	if (bytes != NULL)
+		g_queue_push_tail(&js->write_queue, bytes);
+
+	return TRUE;
+}
+
+static void jabber_send_cb(gpointer data, gint source, PurpleInputCondition cond);
+
+/* Writes what the socket takes now, and waits for it to take the rest. */
+static void jabber_stream_write_pending(JabberStream *js)
+{
+	if (!jabber_stream_flush_compression(js) || !jabber_stream_flush(js))
 		return;
+
+	if (g_queue_is_empty(&js->write_queue)) {
+		if (js->writeh) {
+			purple_input_remove(js->writeh);
+			js->writeh = 0;
+		}
+	} else if (js->writeh == 0 && (js->gsc || js->fd >= 0)) {
+		js->writeh = purple_input_add(
+			js->gsc ? js->gsc->fd : js->fd,
+			PURPLE_INPUT_WRITE, jabber_send_cb, js);
 	}
+}
 
-	purple_circular_buffer_mark_read(js->write_buffer, ret);
+static void jabber_send_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	jabber_stream_write_pending(data);
 }
 
-static gboolean do_jabber_send_raw(JabberStream *js, const char *data, int len)
+static gboolean jabber_write_timer_cb(gpointer data)
 {
-	int ret;
-	gboolean success = TRUE;
+	JabberStream *js = data;
 
-	g_return_val_if_fail(len > 0, FALSE);
+	js->write_timer = 0;
+	jabber_stream_write_pending(js);
+
+	return FALSE;
+}
+
+static void do_jabber_send_raw(JabberStream *js, GBytes *bytes)
+{
+	g_return_if_fail(g_bytes_get_size(bytes) > 0);
 
 	if (js->state == JABBER_STREAM_CONNECTED)
 		jabber_stream_restart_inactivity_timer(js);
 
-	if (js->writeh == 0)
-		ret = jabber_do_send(js, data, len);
-	else {
-		ret = -1;
-		errno = EAGAIN;
-	}
+	if (js->compression) {
+		gsize size;
+		gconstpointer data = g_bytes_get_data(bytes, &size);
 
-	if (ret < 0 && errno != EAGAIN) {
-		PurpleAccount *account = purple_connection_get_account(js->gc);
-		/*
-		 * The server may have closed the socket (on a stream error), so if
-		 * we're disconnecting, don't generate (possibly another) error that
-		 * (for some UIs) would mask the first.
-		 */
-		if (!purple_account_is_disconnecting(account)) {
-			gchar *tmp = g_strdup_printf(_("Lost connection with server: %s"),
-					g_strerror(errno));
+		if (!jabber_compression_deflate(js->compression, data, size)) {
 			purple_connection_error(js->gc,
-				PURPLE_CONNECTION_ERROR_NETWORK_ERROR, tmp);
-			g_free(tmp);
+				PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+				_("Stream compression error"));
+			return;
 		}
-
-		success = FALSE;
-	} else if (ret < len) {
-		if (ret < 0)
-			ret = 0;
-		if (js->writeh == 0)
-			js->writeh = purple_input_add(
-				js->gsc ? js->gsc->fd : js->fd,
-				PURPLE_INPUT_WRITE, jabber_send_cb, js);
-		purple_circular_buffer_append(js->write_buffer,
-			data + ret, len - ret);
-	}
-
-	return success;
+	} else
+		g_queue_push_tail(&js->write_queue, g_bytes_ref(bytes));
+	js->chunks_queued++;
+
+	/* Everything sent until the main loop runs again goes out in one write,
+	 * unless we're already waiting for the socket. */
+	if (js->write_timer == 0 && js->writeh == 0)
+		js->write_timer = purple_timeout_add(0, jabber_write_timer_cb, js);
 }
 
-void jabber_send_raw(JabberStream *js, const char *data, int len)
+/* Sends data, keeping a reference to bytes instead of copying data if it is
+ * the contents of bytes. */
+static void jabber_send_raw_bytes(JabberStream *js, const char *data, int len,
+		GBytes *bytes)
 {
 	PurpleConnection *gc;
 	PurpleAccount *account;
@@ -540,6 +753,7 @@ void jabber_send_raw(JabberStream *js, const char *data, int len)
 			const char *out;
 			unsigned olen;
 			int rc;
+			GBytes *encoded;
 
 			towrite = MIN((len - pos), js->sasl_maxbuf);
 
@@ -560,25 +774,38 @@ void jabber_send_raw(JabberStream *js, const char *data, int len)
 			}
 			pos += towrite;
 
-			/* do_jabber_send_raw returns FALSE when it throws a
-			 * connection error.
-			 */
-			if (!do_jabber_send_raw(js, out, olen))
-				break;
+			encoded = g_bytes_new(out, olen);
+			do_jabber_send_raw(js, encoded);
+			g_bytes_unref(encoded);
 		}
 		return;
 	}
 #endif
 
-	if (js->bosh)
+	if (js->bosh) {
 		jabber_bosh_connection_send(js->bosh, data);
+		return;
+	}
+
+	/* A signal handler may have replaced the data. */
+	if (bytes != NULL && (gconstpointer)data == g_bytes_get_data(bytes, NULL) &&
+			(gsize)len == g_bytes_get_size(bytes))
+		g_bytes_ref(bytes);
 	else
-		do_jabber_send_raw(js, data, len);
+		bytes = g_bytes_new(data, len);
+	do_jabber_send_raw(js, bytes);
+	g_bytes_unref(bytes);
+}
+
+void jabber_send_raw(JabberStream *js, const char *data, int len)
+{
+	jabber_send_raw_bytes(js, data, len, NULL);
 }
 
 int jabber_protocol_send_raw(PurpleConnection *gc, const char *buf, int len)
 {
 	JabberStream *js = purple_connection_get_protocol_data(gc);
+	GBytes *bytes;
 
 	g_return_val_if_fail(js != NULL, -1);
 	/* TODO: It's probably worthwhile to restrict this to when the account
@@ -586,14 +813,23 @@ int jabber_protocol_send_raw(PurpleConnection *gc, const char *buf, int len)
 	 * to do things during the connection process.
 	 */
 
-	jabber_send_raw(js, buf, len);
-	return (len < 0 ? (int)strlen(buf) : len);
+	if (len < 0)
+		len = strlen(buf);
+
+	/* The server counts the stanzas in here like any others. */
+	bytes = g_bytes_new(buf, len);
+	if (jabber_sm_outbound_raw(js, bytes))
+		jabber_send_raw_bytes(js, buf, len, bytes);
+	g_bytes_unref(bytes);
+
+	return len;
 }
 
 void jabber_send_signal_cb(PurpleConnection *pc, PurpleXmlNode **packet,
                            gpointer unused)
 {
 	JabberStream *js;
+	GBytes *bytes;
 	char *txt;
 	int len;
 
@@ -613,8 +849,10 @@ void jabber_send_signal_cb(PurpleConnection *pc, PurpleXmlNode **packet,
 				g_str_equal((*packet)->name, "presence"))
 			purple_xmlnode_set_namespace(*packet, NS_XMPP_CLIENT);
 	txt = purple_xmlnode_to_str(*packet, &len);
-	jabber_send_raw(js, txt, len);
-	g_free(txt);
+	bytes = g_bytes_new_take(txt, len);
+	if (jabber_sm_outbound(js, *packet, bytes))
+		jabber_send_raw_bytes(js, txt, len, bytes);
+	g_bytes_unref(bytes);
 }
 
 void jabber_send(JabberStream *js, PurpleXmlNode *packet)
@@ -625,9 +863,8 @@ void jabber_send(JabberStream *js, PurpleXmlNode *packet)
 static gboolean jabber_keepalive_timeout(PurpleConnection *gc)
 {
 	JabberStream *js = purple_connection_get_protocol_data(gc);
-	purple_connection_error(gc, PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
-					_("Ping timed out"));
 	js->keepalive_timeout = 0;
+	jabber_stream_connection_lost(js, _("Ping timed out"));
 	return FALSE;
 }
 
@@ -645,6 +882,33 @@ void jabber_keepalive(PurpleConnection *gc)
 	}
 }
 
+/* Hands data read from the server to the parser, inflating it first if the
+ * stream is compressed. */
+static void
+jabber_stream_process_input(JabberStream *js, const char *data, gsize len,
+		const char *layer)
+{
+	if (js->compression) {
+		data = jabber_compression_inflate(js->compression, data, len, &len);
+		if (data == NULL) {
+			purple_connection_error(js->gc,
+				PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+				_("Stream compression error"));
+			return;
+		}
+		if (len == 0)
+			return;
+		purple_debug_misc("jabber", "Recv%s(zlib)(%" G_GSIZE_FORMAT "): %s",
+				layer, len, data);
+	} else
+		purple_debug_misc("jabber", "Recv%s(%" G_GSIZE_FORMAT "): %s",
+				layer, len, data);
+
+	jabber_parser_process(js, data, len);
+	if (js->reinit)
+		jabber_stream_init(js);
+}
+
 static void
 jabber_recv_cb_ssl(gpointer data, PurpleSslConnection *gsc,
 		PurpleInputCondition cond)
@@ -658,11 +922,9 @@ jabber_recv_cb_ssl(gpointer data, PurpleSslConnection *gsc,
 
 	while((len = purple_ssl_read(gsc, buf, sizeof(buf) - 1)) > 0) {
 		purple_connection_update_last_received(gc);
+		js->bytes_read += len;
 		buf[len] = '\0';
-		purple_debug_misc("jabber", "Recv (ssl)(%d): %s", len, buf);
-		jabber_parser_process(js, buf, len);
-		if(js->reinit)
-			jabber_stream_init(js);
+		jabber_stream_process_input(js, buf, len, " (ssl)");
 	}
 
 	if(len < 0 && errno == EAGAIN)
@@ -674,8 +936,7 @@ jabber_recv_cb_ssl(gpointer data, PurpleSslConnection *gsc,
 		else
 			tmp = g_strdup_printf(_("Lost connection with server: %s"),
 					g_strerror(errno));
-		purple_connection_error(js->gc,
-			PURPLE_CONNECTION_ERROR_NETWORK_ERROR, tmp);
+		jabber_stream_connection_lost(js, tmp);
 		g_free(tmp);
 	}
 }
@@ -692,6 +953,7 @@ jabber_recv_cb(gpointer data, gint source, PurpleInputCondition condition)
 
 	if((len = read(js->fd, buf, sizeof(buf) - 1)) > 0) {
 		purple_connection_update_last_received(gc);
+		js->bytes_read += len;
 #ifdef HAVE_CYRUS_SASL
 		if (js->sasl_maxbuf > 0) {
 			const char *out;
@@ -719,10 +981,7 @@ jabber_recv_cb(gpointer data, gint source, PurpleInputCondition condition)
 		}
 #endif
 		buf[len] = '\0';
-		purple_debug_misc("jabber", "Recv (%d): %s", len, buf);
-		jabber_parser_process(js, buf, len);
-		if(js->reinit)
-			jabber_stream_init(js);
+		jabber_stream_process_input(js, buf, len, " ");
 	} else if(len < 0 && errno == EAGAIN) {
 		return;
 	} else {
@@ -732,8 +991,7 @@ jabber_recv_cb(gpointer data, gint source, PurpleInputCondition condition)
 		else
 			tmp = g_strdup_printf(_("Lost connection with server: %s"),
 					g_strerror(errno));
-		purple_connection_error(js->gc,
-			PURPLE_CONNECTION_ERROR_NETWORK_ERROR, tmp);
+		jabber_stream_connection_lost(js, tmp);
 		g_free(tmp);
 	}
 }
@@ -871,6 +1129,13 @@ jabber_ssl_connect_failure(PurpleSslConnection *gsc, PurpleSslErrorType error,
 
 static void tls_init(JabberStream *js)
 {
+	/* Whatever is still queued belongs before the TLS handshake. */
+	jabber_stream_flush(js);
+	if (js->writeh) {
+		purple_input_remove(js->writeh);
+		js->writeh = 0;
+	}
+
 	purple_input_remove(js->inpa);
 	js->inpa = 0;
 	js->gsc = purple_ssl_connect_with_host_fd(purple_connection_get_account(js->gc), js->fd,
@@ -1025,7 +1290,6 @@ jabber_stream_new(PurpleAccount *account)
 	js->chats = g_hash_table_new_full(g_str_hash, g_str_equal,
 			g_free, (GDestroyNotify)jabber_chat_free);
 	js->next_id = g_random_int();
-	js->write_buffer = purple_circular_buffer_new(512);
 	js->old_length = 0;
 	js->keepalive_timeout = 0;
 	js->max_inactivity = DEFAULT_INACTIVITY_TIME;
@@ -1108,6 +1372,133 @@ jabber_stream_connect(JabberStream *js)
 	}
 }
 
+static gboolean
+jabber_stream_resume_timeout_cb(gpointer data)
+{
+	JabberStream *js = data;
+
+	js->sm->resume_timer = 0;
+	purple_connection_error(js->gc, PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+		_("Unable to resume the session"));
+
+	return FALSE;
+}
+
+static gboolean
+jabber_stream_reconnect_cb(gpointer data)
+{
+	JabberStream *js = data;
+
+	js->sm->reconnect_timer = 0;
+
+	/* Drop the connection along with whatever was on its way out; the
+	 * stanzas among that are still unacked and get resent. */
+	if (js->gsc) {
+		purple_ssl_close(js->gsc);
+		js->gsc = NULL;
+	} else if (js->fd >= 0) {
+		if (js->inpa)
+			purple_input_remove(js->inpa);
+		close(js->fd);
+		js->fd = -1;
+	}
+	js->inpa = 0;
+
+	if (js->writeh) {
+		purple_input_remove(js->writeh);
+		js->writeh = 0;
+	}
+	if (js->write_timer) {
+		purple_timeout_remove(js->write_timer);
+		js->write_timer = 0;
+	}
+	g_queue_foreach(&js->write_queue, (GFunc)g_bytes_unref, NULL);
+	g_queue_clear(&js->write_queue);
+	js->write_offset = 0;
+
+	jabber_compression_free(js->compression);
+	js->compression = NULL;
+	js->compression_requested = FALSE;
+
+	if (js->keepalive_timeout) {
+		purple_timeout_remove(js->keepalive_timeout);
+		js->keepalive_timeout = 0;
+	}
+	if (js->inactivity_timer) {
+		purple_timeout_remove(js->inactivity_timer);
+		js->inactivity_timer = 0;
+	}
+
+	if (js->auth_mech && js->auth_mech->dispose)
+		js->auth_mech->dispose(js);
+	js->auth_mech = NULL;
+#ifdef HAVE_CYRUS_SASL
+	if (js->sasl)
+		sasl_dispose(&js->sasl);
+	if (js->sasl_mechs) {
+		g_string_free(js->sasl_mechs, TRUE);
+		js->sasl_mechs = NULL;
+	}
+#endif
+
+	g_free(js->certificate_CN);
+	js->certificate_CN = NULL;
+
+	jabber_stream_connect(js);
+
+	return FALSE;
+}
+
+/*
+ * Reconnects and resumes the session after losing the connection, if the
+ * server lets us.  Everything above the connection is kept: the UI keeps
+ * seeing the account as connected, and neither the roster nor presence nor
+ * chats have to be fetched again.
+ */
+static gboolean
+jabber_stream_resume(JabberStream *js)
+{
+	JabberSm *sm = js->sm;
+	guint timeout;
+
+	if (!jabber_sm_can_resume(js))
+		return FALSE;
+#ifdef HAVE_CYRUS_SASL
+	if (js->sasl_maxbuf > 0)
+		return FALSE;
+#endif
+
+	purple_debug_info("jabber", "Connection lost, resuming the session\n");
+
+	sm->resuming = TRUE;
+	sm->lost_time = g_get_monotonic_time();
+	sm->lost_bytes_read = js->bytes_read;
+	sm->lost_bytes_written = js->bytes_written;
+
+	timeout = JABBER_SM_RESUME_TIMEOUT;
+	if (sm->max > 0 && sm->max < timeout)
+		timeout = sm->max;
+	sm->resume_timer = purple_timeout_add_seconds(timeout,
+			jabber_stream_resume_timeout_cb, js);
+
+	/* We may be in the middle of reading from the connection. */
+	sm->reconnect_timer = purple_timeout_add(0, jabber_stream_reconnect_cb, js);
+
+	return TRUE;
+}
+
+static void
+jabber_stream_connection_lost(JabberStream *js, const char *msg)
+{
+	/* Already on it */
+	if (js->sm && js->sm->reconnect_timer)
+		return;
+
+	if (!jabber_stream_resume(js))
+		purple_connection_error(js->gc,
+			PURPLE_CONNECTION_ERROR_NETWORK_ERROR, msg);
+}
+
 void
 jabber_login(PurpleAccount *account)
 {
@@ -1635,8 +2026,28 @@ void jabber_close(PurpleConnection *gc)
 	if (js->bosh) {
 		jabber_bosh_connection_destroy(js->bosh);
 		js->bosh = NULL;
-	} else if ((js->gsc && js->gsc->fd > 0) || js->fd > 0)
+	} else if ((js->gsc && js->gsc->fd > 0) || js->fd > 0) {
 		jabber_send_raw(js, "</stream:stream>", -1);
+		/* Write out as much as the socket takes; nothing waits for the rest. */
+		if (jabber_stream_flush_compression(js))
+			jabber_stream_flush(js);
+	}
+
+	if (js->write_count > 0)
+		purple_debug_info("jabber", "Wrote %" G_GUINT64_FORMAT " bytes in %"
+				G_GUINT64_FORMAT " writes, %.1f chunks per write\n",
+				js->bytes_written, js->write_count,
+				(double)js->chunks_queued / js->write_count);
+
+	if (js->compression) {
+		purple_debug_info("jabber", "Stream compression ratio: %.2f\n",
+				jabber_compression_get_ratio(js->compression));
+		jabber_compression_free(js->compression);
+		js->compression = NULL;
+	}
+
+	jabber_sm_free(js->sm);
+	js->sm = NULL;
 
 	if(js->gsc) {
 		purple_ssl_close(js->gsc);
@@ -1687,10 +2098,12 @@ void jabber_close(PurpleConnection *gc)
 	g_free(js->avatar_hash);
 	g_free(js->caps_hash);
 
-	if (js->write_buffer)
-		g_object_unref(G_OBJECT(js->write_buffer));
+	g_queue_foreach(&js->write_queue, (GFunc)g_bytes_unref, NULL);
+	g_queue_clear(&js->write_queue);
 	if(js->writeh)
 		purple_input_remove(js->writeh);
+	if (js->write_timer)
+		purple_timeout_remove(js->write_timer);
 	if (js->auth_mech && js->auth_mech->dispose)
 		js->auth_mech->dispose(js);
 #ifdef HAVE_CYRUS_SASL
@@ -1752,6 +2165,14 @@ void jabber_stream_set_state(JabberStream *js, JabberStreamState state)
 {
 #define JABBER_CONNECT_STEPS ((js->gsc || js->state == JABBER_STREAM_INITIALIZING_ENCRYPTION) ? 9 : 5)
 
+	/* As far as the UI knows, a session being resumed is still connected. */
+	if (js->sm && js->sm->resuming) {
+		js->state = state;
+		if (state == JABBER_STREAM_INITIALIZING)
+			jabber_stream_init(js);
+		return;
+	}
+
 	js->state = state;
 	switch(state) {
 		case JABBER_STREAM_OFFLINE:
@@ -3986,6 +4407,7 @@ jabber_do_init(void)
 #endif
 
 	/* reverse order of unload_plugin */
+	jabber_parser_init();
 	jabber_iq_init();
 	jabber_presence_init();
 	jabber_caps_init();
@@ -4015,6 +4437,7 @@ jabber_do_uninit(void)
 	jabber_caps_uninit();
 	jabber_presence_uninit();
 	jabber_iq_uninit();
+	jabber_parser_uninit();
 
 #ifdef USE_VV
 	g_signal_handlers_disconnect_by_func(G_OBJECT(purple_media_manager_get()),
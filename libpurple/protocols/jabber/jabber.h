@@ -48,6 +48,7 @@ typedef enum {
 
 	JABBER_CAP_ITEMS          = 1 << 14,
 	JABBER_CAP_ROSTER_VERSIONING = 1 << 15,
+	JABBER_CAP_STREAM_MANAGEMENT = 1 << 16,
 
 	JABBER_CAP_RETRIEVED      = 1 << 31
 } JabberCapabilities;
@@ -71,11 +72,13 @@ typedef struct _JabberStream JabberStream;
 #include "namespaces.h"
 
 #include "auth.h"
+#include "compression.h"
 #include "iq.h"
 #include "jutil.h"
 #include "xmlnode.h"
 #include "buddy.h"
 #include "bosh.h"
+#include "sm.h"
 
 #ifdef HAVE_CYRUS_SASL
 #include <sasl/sasl.h>
@@ -124,6 +127,8 @@ struct _JabberStream
 
 	xmlParserCtxt *context;
 	PurpleXmlNode *current;
+	/* the stanza being consumed by a streaming handler, see parser.h */
+	struct _JabberParserCursor *stream_cursor;
 
 	struct {
 		guint8 major;
@@ -209,8 +214,26 @@ struct _JabberStream
 
 	GSList *pending_buddy_info_requests;
 
-	PurpleCircularBuffer *write_buffer;
+	/* GBytes waiting to be written, of which write_offset bytes of the
+	 * first one have been written already. Data sent during one main loop
+	 * iteration is gathered into a single write by write_timer. */
+	GQueue write_queue;
+	gsize write_offset;
 	guint writeh;
+	guint write_timer;
+
+	/* Traffic counters, and the average number of chunks per write */
+	guint64 bytes_read;
+	guint64 bytes_written;
+	guint64 write_count;
+	guint64 chunks_queued;
+
+	/* XEP-0138 zlib stream compression, once the server agreed to it */
+	JabberCompression *compression;
+	gboolean compression_requested;
+
+	/* XEP-0198 stream management, once it has been enabled */
+	JabberSm *sm;
 
 	gboolean reinit;
 
@@ -67,9 +67,16 @@
 /* XEP-0124 Bidirectional-streams Over Synchronous HTTP (BOSH) */
 #define NS_BOSH "http://jabber.org/protocol/httpbind"
 
+/* XEP-0138 Stream Compression */
+#define NS_COMPRESS_FEATURE "http://jabber.org/features/compress"
+#define NS_COMPRESS_PROTOCOL "http://jabber.org/protocol/compress"
+
 /* XEP-0191 Simple Communications Blocking */
 #define NS_SIMPLE_BLOCKING "urn:xmpp:blocking"
 
+/* XEP-0198 Stream Management */
+#define NS_STREAM_MANAGEMENT "urn:xmpp:sm:3"
+
 /* XEP-0199 Ping */
 #define NS_PING "urn:xmpp:ping"
 
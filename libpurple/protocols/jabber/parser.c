@@ -26,11 +26,502 @@
 
 #include "connection.h"
 #include "debug.h"
+#include "iq.h"
 #include "jabber.h"
 #include "parser.h"
+#include "roster.h"
+#include "sm.h"
 #include "util.h"
 #include "xmlnode.h"
 
+/* Stanzas are parsed into a tree allocated within a memory pool of its own,
+ * which is released in one go after the stanza is processed. */
+#define JABBER_PARSER_POOL_BLOCK_SIZE 4096
+
+/* Names shared (rather than copied) by every pooled stanza tree. */
+static const gchar *jabber_parser_common_names[] = {
+	"iq", "message", "presence", "query", "item", "body", "thread",
+	"subject", "error", "x", "c", "delay", "active", "composing", "paused",
+	"show", "status", "priority", "id", "to", "from", "type", "jid",
+	"name", "node", "ver", "hash", "ext", "affiliation", "role", "nick",
+	"subscription", "ask", "group", "stamp",
+	NS_XMPP_CLIENT, NS_XMPP_STANZAS, NS_XMPP_STREAMS, NS_DISCO_INFO,
+	NS_DISCO_ITEMS, NS_DELAYED_DELIVERY, "jabber:iq:roster",
+	"http://jabber.org/protocol/caps", "http://jabber.org/protocol/chatstates",
+	"http://jabber.org/protocol/muc",
+	"http://jabber.org/protocol/muc#user", NULL
+};
+
+typedef struct
+{
+	const xmlChar *name;
+	const xmlChar *prefix;
+	const xmlChar *xmlns;
+	int nb_namespaces;
+	const xmlChar **namespaces;
+	int nb_attributes;
+	const xmlChar **attributes;
+} JabberParserElement;
+
+struct _JabberParserCursor
+{
+	JabberParserStreamHandler *handler;
+	PurpleXmlNode *stanza;
+
+	/* depth of the innermost open element, 0 being the stanza */
+	guint depth;
+	gboolean started;
+
+	gboolean skipping;
+	guint skip_depth;
+
+	PurpleXmlNode *subtree;
+	PurpleXmlNode *subtree_current;
+	guint subtree_depth;
+
+	JabberParserEvent event;
+	const char *name;
+	const char *xmlns;
+	const JabberParserElement *element;
+	const char *text;
+	int text_len;
+
+	/* strings handed out for the current event */
+	GSList *scratch;
+
+	gpointer data;
+	GDestroyNotify destroy;
+};
+
+static GHashTable *stream_handlers = NULL;
+
+static PurpleXmlNode *
+jabber_parser_new_stanza(const char *name)
+{
+	PurpleMemoryPool *pool;
+	PurpleXmlNode *node;
+
+	pool = purple_memory_pool_new();
+	purple_memory_pool_set_block_size(pool, JABBER_PARSER_POOL_BLOCK_SIZE);
+
+	/* the stanza root holds its own reference */
+	node = purple_xmlnode_new_with_pool(name, pool);
+	g_object_unref(pool);
+
+	return node;
+}
+
+static void
+jabber_parser_fill_node(PurpleXmlNode *node, const JabberParserElement *el)
+{
+	int i, j;
+
+	purple_xmlnode_set_namespace(node, (const char*) el->xmlns);
+	purple_xmlnode_set_prefix(node, (const char *)el->prefix);
+
+	if (el->nb_namespaces != 0) {
+		/* keys and values are allocated within the stanza pool */
+		node->namespace_map = g_hash_table_new(g_str_hash, g_str_equal);
+
+		for (i = 0, j = 0; i < el->nb_namespaces; i++, j += 2) {
+			const char *key = (const char *)el->namespaces[j];
+			const char *val = (const char *)el->namespaces[j + 1];
+			g_hash_table_insert(node->namespace_map,
+				purple_memory_pool_strdup(node->pool, key ? key : ""),
+				purple_memory_pool_strdup(node->pool, val ? val : ""));
+		}
+	}
+	for(i=0; i < el->nb_attributes * 5; i+=5) {
+		const char *name = (const char *)el->attributes[i];
+		const char *prefix = (const char *)el->attributes[i+1];
+		const char *attrib_ns = (const char *)el->attributes[i+2];
+		const char *value = (const char *)el->attributes[i+3];
+		int attrib_len = el->attributes[i+4] - el->attributes[i+3];
+		char buf[256];
+
+		/* Most attribute values are short and have nothing to
+		 * unescape, so don't bother with the heap for them. */
+		if (attrib_len < (int)sizeof(buf) &&
+				memchr(value, '&', attrib_len) == NULL) {
+			memcpy(buf, value, attrib_len);
+			buf[attrib_len] = '\0';
+			purple_xmlnode_set_attrib_full(node, name, attrib_ns, prefix, buf);
+		} else {
+			char *txt = g_strndup(value, attrib_len);
+			char *attrib = purple_unescape_text(txt);
+			g_free(txt);
+			purple_xmlnode_set_attrib_full(node, name, attrib_ns, prefix, attrib);
+			g_free(attrib);
+		}
+	}
+}
+
+/******************************************************************************
+ * Streaming stanzas
+ *****************************************************************************/
+
+static JabberParserStreamHandler *
+jabber_parser_find_stream_handler(JabberStream *js, const char *stanza,
+		const char *node, const char *xmlns)
+{
+	JabberParserStreamHandler *handler;
+	PurpleProtocol *protocol;
+	const char *signal = NULL;
+	char key[256];
+
+	if (stream_handlers == NULL || g_hash_table_size(stream_handlers) == 0)
+		return NULL;
+
+	if (node) {
+		if (g_snprintf(key, sizeof(key), "%s %s %s", stanza, node,
+				xmlns ? xmlns : "") >= (gint)sizeof(key))
+			return NULL;
+	} else if (g_strlcpy(key, stanza, sizeof(key)) >= sizeof(key)) {
+		return NULL;
+	}
+
+	handler = g_hash_table_lookup(stream_handlers, key);
+	if (handler == NULL)
+		return NULL;
+
+	/* Whoever listens to these wants to see the whole stanza. */
+	protocol = purple_connection_get_protocol(js->gc);
+	if (purple_signal_has_handlers(protocol, "jabber-receiving-xmlnode"))
+		return NULL;
+
+	if (g_str_equal(stanza, "iq")) {
+		if (node && jabber_iq_is_watched(node, xmlns))
+			return NULL;
+		signal = "jabber-receiving-iq";
+	} else if (g_str_equal(stanza, "message")) {
+		signal = "jabber-receiving-message";
+	} else if (g_str_equal(stanza, "presence")) {
+		signal = "jabber-receiving-presence";
+	}
+
+	if (signal && purple_signal_has_handlers(protocol, signal))
+		return NULL;
+
+	return handler;
+}
+
+static void
+jabber_parser_cursor_free(JabberParserCursor *cursor)
+{
+	g_slist_free_full(cursor->scratch, g_free);
+
+	if (cursor->destroy)
+		cursor->destroy(cursor->data);
+	if (cursor->subtree)
+		purple_xmlnode_free(cursor->subtree);
+	if (cursor->stanza)
+		purple_xmlnode_free(cursor->stanza);
+
+	g_free(cursor);
+}
+
+static JabberParserAction
+jabber_parser_cursor_emit(JabberStream *js, JabberParserCursor *cursor,
+		JabberParserEvent event)
+{
+	JabberParserAction action;
+	gboolean first = !cursor->started;
+
+	cursor->event = event;
+	cursor->started = TRUE;
+	action = cursor->handler(js, cursor);
+
+	g_slist_free_full(cursor->scratch, g_free);
+	cursor->scratch = NULL;
+
+	if (event != JABBER_PARSER_EVENT_START)
+		return JABBER_PARSER_CONTINUE;
+
+	if (action == JABBER_PARSER_FALLBACK && !first) {
+		purple_debug_warning("jabber", "Stream handler asked for a fallback "
+			"in the middle of <%s/>, skipping it instead\n",
+			cursor->stanza->name);
+		action = JABBER_PARSER_SKIP;
+	}
+
+	return action;
+}
+
+static void
+jabber_parser_cursor_apply(JabberParserCursor *cursor,
+		JabberParserAction action, const JabberParserElement *el)
+{
+	if (action == JABBER_PARSER_SKIP) {
+		cursor->skipping = TRUE;
+		cursor->skip_depth = cursor->depth;
+	} else if (action == JABBER_PARSER_BUILD) {
+		cursor->subtree = jabber_parser_new_stanza((const char *)el->name);
+		jabber_parser_fill_node(cursor->subtree, el);
+		cursor->subtree_current = cursor->subtree;
+		cursor->subtree_depth = cursor->depth;
+	}
+}
+
+static void
+jabber_parser_cursor_set_element(JabberParserCursor *cursor,
+		const JabberParserElement *el)
+{
+	cursor->name = (const char *)el->name;
+	cursor->xmlns = (const char *)el->xmlns;
+	cursor->element = el;
+	cursor->text = NULL;
+	cursor->text_len = 0;
+}
+
+/* Hands the stanza over to a streaming handler. Returns FALSE, if the
+ * handler wants it to be parsed into a tree after all. */
+static gboolean
+jabber_parser_stream_begin(JabberStream *js, JabberParserStreamHandler *handler,
+		PurpleXmlNode *stanza, guint depth, const JabberParserElement *el)
+{
+	JabberParserCursor *cursor;
+	JabberParserAction action;
+
+	cursor = g_new0(JabberParserCursor, 1);
+	cursor->handler = handler;
+	cursor->stanza = stanza;
+	cursor->depth = depth;
+	js->stream_cursor = cursor;
+
+	jabber_parser_cursor_set_element(cursor, el);
+	action = jabber_parser_cursor_emit(js, cursor, JABBER_PARSER_EVENT_START);
+
+	if (action == JABBER_PARSER_FALLBACK) {
+		/* the stanza tree is still ours */
+		cursor->stanza = NULL;
+		js->stream_cursor = NULL;
+		jabber_parser_cursor_free(cursor);
+		return FALSE;
+	}
+
+	jabber_parser_cursor_apply(cursor, action, el);
+	return TRUE;
+}
+
+static void
+jabber_parser_stream_element_start(JabberStream *js,
+		const JabberParserElement *el)
+{
+	JabberParserCursor *cursor = js->stream_cursor;
+	JabberParserAction action;
+
+	cursor->depth++;
+
+	if (cursor->skipping)
+		return;
+
+	if (cursor->subtree) {
+		PurpleXmlNode *node = purple_xmlnode_new_child(
+			cursor->subtree_current, (const char *)el->name);
+		jabber_parser_fill_node(node, el);
+		cursor->subtree_current = node;
+		return;
+	}
+
+	jabber_parser_cursor_set_element(cursor, el);
+	action = jabber_parser_cursor_emit(js, cursor, JABBER_PARSER_EVENT_START);
+	jabber_parser_cursor_apply(cursor, action, el);
+}
+
+static void
+jabber_parser_stream_element_end(JabberStream *js, const xmlChar *element_name,
+		const xmlChar *namespace)
+{
+	JabberParserCursor *cursor = js->stream_cursor;
+	guint depth = cursor->depth;
+
+	if (cursor->skipping) {
+		if (depth == cursor->skip_depth)
+			cursor->skipping = FALSE;
+	} else if (cursor->subtree && depth > cursor->subtree_depth) {
+		cursor->subtree_current = cursor->subtree_current->parent;
+	} else {
+		cursor->name = (const char *)element_name;
+		cursor->xmlns = (const char *)namespace;
+		cursor->element = NULL;
+		jabber_parser_cursor_emit(js, cursor, JABBER_PARSER_EVENT_END);
+
+		if (cursor->subtree) {
+			purple_xmlnode_free(cursor->subtree);
+			cursor->subtree = NULL;
+			cursor->subtree_current = NULL;
+		}
+	}
+
+	if (depth == 0) {
+		gboolean stanza = jabber_sm_is_stanza(cursor->stanza);
+
+		js->stream_cursor = NULL;
+		jabber_parser_cursor_free(cursor);
+
+		if (stanza)
+			jabber_sm_handled(js);
+	} else {
+		cursor->depth--;
+	}
+}
+
+static void
+jabber_parser_stream_text(JabberStream *js, const xmlChar *text, int text_len)
+{
+	JabberParserCursor *cursor = js->stream_cursor;
+
+	if (cursor->skipping)
+		return;
+
+	if (cursor->subtree) {
+		purple_xmlnode_insert_data(cursor->subtree_current,
+			(const char *)text, text_len);
+		return;
+	}
+
+	cursor->name = NULL;
+	cursor->xmlns = NULL;
+	cursor->element = NULL;
+	cursor->text = (const char *)text;
+	cursor->text_len = text_len;
+	jabber_parser_cursor_emit(js, cursor, JABBER_PARSER_EVENT_TEXT);
+}
+
+void
+jabber_parser_register_stream_handler(const char *stanza, const char *node,
+		const char *xmlns, JabberParserStreamHandler *handler)
+{
+	char *key;
+
+	g_return_if_fail(stanza != NULL && *stanza != '\0');
+	g_return_if_fail(stream_handlers != NULL);
+
+	if (node)
+		key = g_strdup_printf("%s %s %s", stanza, node, xmlns ? xmlns : "");
+	else
+		key = g_strdup(stanza);
+
+	g_hash_table_replace(stream_handlers, key, handler);
+}
+
+JabberParserEvent
+jabber_parser_cursor_get_event(const JabberParserCursor *cursor)
+{
+	return cursor->event;
+}
+
+guint
+jabber_parser_cursor_get_depth(const JabberParserCursor *cursor)
+{
+	return cursor->depth;
+}
+
+const char *
+jabber_parser_cursor_get_name(const JabberParserCursor *cursor)
+{
+	return cursor->name;
+}
+
+const char *
+jabber_parser_cursor_get_namespace(const JabberParserCursor *cursor)
+{
+	return cursor->xmlns;
+}
+
+const char *
+jabber_parser_cursor_get_attrib(JabberParserCursor *cursor, const char *attr)
+{
+	const JabberParserElement *el = cursor->element;
+	int i;
+
+	g_return_val_if_fail(attr != NULL, NULL);
+
+	if (el == NULL)
+		return NULL;
+
+	for (i = 0; i < el->nb_attributes * 5; i += 5) {
+		const char *value = (const char *)el->attributes[i+3];
+		int len = el->attributes[i+4] - el->attributes[i+3];
+		char *ret;
+
+		if (xmlStrcmp(el->attributes[i], (const xmlChar *)attr) != 0)
+			continue;
+
+		ret = g_strndup(value, len);
+		if (memchr(value, '&', len) != NULL) {
+			char *tmp = ret;
+			ret = purple_unescape_text(tmp);
+			g_free(tmp);
+		}
+
+		cursor->scratch = g_slist_prepend(cursor->scratch, ret);
+		return ret;
+	}
+
+	return NULL;
+}
+
+const char *
+jabber_parser_cursor_get_text(const JabberParserCursor *cursor, int *len)
+{
+	if (len)
+		*len = cursor->text_len;
+
+	return cursor->text;
+}
+
+PurpleXmlNode *
+jabber_parser_cursor_get_stanza(const JabberParserCursor *cursor)
+{
+	return cursor->stanza;
+}
+
+PurpleXmlNode *
+jabber_parser_cursor_get_subtree(const JabberParserCursor *cursor)
+{
+	if (cursor->event != JABBER_PARSER_EVENT_END ||
+			cursor->depth != cursor->subtree_depth)
+		return NULL;
+
+	return cursor->subtree;
+}
+
+void
+jabber_parser_cursor_set_data(JabberParserCursor *cursor, gpointer data,
+		GDestroyNotify destroy)
+{
+	if (cursor->destroy)
+		cursor->destroy(cursor->data);
+
+	cursor->data = data;
+	cursor->destroy = destroy;
+}
+
+gpointer
+jabber_parser_cursor_get_data(const JabberParserCursor *cursor)
+{
+	return cursor->data;
+}
+
+/******************************************************************************
+ * SAX callbacks
+ *****************************************************************************/
+
+/* Checks whether nothing but attributes and text was added to a node. */
+static gboolean
+jabber_parser_has_no_children(const PurpleXmlNode *node)
+{
+	const PurpleXmlNode *child;
+
+	for (child = node->child; child; child = child->next) {
+		if (child->type == PURPLE_XMLNODE_TYPE_TAG)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
 static void
 jabber_parser_element_start_libxml(void *user_data,
 				   const xmlChar *element_name, const xmlChar *prefix, const xmlChar *namespace,
@@ -38,8 +529,14 @@ jabber_parser_element_start_libxml(void *user_data,
 				   int nb_attributes, int nb_defaulted, const xmlChar **attributes)
 {
 	JabberStream *js = user_data;
+	JabberParserStreamHandler *handler;
 	PurpleXmlNode *node;
-	int i, j;
+	JabberParserElement el = {
+		element_name, prefix, namespace,
+		nb_namespaces, namespaces,
+		nb_attributes, attributes
+	};
+	int i;
 
 	if(!element_name) {
 		return;
@@ -112,39 +609,34 @@ jabber_parser_element_start_libxml(void *user_data,
 			                  "to be a MUST; digest legacy auth may fail.\n");
 #endif
 		}
+	} else if (js->stream_cursor) {
+		jabber_parser_stream_element_start(js, &el);
 	} else {
-
-		if(js->current)
-			node = purple_xmlnode_new_child(js->current, (const char*) element_name);
-		else
-			node = purple_xmlnode_new((const char*) element_name);
-		purple_xmlnode_set_namespace(node, (const char*) namespace);
-		purple_xmlnode_set_prefix(node, (const char *)prefix);
-
-		if (nb_namespaces != 0) {
-			node->namespace_map = g_hash_table_new_full(
-				g_str_hash, g_str_equal, g_free, g_free);
-
-			for (i = 0, j = 0; i < nb_namespaces; i++, j += 2) {
-				const char *key = (const char *)namespaces[j];
-				const char *val = (const char *)namespaces[j + 1];
-				g_hash_table_insert(node->namespace_map,
-					g_strdup(key ? key : ""), g_strdup(val ? val : ""));
+		if (js->current == NULL) {
+			node = jabber_parser_new_stanza((const char*) element_name);
+			jabber_parser_fill_node(node, &el);
+
+			handler = jabber_parser_find_stream_handler(js, node->name,
+				NULL, NULL);
+			if (handler && jabber_parser_stream_begin(js, handler, node, 0, &el))
+				return;
+		} else {
+			PurpleXmlNode *stanza = js->current;
+
+			/* Handlers may also be picked by the first child of a stanza,
+			 * like the IQ ones are. */
+			if (stanza->parent == NULL && jabber_parser_has_no_children(stanza)) {
+				handler = jabber_parser_find_stream_handler(js, stanza->name,
+					(const char *)element_name, (const char *)namespace);
+				if (handler && jabber_parser_stream_begin(js, handler,
+						stanza, 1, &el)) {
+					js->current = NULL;
+					return;
+				}
 			}
-		}
-		for(i=0; i < nb_attributes * 5; i+=5) {
-			const char *name = (const char *)attributes[i];
-			const char *prefix = (const char *)attributes[i+1];
-			const char *attrib_ns = (const char *)attributes[i+2];
-			char *txt;
-			int attrib_len = attributes[i+4] - attributes[i+3];
-			char *attrib = g_strndup((gchar *)attributes[i+3], attrib_len);
 
-			txt = attrib;
-			attrib = purple_unescape_text(txt);
-			g_free(txt);
-			purple_xmlnode_set_attrib_full(node, name, attrib_ns, prefix, attrib);
-			g_free(attrib);
+			node = purple_xmlnode_new_child(stanza, (const char*) element_name);
+			jabber_parser_fill_node(node, &el);
 		}
 
 		js->current = node;
@@ -157,6 +649,11 @@ jabber_parser_element_end_libxml(void *user_data, const xmlChar *element_name,
 {
 	JabberStream *js = user_data;
 
+	if (js->stream_cursor) {
+		jabber_parser_stream_element_end(js, element_name, namespace);
+		return;
+	}
+
 	if(!js->current)
 		return;
 
@@ -165,10 +662,17 @@ jabber_parser_element_end_libxml(void *user_data, const xmlChar *element_name,
 			js->current = js->current->parent;
 	} else {
 		PurpleXmlNode *packet = js->current;
+		/* A jabber-receiving-xmlnode handler may take the stanza, but it
+		 * has still been handled as far as the server is concerned. */
+		gboolean stanza = jabber_sm_is_stanza(packet);
+
 		js->current = NULL;
 		jabber_process_packet(js, &packet);
 		if (packet != NULL)
 			purple_xmlnode_free(packet);
+
+		if (stanza)
+			jabber_sm_handled(js);
 	}
 }
 
@@ -177,10 +681,15 @@ jabber_parser_element_text_libxml(void *user_data, const xmlChar *text, int text
 {
 	JabberStream *js = user_data;
 
-	if(!js->current)
+	if(!text || !text_len)
 		return;
 
-	if(!text || !text_len)
+	if (js->stream_cursor) {
+		jabber_parser_stream_text(js, text, text_len);
+		return;
+	}
+
+	if(!js->current)
 		return;
 
 	purple_xmlnode_insert_data(js->current, (const char*) text, text_len);
@@ -252,6 +761,16 @@ static xmlSAXHandler jabber_parser_libxml = {
 void
 jabber_parser_setup(JabberStream *js)
 {
+	static gboolean names_interned = FALSE;
+
+	if (!names_interned) {
+		const gchar **name;
+
+		for (name = jabber_parser_common_names; *name != NULL; name++)
+			g_intern_static_string(*name);
+		names_interned = TRUE;
+	}
+
 	/* This seems backwards, but it makes sense. The libxml code creates
 	 * the parser context when you try to use it (this way, it can figure
 	 * out the encoding at creation time. So, setting up the parser is
@@ -265,6 +784,22 @@ void jabber_parser_free(JabberStream *js) {
 		xmlFreeParserCtxt(js->context);
 		js->context = NULL;
 	}
+
+	/* drop a stanza that was cut in the middle */
+	if (js->stream_cursor) {
+		JabberParserCursor *cursor = js->stream_cursor;
+
+		js->stream_cursor = NULL;
+		jabber_parser_cursor_free(cursor);
+	}
+	if (js->current) {
+		PurpleXmlNode *root = js->current;
+
+		while (root->parent)
+			root = root->parent;
+		js->current = NULL;
+		purple_xmlnode_free(root);
+	}
 }
 
 void jabber_parser_process(JabberStream *js, const char *buf, int len)
@@ -321,3 +856,19 @@ void jabber_parser_process(JabberStream *js, const char *buf, int len)
 	}
 }
 
+void
+jabber_parser_init(void)
+{
+	stream_handlers = g_hash_table_new_full(g_str_hash, g_str_equal,
+		g_free, NULL);
+
+	jabber_parser_register_stream_handler("iq", "query", "jabber:iq:roster",
+		jabber_roster_stream_parse);
+}
+
+void
+jabber_parser_uninit(void)
+{
+	g_hash_table_destroy(stream_handlers);
+	stream_handlers = NULL;
+}
@@ -26,8 +26,120 @@
 
 #include "jabber.h"
 
+typedef struct _JabberParserCursor JabberParserCursor;
+
+typedef enum {
+	JABBER_PARSER_EVENT_START,
+	JABBER_PARSER_EVENT_END,
+	JABBER_PARSER_EVENT_TEXT
+} JabberParserEvent;
+
+typedef enum {
+	/* Keep delivering events of the stanza. */
+	JABBER_PARSER_CONTINUE,
+	/* Don't deliver anything from inside the element that just started
+	 * (including its end). */
+	JABBER_PARSER_SKIP,
+	/* Build a tree of the element that just started, and hand it over
+	 * with jabber_parser_cursor_get_subtree() when it ends. */
+	JABBER_PARSER_BUILD,
+	/* Stop streaming, build the whole stanza and process it the usual way
+	 * with jabber_process_packet(). Honoured only for the first event
+	 * delivered to the handler. */
+	JABBER_PARSER_FALLBACK
+} JabberParserAction;
+
+/**
+ * A JabberParserStreamHandler consumes a stanza directly from the SAX
+ * events, without the full PurpleXmlNode tree being built first.
+ *
+ * The first event delivered is the start of the element the handler was
+ * registered for: either the stanza itself (depth 0) or its first child
+ * (depth 1). Afterwards the handler gets every event of the stanza up to
+ * and including the end of the stanza, unless it asks to skip parts of it.
+ *
+ * @param js     The JabberStream object.
+ * @param cursor The cursor positioned at the current event. It is valid
+ *               until the stanza ends.
+ *
+ * @return What the parser should do with the rest of the current element.
+ *         The value is ignored for anything but the start events.
+ */
+typedef JabberParserAction (JabberParserStreamHandler)(JabberStream *js,
+		JabberParserCursor *cursor);
+
 void jabber_parser_setup(JabberStream *js);
 void jabber_parser_free(JabberStream *js);
 void jabber_parser_process(JabberStream *js, const char *buf, int len);
 
+/**
+ * Registers a streaming handler for a stanza.
+ *
+ * @param stanza  The name of the top-level element (iq, message, ...).
+ * @param node    The name of the first child of the stanza, or NULL to
+ *                stream every stanza named @stanza.
+ * @param xmlns   The namespace of @node. Ignored if @node is NULL.
+ * @param handler The handler.
+ *
+ * Streaming is used only if nothing is connected to the signals exposing
+ * the whole stanza (jabber-receiving-xmlnode and the per-stanza
+ * jabber-receiving-* ones).
+ */
+void jabber_parser_register_stream_handler(const char *stanza,
+		const char *node, const char *xmlns,
+		JabberParserStreamHandler *handler);
+
+JabberParserEvent jabber_parser_cursor_get_event(const JabberParserCursor *cursor);
+
+/**
+ * @return The depth of the element of the current event, 0 being the
+ *         stanza itself.
+ */
+guint jabber_parser_cursor_get_depth(const JabberParserCursor *cursor);
+
+/**
+ * @return The name of the element that started or ended, NULL for the
+ *         text events.
+ */
+const char *jabber_parser_cursor_get_name(const JabberParserCursor *cursor);
+const char *jabber_parser_cursor_get_namespace(const JabberParserCursor *cursor);
+
+/**
+ * Gets an (unescaped) attribute of the element that just started.
+ *
+ * @return The value, valid until the next event, or NULL.
+ */
+const char *jabber_parser_cursor_get_attrib(JabberParserCursor *cursor,
+		const char *attr);
+
+/**
+ * @return The (escaped) text of a text event, which is not NUL-terminated.
+ */
+const char *jabber_parser_cursor_get_text(const JabberParserCursor *cursor,
+		int *len);
+
+/**
+ * @return The stanza element with its attributes (but no children).
+ */
+PurpleXmlNode *jabber_parser_cursor_get_stanza(const JabberParserCursor *cursor);
+
+/**
+ * @return The tree of the element that just ended, if it was requested
+ *         with JABBER_PARSER_BUILD, otherwise NULL. It's freed after the
+ *         handler returns.
+ */
+PurpleXmlNode *jabber_parser_cursor_get_subtree(const JabberParserCursor *cursor);
+
+/**
+ * Attaches handler's state to the stanza being streamed. @destroy is
+ * called when the stanza ends or the stream is torn down in the middle of
+ * it.
+ */
+void jabber_parser_cursor_set_data(JabberParserCursor *cursor, gpointer data,
+		GDestroyNotify destroy);
+gpointer jabber_parser_cursor_get_data(const JabberParserCursor *cursor);
+
+void jabber_parser_init(void);
+void jabber_parser_uninit(void);
+
 #endif /* PURPLE_JABBER_PARSER_H_ */
@@ -199,10 +199,81 @@ static void add_purple_buddy_to_groups(JabberStream *js, const char *jid,
 	g_slist_free(buddies);
 }
 
+static void jabber_roster_parse_item(JabberStream *js, PurpleXmlNode *item)
+{
+	PurpleXmlNode *group;
+	const char *jid, *name, *subscription, *ask;
+	JabberBuddy *jb;
+
+	subscription = purple_xmlnode_get_attrib(item, "subscription");
+	jid = purple_xmlnode_get_attrib(item, "jid");
+	name = purple_xmlnode_get_attrib(item, "name");
+	ask = purple_xmlnode_get_attrib(item, "ask");
+
+	if(!jid)
+		return;
+
+	if(!(jb = jabber_buddy_find(js, jid, TRUE)))
+		return;
+
+	if(subscription) {
+		if (g_str_equal(subscription, "remove"))
+			jb->subscription = JABBER_SUB_REMOVE;
+		else if (jb == js->user_jb)
+			jb->subscription = JABBER_SUB_BOTH;
+		else if (g_str_equal(subscription, "none"))
+			jb->subscription = JABBER_SUB_NONE;
+		else if (g_str_equal(subscription, "to"))
+			jb->subscription = JABBER_SUB_TO;
+		else if (g_str_equal(subscription, "from"))
+			jb->subscription = JABBER_SUB_FROM;
+		else if (g_str_equal(subscription, "both"))
+			jb->subscription = JABBER_SUB_BOTH;
+	}
+
+	if(purple_strequal(ask, "subscribe"))
+		jb->subscription |= JABBER_SUB_PENDING;
+	else
+		jb->subscription &= ~JABBER_SUB_PENDING;
+
+	if(jb->subscription & JABBER_SUB_REMOVE) {
+		remove_purple_buddies(js, jid);
+	} else {
+		GSList *groups = NULL;
+
+		if (js->server_caps & JABBER_CAP_GOOGLE_ROSTER)
+			if (!jabber_google_roster_incoming(js, item))
+				return;
+
+		for(group = purple_xmlnode_get_child(item, "group"); group; group = purple_xmlnode_get_next_twin(group)) {
+			char *group_name = purple_xmlnode_get_data(group);
+
+			if (group_name == NULL || *group_name == '\0')
+				/* Changing this string?  Look in add_purple_buddy_to_groups */
+				group_name = g_strdup(JABBER_ROSTER_DEFAULT_GROUP);
+
+			/*
+			 * See the note in add_purple_buddy_to_groups; the core handles
+			 * names case-insensitively and this is required to not
+			 * end up with duplicates if a buddy is in, e.g.,
+			 * 'XMPP' and 'xmpp'
+			 */
+			if (g_slist_find_custom(groups, group_name, (GCompareFunc)purple_utf8_strcasecmp))
+				g_free(group_name);
+			else
+				groups = g_slist_prepend(groups, group_name);
+		}
+
+		add_purple_buddy_to_groups(js, jid, name, groups);
+		if (jb == js->user_jb)
+			jabber_presence_fake_to_self(js, NULL);
+	}
+}
+
 void jabber_roster_parse(JabberStream *js, const char *from,
                          JabberIqType type, const char *id, PurpleXmlNode *query)
 {
-	PurpleXmlNode *item, *group;
+	PurpleXmlNode *item;
 #if 0
 	const char *ver;
 #endif
@@ -216,74 +287,7 @@ void jabber_roster_parse(JabberStream *js, const char *from,
 	js->currently_parsing_roster_push = TRUE;
 
 	for(item = purple_xmlnode_get_child(query, "item"); item; item = purple_xmlnode_get_next_twin(item))
-	{
-		const char *jid, *name, *subscription, *ask;
-		JabberBuddy *jb;
-
-		subscription = purple_xmlnode_get_attrib(item, "subscription");
-		jid = purple_xmlnode_get_attrib(item, "jid");
-		name = purple_xmlnode_get_attrib(item, "name");
-		ask = purple_xmlnode_get_attrib(item, "ask");
-
-		if(!jid)
-			continue;
-
-		if(!(jb = jabber_buddy_find(js, jid, TRUE)))
-			continue;
-
-		if(subscription) {
-			if (g_str_equal(subscription, "remove"))
-				jb->subscription = JABBER_SUB_REMOVE;
-			else if (jb == js->user_jb)
-				jb->subscription = JABBER_SUB_BOTH;
-			else if (g_str_equal(subscription, "none"))
-				jb->subscription = JABBER_SUB_NONE;
-			else if (g_str_equal(subscription, "to"))
-				jb->subscription = JABBER_SUB_TO;
-			else if (g_str_equal(subscription, "from"))
-				jb->subscription = JABBER_SUB_FROM;
-			else if (g_str_equal(subscription, "both"))
-				jb->subscription = JABBER_SUB_BOTH;
-		}
-
-		if(purple_strequal(ask, "subscribe"))
-			jb->subscription |= JABBER_SUB_PENDING;
-		else
-			jb->subscription &= ~JABBER_SUB_PENDING;
-
-		if(jb->subscription & JABBER_SUB_REMOVE) {
-			remove_purple_buddies(js, jid);
-		} else {
-			GSList *groups = NULL;
-
-			if (js->server_caps & JABBER_CAP_GOOGLE_ROSTER)
-				if (!jabber_google_roster_incoming(js, item))
-					continue;
-
-			for(group = purple_xmlnode_get_child(item, "group"); group; group = purple_xmlnode_get_next_twin(group)) {
-				char *group_name = purple_xmlnode_get_data(group);
-
-				if (group_name == NULL || *group_name == '\0')
-					/* Changing this string?  Look in add_purple_buddy_to_groups */
-					group_name = g_strdup(JABBER_ROSTER_DEFAULT_GROUP);
-
-				/*
-				 * See the note in add_purple_buddy_to_groups; the core handles
-				 * names case-insensitively and this is required to not
-				 * end up with duplicates if a buddy is in, e.g.,
-				 * 'XMPP' and 'xmpp'
-				 */
-				if (g_slist_find_custom(groups, group_name, (GCompareFunc)purple_utf8_strcasecmp))
-					g_free(group_name);
-				else
-					groups = g_slist_prepend(groups, group_name);
-			}
-
-			add_purple_buddy_to_groups(js, jid, name, groups);
-			if (jb == js->user_jb)
-				jabber_presence_fake_to_self(js, NULL);
-		}
-	}
+		jabber_roster_parse_item(js, item);
 
 #if 0
 	ver = purple_xmlnode_get_attrib(query, "ver");
@@ -302,6 +306,101 @@ void jabber_roster_parse(JabberStream *js, const char *from,
 	js->currently_parsing_roster_push = FALSE;
 }
 
+typedef struct {
+	JabberIqType type;
+	char *id;
+} JabberRosterStream;
+
+static void jabber_roster_stream_free(JabberRosterStream *rs)
+{
+	g_free(rs->id);
+	g_free(rs);
+}
+
+/* Decides whether the roster in an <iq/> may be consumed item by item.
+ * Anything unusual goes through jabber_iq_parse() instead. */
+static JabberParserAction jabber_roster_stream_begin(JabberStream *js,
+		JabberParserCursor *cursor)
+{
+	PurpleXmlNode *iq = jabber_parser_cursor_get_stanza(cursor);
+	const char *type, *id, *from;
+	JabberRosterStream *rs;
+
+	type = purple_xmlnode_get_attrib(iq, "type");
+	id = purple_xmlnode_get_attrib(iq, "id");
+	from = purple_xmlnode_get_attrib(iq, "from");
+
+	if (type == NULL || id == NULL || *id == '\0')
+		return JABBER_PARSER_FALLBACK;
+	if (!jabber_is_own_account(js, from))
+		return JABBER_PARSER_FALLBACK;
+
+	rs = g_new0(JabberRosterStream, 1);
+	if (g_str_equal(type, "set")) {
+		rs->type = JABBER_IQ_SET;
+	} else if (g_str_equal(type, "result") &&
+			jabber_iq_has_callback(js, id, from, roster_request_cb)) {
+		rs->type = JABBER_IQ_RESULT;
+	} else {
+		g_free(rs);
+		return JABBER_PARSER_FALLBACK;
+	}
+	rs->id = g_strdup(id);
+
+	jabber_parser_cursor_set_data(cursor, rs,
+		(GDestroyNotify)jabber_roster_stream_free);
+
+	return JABBER_PARSER_CONTINUE;
+}
+
+static void jabber_roster_stream_end(JabberStream *js, JabberRosterStream *rs)
+{
+	if (rs->type == JABBER_IQ_SET) {
+		JabberIq *ack = jabber_iq_new(js, JABBER_IQ_RESULT);
+		jabber_iq_set_id(ack, rs->id);
+		jabber_iq_send(ack);
+	} else {
+		jabber_iq_remove_callback_by_id(js, rs->id);
+		jabber_stream_set_state(js, JABBER_STREAM_CONNECTED);
+	}
+}
+
+JabberParserAction jabber_roster_stream_parse(JabberStream *js,
+		JabberParserCursor *cursor)
+{
+	JabberRosterStream *rs = jabber_parser_cursor_get_data(cursor);
+	guint depth = jabber_parser_cursor_get_depth(cursor);
+	PurpleXmlNode *item;
+
+	switch (jabber_parser_cursor_get_event(cursor)) {
+		case JABBER_PARSER_EVENT_START:
+			if (depth == 1 && rs == NULL)
+				return jabber_roster_stream_begin(js, cursor);
+			/* Only a single item is kept in memory at a time. */
+			if (depth == 2 && purple_strequal(
+					jabber_parser_cursor_get_name(cursor), "item"))
+				return JABBER_PARSER_BUILD;
+			return JABBER_PARSER_SKIP;
+
+		case JABBER_PARSER_EVENT_END:
+			if (rs == NULL)
+				break;
+			if (depth == 0) {
+				jabber_roster_stream_end(js, rs);
+			} else if ((item = jabber_parser_cursor_get_subtree(cursor))) {
+				js->currently_parsing_roster_push = TRUE;
+				jabber_roster_parse_item(js, item);
+				js->currently_parsing_roster_push = FALSE;
+			}
+			break;
+
+		case JABBER_PARSER_EVENT_TEXT:
+			break;
+	}
+
+	return JABBER_PARSER_CONTINUE;
+}
+
 /* jabber_roster_update frees the GSList* passed in */
 static void jabber_roster_update(JabberStream *js, const char *name,
 		GSList *groups)
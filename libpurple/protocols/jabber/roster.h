@@ -28,12 +28,17 @@
 #define JABBER_ROSTER_DEFAULT_GROUP "Buddies"
 
 #include "jabber.h"
+#include "parser.h"
 
 void jabber_roster_request(JabberStream *js);
 
 void jabber_roster_parse(JabberStream *js, const char *from,
                          JabberIqType type, const char *id, PurpleXmlNode *query);
 
+/* Consumes roster pushes and results one <item/> at a time. */
+JabberParserAction jabber_roster_stream_parse(JabberStream *js,
+                                              JabberParserCursor *cursor);
+
 void jabber_roster_add_buddy(PurpleConnection *gc, PurpleBuddy *buddy,
 		PurpleGroup *group, const char *message);
 void jabber_roster_alias_change(PurpleConnection *gc, const char *name,
@@ -0,0 +1,510 @@
+/*
+ * purple - Jabber Protocol Plugin
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ *
+ */
+
+#include "internal.h"
+
+#include "debug.h"
+#include "util.h"
+
+#include "jabber.h"
+#include "sm.h"
+
+/* Ask for an ack after this many unacknowledged stanzas, or after this many
+ * seconds, whichever comes first. */
+#define JABBER_SM_REQUEST_STANZAS 5
+#define JABBER_SM_REQUEST_DELAY   5
+
+JabberSm *
+jabber_sm_new(void)
+{
+	JabberSm *sm = g_new0(JabberSm, 1);
+
+	g_queue_init(&sm->unacked);
+
+	return sm;
+}
+
+void
+jabber_sm_free(JabberSm *sm)
+{
+	if (sm == NULL)
+		return;
+
+	if (sm->request_timer)
+		purple_timeout_remove(sm->request_timer);
+	if (sm->reconnect_timer)
+		purple_timeout_remove(sm->reconnect_timer);
+	if (sm->resume_timer)
+		purple_timeout_remove(sm->resume_timer);
+
+	g_queue_foreach(&sm->unacked, (GFunc)g_bytes_unref, NULL);
+	g_queue_clear(&sm->unacked);
+	g_free(sm->id);
+	g_free(sm);
+}
+
+gboolean
+jabber_sm_is_offered(PurpleXmlNode *features)
+{
+	return purple_xmlnode_get_child_with_namespace(features, "sm",
+			NS_STREAM_MANAGEMENT) != NULL;
+}
+
+gboolean
+jabber_sm_is_stanza(PurpleXmlNode *packet)
+{
+	const char *xmlns = purple_xmlnode_get_namespace(packet);
+
+	if (xmlns != NULL && !g_str_equal(xmlns, NS_XMPP_CLIENT))
+		return FALSE;
+
+	return g_str_equal(packet->name, "message") ||
+	       g_str_equal(packet->name, "presence") ||
+	       g_str_equal(packet->name, "iq");
+}
+
+static gboolean
+jabber_sm_is_stanza_name(const char *name, gsize len)
+{
+	const char *colon = memchr(name, ':', len);
+
+	/* Whatever the prefix, raw XML sent to a client stream is in the
+	 * jabber:client namespace */
+	if (colon != NULL) {
+		len -= colon + 1 - name;
+		name = colon + 1;
+	}
+
+	return (len == 7 && strncmp(name, "message", 7) == 0) ||
+	       (len == 8 && strncmp(name, "presence", 8) == 0) ||
+	       (len == 2 && strncmp(name, "iq", 2) == 0);
+}
+
+static const char *
+jabber_sm_skip_past(const char *p, const char *end, const char *str)
+{
+	gsize len = strlen(str);
+
+	for (; p + len <= end; p++) {
+		if (memcmp(p, str, len) == 0)
+			return p + len;
+	}
+
+	return end;
+}
+
+guint
+jabber_sm_count_stanzas(const char *data, gsize len)
+{
+	const char *p = data, *end = data + len;
+	guint depth = 0, count = 0;
+
+	while (p < end && (p = memchr(p, '<', end - p)) != NULL) {
+		const char *name;
+		gsize name_len;
+		gboolean closing = FALSE, empty = FALSE;
+		char quote = '\0';
+
+		p++;
+		if (end - p >= 3 && memcmp(p, "!--", 3) == 0) {
+			p = jabber_sm_skip_past(p + 3, end, "-->");
+			continue;
+		}
+		if (end - p >= 8 && memcmp(p, "![CDATA[", 8) == 0) {
+			p = jabber_sm_skip_past(p + 8, end, "]]>");
+			continue;
+		}
+		if (p < end && (*p == '?' || *p == '!')) {
+			p = jabber_sm_skip_past(p, end, ">");
+			continue;
+		}
+		if (p < end && *p == '/') {
+			closing = TRUE;
+			p++;
+		}
+
+		name = p;
+		while (p < end && !g_ascii_isspace(*p) && *p != '/' && *p != '>')
+			p++;
+		name_len = p - name;
+
+		/* the end of the tag, which may be in an attribute value */
+		for (; p < end; p++) {
+			if (quote != '\0') {
+				if (*p == quote)
+					quote = '\0';
+			} else if (*p == '"' || *p == '\'') {
+				quote = *p;
+			} else if (*p == '>') {
+				empty = p[-1] == '/';
+				p++;
+				break;
+			}
+		}
+
+		if (closing) {
+			if (depth > 0)
+				depth--;
+			continue;
+		}
+
+		if (depth == 0 && jabber_sm_is_stanza_name(name, name_len))
+			count++;
+		if (!empty)
+			depth++;
+	}
+
+	return count;
+}
+
+static PurpleXmlNode *
+jabber_sm_new_node(const char *name)
+{
+	PurpleXmlNode *node = purple_xmlnode_new(name);
+
+	purple_xmlnode_set_namespace(node, NS_STREAM_MANAGEMENT);
+
+	return node;
+}
+
+PurpleXmlNode *
+jabber_sm_new_enable(void)
+{
+	PurpleXmlNode *enable = jabber_sm_new_node("enable");
+
+	purple_xmlnode_set_attrib(enable, "resume", "true");
+
+	return enable;
+}
+
+PurpleXmlNode *
+jabber_sm_new_request(void)
+{
+	return jabber_sm_new_node("r");
+}
+
+PurpleXmlNode *
+jabber_sm_new_ack(JabberSm *sm)
+{
+	PurpleXmlNode *ack = jabber_sm_new_node("a");
+	char *h = g_strdup_printf("%u", sm->handled);
+
+	purple_xmlnode_set_attrib(ack, "h", h);
+	g_free(h);
+
+	return ack;
+}
+
+PurpleXmlNode *
+jabber_sm_new_resume(JabberSm *sm)
+{
+	PurpleXmlNode *resume = jabber_sm_new_node("resume");
+	char *h = g_strdup_printf("%u", sm->handled);
+
+	purple_xmlnode_set_attrib(resume, "previd", sm->id);
+	purple_xmlnode_set_attrib(resume, "h", h);
+	g_free(h);
+
+	return resume;
+}
+
+void
+jabber_sm_parse_enabled(JabberSm *sm, PurpleXmlNode *enabled)
+{
+	const char *resume = purple_xmlnode_get_attrib(enabled, "resume");
+	const char *id = purple_xmlnode_get_attrib(enabled, "id");
+	const char *max = purple_xmlnode_get_attrib(enabled, "max");
+
+	sm->enabled = TRUE;
+
+	g_free(sm->id);
+	sm->id = NULL;
+	if (id && *id && (purple_strequal(resume, "true") ||
+			purple_strequal(resume, "1")))
+		sm->id = g_strdup(id);
+
+	sm->max = max ? strtoul(max, NULL, 10) : 0;
+}
+
+void
+jabber_sm_stanza_sent(JabberSm *sm, GBytes *stanza)
+{
+	g_queue_push_tail(&sm->unacked, g_bytes_ref(stanza));
+	sm->sent++;
+}
+
+gboolean
+jabber_sm_parse_ack(JabberSm *sm, PurpleXmlNode *packet)
+{
+	const char *attr = purple_xmlnode_get_attrib(packet, "h");
+	char *end;
+	guint64 h;
+	guint32 count;
+
+	if (attr == NULL || *attr == '\0')
+		return FALSE;
+
+	h = g_ascii_strtoull(attr, &end, 10);
+	if (*end != '\0' || h > G_MAXUINT32)
+		return FALSE;
+
+	/* h wraps around at 2^32, and so does the unsigned subtraction */
+	count = (guint32)h - sm->acked;
+	if (count > G_MAXINT32)
+		return FALSE;
+
+	if (count > g_queue_get_length(&sm->unacked)) {
+		/* The server counted stanzas we didn't; raw XML can hold
+		 * anything.  Carry on from its count rather than give up on
+		 * the stream. */
+		purple_debug_warning("jabber", "Server acked %u stanzas, but only "
+				"%u were waiting for an ack\n", count,
+				g_queue_get_length(&sm->unacked));
+		count = g_queue_get_length(&sm->unacked);
+		sm->sent = (guint32)h;
+	}
+
+	sm->acked = (guint32)h;
+	while (count-- > 0)
+		g_bytes_unref(g_queue_pop_head(&sm->unacked));
+
+	return TRUE;
+}
+
+static void
+jabber_sm_send(JabberStream *js, PurpleXmlNode *node)
+{
+	jabber_send(js, node);
+	purple_xmlnode_free(node);
+}
+
+static void
+jabber_sm_request_ack(JabberStream *js)
+{
+	JabberSm *sm = js->sm;
+
+	if (sm->request_timer) {
+		purple_timeout_remove(sm->request_timer);
+		sm->request_timer = 0;
+	}
+
+	sm->requested = sm->sent;
+	jabber_sm_send(js, jabber_sm_new_request());
+}
+
+static gboolean
+jabber_sm_request_timer_cb(gpointer data)
+{
+	JabberStream *js = data;
+
+	js->sm->request_timer = 0;
+	if (!js->sm->resuming && js->sm->requested != js->sm->sent)
+		jabber_sm_request_ack(js);
+
+	return FALSE;
+}
+
+/* Asks for an ack right away if enough stanzas are waiting for one, and
+ * otherwise in a while. */
+static void
+jabber_sm_schedule_request(JabberStream *js)
+{
+	JabberSm *sm = js->sm;
+
+	if (!sm->enabled || sm->resuming || sm->requested == sm->sent)
+		return;
+
+	if (sm->sent - sm->requested >= JABBER_SM_REQUEST_STANZAS)
+		jabber_sm_request_ack(js);
+	else if (sm->request_timer == 0)
+		sm->request_timer = purple_timeout_add_seconds(
+				JABBER_SM_REQUEST_DELAY, jabber_sm_request_timer_cb, js);
+}
+
+void
+jabber_sm_enable(JabberStream *js)
+{
+	if (js->sm != NULL)
+		return;
+
+	/* Outbound stanzas are counted from here on */
+	js->sm = jabber_sm_new();
+	jabber_sm_send(js, jabber_sm_new_enable());
+}
+
+void
+jabber_sm_handled(JabberStream *js)
+{
+	if (js->sm && js->sm->enabled)
+		js->sm->handled++;
+}
+
+gboolean
+jabber_sm_outbound(JabberStream *js, PurpleXmlNode *packet, GBytes *bytes)
+{
+	JabberSm *sm = js->sm;
+
+	if (sm == NULL || !jabber_sm_is_stanza(packet))
+		return TRUE;
+
+	jabber_sm_stanza_sent(sm, bytes);
+
+	/* Sent when the session is resumed */
+	if (sm->resuming)
+		return FALSE;
+
+	jabber_sm_schedule_request(js);
+
+	return TRUE;
+}
+
+gboolean
+jabber_sm_outbound_raw(JabberStream *js, GBytes *bytes)
+{
+	JabberSm *sm = js->sm;
+	GBytes *empty;
+	gconstpointer data;
+	gsize size;
+	guint count;
+
+	if (sm == NULL)
+		return TRUE;
+
+	data = g_bytes_get_data(bytes, &size);
+	count = jabber_sm_count_stanzas(data, size);
+	if (count == 0)
+		return TRUE;
+
+	/* The text can only be resent as a whole, so it takes the place of
+	 * its last stanza, and the others hold nothing.  Should only some of
+	 * them be acked, the rest are resent along with the acked ones. */
+	empty = g_bytes_new_static("", 0);
+	while (--count > 0)
+		jabber_sm_stanza_sent(sm, empty);
+	g_bytes_unref(empty);
+	jabber_sm_stanza_sent(sm, bytes);
+
+	if (sm->resuming)
+		return FALSE;
+
+	jabber_sm_schedule_request(js);
+
+	return TRUE;
+}
+
+gboolean
+jabber_sm_can_resume(JabberStream *js)
+{
+	return js->sm && js->sm->enabled && js->sm->id && !js->sm->resuming &&
+	       js->state == JABBER_STREAM_CONNECTED && !js->bosh;
+}
+
+static void
+jabber_sm_resumed(JabberStream *js, PurpleXmlNode *packet)
+{
+	JabberSm *sm = js->sm;
+	GList *l;
+	guint resent = 0;
+
+	if (!jabber_sm_parse_ack(sm, packet)) {
+		purple_connection_error(js->gc,
+			PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+			_("Invalid response from server"));
+		return;
+	}
+
+	sm->resuming = FALSE;
+	if (sm->resume_timer) {
+		purple_timeout_remove(sm->resume_timer);
+		sm->resume_timer = 0;
+	}
+
+	/* Whatever the server didn't get before, it gets now. */
+	for (l = sm->unacked.head; l; l = l->next) {
+		gsize size;
+		gconstpointer data = g_bytes_get_data(l->data, &size);
+
+		if (size == 0)
+			continue;
+
+		jabber_send_raw(js, data, size);
+		resent++;
+	}
+
+	/* The roster, presence and chats all carry on where they were. */
+	js->state = JABBER_STREAM_CONNECTED;
+	jabber_stream_restart_inactivity_timer(js);
+
+	purple_debug_info("jabber", "Session resumed in %" G_GINT64_FORMAT
+			" ms, %" G_GUINT64_FORMAT " bytes sent and %" G_GUINT64_FORMAT
+			" received, %u stanzas resent\n",
+			(g_get_monotonic_time() - sm->lost_time) / 1000,
+			js->bytes_written - sm->lost_bytes_written,
+			js->bytes_read - sm->lost_bytes_read, resent);
+
+	sm->requested = sm->acked;
+	jabber_sm_schedule_request(js);
+}
+
+void
+jabber_sm_parse(JabberStream *js, PurpleXmlNode *packet)
+{
+	JabberSm *sm = js->sm;
+	const char *name = packet->name;
+
+	if (sm == NULL) {
+		purple_debug_warning("jabber", "Ignoring spurious %s\n", name);
+		return;
+	}
+
+	if (g_str_equal(name, "r")) {
+		if (sm->enabled)
+			jabber_sm_send(js, jabber_sm_new_ack(sm));
+	} else if (g_str_equal(name, "a")) {
+		if (!jabber_sm_parse_ack(sm, packet)) {
+			purple_connection_error(js->gc,
+				PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+				_("Invalid response from server"));
+		}
+	} else if (g_str_equal(name, "enabled")) {
+		jabber_sm_parse_enabled(sm, packet);
+		purple_debug_info("jabber", "Stream management enabled%s\n",
+				sm->id ? ", the session can be resumed" : "");
+		jabber_sm_schedule_request(js);
+	} else if (g_str_equal(name, "resumed")) {
+		if (sm->resuming)
+			jabber_sm_resumed(js, packet);
+	} else if (g_str_equal(name, "failed")) {
+		if (sm->resuming) {
+			/* The session is gone; start a new one from scratch. */
+			purple_connection_error(js->gc,
+				PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+				_("Unable to resume the session"));
+		} else {
+			purple_debug_info("jabber",
+					"Server refused to enable stream management\n");
+			jabber_sm_free(sm);
+			js->sm = NULL;
+		}
+	}
+}
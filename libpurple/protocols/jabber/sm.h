@@ -0,0 +1,131 @@
+/**
+ * @file sm.h XEP-0198 Stream Management
+ *
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+#ifndef PURPLE_JABBER_SM_H_
+#define PURPLE_JABBER_SM_H_
+
+#include <glib.h>
+
+#include "xmlnode.h"
+
+typedef struct _JabberSm JabberSm;
+
+#include "jabber.h"
+
+/*
+ * The stream management state of a session.  It exists from the moment
+ * <enable/> is sent, which is when outbound stanzas start being counted,
+ * and survives the loss of the connection while the session is resumed.
+ */
+struct _JabberSm {
+	/* the server answered <enabled/>, so inbound stanzas are counted and
+	 * acks can be requested */
+	gboolean enabled;
+	/* the resumption id, or NULL if the session can't be resumed */
+	char *id;
+	/* how long the server keeps the session after losing us, in seconds */
+	guint max;
+
+	/* inbound stanzas handled */
+	guint32 handled;
+	/* outbound stanzas acknowledged by the server, and sent so far */
+	guint32 acked;
+	guint32 sent;
+	/* the GBytes of the outbound stanzas after acked, oldest first */
+	GQueue unacked;
+	/* the value of sent when an ack was last requested */
+	guint32 requested;
+	guint request_timer;
+
+	/* set from the loss of the connection until <resumed/> */
+	gboolean resuming;
+	guint reconnect_timer;
+	guint resume_timer;
+	gint64 lost_time;
+	guint64 lost_bytes_read;
+	guint64 lost_bytes_written;
+};
+
+JabberSm *jabber_sm_new(void);
+void jabber_sm_free(JabberSm *sm);
+
+/* Whether the stream features offer stream management. */
+gboolean jabber_sm_is_offered(PurpleXmlNode *features);
+
+/* Whether packet is a stanza, which is what stream management counts. */
+gboolean jabber_sm_is_stanza(PurpleXmlNode *packet);
+
+PurpleXmlNode *jabber_sm_new_enable(void);
+PurpleXmlNode *jabber_sm_new_request(void);
+PurpleXmlNode *jabber_sm_new_ack(JabberSm *sm);
+PurpleXmlNode *jabber_sm_new_resume(JabberSm *sm);
+
+/* Reads the resumption id and timeout from <enabled/>. */
+void jabber_sm_parse_enabled(JabberSm *sm, PurpleXmlNode *enabled);
+
+/* Keeps a stanza until the server acknowledges it. */
+void jabber_sm_stanza_sent(JabberSm *sm, GBytes *stanza);
+
+/*
+ * Drops the stanzas acknowledged by the h attribute of an <a/> or
+ * <resumed/>.  Returns FALSE if h is missing or behind an earlier ack.
+ * An h beyond the stanzas sent, which raw XML can lead to, is taken as
+ * the new count.
+ */
+gboolean jabber_sm_parse_ack(JabberSm *sm, PurpleXmlNode *packet);
+
+/*
+ * Called when the stream has been bound, and offered stream management
+ * along with it.
+ */
+void jabber_sm_enable(JabberStream *js);
+
+/* Counts an inbound stanza once it has been handled. */
+void jabber_sm_handled(JabberStream *js);
+
+/*
+ * Keeps track of an outbound packet.  Returns FALSE if the packet is a
+ * stanza which must not be written now because the session is being
+ * resumed; it is sent once the session has been.
+ */
+gboolean jabber_sm_outbound(JabberStream *js, PurpleXmlNode *packet,
+		GBytes *bytes);
+
+/*
+ * Like jabber_sm_outbound(), for raw XML written to the stream, such as
+ * from the XML console.
+ */
+gboolean jabber_sm_outbound_raw(JabberStream *js, GBytes *bytes);
+
+/*
+ * Counts the top-level stanzas in raw XML.  Tags split across calls
+ * aren't seen.
+ */
+guint jabber_sm_count_stanzas(const char *data, gsize len);
+
+/* Whether the session can be resumed if the connection is lost. */
+gboolean jabber_sm_can_resume(JabberStream *js);
+
+void jabber_sm_parse(JabberStream *js, PurpleXmlNode *packet);
+
+#endif /* PURPLE_JABBER_SM_H_ */
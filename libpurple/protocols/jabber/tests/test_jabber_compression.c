@@ -0,0 +1,335 @@
+#include <glib.h>
+#include <gio/gio.h>
+#include <signal.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "account.h"
+#include "buddylist.h"
+#include "tests.h"
+#include "xmlnode.h"
+#include "protocols/jabber/compression.h"
+#include "protocols/jabber/jabber.h"
+
+#include "test_jabber_mock.h"
+
+#define TEST_JABBER_COMPRESSION_BATCHES 4
+#define TEST_JABBER_COMPRESSION_STANZAS 25
+#define TEST_JABBER_COMPRESSION_UI "test-jabber-compression"
+#define TEST_JABBER_COMPRESSION_CONTACTS 500
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static void
+test_write_bytes(GSocketConnection *conn, GBytes *bytes) {
+	GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(conn));
+	GError *error = NULL;
+	gsize size;
+	gconstpointer data = g_bytes_get_data(bytes, &size);
+
+	g_output_stream_write_all(out, data, size, NULL, NULL, &error);
+	g_assert_no_error(error);
+}
+
+static gssize
+test_read(GSocketConnection *conn, char *buf, gsize len) {
+	GInputStream *in = g_io_stream_get_input_stream(G_IO_STREAM(conn));
+	GError *error = NULL;
+	gssize ret = g_input_stream_read(in, buf, len, NULL, &error);
+
+	g_assert_no_error(error);
+	g_assert_cmpint(ret, >, 0);
+
+	return ret;
+}
+
+/* Deflates a batch of stanzas one at a time, as jabber_send() would, and
+ * returns their text. */
+static GString *
+test_deflate_batch(JabberCompression *compression, guint batch) {
+	GString *str = g_string_new(NULL);
+	guint i;
+
+	for (i = 0; i < TEST_JABBER_COMPRESSION_STANZAS; i++) {
+		char *stanza = g_strdup_printf(
+			"<message to='juliet@capulet.example/balcony' "
+			"from='romeo@montague.example/orchard' type='chat' "
+			"id='m%u.%u'><body>Wherefore art thou?</body>"
+			"<active xmlns='http://jabber.org/protocol/chatstates'/>"
+			"</message>", batch, i);
+
+		g_assert_true(jabber_compression_deflate(compression, stanza,
+		                                         strlen(stanza)));
+		g_string_append(str, stanza);
+		g_free(stanza);
+	}
+
+	return str;
+}
+
+/* Logs in to a mock server which offers compression, with the account
+ * setting as given. */
+static TestMockConnection *
+test_jabber_compression_login(TestJabberClient *test,
+                              TestMockCompression compression,
+                              gboolean enabled) {
+	test_jabber_client_setup(test, TEST_JABBER_COMPRESSION_UI);
+	test->mock.compression = compression;
+	test->mock.contacts = TEST_JABBER_COMPRESSION_CONTACTS;
+	purple_account_set_bool(test->account, "compression", enabled);
+
+	test_jabber_client_login(test);
+	test_jabber_client_run_until(test, test_jabber_client_logged_in);
+
+	g_assert_nonnull(purple_blist_find_buddy(test->account,
+	                                         "contact499@montague.example"));
+	g_assert_cmpuint(test_mock_connection_count_iqs(
+		test_mock_server_current(&test->mock),
+		"urn:ietf:params:xml:ns:xmpp-bind"), ==, 1);
+
+	return test_mock_server_current(&test->mock);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_jabber_compression_offered(void) {
+	PurpleXmlNode *features;
+
+	features = purple_xmlnode_from_str(
+		"<stream:features xmlns:stream='http://etherx.jabber.org/streams'>"
+		"<compression xmlns='http://jabber.org/features/compress'>"
+		"<method>lzw</method><method>zlib</method></compression>"
+		"</stream:features>", -1);
+	g_assert_true(jabber_compression_is_offered(features));
+	purple_xmlnode_free(features);
+
+	features = purple_xmlnode_from_str(
+		"<stream:features xmlns:stream='http://etherx.jabber.org/streams'>"
+		"<compression xmlns='http://jabber.org/features/compress'>"
+		"<method>lzw</method></compression>"
+		"</stream:features>", -1);
+	g_assert_false(jabber_compression_is_offered(features));
+	purple_xmlnode_free(features);
+
+	features = purple_xmlnode_from_str(
+		"<stream:features xmlns:stream='http://etherx.jabber.org/streams'>"
+		"<bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'/>"
+		"</stream:features>", -1);
+	g_assert_false(jabber_compression_is_offered(features));
+	purple_xmlnode_free(features);
+}
+
+static void
+test_jabber_compression_request(void) {
+	PurpleXmlNode *request = jabber_compression_new_request();
+	char *str = purple_xmlnode_to_str(request, NULL);
+
+	g_assert_cmpstr(str, ==,
+		"<compress xmlns='http://jabber.org/protocol/compress'>"
+		"<method>zlib</method></compress>");
+
+	g_free(str);
+	purple_xmlnode_free(request);
+}
+
+static void
+test_jabber_compression_loopback(void) {
+	PurpleTestLoopback loopback;
+	JabberCompression *compression;
+	z_stream server_in, server_out;
+	GBytes *bytes;
+	char buf[4096];
+	guint batch;
+
+	purple_test_loopback_open(&loopback);
+
+	compression = jabber_compression_new();
+	g_assert_nonnull(compression);
+
+	/* nothing deflated, nothing to send */
+	g_assert_true(jabber_compression_flush(compression, &bytes));
+	g_assert_null(bytes);
+
+	memset(&server_in, 0, sizeof(server_in));
+	memset(&server_out, 0, sizeof(server_out));
+	g_assert_cmpint(inflateInit(&server_in), ==, Z_OK);
+	g_assert_cmpint(deflateInit(&server_out, Z_DEFAULT_COMPRESSION), ==, Z_OK);
+
+	for (batch = 0; batch < TEST_JABBER_COMPRESSION_BATCHES; batch++) {
+		GString *sent = test_deflate_batch(compression, batch);
+		GString *received = g_string_new(NULL);
+		GString *reply = g_string_new(NULL);
+		gsize len;
+
+		/* client to server: the batch goes out in one sync flush, which
+		 * the server can inflate completely without more input */
+		g_assert_true(jabber_compression_flush(compression, &bytes));
+		g_assert_nonnull(bytes);
+		g_assert_cmpuint(g_bytes_get_size(bytes), <, sent->len);
+		test_write_bytes(loopback.client, bytes);
+		g_bytes_unref(bytes);
+
+		while (received->len < sent->len) {
+			char out[4096];
+			gssize ret = test_read(loopback.server, buf, sizeof(buf));
+
+			server_in.next_in = (Bytef *)buf;
+			server_in.avail_in = ret;
+			do {
+				int zret;
+
+				server_in.next_out = (Bytef *)out;
+				server_in.avail_out = sizeof(out);
+				zret = inflate(&server_in, Z_SYNC_FLUSH);
+				g_assert_true(zret == Z_OK || zret == Z_BUF_ERROR);
+				g_string_append_len(received, out,
+				                    sizeof(out) - server_in.avail_out);
+			} while (server_in.avail_in > 0 || server_in.avail_out == 0);
+		}
+		g_assert_cmpstr(received->str, ==, sent->str);
+
+		/* server to client */
+		server_out.next_in = (Bytef *)sent->str;
+		server_out.avail_in = sent->len;
+		do {
+			char out[4096];
+			GBytes *chunk;
+
+			server_out.next_out = (Bytef *)out;
+			server_out.avail_out = sizeof(out);
+			g_assert_cmpint(deflate(&server_out, Z_SYNC_FLUSH), ==, Z_OK);
+			chunk = g_bytes_new(out, sizeof(out) - server_out.avail_out);
+			test_write_bytes(loopback.server, chunk);
+			g_bytes_unref(chunk);
+		} while (server_out.avail_out == 0);
+
+		while (reply->len < sent->len) {
+			gssize ret = test_read(loopback.client, buf, sizeof(buf));
+			const char *data;
+
+			data = jabber_compression_inflate(compression, buf, ret, &len);
+			g_assert_nonnull(data);
+			g_assert_cmpuint(strlen(data), ==, len);
+			g_string_append_len(reply, data, len);
+		}
+		g_assert_cmpstr(reply->str, ==, sent->str);
+
+		g_string_free(sent, TRUE);
+		g_string_free(received, TRUE);
+		g_string_free(reply, TRUE);
+	}
+
+	g_assert_cmpfloat(jabber_compression_get_ratio(compression), <, 0.5);
+
+	inflateEnd(&server_in);
+	deflateEnd(&server_out);
+	jabber_compression_free(compression);
+	purple_test_loopback_close(&loopback);
+}
+
+static void
+test_jabber_compression_corrupt(void) {
+	JabberCompression *compression = jabber_compression_new();
+
+	g_assert_nonnull(compression);
+	g_assert_null(jabber_compression_inflate(compression,
+	                                         "<not compressed/>", 17, NULL));
+
+	jabber_compression_free(compression);
+}
+
+/* The client asks for compression once authenticated, and restarts the
+ * stream compressed when the server agrees. */
+static void
+test_jabber_compression_stream(void) {
+	TestJabberClient test;
+	TestMockConnection *conn;
+	JabberStream *js;
+
+	conn = test_jabber_compression_login(&test, TEST_MOCK_COMPRESSION_ZLIB,
+	                                     TRUE);
+	js = test_jabber_client_stream(&test);
+
+	g_assert_cmpuint(test_mock_connection_count(conn, "compress",
+		"http://jabber.org/protocol/compress"), ==, 1);
+	g_assert_true(conn->compressed);
+	g_assert_nonnull(js->compression);
+	/* before authentication, after it, and once compressed */
+	g_assert_cmpuint(conn->streams, ==, 3);
+
+	/* it goes on compressed both ways */
+	test_jabber_client_sync(&test);
+	g_assert_cmpfloat(jabber_compression_get_ratio(js->compression), <, 0.5);
+
+	test_jabber_client_teardown(&test);
+}
+
+/* A server which refuses leaves the stream uncompressed, and the client
+ * binds its resource on it. */
+static void
+test_jabber_compression_refused(void) {
+	TestJabberClient test;
+	TestMockConnection *conn;
+
+	conn = test_jabber_compression_login(&test, TEST_MOCK_COMPRESSION_FAIL,
+	                                     TRUE);
+
+	g_assert_cmpuint(test_mock_connection_count(conn, "compress",
+		"http://jabber.org/protocol/compress"), ==, 1);
+	g_assert_false(conn->compressed);
+	g_assert_null(test_jabber_client_stream(&test)->compression);
+	g_assert_cmpuint(conn->streams, ==, 2);
+	test_jabber_client_sync(&test);
+
+	test_jabber_client_teardown(&test);
+}
+
+/* Unless the user turns it on, compression isn't asked for. */
+static void
+test_jabber_compression_disabled(void) {
+	TestJabberClient test;
+	TestMockConnection *conn;
+
+	conn = test_jabber_compression_login(&test, TEST_MOCK_COMPRESSION_ZLIB,
+	                                     FALSE);
+
+	g_assert_cmpuint(test_mock_connection_count(conn, "compress",
+		"http://jabber.org/protocol/compress"), ==, 0);
+	g_assert_false(conn->compressed);
+	g_assert_null(test_jabber_client_stream(&test)->compression);
+
+	test_jabber_client_teardown(&test);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+#ifndef _WIN32
+	/* the client may write to a connection the mock server dropped */
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	g_test_add_func("/jabber/compression/offered",
+	                test_jabber_compression_offered);
+	g_test_add_func("/jabber/compression/request",
+	                test_jabber_compression_request);
+	g_test_add_func("/jabber/compression/loopback",
+	                test_jabber_compression_loopback);
+	g_test_add_func("/jabber/compression/corrupt",
+	                test_jabber_compression_corrupt);
+	g_test_add_func("/jabber/compression/stream",
+	                test_jabber_compression_stream);
+	g_test_add_func("/jabber/compression/refused",
+	                test_jabber_compression_refused);
+	g_test_add_func("/jabber/compression/disabled",
+	                test_jabber_compression_disabled);
+
+	return g_test_run();
+}
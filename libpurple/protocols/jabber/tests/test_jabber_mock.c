@@ -0,0 +1,815 @@
+/*
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "account.h"
+#include "accounts.h"
+#include "connection.h"
+#include "core.h"
+#include "eventloop.h"
+#include "plugins.h"
+#include "protocols.h"
+#include "signals.h"
+#include "tests.h"
+#include "util.h"
+#include "xmlnode.h"
+#include "protocols/jabber/jabber.h"
+#include "protocols/jabber/sm.h"
+
+#include "test_jabber_mock.h"
+
+/******************************************************************************
+ * Event loop
+ *****************************************************************************/
+#define TEST_GLIB_READ_COND  (G_IO_IN | G_IO_HUP | G_IO_ERR)
+#define TEST_GLIB_WRITE_COND (G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL)
+
+typedef struct {
+	PurpleInputFunction function;
+	gpointer data;
+} TestGLibIOClosure;
+
+static gboolean
+test_glib_io_invoke(GIOChannel *source, GIOCondition condition,
+                    gpointer data) {
+	TestGLibIOClosure *closure = data;
+	PurpleInputCondition purple_cond = 0;
+
+	if (condition & TEST_GLIB_READ_COND)
+		purple_cond |= PURPLE_INPUT_READ;
+	if (condition & TEST_GLIB_WRITE_COND)
+		purple_cond |= PURPLE_INPUT_WRITE;
+
+	closure->function(closure->data, g_io_channel_unix_get_fd(source),
+	                  purple_cond);
+
+	return TRUE;
+}
+
+static guint
+test_glib_input_add(gint fd, PurpleInputCondition condition,
+                    PurpleInputFunction function, gpointer data) {
+	TestGLibIOClosure *closure = g_new0(TestGLibIOClosure, 1);
+	GIOChannel *channel = g_io_channel_unix_new(fd);
+	GIOCondition cond = 0;
+	guint ret;
+
+	closure->function = function;
+	closure->data = data;
+
+	if (condition & PURPLE_INPUT_READ)
+		cond |= TEST_GLIB_READ_COND;
+	if (condition & PURPLE_INPUT_WRITE)
+		cond |= TEST_GLIB_WRITE_COND;
+
+	ret = g_io_add_watch_full(channel, G_PRIORITY_DEFAULT, cond,
+	                          test_glib_io_invoke, closure, g_free);
+	g_io_channel_unref(channel);
+
+	return ret;
+}
+
+static PurpleEventLoopUiOps test_eventloop_ops = {
+	g_timeout_add,
+	g_source_remove,
+	test_glib_input_add,
+	g_source_remove,
+	NULL,
+	g_timeout_add_seconds,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+/******************************************************************************
+ * Mock server
+ *****************************************************************************/
+static void
+test_mock_connection_free(TestMockConnection *conn) {
+	if (conn->flush_id)
+		g_source_remove(conn->flush_id);
+	g_queue_foreach(&conn->pending, (GFunc)g_bytes_unref, NULL);
+	g_queue_clear(&conn->pending);
+
+	if (conn->compressed) {
+		inflateEnd(&conn->zin);
+		deflateEnd(&conn->zout);
+	}
+
+	g_source_destroy(conn->source);
+	g_source_unref(conn->source);
+	g_socket_close(conn->socket, NULL);
+	g_object_unref(conn->socket);
+	g_string_free(conn->buf, TRUE);
+	g_ptr_array_free(conn->received, TRUE);
+	g_free(conn);
+}
+
+TestMockConnection *
+test_mock_server_current(TestMockServer *mock) {
+	g_assert_cmpuint(mock->connections->len, >, 0);
+
+	return g_ptr_array_index(mock->connections, mock->connections->len - 1);
+}
+
+static void
+test_mock_connection_send(TestMockConnection *conn, const char *data,
+                          gsize len) {
+	gsize written = 0;
+	GError *error = NULL;
+
+	while (written < len) {
+		gssize ret = g_socket_send_with_blocking(conn->socket, data + written,
+		                                         len - written, TRUE, NULL,
+		                                         &error);
+
+		g_assert_no_error(error);
+		written += ret;
+	}
+
+	conn->bytes += len;
+}
+
+static gboolean
+test_mock_connection_flush_cb(gpointer data) {
+	TestMockConnection *conn = data;
+	GBytes *piece = g_queue_pop_head(&conn->pending);
+	gsize len;
+	const char *str = g_bytes_get_data(piece, &len);
+
+	test_mock_connection_send(conn, str, len);
+	g_bytes_unref(piece);
+
+	if (g_queue_is_empty(&conn->pending)) {
+		conn->flush_id = 0;
+		return G_SOURCE_REMOVE;
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+/* Deflates data for a compressed stream, flushing it all out. */
+static GString *
+test_mock_connection_deflate(TestMockConnection *conn, const char *data,
+                             gsize len) {
+	GString *out = g_string_new(NULL);
+	char buf[4096];
+
+	conn->zout.next_in = (Bytef *)data;
+	conn->zout.avail_in = len;
+	do {
+		conn->zout.next_out = (Bytef *)buf;
+		conn->zout.avail_out = sizeof(buf);
+		g_assert_cmpint(deflate(&conn->zout, Z_SYNC_FLUSH), ==, Z_OK);
+		g_string_append_len(out, buf, sizeof(buf) - conn->zout.avail_out);
+	} while (conn->zout.avail_out == 0);
+
+	return out;
+}
+
+void
+test_mock_connection_write(TestMockConnection *conn, const char *data) {
+	TestMockServer *mock = conn->mock;
+	GString *compressed = NULL;
+	gsize len = strlen(data), offset;
+
+	if (conn->compressed) {
+		compressed = test_mock_connection_deflate(conn, data, len);
+		data = compressed->str;
+		len = compressed->len;
+	}
+
+	if (mock->split == 0 && len <= TEST_JABBER_MOCK_WRITE_MAX &&
+	    g_queue_is_empty(&conn->pending)) {
+		test_mock_connection_send(conn, data, len);
+	} else {
+		gsize split = mock->split ? mock->split : TEST_JABBER_MOCK_WRITE_MAX;
+
+		for (offset = 0; offset < len; offset += split) {
+			g_queue_push_tail(&conn->pending,
+				g_bytes_new(data + offset, MIN(split, len - offset)));
+		}
+		if (conn->flush_id == 0) {
+			conn->flush_id = g_idle_add(test_mock_connection_flush_cb,
+			                            conn);
+		}
+	}
+
+	if (compressed)
+		g_string_free(compressed, TRUE);
+}
+
+void
+test_mock_connection_send_stanza(TestMockConnection *conn, const char *data) {
+	test_mock_connection_write(conn, data);
+
+	if (conn->mock->enabled)
+		conn->mock->stanzas_out++;
+}
+
+/* Answers a request the client is waiting for. */
+static void
+test_mock_connection_reply(TestMockConnection *conn, const char *data,
+                           gboolean stanza) {
+	conn->round_trips++;
+
+	if (stanza)
+		test_mock_connection_send_stanza(conn, data);
+	else
+		test_mock_connection_write(conn, data);
+}
+
+static void
+test_mock_connection_features(TestMockConnection *conn) {
+	TestMockServer *mock = conn->mock;
+	const char *compression = "";
+	char *features;
+
+	if (mock->compression != TEST_MOCK_COMPRESSION_NONE && !conn->compressed)
+		compression = "<compression xmlns='http://jabber.org/features/compress'>"
+		              "<method>zlib</method></compression>";
+
+	features = g_strdup_printf(
+		"<?xml version='1.0'?><stream:stream from='capulet.example' "
+		"id='s%u.%u' xmlns='jabber:client' "
+		"xmlns:stream='http://etherx.jabber.org/streams' version='1.0'>"
+		"<stream:features>%s%s</stream:features>",
+		mock->connections->len, conn->streams,
+		conn->authenticated ?
+			"<bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'/>"
+			"<sm xmlns='urn:xmpp:sm:3'/>" :
+			"<mechanisms xmlns='urn:ietf:params:xml:ns:xmpp-sasl'>"
+			"<mechanism>PLAIN</mechanism></mechanisms>",
+		conn->authenticated ? compression : "");
+
+	test_mock_connection_reply(conn, features, FALSE);
+	g_free(features);
+}
+
+/* The names have entities in them, so that the client has some unescaping
+ * to do. */
+char *
+test_mock_roster(const char *id, guint contacts) {
+	GString *roster = g_string_new(NULL);
+	guint i;
+
+	g_string_printf(roster, "<iq type='result' id='%s'>"
+	                        "<query xmlns='jabber:iq:roster' ver='v1'>", id);
+	for (i = 0; i < contacts; i++) {
+		g_string_append_printf(roster,
+			"<item jid='contact%u@montague.example' "
+			"name='Contact %u &lt;%u&gt;' subscription='both'>"
+			"<group>Friends &amp; Family</group></item>", i, i, i);
+	}
+	g_string_append(roster, "</query></iq>");
+
+	return g_string_free(roster, FALSE);
+}
+
+static void
+test_mock_connection_iq(TestMockConnection *conn, PurpleXmlNode *iq) {
+	const char *type = purple_xmlnode_get_attrib(iq, "type");
+	const char *id = purple_xmlnode_get_attrib(iq, "id");
+	const char *to = purple_xmlnode_get_attrib(iq, "to");
+	char *reply;
+
+	/* results and errors need no answer */
+	if (!purple_strequal(type, "get") && !purple_strequal(type, "set"))
+		return;
+
+	if (purple_xmlnode_get_child_with_namespace(iq, "bind",
+			"urn:ietf:params:xml:ns:xmpp-bind")) {
+		reply = g_strdup_printf("<iq type='result' id='%s'>"
+			"<bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'>"
+			"<jid>juliet@capulet.example/balcony</jid></bind></iq>", id);
+	} else if (purple_xmlnode_get_child_with_namespace(iq, "query",
+			"jabber:iq:roster")) {
+		reply = test_mock_roster(id, conn->mock->contacts);
+	} else if (to != NULL) {
+		reply = g_strdup_printf("<iq type='result' id='%s' from='%s'/>",
+		                        id, to);
+	} else {
+		reply = g_strdup_printf("<iq type='result' id='%s'/>", id);
+	}
+
+	test_mock_connection_reply(conn, reply, TRUE);
+	g_free(reply);
+}
+
+static void
+test_mock_connection_compress(TestMockConnection *conn) {
+	if (conn->mock->compression != TEST_MOCK_COMPRESSION_ZLIB) {
+		test_mock_connection_reply(conn,
+			"<failure xmlns='http://jabber.org/protocol/compress'>"
+			"<setup-failed/></failure>", FALSE);
+		return;
+	}
+
+	/* everything after this answer is compressed, both ways */
+	test_mock_connection_reply(conn,
+		"<compressed xmlns='http://jabber.org/protocol/compress'/>", FALSE);
+
+	memset(&conn->zin, 0, sizeof(conn->zin));
+	memset(&conn->zout, 0, sizeof(conn->zout));
+	g_assert_cmpint(inflateInit(&conn->zin), ==, Z_OK);
+	g_assert_cmpint(deflateInit(&conn->zout, Z_DEFAULT_COMPRESSION), ==,
+	                Z_OK);
+	conn->compressed = TRUE;
+}
+
+static void
+test_mock_connection_handle(TestMockConnection *conn, PurpleXmlNode *node) {
+	TestMockServer *mock = conn->mock;
+	const char *name = node->name;
+	char *reply;
+
+	g_ptr_array_add(conn->received, node);
+
+	if (mock->enabled && jabber_sm_is_stanza(node))
+		mock->stanzas_in++;
+
+	if (g_str_equal(name, "auth")) {
+		conn->authenticated = TRUE;
+		test_mock_connection_reply(conn,
+			"<success xmlns='urn:ietf:params:xml:ns:xmpp-sasl'/>", FALSE);
+	} else if (g_str_equal(name, "compress")) {
+		test_mock_connection_compress(conn);
+	} else if (g_str_equal(name, "enable")) {
+		/* both ends count from here */
+		mock->enabled = TRUE;
+		mock->stanzas_in = mock->stanzas_out = 0;
+		test_mock_connection_reply(conn,
+			"<enabled xmlns='urn:xmpp:sm:3' id='sm-1' resume='true'/>",
+			FALSE);
+	} else if (g_str_equal(name, "r")) {
+		reply = g_strdup_printf("<a xmlns='urn:xmpp:sm:3' h='%u'/>",
+		                        mock->stanzas_in);
+		test_mock_connection_reply(conn, reply, FALSE);
+		g_free(reply);
+	} else if (g_str_equal(name, "a")) {
+		mock->client_h = strtoul(purple_xmlnode_get_attrib(node, "h"),
+		                         NULL, 10);
+		mock->acks++;
+	} else if (g_str_equal(name, "resume")) {
+		mock->resume_h = g_ascii_strtoll(purple_xmlnode_get_attrib(node, "h"),
+		                                 NULL, 10);
+		reply = g_strdup_printf("<resumed xmlns='urn:xmpp:sm:3' "
+		                        "previd='sm-1' h='%u'/>", mock->stanzas_in);
+		test_mock_connection_reply(conn, reply, FALSE);
+		g_free(reply);
+	} else if (g_str_equal(name, "iq")) {
+		test_mock_connection_iq(conn, node);
+	} else if (g_str_equal(name, "presence")) {
+		if (purple_xmlnode_get_attrib(node, "to") == NULL)
+			mock->presence = TRUE;
+	}
+}
+
+/* Returns the length of the element at the start of data, or 0 if it
+ * hasn't arrived completely yet. */
+static gsize
+test_mock_element_length(const char *data, gsize len) {
+	const char *p = data, *end = data + len;
+	guint depth = 0;
+
+	while ((p = memchr(p, '<', end - p)) != NULL) {
+		gboolean closing = p + 1 < end && p[1] == '/';
+		char quote = '\0';
+
+		for (p++; p < end; p++) {
+			if (quote != '\0') {
+				if (*p == quote)
+					quote = '\0';
+			} else if (*p == '"' || *p == '\'') {
+				quote = *p;
+			} else if (*p == '>') {
+				break;
+			}
+		}
+		if (p == end)
+			return 0;
+
+		if (closing)
+			depth--;
+		else if (p[-1] != '/')
+			depth++;
+		p++;
+
+		if (depth == 0)
+			return p - data;
+	}
+
+	return 0;
+}
+
+static void
+test_mock_connection_process(TestMockConnection *conn) {
+	GString *buf = conn->buf;
+
+	for (;;) {
+		const char *end;
+		gsize skip = 0;
+
+		while (skip < buf->len && g_ascii_isspace(buf->str[skip]))
+			skip++;
+		g_string_erase(buf, 0, skip);
+
+		if (buf->len == 0)
+			return;
+
+		if (g_str_has_prefix(buf->str, "<?xml")) {
+			if ((end = strstr(buf->str, "?>")) == NULL)
+				return;
+			g_string_erase(buf, 0, end + 2 - buf->str);
+		} else if (g_str_has_prefix(buf->str, "<stream:stream")) {
+			if ((end = strchr(buf->str, '>')) == NULL)
+				return;
+			g_string_erase(buf, 0, end + 1 - buf->str);
+			conn->streams++;
+			test_mock_connection_features(conn);
+		} else if (g_str_has_prefix(buf->str, "</stream:stream>")) {
+			g_string_erase(buf, 0, strlen("</stream:stream>"));
+		} else {
+			gsize len = test_mock_element_length(buf->str, buf->len);
+			PurpleXmlNode *node;
+
+			if (len == 0)
+				return;
+
+			node = purple_xmlnode_from_str(buf->str, len);
+			g_assert_nonnull(node);
+			g_string_erase(buf, 0, len);
+			test_mock_connection_handle(conn, node);
+		}
+	}
+}
+
+static void
+test_mock_connection_inflate(TestMockConnection *conn, const char *data,
+                             gsize len) {
+	char buf[4096];
+
+	conn->zin.next_in = (Bytef *)data;
+	conn->zin.avail_in = len;
+	do {
+		int ret;
+
+		conn->zin.next_out = (Bytef *)buf;
+		conn->zin.avail_out = sizeof(buf);
+		ret = inflate(&conn->zin, Z_SYNC_FLUSH);
+		g_assert_true(ret == Z_OK || ret == Z_BUF_ERROR);
+		g_string_append_len(conn->buf, buf,
+		                    sizeof(buf) - conn->zin.avail_out);
+	} while (conn->zin.avail_in > 0 || conn->zin.avail_out == 0);
+}
+
+static gboolean
+test_mock_connection_read_cb(GSocket *socket, GIOCondition condition,
+                             gpointer data) {
+	TestMockConnection *conn = data;
+	GError *error = NULL;
+	char buf[4096];
+	gssize len;
+
+	len = g_socket_receive_with_blocking(socket, buf, sizeof(buf), FALSE,
+	                                     NULL, &error);
+	if (len < 0 && g_error_matches(error, G_IO_ERROR,
+	                               G_IO_ERROR_WOULD_BLOCK)) {
+		g_error_free(error);
+		return G_SOURCE_CONTINUE;
+	}
+	g_clear_error(&error);
+
+	/* the client went away */
+	if (len <= 0)
+		return G_SOURCE_REMOVE;
+
+	conn->bytes += len;
+	if (conn->compressed)
+		test_mock_connection_inflate(conn, buf, len);
+	else
+		g_string_append_len(conn->buf, buf, len);
+	test_mock_connection_process(conn);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+test_mock_server_accept_cb(GObject *source, GAsyncResult *result,
+                           gpointer data) {
+	TestMockServer *mock = data;
+	TestMockConnection *conn;
+	GError *error = NULL;
+	GSocket *socket;
+
+	socket = g_socket_listener_accept_socket_finish(G_SOCKET_LISTENER(source),
+	                                                result, NULL, &error);
+	if (socket == NULL) {
+		/* the server is gone */
+		g_error_free(error);
+		return;
+	}
+
+	conn = g_new0(TestMockConnection, 1);
+	conn->mock = mock;
+	conn->socket = socket;
+	conn->buf = g_string_new(NULL);
+	conn->received = g_ptr_array_new_with_free_func(
+		(GDestroyNotify)purple_xmlnode_free);
+	g_queue_init(&conn->pending);
+	conn->source = g_socket_create_source(socket,
+	                                      G_IO_IN | G_IO_HUP | G_IO_ERR,
+	                                      NULL);
+	g_source_set_callback(conn->source,
+	                      (GSourceFunc)test_mock_connection_read_cb, conn,
+	                      NULL);
+	g_source_attach(conn->source, NULL);
+	g_ptr_array_add(mock->connections, conn);
+
+	g_socket_listener_accept_socket_async(mock->listener, mock->cancellable,
+	                                      test_mock_server_accept_cb, mock);
+}
+
+void
+test_mock_server_open(TestMockServer *mock) {
+	GSocketAddress *address;
+
+	memset(mock, 0, sizeof(*mock));
+	mock->contacts = TEST_JABBER_MOCK_CONTACTS;
+	mock->resume_h = -1;
+	mock->connections = g_ptr_array_new_with_free_func(
+		(GDestroyNotify)test_mock_connection_free);
+	mock->cancellable = g_cancellable_new();
+
+	mock->listener = g_socket_listener_new();
+	address = purple_test_loopback_listen(mock->listener);
+	mock->port = g_inet_socket_address_get_port(
+		G_INET_SOCKET_ADDRESS(address));
+	g_object_unref(address);
+
+	g_socket_listener_accept_socket_async(mock->listener, mock->cancellable,
+	                                      test_mock_server_accept_cb, mock);
+}
+
+void
+test_mock_server_close(TestMockServer *mock) {
+	g_cancellable_cancel(mock->cancellable);
+	g_object_unref(mock->cancellable);
+	g_socket_listener_close(mock->listener);
+	g_object_unref(mock->listener);
+	g_ptr_array_free(mock->connections, TRUE);
+}
+
+/* Loses the connection, like a network outage would, but keeps the
+ * session for the client to resume. */
+void
+test_mock_server_drop(TestMockServer *mock) {
+	TestMockConnection *conn = test_mock_server_current(mock);
+
+	if (conn->flush_id) {
+		g_source_remove(conn->flush_id);
+		conn->flush_id = 0;
+	}
+	g_source_destroy(conn->source);
+	g_socket_close(conn->socket, NULL);
+}
+
+/* Counts the top-level elements a connection got with the given name and
+ * namespace. */
+guint
+test_mock_connection_count(TestMockConnection *conn, const char *name,
+                           const char *xmlns) {
+	guint i, count = 0;
+
+	for (i = 0; i < conn->received->len; i++) {
+		PurpleXmlNode *node = g_ptr_array_index(conn->received, i);
+
+		if (g_str_equal(node->name, name) &&
+		    purple_strequal(purple_xmlnode_get_namespace(node), xmlns))
+			count++;
+	}
+
+	return count;
+}
+
+/* Counts the iqs a connection got with a child in the namespace xmlns. */
+guint
+test_mock_connection_count_iqs(TestMockConnection *conn, const char *xmlns) {
+	guint i, count = 0;
+
+	for (i = 0; i < conn->received->len; i++) {
+		PurpleXmlNode *node = g_ptr_array_index(conn->received, i), *child;
+
+		if (!g_str_equal(node->name, "iq"))
+			continue;
+
+		for (child = node->child; child; child = child->next) {
+			if (child->type == PURPLE_XMLNODE_TYPE_TAG &&
+			    purple_strequal(purple_xmlnode_get_namespace(child),
+			                    xmlns)) {
+				count++;
+				break;
+			}
+		}
+	}
+
+	return count;
+}
+
+guint
+test_mock_connection_count_results(TestMockConnection *conn, const char *id) {
+	guint i, count = 0;
+
+	for (i = 0; i < conn->received->len; i++) {
+		PurpleXmlNode *node = g_ptr_array_index(conn->received, i);
+
+		if (g_str_equal(node->name, "iq") &&
+		    purple_strequal(purple_xmlnode_get_attrib(node, "type"),
+		                    "result") &&
+		    purple_strequal(purple_xmlnode_get_attrib(node, "id"), id))
+			count++;
+	}
+
+	return count;
+}
+
+guint
+test_mock_connection_count_messages(TestMockConnection *conn,
+                                    const char *body) {
+	guint i, count = 0;
+
+	for (i = 0; i < conn->received->len; i++) {
+		PurpleXmlNode *node = g_ptr_array_index(conn->received, i);
+		char *data;
+
+		if (!g_str_equal(node->name, "message") ||
+		    (node = purple_xmlnode_get_child(node, "body")) == NULL)
+			continue;
+
+		data = purple_xmlnode_get_data(node);
+		if (purple_strequal(data, body))
+			count++;
+		g_free(data);
+	}
+
+	return count;
+}
+
+/******************************************************************************
+ * Client
+ *****************************************************************************/
+static gboolean
+test_jabber_client_wakeup_cb(gpointer data) {
+	return G_SOURCE_CONTINUE;
+}
+
+void
+test_jabber_client_run_until(TestJabberClient *test,
+                             TestJabberClientCondition done) {
+	gint64 deadline = g_get_monotonic_time() +
+	                  TEST_JABBER_MOCK_TIMEOUT * G_USEC_PER_SEC;
+	guint wakeup = g_timeout_add(100, test_jabber_client_wakeup_cb, NULL);
+
+	while (!done(test)) {
+		g_assert_cmpint(g_get_monotonic_time(), <, deadline);
+		g_main_context_iteration(NULL, TRUE);
+	}
+
+	g_source_remove(wakeup);
+}
+
+JabberStream *
+test_jabber_client_stream(TestJabberClient *test) {
+	PurpleConnection *gc = purple_account_get_connection(test->account);
+
+	return gc ? purple_connection_get_protocol_data(gc) : NULL;
+}
+
+gboolean
+test_jabber_client_logged_in(TestJabberClient *test) {
+	JabberStream *js = test_jabber_client_stream(test);
+
+	return js && js->state == JABBER_STREAM_CONNECTED && test->mock.presence;
+}
+
+static gboolean
+test_jabber_client_acked(TestJabberClient *test) {
+	return test->mock.acks > test->acks;
+}
+
+/* It must have counted every stanza the server sent. */
+void
+test_jabber_client_sync(TestJabberClient *test) {
+	test->acks = test->mock.acks;
+	test_mock_connection_write(test_mock_server_current(&test->mock),
+	                           "<r xmlns='urn:xmpp:sm:3'/>");
+	test_jabber_client_run_until(test, test_jabber_client_acked);
+
+	g_assert_cmpuint(test->mock.client_h, ==, test->mock.stanzas_out);
+}
+
+static void
+test_jabber_client_connection_error_cb(PurpleConnection *gc,
+                                       PurpleConnectionError reason,
+                                       const char *description,
+                                       gpointer data) {
+	g_test_message("connection error: %s", description);
+	g_assert_not_reached();
+}
+
+static void
+test_jabber_client_remove_dir(const char *path) {
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const char *name;
+
+	while (dir && (name = g_dir_read_name(dir)) != NULL) {
+		char *child = g_build_filename(path, name, NULL);
+
+		if (g_file_test(child, G_FILE_TEST_IS_DIR))
+			test_jabber_client_remove_dir(child);
+		else
+			g_unlink(child);
+		g_free(child);
+	}
+
+	if (dir)
+		g_dir_close(dir);
+	g_rmdir(path);
+}
+
+void
+test_jabber_client_setup(TestJabberClient *test, const char *ui) {
+	GError *error = NULL;
+
+	memset(test, 0, sizeof(*test));
+
+	test->user_dir = g_dir_make_tmp("test_jabber-XXXXXX", &error);
+	g_assert_no_error(error);
+	purple_util_set_user_dir(test->user_dir);
+
+	g_setenv("PURPLE_PLUGIN_PATH", TEST_JABBER_PLUGIN_DIR, TRUE);
+	purple_eventloop_set_ui_ops(&test_eventloop_ops);
+	g_assert_true(purple_core_init(ui));
+	purple_plugins_refresh();
+	g_assert_nonnull(purple_protocols_find("prpl-jabber"));
+
+	purple_signal_connect(purple_connections_get_handle(), "connection-error",
+	                      test,
+	                      PURPLE_CALLBACK(test_jabber_client_connection_error_cb),
+	                      NULL);
+
+	test_mock_server_open(&test->mock);
+
+	test->account = purple_account_new("juliet@capulet.example/balcony",
+	                                   "prpl-jabber");
+	purple_account_set_remember_password(test->account, FALSE);
+	purple_account_set_password(test->account, "r0m30myr0m30", NULL, NULL);
+	purple_account_set_string(test->account, "connect_server", "127.0.0.1");
+	purple_account_set_int(test->account, "port", test->mock.port);
+	purple_account_set_string(test->account, "connection_security",
+	                          "opportunistic_tls");
+	purple_account_set_bool(test->account, "auth_plain_in_clear", TRUE);
+	purple_accounts_add(test->account);
+}
+
+/* Connects the account; test_jabber_client_logged_in() tells when it is
+ * done. */
+void
+test_jabber_client_login(TestJabberClient *test) {
+	purple_account_set_status(test->account, "available", TRUE, NULL);
+	purple_account_set_enabled(test->account, purple_core_get_ui(), TRUE);
+}
+
+void
+test_jabber_client_teardown(TestJabberClient *test) {
+	purple_signals_disconnect_by_handle(test);
+	purple_core_quit();
+	test_mock_server_close(&test->mock);
+
+	test_jabber_client_remove_dir(test->user_dir);
+	g_free(test->user_dir);
+}
@@ -0,0 +1,158 @@
+/*
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+#ifndef PURPLE_JABBER_TEST_MOCK_H
+#define PURPLE_JABBER_TEST_MOCK_H
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <zlib.h>
+
+#include "account.h"
+#include "xmlnode.h"
+#include "protocols/jabber/jabber.h"
+
+#define TEST_JABBER_MOCK_CONTACTS 50
+#define TEST_JABBER_MOCK_TIMEOUT 10
+/* Anything longer is written a piece at a time, as the client reads it,
+ * rather than overflowing the socket buffers. */
+#define TEST_JABBER_MOCK_WRITE_MAX 16384
+
+/******************************************************************************
+ * Mock server
+ *****************************************************************************/
+typedef struct _TestMockServer TestMockServer;
+
+typedef enum {
+	TEST_MOCK_COMPRESSION_NONE,
+	/* offer zlib, and compress the stream when asked to */
+	TEST_MOCK_COMPRESSION_ZLIB,
+	/* offer zlib, but refuse it when asked to */
+	TEST_MOCK_COMPRESSION_FAIL
+} TestMockCompression;
+
+/* One connection of the client to the mock server */
+typedef struct {
+	TestMockServer *mock;
+	GSocket *socket;
+	GSource *source;
+	GString *buf;
+	gboolean authenticated;
+	/* the top-level elements the client sent, in order */
+	GPtrArray *received;
+	/* the stream headers the client sent */
+	guint streams;
+	guint64 bytes;
+	guint round_trips;
+
+	/* pieces of the output, which go out one main loop iteration at a
+	 * time */
+	GQueue pending;
+	guint flush_id;
+
+	gboolean compressed;
+	z_stream zin;
+	z_stream zout;
+} TestMockConnection;
+
+/* An XMPP server on 127.0.0.1 which logs anyone in, and keeps a single
+ * session with stream management going from one connection to the next.
+ * It runs in the main loop along with the client; whatever it writes has
+ * to fit in the socket buffers until the client reads it. */
+struct _TestMockServer {
+	GSocketListener *listener;
+	GCancellable *cancellable;
+	guint16 port;
+	GPtrArray *connections;
+
+	/* the number of contacts on the roster */
+	guint contacts;
+	/* if not 0, the output is split into pieces of this many bytes, so
+	 * that the client reads them one by one */
+	gsize split;
+	TestMockCompression compression;
+
+	gboolean enabled;
+	/* stanzas received and sent since <enable/> */
+	guint32 stanzas_in;
+	guint32 stanzas_out;
+	/* the h of the client's last <a/>, and how many it sent */
+	guint32 client_h;
+	guint acks;
+	/* the h of the client's <resume/>, or -1 */
+	gint64 resume_h;
+	/* whether the client sent its initial presence */
+	gboolean presence;
+};
+
+void test_mock_server_open(TestMockServer *mock);
+void test_mock_server_close(TestMockServer *mock);
+TestMockConnection *test_mock_server_current(TestMockServer *mock);
+void test_mock_server_drop(TestMockServer *mock);
+
+void test_mock_connection_write(TestMockConnection *conn, const char *data);
+void test_mock_connection_send_stanza(TestMockConnection *conn,
+                                      const char *data);
+
+guint test_mock_connection_count(TestMockConnection *conn, const char *name,
+                                 const char *xmlns);
+guint test_mock_connection_count_iqs(TestMockConnection *conn,
+                                     const char *xmlns);
+guint test_mock_connection_count_results(TestMockConnection *conn,
+                                         const char *id);
+guint test_mock_connection_count_messages(TestMockConnection *conn,
+                                          const char *body);
+
+/******************************************************************************
+ * Client
+ *****************************************************************************/
+/* libpurple with the XMPP protocol, and an account on the mock server */
+typedef struct {
+	TestMockServer mock;
+	char *user_dir;
+	PurpleAccount *account;
+
+	/* what test_jabber_client_run_until() waits for */
+	guint acks;
+	guint32 stanzas_in;
+} TestJabberClient;
+
+typedef gboolean (*TestJabberClientCondition)(TestJabberClient *test);
+
+/* Starts libpurple and the mock server, and creates the account.  It is
+ * left to the test to change the server and account settings and to call
+ * test_jabber_client_login(). */
+void test_jabber_client_setup(TestJabberClient *test, const char *ui);
+void test_jabber_client_teardown(TestJabberClient *test);
+void test_jabber_client_login(TestJabberClient *test);
+
+void test_jabber_client_run_until(TestJabberClient *test,
+                                  TestJabberClientCondition done);
+JabberStream *test_jabber_client_stream(TestJabberClient *test);
+gboolean test_jabber_client_logged_in(TestJabberClient *test);
+
+/* Asks the client for an ack and waits for it, by which time the client
+ * has handled everything sent before. */
+void test_jabber_client_sync(TestJabberClient *test);
+
+char *test_mock_roster(const char *id, guint contacts);
+
+#endif /* PURPLE_JABBER_TEST_MOCK_H */
@@ -0,0 +1,263 @@
+#include <glib.h>
+#include <signal.h>
+#include <string.h>
+
+#include "account.h"
+#include "buddylist.h"
+#include "connection.h"
+#include "conversations.h"
+#include "signals.h"
+#include "util.h"
+#include "xmlnode.h"
+#include "protocols/jabber/jabber.h"
+#include "protocols/jabber/parser.h"
+
+#include "test_jabber_mock.h"
+
+#define TEST_JABBER_PARSER_UI "test-jabber-parser"
+#define TEST_JABBER_PARSER_CONTACTS 2000
+#define TEST_JABBER_PARSER_TEST_NS "urn:purple:test"
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+/* What the test stream handler saw of the last stanza */
+static GString *test_jabber_parser_events = NULL;
+
+/* Writes the events of <test/> elements down, skipping <skip/> and building
+ * <build/>.  A <test fallback='1'/> goes the usual way. */
+static JabberParserAction
+test_jabber_parser_handler(JabberStream *js, JabberParserCursor *cursor) {
+	GString *events = test_jabber_parser_events;
+	guint depth = jabber_parser_cursor_get_depth(cursor);
+	const char *name = jabber_parser_cursor_get_name(cursor);
+	PurpleXmlNode *subtree;
+	const char *text;
+	char *str;
+	int len;
+
+	switch (jabber_parser_cursor_get_event(cursor)) {
+		case JABBER_PARSER_EVENT_START:
+			if (depth == 1) {
+				if (jabber_parser_cursor_get_attrib(cursor, "fallback"))
+					return JABBER_PARSER_FALLBACK;
+				g_string_truncate(events, 0);
+				g_string_append_printf(events, "<%s %u a='%s' from='%s'>",
+					name, depth,
+					jabber_parser_cursor_get_attrib(cursor, "a"),
+					purple_xmlnode_get_attrib(
+						jabber_parser_cursor_get_stanza(cursor),
+						"from"));
+				return JABBER_PARSER_CONTINUE;
+			}
+			g_string_append_printf(events, "<%s %u>", name, depth);
+			if (purple_strequal(name, "skip"))
+				return JABBER_PARSER_SKIP;
+			if (purple_strequal(name, "build"))
+				return JABBER_PARSER_BUILD;
+			return JABBER_PARSER_CONTINUE;
+
+		case JABBER_PARSER_EVENT_END:
+			g_string_append_printf(events, "</%s %u>", name, depth);
+			if ((subtree = jabber_parser_cursor_get_subtree(cursor))) {
+				str = purple_xmlnode_to_str(subtree, NULL);
+				g_string_append_printf(events, "[%s]", str);
+				g_free(str);
+			}
+			break;
+
+		case JABBER_PARSER_EVENT_TEXT:
+			text = jabber_parser_cursor_get_text(cursor, &len);
+			g_string_append_len(events, text, len);
+			break;
+	}
+
+	return JABBER_PARSER_CONTINUE;
+}
+
+static void
+test_jabber_parser_setup(TestJabberClient *test, guint contacts,
+                         gsize split) {
+	test_jabber_client_setup(test, TEST_JABBER_PARSER_UI);
+	test->mock.contacts = contacts;
+	test->mock.split = split;
+
+	jabber_parser_register_stream_handler("message", "test",
+	                                      TEST_JABBER_PARSER_TEST_NS,
+	                                      test_jabber_parser_handler);
+	test_jabber_parser_events = g_string_new(NULL);
+}
+
+static void
+test_jabber_parser_teardown(TestJabberClient *test) {
+	test_jabber_client_teardown(test);
+
+	g_string_free(test_jabber_parser_events, TRUE);
+	test_jabber_parser_events = NULL;
+}
+
+static void
+test_jabber_parser_assert_roster(TestJabberClient *test, guint contacts) {
+	GSList *buddies;
+	guint i;
+
+	for (i = 0; i < contacts; i++) {
+		char *jid = g_strdup_printf("contact%u@montague.example", i);
+		char *alias = g_strdup_printf("Contact %u <%u>", i, i);
+		PurpleBuddy *buddy = purple_blist_find_buddy(test->account, jid);
+
+		g_assert_nonnull(buddy);
+		g_assert_cmpstr(purple_buddy_get_local_alias(buddy), ==, alias);
+		g_assert_cmpstr(purple_group_get_name(purple_buddy_get_group(buddy)),
+		                ==, "Friends & Family");
+
+		g_free(jid);
+		g_free(alias);
+	}
+
+	buddies = purple_blist_find_buddies(test->account, NULL);
+	g_assert_cmpuint(g_slist_length(buddies), ==, contacts);
+	g_slist_free(buddies);
+}
+
+static void
+test_jabber_parser_receiving_cb(PurpleConnection *gc, PurpleXmlNode **packet,
+                                gpointer data) {
+	guint *count = data;
+
+	(*count)++;
+}
+
+static void
+test_jabber_parser_received_im_cb(PurpleAccount *account, const char *who,
+                                  const char *message,
+                                  PurpleIMConversation *im, guint flags,
+                                  gpointer data) {
+	GString *events = data;
+
+	g_string_append_printf(events, "%s: %s", who, message);
+}
+
+static void
+test_jabber_parser_roster(guint contacts, gsize split) {
+	TestJabberClient test;
+
+	test_jabber_parser_setup(&test, contacts, split);
+	test_jabber_client_login(&test);
+	test_jabber_client_run_until(&test, test_jabber_client_logged_in);
+
+	/* every <item/> made it, and the stanza counted as one */
+	test_jabber_parser_assert_roster(&test, contacts);
+	test_jabber_client_sync(&test);
+
+	test_jabber_parser_teardown(&test);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_jabber_parser_roster_whole(void) {
+	test_jabber_parser_roster(TEST_JABBER_PARSER_CONTACTS, 0);
+}
+
+/* Split into pieces which cut through names, attributes and entities. */
+static void
+test_jabber_parser_roster_split(void) {
+	test_jabber_parser_roster(TEST_JABBER_PARSER_CONTACTS / 4, 7);
+}
+
+/* Whoever listens to jabber-receiving-xmlnode gets the whole roster, which
+ * goes the usual way then, with the same result. */
+static void
+test_jabber_parser_roster_tree(void) {
+	TestJabberClient test;
+	guint count = 0;
+
+	test_jabber_parser_setup(&test, TEST_JABBER_PARSER_CONTACTS / 4, 13);
+	test_jabber_client_login(&test);
+	purple_signal_connect(
+		purple_connection_get_protocol(
+			purple_account_get_connection(test.account)),
+		"jabber-receiving-xmlnode", &test,
+		PURPLE_CALLBACK(test_jabber_parser_receiving_cb), &count);
+	test_jabber_client_run_until(&test, test_jabber_client_logged_in);
+
+	test_jabber_parser_assert_roster(&test, TEST_JABBER_PARSER_CONTACTS / 4);
+	test_jabber_client_sync(&test);
+	g_assert_cmpuint(count, >, 0);
+
+	test_jabber_parser_teardown(&test);
+}
+
+/* Streams a stanza to a handler of its own, one byte at a time. */
+static void
+test_jabber_parser_handler_events(void) {
+	TestJabberClient test;
+	TestMockConnection *conn;
+	GString *im = g_string_new(NULL);
+
+	test_jabber_parser_setup(&test, 0, 0);
+	test_jabber_client_login(&test);
+	test_jabber_client_run_until(&test, test_jabber_client_logged_in);
+	conn = test_mock_server_current(&test.mock);
+
+	test.mock.split = 1;
+	test_mock_connection_send_stanza(conn,
+		"<message from='romeo@montague.example/orchard' type='chat'>"
+		"<test xmlns='" TEST_JABBER_PARSER_TEST_NS "' a='1 &amp; 2'>"
+		"te&amp;xt"
+		"<skip><deep>hidden</deep></skip>"
+		"<build x='y'><child>data</child></build>"
+		"<more/>"
+		"</test></message>");
+	test_jabber_client_sync(&test);
+	test.mock.split = 0;
+
+	g_assert_cmpstr(test_jabber_parser_events->str, ==,
+		"<test 1 a='1 & 2' from='romeo@montague.example/orchard'>"
+		"te&xt<skip 2><build 2></build 2>"
+		"[<build xmlns='" TEST_JABBER_PARSER_TEST_NS "' x='y'>"
+		"<child>data</child></build>]"
+		"<more 2></more 2></test 1></message 0>");
+
+	/* a handler may leave it to the usual processing, as long as it does
+	 * so right away */
+	purple_signal_connect(purple_conversations_get_handle(),
+	                      "received-im-msg", &test,
+	                      PURPLE_CALLBACK(test_jabber_parser_received_im_cb),
+	                      im);
+	test_mock_connection_send_stanza(conn,
+		"<message from='romeo@montague.example/orchard' type='chat'>"
+		"<test xmlns='" TEST_JABBER_PARSER_TEST_NS "' fallback='1'/>"
+		"<body>Hist!</body></message>");
+	test_jabber_client_sync(&test);
+	g_assert_cmpstr(im->str, ==, "romeo@montague.example/orchard: Hist!");
+
+	g_string_free(im, TRUE);
+	test_jabber_parser_teardown(&test);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+#ifndef _WIN32
+	/* the client may write to a connection the mock server dropped */
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	g_test_add_func("/jabber/parser/roster/whole",
+	                test_jabber_parser_roster_whole);
+	g_test_add_func("/jabber/parser/roster/split",
+	                test_jabber_parser_roster_split);
+	g_test_add_func("/jabber/parser/roster/tree",
+	                test_jabber_parser_roster_tree);
+	g_test_add_func("/jabber/parser/handler/events",
+	                test_jabber_parser_handler_events);
+
+	return g_test_run();
+}
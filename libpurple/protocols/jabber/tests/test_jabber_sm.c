@@ -0,0 +1,409 @@
+#include <glib.h>
+#include <signal.h>
+#include <string.h>
+
+#include "account.h"
+#include "buddylist.h"
+#include "connection.h"
+#include "message.h"
+#include "server.h"
+#include "signals.h"
+#include "util.h"
+#include "xmlnode.h"
+#include "protocols/jabber/jabber.h"
+#include "protocols/jabber/sm.h"
+
+#include "test_jabber_mock.h"
+
+#define TEST_JABBER_SM_UI "test-jabber-sm"
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static GBytes *
+test_jabber_sm_stanza(guint i) {
+	char *txt = g_strdup_printf("<message to='juliet@capulet.example' "
+	                            "type='chat' id='m%u'><body>%u</body>"
+	                            "</message>", i, i);
+
+	return g_bytes_new_take(txt, strlen(txt));
+}
+
+static void
+test_jabber_sm_send_stanzas(JabberSm *sm, guint count) {
+	guint i;
+
+	for (i = 0; i < count; i++) {
+		GBytes *stanza = test_jabber_sm_stanza(sm->sent);
+
+		jabber_sm_stanza_sent(sm, stanza);
+		g_bytes_unref(stanza);
+	}
+}
+
+static gboolean
+test_jabber_sm_ack(JabberSm *sm, const char *xml) {
+	PurpleXmlNode *ack = purple_xmlnode_from_str(xml, -1);
+	gboolean ret = jabber_sm_parse_ack(sm, ack);
+
+	purple_xmlnode_free(ack);
+
+	return ret;
+}
+
+/******************************************************************************
+ * Client
+ *****************************************************************************/
+static gboolean
+test_jabber_sm_received(TestJabberClient *test) {
+	return test->mock.stanzas_in >= test->stanzas_in;
+}
+
+static gboolean
+test_jabber_sm_resuming(TestJabberClient *test) {
+	JabberStream *js = test_jabber_client_stream(test);
+
+	return js && js->sm && js->sm->resuming;
+}
+
+static gboolean
+test_jabber_sm_resumed(TestJabberClient *test) {
+	JabberStream *js = test_jabber_client_stream(test);
+
+	return js && js->sm && !js->sm->resuming &&
+	       js->state == JABBER_STREAM_CONNECTED &&
+	       test->mock.connections->len == 2;
+}
+
+/* Takes the stanzas with the id 'taken' away from the protocol. */
+static void
+test_jabber_sm_take_cb(PurpleConnection *gc, PurpleXmlNode **packet,
+                       gpointer data) {
+	if (purple_strequal(purple_xmlnode_get_attrib(*packet, "id"), "taken")) {
+		purple_xmlnode_free(*packet);
+		*packet = NULL;
+	}
+}
+
+static void
+test_jabber_sm_send_im(TestJabberClient *test, const char *body) {
+	PurpleConnection *gc = purple_account_get_connection(test->account);
+	PurpleMessage *msg;
+
+	msg = purple_message_new_outgoing("romeo@montague.example", body, 0);
+	purple_serv_send_im(gc, msg);
+	g_object_unref(msg);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_jabber_sm_offered(void) {
+	PurpleXmlNode *features;
+
+	features = purple_xmlnode_from_str(
+		"<stream:features xmlns:stream='http://etherx.jabber.org/streams'>"
+		"<bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'/>"
+		"<sm xmlns='urn:xmpp:sm:3'/></stream:features>", -1);
+	g_assert_true(jabber_sm_is_offered(features));
+	purple_xmlnode_free(features);
+
+	features = purple_xmlnode_from_str(
+		"<stream:features xmlns:stream='http://etherx.jabber.org/streams'>"
+		"<sm xmlns='urn:xmpp:sm:2'/></stream:features>", -1);
+	g_assert_false(jabber_sm_is_offered(features));
+	purple_xmlnode_free(features);
+}
+
+static void
+test_jabber_sm_enabled(void) {
+	JabberSm *sm = jabber_sm_new();
+	PurpleXmlNode *enabled, *resume;
+	char *str;
+
+	enabled = purple_xmlnode_from_str("<enabled xmlns='urn:xmpp:sm:3' "
+	                                  "id='some-long-sm-id' resume='true' "
+	                                  "max='300'/>", -1);
+	jabber_sm_parse_enabled(sm, enabled);
+	purple_xmlnode_free(enabled);
+
+	g_assert_true(sm->enabled);
+	g_assert_cmpstr(sm->id, ==, "some-long-sm-id");
+	g_assert_cmpuint(sm->max, ==, 300);
+
+	sm->handled = 42;
+	resume = jabber_sm_new_resume(sm);
+	str = purple_xmlnode_to_str(resume, NULL);
+	g_assert_cmpstr(str, ==, "<resume xmlns='urn:xmpp:sm:3' "
+	                         "previd='some-long-sm-id' h='42'/>");
+	g_free(str);
+	purple_xmlnode_free(resume);
+
+	/* without resume='true' the id is of no use */
+	enabled = purple_xmlnode_from_str("<enabled xmlns='urn:xmpp:sm:3' "
+	                                  "id='some-long-sm-id'/>", -1);
+	jabber_sm_parse_enabled(sm, enabled);
+	purple_xmlnode_free(enabled);
+	g_assert_null(sm->id);
+
+	jabber_sm_free(sm);
+}
+
+static void
+test_jabber_sm_is_stanza(void) {
+	PurpleXmlNode *node;
+
+	node = purple_xmlnode_new("message");
+	g_assert_true(jabber_sm_is_stanza(node));
+	purple_xmlnode_set_namespace(node, "jabber:client");
+	g_assert_true(jabber_sm_is_stanza(node));
+	purple_xmlnode_free(node);
+
+	node = jabber_sm_new_request();
+	g_assert_false(jabber_sm_is_stanza(node));
+	purple_xmlnode_free(node);
+
+	node = purple_xmlnode_new("auth");
+	purple_xmlnode_set_namespace(node, "urn:ietf:params:xml:ns:xmpp-sasl");
+	g_assert_false(jabber_sm_is_stanza(node));
+	purple_xmlnode_free(node);
+}
+
+static void
+test_jabber_sm_count_stanzas(void) {
+	static const struct {
+		const char *xml;
+		guint count;
+	} data[] = {
+		{ "", 0 },
+		{ "<presence/>", 1 },
+		{ "<iq type='get' id='1'><query xmlns='jabber:iq:roster'/></iq>", 1 },
+		{ "<message><body>1</body></message>"
+		  "<message><body>2</body></message>", 2 },
+		/* a stanza within a stanza isn't one of its own */
+		{ "<message><forwarded xmlns='urn:xmpp:forward:0'>"
+		  "<message><body>1</body></message></forwarded></message>", 1 },
+		{ "<a xmlns='urn:xmpp:sm:3' h='1'/><r xmlns='urn:xmpp:sm:3'/>", 0 },
+		{ "<!-- <message/> --><presence/>", 1 },
+		{ "<message><body><![CDATA[<iq/>]]></body></message>", 1 },
+		{ "<message to='a>b' id=\"x/\"><body/></message>", 1 },
+		{ "<client:iq xmlns:client='jabber:client' type='get' id='1'/>", 1 },
+		{ NULL, 0 }
+	};
+	gint i;
+
+	for (i = 0; data[i].xml; i++) {
+		g_assert_cmpuint(jabber_sm_count_stanzas(data[i].xml,
+		                                         strlen(data[i].xml)),
+		                 ==, data[i].count);
+	}
+}
+
+static void
+test_jabber_sm_acks(void) {
+	JabberSm *sm = jabber_sm_new();
+	char *str;
+
+	test_jabber_sm_send_stanzas(sm, 5);
+	g_assert_cmpuint(g_queue_get_length(&sm->unacked), ==, 5);
+
+	g_assert_true(test_jabber_sm_ack(sm, "<a xmlns='urn:xmpp:sm:3' h='3'/>"));
+	g_assert_cmpuint(sm->acked, ==, 3);
+	g_assert_cmpuint(g_queue_get_length(&sm->unacked), ==, 2);
+
+	/* the oldest unacked stanza is first */
+	str = g_strndup(g_bytes_get_data(g_queue_peek_head(&sm->unacked), NULL),
+	                g_bytes_get_size(g_queue_peek_head(&sm->unacked)));
+	g_assert_nonnull(strstr(str, "id='m3'"));
+	g_free(str);
+
+	/* acking the same again changes nothing */
+	g_assert_true(test_jabber_sm_ack(sm, "<a xmlns='urn:xmpp:sm:3' h='3'/>"));
+	g_assert_cmpuint(g_queue_get_length(&sm->unacked), ==, 2);
+
+	/* no h at all, or one behind an earlier ack */
+	g_assert_false(test_jabber_sm_ack(sm, "<a xmlns='urn:xmpp:sm:3' h='x'/>"));
+	g_assert_false(test_jabber_sm_ack(sm, "<a xmlns='urn:xmpp:sm:3'/>"));
+	g_assert_false(test_jabber_sm_ack(sm, "<a xmlns='urn:xmpp:sm:3' h='2'/>"));
+	g_assert_cmpuint(g_queue_get_length(&sm->unacked), ==, 2);
+
+	/* the server counted a stanza we didn't, so we go on from its count */
+	g_assert_true(test_jabber_sm_ack(sm, "<a xmlns='urn:xmpp:sm:3' h='6'/>"));
+	g_assert_cmpuint(sm->acked, ==, 6);
+	g_assert_cmpuint(sm->sent, ==, 6);
+	g_assert_true(g_queue_is_empty(&sm->unacked));
+
+	test_jabber_sm_send_stanzas(sm, 1);
+	g_assert_true(test_jabber_sm_ack(sm, "<a xmlns='urn:xmpp:sm:3' h='7'/>"));
+	g_assert_true(g_queue_is_empty(&sm->unacked));
+
+	jabber_sm_free(sm);
+}
+
+static void
+test_jabber_sm_acks_wrap(void) {
+	JabberSm *sm = jabber_sm_new();
+
+	sm->acked = sm->sent = G_MAXUINT32 - 1;
+	test_jabber_sm_send_stanzas(sm, 4);
+	g_assert_cmpuint(sm->sent, ==, 2);
+
+	g_assert_true(test_jabber_sm_ack(sm, "<a xmlns='urn:xmpp:sm:3' h='1'/>"));
+	g_assert_cmpuint(g_queue_get_length(&sm->unacked), ==, 1);
+
+	jabber_sm_free(sm);
+}
+
+/* Logs in to the mock server, loses the connection and resumes the
+ * session, checking what the client sends all along. */
+static void
+test_jabber_sm_resume(void) {
+	TestJabberClient test;
+	TestMockConnection *login, *resume;
+	JabberStream *js;
+	GTimer *timer = g_timer_new();
+	guint64 login_bytes, resume_bytes;
+	guint login_round_trips, resume_round_trips;
+	gdouble login_time, resume_time;
+	guint32 handled;
+	gpointer handle = &test.acks;
+	char *ack;
+
+	test_jabber_client_setup(&test, TEST_JABBER_SM_UI);
+	test_jabber_client_login(&test);
+
+	test_jabber_client_run_until(&test, test_jabber_client_logged_in);
+	login_time = g_timer_elapsed(timer, NULL);
+	login = g_ptr_array_index(test.mock.connections, 0);
+	login_bytes = login->bytes;
+	login_round_trips = login->round_trips;
+
+	js = test_jabber_client_stream(&test);
+	g_assert_nonnull(js->sm);
+	g_assert_true(js->sm->enabled);
+	g_assert_nonnull(purple_blist_find_buddy(test.account,
+	                                         "contact0@montague.example"));
+
+	/* The roster came in as one streamed <iq/>, which was counted. */
+	test_jabber_client_sync(&test);
+
+	/* So is a streamed roster push, which gets its answer. */
+	test_mock_connection_send_stanza(login,
+		"<iq type='set' id='push1'><query xmlns='jabber:iq:roster'>"
+		"<item jid='nurse@capulet.example' name='Nurse' "
+		"subscription='both'/></query></iq>");
+	test_jabber_client_sync(&test);
+	g_assert_nonnull(purple_blist_find_buddy(test.account,
+	                                         "nurse@capulet.example"));
+	g_assert_cmpuint(test_mock_connection_count_results(login, "push1"),
+	                 ==, 1);
+
+	/* A stanza which a jabber-receiving-xmlnode handler takes has been
+	 * handled all the same. */
+	purple_signal_connect(purple_connection_get_protocol(js->gc),
+	                      "jabber-receiving-xmlnode", handle,
+	                      PURPLE_CALLBACK(test_jabber_sm_take_cb), NULL);
+	test_mock_connection_send_stanza(login,
+		"<message from='romeo@montague.example/orchard' type='chat' "
+		"id='taken'><body>Hist!</body></message>");
+	test_jabber_client_sync(&test);
+	purple_signals_disconnect_by_handle(handle);
+
+	/* Raw XML, as from the XML console, counts too, and the server's ack
+	 * of it leaves the stream alone. */
+	test.stanzas_in = test.mock.stanzas_in + 2;
+	g_assert_cmpint(jabber_protocol_send_raw(js->gc,
+		"<message to='romeo@montague.example' type='chat' id='raw1'>"
+		"<body>raw 1</body></message>"
+		"<message to='romeo@montague.example' type='chat' id='raw2'>"
+		"<body>raw 2</body></message>", -1), >, 0);
+	test_jabber_client_run_until(&test, test_jabber_sm_received);
+	g_assert_cmpuint(js->sm->sent, ==, test.mock.stanzas_in);
+
+	ack = g_strdup_printf("<a xmlns='urn:xmpp:sm:3' h='%u'/>",
+	                      test.mock.stanzas_in);
+	test_mock_connection_write(login, ack);
+	g_free(ack);
+	test_jabber_client_sync(&test);
+	g_assert_true(purple_account_is_connected(test.account));
+	g_assert_cmpuint(js->sm->acked, ==, js->sm->sent);
+	g_assert_true(g_queue_is_empty(&js->sm->unacked));
+
+	/* One message reaches the server before the connection is lost, but
+	 * isn't acked, and another is sent while the connection is down. */
+	test.stanzas_in = test.mock.stanzas_in + 1;
+	test_jabber_sm_send_im(&test, "before");
+	test_jabber_client_run_until(&test, test_jabber_sm_received);
+	handled = test.mock.stanzas_out;
+
+	g_timer_start(timer);
+	test_mock_server_drop(&test.mock);
+	test_jabber_client_run_until(&test, test_jabber_sm_resuming);
+	test_jabber_sm_send_im(&test, "during");
+	test_jabber_client_run_until(&test, test_jabber_sm_resumed);
+	resume_time = g_timer_elapsed(timer, NULL);
+	resume = g_ptr_array_index(test.mock.connections, 1);
+	resume_bytes = resume->bytes;
+	resume_round_trips = resume->round_trips;
+
+	test_jabber_client_sync(&test);
+
+	/* The session carried on where it was, without binding or fetching
+	 * the roster again, and each message got there exactly once. */
+	g_assert_cmpint(test.mock.resume_h, ==, handled);
+	g_assert_cmpuint(test_mock_connection_count_iqs(resume,
+		"urn:ietf:params:xml:ns:xmpp-bind"), ==, 0);
+	g_assert_cmpuint(test_mock_connection_count_iqs(resume,
+		"jabber:iq:roster"), ==, 0);
+	g_assert_cmpuint(test_mock_connection_count_messages(login, "before"),
+	                 ==, 1);
+	g_assert_cmpuint(test_mock_connection_count_messages(resume, "before"),
+	                 ==, 0);
+	g_assert_cmpuint(test_mock_connection_count_messages(resume, "during"),
+	                 ==, 1);
+	g_assert_true(purple_account_is_connected(test.account));
+
+	g_test_message("full login: %u round trips, %" G_GUINT64_FORMAT
+	               " bytes, %.3f ms", login_round_trips, login_bytes,
+	               login_time * 1000);
+	g_test_message("resumption: %u round trips, %" G_GUINT64_FORMAT
+	               " bytes, %.3f ms", resume_round_trips, resume_bytes,
+	               resume_time * 1000);
+
+	g_assert_cmpuint(resume_round_trips, <, login_round_trips);
+	g_assert_cmpuint(resume_bytes * 2, <, login_bytes);
+
+	g_timer_destroy(timer);
+	test_jabber_client_teardown(&test);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+#ifndef _WIN32
+	/* the client may write to a connection the mock server dropped */
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	g_test_add_func("/jabber/sm/offered",
+	                test_jabber_sm_offered);
+	g_test_add_func("/jabber/sm/enabled",
+	                test_jabber_sm_enabled);
+	g_test_add_func("/jabber/sm/is stanza",
+	                test_jabber_sm_is_stanza);
+	g_test_add_func("/jabber/sm/count stanzas",
+	                test_jabber_sm_count_stanzas);
+	g_test_add_func("/jabber/sm/acks",
+	                test_jabber_sm_acks);
+	g_test_add_func("/jabber/sm/acks wrap",
+	                test_jabber_sm_acks_wrap);
+	g_test_add_func("/jabber/sm/resume",
+	                test_jabber_sm_resume);
+
+	return g_test_run();
+}
@@ -70,6 +70,11 @@ xmpp_protocol_init(PurpleProtocol *protocol)
 	protocol->account_options = g_list_append(protocol->account_options,
 						   option);
 
+	option = purple_account_option_bool_new(_("Use stream compression"),
+						"compression", FALSE);
+	protocol->account_options = g_list_append(protocol->account_options,
+						   option);
+
 	option = purple_account_option_int_new(_("Connect port"), "port", 5222);
 	protocol->account_options = g_list_append(protocol->account_options,
 						   option);
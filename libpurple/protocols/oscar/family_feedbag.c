@@ -46,7 +46,7 @@
 #include "oscarcommon.h"
 #include "debug.h"
 
-static int aim_ssi_addmoddel(OscarData *od);
+static int aim_ssi_addmoddel(OscarData *od, struct aim_ssi_tmp *first, int count);
 
 static void aim_ssi_item_free(struct aim_ssi_item *item)
 {
@@ -55,6 +55,28 @@ static void aim_ssi_item_free(struct aim_ssi_item *item)
 	g_free(item);
 }
 
+/**
+ * Remove a buddy from the hash table of buddies keyed by group ID# and
+ * name.  Each key holds all the buddies with that name in that group,
+ * oldest first, so if there is another one it takes this one's place.
+ */
+static void aim_ssi_item_unindex_buddy(struct aim_ssi_itemlist *list, struct aim_ssi_item *item)
+{
+	GQueue *buddies;
+	gchar key[3000];
+
+	if (!item->name)
+		return;
+
+	snprintf(key, sizeof(key), "%hx:%s", item->gid, oscar_normalize(NULL, item->name));
+	if (!(buddies = g_hash_table_lookup(list->idx_gid_buddies, key)))
+		return;
+
+	g_queue_remove(buddies, item);
+	if (g_queue_is_empty(buddies))
+		g_hash_table_remove(list->idx_gid_buddies, key);
+}
+
 static void aim_ssi_item_set_name(struct aim_ssi_itemlist *list, struct aim_ssi_item *item, const char *name)
 {
 	gchar key[3000];
@@ -63,6 +85,8 @@ static void aim_ssi_item_set_name(struct aim_ssi_itemlist *list, struct aim_ssi_
 		/* Remove old name from hash table */
 		snprintf(key, sizeof(key), "%hx%s", item->type, oscar_normalize(NULL, item->name));
 		g_hash_table_remove(list->idx_all_named_items, key);
+
+		aim_ssi_item_unindex_buddy(list, item);
 	}
 
 	g_free(item->name);
@@ -72,6 +96,19 @@ static void aim_ssi_item_set_name(struct aim_ssi_itemlist *list, struct aim_ssi_
 		/* Add new name to hash table */
 		snprintf(key, sizeof(key), "%hx%s", item->type, oscar_normalize(NULL, item->name));
 		g_hash_table_insert(list->idx_all_named_items, g_strdup(key), item);
+
+		/* Buddies can also be looked up by their group.  If a name
+		 * appears twice in a group, the older item is the one found */
+		if (item->type == AIM_SSI_TYPE_BUDDY) {
+			GQueue *buddies;
+
+			snprintf(key, sizeof(key), "%hx:%s", item->gid, oscar_normalize(NULL, item->name));
+			if (!(buddies = g_hash_table_lookup(list->idx_gid_buddies, key))) {
+				buddies = g_queue_new();
+				g_hash_table_insert(list->idx_gid_buddies, g_strdup(key), buddies);
+			}
+			g_queue_push_tail(buddies, item);
+		}
 	}
 }
 
@@ -308,6 +345,8 @@ static int aim_ssi_itemlist_del(struct aim_ssi_itemlist *list, struct aim_ssi_it
 	snprintf(key, sizeof(key), "%hx%s", del->type, oscar_normalize(NULL, del->name));
 	g_hash_table_remove(list->idx_all_named_items, key);
 
+	aim_ssi_item_unindex_buddy(list, del);
+
 	/* Free the removed item */
 	aim_ssi_item_free(del);
 
@@ -392,6 +431,7 @@ struct aim_ssi_item *aim_ssi_itemlist_find(struct aim_ssi_itemlist *list, guint1
 struct aim_ssi_item *aim_ssi_itemlist_finditem(struct aim_ssi_itemlist *list, const char *gn, const char *bn, guint16 type)
 {
 	struct aim_ssi_item *cur;
+	GQueue *buddies;
 	gchar key[3000];
 
 	if (!list->data)
@@ -399,13 +439,15 @@ struct aim_ssi_item *aim_ssi_itemlist_finditem(struct aim_ssi_itemlist *list, co
 
 	if (gn && bn) { /* For finding buddies in groups */
 		g_return_val_if_fail(type == AIM_SSI_TYPE_BUDDY, NULL);
-		for (cur=list->data; cur; cur=cur->next)
-			if ((cur->type == type) && (cur->name) && !(oscar_util_name_compare(cur->name, bn))) {
-				struct aim_ssi_item *curg;
-				for (curg=list->data; curg; curg=curg->next)
-					if ((curg->type == AIM_SSI_TYPE_GROUP) && (curg->gid == cur->gid) && (curg->name) && !(oscar_util_name_compare(curg->name, gn)))
-						return cur;
-			}
+		snprintf(key, sizeof(key), "%hx%s", AIM_SSI_TYPE_GROUP, oscar_normalize(NULL, gn));
+		if (!(cur = g_hash_table_lookup(list->idx_all_named_items, key)))
+			return NULL;
+
+		snprintf(key, sizeof(key), "%hx:%s", cur->gid, oscar_normalize(NULL, bn));
+		buddies = g_hash_table_lookup(list->idx_gid_buddies, key);
+		cur = buddies ? g_queue_peek_head(buddies) : NULL;
+		if (cur && (cur->type == type))
+			return cur;
 
 	} else if (gn || bn) { /* For finding groups, permits, denies and ignores */
 		snprintf(key, sizeof(key), "%hx%s", type, oscar_normalize(NULL, gn ? gn : bn));
@@ -555,6 +597,23 @@ gboolean aim_ssi_waitingforauth(struct aim_ssi_itemlist *list, const char *gn, c
 	return FALSE;
 }
 
+/**
+ * Create a temporary item for an add, mod or del of the given item.
+ */
+static struct aim_ssi_tmp *aim_ssi_tmp_new(guint16 action, struct aim_ssi_item *item)
+{
+	struct aim_ssi_tmp *new;
+
+	new = g_new(struct aim_ssi_tmp, 1);
+	new->action = action;
+	new->ack = 0xffff;
+	new->name = NULL;
+	new->item = item;
+	new->next = NULL;
+
+	return new;
+}
+
 /**
  * If there are changes, then create temporary items and
  * call addmoddel.
@@ -565,16 +624,11 @@ gboolean aim_ssi_waitingforauth(struct aim_ssi_itemlist *list, const char *gn, c
 static int aim_ssi_sync(OscarData *od)
 {
 	struct aim_ssi_item *cur1, *cur2;
-	struct aim_ssi_tmp *cur, *new;
-	int n = 0;
+	struct aim_ssi_tmp *cur, *next;
+	struct aim_ssi_tmp **tail;
+	int n;
 	GString *debugstr = g_string_new("");
 
-	/*
-	 * The variable "n" is used to limit the number of addmoddel's that
-	 * are performed in a single SNAC.  It will hopefully keep the size
-	 * of the SNAC below the maximum SNAC size.
-	 */
-
 	if (!od)
 		return -EINVAL;
 
@@ -584,79 +638,46 @@ static int aim_ssi_sync(OscarData *od)
 
 	/*
 	 * Compare the 2 lists and create an aim_ssi_tmp for each difference.
-	 * We should only send either additions, modifications, or deletions
-	 * before waiting for an acknowledgement.  So first do deletions, then
-	 * additions, then modifications.  Also, both the official and the local
-	 * list should be in ascending numerical order for the group ID#s and the
-	 * buddy ID#s, which makes things more efficient.  I think.
+	 * Deletions are sent first, then additions.  Modifications are only
+	 * worked out once those have all been acked, because a group changed
+	 * to contain its new buddies must be compared against the official
+	 * list as it is after the buddies were added.  Each list is walked
+	 * once and the other list is checked with its gid/bid hash table.
 	 */
+	tail = &od->ssi.pending;
+	while (*tail)
+		tail = &(*tail)->next;
 
 	/* Deletions */
-	if (!od->ssi.pending) {
-		for (cur1=od->ssi.official.data; cur1 && (n < 15); cur1=cur1->next) {
-			if (!aim_ssi_itemlist_find(&od->ssi.local, cur1->gid, cur1->bid)) {
-				n++;
-				new = g_new(struct aim_ssi_tmp, 1);
-				new->action = SNAC_SUBTYPE_FEEDBAG_DEL;
-				new->ack = 0xffff;
-				new->name = NULL;
-				new->item = cur1;
-				new->next = NULL;
-				if (od->ssi.pending) {
-					for (cur=od->ssi.pending; cur->next; cur=cur->next);
-					cur->next = new;
-				} else {
-					od->ssi.pending = new;
-				}
-				aim_ssi_item_debug_append(debugstr, "Deleting item ", cur1);
-			}
+	for (cur1=od->ssi.official.data; cur1; cur1=cur1->next) {
+		if (!aim_ssi_itemlist_find(&od->ssi.local, cur1->gid, cur1->bid)) {
+			*tail = aim_ssi_tmp_new(SNAC_SUBTYPE_FEEDBAG_DEL, cur1);
+			tail = &(*tail)->next;
+			aim_ssi_item_debug_append(debugstr, "Deleting item ", cur1);
 		}
 	}
 
 	/* Additions */
-	if (!od->ssi.pending) {
-		for (cur1=od->ssi.local.data; cur1 && (n < 15); cur1=cur1->next) {
-			if (!aim_ssi_itemlist_find(&od->ssi.official, cur1->gid, cur1->bid)) {
-				n++;
-				new = g_new(struct aim_ssi_tmp, 1);
-				new->action = SNAC_SUBTYPE_FEEDBAG_ADD;
-				new->ack = 0xffff;
-				new->name = NULL;
-				new->item = cur1;
-				new->next = NULL;
-				if (od->ssi.pending) {
-					for (cur=od->ssi.pending; cur->next; cur=cur->next);
-					cur->next = new;
-				} else {
-					od->ssi.pending = new;
-				}
-				aim_ssi_item_debug_append(debugstr, "Adding item ", cur1);
-			}
+	for (cur1=od->ssi.local.data; cur1; cur1=cur1->next) {
+		if (!aim_ssi_itemlist_find(&od->ssi.official, cur1->gid, cur1->bid)) {
+			*tail = aim_ssi_tmp_new(SNAC_SUBTYPE_FEEDBAG_ADD, cur1);
+			tail = &(*tail)->next;
+			aim_ssi_item_debug_append(debugstr, "Adding item ", cur1);
 		}
 	}
 
-	/* Modifications */
+	/* Modifications, once nothing else is left to send */
 	if (!od->ssi.pending) {
-		for (cur1=od->ssi.local.data; cur1 && (n < 15); cur1=cur1->next) {
+		for (cur1=od->ssi.local.data; cur1; cur1=cur1->next) {
 			cur2 = aim_ssi_itemlist_find(&od->ssi.official, cur1->gid, cur1->bid);
-			if (cur2 && (aim_ssi_itemlist_cmp(cur1, cur2))) {
-				n++;
-				new = g_new(struct aim_ssi_tmp, 1);
-				new->action = SNAC_SUBTYPE_FEEDBAG_MOD;
-				new->ack = 0xffff;
-				new->name = NULL;
-				new->item = cur1;
-				new->next = NULL;
-				if (od->ssi.pending) {
-					for (cur=od->ssi.pending; cur->next; cur=cur->next);
-					cur->next = new;
-				} else {
-					od->ssi.pending = new;
-				}
+			if (cur2 && aim_ssi_itemlist_cmp(cur1, cur2)) {
+				*tail = aim_ssi_tmp_new(SNAC_SUBTYPE_FEEDBAG_MOD, cur1);
+				tail = &(*tail)->next;
 				aim_ssi_item_debug_append(debugstr, "Modifying item ", cur1);
 			}
 		}
 	}
+
 	if (debugstr->len > 0) {
 		purple_debug_info("oscar", "%s", debugstr->str);
 		if (purple_debug_is_verbose()) {
@@ -689,11 +710,21 @@ static int aim_ssi_sync(OscarData *od)
 	}
 
 	/* Make sure we don't send anything else between now
-	 * and when we receive the ack for the following operation */
+	 * and when we receive the acks for the following operations */
 	od->ssi.waiting_for_ack = TRUE;
 
-	/* Now go mail off our data and wait 4 to 6 weeks */
-	return aim_ssi_addmoddel(od);;
+	/*
+	 * Now go mail off our data and wait 4 to 6 weeks.  Each SNAC holds
+	 * up to 15 items of the same kind, which will hopefully keep it
+	 * below the maximum SNAC size.  The server acks them in order, and
+	 * parseack matches the acks up with the pending list.
+	 */
+	for (cur = od->ssi.pending; cur; cur = next) {
+		for (n = 1, next = cur->next; next && (n < 15) && (next->action == cur->action); n++, next = next->next);
+		aim_ssi_addmoddel(od, cur, n);
+	}
+
+	return 0;
 }
 
 /**
@@ -731,6 +762,13 @@ aim_ssi_freelist(OscarData *od)
 		g_free(deltmp);
 	}
 
+	g_hash_table_remove_all(od->ssi.official.idx_gid_bid);
+	g_hash_table_remove_all(od->ssi.official.idx_all_named_items);
+	g_hash_table_remove_all(od->ssi.official.idx_gid_buddies);
+	g_hash_table_remove_all(od->ssi.local.idx_gid_bid);
+	g_hash_table_remove_all(od->ssi.local.idx_all_named_items);
+	g_hash_table_remove_all(od->ssi.local.idx_gid_buddies);
+
 	od->ssi.numitems = 0;
 	od->ssi.official.data = NULL;
 	od->ssi.local.data = NULL;
@@ -1382,21 +1420,24 @@ int aim_ssi_enable(OscarData *od)
  * information.  These 3 SNACs all have an identical structure.  The only
  * difference is the subtype that is set for the SNAC.
  *
+ * The SNAC holds count pending items, starting with first, which must
+ * all have the same action.
+ *
  */
-static int aim_ssi_addmoddel(OscarData *od)
+static int aim_ssi_addmoddel(OscarData *od, struct aim_ssi_tmp *first, int count)
 {
 	FlapConnection *conn;
 	ByteStream bs;
 	aim_snacid_t snacid;
-	int bslen;
+	int bslen, n;
 	struct aim_ssi_tmp *cur;
 
-	if (!od || !(conn = flap_connection_findbygroup(od, SNAC_FAMILY_FEEDBAG)) || !od->ssi.pending || !od->ssi.pending->item)
+	if (!od || !(conn = flap_connection_findbygroup(od, SNAC_FAMILY_FEEDBAG)) || !first || !first->item)
 		return -EINVAL;
 
 	/* Calculate total SNAC size */
 	bslen = 0;
-	for (cur=od->ssi.pending; cur; cur=cur->next) {
+	for (cur=first, n=0; cur && (n < count); cur=cur->next, n++) {
 		bslen += 10; /* For length, GID, BID, type, and length */
 		if (cur->item->name)
 			bslen += strlen(cur->item->name);
@@ -1406,7 +1447,7 @@ static int aim_ssi_addmoddel(OscarData *od)
 
 	byte_stream_new(&bs, bslen);
 
-	for (cur=od->ssi.pending; cur; cur=cur->next) {
+	for (cur=first, n=0; cur && (n < count); cur=cur->next, n++) {
 		byte_stream_put16(&bs, cur->item->name ? strlen(cur->item->name) : 0);
 		if (cur->item->name)
 			byte_stream_putstr(&bs, cur->item->name);
@@ -1418,8 +1459,8 @@ static int aim_ssi_addmoddel(OscarData *od)
 			aim_tlvlist_write(&bs, &cur->item->data);
 	}
 
-	snacid = aim_cachesnac(od, SNAC_FAMILY_FEEDBAG, od->ssi.pending->action, 0x0000, NULL, 0);
-	flap_connection_send_snac(od, conn, SNAC_FAMILY_FEEDBAG, od->ssi.pending->action, snacid, &bs);
+	snacid = aim_cachesnac(od, SNAC_FAMILY_FEEDBAG, first->action, 0x0000, NULL, 0);
+	flap_connection_send_snac(od, conn, SNAC_FAMILY_FEEDBAG, first->action, snacid, &bs);
 
 	byte_stream_destroy(&bs);
 
@@ -1493,6 +1534,8 @@ static int parsemod(OscarData *od, FlapConnection *conn, aim_module_t *mod, Flap
 
 		/* Replace the 2 local items with the given one */
 		if ((item = aim_ssi_itemlist_find(&od->ssi.local, gid, bid))) {
+			/* The old name is indexed under the old type */
+			aim_ssi_item_set_name(&od->ssi.local, item, NULL);
 			item->type = type;
 			aim_ssi_item_set_name(&od->ssi.local, item, name);
 			aim_tlvlist_free(item->data);
@@ -1500,6 +1543,8 @@ static int parsemod(OscarData *od, FlapConnection *conn, aim_module_t *mod, Flap
 		}
 
 		if ((item = aim_ssi_itemlist_find(&od->ssi.official, gid, bid))) {
+			/* The old name is indexed under the old type */
+			aim_ssi_item_set_name(&od->ssi.official, item, NULL);
 			item->type = type;
 			aim_ssi_item_set_name(&od->ssi.official, item, name);
 			aim_tlvlist_free(item->data);
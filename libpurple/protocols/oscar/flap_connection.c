@@ -29,6 +29,9 @@
 #include <netinet/in.h>
 #endif
 
+/* How much we try to read from the socket at a time */
+#define FLAP_RECV_CHUNK_SIZE 16384
+
 /**
  * This sends a channel 1 SNAC containing the FLAP version.
  * The FLAP version is sent by itself at the beginning of every
@@ -403,8 +406,10 @@ flap_connection_close(OscarData *od, FlapConnection *conn)
 		conn->gsc = NULL;
 	}
 
-	g_free(conn->buffer_incoming.data.data);
-	conn->buffer_incoming.data.data = NULL;
+	g_free(conn->buffer_incoming);
+	conn->buffer_incoming = NULL;
+	conn->buffer_incoming_len = 0;
+	conn->buffer_incoming_used = 0;
 
 	g_object_unref(G_OBJECT(conn->buffer_outgoing));
 	conn->buffer_outgoing = NULL;
@@ -866,11 +871,65 @@ parse_flap(OscarData *od, FlapConnection *conn, FlapFrame *frame)
 	}
 }
 
+/**
+ * Handle every complete FLAP in the receive buffer.  The frames are
+ * parsed in place; only the FlapFrame wrapper lives on the stack.
+ *
+ * @return The number of bytes consumed from the start of the buffer,
+ *         or -1 if the connection is going away and the rest of the
+ *         buffer should be ignored.
+ */
+static gssize
+flap_connection_parse_buffer(FlapConnection *conn)
+{
+	FlapFrame frame;
+	guint8 *header;
+	gsize offset = 0;
+	guint16 len;
+
+	while (conn->buffer_incoming_used - offset >= 6)
+	{
+		header = conn->buffer_incoming + offset;
+
+		/* All FLAP frames must start with the byte 0x2a */
+		if (aimutil_get8(&header[0]) != 0x2a)
+		{
+			flap_connection_schedule_destroy(conn,
+					OSCAR_DISCONNECT_INVALID_DATA, NULL);
+			return -1;
+		}
+
+		len = aimutil_get16(&header[4]);
+		if (conn->buffer_incoming_used - offset < 6 + (gsize)len)
+			/* Waiting for the rest of this FLAP to arrive */
+			break;
+
+		memset(&frame, 0, sizeof(frame));
+		frame.channel = aimutil_get8(&header[1]);
+		frame.seqnum = aimutil_get16(&header[2]);
+		frame.data.data = header + 6;
+		frame.data.len = len;
+		frame.data.offset = 0;
+
+		parse_flap(conn->od, conn, &frame);
+		conn->lastactivity = time(NULL);
+
+		offset += 6 + len;
+
+		/* Don't keep handling data for a connection we're closing */
+		if (conn->destroy_timeout != 0)
+			return -1;
+	}
+
+	return offset;
+}
+
 /**
  * Read in all available data on the socket for a given connection.
- * All complete FLAPs handled immedate after they're received.
- * Incomplete FLAP data is stored locally and appended to the next
- * time this callback is triggered.
+ * Data is read in large chunks and every complete FLAP in the
+ * buffer is handled immediately.  The start of an incomplete FLAP
+ * is kept at the front of the buffer and completed the next time
+ * this callback is triggered.
  *
  * This is called by flap_connection_recv_cb and
  * flap_connection_recv_cb_ssl for unencrypted/encrypted connections.
@@ -878,113 +937,72 @@ parse_flap(OscarData *od, FlapConnection *conn, FlapFrame *frame)
 static void
 flap_connection_recv(FlapConnection *conn)
 {
-	gpointer buf;
 	gsize buflen;
-	gssize read;
+	gssize read, parsed;
 
 	/* Read data until we run out of data and break out of the loop */
 	while (TRUE)
 	{
-		/* Start reading a new FLAP */
-		if (conn->buffer_incoming.data.data == NULL)
+		/* Make sure the buffer can hold the whole FLAP we're in the
+		 * middle of, if it's bigger than the usual chunk */
+		buflen = FLAP_RECV_CHUNK_SIZE;
+		if (conn->buffer_incoming_used >= 6)
+			buflen = MAX(buflen, 6 + (gsize)aimutil_get16(&conn->buffer_incoming[4]));
+		if (buflen > conn->buffer_incoming_len)
 		{
-			buf = conn->header + conn->header_received;
-			buflen = 6 - conn->header_received;
-
-			/* Read the first 6 bytes (the FLAP header) */
-			if (conn->gsc)
-				read = purple_ssl_read(conn->gsc, buf, buflen);
-			else
-				read = recv(conn->fd, buf, buflen, 0);
-
-			/* Check if the FLAP server closed the connection */
-			if (read == 0)
-			{
-				flap_connection_schedule_destroy(conn,
-						OSCAR_DISCONNECT_REMOTE_CLOSED, NULL);
-				break;
-			}
-
-			/* If there was an error then close the connection */
-			if (read < 0)
-			{
-				if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
-					/* No worries */
-					break;
-
-				/* Error! */
-				flap_connection_schedule_destroy(conn,
-						OSCAR_DISCONNECT_LOST_CONNECTION, g_strerror(errno));
-				break;
-			}
-			purple_connection_update_last_received(conn->od->gc);
+			conn->buffer_incoming = g_realloc(conn->buffer_incoming, buflen);
+			conn->buffer_incoming_len = buflen;
+		}
 
-			/* If we don't even have a complete FLAP header then do nothing */
-			conn->header_received += read;
-			if (conn->header_received < 6)
-				break;
+		buflen = conn->buffer_incoming_len - conn->buffer_incoming_used;
+		if (conn->gsc)
+			read = purple_ssl_read(conn->gsc,
+					conn->buffer_incoming + conn->buffer_incoming_used, buflen);
+		else
+			read = recv(conn->fd,
+					conn->buffer_incoming + conn->buffer_incoming_used, buflen, 0);
 
-			/* All FLAP frames must start with the byte 0x2a */
-			if (aimutil_get8(&conn->header[0]) != 0x2a)
-			{
-				flap_connection_schedule_destroy(conn,
-						OSCAR_DISCONNECT_INVALID_DATA, NULL);
-				break;
-			}
-
-			/* Initialize a new temporary FlapFrame for incoming data */
-			conn->buffer_incoming.channel = aimutil_get8(&conn->header[1]);
-			conn->buffer_incoming.seqnum = aimutil_get16(&conn->header[2]);
-			conn->buffer_incoming.data.len = aimutil_get16(&conn->header[4]);
-			conn->buffer_incoming.data.data = g_new(guint8, conn->buffer_incoming.data.len);
-			conn->buffer_incoming.data.offset = 0;
+		/* Check if the FLAP server closed the connection */
+		if (read == 0)
+		{
+			flap_connection_schedule_destroy(conn,
+					OSCAR_DISCONNECT_REMOTE_CLOSED, NULL);
+			break;
 		}
 
-		buflen = conn->buffer_incoming.data.len - conn->buffer_incoming.data.offset;
-		if (buflen)
+		/* If there was an error then close the connection */
+		if (read < 0)
 		{
-			buf = &conn->buffer_incoming.data.data[conn->buffer_incoming.data.offset];
-			/* Read data into the temporary FlapFrame until it is complete */
-			if (conn->gsc)
-				read = purple_ssl_read(conn->gsc, buf, buflen);
-			else
-				read = recv(conn->fd, buf, buflen, 0);
-
-			/* Check if the FLAP server closed the connection */
-			if (read == 0)
-			{
-				flap_connection_schedule_destroy(conn,
-						OSCAR_DISCONNECT_REMOTE_CLOSED, NULL);
-				break;
-			}
-
-			if (read < 0)
-			{
-				if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
-					/* No worries */
-					break;
-
-				/* Error! */
-				flap_connection_schedule_destroy(conn,
-						OSCAR_DISCONNECT_LOST_CONNECTION, g_strerror(errno));
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				/* No worries */
 				break;
-			}
 
-			conn->buffer_incoming.data.offset += read;
-			if (conn->buffer_incoming.data.offset < conn->buffer_incoming.data.len)
-				/* Waiting for more data to arrive */
-				break;
+			/* Error! */
+			flap_connection_schedule_destroy(conn,
+					OSCAR_DISCONNECT_LOST_CONNECTION, g_strerror(errno));
+			break;
 		}
+		purple_connection_update_last_received(conn->od->gc);
 
-		/* We have a complete FLAP!  Handle it and continue reading */
-		byte_stream_rewind(&conn->buffer_incoming.data);
-		parse_flap(conn->od, conn, &conn->buffer_incoming);
-		conn->lastactivity = time(NULL);
+		conn->buffer_incoming_used += read;
+
+		/* Handle all the complete FLAPs we have */
+		parsed = flap_connection_parse_buffer(conn);
+		if (parsed < 0)
+			break;
 
-		g_free(conn->buffer_incoming.data.data);
-		conn->buffer_incoming.data.data = NULL;
+		conn->buffer_incoming_used -= parsed;
+		if (parsed > 0 && conn->buffer_incoming_used > 0)
+			memmove(conn->buffer_incoming, conn->buffer_incoming + parsed,
+					conn->buffer_incoming_used);
 
-		conn->header_received = 0;
+		/*
+		 * A short read means the socket is drained.  SSL connections
+		 * might still have decrypted data buffered, so they keep
+		 * reading until they're told to wait.
+		 */
+		if (conn->gsc == NULL && (gsize)read < buflen)
+			break;
 	}
 }
 
@@ -298,9 +298,9 @@ struct _FlapConnection
 
 	int fd;
 	PurpleSslConnection *gsc;
-	guint8 header[6];
-	gssize header_received;
-	FlapFrame buffer_incoming;
+	guint8 *buffer_incoming; /**< Received data that hasn't been handled yet. */
+	gsize buffer_incoming_len; /**< The allocated size of buffer_incoming. */
+	gsize buffer_incoming_used; /**< The number of bytes in buffer_incoming. */
 	PurpleCircularBuffer *buffer_outgoing;
 	guint watcher_incoming;
 	guint watcher_outgoing;
@@ -336,6 +336,7 @@ struct aim_ssi_itemlist {
 	struct aim_ssi_item *data;
 	GHashTable *idx_gid_bid;
 	GHashTable *idx_all_named_items;
+	GHashTable *idx_gid_buddies; /**< Queues of buddies keyed by group ID# and name, oldest first. */
 };
 
 /**
@@ -49,9 +49,11 @@ oscar_data_new(void)
 
 	od->ssi.local.idx_gid_bid = g_hash_table_new(g_direct_hash, g_direct_equal);
 	od->ssi.local.idx_all_named_items = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	od->ssi.local.idx_gid_buddies = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_queue_free);
 
 	od->ssi.official.idx_gid_bid = g_hash_table_new(g_direct_hash, g_direct_equal);
 	od->ssi.official.idx_all_named_items = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	od->ssi.official.idx_gid_buddies = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_queue_free);
 
 	/*
 	 * Register all the modules for this session...
@@ -133,9 +135,11 @@ oscar_data_destroy(OscarData *od)
 
 	g_hash_table_destroy(od->ssi.local.idx_gid_bid);
 	g_hash_table_destroy(od->ssi.local.idx_all_named_items);
+	g_hash_table_destroy(od->ssi.local.idx_gid_buddies);
 
 	g_hash_table_destroy(od->ssi.official.idx_gid_bid);
 	g_hash_table_destroy(od->ssi.official.idx_all_named_items);
+	g_hash_table_destroy(od->ssi.official.idx_gid_buddies);
 
 	g_free(od);
 }
@@ -0,0 +1,307 @@
+#include <glib.h>
+
+#include "../oscar.h"
+
+typedef struct {
+	OscarData *od;
+	FlapConnection *conn;
+	aim_module_t *mod;
+} TestOscarFeedbag;
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static void
+test_oscar_feedbag_setup(TestOscarFeedbag *test, gconstpointer data) {
+	test->od = oscar_data_new();
+
+	/* With no fd, everything sent is left in the outgoing buffer */
+	test->conn = flap_connection_new(test->od, SNAC_FAMILY_LOCATE);
+	test->conn->groups = g_slist_prepend(test->conn->groups,
+	                                     GUINT_TO_POINTER(SNAC_FAMILY_FEEDBAG));
+
+	test->mod = aim__findmodulebygroup(test->od, SNAC_FAMILY_FEEDBAG);
+	g_assert_nonnull(test->mod);
+}
+
+static void
+test_oscar_feedbag_teardown(TestOscarFeedbag *test, gconstpointer data) {
+	/* flap_connection_destroy wants a PurpleConnection, which we don't have */
+	test->od->oscar_connections = g_slist_remove(test->od->oscar_connections,
+	                                             test->conn);
+	g_slist_free(test->conn->groups);
+	g_object_unref(test->conn->buffer_outgoing);
+	g_hash_table_destroy(test->conn->rateclass_members);
+	g_free(test->conn);
+
+	oscar_data_destroy(test->od);
+}
+
+static guint16
+test_oscar_feedbag_get16(const guint8 *data) {
+	return (data[0] << 8) | data[1];
+}
+
+/* Returns what was sent since the last call, as a comma separated list of
+ * "begin", "end" and "add", "mod" or "del" with their item counts. */
+static gchar *
+test_oscar_feedbag_sent(TestOscarFeedbag *test) {
+	PurpleCircularBuffer *buffer = test->conn->buffer_outgoing;
+	GByteArray *bytes = g_byte_array_new();
+	GString *sent = g_string_new(NULL);
+	gsize offset = 0;
+	gsize len;
+
+	while ((len = purple_circular_buffer_get_max_read(buffer)) > 0) {
+		g_byte_array_append(bytes,
+		                    (const guint8 *)purple_circular_buffer_get_output(buffer),
+		                    len);
+		purple_circular_buffer_mark_read(buffer, len);
+	}
+
+	while (offset < bytes->len) {
+		const guint8 *frame = bytes->data + offset;
+		gsize end, pos;
+		guint16 subtype;
+		guint count = 0;
+
+		g_assert_cmpuint(offset + 16, <=, bytes->len);
+		g_assert_cmpuint(frame[0], ==, 0x2a);
+		g_assert_cmpuint(frame[1], ==, 0x02);
+		end = 6 + test_oscar_feedbag_get16(frame + 4);
+		g_assert_cmpuint(offset + end, <=, bytes->len);
+		g_assert_cmpuint(test_oscar_feedbag_get16(frame + 6), ==,
+		                 SNAC_FAMILY_FEEDBAG);
+		subtype = test_oscar_feedbag_get16(frame + 8);
+
+		/* Each item is a name, gid, bid, type and its TLVs */
+		for (pos = 16; pos < end; count++) {
+			pos += 2 + test_oscar_feedbag_get16(frame + pos) + 6;
+			pos += 2 + test_oscar_feedbag_get16(frame + pos);
+		}
+		g_assert_cmpuint(pos, ==, end);
+
+		if (sent->len > 0)
+			g_string_append_c(sent, ',');
+
+		switch (subtype) {
+			case SNAC_SUBTYPE_FEEDBAG_EDITSTART:
+				g_string_append(sent, "begin");
+				break;
+			case SNAC_SUBTYPE_FEEDBAG_EDITSTOP:
+				g_string_append(sent, "end");
+				break;
+			case SNAC_SUBTYPE_FEEDBAG_ADD:
+				g_string_append_printf(sent, "add:%u", count);
+				break;
+			case SNAC_SUBTYPE_FEEDBAG_MOD:
+				g_string_append_printf(sent, "mod:%u", count);
+				break;
+			case SNAC_SUBTYPE_FEEDBAG_DEL:
+				g_string_append_printf(sent, "del:%u", count);
+				break;
+			default:
+				g_string_append_printf(sent, "0x%04x", subtype);
+				break;
+		}
+
+		offset += end;
+	}
+
+	g_byte_array_free(bytes, TRUE);
+
+	return g_string_free(sent, FALSE);
+}
+
+static void
+test_oscar_feedbag_assert_sent(TestOscarFeedbag *test, const gchar *expected) {
+	gchar *sent = test_oscar_feedbag_sent(test);
+
+	g_assert_cmpstr(sent, ==, expected);
+
+	g_free(sent);
+}
+
+static void
+test_oscar_feedbag_receive(TestOscarFeedbag *test, guint16 subtype,
+                           ByteStream *bs)
+{
+	aim_modsnac_t snac;
+
+	snac.family = SNAC_FAMILY_FEEDBAG;
+	snac.subtype = subtype;
+	snac.flags = 0;
+	snac.id = 0;
+
+	byte_stream_rewind(bs);
+	test->mod->snachandler(test->od, test->conn, test->mod, NULL, &snac, bs);
+	byte_stream_destroy(bs);
+}
+
+/* Acks everything pending, which must be exactly count items */
+static void
+test_oscar_feedbag_ack(TestOscarFeedbag *test, guint count) {
+	struct aim_ssi_tmp *cur;
+	ByteStream bs;
+	guint i = 0;
+
+	for (cur = test->od->ssi.pending; cur; cur = cur->next)
+		i++;
+	g_assert_cmpuint(i, ==, count);
+
+	byte_stream_new(&bs, 2 * count);
+	for (i = 0; i < count; i++)
+		byte_stream_put16(&bs, 0x0000);
+
+	test_oscar_feedbag_receive(test, SNAC_SUBTYPE_FEEDBAG_SRVACK, &bs);
+}
+
+static void
+test_oscar_feedbag_receive_mod(TestOscarFeedbag *test, const gchar *name,
+                               guint16 gid, guint16 bid, guint16 type)
+{
+	ByteStream bs;
+
+	byte_stream_new(&bs, 10 + strlen(name));
+	byte_stream_put16(&bs, strlen(name));
+	byte_stream_putstr(&bs, name);
+	byte_stream_put16(&bs, gid);
+	byte_stream_put16(&bs, bid);
+	byte_stream_put16(&bs, type);
+	byte_stream_put16(&bs, 0);
+
+	test_oscar_feedbag_receive(test, SNAC_SUBTYPE_FEEDBAG_MOD, &bs);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_oscar_feedbag_index(TestOscarFeedbag *test, gconstpointer data) {
+	struct aim_ssi_itemlist *local = &test->od->ssi.local;
+	struct aim_ssi_item *first, *second, *item;
+
+	/* The same name twice in one group finds the older one */
+	aim_ssi_addbuddy(test->od, "romeo", "Verona", NULL, NULL, NULL, NULL, FALSE);
+	first = aim_ssi_itemlist_finditem(local, "Verona", "romeo", AIM_SSI_TYPE_BUDDY);
+	g_assert_nonnull(first);
+
+	aim_ssi_addbuddy(test->od, "Romeo", "Verona", NULL, NULL, NULL, NULL, FALSE);
+	item = aim_ssi_itemlist_finditem(local, "Verona", "ROMEO", AIM_SSI_TYPE_BUDDY);
+	g_assert_true(item == first);
+
+	/* Deleting it leaves the newer one to be found */
+	aim_ssi_delbuddy(test->od, "romeo", "Verona");
+	second = aim_ssi_itemlist_finditem(local, "Verona", "romeo", AIM_SSI_TYPE_BUDDY);
+	g_assert_nonnull(second);
+	g_assert_cmpstr(second->name, ==, "Romeo");
+	g_assert_true(aim_ssi_itemlist_find(local, second->gid, second->bid) == second);
+
+	/* Renaming it moves it to the new name */
+	test_oscar_feedbag_receive_mod(test, "juliet", second->gid, second->bid,
+	                               AIM_SSI_TYPE_BUDDY);
+	g_assert_null(aim_ssi_itemlist_finditem(local, "Verona", "romeo",
+	                                        AIM_SSI_TYPE_BUDDY));
+	item = aim_ssi_itemlist_finditem(local, "Verona", "juliet", AIM_SSI_TYPE_BUDDY);
+	g_assert_true(item == second);
+
+	/* Changing its type takes it out of the buddies */
+	test_oscar_feedbag_receive_mod(test, "juliet", second->gid, second->bid,
+	                               AIM_SSI_TYPE_PERMIT);
+	g_assert_null(aim_ssi_itemlist_finditem(local, "Verona", "juliet",
+	                                        AIM_SSI_TYPE_BUDDY));
+	item = aim_ssi_itemlist_finditem(local, NULL, "juliet", AIM_SSI_TYPE_PERMIT);
+	g_assert_true(item == second);
+
+	/* And back again */
+	test_oscar_feedbag_receive_mod(test, "juliet", second->gid, second->bid,
+	                               AIM_SSI_TYPE_BUDDY);
+	g_assert_null(aim_ssi_itemlist_finditem(local, NULL, "juliet",
+	                                        AIM_SSI_TYPE_PERMIT));
+	item = aim_ssi_itemlist_finditem(local, "Verona", "juliet", AIM_SSI_TYPE_BUDDY);
+	g_assert_true(item == second);
+
+	aim_ssi_delbuddy(test->od, "juliet", "Verona");
+	g_assert_null(aim_ssi_itemlist_finditem(local, "Verona", "juliet",
+	                                        AIM_SSI_TYPE_BUDDY));
+	g_assert_null(aim_ssi_itemlist_finditem(local, "Verona", "romeo",
+	                                        AIM_SSI_TYPE_BUDDY));
+}
+
+static void
+test_oscar_feedbag_sync(TestOscarFeedbag *test, gconstpointer data) {
+	struct aim_ssi_itemlist *official = &test->od->ssi.official;
+	gchar name[16];
+	gint i;
+
+	/* The master group, the group and the buddy go in one SNAC */
+	aim_ssi_addbuddy(test->od, "buddy00", "Verona", NULL, NULL, NULL, NULL, FALSE);
+	test_oscar_feedbag_assert_sent(test, "begin,add:3");
+	test_oscar_feedbag_ack(test, 3);
+	test_oscar_feedbag_assert_sent(test, "end");
+	g_assert_false(test->od->ssi.in_transaction);
+	g_assert_false(test->od->ssi.waiting_for_ack);
+
+	/* Nothing else is sent until the first add is acked */
+	aim_ssi_addbuddy(test->od, "buddy01", "Verona", NULL, NULL, NULL, NULL, FALSE);
+	test_oscar_feedbag_assert_sent(test, "begin,add:1");
+	for (i = 2; i < 20; i++) {
+		g_snprintf(name, sizeof(name), "buddy%02d", i);
+		aim_ssi_addbuddy(test->od, name, "Verona", NULL, NULL, NULL, NULL, FALSE);
+	}
+	test_oscar_feedbag_assert_sent(test, "");
+
+	/* The rest go 15 at a time, and the group follows once they're in */
+	test_oscar_feedbag_ack(test, 1);
+	test_oscar_feedbag_assert_sent(test, "add:15,add:3");
+	test_oscar_feedbag_ack(test, 18);
+	test_oscar_feedbag_assert_sent(test, "mod:1");
+	test_oscar_feedbag_ack(test, 1);
+	test_oscar_feedbag_assert_sent(test, "end");
+	g_assert_false(test->od->ssi.in_transaction);
+	g_assert_false(test->od->ssi.waiting_for_ack);
+
+	for (i = 0; i < 20; i++) {
+		g_snprintf(name, sizeof(name), "buddy%02d", i);
+		g_assert_nonnull(aim_ssi_itemlist_finditem(official, "Verona", name,
+		                                           AIM_SSI_TYPE_BUDDY));
+	}
+
+	/* Deletions go before additions */
+	aim_ssi_delbuddy(test->od, "buddy00", "Verona");
+	test_oscar_feedbag_assert_sent(test, "begin,del:1");
+	aim_ssi_delbuddy(test->od, "buddy01", "Verona");
+	aim_ssi_addbuddy(test->od, "tybalt", "Verona", NULL, NULL, NULL, NULL, FALSE);
+	test_oscar_feedbag_assert_sent(test, "");
+
+	test_oscar_feedbag_ack(test, 1);
+	test_oscar_feedbag_assert_sent(test, "del:1,add:1");
+	test_oscar_feedbag_ack(test, 2);
+	test_oscar_feedbag_assert_sent(test, "mod:1");
+	test_oscar_feedbag_ack(test, 1);
+	test_oscar_feedbag_assert_sent(test, "end");
+
+	g_assert_null(aim_ssi_itemlist_finditem(official, "Verona", "buddy00",
+	                                        AIM_SSI_TYPE_BUDDY));
+	g_assert_null(aim_ssi_itemlist_finditem(official, "Verona", "buddy01",
+	                                        AIM_SSI_TYPE_BUDDY));
+	g_assert_nonnull(aim_ssi_itemlist_finditem(official, "Verona", "tybalt",
+	                                           AIM_SSI_TYPE_BUDDY));
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/oscar/feedbag/index", TestOscarFeedbag, NULL,
+	           test_oscar_feedbag_setup, test_oscar_feedbag_index,
+	           test_oscar_feedbag_teardown);
+	g_test_add("/oscar/feedbag/sync", TestOscarFeedbag, NULL,
+	           test_oscar_feedbag_setup, test_oscar_feedbag_sync,
+	           test_oscar_feedbag_teardown);
+
+	return g_test_run();
+}
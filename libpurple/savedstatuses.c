@@ -720,6 +720,8 @@ purple_savedstatus_delete_by_status(PurpleSavedStatus *status)
 	 * If we just deleted our current status or our idleaway status,
 	 * then set the appropriate pref back to 0.
 	 */
+	purple_prefs_begin_batch();
+
 	current = purple_prefs_get_int("/purple/savedstatus/default");
 	if (current == creation_time)
 		purple_prefs_set_int("/purple/savedstatus/default", 0);
@@ -728,6 +730,8 @@ purple_savedstatus_delete_by_status(PurpleSavedStatus *status)
 	if (idleaway == creation_time)
 		purple_prefs_set_int("/purple/savedstatus/idleaway", 0);
 
+	purple_prefs_commit_batch();
+
 	purple_signal_emit(purple_savedstatuses_get_handle(),
 			"savedstatus-deleted", status);
 }
@@ -868,11 +872,16 @@ purple_savedstatus_set_idleaway(gboolean idleaway)
 		/* Don't need to do anything */
 		return;
 
+	/* Looking up the status may set a pref of its own */
+	purple_prefs_begin_batch();
+
 	old = purple_savedstatus_get_current();
 	saved_status = idleaway ? purple_savedstatus_get_idleaway()
 			: purple_savedstatus_get_default();
 	purple_prefs_set_bool("/purple/savedstatus/isidleaway", idleaway);
 
+	purple_prefs_commit_batch();
+
 	/* Changing our status makes us un-idle */
 	if (!idleaway)
 		purple_idle_touch();
@@ -1105,6 +1114,10 @@ purple_savedstatus_activate(PurpleSavedStatus *saved_status)
 
 	g_return_if_fail(saved_status != NULL);
 
+	/* Leaving idleaway changes a second pref; the callbacks of both
+	 * run once everything is set. */
+	purple_prefs_begin_batch();
+
 	/* Make sure our list of saved statuses remains sorted */
 	saved_status->lastused = time(NULL);
 	saved_status->usage_count++;
@@ -1131,6 +1144,8 @@ purple_savedstatus_activate(PurpleSavedStatus *saved_status)
 		purple_signal_emit(purple_savedstatuses_get_handle(), "savedstatus-changed",
 					 	   saved_status, old);
 	}
+
+	purple_prefs_commit_batch();
 }
 
 void
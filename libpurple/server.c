@@ -517,8 +517,9 @@ void purple_serv_got_im(PurpleConnection *gc, const char *who, const char *msg,
 	angel = g_strdup(who);
 
 	plugin_return = GPOINTER_TO_INT(
-		purple_signal_emit_return_1(purple_conversations_get_handle(),
-								  "receiving-im-msg", purple_connection_get_account(gc),
+		purple_signal_emit_return_1_by_id(_purple_conversations_get_signal_id(
+								  PURPLE_CONVERSATIONS_SIGNAL_RECEIVING_IM_MSG),
+								  purple_connection_get_account(gc),
 								  &angel, &buffy, im, &flags));
 
 	if (!buffy || !angel || plugin_return) {
@@ -530,7 +531,8 @@ void purple_serv_got_im(PurpleConnection *gc, const char *who, const char *msg,
 	name = angel;
 	message = buffy;
 
-	purple_signal_emit(purple_conversations_get_handle(), "received-im-msg", purple_connection_get_account(gc),
+	purple_signal_emit_by_id(_purple_conversations_get_signal_id(
+					 PURPLE_CONVERSATIONS_SIGNAL_RECEIVED_IM_MSG), purple_connection_get_account(gc),
 					 name, message, im, flags);
 
 	/* search for conversation again in case it was created by received-im-msg handler */
@@ -634,16 +636,19 @@ void purple_serv_got_typing(PurpleConnection *gc, const char *name, int timeout,
 		switch (state)
 		{
 			case PURPLE_IM_TYPING:
-				purple_signal_emit(purple_conversations_get_handle(),
-								   "buddy-typing", purple_connection_get_account(gc), name);
+				purple_signal_emit_by_id(_purple_conversations_get_signal_id(
+								   PURPLE_CONVERSATIONS_SIGNAL_BUDDY_TYPING),
+								   purple_connection_get_account(gc), name);
 				break;
 			case PURPLE_IM_TYPED:
-				purple_signal_emit(purple_conversations_get_handle(),
-								   "buddy-typed", purple_connection_get_account(gc), name);
+				purple_signal_emit_by_id(_purple_conversations_get_signal_id(
+								   PURPLE_CONVERSATIONS_SIGNAL_BUDDY_TYPED),
+								   purple_connection_get_account(gc), name);
 				break;
 			case PURPLE_IM_NOT_TYPING:
-				purple_signal_emit(purple_conversations_get_handle(),
-								   "buddy-typing-stopped", purple_connection_get_account(gc), name);
+				purple_signal_emit_by_id(_purple_conversations_get_signal_id(
+								   PURPLE_CONVERSATIONS_SIGNAL_BUDDY_TYPING_STOPPED),
+								   purple_connection_get_account(gc), name);
 				break;
 		}
 	}
@@ -667,8 +672,9 @@ void purple_serv_got_typing_stopped(PurpleConnection *gc, const char *name) {
 	}
 	else
 	{
-		purple_signal_emit(purple_conversations_get_handle(),
-						 "buddy-typing-stopped", purple_connection_get_account(gc), name);
+		purple_signal_emit_by_id(_purple_conversations_get_signal_id(
+						 PURPLE_CONVERSATIONS_SIGNAL_BUDDY_TYPING_STOPPED),
+						 purple_connection_get_account(gc), name);
 	}
 }
 
@@ -859,8 +865,9 @@ void purple_serv_got_chat_in(PurpleConnection *g, int id, const char *who,
 	angel = g_strdup(who);
 
 	plugin_return = GPOINTER_TO_INT(
-		purple_signal_emit_return_1(purple_conversations_get_handle(),
-								  "receiving-chat-msg", purple_connection_get_account(g),
+		purple_signal_emit_return_1_by_id(_purple_conversations_get_signal_id(
+								  PURPLE_CONVERSATIONS_SIGNAL_RECEIVING_CHAT_MSG),
+								  purple_connection_get_account(g),
 								  &angel, &buffy, chat, &flags));
 
 	if (!buffy || !angel || plugin_return) {
@@ -872,7 +879,8 @@ void purple_serv_got_chat_in(PurpleConnection *g, int id, const char *who,
 	who = angel;
 	message = buffy;
 
-	purple_signal_emit(purple_conversations_get_handle(), "received-chat-msg", purple_connection_get_account(g),
+	purple_signal_emit_by_id(_purple_conversations_get_signal_id(
+					 PURPLE_CONVERSATIONS_SIGNAL_RECEIVED_CHAT_MSG), purple_connection_get_account(g),
 					 who, message, chat, flags);
 
 	if (flags & PURPLE_MESSAGE_RECV)
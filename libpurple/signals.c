@@ -34,13 +34,24 @@ typedef struct
 	GHashTable *signals;
 	size_t signal_count;
 
-	gulong next_signal_id;
-
 } PurpleInstanceData;
 
 typedef struct
 {
 	gulong id;
+	PurpleCallback cb;
+	void *handle;
+	void *data;
+	gboolean use_vargs;
+	int priority;
+
+} PurpleSignalHandlerData;
+
+typedef struct
+{
+	gulong id;
+	/* owned by the signals table of the instance */
+	const char *name;
 
 	PurpleSignalMarshalFunc marshal;
 
@@ -48,25 +59,27 @@ typedef struct
 	GType *value_types;
 	GType ret_type;
 
-	GList *handlers;
+	/*
+	 * Handlers are kept in a single block, sorted by handler_compare().
+	 * While the signal is being emitted, the block isn't reordered:
+	 * disconnected handlers are only marked by a NULL callback and new ones
+	 * are appended, until the outermost emission is done.
+	 */
+	PurpleSignalHandlerData *handlers;
+	guint handlers_len;
+	guint handlers_alloc;
 	size_t handler_count;
+	guint emitting;
+	gboolean handlers_dirty;
 
 	gulong next_handler_id;
 } PurpleSignalData;
 
-typedef struct
-{
-	gulong id;
-	PurpleCallback cb;
-	void *handle;
-	void *data;
-	gboolean use_vargs;
-	int priority;
-
-} PurpleSignalHandlerData;
-
 static GHashTable *instance_table = NULL;
 
+/* PurpleSignalData indexed by their IDs; unregistered ones leave a NULL. */
+static GPtrArray *signal_table = NULL;
+
 static void
 destroy_instance_data(PurpleInstanceData *instance_data)
 {
@@ -78,13 +91,24 @@ destroy_instance_data(PurpleInstanceData *instance_data)
 static void
 destroy_signal_data(PurpleSignalData *signal_data)
 {
-	g_list_foreach(signal_data->handlers, (GFunc)g_free, NULL);
-	g_list_free(signal_data->handlers);
+	if (signal_table != NULL)
+		g_ptr_array_index(signal_table, signal_data->id) = NULL;
+
+	g_free(signal_data->handlers);
 
 	g_free(signal_data->value_types);
 	g_free(signal_data);
 }
 
+static PurpleSignalData *
+signal_data_by_id(gulong signal_id)
+{
+	if (signal_table == NULL || signal_id >= signal_table->len)
+		return NULL;
+
+	return g_ptr_array_index(signal_table, signal_id);
+}
+
 gulong
 purple_signal_register(void *instance, const char *signal,
 					 PurpleSignalMarshalFunc marshal,
@@ -92,11 +116,13 @@ purple_signal_register(void *instance, const char *signal,
 {
 	PurpleInstanceData *instance_data;
 	PurpleSignalData *signal_data;
+	char *name;
 	va_list args;
 
 	g_return_val_if_fail(instance != NULL, 0);
 	g_return_val_if_fail(signal   != NULL, 0);
 	g_return_val_if_fail(marshal  != NULL, 0);
+	g_return_val_if_fail(signal_table != NULL, 0);
 
 	instance_data =
 		(PurpleInstanceData *)g_hash_table_lookup(instance_table, instance);
@@ -106,7 +132,6 @@ purple_signal_register(void *instance, const char *signal,
 		instance_data = g_new0(PurpleInstanceData, 1);
 
 		instance_data->instance = instance;
-		instance_data->next_signal_id = 1;
 
 		instance_data->signals =
 			g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
@@ -116,7 +141,7 @@ purple_signal_register(void *instance, const char *signal,
 	}
 
 	signal_data = g_new0(PurpleSignalData, 1);
-	signal_data->id              = instance_data->next_signal_id;
+	signal_data->id              = signal_table->len;
 	signal_data->marshal         = marshal;
 	signal_data->next_handler_id = 1;
 	signal_data->ret_type        = ret_type;
@@ -136,10 +161,12 @@ purple_signal_register(void *instance, const char *signal,
 		va_end(args);
 	}
 
-	g_hash_table_insert(instance_data->signals,
-						g_strdup(signal), signal_data);
+	g_ptr_array_add(signal_table, signal_data);
+
+	name = g_strdup(signal);
+	signal_data->name = name;
+	g_hash_table_replace(instance_data->signals, name, signal_data);
 
-	instance_data->next_signal_id++;
 	instance_data->signal_count++;
 
 	return signal_data->id;
@@ -183,6 +210,30 @@ purple_signals_unregister_by_instance(void *instance)
 	/* g_return_if_fail(found); */
 }
 
+gulong
+purple_signal_lookup(void *instance, const char *signal)
+{
+	PurpleInstanceData *instance_data;
+	PurpleSignalData *signal_data;
+
+	g_return_val_if_fail(instance != NULL, 0);
+	g_return_val_if_fail(signal   != NULL, 0);
+
+	instance_data =
+		(PurpleInstanceData *)g_hash_table_lookup(instance_table, instance);
+
+	if (instance_data == NULL)
+		return 0;
+
+	signal_data =
+		(PurpleSignalData *)g_hash_table_lookup(instance_data->signals, signal);
+
+	if (signal_data == NULL)
+		return 0;
+
+	return signal_data->id;
+}
+
 void
 purple_signal_get_types(void *instance, const char *signal,
 					   GType *ret_type,
@@ -215,21 +266,104 @@ purple_signal_get_types(void *instance, const char *signal,
 		*ret_type = signal_data->ret_type;
 }
 
-static gint handler_priority(void * a, void * b) {
-	PurpleSignalHandlerData *ah = (PurpleSignalHandlerData*)a;
-	PurpleSignalHandlerData *bh = (PurpleSignalHandlerData*)b;
+/*
+ * Lower priorities go first. Handlers of the same priority are called from
+ * the most recently connected one, as they always were.
+ */
+static gint
+handler_compare(const void *a, const void *b)
+{
+	const PurpleSignalHandlerData *ah = a;
+	const PurpleSignalHandlerData *bh = b;
+
 	if (ah->priority > bh->priority) return 1;
 	if (ah->priority < bh->priority) return -1;
+	if (ah->id < bh->id) return 1;
+	if (ah->id > bh->id) return -1;
 	return 0;
 }
 
+static void
+signal_handlers_insert(PurpleSignalData *signal_data,
+                       const PurpleSignalHandlerData *handler_data)
+{
+	guint i;
+
+	if (signal_data->handlers_len == signal_data->handlers_alloc)
+	{
+		signal_data->handlers_alloc = MAX(4, signal_data->handlers_alloc * 2);
+		signal_data->handlers = g_renew(PurpleSignalHandlerData,
+			signal_data->handlers, signal_data->handlers_alloc);
+	}
+
+	if (signal_data->emitting > 0)
+	{
+		/* Don't move the handlers under the running emission. */
+		i = signal_data->handlers_len;
+		signal_data->handlers_dirty = TRUE;
+	}
+	else
+	{
+		for (i = 0; i < signal_data->handlers_len; i++)
+		{
+			if (handler_compare(handler_data, &signal_data->handlers[i]) < 0)
+				break;
+		}
+
+		memmove(&signal_data->handlers[i + 1], &signal_data->handlers[i],
+			(signal_data->handlers_len - i) * sizeof(PurpleSignalHandlerData));
+	}
+
+	signal_data->handlers[i] = *handler_data;
+	signal_data->handlers_len++;
+	signal_data->handler_count++;
+}
+
+static void
+signal_handlers_remove(PurpleSignalData *signal_data, guint i)
+{
+	if (signal_data->emitting > 0)
+	{
+		signal_data->handlers[i].cb = NULL;
+		signal_data->handlers[i].handle = NULL;
+		signal_data->handlers_dirty = TRUE;
+	}
+	else
+	{
+		memmove(&signal_data->handlers[i], &signal_data->handlers[i + 1],
+			(signal_data->handlers_len - i - 1) *
+			sizeof(PurpleSignalHandlerData));
+		signal_data->handlers_len--;
+	}
+
+	signal_data->handler_count--;
+}
+
+static void
+signal_handlers_compact(PurpleSignalData *signal_data)
+{
+	guint i, j = 0;
+
+	for (i = 0; i < signal_data->handlers_len; i++)
+	{
+		if (signal_data->handlers[i].cb != NULL)
+			signal_data->handlers[j++] = signal_data->handlers[i];
+	}
+
+	signal_data->handlers_len = j;
+	qsort(signal_data->handlers, signal_data->handlers_len,
+		sizeof(PurpleSignalHandlerData), handler_compare);
+
+	signal_data->handlers_dirty = FALSE;
+}
+
 static gulong
 signal_connect_common(void *instance, const char *signal, void *handle,
 					  PurpleCallback func, void *data, int priority, gboolean use_vargs)
 {
 	PurpleInstanceData *instance_data;
 	PurpleSignalData *signal_data;
-	PurpleSignalHandlerData *handler_data;
+	PurpleSignalHandlerData handler_data;
 
 	g_return_val_if_fail(instance != NULL, 0);
 	g_return_val_if_fail(signal   != NULL, 0);
@@ -260,19 +394,17 @@ signal_connect_common(void *instance, const char *signal, void *handle,
 	}
 
 	/* Create the signal handler data */
-	handler_data = g_new0(PurpleSignalHandlerData, 1);
-	handler_data->id        = signal_data->next_handler_id;
-	handler_data->cb        = func;
-	handler_data->handle    = handle;
-	handler_data->data      = data;
-	handler_data->use_vargs = use_vargs;
-	handler_data->priority = priority;
-
-	signal_data->handlers = g_list_insert_sorted(signal_data->handlers, handler_data, (GCompareFunc)handler_priority);
-	signal_data->handler_count++;
+	handler_data.id        = signal_data->next_handler_id;
+	handler_data.cb        = func;
+	handler_data.handle    = handle;
+	handler_data.data      = data;
+	handler_data.use_vargs = use_vargs;
+	handler_data.priority  = priority;
+
+	signal_handlers_insert(signal_data, &handler_data);
 	signal_data->next_handler_id++;
 
-	return handler_data->id;
+	return handler_data.id;
 }
 
 gulong
@@ -309,8 +441,7 @@ purple_signal_disconnect(void *instance, const char *signal,
 {
 	PurpleInstanceData *instance_data;
 	PurpleSignalData *signal_data;
-	PurpleSignalHandlerData *handler_data;
-	GList *l;
+	guint i;
 	gboolean found = FALSE;
 
 	g_return_if_fail(instance != NULL);
@@ -336,17 +467,13 @@ purple_signal_disconnect(void *instance, const char *signal,
 	}
 
 	/* Find the handler data. */
-	for (l = signal_data->handlers; l != NULL; l = l->next)
+	for (i = 0; i < signal_data->handlers_len; i++)
 	{
-		handler_data = (PurpleSignalHandlerData *)l->data;
+		PurpleSignalHandlerData *handler_data = &signal_data->handlers[i];
 
 		if (handler_data->handle == handle && handler_data->cb == func)
 		{
-			g_free(handler_data);
-
-			signal_data->handlers = g_list_delete_link(signal_data->handlers,
-												       l);
-			signal_data->handler_count--;
+			signal_handlers_remove(signal_data, i);
 
 			found = TRUE;
 
@@ -366,22 +493,15 @@ static void
 disconnect_handle_from_signals(const char *signal,
 							   PurpleSignalData *signal_data, void *handle)
 {
-	GList *l, *l_next;
-	PurpleSignalHandlerData *handler_data;
+	guint i = signal_data->handlers_len;
 
-	for (l = signal_data->handlers; l != NULL; l = l_next)
+	/* backwards, so removing a handler doesn't move the unvisited ones */
+	while (i-- > 0)
 	{
-		handler_data = (PurpleSignalHandlerData *)l->data;
-		l_next = l->next;
+		PurpleSignalHandlerData *handler_data = &signal_data->handlers[i];
 
-		if (handler_data->handle == handle)
-		{
-			g_free(handler_data);
-
-			signal_data->handler_count--;
-			signal_data->handlers = g_list_delete_link(signal_data->handlers,
-			                                           l);
-		}
+		if (handler_data->cb != NULL && handler_data->handle == handle)
+			signal_handlers_remove(signal_data, i);
 	}
 }
 
@@ -403,6 +523,131 @@ purple_signals_disconnect_by_handle(void *handle)
 						 (GHFunc)disconnect_handle_from_instance, handle);
 }
 
+gboolean
+purple_signal_has_handlers(void *instance, const char *signal)
+{
+	PurpleInstanceData *instance_data;
+	PurpleSignalData *signal_data;
+
+	g_return_val_if_fail(instance != NULL, FALSE);
+	g_return_val_if_fail(signal   != NULL, FALSE);
+
+	instance_data =
+		(PurpleInstanceData *)g_hash_table_lookup(instance_table, instance);
+
+	if (instance_data == NULL)
+		return FALSE;
+
+	signal_data =
+		(PurpleSignalData *)g_hash_table_lookup(instance_data->signals, signal);
+
+	return (signal_data != NULL && signal_data->handler_count > 0);
+}
+
+static void
+signal_emit_end(PurpleSignalData *signal_data)
+{
+	signal_data->emitting--;
+
+	if (signal_data->emitting == 0 && signal_data->handlers_dirty)
+		signal_handlers_compact(signal_data);
+}
+
+static void
+signal_emit(PurpleSignalData *signal_data, va_list args)
+{
+	va_list tmp;
+	guint i;
+
+	if (signal_data->handler_count > 0)
+	{
+		signal_data->emitting++;
+
+		/* Handlers connected in the meantime are appended, so they get
+		 * called too. */
+		for (i = 0; i < signal_data->handlers_len; i++)
+		{
+			/* A copy, as the block may be reallocated by the callback. */
+			PurpleSignalHandlerData handler_data = signal_data->handlers[i];
+
+			if (handler_data.cb == NULL)
+				continue;
+
+			/* This is necessary because a va_list may only be
+			 * evaluated once */
+			G_VA_COPY(tmp, args);
+
+			if (handler_data.use_vargs)
+			{
+				((void (*)(va_list, void *))handler_data.cb)(tmp,
+															 handler_data.data);
+			}
+			else
+			{
+				signal_data->marshal(handler_data.cb, tmp,
+									 handler_data.data, NULL);
+			}
+
+			va_end(tmp);
+		}
+
+		signal_emit_end(signal_data);
+	}
+
+#ifdef HAVE_DBUS
+	if (purple_dbus_signal_is_subscribed(signal_data->name))
+		purple_dbus_signal_emit_purple(signal_data->name,
+				signal_data->num_values, signal_data->value_types, args);
+#endif	/* HAVE_DBUS */
+}
+
+static void *
+signal_emit_return_1(PurpleSignalData *signal_data, va_list args)
+{
+	void *ret_val = NULL;
+	va_list tmp;
+	guint i;
+
+#ifdef HAVE_DBUS
+	if (purple_dbus_signal_is_subscribed(signal_data->name)) {
+		G_VA_COPY(tmp, args);
+		purple_dbus_signal_emit_purple(signal_data->name,
+				signal_data->num_values, signal_data->value_types, tmp);
+		va_end(tmp);
+	}
+#endif	/* HAVE_DBUS */
+
+	if (signal_data->handler_count == 0)
+		return NULL;
+
+	signal_data->emitting++;
+
+	for (i = 0; i < signal_data->handlers_len && ret_val == NULL; i++)
+	{
+		PurpleSignalHandlerData handler_data = signal_data->handlers[i];
+
+		if (handler_data.cb == NULL)
+			continue;
+
+		G_VA_COPY(tmp, args);
+		if (handler_data.use_vargs)
+		{
+			ret_val = ((void *(*)(va_list, void *))handler_data.cb)(
+				tmp, handler_data.data);
+		}
+		else
+		{
+			signal_data->marshal(handler_data.cb, tmp,
+								 handler_data.data, &ret_val);
+		}
+		va_end(tmp);
+	}
+
+	signal_emit_end(signal_data);
+
+	return ret_val;
+}
+
 void
 purple_signal_emit(void *instance, const char *signal, ...)
 {
@@ -421,9 +666,6 @@ purple_signal_emit_vargs(void *instance, const char *signal, va_list args)
 {
 	PurpleInstanceData *instance_data;
 	PurpleSignalData *signal_data;
-	PurpleSignalHandlerData *handler_data;
-	GList *l, *l_next;
-	va_list tmp;
 
 	g_return_if_fail(instance != NULL);
 	g_return_if_fail(signal   != NULL);
@@ -443,35 +685,33 @@ purple_signal_emit_vargs(void *instance, const char *signal, va_list args)
 		return;
 	}
 
-	for (l = signal_data->handlers; l != NULL; l = l_next)
-	{
-		l_next = l->next;
+	signal_emit(signal_data, args);
+}
 
-		handler_data = (PurpleSignalHandlerData *)l->data;
+void
+purple_signal_emit_by_id(gulong signal_id, ...)
+{
+	va_list args;
 
-		/* This is necessary because a va_list may only be
-		 * evaluated once */
-		G_VA_COPY(tmp, args);
+	va_start(args, signal_id);
+	purple_signal_emit_vargs_by_id(signal_id, args);
+	va_end(args);
+}
 
-		if (handler_data->use_vargs)
-		{
-			((void (*)(va_list, void *))handler_data->cb)(tmp,
-														  handler_data->data);
-		}
-		else
-		{
-			signal_data->marshal(handler_data->cb, tmp,
-								 handler_data->data, NULL);
-		}
+void
+purple_signal_emit_vargs_by_id(gulong signal_id, va_list args)
+{
+	PurpleSignalData *signal_data;
 
-		va_end(tmp);
-	}
+	/* 0 is what a failed or skipped registration hands back */
+	if (signal_id == 0)
+		return;
 
-#ifdef HAVE_DBUS
-	purple_dbus_signal_emit_purple(signal, signal_data->num_values,
-				   signal_data->value_types, args);
-#endif	/* HAVE_DBUS */
+	signal_data = signal_data_by_id(signal_id);
 
+	g_return_if_fail(signal_data != NULL);
+
+	signal_emit(signal_data, args);
 }
 
 void *
@@ -496,9 +736,6 @@ purple_signal_emit_vargs_return_1(void *instance, const char *signal,
 {
 	PurpleInstanceData *instance_data;
 	PurpleSignalData *signal_data;
-	PurpleSignalHandlerData *handler_data;
-	GList *l, *l_next;
-	va_list tmp;
 
 	g_return_val_if_fail(instance != NULL, NULL);
 	g_return_val_if_fail(signal   != NULL, NULL);
@@ -518,39 +755,35 @@ purple_signal_emit_vargs_return_1(void *instance, const char *signal,
 		return 0;
 	}
 
-#ifdef HAVE_DBUS
-	G_VA_COPY(tmp, args);
-	purple_dbus_signal_emit_purple(signal, signal_data->num_values,
-				   signal_data->value_types, tmp);
-	va_end(tmp);
-#endif	/* HAVE_DBUS */
+	return signal_emit_return_1(signal_data, args);
+}
 
-	for (l = signal_data->handlers; l != NULL; l = l_next)
-	{
-		void *ret_val = NULL;
+void *
+purple_signal_emit_return_1_by_id(gulong signal_id, ...)
+{
+	void *ret_val;
+	va_list args;
 
-		l_next = l->next;
+	va_start(args, signal_id);
+	ret_val = purple_signal_emit_vargs_return_1_by_id(signal_id, args);
+	va_end(args);
 
-		handler_data = (PurpleSignalHandlerData *)l->data;
+	return ret_val;
+}
 
-		G_VA_COPY(tmp, args);
-		if (handler_data->use_vargs)
-		{
-			ret_val = ((void *(*)(va_list, void *))handler_data->cb)(
-				tmp, handler_data->data);
-		}
-		else
-		{
-			signal_data->marshal(handler_data->cb, tmp,
-								 handler_data->data, &ret_val);
-		}
-		va_end(tmp);
+void *
+purple_signal_emit_vargs_return_1_by_id(gulong signal_id, va_list args)
+{
+	PurpleSignalData *signal_data;
 
-		if (ret_val != NULL)
-			return ret_val;
-	}
+	if (signal_id == 0)
+		return NULL;
+
+	signal_data = signal_data_by_id(signal_id);
 
-	return NULL;
+	g_return_val_if_fail(signal_data != NULL, NULL);
+
+	return signal_emit_return_1(signal_data, args);
 }
 
 void
@@ -561,6 +794,10 @@ purple_signals_init()
 	instance_table =
 		g_hash_table_new_full(g_direct_hash, g_direct_equal,
 							  NULL, (GDestroyNotify)destroy_instance_data);
+
+	/* 0 is never a valid signal ID */
+	signal_table = g_ptr_array_new();
+	g_ptr_array_add(signal_table, NULL);
 }
 
 void
@@ -570,6 +807,9 @@ purple_signals_uninit()
 
 	g_hash_table_destroy(instance_table);
 	instance_table = NULL;
+
+	g_ptr_array_free(signal_table, TRUE);
+	signal_table = NULL;
 }
 
 /**************************************************************************
@@ -86,8 +86,9 @@ G_BEGIN_DECLS
  *
  * Registers a signal in an instance.
  *
- * Returns: The signal ID local to that instance, or 0 if the signal
- *          couldn't be registered.
+ * Returns: The signal ID, or 0 if the signal couldn't be registered. The ID
+ *          is unique across all instances and can be passed to
+ *          purple_signal_emit_by_id().
  */
 gulong purple_signal_register(void *instance, const char *signal,
 							PurpleSignalMarshalFunc marshal,
@@ -243,6 +244,33 @@ void purple_signal_disconnect(void *instance, const char *signal,
  */
 void purple_signals_disconnect_by_handle(void *handle);
 
+/**
+ * purple_signal_has_handlers:
+ * @instance: The instance the signal is registered on.
+ * @signal:   The name of the signal.
+ *
+ * Checks whether any handler is connected to a signal. This lets the emitter
+ * skip preparing the arguments of a signal no one listens to.
+ *
+ * Returns: %TRUE if at least one handler is connected to the signal.
+ */
+gboolean purple_signal_has_handlers(void *instance, const char *signal);
+
+/**
+ * purple_signal_lookup:
+ * @instance: The instance the signal is registered on.
+ * @signal:   The name of the signal.
+ *
+ * Looks up the ID of a registered signal. Code emitting a signal often can
+ * look it up once and then use purple_signal_emit_by_id(), which avoids
+ * hashing the instance and the signal name on every emission.
+ *
+ * The ID stays valid until the signal is unregistered.
+ *
+ * Returns: The signal ID, or 0 if the signal isn't registered.
+ */
+gulong purple_signal_lookup(void *instance, const char *signal);
+
 /**
  * purple_signal_emit:
  * @instance: The instance emitting the signal.
@@ -298,6 +326,57 @@ void *purple_signal_emit_return_1(void *instance, const char *signal, ...);
 void *purple_signal_emit_vargs_return_1(void *instance, const char *signal,
 									  va_list args);
 
+/**
+ * purple_signal_emit_by_id:
+ * @signal_id: The ID of the signal being emitted.
+ * @...:       The arguments to pass to the callbacks.
+ *
+ * Emits a signal by its ID, as returned by purple_signal_register() or
+ * purple_signal_lookup().  An ID of 0 means "no signal" and is silently
+ * ignored.
+ *
+ * See purple_signal_emit()
+ */
+void purple_signal_emit_by_id(gulong signal_id, ...);
+
+/**
+ * purple_signal_emit_vargs_by_id:
+ * @signal_id: The ID of the signal being emitted.
+ * @args:      The arguments list.
+ *
+ * Emits a signal by its ID, using a va_list of arguments.
+ *
+ * See purple_signal_emit_vargs()
+ */
+void purple_signal_emit_vargs_by_id(gulong signal_id, va_list args);
+
+/**
+ * purple_signal_emit_return_1_by_id:
+ * @signal_id: The ID of the signal being emitted.
+ * @...:       The arguments to pass to the callbacks.
+ *
+ * Emits a signal by its ID and returns the first non-NULL return value.
+ *
+ * See purple_signal_emit_return_1()
+ *
+ * Returns: The first non-NULL return value
+ */
+void *purple_signal_emit_return_1_by_id(gulong signal_id, ...);
+
+/**
+ * purple_signal_emit_vargs_return_1_by_id:
+ * @signal_id: The ID of the signal being emitted.
+ * @args:      The arguments list.
+ *
+ * Emits a signal by its ID, using a va_list of arguments, and returns the
+ * first non-NULL return value.
+ *
+ * See purple_signal_emit_vargs_return_1()
+ *
+ * Returns: The first non-NULL return value
+ */
+void *purple_signal_emit_vargs_return_1_by_id(gulong signal_id, va_list args);
+
 /**
  * purple_signals_init:
  *
@@ -22,6 +22,7 @@
 #define PURPLE_TESTS_H
 
 #include <glib.h>
+#include <gio/gio.h>
 
 G_BEGIN_DECLS
 
@@ -58,6 +59,69 @@ purple_test_string_compare_free(PurpleTestStringFreeFunc func,
 	}
 }
 
+typedef struct {
+	GSocketListener *listener;
+	GSocketConnection *client;
+	GSocketConnection *server;
+} PurpleTestLoopback;
+
+/* Makes listener listen on a free port of 127.0.0.1, and returns the
+ * address it listens on. */
+static inline GSocketAddress *
+purple_test_loopback_listen(GSocketListener *listener)
+{
+	GSocketAddress *address, *effective = NULL;
+	GInetAddress *localhost;
+	GError *error = NULL;
+
+	localhost = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+	address = g_inet_socket_address_new(localhost, 0);
+	g_socket_listener_add_address(listener, address, G_SOCKET_TYPE_STREAM,
+	                              G_SOCKET_PROTOCOL_TCP, NULL, &effective,
+	                              &error);
+	g_assert_no_error(error);
+	g_object_unref(address);
+	g_object_unref(localhost);
+
+	return effective;
+}
+
+/* Connects a client to a server on 127.0.0.1.  Everything runs in this
+ * thread with blocking sockets; the kernel completes the connection before
+ * it is accepted, so whatever is written has to fit in the socket buffers
+ * until the other end reads it. */
+static inline void
+purple_test_loopback_open(PurpleTestLoopback *loopback)
+{
+	GSocketAddress *address;
+	GSocketClient *client;
+	GError *error = NULL;
+
+	loopback->listener = g_socket_listener_new();
+	address = purple_test_loopback_listen(loopback->listener);
+
+	client = g_socket_client_new();
+	loopback->client = g_socket_client_connect(client,
+	                                           G_SOCKET_CONNECTABLE(address),
+	                                           NULL, &error);
+	g_assert_no_error(error);
+	g_object_unref(client);
+	g_object_unref(address);
+
+	loopback->server = g_socket_listener_accept(loopback->listener, NULL,
+	                                            NULL, &error);
+	g_assert_no_error(error);
+}
+
+static inline void
+purple_test_loopback_close(PurpleTestLoopback *loopback)
+{
+	g_object_unref(loopback->client);
+	g_object_unref(loopback->server);
+	g_socket_listener_close(loopback->listener);
+	g_object_unref(loopback->listener);
+}
+
 
 G_END_DECLS
 
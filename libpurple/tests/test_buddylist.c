@@ -0,0 +1,426 @@
+/*
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ *
+ */
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "../account.h"
+#include "../accounts.h"
+#include "../buddylist.h"
+#include "../core.h"
+#include "../eventloop.h"
+#include "../protocols.h"
+#include "../util.h"
+
+#define TEST_BUDDYLIST_UI "test-buddylist"
+#define TEST_BUDDYLIST_PROTOCOL "prpl-test-buddylist"
+#define TEST_BUDDYLIST_JOURNAL "blist-journal.xml"
+
+/******************************************************************************
+ * Test protocol
+ *****************************************************************************/
+/* Buddies take their statuses from the protocol of their account. */
+typedef PurpleProtocol TestProtocol;
+typedef PurpleProtocolClass TestProtocolClass;
+
+G_DEFINE_TYPE(TestProtocol, test_protocol, PURPLE_TYPE_PROTOCOL);
+
+static void
+test_protocol_login(PurpleAccount *account) {
+}
+
+static void
+test_protocol_close(PurpleConnection *gc) {
+}
+
+static GList *
+test_protocol_status_types(PurpleAccount *account) {
+	GList *types = NULL;
+
+	types = g_list_append(types, purple_status_type_new(
+		PURPLE_STATUS_AVAILABLE, NULL, NULL, TRUE));
+	types = g_list_append(types, purple_status_type_new(
+		PURPLE_STATUS_OFFLINE, NULL, NULL, TRUE));
+
+	return types;
+}
+
+static const char *
+test_protocol_list_icon(PurpleAccount *account, PurpleBuddy *buddy) {
+	return "test";
+}
+
+static void
+test_protocol_init(TestProtocol *protocol) {
+	protocol->id = TEST_BUDDYLIST_PROTOCOL;
+	protocol->name = "Buddy List Test";
+	protocol->options = OPT_PROTO_NO_PASSWORD;
+}
+
+static void
+test_protocol_class_init(TestProtocolClass *klass) {
+	klass->login = test_protocol_login;
+	klass->close = test_protocol_close;
+	klass->status_types = test_protocol_status_types;
+	klass->list_icon = test_protocol_list_icon;
+}
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static PurpleEventLoopUiOps test_eventloop_ops = {
+	g_timeout_add,
+	g_source_remove,
+	NULL,
+	NULL,
+	NULL,
+	g_timeout_add_seconds,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+/* Saving is left to the defaults libpurple fills in. */
+static PurpleBlistUiOps test_blist_ops;
+
+typedef struct {
+	gchar *dir;
+	PurpleAccount *account;
+} TestBuddylist;
+
+static void
+test_buddylist_setup(TestBuddylist *test, gconstpointer data) {
+	GError *error = NULL;
+
+	test->dir = g_dir_make_tmp("purple-buddylist-XXXXXX", NULL);
+	g_assert_nonnull(test->dir);
+	purple_util_set_user_dir(test->dir);
+
+	purple_eventloop_set_ui_ops(&test_eventloop_ops);
+	purple_blist_set_ui_ops(&test_blist_ops);
+	g_assert_true(purple_core_init(TEST_BUDDYLIST_UI));
+
+	g_assert_nonnull(purple_protocols_add(test_protocol_get_type(), &error));
+	g_assert_no_error(error);
+
+	test->account = purple_account_new("test", TEST_BUDDYLIST_PROTOCOL);
+	purple_accounts_add(test->account);
+}
+
+static void
+test_buddylist_remove_dir(const gchar *path) {
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const gchar *name;
+
+	while (dir && (name = g_dir_read_name(dir)) != NULL) {
+		gchar *child = g_build_filename(path, name, NULL);
+
+		if (g_file_test(child, G_FILE_TEST_IS_DIR))
+			test_buddylist_remove_dir(child);
+		else
+			g_unlink(child);
+		g_free(child);
+	}
+
+	if (dir)
+		g_dir_close(dir);
+	g_rmdir(path);
+}
+
+static void
+test_buddylist_teardown(TestBuddylist *test, gconstpointer data) {
+	purple_core_quit();
+	purple_blist_set_ui_ops(NULL);
+
+	test_buddylist_remove_dir(test->dir);
+	g_free(test->dir);
+}
+
+/* Saves the list the way quitting does, and reads it back in. */
+static void
+test_buddylist_restart(TestBuddylist *test) {
+	purple_blist_uninit();
+	purple_blist_init();
+	purple_blist_boot();
+}
+
+static gchar *
+test_buddylist_read(TestBuddylist *test, const gchar *name) {
+	gchar *filename = g_build_filename(test->dir, name, NULL);
+	gchar *contents = NULL;
+
+	if (!g_file_get_contents(filename, &contents, NULL, NULL))
+		contents = NULL;
+	g_free(filename);
+
+	return contents;
+}
+
+static void
+test_buddylist_write(TestBuddylist *test, const gchar *name,
+                     const gchar *contents)
+{
+	gchar *filename = g_build_filename(test->dir, name, NULL);
+
+	g_assert_true(g_file_set_contents(filename, contents, -1, NULL));
+	g_free(filename);
+}
+
+static void
+test_buddylist_dump_node(GString *out, PurpleBlistNode *node, guint depth) {
+	const gchar *note;
+
+	for (; node != NULL; node = purple_blist_node_get_sibling_next(node)) {
+		g_string_append_printf(out, "%*s", depth, "");
+
+		if (PURPLE_IS_GROUP(node)) {
+			g_string_append_printf(out, "group %s",
+				purple_group_get_name(PURPLE_GROUP(node)));
+		} else if (PURPLE_IS_CONTACT(node)) {
+			g_string_append_printf(out, "contact %s",
+				purple_contact_get_alias(PURPLE_CONTACT(node)));
+		} else if (PURPLE_IS_BUDDY(node)) {
+			g_string_append_printf(out, "buddy %s/%s",
+				purple_buddy_get_name(PURPLE_BUDDY(node)),
+				purple_buddy_get_local_alias(PURPLE_BUDDY(node)));
+		} else if (PURPLE_IS_CHAT(node)) {
+			g_string_append_printf(out, "chat %s",
+				purple_chat_get_name(PURPLE_CHAT(node)));
+		}
+
+		if ((note = purple_blist_node_get_string(node, "note")) != NULL)
+			g_string_append_printf(out, " [%s]", note);
+		g_string_append_c(out, '\n');
+
+		test_buddylist_dump_node(out,
+			purple_blist_node_get_first_child(node), depth + 1);
+	}
+}
+
+/* The whole list, in order, one node per line */
+static gchar *
+test_buddylist_dump(void) {
+	GString *out = g_string_new(NULL);
+
+	test_buddylist_dump_node(out, purple_blist_get_root(), 0);
+
+	return g_string_free(out, FALSE);
+}
+
+static PurpleBuddy *
+test_buddylist_add_buddy(TestBuddylist *test, PurpleContact *contact,
+                         PurpleGroup *group, const gchar *name,
+                         const gchar *alias)
+{
+	PurpleBuddy *buddy = purple_buddy_new(test->account, name, alias);
+
+	purple_blist_add_buddy(buddy, contact, group, NULL);
+
+	return buddy;
+}
+
+/* Capulets: juliet, nurse; Montagues: romeo, benvolio with mercutio, and a
+ * chat.  In blist.xml, the Capulets are 1, Juliet's contact 2 and juliet 3. */
+static void
+test_buddylist_populate(TestBuddylist *test) {
+	PurpleGroup *capulets = purple_group_new("Capulets");
+	PurpleGroup *montagues = purple_group_new("Montagues");
+	PurpleContact *friends;
+	GHashTable *components;
+
+	purple_blist_add_group(capulets, NULL);
+	purple_blist_add_group(montagues, PURPLE_BLIST_NODE(capulets));
+
+	test_buddylist_add_buddy(test, NULL, capulets, "juliet", "Juliet");
+	test_buddylist_add_buddy(test, NULL, capulets, "nurse", NULL);
+	test_buddylist_add_buddy(test, NULL, montagues, "romeo", "Romeo");
+
+	friends = purple_contact_new();
+	purple_contact_set_alias(friends, "Friends of Romeo");
+	purple_blist_add_contact(friends, montagues, NULL);
+	test_buddylist_add_buddy(test, friends, NULL, "benvolio", NULL);
+	test_buddylist_add_buddy(test, friends, NULL, "mercutio", NULL);
+
+	components = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert(components, g_strdup("room"), g_strdup("square"));
+	purple_blist_add_chat(purple_chat_new(test->account, "Verona", components),
+	                      montagues, NULL);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_buddylist_journal_round_trip(TestBuddylist *test, gconstpointer data) {
+	PurpleGroup *capulets, *montagues;
+	PurpleBuddy *romeo, *mercutio, *juliet, *tybalt;
+	PurpleBlistNode *chat;
+	gchar *before, *after, *snapshot, *contents, *journal, *end;
+
+	/* a new list is written out whole */
+	test_buddylist_populate(test);
+	before = test_buddylist_dump();
+	test_buddylist_restart(test);
+	after = test_buddylist_dump();
+	g_assert_cmpstr(after, ==, before);
+	g_free(before);
+	g_free(after);
+
+	snapshot = test_buddylist_read(test, "blist.xml");
+	g_assert_nonnull(snapshot);
+	g_assert_null(test_buddylist_read(test, TEST_BUDDYLIST_JOURNAL));
+
+	/* changes only go to the journal */
+	capulets = purple_blist_find_group("Capulets");
+	montagues = purple_blist_find_group("Montagues");
+	romeo = purple_blist_find_buddy(test->account, "romeo");
+	mercutio = purple_blist_find_buddy(test->account, "mercutio");
+	juliet = purple_blist_find_buddy(test->account, "juliet");
+
+	purple_blist_add_contact(purple_buddy_get_contact(romeo), capulets,
+	                         PURPLE_BLIST_NODE(purple_buddy_get_contact(juliet)));
+	purple_blist_remove_buddy(mercutio);
+	purple_group_set_name(montagues, "House of Montague");
+	purple_blist_add_group(montagues, NULL);
+	test_buddylist_add_buddy(test, NULL, capulets, "tybalt", "Tybalt");
+	purple_blist_node_set_string(PURPLE_BLIST_NODE(juliet), "note", "balcony");
+	chat = purple_blist_node_get_first_child(PURPLE_BLIST_NODE(montagues));
+	while (!PURPLE_IS_CHAT(chat))
+		chat = purple_blist_node_get_sibling_next(chat);
+	purple_chat_set_alias(PURPLE_CHAT(chat), "Verona square");
+
+	before = test_buddylist_dump();
+	test_buddylist_restart(test);
+	after = test_buddylist_dump();
+	g_assert_cmpstr(after, ==, before);
+	g_free(after);
+
+	contents = test_buddylist_read(test, "blist.xml");
+	g_assert_cmpstr(contents, ==, snapshot);
+	g_free(contents);
+	journal = test_buddylist_read(test, TEST_BUDDYLIST_JOURNAL);
+	g_assert_nonnull(journal);
+	g_assert_true(g_str_has_prefix(journal, "<journal generation="));
+
+	/* a record cut short by a crash is dropped, along with its change */
+	tybalt = purple_blist_find_buddy(test->account, "tybalt");
+	purple_blist_node_set_string(PURPLE_BLIST_NODE(tybalt), "note", "cousin");
+	purple_blist_uninit();
+
+	contents = test_buddylist_read(test, TEST_BUDDYLIST_JOURNAL);
+	g_assert_true(g_str_has_prefix(contents, journal));
+	g_assert_cmpuint(strlen(contents), >, strlen(journal));
+	g_assert_true(g_str_has_suffix(contents, "\n"));
+	end = contents + strlen(contents) - 1;
+	*end = '\0';
+	end = strrchr(contents, '\n') + 1;
+	end[strlen(end) / 2] = '\0';
+	test_buddylist_write(test, TEST_BUDDYLIST_JOURNAL, contents);
+	g_free(contents);
+	g_free(journal);
+
+	purple_blist_init();
+	purple_blist_boot();
+	after = test_buddylist_dump();
+	g_assert_cmpstr(after, ==, before);
+	tybalt = purple_blist_find_buddy(test->account, "tybalt");
+	g_assert_null(purple_blist_node_get_string(PURPLE_BLIST_NODE(tybalt),
+	                                           "note"));
+	g_free(before);
+	g_free(after);
+
+	/* and the next save folds the journal into a new blist.xml */
+	romeo = purple_blist_find_buddy(test->account, "romeo");
+	purple_blist_node_set_string(PURPLE_BLIST_NODE(romeo), "note", "orchard");
+	before = test_buddylist_dump();
+	test_buddylist_restart(test);
+	after = test_buddylist_dump();
+	g_assert_cmpstr(after, ==, before);
+	g_free(before);
+	g_free(after);
+
+	g_assert_null(test_buddylist_read(test, TEST_BUDDYLIST_JOURNAL));
+	contents = test_buddylist_read(test, "blist.xml");
+	g_assert_cmpstr(contents, !=, snapshot);
+	g_assert_nonnull(strstr(contents, "orchard"));
+	g_free(contents);
+	g_free(snapshot);
+}
+
+/* Records whose ID belongs to a node of another type are skipped. */
+static void
+test_buddylist_journal_type_mismatch(TestBuddylist *test,
+                                     gconstpointer data)
+{
+	PurpleBuddy *juliet;
+	gchar *before, *after, *journal, *contents;
+
+	test_buddylist_populate(test);
+	test_buddylist_restart(test);
+
+	juliet = purple_blist_find_buddy(test->account, "juliet");
+	purple_blist_node_set_string(PURPLE_BLIST_NODE(juliet), "note", "balcony");
+	before = test_buddylist_dump();
+	purple_blist_uninit();
+
+	journal = test_buddylist_read(test, TEST_BUDDYLIST_JOURNAL);
+	g_assert_nonnull(journal);
+	contents = g_strconcat(journal,
+		"<buddy id='1' parent='2' account='test' proto='"
+		TEST_BUDDYLIST_PROTOCOL "'><name>tybalt</name></buddy>\n"
+		"<group id='3' name='Verona'/>\n"
+		"<chat id='2' parent='1' account='test' proto='"
+		TEST_BUDDYLIST_PROTOCOL "'><alias>Verona</alias></chat>\n",
+		NULL);
+	test_buddylist_write(test, TEST_BUDDYLIST_JOURNAL, contents);
+	g_free(contents);
+	g_free(journal);
+
+	purple_blist_init();
+	purple_blist_boot();
+	after = test_buddylist_dump();
+	g_assert_cmpstr(after, ==, before);
+	g_assert_null(purple_blist_find_buddy(test->account, "tybalt"));
+	g_assert_null(purple_blist_find_group("Verona"));
+
+	g_free(before);
+	g_free(after);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/buddylist/journal/round trip", TestBuddylist, NULL,
+	           test_buddylist_setup, test_buddylist_journal_round_trip,
+	           test_buddylist_teardown);
+	g_test_add("/buddylist/journal/type mismatch", TestBuddylist, NULL,
+	           test_buddylist_setup, test_buddylist_journal_type_mismatch,
+	           test_buddylist_teardown);
+
+	return g_test_run();
+}
@@ -0,0 +1,627 @@
+/*
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ *
+ */
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "../account.h"
+#include "../accounts.h"
+#include "../conversations.h"
+#include "../core.h"
+#include "../eventloop.h"
+#include "../prefs.h"
+#include "../protocols.h"
+#include "../server.h"
+#include "../util.h"
+
+#define TEST_CONVERSATION_UI "test-conversation"
+#define TEST_CONVERSATION_PROTOCOL "prpl-test-conversation"
+#define TEST_CONVERSATION_HISTORY_PREF "/purple/conversations/message_history_limit"
+
+/******************************************************************************
+ * Test protocol
+ *****************************************************************************/
+/* Conversations copy the features of their connection, so they need an
+ * account which is connected; this protocol connects at once. */
+typedef PurpleProtocol TestProtocol;
+typedef PurpleProtocolClass TestProtocolClass;
+
+G_DEFINE_TYPE(TestProtocol, test_protocol, PURPLE_TYPE_PROTOCOL);
+
+static void
+test_protocol_login(PurpleAccount *account) {
+	PurpleConnection *gc = purple_account_get_connection(account);
+
+	purple_connection_set_state(gc, PURPLE_CONNECTION_CONNECTED);
+}
+
+static void
+test_protocol_close(PurpleConnection *gc) {
+}
+
+static GList *
+test_protocol_status_types(PurpleAccount *account) {
+	GList *types = NULL;
+
+	types = g_list_append(types, purple_status_type_new(
+		PURPLE_STATUS_AVAILABLE, NULL, NULL, TRUE));
+	types = g_list_append(types, purple_status_type_new(
+		PURPLE_STATUS_OFFLINE, NULL, NULL, TRUE));
+
+	return types;
+}
+
+static const char *
+test_protocol_list_icon(PurpleAccount *account, PurpleBuddy *buddy) {
+	return "test";
+}
+
+static void
+test_protocol_init(TestProtocol *protocol) {
+	protocol->id = TEST_CONVERSATION_PROTOCOL;
+	protocol->name = "Conversation Test";
+	protocol->options = OPT_PROTO_NO_PASSWORD;
+}
+
+static void
+test_protocol_class_init(TestProtocolClass *klass) {
+	klass->login = test_protocol_login;
+	klass->close = test_protocol_close;
+	klass->status_types = test_protocol_status_types;
+	klass->list_icon = test_protocol_list_icon;
+}
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static PurpleEventLoopUiOps test_eventloop_ops = {
+	g_timeout_add,
+	g_source_remove,
+	NULL,
+	NULL,
+	NULL,
+	g_timeout_add_seconds,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+typedef struct {
+	gchar *dir;
+	PurpleAccount *account;
+
+	/* what the chat-users-joined and chat-users-left signals saw */
+	gint joined_batches;
+	gint joined;
+	gint left_batches;
+	gint left;
+	GString *batch;
+	gchar *reason;
+} TestConversation;
+
+static void
+test_conversation_setup(TestConversation *test, gconstpointer data) {
+	GError *error = NULL;
+
+	test->dir = g_dir_make_tmp("purple-conversation-XXXXXX", NULL);
+	g_assert_nonnull(test->dir);
+	purple_util_set_user_dir(test->dir);
+
+	purple_eventloop_set_ui_ops(&test_eventloop_ops);
+	g_assert_true(purple_core_init(TEST_CONVERSATION_UI));
+
+	g_assert_nonnull(purple_protocols_add(test_protocol_get_type(), &error));
+	g_assert_no_error(error);
+
+	test->account = purple_account_new("test", TEST_CONVERSATION_PROTOCOL);
+	purple_accounts_add(test->account);
+	purple_account_set_status(test->account, "available", TRUE, NULL);
+	purple_account_set_enabled(test->account, TEST_CONVERSATION_UI, TRUE);
+	g_assert_true(purple_account_is_connected(test->account));
+}
+
+static void
+test_conversation_remove_dir(const gchar *path) {
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const gchar *name;
+
+	while (dir && (name = g_dir_read_name(dir)) != NULL) {
+		gchar *child = g_build_filename(path, name, NULL);
+
+		if (g_file_test(child, G_FILE_TEST_IS_DIR))
+			test_conversation_remove_dir(child);
+		else
+			g_unlink(child);
+		g_free(child);
+	}
+
+	if (dir)
+		g_dir_close(dir);
+	g_rmdir(path);
+}
+
+static void
+test_conversation_teardown(TestConversation *test, gconstpointer data) {
+	purple_signals_disconnect_by_handle(test);
+	purple_core_quit();
+
+	if (test->batch)
+		g_string_free(test->batch, TRUE);
+	g_free(test->reason);
+
+	test_conversation_remove_dir(test->dir);
+	g_free(test->dir);
+}
+
+static PurpleConversation *
+test_conversation_new_im(TestConversation *test, const gchar *name) {
+	PurpleIMConversation *im;
+
+	im = purple_im_conversation_new(test->account, name);
+	g_assert_nonnull(im);
+
+	return PURPLE_CONVERSATION(im);
+}
+
+/* Writes messages "first" to "last - 1", oldest first. */
+static void
+test_conversation_write(PurpleConversation *conv, gint first, gint last) {
+	gint i;
+
+	for (i = first; i < last; i++) {
+		PurpleMessage *msg;
+		gchar *contents = g_strdup_printf("%d", i);
+
+		msg = purple_message_new_incoming("peer", contents, 0, 0);
+		purple_conversation_write_message(conv, msg);
+		g_object_unref(msg);
+		g_free(contents);
+	}
+}
+
+/* Checks that the history holds messages "first" to "last - 1", both by
+ * position and by iterating, newest first. */
+static void
+test_conversation_assert_history(PurpleConversation *conv, gint first,
+                                 gint last)
+{
+	PurpleConversationMessageHistoryIter iter;
+	PurpleMessage *msg;
+	gchar *contents;
+	gint i;
+
+	g_assert_cmpuint(purple_conversation_get_message_history_length(conv),
+	                 ==, last - first);
+
+	for (i = 0; i < last - first; i++) {
+		msg = purple_conversation_get_message_history_nth(conv, i);
+		g_assert_nonnull(msg);
+		contents = g_strdup_printf("%d", last - 1 - i);
+		g_assert_cmpstr(purple_message_get_contents(msg), ==, contents);
+		g_free(contents);
+	}
+	g_assert_null(purple_conversation_get_message_history_nth(conv, i));
+
+	i = last;
+	purple_conversation_message_history_iter_init(&iter, conv);
+	while (purple_conversation_message_history_iter_next(&iter, &msg)) {
+		contents = g_strdup_printf("%d", --i);
+		g_assert_cmpstr(purple_message_get_contents(msg), ==, contents);
+		g_free(contents);
+	}
+	g_assert_cmpint(i, ==, first);
+}
+
+static PurpleChatConversation *
+test_conversation_new_chat(TestConversation *test) {
+	PurpleConnection *gc = purple_account_get_connection(test->account);
+	PurpleChatConversation *chat;
+
+	chat = purple_serv_got_joined_chat(gc, 1, "#verona");
+	g_assert_nonnull(chat);
+
+	return chat;
+}
+
+/* Adds the users, NULL terminated, in one batch with the same flags. */
+static void
+test_conversation_add_users(PurpleChatConversation *chat,
+                            PurpleChatUserFlags flags, ...)
+{
+	GList *users = NULL, *flag_list = NULL;
+	const gchar *name;
+	va_list args;
+
+	va_start(args, flags);
+	while ((name = va_arg(args, const gchar *)) != NULL) {
+		users = g_list_append(users, (gpointer)name);
+		flag_list = g_list_append(flag_list, GINT_TO_POINTER(flags));
+	}
+	va_end(args);
+
+	purple_chat_conversation_add_users(chat, users, NULL, flag_list, FALSE);
+
+	g_list_free(users);
+	g_list_free(flag_list);
+}
+
+/* Checks that the sorted users are those named, NULL terminated, in that
+ * order, and that each knows its place. */
+static void
+test_conversation_assert_sorted(PurpleChatConversation *chat, ...) {
+	GList *sorted, *l;
+	const gchar *name;
+	va_list args;
+	gint i = 0;
+
+	sorted = purple_chat_conversation_get_sorted_users(chat);
+
+	va_start(args, chat);
+	for (l = sorted; l != NULL; l = l->next, i++) {
+		PurpleChatUser *cb = l->data;
+
+		name = va_arg(args, const gchar *);
+		g_assert_nonnull(name);
+		g_assert_cmpstr(purple_chat_user_get_name(cb), ==, name);
+		g_assert_cmpint(purple_chat_user_get_index(cb), ==, i);
+		if (l->next != NULL)
+			g_assert_cmpint(purple_chat_user_compare(cb, l->next->data),
+			                <, 0);
+	}
+	g_assert_null(va_arg(args, const gchar *));
+	va_end(args);
+
+	g_assert_cmpuint(purple_chat_conversation_get_users_count(chat), ==, i);
+	g_list_free(sorted);
+}
+
+static void
+test_conversation_users_joined_cb(PurpleChatConversation *chat,
+                                  GList *users, gboolean new_arrivals,
+                                  TestConversation *test)
+{
+	test->joined_batches++;
+
+	g_string_truncate(test->batch, 0);
+	for (; users != NULL; users = users->next) {
+		if (test->batch->len)
+			g_string_append_c(test->batch, ',');
+		g_string_append(test->batch, purple_chat_user_get_name(users->data));
+	}
+}
+
+static void
+test_conversation_user_joined_cb(PurpleChatConversation *chat,
+                                 const gchar *user, PurpleChatUserFlags flags,
+                                 gboolean new_arrival, TestConversation *test)
+{
+	test->joined++;
+}
+
+static void
+test_conversation_users_left_cb(PurpleChatConversation *chat, GList *names,
+                                const gchar *reason, TestConversation *test)
+{
+	test->left_batches++;
+	test->left += g_list_length(names);
+
+	g_string_truncate(test->batch, 0);
+	for (; names != NULL; names = names->next) {
+		if (test->batch->len)
+			g_string_append_c(test->batch, ',');
+		g_string_append(test->batch, names->data);
+	}
+
+	g_free(test->reason);
+	test->reason = g_strdup(reason);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_conversation_history_wrap(TestConversation *test, gconstpointer data) {
+	PurpleConversation *conv = test_conversation_new_im(test, "peer");
+
+	purple_conversation_set_message_history_limit(conv, 20);
+	test_conversation_write(conv, 0, 15);
+	test_conversation_assert_history(conv, 0, 15);
+
+	/* once full, each new message pushes out the oldest one */
+	test_conversation_write(conv, 15, 53);
+	test_conversation_assert_history(conv, 33, 53);
+
+	/* raising the limit grows a buffer which has wrapped around */
+	purple_conversation_set_message_history_limit(conv, 40);
+	test_conversation_write(conv, 53, 70);
+	test_conversation_assert_history(conv, 33, 70);
+	test_conversation_write(conv, 70, 80);
+	test_conversation_assert_history(conv, 40, 80);
+
+	/* and lowering it keeps the newest messages */
+	purple_conversation_set_message_history_limit(conv, 7);
+	test_conversation_assert_history(conv, 73, 80);
+	test_conversation_write(conv, 80, 85);
+	test_conversation_assert_history(conv, 78, 85);
+
+	purple_conversation_clear_message_history(conv);
+	test_conversation_assert_history(conv, 0, 0);
+	test_conversation_write(conv, 0, 10);
+	test_conversation_assert_history(conv, 3, 10);
+}
+
+static void
+test_conversation_history_unlimited(TestConversation *test,
+                                    gconstpointer data)
+{
+	PurpleConversation *conv = test_conversation_new_im(test, "peer");
+
+	purple_conversation_set_message_history_limit(conv, 0);
+	test_conversation_write(conv, 0, 1500);
+	test_conversation_assert_history(conv, 0, 1500);
+}
+
+static void
+test_conversation_history_limit_pref(TestConversation *test,
+                                     gconstpointer data)
+{
+	PurpleConversation *conv = test_conversation_new_im(test, "peer");
+	PurpleConversation *other;
+
+	g_assert_cmpuint(purple_conversation_get_message_history_limit(conv),
+	                 ==, purple_prefs_get_int(TEST_CONVERSATION_HISTORY_PREF));
+	test_conversation_write(conv, 0, 30);
+
+	/* changing the preference resizes the open conversations */
+	purple_prefs_set_int(TEST_CONVERSATION_HISTORY_PREF, 10);
+	g_assert_cmpuint(purple_conversation_get_message_history_limit(conv),
+	                 ==, 10);
+	test_conversation_assert_history(conv, 20, 30);
+	test_conversation_write(conv, 30, 35);
+	test_conversation_assert_history(conv, 25, 35);
+
+	/* new ones start with it */
+	other = test_conversation_new_im(test, "other");
+	g_assert_cmpuint(purple_conversation_get_message_history_limit(other),
+	                 ==, 10);
+
+	/* a negative limit is no limit */
+	purple_prefs_set_int(TEST_CONVERSATION_HISTORY_PREF, -1);
+	g_assert_cmpuint(purple_conversation_get_message_history_limit(conv),
+	                 ==, 0);
+	g_assert_cmpuint(purple_conversation_get_message_history_limit(other),
+	                 ==, 0);
+	test_conversation_write(conv, 35, 100);
+	test_conversation_assert_history(conv, 25, 100);
+}
+
+/* The order is kept as users come and go, are renamed or change flags:
+ * more important users first, then by name, regardless of case. */
+static void
+test_conversation_chat_sorted(TestConversation *test, gconstpointer data) {
+	PurpleChatConversation *chat = test_conversation_new_chat(test);
+
+	test_conversation_add_users(chat, PURPLE_CHAT_USER_NONE,
+	                            "romeo", "mercutio", NULL);
+	test_conversation_add_users(chat, PURPLE_CHAT_USER_VOICE,
+	                            "tybalt", "benvolio", NULL);
+	purple_chat_conversation_add_user(chat, "Juliet", NULL,
+	                                  PURPLE_CHAT_USER_OP, FALSE);
+	test_conversation_assert_sorted(chat, "Juliet", "benvolio", "tybalt",
+	                                "mercutio", "romeo", NULL);
+
+	purple_chat_conversation_remove_user(chat, "tybalt", NULL);
+	test_conversation_assert_sorted(chat, "Juliet", "benvolio", "mercutio",
+	                                "romeo", NULL);
+
+	/* a new name takes a new place, with the same flags */
+	purple_chat_conversation_rename_user(chat, "mercutio", "Abram");
+	purple_chat_conversation_rename_user(chat, "benvolio", "Sampson");
+	test_conversation_assert_sorted(chat, "Juliet", "Sampson", "Abram",
+	                                "romeo", NULL);
+
+	purple_chat_user_set_flags(purple_chat_conversation_find_user(chat,
+	                           "romeo"), PURPLE_CHAT_USER_OP);
+	test_conversation_assert_sorted(chat, "Juliet", "romeo", "Sampson",
+	                                "Abram", NULL);
+	purple_chat_user_set_flags(purple_chat_conversation_find_user(chat,
+	                           "Juliet"), PURPLE_CHAT_USER_NONE);
+	test_conversation_assert_sorted(chat, "romeo", "Sampson", "Abram",
+	                                "Juliet", NULL);
+
+	purple_chat_conversation_add_user(chat, "balthasar", NULL,
+	                                  PURPLE_CHAT_USER_NONE, FALSE);
+	test_conversation_assert_sorted(chat, "romeo", "Sampson", "Abram",
+	                                "balthasar", "Juliet", NULL);
+
+	purple_chat_conversation_clear_users(chat);
+	test_conversation_assert_sorted(chat, NULL);
+}
+
+/* Each batch is announced once, whatever its size. */
+static void
+test_conversation_chat_signals(TestConversation *test, gconstpointer data) {
+	PurpleChatConversation *chat = test_conversation_new_chat(test);
+	void *handle = purple_conversations_get_handle();
+	GList *names = NULL;
+
+	test->batch = g_string_new(NULL);
+	purple_signal_connect(handle, "chat-users-joined", test,
+	                      PURPLE_CALLBACK(test_conversation_users_joined_cb),
+	                      test);
+	purple_signal_connect(handle, "chat-users-left", test,
+	                      PURPLE_CALLBACK(test_conversation_users_left_cb),
+	                      test);
+
+	/* the batch comes in display order */
+	test_conversation_add_users(chat, PURPLE_CHAT_USER_NONE,
+	                            "romeo", "mercutio", "benvolio", NULL);
+	g_assert_cmpint(test->joined_batches, ==, 1);
+	g_assert_cmpstr(test->batch->str, ==, "benvolio,mercutio,romeo");
+
+	/* the per-user signal is only emitted once something listens */
+	g_assert_cmpint(test->joined, ==, 0);
+	purple_signal_connect(handle, "chat-user-joined", test,
+	                      PURPLE_CALLBACK(test_conversation_user_joined_cb),
+	                      test);
+	test_conversation_add_users(chat, PURPLE_CHAT_USER_OP,
+	                            "Juliet", "tybalt", NULL);
+	g_assert_cmpint(test->joined_batches, ==, 2);
+	g_assert_cmpint(test->joined, ==, 2);
+	g_assert_cmpstr(test->batch->str, ==, "Juliet,tybalt");
+
+	names = g_list_append(names, "tybalt");
+	names = g_list_append(names, "mercutio");
+	purple_chat_conversation_remove_users(chat, names, "banished");
+	g_list_free(names);
+	g_assert_cmpint(test->left_batches, ==, 1);
+	g_assert_cmpstr(test->batch->str, ==, "tybalt,mercutio");
+	g_assert_cmpstr(test->reason, ==, "banished");
+	test_conversation_assert_sorted(chat, "Juliet", "benvolio", "romeo",
+	                                NULL);
+
+	purple_chat_conversation_clear_users(chat);
+	g_assert_cmpint(test->left_batches, ==, 2);
+	g_assert_cmpint(test->left, ==, 5);
+	g_assert_null(test->reason);
+}
+
+/* Names which aren't valid UTF-8 can't be collated; they still have to
+ * sort the same way every time, or the index falls apart. */
+static void
+test_conversation_chat_invalid_utf8(TestConversation *test,
+                                    gconstpointer data)
+{
+	PurpleChatConversation *chat = test_conversation_new_chat(test);
+	GList *sorted, *a, *b;
+
+	test_conversation_add_users(chat, PURPLE_CHAT_USER_NONE,
+	                            "zed", "caf\xe9", "alice", "\xff\xfe",
+	                            "Bob", NULL);
+	test_conversation_assert_sorted(chat, "alice", "Bob", "zed",
+	                                "caf\xe9", "\xff\xfe", NULL);
+
+	sorted = purple_chat_conversation_get_sorted_users(chat);
+	for (a = sorted; a != NULL; a = a->next) {
+		for (b = sorted; b != NULL; b = b->next) {
+			gint ab = purple_chat_user_compare(a->data, b->data);
+			gint ba = purple_chat_user_compare(b->data, a->data);
+
+			g_assert_cmpint((ab > 0) - (ab < 0), ==, (ba < 0) - (ba > 0));
+			g_assert_true((ab == 0) == (a == b));
+		}
+	}
+	g_list_free(sorted);
+
+	g_assert_nonnull(purple_chat_conversation_find_user(chat, "\xff\xfe"));
+	purple_chat_conversation_remove_user(chat, "\xff\xfe", NULL);
+	purple_chat_user_set_flags(purple_chat_conversation_find_user(chat,
+	                           "caf\xe9"), PURPLE_CHAT_USER_VOICE);
+	test_conversation_assert_sorted(chat, "caf\xe9", "alice", "Bob",
+	                                "zed", NULL);
+}
+
+/* The first matching entry wins, prefixed entries match the bare name too,
+ * and taking one away uncovers the next. */
+static void
+test_conversation_chat_ignore(TestConversation *test, gconstpointer data) {
+	PurpleChatConversation *chat = test_conversation_new_chat(test);
+	GList *ignored = NULL;
+	const gchar *ign;
+
+	ignored = g_list_append(ignored, g_strdup("@romeo"));
+	ignored = g_list_append(ignored, g_strdup("romeo"));
+	ignored = g_list_append(ignored, g_strdup("+tybalt"));
+	purple_chat_conversation_set_ignored(chat, ignored);
+
+	ign = purple_chat_conversation_get_ignored_user(chat, "ROMEO");
+	g_assert_true(ign == (gchar *)ignored->data + 1);
+	g_assert_cmpstr(purple_chat_conversation_get_ignored_user(chat,
+	                "tybalt"), ==, "+tybalt");
+	g_assert_cmpstr(purple_chat_conversation_get_ignored_user(chat,
+	                "@romeo"), ==, "@romeo");
+
+	purple_chat_conversation_unignore(chat, "romeo");
+	ignored = purple_chat_conversation_get_ignored(chat);
+	g_assert_cmpuint(g_list_length(ignored), ==, 2);
+	ign = purple_chat_conversation_get_ignored_user(chat, "romeo");
+	g_assert_true(ign == ignored->data);
+	g_assert_false(purple_chat_conversation_is_ignored_user(chat, "@romeo"));
+
+	purple_chat_conversation_ignore(chat, "Mercutio");
+	g_assert_true(purple_chat_conversation_is_ignored_user(chat,
+	              "mercutio"));
+	purple_chat_conversation_ignore(chat, "MERCUTIO");
+	g_assert_cmpuint(g_list_length(purple_chat_conversation_get_ignored(chat)),
+	                 ==, 3);
+
+	purple_chat_conversation_unignore(chat, "tybalt");
+	purple_chat_conversation_unignore(chat, "MERCUTIO");
+	purple_chat_conversation_unignore(chat, "romeo");
+	g_assert_null(purple_chat_conversation_get_ignored(chat));
+	g_assert_false(purple_chat_conversation_is_ignored_user(chat, "romeo"));
+	g_assert_false(purple_chat_conversation_is_ignored_user(chat,
+	               "mercutio"));
+
+	/* renaming an ignored user carries it over */
+	purple_chat_conversation_add_user(chat, "benvolio", NULL,
+	                                  PURPLE_CHAT_USER_NONE, FALSE);
+	purple_chat_conversation_ignore(chat, "benvolio");
+	purple_chat_conversation_rename_user(chat, "benvolio", "Abram");
+	g_assert_false(purple_chat_conversation_is_ignored_user(chat,
+	               "benvolio"));
+	g_assert_true(purple_chat_conversation_is_ignored_user(chat, "abram"));
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/conversation/history/wrap", TestConversation, NULL,
+	           test_conversation_setup, test_conversation_history_wrap,
+	           test_conversation_teardown);
+	g_test_add("/conversation/history/unlimited", TestConversation, NULL,
+	           test_conversation_setup, test_conversation_history_unlimited,
+	           test_conversation_teardown);
+	g_test_add("/conversation/history/limit pref", TestConversation, NULL,
+	           test_conversation_setup, test_conversation_history_limit_pref,
+	           test_conversation_teardown);
+
+	g_test_add("/conversation/chat/sorted", TestConversation, NULL,
+	           test_conversation_setup, test_conversation_chat_sorted,
+	           test_conversation_teardown);
+	g_test_add("/conversation/chat/signals", TestConversation, NULL,
+	           test_conversation_setup, test_conversation_chat_signals,
+	           test_conversation_teardown);
+	g_test_add("/conversation/chat/invalid utf8", TestConversation, NULL,
+	           test_conversation_setup, test_conversation_chat_invalid_utf8,
+	           test_conversation_teardown);
+	g_test_add("/conversation/chat/ignore", TestConversation, NULL,
+	           test_conversation_setup, test_conversation_chat_ignore,
+	           test_conversation_teardown);
+
+	return g_test_run();
+}
@@ -0,0 +1,612 @@
+/*
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ *
+ */
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "../account.h"
+#include "../accounts.h"
+#include "../buddylist.h"
+#include "../core.h"
+#include "../dbus-server.h"
+#include "../eventloop.h"
+#include "../protocols.h"
+#include "../status.h"
+#include "../util.h"
+
+#define TEST_DBUS_UI "test-dbus"
+#define TEST_DBUS_PROTOCOL "prpl-test-dbus"
+
+/******************************************************************************
+ * Match rules
+ *****************************************************************************/
+typedef struct {
+	const gchar *rule;
+	gboolean matches;
+	const gchar *member;
+} TestDBusMatchRule;
+
+static void
+test_dbus_match_rules_check(const TestDBusMatchRule *rules, gsize n_rules) {
+	gsize i;
+
+	for (i = 0; i < n_rules; i++) {
+		gchar *member = (gchar *)"unset";
+
+		g_assert_cmpint(_purple_dbus_match_rule_parse(rules[i].rule, &member),
+		                ==, rules[i].matches);
+		g_assert_cmpstr(member, ==, rules[i].member);
+		g_free(member);
+	}
+}
+
+static void
+test_dbus_match_rule_parse_keys(void) {
+	const TestDBusMatchRule rules[] = {
+		/* an empty rule matches everything */
+		{ "", TRUE, NULL },
+		{ "type='signal'", TRUE, NULL },
+		{ "type='method_call'", FALSE, NULL },
+		{ "interface='" PURPLE_DBUS_INTERFACE "'", TRUE, NULL },
+		{ "interface='org.freedesktop.DBus'", FALSE, NULL },
+		{ "path='" PURPLE_DBUS_PATH "'", TRUE, NULL },
+		{ "path='/im/pidgin'", FALSE, NULL },
+		{ "sender='" PURPLE_DBUS_SERVICE "'", TRUE, NULL },
+		{ "sender=':1.42'", FALSE, NULL },
+		{ "destination=':1.42'", FALSE, NULL },
+		{ "type='signal',member='BuddySignedOn'", TRUE, "BuddySignedOn" },
+		{ "member='BuddySignedOn',member='BuddySignedOff'", TRUE,
+		  "BuddySignedOff" },
+		/* a rule that can't match has no member */
+		{ "member='BuddySignedOn',type='method_call'", FALSE, NULL },
+		/* these only narrow the rule down */
+		{ "eavesdrop='true',arg0='account',arg1path='/',unknown='x'", TRUE,
+		  NULL },
+		/* not key=value */
+		{ "type", FALSE, NULL },
+		{ "type='signal',", TRUE, NULL },
+		{ "type='signal',member", FALSE, NULL },
+	};
+
+	test_dbus_match_rules_check(rules, G_N_ELEMENTS(rules));
+}
+
+static void
+test_dbus_match_rule_parse_quoting(void) {
+	const TestDBusMatchRule rules[] = {
+		{ "member=BuddySignedOn", TRUE, "BuddySignedOn" },
+		{ "type=signal,member=BuddySignedOn", TRUE, "BuddySignedOn" },
+		/* a comma only ends a value outside of quotes */
+		{ "member='Buddy,SignedOn',type='signal'", TRUE, "Buddy,SignedOn" },
+		/* outside of quotes, \' is a quote */
+		{ "member=Buddy\\'s", TRUE, "Buddy's" },
+		{ "member='Buddy'\\''s'", TRUE, "Buddy's" },
+		/* inside them, a backslash is just a backslash */
+		{ "member='Buddy\\'", TRUE, "Buddy\\" },
+		/* values are pieced together from quoted and unquoted parts */
+		{ "member=Buddy'Signed'On", TRUE, "BuddySignedOn" },
+		{ "member='BuddySignedOn", TRUE, "BuddySignedOn" },
+		{ "member=''", TRUE, "" },
+		/* keys may have space around them, but values are as written */
+		{ " type ='signal'", TRUE, NULL },
+		{ "type=' signal'", FALSE, NULL },
+	};
+
+	test_dbus_match_rules_check(rules, G_N_ELEMENTS(rules));
+}
+
+static void
+test_dbus_match_rule_parse_path_namespace(void) {
+	const TestDBusMatchRule rules[] = {
+		{ "path_namespace='/'", TRUE, NULL },
+		{ "path_namespace='/im'", TRUE, NULL },
+		{ "path_namespace='/im/pidgin'", TRUE, NULL },
+		{ "path_namespace='/im/pidgin/purple/PurpleObject'", TRUE, NULL },
+		/* only whole path elements match */
+		{ "path_namespace='/im/pid'", FALSE, NULL },
+		{ "path_namespace='/im/pidgin/purple/Purple'", FALSE, NULL },
+		/* and it mustn't be below our path */
+		{ "path_namespace='/im/pidgin/purple/PurpleObject/child'", FALSE,
+		  NULL },
+		{ "path_namespace='/org/freedesktop'", FALSE, NULL },
+	};
+
+	test_dbus_match_rules_check(rules, G_N_ELEMENTS(rules));
+}
+
+/******************************************************************************
+ * Bulk queries
+ *****************************************************************************/
+/* Buddies take their statuses from the protocol of their account. */
+typedef PurpleProtocol TestProtocol;
+typedef PurpleProtocolClass TestProtocolClass;
+
+G_DEFINE_TYPE(TestProtocol, test_protocol, PURPLE_TYPE_PROTOCOL);
+
+static void
+test_protocol_login(PurpleAccount *account) {
+}
+
+static void
+test_protocol_close(PurpleConnection *gc) {
+}
+
+static GList *
+test_protocol_status_types(PurpleAccount *account) {
+	GList *types = NULL;
+
+	types = g_list_append(types, purple_status_type_new(
+		PURPLE_STATUS_AVAILABLE, NULL, NULL, TRUE));
+	types = g_list_append(types, purple_status_type_new_with_attrs(
+		PURPLE_STATUS_AWAY, NULL, NULL, TRUE, TRUE, FALSE,
+		"message", "Message", purple_value_new(G_TYPE_STRING), NULL));
+	types = g_list_append(types, purple_status_type_new(
+		PURPLE_STATUS_OFFLINE, NULL, NULL, TRUE));
+
+	return types;
+}
+
+static const char *
+test_protocol_list_icon(PurpleAccount *account, PurpleBuddy *buddy) {
+	return "test";
+}
+
+static void
+test_protocol_init(TestProtocol *protocol) {
+	protocol->id = TEST_DBUS_PROTOCOL;
+	protocol->name = "D-Bus Test";
+	protocol->options = OPT_PROTO_NO_PASSWORD;
+}
+
+static void
+test_protocol_class_init(TestProtocolClass *klass) {
+	klass->login = test_protocol_login;
+	klass->close = test_protocol_close;
+	klass->status_types = test_protocol_status_types;
+	klass->list_icon = test_protocol_list_icon;
+}
+
+static PurpleEventLoopUiOps test_eventloop_ops = {
+	g_timeout_add,
+	g_source_remove,
+	NULL,
+	NULL,
+	NULL,
+	g_timeout_add_seconds,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+typedef struct {
+	gchar *dir;
+	PurpleAccount *account;
+	PurpleAccount *other;
+	PurpleBuddy *juliet;
+	PurpleBuddy *romeo;
+	PurpleBuddy *tybalt;
+} TestDBusBulk;
+
+static PurpleBuddy *
+test_dbus_bulk_add_buddy(PurpleAccount *account, const gchar *group,
+                         const gchar *name, const gchar *alias)
+{
+	PurpleBuddy *buddy = purple_buddy_new(account, name, alias);
+	PurpleGroup *g = purple_blist_find_group(group);
+
+	if (g == NULL) {
+		g = purple_group_new(group);
+		purple_blist_add_group(g, NULL);
+	}
+	purple_blist_add_buddy(buddy, NULL, g, NULL);
+
+	return buddy;
+}
+
+/* juliet is away and idle, romeo available and tybalt, on another account,
+ * offline. */
+static void
+test_dbus_bulk_setup(TestDBusBulk *test, gconstpointer data) {
+	PurplePresence *presence;
+	GList *attrs = NULL;
+	GError *error = NULL;
+
+	test->dir = g_dir_make_tmp("purple-dbus-XXXXXX", NULL);
+	g_assert_nonnull(test->dir);
+	purple_util_set_user_dir(test->dir);
+
+	purple_eventloop_set_ui_ops(&test_eventloop_ops);
+	g_assert_true(purple_core_init(TEST_DBUS_UI));
+
+	g_assert_nonnull(purple_protocols_add(test_protocol_get_type(), &error));
+	g_assert_no_error(error);
+
+	test->account = purple_account_new("test", TEST_DBUS_PROTOCOL);
+	purple_accounts_add(test->account);
+	test->other = purple_account_new("other", TEST_DBUS_PROTOCOL);
+	purple_accounts_add(test->other);
+
+	test->juliet = test_dbus_bulk_add_buddy(test->account, "Capulets",
+	                                        "juliet", "Juliet");
+	test->romeo = test_dbus_bulk_add_buddy(test->account, "Montagues",
+	                                       "romeo", NULL);
+	test->tybalt = test_dbus_bulk_add_buddy(test->other, "Capulets",
+	                                        "tybalt", "Tybalt");
+
+	presence = purple_buddy_get_presence(test->juliet);
+	attrs = g_list_append(attrs, "message");
+	attrs = g_list_append(attrs, "On the balcony");
+	purple_status_set_active_with_attrs_list(
+		purple_presence_get_status(presence, "away"), TRUE, attrs);
+	g_list_free(attrs);
+	purple_presence_set_idle(presence, TRUE, 1000);
+
+	purple_presence_switch_status(purple_buddy_get_presence(test->romeo),
+	                              "available");
+	purple_presence_switch_status(purple_buddy_get_presence(test->tybalt),
+	                              "offline");
+}
+
+static void
+test_dbus_bulk_remove_dir(const gchar *path) {
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const gchar *name;
+
+	while (dir && (name = g_dir_read_name(dir)) != NULL) {
+		gchar *child = g_build_filename(path, name, NULL);
+
+		if (g_file_test(child, G_FILE_TEST_IS_DIR))
+			test_dbus_bulk_remove_dir(child);
+		else
+			g_unlink(child);
+		g_free(child);
+	}
+
+	if (dir)
+		g_dir_close(dir);
+	g_rmdir(path);
+}
+
+static void
+test_dbus_bulk_teardown(TestDBusBulk *test, gconstpointer data) {
+	purple_core_quit();
+
+	test_dbus_bulk_remove_dir(test->dir);
+	g_free(test->dir);
+}
+
+static DBusMessage *
+test_dbus_bulk_call(const gchar *method) {
+	DBusMessage *call = dbus_message_new_method_call(PURPLE_DBUS_SERVICE,
+		PURPLE_DBUS_PATH, PURPLE_DBUS_INTERFACE, method);
+
+	/* replies refer to the serial of their call, which the bus would set */
+	dbus_message_set_serial(call, 1);
+
+	return call;
+}
+
+static DBusMessage *
+test_dbus_bulk_get_buddies(PurpleAccount *account, DBusError *error) {
+	DBusMessage *call = test_dbus_bulk_call("PurpleBlistGetBuddiesInfo");
+	DBusMessage *reply;
+	dbus_int32_t id = purple_dbus_pointer_to_id(account);
+
+	dbus_message_append_args(call, DBUS_TYPE_INT32, &id, DBUS_TYPE_INVALID);
+	reply = _purple_dbus_get_buddies_info(call, error);
+	dbus_message_unref(call);
+
+	return reply;
+}
+
+static void
+test_dbus_bulk_next(DBusMessageIter *iter, int type, gpointer value) {
+	g_assert_cmpint(dbus_message_iter_get_arg_type(iter), ==, type);
+	dbus_message_iter_get_basic(iter, value);
+	dbus_message_iter_next(iter);
+}
+
+static gint
+test_dbus_bulk_compare_lines(gconstpointer a, gconstpointer b) {
+	return g_strcmp0(*(const gchar **)a, *(const gchar **)b);
+}
+
+/* Reads an array of buddy structs into one line per buddy, sorted, as
+ * account/group/name/alias/online/status/message/idle.  The IDs have to
+ * belong to that buddy and its account. */
+static gchar *
+test_dbus_bulk_read_buddies(DBusMessageIter *iter) {
+	GPtrArray *lines = g_ptr_array_new_with_free_func(g_free);
+	DBusMessageIter array, info;
+	gchar *ret;
+
+	g_assert_cmpint(dbus_message_iter_get_arg_type(iter), ==,
+	                DBUS_TYPE_ARRAY);
+	dbus_message_iter_recurse(iter, &array);
+
+	while (dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_STRUCT) {
+		dbus_int32_t id, account_id;
+		const char *group, *name, *alias, *status, *message;
+		dbus_bool_t online;
+		dbus_int64_t idle;
+		PurpleBuddy *buddy;
+		PurpleAccount *account;
+
+		dbus_message_iter_recurse(&array, &info);
+		test_dbus_bulk_next(&info, DBUS_TYPE_INT32, &id);
+		test_dbus_bulk_next(&info, DBUS_TYPE_INT32, &account_id);
+		test_dbus_bulk_next(&info, DBUS_TYPE_STRING, &group);
+		test_dbus_bulk_next(&info, DBUS_TYPE_STRING, &name);
+		test_dbus_bulk_next(&info, DBUS_TYPE_STRING, &alias);
+		test_dbus_bulk_next(&info, DBUS_TYPE_BOOLEAN, &online);
+		test_dbus_bulk_next(&info, DBUS_TYPE_STRING, &status);
+		test_dbus_bulk_next(&info, DBUS_TYPE_STRING, &message);
+		test_dbus_bulk_next(&info, DBUS_TYPE_INT64, &idle);
+		g_assert_cmpint(dbus_message_iter_get_arg_type(&info), ==,
+		                DBUS_TYPE_INVALID);
+
+		buddy = purple_dbus_id_to_pointer(id, PURPLE_DBUS_TYPE(PurpleBuddy));
+		g_assert_nonnull(buddy);
+		g_assert_cmpstr(purple_buddy_get_name(buddy), ==, name);
+		account = purple_dbus_id_to_pointer(account_id,
+		                                    PURPLE_DBUS_TYPE(PurpleAccount));
+		g_assert_true(account == purple_buddy_get_account(buddy));
+
+		g_ptr_array_add(lines, g_strdup_printf(
+			"%s/%s/%s/%s/%d/%s/%s/%" G_GINT64_FORMAT,
+			purple_account_get_username(account), group, name, alias,
+			online, status, message, (gint64)idle));
+
+		dbus_message_iter_next(&array);
+	}
+	dbus_message_iter_next(iter);
+
+	g_ptr_array_sort(lines, test_dbus_bulk_compare_lines);
+	g_ptr_array_add(lines, NULL);
+	ret = g_strjoinv("\n", (gchar **)lines->pdata);
+	g_ptr_array_free(lines, TRUE);
+
+	return ret;
+}
+
+static gchar *
+test_dbus_bulk_reply_buddies(DBusMessage *reply) {
+	DBusMessageIter iter;
+	gchar *ret;
+
+	g_assert_nonnull(reply);
+	g_assert_cmpstr(dbus_message_get_signature(reply), ==, "a(iisssbssx)");
+
+	dbus_message_iter_init(reply, &iter);
+	ret = test_dbus_bulk_read_buddies(&iter);
+	dbus_message_unref(reply);
+
+	return ret;
+}
+
+static void
+test_dbus_bulk_buddies(TestDBusBulk *test, gconstpointer data) {
+	DBusError error;
+	gchar *buddies;
+
+	dbus_error_init(&error);
+
+	/* account 0 is every account */
+	buddies = test_dbus_bulk_reply_buddies(
+		test_dbus_bulk_get_buddies(NULL, &error));
+	g_assert_false(dbus_error_is_set(&error));
+	g_assert_cmpstr(buddies, ==,
+		"other/Capulets/tybalt/Tybalt/0/offline//0\n"
+		"test/Capulets/juliet/Juliet/1/away/On the balcony/1000\n"
+		"test/Montagues/romeo/romeo/1/available//0");
+	g_free(buddies);
+
+	buddies = test_dbus_bulk_reply_buddies(
+		test_dbus_bulk_get_buddies(test->account, &error));
+	g_assert_false(dbus_error_is_set(&error));
+	g_assert_cmpstr(buddies, ==,
+		"test/Capulets/juliet/Juliet/1/away/On the balcony/1000\n"
+		"test/Montagues/romeo/romeo/1/available//0");
+	g_free(buddies);
+
+	buddies = test_dbus_bulk_reply_buddies(
+		test_dbus_bulk_get_buddies(test->other, &error));
+	g_assert_false(dbus_error_is_set(&error));
+	g_assert_cmpstr(buddies, ==, "other/Capulets/tybalt/Tybalt/0/offline//0");
+	g_free(buddies);
+
+	/* an ID that isn't an account is an error, not every buddy */
+	g_assert_null(test_dbus_bulk_get_buddies(
+		(PurpleAccount *)test->juliet, &error));
+	g_assert_true(dbus_error_is_set(&error));
+	g_assert_cmpstr(error.name, ==, "im.pidgin.purple.InvalidHandle");
+	dbus_error_free(&error);
+}
+
+static void
+test_dbus_bulk_accounts(TestDBusBulk *test, gconstpointer data) {
+	DBusMessage *call, *reply;
+	DBusMessageIter iter, array, info;
+	DBusError error;
+	GList *accounts = purple_accounts_get_all();
+
+	dbus_error_init(&error);
+	call = test_dbus_bulk_call("PurpleAccountsGetAllInfo");
+	reply = _purple_dbus_get_accounts_info(call, &error);
+	dbus_message_unref(call);
+	g_assert_false(dbus_error_is_set(&error));
+	g_assert_nonnull(reply);
+	g_assert_cmpstr(dbus_message_get_signature(reply), ==, "a(issbs)");
+
+	/* in the order of purple_accounts_get_all() */
+	dbus_message_iter_init(reply, &iter);
+	dbus_message_iter_recurse(&iter, &array);
+	for (; accounts != NULL; accounts = accounts->next) {
+		PurpleAccount *account = accounts->data;
+		PurpleStatus *active = purple_account_get_active_status(account);
+		dbus_int32_t id;
+		const char *username, *protocol_id, *status;
+		dbus_bool_t connected;
+
+		g_assert_cmpint(dbus_message_iter_get_arg_type(&array), ==,
+		                DBUS_TYPE_STRUCT);
+		dbus_message_iter_recurse(&array, &info);
+		test_dbus_bulk_next(&info, DBUS_TYPE_INT32, &id);
+		test_dbus_bulk_next(&info, DBUS_TYPE_STRING, &username);
+		test_dbus_bulk_next(&info, DBUS_TYPE_STRING, &protocol_id);
+		test_dbus_bulk_next(&info, DBUS_TYPE_BOOLEAN, &connected);
+		test_dbus_bulk_next(&info, DBUS_TYPE_STRING, &status);
+
+		g_assert_cmpint(id, ==, purple_dbus_pointer_to_id(account));
+		g_assert_cmpstr(username, ==, purple_account_get_username(account));
+		g_assert_cmpstr(protocol_id, ==, TEST_DBUS_PROTOCOL);
+		g_assert_false(connected);
+		g_assert_cmpstr(status, ==,
+		                active ? purple_status_get_id(active) : "");
+
+		dbus_message_iter_next(&array);
+	}
+	g_assert_cmpint(dbus_message_iter_get_arg_type(&array), ==,
+	                DBUS_TYPE_INVALID);
+	dbus_message_unref(reply);
+
+	/* an empty array still has its element type */
+	call = test_dbus_bulk_call("PurpleConversationsGetAllInfo");
+	reply = _purple_dbus_get_conversations_info(call, &error);
+	dbus_message_unref(call);
+	g_assert_false(dbus_error_is_set(&error));
+	g_assert_nonnull(reply);
+	g_assert_cmpstr(dbus_message_get_signature(reply), ==, "a(iibss)");
+	dbus_message_iter_init(reply, &iter);
+	dbus_message_iter_recurse(&iter, &array);
+	g_assert_cmpint(dbus_message_iter_get_arg_type(&array), ==,
+	                DBUS_TYPE_INVALID);
+	dbus_message_unref(reply);
+}
+
+/* Returns the changed buddies, and the removed IDs in @removed. */
+static gchar *
+test_dbus_bulk_take_changes(GArray *removed) {
+	DBusMessage *signal = _purple_dbus_buddies_changed_take();
+	DBusMessageIter iter, array;
+	const dbus_int32_t *ids;
+	int n_ids;
+	gchar *changed;
+
+	g_assert_nonnull(signal);
+	g_assert_true(dbus_message_is_signal(signal, PURPLE_DBUS_INTERFACE,
+	                                     "BuddiesChanged"));
+	g_assert_cmpstr(dbus_message_get_path(signal), ==, PURPLE_DBUS_PATH);
+	g_assert_cmpstr(dbus_message_get_signature(signal), ==,
+	                "a(iisssbssx)ai");
+
+	dbus_message_iter_init(signal, &iter);
+	changed = test_dbus_bulk_read_buddies(&iter);
+
+	dbus_message_iter_recurse(&iter, &array);
+	dbus_message_iter_get_fixed_array(&array, &ids, &n_ids);
+	g_array_set_size(removed, 0);
+	g_array_append_vals(removed, ids, n_ids);
+
+	dbus_message_unref(signal);
+
+	return changed;
+}
+
+static void
+test_dbus_bulk_changes(TestDBusBulk *test, gconstpointer data) {
+	GArray *removed = g_array_new(FALSE, FALSE, sizeof(dbus_int32_t));
+	dbus_int32_t tybalt = purple_dbus_pointer_to_id(test->tybalt);
+	PurpleBuddy *nurse;
+	gchar *changed;
+
+	/* nothing is pending to begin with */
+	changed = test_dbus_bulk_take_changes(removed);
+	g_assert_cmpstr(changed, ==, "");
+	g_assert_cmpuint(removed->len, ==, 0);
+	g_free(changed);
+
+	/* each buddy is sent once, as it is when the signal is built */
+	_purple_dbus_buddy_changed(test->juliet);
+	_purple_dbus_buddy_changed(test->romeo);
+	_purple_dbus_buddy_changed(test->juliet);
+	purple_presence_set_idle(purple_buddy_get_presence(test->juliet), FALSE, 0);
+
+	/* a buddy that changed and is then removed is only sent as removed */
+	_purple_dbus_buddy_changed(test->tybalt);
+	_purple_dbus_buddy_removed(test->tybalt);
+	purple_blist_remove_buddy(test->tybalt);
+	test->tybalt = NULL;
+
+	/* and one that is gone without a word is skipped */
+	nurse = test_dbus_bulk_add_buddy(test->account, "Capulets", "nurse", NULL);
+	_purple_dbus_buddy_changed(nurse);
+	purple_blist_remove_buddy(nurse);
+
+	changed = test_dbus_bulk_take_changes(removed);
+	g_assert_cmpstr(changed, ==,
+		"test/Capulets/juliet/Juliet/1/away/On the balcony/0\n"
+		"test/Montagues/romeo/romeo/1/available//0");
+	g_assert_cmpuint(removed->len, ==, 1);
+	g_assert_cmpint(g_array_index(removed, dbus_int32_t, 0), ==, tybalt);
+	g_free(changed);
+
+	/* taking them forgets them */
+	changed = test_dbus_bulk_take_changes(removed);
+	g_assert_cmpstr(changed, ==, "");
+	g_assert_cmpuint(removed->len, ==, 0);
+	g_free(changed);
+
+	g_array_free(removed, TRUE);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	/* Without a bus, nothing but the tests collects buddy changes. */
+	g_unsetenv("DBUS_STARTER_ADDRESS");
+	g_unsetenv("DBUS_STARTER_BUS_TYPE");
+
+	g_test_add_func("/dbus/match rule/keys",
+	                test_dbus_match_rule_parse_keys);
+	g_test_add_func("/dbus/match rule/quoting",
+	                test_dbus_match_rule_parse_quoting);
+	g_test_add_func("/dbus/match rule/path namespace",
+	                test_dbus_match_rule_parse_path_namespace);
+
+	g_test_add("/dbus/bulk/buddies", TestDBusBulk, NULL,
+	           test_dbus_bulk_setup, test_dbus_bulk_buddies,
+	           test_dbus_bulk_teardown);
+	g_test_add("/dbus/bulk/accounts", TestDBusBulk, NULL,
+	           test_dbus_bulk_setup, test_dbus_bulk_accounts,
+	           test_dbus_bulk_teardown);
+	g_test_add("/dbus/bulk/changes", TestDBusBulk, NULL,
+	           test_dbus_bulk_setup, test_dbus_bulk_changes,
+	           test_dbus_bulk_teardown);
+
+	return g_test_run();
+}
@@ -0,0 +1,351 @@
+/*
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ *
+ */
+#include <glib.h>
+
+#include <string.h>
+
+#include "../debug.h"
+
+#define TEST_DEBUG_THREADS 4
+#define TEST_DEBUG_THREAD_MESSAGES 500
+#define TEST_DEBUG_PERF_MESSAGES 200000
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static void
+test_debug_collect_cb(PurpleDebugLevel level, const char *category,
+                      gint64 time, const char *message, gpointer data)
+{
+	GPtrArray *messages = data;
+
+	g_ptr_array_add(messages, g_strdup_printf("%d|%s|%s", level,
+	                                          category ? category : "",
+	                                          message));
+}
+
+static GPtrArray *
+test_debug_collect(void) {
+	GPtrArray *messages = g_ptr_array_new_with_free_func(g_free);
+
+	purple_debug_ring_buffer_foreach(test_debug_collect_cb, messages);
+
+	return messages;
+}
+
+static void
+test_debug_print(PurpleDebugLevel level, const char *category,
+                 const char *arg_s)
+{
+}
+
+static PurpleDebugUiOps test_debug_ui_ops = {
+	test_debug_print,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_debug_levels(void) {
+	g_assert_true(purple_debug_is_level_enabled(PURPLE_DEBUG_MISC, "test"));
+
+	purple_debug_set_level(PURPLE_DEBUG_WARNING);
+	g_assert_false(purple_debug_is_level_enabled(PURPLE_DEBUG_INFO, "test"));
+	g_assert_true(purple_debug_is_level_enabled(PURPLE_DEBUG_WARNING, "test"));
+	g_assert_true(purple_debug_is_level_enabled(PURPLE_DEBUG_ERROR, NULL));
+
+	purple_debug_set_category_level("jabber", PURPLE_DEBUG_MISC);
+	purple_debug_set_category_level("oscar", PURPLE_DEBUG_FATAL);
+	g_assert_true(purple_debug_is_level_enabled(PURPLE_DEBUG_MISC, "jabber"));
+	g_assert_false(purple_debug_is_level_enabled(PURPLE_DEBUG_ERROR, "oscar"));
+	g_assert_false(purple_debug_is_level_enabled(PURPLE_DEBUG_INFO, "test"));
+
+	purple_debug_unset_category_level("jabber");
+	g_assert_false(purple_debug_is_level_enabled(PURPLE_DEBUG_MISC, "jabber"));
+
+	purple_debug_unset_category_level("oscar");
+	purple_debug_set_level(PURPLE_DEBUG_ALL);
+	g_assert_true(purple_debug_is_level_enabled(PURPLE_DEBUG_ERROR, "oscar"));
+}
+
+static void
+test_debug_ring_lazy(void) {
+	GPtrArray *messages;
+	gchar buffer[] = "before";
+	gchar *expected;
+
+	purple_debug_ring_buffer_set_size(64 * 1024);
+
+	purple_debug_info("test", "int %d long %ld size %" G_GSIZE_FORMAT
+	                  " double %.2f string %s pointer %p %%\n",
+	                  -42, 1234567890L, (gsize)99, 3.14159, "str",
+	                  (gpointer)buffer);
+	purple_debug_misc(NULL, "%-5s|%5d|%.*s|%*d", "ab", 42, 3, "abcdef", 4, 7);
+	purple_debug_warning("test", "%2$s %1$s", "world", "hello");
+	purple_debug_error("test", "%s", buffer);
+	strcpy(buffer, "after!");
+
+	messages = test_debug_collect();
+	g_assert_cmpuint(messages->len, ==, 4);
+
+	expected = g_strdup_printf("%d|test|int -42 long 1234567890 size 99 "
+	                           "double 3.14 string str pointer %p %%",
+	                           PURPLE_DEBUG_INFO, (gpointer)buffer);
+	g_assert_cmpstr(g_ptr_array_index(messages, 0), ==, expected);
+	g_free(expected);
+
+	expected = g_strdup_printf("%d||%-5s|%5d|%.*s|%*d", PURPLE_DEBUG_MISC,
+	                           "ab", 42, 3, "abcdef", 4, 7);
+	g_assert_cmpstr(g_ptr_array_index(messages, 1), ==, expected);
+	g_free(expected);
+
+	/* positional arguments are formatted right away */
+	expected = g_strdup_printf("%d|test|hello world", PURPLE_DEBUG_WARNING);
+	g_assert_cmpstr(g_ptr_array_index(messages, 2), ==, expected);
+	g_free(expected);
+
+	/* strings are copied when the message is logged */
+	expected = g_strdup_printf("%d|test|before", PURPLE_DEBUG_ERROR);
+	g_assert_cmpstr(g_ptr_array_index(messages, 3), ==, expected);
+	g_free(expected);
+
+	g_ptr_array_free(messages, TRUE);
+	purple_debug_ring_buffer_set_size(0);
+}
+
+static void
+test_debug_ring_levels(void) {
+	GPtrArray *messages;
+
+	purple_debug_ring_buffer_set_size(64 * 1024);
+
+	purple_debug_set_category_level("quiet", PURPLE_DEBUG_ERROR);
+	purple_debug_info("quiet", "dropped");
+	purple_debug_error("quiet", "kept");
+	purple_debug_unset_category_level("quiet");
+
+	messages = test_debug_collect();
+	g_assert_cmpuint(messages->len, ==, 1);
+	g_assert_true(g_str_has_suffix(g_ptr_array_index(messages, 0), "|quiet|kept"));
+	g_ptr_array_free(messages, TRUE);
+
+	purple_debug_ring_buffer_set_size(0);
+}
+
+static void
+test_debug_ring_wrap(void) {
+	GPtrArray *messages;
+	gchar *dump, *expected;
+	guint i, first;
+
+	purple_debug_ring_buffer_set_size(4096);
+
+	for (i = 0; i < 1000; i++)
+		purple_debug_info("wrap", "message %u", i);
+
+	messages = test_debug_collect();
+	g_assert_cmpuint(messages->len, >, 0);
+	g_assert_cmpuint(messages->len, <, 1000);
+
+	/* only the newest messages are kept, in order */
+	first = 1000 - messages->len;
+	for (i = 0; i < messages->len; i++) {
+		expected = g_strdup_printf("%d|wrap|message %u", PURPLE_DEBUG_INFO,
+		                           first + i);
+		g_assert_cmpstr(g_ptr_array_index(messages, i), ==, expected);
+		g_free(expected);
+	}
+	g_ptr_array_free(messages, TRUE);
+
+	/* messages too big for the ring are cut short */
+	expected = g_strnfill(8192, 'x');
+	purple_debug_info("wrap", "%s", expected);
+	messages = test_debug_collect();
+	g_assert_true(g_str_has_prefix(g_ptr_array_index(messages, messages->len - 1),
+	                               "2|wrap|xxxx"));
+	g_assert_cmpuint(strlen(g_ptr_array_index(messages, messages->len - 1)),
+	                 <, 2048);
+	g_ptr_array_free(messages, TRUE);
+	g_free(expected);
+
+	purple_debug_info("wrap", "last");
+	dump = purple_debug_ring_buffer_dump();
+	g_assert_true(g_str_has_suffix(dump, "wrap: last\n"));
+	g_free(dump);
+
+	purple_debug_ring_buffer_set_size(0);
+}
+
+static void
+test_debug_ring_clear(void) {
+	GPtrArray *messages;
+
+	purple_debug_ring_buffer_set_size(4096);
+
+	purple_debug_info("clear", "one");
+	purple_debug_ring_buffer_clear();
+
+	messages = test_debug_collect();
+	g_assert_cmpuint(messages->len, ==, 0);
+	g_ptr_array_free(messages, TRUE);
+
+	purple_debug_info("clear", "two");
+	messages = test_debug_collect();
+	g_assert_cmpuint(messages->len, ==, 1);
+	g_ptr_array_free(messages, TRUE);
+
+	/* disabling the ring drops everything in it */
+	purple_debug_ring_buffer_set_size(0);
+	purple_debug_info("clear", "three");
+	messages = test_debug_collect();
+	g_assert_cmpuint(messages->len, ==, 0);
+	g_ptr_array_free(messages, TRUE);
+}
+
+static gpointer
+test_debug_ring_thread(gpointer data) {
+	guint i;
+
+	for (i = 0; i < TEST_DEBUG_THREAD_MESSAGES; i++)
+		purple_debug_info("thread", "%u %u", GPOINTER_TO_UINT(data), i);
+
+	return NULL;
+}
+
+static void
+test_debug_ring_threads(void) {
+	GThread *threads[TEST_DEBUG_THREADS];
+	guint next[TEST_DEBUG_THREADS] = { 0 };
+	GPtrArray *messages;
+	guint i;
+
+	purple_debug_ring_buffer_set_size(256 * 1024);
+
+	for (i = 0; i < TEST_DEBUG_THREADS; i++)
+		threads[i] = g_thread_new("debug", test_debug_ring_thread,
+		                          GUINT_TO_POINTER(i));
+	for (i = 0; i < TEST_DEBUG_THREADS; i++)
+		g_thread_join(threads[i]);
+
+	/* every thread had its own ring, and each one's messages are in order */
+	messages = test_debug_collect();
+	g_assert_cmpuint(messages->len, ==,
+	                 TEST_DEBUG_THREADS * TEST_DEBUG_THREAD_MESSAGES);
+	for (i = 0; i < messages->len; i++) {
+		guint thread, n;
+
+		g_assert_cmpint(sscanf(g_ptr_array_index(messages, i),
+		                       "2|thread|%u %u", &thread, &n), ==, 2);
+		g_assert_cmpuint(thread, <, TEST_DEBUG_THREADS);
+		g_assert_cmpuint(n, ==, next[thread]++);
+	}
+	g_ptr_array_free(messages, TRUE);
+
+	purple_debug_ring_buffer_set_size(0);
+}
+
+/******************************************************************************
+ * Benchmarks
+ *****************************************************************************/
+static void
+test_debug_perf_log(void) {
+	gchar *dump;
+	gdouble elapsed;
+	guint i;
+
+	/* a UI that reads every message, so each one is formatted */
+	purple_debug_set_ui_ops(&test_debug_ui_ops);
+	g_test_timer_start();
+	for (i = 0; i < TEST_DEBUG_PERF_MESSAGES; i++) {
+		purple_debug_info("perf", "Sending (%s): <message to='%s' id='%u'/>",
+		                  "user@example.com", "buddy@example.com", i);
+	}
+	elapsed = g_test_timer_elapsed();
+	g_test_minimized_result(elapsed, "formatted %d messages: %.3fs",
+	                        TEST_DEBUG_PERF_MESSAGES, elapsed);
+	purple_debug_set_ui_ops(NULL);
+
+	/* only the ring buffer, which formats lazily */
+	purple_debug_ring_buffer_set_size(1024 * 1024);
+	g_test_timer_start();
+	for (i = 0; i < TEST_DEBUG_PERF_MESSAGES; i++) {
+		purple_debug_info("perf", "Sending (%s): <message to='%s' id='%u'/>",
+		                  "user@example.com", "buddy@example.com", i);
+	}
+	elapsed = g_test_timer_elapsed();
+	g_test_minimized_result(elapsed, "recorded %d messages: %.3fs",
+	                        TEST_DEBUG_PERF_MESSAGES, elapsed);
+
+	g_test_timer_start();
+	dump = purple_debug_ring_buffer_dump();
+	elapsed = g_test_timer_elapsed();
+	g_test_minimized_result(elapsed, "dumped the ring buffer: %.3fs", elapsed);
+	g_free(dump);
+	purple_debug_ring_buffer_set_size(0);
+
+	/* nothing wants the messages at all */
+	purple_debug_set_level(PURPLE_DEBUG_WARNING);
+	g_test_timer_start();
+	for (i = 0; i < TEST_DEBUG_PERF_MESSAGES; i++) {
+		purple_debug_info("perf", "Sending (%s): <message to='%s' id='%u'/>",
+		                  "user@example.com", "buddy@example.com", i);
+	}
+	elapsed = g_test_timer_elapsed();
+	g_test_minimized_result(elapsed, "dropped %d messages: %.3fs",
+	                        TEST_DEBUG_PERF_MESSAGES, elapsed);
+	purple_debug_set_level(PURPLE_DEBUG_ALL);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/debug/levels",
+	                test_debug_levels);
+	g_test_add_func("/debug/ring/lazy",
+	                test_debug_ring_lazy);
+	g_test_add_func("/debug/ring/levels",
+	                test_debug_ring_levels);
+	g_test_add_func("/debug/ring/wrap",
+	                test_debug_ring_wrap);
+	g_test_add_func("/debug/ring/clear",
+	                test_debug_ring_clear);
+	g_test_add_func("/debug/ring/threads",
+	                test_debug_ring_threads);
+
+	if (g_test_perf()) {
+		g_test_add_func("/debug/perf/log",
+		                test_debug_perf_log);
+	}
+
+	return g_test_run();
+}
@@ -0,0 +1,595 @@
+/*
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ *
+ */
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <string.h>
+
+#include "../core.h"
+#include "../eventloop.h"
+#include "../http.h"
+#include "../tests.h"
+#include "../util.h"
+
+#define TEST_HTTP_UI "test-http"
+#define TEST_HTTP_TIMEOUT 10
+
+#define TEST_HTTP_CHUNKED_BODY "Wherefore art thou Romeo?"
+#define TEST_HTTP_GZIP_LINE "Deny thy father and refuse thy name.\n"
+#define TEST_HTTP_GZIP_LINES 64
+
+/******************************************************************************
+ * Loopback server
+ *****************************************************************************/
+typedef struct {
+	GSocketListener *listener;
+	GCancellable *cancellable;
+	guint16 port;
+	GPtrArray *connections;
+
+	/* the first connection waits for this many requests before it sends
+	 * any response, so they have to be pipelined */
+	guint hold;
+	/* if not 0, the first connection is closed after this many
+	 * responses */
+	guint close_after;
+	/* whether the last response before closing says so */
+	gboolean announce_close;
+} TestHttpServer;
+
+typedef struct {
+	TestHttpServer *server;
+	GSocket *socket;
+	GSource *source;
+	GString *buf;
+	/* the paths of the requests not answered yet */
+	GPtrArray *pending;
+	/* the paths of every request, in order */
+	GPtrArray *received;
+	guint hold;
+	guint close_after;
+	guint responses;
+	gboolean closed;
+} TestHttpServerConnection;
+
+static void
+test_http_server_connection_free(TestHttpServerConnection *conn) {
+	if (!conn->closed) {
+		g_source_destroy(conn->source);
+		g_socket_close(conn->socket, NULL);
+	}
+	g_source_unref(conn->source);
+	g_object_unref(conn->socket);
+	g_string_free(conn->buf, TRUE);
+	g_ptr_array_free(conn->pending, TRUE);
+	g_ptr_array_free(conn->received, TRUE);
+	g_free(conn);
+}
+
+static GBytes *
+test_http_gzip(const gchar *data) {
+	GZlibCompressor *compressor;
+	GOutputStream *memory, *out;
+	GError *error = NULL;
+	GBytes *bytes;
+
+	compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+	memory = g_memory_output_stream_new_resizable();
+	out = g_converter_output_stream_new(memory, G_CONVERTER(compressor));
+
+	g_output_stream_write_all(out, data, strlen(data), NULL, NULL, &error);
+	g_assert_no_error(error);
+	g_output_stream_close(out, NULL, &error);
+	g_assert_no_error(error);
+
+	bytes = g_memory_output_stream_steal_as_bytes(
+		G_MEMORY_OUTPUT_STREAM(memory));
+
+	g_object_unref(out);
+	g_object_unref(memory);
+	g_object_unref(compressor);
+
+	return bytes;
+}
+
+static gchar *
+test_http_gzip_body(void) {
+	GString *body = g_string_new(NULL);
+	guint i;
+
+	for (i = 0; i < TEST_HTTP_GZIP_LINES; i++)
+		g_string_append(body, TEST_HTTP_GZIP_LINE);
+
+	return g_string_free(body, FALSE);
+}
+
+/* "/plain/<text>" answers with the text, "/chunked" with a chunked body, and
+ * "/gzip" with a gzip-encoded one. */
+static void
+test_http_server_respond(TestHttpServerConnection *conn, GString *out,
+                         const gchar *path, gboolean closing) {
+	const gchar *connection = closing ? "Connection: close\r\n" : "";
+
+	if (g_str_has_prefix(path, "/plain/")) {
+		const gchar *body = path + strlen("/plain/");
+
+		g_string_append_printf(out, "HTTP/1.1 200 OK\r\n%s"
+		                       "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+		                       "\r\n%s",
+		                       connection, strlen(body), body);
+	} else if (g_str_equal(path, "/chunked")) {
+		const gchar *body = TEST_HTTP_CHUNKED_BODY;
+		gsize len = strlen(body), offset, size;
+
+		g_string_append_printf(out, "HTTP/1.1 200 OK\r\n%s"
+		                       "Transfer-Encoding: chunked\r\n\r\n",
+		                       connection);
+		for (offset = 0, size = 1; offset < len; offset += size, size *= 2) {
+			size = MIN(size, len - offset);
+			g_string_append_printf(out, "%" G_GSIZE_MODIFIER "x\r\n",
+			                       size);
+			g_string_append_len(out, body + offset, size);
+			g_string_append(out, "\r\n");
+		}
+		g_string_append(out, "0\r\n\r\n");
+	} else if (g_str_equal(path, "/gzip")) {
+		gchar *body = test_http_gzip_body();
+		GBytes *gzipped = test_http_gzip(body);
+		gsize len;
+		gconstpointer data = g_bytes_get_data(gzipped, &len);
+
+		g_string_append_printf(out, "HTTP/1.1 200 OK\r\n%s"
+		                       "Content-Encoding: gzip\r\n"
+		                       "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+		                       "\r\n",
+		                       connection, len);
+		g_string_append_len(out, data, len);
+
+		g_bytes_unref(gzipped);
+		g_free(body);
+	} else {
+		g_string_append(out, "HTTP/1.1 404 Not Found\r\n"
+		                "Content-Length: 0\r\n\r\n");
+	}
+}
+
+/* Whatever is answered goes out in a single write, so that the client reads
+ * several responses at once. */
+static void
+test_http_server_connection_process(TestHttpServerConnection *conn) {
+	GString *out;
+	GError *error = NULL;
+	gsize written = 0;
+	gchar *end;
+
+	while ((end = strstr(conn->buf->str, "\r\n\r\n")) != NULL) {
+		gchar **words = g_strsplit(conn->buf->str, " ", 3);
+
+		g_assert_cmpstr(words[0], ==, "GET");
+		g_ptr_array_add(conn->pending, g_strdup(words[1]));
+		g_ptr_array_add(conn->received, g_strdup(words[1]));
+		g_strfreev(words);
+
+		g_string_erase(conn->buf, 0, end + 4 - conn->buf->str);
+	}
+
+	if (conn->pending->len == 0 || conn->pending->len < conn->hold)
+		return;
+	conn->hold = 0;
+
+	out = g_string_new(NULL);
+	while (conn->pending->len > 0) {
+		gboolean closing = (++conn->responses == conn->close_after);
+
+		test_http_server_respond(conn, out,
+		                         g_ptr_array_index(conn->pending, 0),
+		                         closing && conn->server->announce_close);
+		g_ptr_array_remove_index(conn->pending, 0);
+		if (closing)
+			break;
+	}
+
+	while (written < out->len) {
+		gssize ret = g_socket_send_with_blocking(conn->socket,
+		                                         out->str + written,
+		                                         out->len - written,
+		                                         TRUE, NULL, &error);
+
+		g_assert_no_error(error);
+		written += ret;
+	}
+	g_string_free(out, TRUE);
+
+	/* Everything the client sent was read, so it gets an end of file
+	 * rather than a reset. */
+	if (conn->responses == conn->close_after) {
+		g_source_destroy(conn->source);
+		g_socket_close(conn->socket, NULL);
+		conn->closed = TRUE;
+	}
+}
+
+static gboolean
+test_http_server_connection_read_cb(GSocket *socket, GIOCondition condition,
+                                    gpointer data) {
+	TestHttpServerConnection *conn = data;
+	GError *error = NULL;
+	gchar buf[4096];
+	gssize len;
+
+	len = g_socket_receive_with_blocking(socket, buf, sizeof(buf), FALSE,
+	                                     NULL, &error);
+	if (len < 0 && g_error_matches(error, G_IO_ERROR,
+	                               G_IO_ERROR_WOULD_BLOCK)) {
+		g_error_free(error);
+		return G_SOURCE_CONTINUE;
+	}
+	g_clear_error(&error);
+
+	/* the client went away */
+	if (len <= 0)
+		return G_SOURCE_REMOVE;
+
+	g_string_append_len(conn->buf, buf, len);
+	test_http_server_connection_process(conn);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+test_http_server_accept_cb(GObject *source, GAsyncResult *result,
+                           gpointer data) {
+	TestHttpServer *server = data;
+	TestHttpServerConnection *conn;
+	GError *error = NULL;
+	GSocket *socket;
+
+	socket = g_socket_listener_accept_socket_finish(G_SOCKET_LISTENER(source),
+	                                                result, NULL, &error);
+	if (socket == NULL) {
+		/* the server is gone */
+		g_error_free(error);
+		return;
+	}
+
+	conn = g_new0(TestHttpServerConnection, 1);
+	conn->server = server;
+	conn->socket = socket;
+	conn->buf = g_string_new(NULL);
+	conn->pending = g_ptr_array_new_with_free_func(g_free);
+	conn->received = g_ptr_array_new_with_free_func(g_free);
+	if (server->connections->len == 0) {
+		conn->hold = server->hold;
+		conn->close_after = server->close_after;
+	}
+	conn->source = g_socket_create_source(socket,
+	                                      G_IO_IN | G_IO_HUP | G_IO_ERR,
+	                                      NULL);
+	g_source_set_callback(conn->source,
+	                      (GSourceFunc)test_http_server_connection_read_cb,
+	                      conn, NULL);
+	g_source_attach(conn->source, NULL);
+	g_ptr_array_add(server->connections, conn);
+
+	g_socket_listener_accept_socket_async(server->listener,
+	                                      server->cancellable,
+	                                      test_http_server_accept_cb, server);
+}
+
+static void
+test_http_server_open(TestHttpServer *server) {
+	GSocketAddress *address;
+
+	server->connections = g_ptr_array_new_with_free_func(
+		(GDestroyNotify)test_http_server_connection_free);
+	server->cancellable = g_cancellable_new();
+
+	server->listener = g_socket_listener_new();
+	address = purple_test_loopback_listen(server->listener);
+	server->port = g_inet_socket_address_get_port(
+		G_INET_SOCKET_ADDRESS(address));
+	g_object_unref(address);
+
+	g_socket_listener_accept_socket_async(server->listener,
+	                                      server->cancellable,
+	                                      test_http_server_accept_cb, server);
+}
+
+static void
+test_http_server_close(TestHttpServer *server) {
+	g_cancellable_cancel(server->cancellable);
+	g_object_unref(server->cancellable);
+	g_socket_listener_close(server->listener);
+	g_object_unref(server->listener);
+	g_ptr_array_free(server->connections, TRUE);
+}
+
+static guint
+test_http_server_received(TestHttpServer *server, guint index) {
+	TestHttpServerConnection *conn;
+
+	g_assert_cmpuint(index, <, server->connections->len);
+	conn = g_ptr_array_index(server->connections, index);
+
+	return conn->received->len;
+}
+
+/******************************************************************************
+ * Client
+ *****************************************************************************/
+static PurpleEventLoopUiOps test_eventloop_ops = {
+	g_timeout_add,
+	g_source_remove,
+	NULL,
+	NULL,
+	NULL,
+	g_timeout_add_seconds,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+typedef struct {
+	gchar *dir;
+	TestHttpServer server;
+	PurpleHttpKeepalivePool *pool;
+	guint done;
+} TestHttp;
+
+typedef struct {
+	TestHttp *test;
+	const gchar *path;
+	gboolean finished;
+	gboolean successful;
+	gchar *body;
+	/* what the bytes writer got, if it was set */
+	GString *written;
+	guint writes;
+} TestHttpFetch;
+
+static void
+test_http_fetch_cb(PurpleHttpConnection *http_conn,
+                   PurpleHttpResponse *response, gpointer data) {
+	TestHttpFetch *fetch = data;
+
+	g_assert_false(fetch->finished);
+	fetch->finished = TRUE;
+	fetch->successful = purple_http_response_is_successful(response);
+	if (fetch->written == NULL)
+		fetch->body = g_strdup(purple_http_response_get_data(response,
+		                                                     NULL));
+	fetch->test->done++;
+}
+
+static gboolean
+test_http_fetch_write_cb(PurpleHttpConnection *http_conn,
+                         PurpleHttpResponse *response, GBytes *data,
+                         gpointer user_data) {
+	TestHttpFetch *fetch = user_data;
+	gsize len;
+	gconstpointer buf = g_bytes_get_data(data, &len);
+
+	g_string_append_len(fetch->written, buf, len);
+	fetch->writes++;
+
+	return TRUE;
+}
+
+static void
+test_http_fetch(TestHttp *test, TestHttpFetch *fetch, const gchar *path,
+                gboolean bytes_writer) {
+	PurpleHttpRequest *request;
+	gchar *url;
+
+	memset(fetch, 0, sizeof(*fetch));
+	fetch->test = test;
+	fetch->path = path;
+
+	url = g_strdup_printf("http://127.0.0.1:%u%s", test->server.port, path);
+	request = purple_http_request_new(url);
+	g_free(url);
+
+	purple_http_request_set_keepalive_pool(request, test->pool);
+	if (bytes_writer) {
+		fetch->written = g_string_new(NULL);
+		purple_http_request_set_response_bytes_writer(request,
+			test_http_fetch_write_cb, fetch);
+	}
+
+	g_assert_nonnull(purple_http_request(NULL, request, test_http_fetch_cb,
+	                                     fetch));
+	purple_http_request_unref(request);
+}
+
+static void
+test_http_fetch_clear(TestHttpFetch *fetch) {
+	g_free(fetch->body);
+	if (fetch->written != NULL)
+		g_string_free(fetch->written, TRUE);
+}
+
+static gboolean
+test_http_wakeup_cb(gpointer data) {
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+test_http_run_until_done(TestHttp *test, guint count) {
+	gint64 deadline = g_get_monotonic_time() +
+	                  TEST_HTTP_TIMEOUT * G_USEC_PER_SEC;
+	guint wakeup = g_timeout_add(100, test_http_wakeup_cb, NULL);
+
+	while (test->done < count) {
+		g_assert_cmpint(g_get_monotonic_time(), <, deadline);
+		g_main_context_iteration(NULL, TRUE);
+	}
+
+	g_source_remove(wakeup);
+}
+
+static void
+test_http_remove_dir(const gchar *path) {
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const gchar *name;
+
+	while (dir && (name = g_dir_read_name(dir)) != NULL) {
+		gchar *child = g_build_filename(path, name, NULL);
+
+		if (g_file_test(child, G_FILE_TEST_IS_DIR))
+			test_http_remove_dir(child);
+		else
+			g_unlink(child);
+		g_free(child);
+	}
+
+	if (dir)
+		g_dir_close(dir);
+	g_rmdir(path);
+}
+
+static void
+test_http_setup(TestHttp *test, gconstpointer data) {
+	GError *error = NULL;
+
+	memset(test, 0, sizeof(*test));
+
+	test->dir = g_dir_make_tmp("test_http-XXXXXX", &error);
+	g_assert_no_error(error);
+	purple_util_set_user_dir(test->dir);
+
+	purple_eventloop_set_ui_ops(&test_eventloop_ops);
+	g_assert_true(purple_core_init(TEST_HTTP_UI));
+
+	test_http_server_open(&test->server);
+
+	/* A single socket, so that whatever else is asked for while it is
+	 * busy has to be pipelined on it. */
+	test->pool = purple_http_keepalive_pool_new();
+	purple_http_keepalive_pool_set_limit_per_host(test->pool, 1);
+	purple_http_keepalive_pool_set_pipelining(test->pool, 8);
+}
+
+static void
+test_http_teardown(TestHttp *test, gconstpointer data) {
+	purple_http_keepalive_pool_unref(test->pool);
+	purple_core_quit();
+	test_http_server_close(&test->server);
+
+	test_http_remove_dir(test->dir);
+	g_free(test->dir);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+/* The server answers none of them before it has all of them, and then
+ * answers them all in one go. */
+static void
+test_http_pipeline(TestHttp *test, gconstpointer data) {
+	TestHttpFetch fetches[5];
+	gchar *gzip_body = test_http_gzip_body();
+	guint i;
+
+	test->server.hold = G_N_ELEMENTS(fetches);
+
+	test_http_fetch(test, &fetches[0], "/plain/Juliet", FALSE);
+	test_http_fetch(test, &fetches[1], "/chunked", FALSE);
+	test_http_fetch(test, &fetches[2], "/gzip", FALSE);
+	test_http_fetch(test, &fetches[3], "/chunked", TRUE);
+	test_http_fetch(test, &fetches[4], "/plain/Romeo", FALSE);
+	test_http_run_until_done(test, G_N_ELEMENTS(fetches));
+
+	g_assert_cmpuint(test->server.connections->len, ==, 1);
+	g_assert_cmpuint(test_http_server_received(&test->server, 0), ==,
+	                 G_N_ELEMENTS(fetches));
+
+	for (i = 0; i < G_N_ELEMENTS(fetches); i++)
+		g_assert_true(fetches[i].successful);
+
+	g_assert_cmpstr(fetches[0].body, ==, "Juliet");
+	g_assert_cmpstr(fetches[1].body, ==, TEST_HTTP_CHUNKED_BODY);
+	g_assert_cmpstr(fetches[2].body, ==, gzip_body);
+	g_assert_cmpstr(fetches[3].written->str, ==, TEST_HTTP_CHUNKED_BODY);
+	g_assert_cmpuint(fetches[3].writes, >, 1);
+	g_assert_cmpstr(fetches[4].body, ==, "Romeo");
+
+	for (i = 0; i < G_N_ELEMENTS(fetches); i++)
+		test_http_fetch_clear(&fetches[i]);
+	g_free(gzip_body);
+}
+
+/* The socket goes away after the first response, and the requests which
+ * were pipelined after it are sent again on a new one. */
+static void
+test_http_pipeline_broken(TestHttp *test, gconstpointer data) {
+	TestHttpFetch fetches[4];
+	gchar *names[G_N_ELEMENTS(fetches)];
+	guint i;
+
+	test->server.hold = G_N_ELEMENTS(fetches);
+	test->server.close_after = 1;
+	test->server.announce_close = GPOINTER_TO_INT(data);
+
+	for (i = 0; i < G_N_ELEMENTS(fetches); i++) {
+		names[i] = g_strdup_printf("/plain/%u", i);
+		test_http_fetch(test, &fetches[i], names[i], FALSE);
+	}
+	test_http_run_until_done(test, G_N_ELEMENTS(fetches));
+
+	g_assert_cmpuint(test->server.connections->len, ==, 2);
+	g_assert_cmpuint(test_http_server_received(&test->server, 0), ==,
+	                 G_N_ELEMENTS(fetches));
+	g_assert_cmpuint(test_http_server_received(&test->server, 1), ==,
+	                 G_N_ELEMENTS(fetches) - 1);
+
+	for (i = 0; i < G_N_ELEMENTS(fetches); i++) {
+		gchar *expected = g_strdup_printf("%u", i);
+
+		g_assert_true(fetches[i].successful);
+		g_assert_cmpstr(fetches[i].body, ==, expected);
+
+		g_free(expected);
+		test_http_fetch_clear(&fetches[i]);
+		g_free(names[i]);
+	}
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/http/pipeline", TestHttp, NULL,
+	           test_http_setup, test_http_pipeline, test_http_teardown);
+	g_test_add("/http/pipeline/closed", TestHttp, GINT_TO_POINTER(TRUE),
+	           test_http_setup, test_http_pipeline_broken,
+	           test_http_teardown);
+	g_test_add("/http/pipeline/broken", TestHttp, GINT_TO_POINTER(FALSE),
+	           test_http_setup, test_http_pipeline_broken,
+	           test_http_teardown);
+
+	return g_test_run();
+}
@@ -0,0 +1,722 @@
+/*
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ *
+ */
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <utime.h>
+
+#include "../account.h"
+#include "../accounts.h"
+#include "../core.h"
+#include "../eventloop.h"
+#include "../log.h"
+#include "../protocols.h"
+#include "../util.h"
+#include "../xmlnode.h"
+
+#define TEST_LOG_UI "test-log"
+#define TEST_LOG_PROTOCOL "prpl-test-log"
+#define TEST_LOG_DAY 86400
+
+/******************************************************************************
+ * Test protocol
+ *****************************************************************************/
+/* The logs of its accounts go in logs/test/<account>. */
+typedef PurpleProtocol TestProtocol;
+typedef PurpleProtocolClass TestProtocolClass;
+
+G_DEFINE_TYPE(TestProtocol, test_protocol, PURPLE_TYPE_PROTOCOL);
+
+static void
+test_protocol_login(PurpleAccount *account) {
+}
+
+static void
+test_protocol_close(PurpleConnection *gc) {
+}
+
+static GList *
+test_protocol_status_types(PurpleAccount *account) {
+	GList *types = NULL;
+
+	types = g_list_append(types, purple_status_type_new(
+		PURPLE_STATUS_AVAILABLE, NULL, NULL, TRUE));
+	types = g_list_append(types, purple_status_type_new(
+		PURPLE_STATUS_OFFLINE, NULL, NULL, TRUE));
+
+	return types;
+}
+
+static const char *
+test_protocol_list_icon(PurpleAccount *account, PurpleBuddy *buddy) {
+	return "test";
+}
+
+static void
+test_protocol_init(TestProtocol *protocol) {
+	protocol->id = TEST_LOG_PROTOCOL;
+	protocol->name = "Log Test";
+	protocol->options = OPT_PROTO_NO_PASSWORD;
+}
+
+static void
+test_protocol_class_init(TestProtocolClass *klass) {
+	klass->login = test_protocol_login;
+	klass->close = test_protocol_close;
+	klass->status_types = test_protocol_status_types;
+	klass->list_icon = test_protocol_list_icon;
+}
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static PurpleEventLoopUiOps test_eventloop_ops = {
+	g_timeout_add,
+	g_source_remove,
+	NULL,
+	NULL,
+	NULL,
+	g_timeout_add_seconds,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+typedef struct {
+	gchar *dir;
+	PurpleAccount *account;
+	/* the time the first log starts */
+	time_t base;
+} TestLog;
+
+static void
+test_log_setup(TestLog *test, gconstpointer data) {
+	GError *error = NULL;
+
+	test->dir = g_dir_make_tmp("purple-log-XXXXXX", NULL);
+	g_assert_nonnull(test->dir);
+	purple_util_set_user_dir(test->dir);
+
+	purple_eventloop_set_ui_ops(&test_eventloop_ops);
+	g_assert_true(purple_core_init(TEST_LOG_UI));
+
+	g_assert_nonnull(purple_protocols_add(test_protocol_get_type(), &error));
+	g_assert_no_error(error);
+
+	test->account = purple_account_new("juliet", TEST_LOG_PROTOCOL);
+	purple_accounts_add(test->account);
+
+	test->base = time(NULL) - 3 * TEST_LOG_DAY;
+}
+
+static void
+test_log_remove_dir(const gchar *path) {
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const gchar *name;
+
+	while (dir && (name = g_dir_read_name(dir)) != NULL) {
+		gchar *child = g_build_filename(path, name, NULL);
+
+		if (g_file_test(child, G_FILE_TEST_IS_DIR))
+			test_log_remove_dir(child);
+		else
+			g_unlink(child);
+		g_free(child);
+	}
+
+	if (dir)
+		g_dir_close(dir);
+	g_rmdir(path);
+}
+
+static void
+test_log_teardown(TestLog *test, gconstpointer data) {
+	purple_core_quit();
+
+	test_log_remove_dir(test->dir);
+	g_free(test->dir);
+}
+
+/* Saves the log catalog the way quitting does, and forgets it. */
+static void
+test_log_restart(TestLog *test) {
+	purple_log_uninit();
+	purple_log_init();
+}
+
+static gchar *
+test_log_path(TestLog *test, const gchar *name) {
+	return g_build_filename(test->dir, "logs", "test", "juliet", name, NULL);
+}
+
+static PurpleLog *
+test_log_new(TestLog *test, const gchar *name, time_t when) {
+	return purple_log_new(PURPLE_LOG_IM, name, test->account, NULL, when,
+	                      NULL);
+}
+
+/* Writes a log of a single message. */
+static void
+test_log_write(TestLog *test, const gchar *name, time_t when,
+               const gchar *message) {
+	PurpleLog *log = test_log_new(test, name, when);
+
+	purple_log_write(log, PURPLE_MESSAGE_RECV, name, when, message);
+	purple_log_free(log);
+}
+
+static void
+test_log_set_mtime(const gchar *path, time_t mtime) {
+	struct utimbuf times;
+
+	times.actime = mtime;
+	times.modtime = mtime;
+	g_assert_cmpint(g_utime(path, &times), ==, 0);
+}
+
+static void
+test_log_age_dir(const gchar *path, time_t mtime) {
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const gchar *name;
+
+	g_assert_nonnull(dir);
+	while ((name = g_dir_read_name(dir)) != NULL) {
+		gchar *child = g_build_filename(path, name, NULL);
+
+		if (g_file_test(child, G_FILE_TEST_IS_DIR))
+			test_log_age_dir(child, mtime);
+		g_free(child);
+	}
+	g_dir_close(dir);
+
+	test_log_set_mtime(path, mtime);
+}
+
+/* Makes every log directory look like it last changed that many seconds
+ * ago. Changes within the last second can't be told apart from the next
+ * ones, so the catalog doesn't trust them. */
+static void
+test_log_age(TestLog *test, time_t seconds) {
+	gchar *path = g_build_filename(test->dir, "logs", NULL);
+
+	test_log_age_dir(path, time(NULL) - seconds);
+	g_free(path);
+}
+
+static gint
+test_log_count(TestLog *test, const gchar *name) {
+	PurpleLogStats stats;
+
+	purple_log_get_stats(PURPLE_LOG_IM, name, test->account, &stats);
+
+	return stats.count;
+}
+
+/* The names of the log sets, sorted and separated by commas */
+static gchar *
+test_log_sets(TestLog *test) {
+	GHashTable *sets = purple_log_get_log_sets();
+	GList *names = NULL, *l;
+	GString *str = g_string_new(NULL);
+
+	for (l = g_hash_table_get_keys(sets); l; l = g_list_delete_link(l, l)) {
+		PurpleLogSet *set = l->data;
+
+		names = g_list_insert_sorted(names, set->name, (GCompareFunc)strcmp);
+	}
+
+	for (l = names; l; l = l->next) {
+		if (str->len > 0)
+			g_string_append_c(str, ',');
+		g_string_append(str, l->data);
+	}
+	g_list_free(names);
+	g_hash_table_destroy(sets);
+
+	return g_string_free(str, FALSE);
+}
+
+static void
+test_log_assert_sets(TestLog *test, const gchar *expected) {
+	gchar *sets = test_log_sets(test);
+
+	g_assert_cmpstr(sets, ==, expected);
+	g_free(sets);
+}
+
+/* The name of a log file of the conversation */
+static gchar *
+test_log_get_file(TestLog *test, const gchar *name) {
+	gchar *path = test_log_path(test, name);
+	GDir *dir = g_dir_open(path, 0, NULL);
+	gchar *file;
+
+	g_assert_nonnull(dir);
+	file = g_build_filename(path, g_dir_read_name(dir), NULL);
+	g_dir_close(dir);
+	g_free(path);
+
+	return file;
+}
+
+static PurpleXmlNode *
+test_log_read_catalog(TestLog *test) {
+	gchar *filename = g_build_filename(test->dir, "logcatalog.xml", NULL);
+	gchar *contents = NULL;
+	PurpleXmlNode *root;
+
+	g_assert_true(g_file_get_contents(filename, &contents, NULL, NULL));
+	root = purple_xmlnode_from_str(contents, -1);
+	g_assert_nonnull(root);
+
+	g_free(contents);
+	g_free(filename);
+
+	return root;
+}
+
+static PurpleXmlNode *
+test_log_find_child(PurpleXmlNode *root, const gchar *name,
+                    const gchar *attr, const gchar *value) {
+	PurpleXmlNode *node;
+
+	for (node = purple_xmlnode_get_child(root, name); node;
+	     node = purple_xmlnode_get_next_twin(node)) {
+		if (g_strcmp0(purple_xmlnode_get_attrib(node, attr), value) == 0)
+			return node;
+	}
+
+	return NULL;
+}
+
+/******************************************************************************
+ * Catalog tests
+ *****************************************************************************/
+/* The catalog is saved with the walked directories and the scanned
+ * conversations, and trusted after loading as long as none of them
+ * changed. */
+static void
+test_log_catalog_save(TestLog *test, gconstpointer data) {
+	PurpleXmlNode *root, *node;
+	gchar *path, *file;
+	GStatBuf st;
+
+	test_log_write(test, "romeo", test->base, "hello");
+	test_log_write(test, "romeo", test->base + 3600, "again");
+	test_log_write(test, "mercutio", test->base + 7200, "a plague");
+	test_log_age(test, 120);
+
+	test_log_assert_sets(test, "mercutio,romeo");
+	g_assert_cmpint(test_log_count(test, "romeo"), ==, 2);
+	g_assert_cmpint(test_log_count(test, "mercutio"), ==, 1);
+	test_log_restart(test);
+
+	root = test_log_read_catalog(test);
+	g_assert_cmpstr(purple_xmlnode_get_attrib(root, "complete"), ==, "1");
+	node = test_log_find_child(root, "dir", "path", "");
+	g_assert_nonnull(node);
+	g_assert_cmpstr(purple_xmlnode_get_attrib(node, "mtime"), !=, "-1");
+	g_assert_nonnull(test_log_find_child(root, "dir", "path", "test/juliet"));
+	node = test_log_find_child(root, "set", "dir", "test/juliet/romeo");
+	g_assert_nonnull(node);
+	g_assert_cmpstr(purple_xmlnode_get_attrib(node, "count"), ==, "2");
+	g_assert_nonnull(purple_xmlnode_get_attrib(node, "first"));
+	purple_xmlnode_free(root);
+
+	/* A log removed behind its back goes unnoticed as long as the
+	 * directory looks the same, which shows the count came from the
+	 * catalog... */
+	path = test_log_path(test, "romeo");
+	g_assert_cmpint(g_stat(path, &st), ==, 0);
+	file = test_log_get_file(test, "romeo");
+	g_assert_cmpint(g_unlink(file), ==, 0);
+	test_log_set_mtime(path, st.st_mtime);
+
+	test_log_assert_sets(test, "mercutio,romeo");
+	g_assert_cmpint(test_log_count(test, "romeo"), ==, 2);
+
+	/* ...and it is counted again once the directory changed. */
+	test_log_age(test, 60);
+	g_assert_cmpint(test_log_count(test, "romeo"), ==, 1);
+
+	g_free(file);
+	g_free(path);
+}
+
+/* Log directories added or removed by someone else are found by the next
+ * listing, even with a complete catalog. */
+static void
+test_log_catalog_revalidate(TestLog *test, gconstpointer data) {
+	gchar *file, *basename, *dir, *copy, *contents;
+	gsize len;
+
+	test_log_write(test, "romeo", test->base, "hello");
+	test_log_write(test, "mercutio", test->base + 3600, "a plague");
+	test_log_age(test, 120);
+	test_log_assert_sets(test, "mercutio,romeo");
+	g_assert_cmpint(test_log_count(test, "romeo"), ==, 1);
+	test_log_restart(test);
+
+	/* as if restored from a backup */
+	file = test_log_get_file(test, "romeo");
+	g_assert_true(g_file_get_contents(file, &contents, &len, NULL));
+	dir = test_log_path(test, "tybalt");
+	g_assert_cmpint(g_mkdir(dir, 0700), ==, 0);
+	basename = g_path_get_basename(file);
+	copy = g_build_filename(dir, basename, NULL);
+	g_assert_true(g_file_set_contents(copy, contents, len, NULL));
+	g_free(dir);
+
+	dir = test_log_path(test, "mercutio");
+	test_log_remove_dir(dir);
+
+	test_log_assert_sets(test, "romeo,tybalt");
+	g_assert_cmpint(test_log_count(test, "tybalt"), ==, 1);
+	g_assert_cmpint(test_log_count(test, "mercutio"), ==, 0);
+
+	/* and nothing changes when listed again from the catalog */
+	test_log_age(test, 60);
+	test_log_assert_sets(test, "romeo,tybalt");
+	test_log_restart(test);
+	test_log_assert_sets(test, "romeo,tybalt");
+
+	g_free(dir);
+	g_free(copy);
+	g_free(basename);
+	g_free(contents);
+	g_free(file);
+}
+
+/* Writing to the logs updates the stats as it goes, and they agree with a
+ * fresh count. */
+static void
+test_log_catalog_incremental(TestLog *test, gconstpointer data) {
+	PurpleLog *first, *second;
+	PurpleLogStats stats, scanned;
+
+	purple_log_get_stats(PURPLE_LOG_IM, "romeo", test->account, &stats);
+	g_assert_cmpint(stats.count, ==, 0);
+	g_assert_cmpint(stats.size, ==, 0);
+
+	first = test_log_new(test, "romeo", test->base);
+	purple_log_write(first, PURPLE_MESSAGE_RECV, "romeo", test->base,
+	                 "hello");
+	purple_log_get_stats(PURPLE_LOG_IM, "romeo", test->account, &stats);
+	g_assert_cmpint(stats.count, ==, 1);
+	g_assert_cmpint(stats.size, >, 0);
+	g_assert_cmpint(stats.first, ==, test->base);
+	g_assert_cmpint(stats.last, ==, test->base);
+	g_assert_cmpint(stats.last_activity, ==, test->base);
+
+	/* More of the same log doesn't change the directory, so this is
+	 * what was counted along the way. */
+	test_log_age(test, 120);
+	purple_log_get_stats(PURPLE_LOG_IM, "romeo", test->account, &scanned);
+	g_assert_cmpint(scanned.count, ==, 1);
+	purple_log_write(first, PURPLE_MESSAGE_SEND, "juliet", test->base + 10,
+	                 "hello to you");
+	purple_log_get_stats(PURPLE_LOG_IM, "romeo", test->account, &stats);
+	g_assert_cmpint(stats.count, ==, 1);
+	g_assert_cmpint(stats.size, >, scanned.size);
+	g_assert_cmpint(stats.last, ==, test->base);
+	g_assert_cmpint(stats.last_activity, ==, test->base + 10);
+
+	/* a new log */
+	second = test_log_new(test, "romeo", test->base + TEST_LOG_DAY);
+	purple_log_write(second, PURPLE_MESSAGE_RECV, "romeo",
+	                 test->base + TEST_LOG_DAY, "good night");
+	purple_log_get_stats(PURPLE_LOG_IM, "romeo", test->account, &stats);
+	g_assert_cmpint(stats.count, ==, 2);
+	g_assert_cmpint(stats.first, ==, test->base);
+	g_assert_cmpint(stats.last, ==, test->base + TEST_LOG_DAY);
+	g_assert_cmpint(stats.last_activity, ==, test->base + TEST_LOG_DAY);
+
+	purple_log_free(first);
+	purple_log_free(second);
+
+	test_log_age(test, 60);
+	purple_log_get_stats(PURPLE_LOG_IM, "romeo", test->account, &scanned);
+	g_assert_cmpint(scanned.count, ==, stats.count);
+	g_assert_cmpint(scanned.first, ==, stats.first);
+	g_assert_cmpint(scanned.last, ==, stats.last);
+	g_assert_cmpint(scanned.last_activity, ==, stats.last_activity);
+}
+
+/******************************************************************************
+ * Search index tests
+ *****************************************************************************/
+static const gchar *test_log_names[] = { "mercutio", "romeo", "tybalt" };
+
+static GList *
+test_log_get_all(TestLog *test) {
+	GList *logs = NULL;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(test_log_names); i++) {
+		logs = g_list_concat(logs, purple_log_get_logs(PURPLE_LOG_IM,
+		                                               test_log_names[i],
+		                                               test->account));
+	}
+
+	return logs;
+}
+
+static void
+test_log_free_all(GList *logs) {
+	g_list_free_full(logs, (GDestroyNotify)purple_log_free);
+}
+
+/* The matches as "<name>:<day>", where day counts from the base time,
+ * sorted and separated by commas */
+static gchar *
+test_log_search(TestLog *test, GList *logs, const gchar *query,
+                time_t start, time_t end) {
+	GList *matches = purple_log_search(logs, query, start, end);
+	GList *names = NULL, *l;
+	GString *str = g_string_new(NULL);
+
+	for (l = matches; l; l = l->next) {
+		PurpleLog *log = l->data;
+
+		names = g_list_insert_sorted(names,
+			g_strdup_printf("%s:%d", log->name,
+			                (gint)((log->time - test->base) / TEST_LOG_DAY)),
+			(GCompareFunc)strcmp);
+	}
+	g_list_free(matches);
+
+	for (l = names; l; l = l->next) {
+		if (str->len > 0)
+			g_string_append_c(str, ',');
+		g_string_append(str, l->data);
+	}
+	g_list_free_full(names, g_free);
+
+	return g_string_free(str, FALSE);
+}
+
+static void
+test_log_assert_search(TestLog *test, GList *logs, const gchar *query,
+                       time_t start, time_t end, const gchar *expected) {
+	gchar *found = test_log_search(test, logs, query, start, end);
+
+	g_assert_cmpstr(found, ==, expected);
+	g_free(found);
+}
+
+static void
+test_log_write_verona(TestLog *test) {
+	test_log_write(test, "romeo", test->base,
+	               "<b>Hello</b>, is that the east?");
+	test_log_write(test, "romeo", test->base + TEST_LOG_DAY,
+	               "Wherefore art thou Romeo?");
+	test_log_write(test, "mercutio", test->base + TEST_LOG_DAY,
+	               "Thou art like one of those fellows");
+	test_log_write(test, "tybalt", test->base + 2 * TEST_LOG_DAY,
+	               "Hell is the word, and I hate it");
+}
+
+static gchar *
+test_log_read_index(TestLog *test) {
+	gchar *filename = g_build_filename(test->dir, "logindex.txt", NULL);
+	gchar *contents = NULL;
+
+	if (!g_file_get_contents(filename, &contents, NULL, NULL))
+		contents = NULL;
+	g_free(filename);
+
+	return contents;
+}
+
+/* Logs written before there was an index are read into it by the first
+ * search, and saved with it. */
+static void
+test_log_index_build(TestLog *test, gconstpointer data) {
+	gchar *filename, *contents, **lines;
+	GList *logs;
+
+	test_log_write_verona(test);
+	test_log_restart(test);
+	filename = g_build_filename(test->dir, "logindex.txt", NULL);
+	g_assert_cmpint(g_unlink(filename), ==, 0);
+	g_free(filename);
+
+	logs = test_log_get_all(test);
+	test_log_assert_search(test, logs, "thou", 0, 0, "mercutio:1,romeo:1");
+	test_log_assert_search(test, logs, "HELLO east", 0, 0, "romeo:0");
+	test_log_assert_search(test, logs, "romeo art", 0, 0, "romeo:1");
+	test_log_assert_search(test, logs, "nurse", 0, 0, "");
+	test_log_free_all(logs);
+
+	/* one line for each log */
+	test_log_restart(test);
+	contents = test_log_read_index(test);
+	g_assert_nonnull(contents);
+	lines = g_strsplit(contents, "\n", -1);
+	g_assert_cmpuint(g_strv_length(lines), ==, 5);
+	g_assert_true(g_str_has_prefix(lines[0], "*\thtml/test/juliet/"));
+	g_assert_cmpstr(lines[4], ==, "");
+	g_strfreev(lines);
+	g_free(contents);
+
+	/* and the saved index is enough to search */
+	logs = test_log_get_all(test);
+	test_log_assert_search(test, logs, "fellows", 0, 0, "mercutio:1");
+	test_log_free_all(logs);
+}
+
+/* Writing and deleting logs updates a loaded index right away. */
+static void
+test_log_index_incremental(TestLog *test, gconstpointer data) {
+	PurpleLog *log;
+	GList *logs, *l;
+	gchar *contents;
+
+	test_log_write_verona(test);
+	logs = test_log_get_all(test);
+	test_log_assert_search(test, logs, "balcony", 0, 0, "");
+	test_log_free_all(logs);
+
+	log = test_log_new(test, "romeo", test->base + 3 * TEST_LOG_DAY);
+	purple_log_write(log, PURPLE_MESSAGE_SEND, "juliet",
+	                 test->base + 3 * TEST_LOG_DAY, "Come to the balcony");
+	purple_log_write(log, PURPLE_MESSAGE_RECV, "romeo",
+	                 test->base + 3 * TEST_LOG_DAY + 10, "Anon, good nurse");
+	purple_log_free(log);
+
+	logs = test_log_get_all(test);
+	test_log_assert_search(test, logs, "balcony nurse juliet", 0, 0,
+	                       "romeo:3");
+
+	/* and deleting it takes it out again */
+	for (l = logs; l; l = l->next) {
+		log = l->data;
+		if (log->time == test->base + 3 * TEST_LOG_DAY)
+			break;
+	}
+	g_assert_nonnull(l);
+	g_assert_true(purple_log_delete(log));
+	logs = g_list_delete_link(logs, l);
+	purple_log_free(log);
+	test_log_free_all(logs);
+
+	/* Both changes went to the journal. */
+	test_log_restart(test);
+	contents = test_log_read_index(test);
+	g_assert_nonnull(strstr(contents, "+\thtml/test/juliet/romeo/"));
+	g_assert_nonnull(strstr(contents, "-\thtml/test/juliet/romeo/"));
+	g_free(contents);
+}
+
+/* Words in double quotes have to be next to each other. */
+static void
+test_log_index_phrase(TestLog *test, gconstpointer data) {
+	GList *logs;
+
+	test_log_write_verona(test);
+	logs = test_log_get_all(test);
+
+	test_log_assert_search(test, logs, "art thou", 0, 0,
+	                       "mercutio:1,romeo:1");
+	test_log_assert_search(test, logs, "\"art thou\"", 0, 0, "romeo:1");
+	test_log_assert_search(test, logs, "\"thou art\"", 0, 0, "mercutio:1");
+	test_log_assert_search(test, logs, "\"thou art\" fellows", 0, 0,
+	                       "mercutio:1");
+	test_log_assert_search(test, logs, "\"art romeo\"", 0, 0, "");
+
+	test_log_free_all(logs);
+}
+
+/* A word that isn't in any log matches the words it starts. */
+static void
+test_log_index_prefix(TestLog *test, gconstpointer data) {
+	GList *logs;
+
+	test_log_write_verona(test);
+	logs = test_log_get_all(test);
+
+	test_log_assert_search(test, logs, "hel", 0, 0, "romeo:0,tybalt:2");
+	test_log_assert_search(test, logs, "Fel", 0, 0, "mercutio:1");
+	test_log_assert_search(test, logs, "wher thou", 0, 0, "romeo:1");
+	test_log_assert_search(test, logs, "hatred", 0, 0, "");
+
+	/* but a word that is in the logs only matches itself */
+	test_log_assert_search(test, logs, "hell", 0, 0, "tybalt:2");
+
+	test_log_free_all(logs);
+}
+
+/* Only logs started from start up to before end are searched. */
+static void
+test_log_index_range(TestLog *test, gconstpointer data) {
+	GList *logs;
+
+	test_log_write_verona(test);
+	logs = test_log_get_all(test);
+
+	test_log_assert_search(test, logs, "is", 0, 0, "romeo:0,tybalt:2");
+	test_log_assert_search(test, logs, "is", test->base + TEST_LOG_DAY, 0,
+	                       "tybalt:2");
+	test_log_assert_search(test, logs, "is", 0,
+	                       test->base + 2 * TEST_LOG_DAY, "romeo:0");
+	test_log_assert_search(test, logs, "thou", test->base + TEST_LOG_DAY,
+	                       test->base + TEST_LOG_DAY + 1,
+	                       "mercutio:1,romeo:1");
+	test_log_assert_search(test, logs, "thou", test->base,
+	                       test->base + TEST_LOG_DAY, "");
+
+	test_log_free_all(logs);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/log/catalog/save", TestLog, NULL,
+	           test_log_setup, test_log_catalog_save, test_log_teardown);
+	g_test_add("/log/catalog/revalidate", TestLog, NULL,
+	           test_log_setup, test_log_catalog_revalidate,
+	           test_log_teardown);
+	g_test_add("/log/catalog/incremental", TestLog, NULL,
+	           test_log_setup, test_log_catalog_incremental,
+	           test_log_teardown);
+
+	g_test_add("/log/index/build", TestLog, NULL,
+	           test_log_setup, test_log_index_build, test_log_teardown);
+	g_test_add("/log/index/incremental", TestLog, NULL,
+	           test_log_setup, test_log_index_incremental,
+	           test_log_teardown);
+	g_test_add("/log/index/phrase", TestLog, NULL,
+	           test_log_setup, test_log_index_phrase, test_log_teardown);
+	g_test_add("/log/index/prefix", TestLog, NULL,
+	           test_log_setup, test_log_index_prefix, test_log_teardown);
+	g_test_add("/log/index/range", TestLog, NULL,
+	           test_log_setup, test_log_index_range, test_log_teardown);
+
+	return g_test_run();
+}
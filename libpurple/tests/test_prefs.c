@@ -0,0 +1,281 @@
+/*
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ *
+ */
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "../eventloop.h"
+#include "../prefs.h"
+#include "../util.h"
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static PurpleEventLoopUiOps test_eventloop_ops = {
+	g_timeout_add,
+	g_source_remove,
+	NULL,
+	NULL,
+	NULL,
+	g_timeout_add_seconds,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+typedef struct {
+	gchar *dir;
+} TestPrefs;
+
+static gint test_prefs_handle;
+
+/* "tag:name=value " for every callback, in order */
+static GString *test_prefs_calls = NULL;
+
+static void
+test_prefs_cb(const char *name, PurplePrefType type, gconstpointer val,
+              gpointer data)
+{
+	g_string_append_printf(test_prefs_calls, "%s:%s=%d ",
+	                       (const gchar *)data, name, GPOINTER_TO_INT(val));
+}
+
+static void
+test_prefs_connect(const gchar *name, const gchar *tag) {
+	g_assert_cmpuint(purple_prefs_connect_callback(&test_prefs_handle, name,
+	                                               test_prefs_cb,
+	                                               (gpointer)tag),
+	                 !=, 0);
+}
+
+static void
+test_prefs_setup(TestPrefs *test, gconstpointer data) {
+	test->dir = g_dir_make_tmp("purple-prefs-XXXXXX", NULL);
+	g_assert_nonnull(test->dir);
+	purple_util_set_user_dir(test->dir);
+	purple_eventloop_set_ui_ops(&test_eventloop_ops);
+
+	purple_prefs_init();
+	purple_prefs_add_none("/test");
+	purple_prefs_add_int("/test/a", 0);
+	purple_prefs_add_int("/test/ab", 0);
+	purple_prefs_add_int("/test/b", 0);
+
+	test_prefs_calls = g_string_new(NULL);
+}
+
+static void
+test_prefs_teardown(TestPrefs *test, gconstpointer data) {
+	gchar *filename;
+
+	purple_prefs_disconnect_by_handle(&test_prefs_handle);
+	purple_prefs_uninit();
+
+	filename = g_build_filename(test->dir, "prefs.xml", NULL);
+	g_unlink(filename);
+	g_free(filename);
+	g_rmdir(test->dir);
+	g_free(test->dir);
+	g_string_free(test_prefs_calls, TRUE);
+	test_prefs_calls = NULL;
+}
+
+/******************************************************************************
+ * UI storage
+ *****************************************************************************/
+/* Ints only, and any change triggers the callbacks by name, so that the
+ * path-indexed dispatch is what finds them. */
+static GHashTable *test_prefs_ui_values = NULL;
+
+static void
+test_prefs_ui_set_int(const char *name, int value) {
+	g_hash_table_insert(test_prefs_ui_values, g_strdup(name),
+	                    GINT_TO_POINTER(value));
+	purple_prefs_trigger_callback(name);
+}
+
+static int
+test_prefs_ui_get_int(const char *name) {
+	return GPOINTER_TO_INT(g_hash_table_lookup(test_prefs_ui_values, name));
+}
+
+static PurplePrefType
+test_prefs_ui_get_type(const char *name) {
+	return PURPLE_PREF_INT;
+}
+
+static void *
+test_prefs_ui_connect_callback(const char *name, PurplePrefCallbackData *data) {
+	return data;
+}
+
+static void
+test_prefs_ui_disconnect_callback(const char *name, void *ui_data) {
+}
+
+static PurplePrefsUiOps test_prefs_ui_ops = {
+	.set_int = test_prefs_ui_set_int,
+	.get_int = test_prefs_ui_get_int,
+	.get_type = test_prefs_ui_get_type,
+	.connect_callback = test_prefs_ui_connect_callback,
+	.disconnect_callback = test_prefs_ui_disconnect_callback,
+};
+
+static void
+test_prefs_ui_setup(TestPrefs *test, gconstpointer data) {
+	test_prefs_ui_values = g_hash_table_new_full(g_str_hash, g_str_equal,
+	                                             g_free, NULL);
+	purple_prefs_set_ui_ops(&test_prefs_ui_ops);
+
+	test_prefs_calls = g_string_new(NULL);
+}
+
+static void
+test_prefs_ui_teardown(TestPrefs *test, gconstpointer data) {
+	purple_prefs_disconnect_by_handle(&test_prefs_handle);
+	purple_prefs_set_ui_ops(NULL);
+
+	g_hash_table_destroy(test_prefs_ui_values);
+	test_prefs_ui_values = NULL;
+	g_string_free(test_prefs_calls, TRUE);
+	test_prefs_calls = NULL;
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+/* A pref's own callbacks run first, then those of its parents. */
+static void
+test_prefs_callbacks_order(TestPrefs *test, gconstpointer data) {
+	test_prefs_connect("/test/a", "1");
+	test_prefs_connect("/test", "2");
+	test_prefs_connect("/test/ab", "3");
+	test_prefs_connect("/test/a", "4");
+
+	purple_prefs_set_int("/test/a", 5);
+	g_assert_cmpstr(test_prefs_calls->str, ==,
+	                "1:/test/a=5 4:/test/a=5 2:/test/a=5 ");
+
+	g_string_truncate(test_prefs_calls, 0);
+	purple_prefs_set_int("/test/ab", 6);
+	g_assert_cmpstr(test_prefs_calls->str, ==, "3:/test/ab=6 2:/test/ab=6 ");
+
+	/* setting the same value again changes nothing */
+	g_string_truncate(test_prefs_calls, 0);
+	purple_prefs_set_int("/test/ab", 6);
+	g_assert_cmpstr(test_prefs_calls->str, ==, "");
+}
+
+/* Each changed pref calls its callbacks once, with its last value, in the
+ * order it was first changed. */
+static void
+test_prefs_batch_coalesce(TestPrefs *test, gconstpointer data) {
+	test_prefs_connect("/test/a", "a");
+	test_prefs_connect("/test/b", "b");
+	test_prefs_connect("/test", "t");
+
+	purple_prefs_begin_batch();
+	purple_prefs_set_int("/test/b", 1);
+	purple_prefs_set_int("/test/a", 2);
+
+	/* only the outermost batch dispatches */
+	purple_prefs_begin_batch();
+	purple_prefs_set_int("/test/b", 3);
+	purple_prefs_commit_batch();
+
+	purple_prefs_set_int("/test/a", 4);
+	g_assert_cmpint(purple_prefs_get_int("/test/a"), ==, 4);
+	g_assert_cmpstr(test_prefs_calls->str, ==, "");
+
+	purple_prefs_commit_batch();
+	g_assert_cmpstr(test_prefs_calls->str, ==,
+	                "b:/test/b=3 t:/test/b=3 a:/test/a=4 t:/test/a=4 ");
+
+	/* and after it, changes go out right away again */
+	g_string_truncate(test_prefs_calls, 0);
+	purple_prefs_set_int("/test/a", 5);
+	g_assert_cmpstr(test_prefs_calls->str, ==, "a:/test/a=5 t:/test/a=5 ");
+}
+
+/* Callbacks kept by the UI are found by each prefix of the path, and called
+ * in the order they were connected. */
+static void
+test_prefs_ui_callbacks_order(TestPrefs *test, gconstpointer data) {
+	test_prefs_connect("/test/a", "1");
+	test_prefs_connect("/test", "2");
+	test_prefs_connect("/", "3");
+	test_prefs_connect("/test/", "4");
+	test_prefs_connect("/test/ab", "5");
+	test_prefs_connect("/tes", "6");
+	test_prefs_connect("/test/a", "7");
+
+	purple_prefs_set_int("/test/a", 8);
+	g_assert_cmpstr(test_prefs_calls->str, ==,
+	                "1:/test/a=8 2:/test/a=8 3:/test/a=8 4:/test/a=8 "
+	                "7:/test/a=8 ");
+
+	g_string_truncate(test_prefs_calls, 0);
+	purple_prefs_set_int("/test/ab", 9);
+	g_assert_cmpstr(test_prefs_calls->str, ==,
+	                "2:/test/ab=9 3:/test/ab=9 4:/test/ab=9 5:/test/ab=9 ");
+}
+
+static void
+test_prefs_ui_batch_coalesce(TestPrefs *test, gconstpointer data) {
+	test_prefs_connect("/test/a", "a");
+	test_prefs_connect("/test", "t");
+	test_prefs_connect("/test/b", "b");
+
+	purple_prefs_begin_batch();
+	purple_prefs_set_int("/test/a", 1);
+	purple_prefs_set_int("/test/b", 2);
+	purple_prefs_set_int("/test/a", 3);
+	g_assert_cmpstr(test_prefs_calls->str, ==, "");
+	purple_prefs_commit_batch();
+
+	g_assert_cmpstr(test_prefs_calls->str, ==,
+	                "a:/test/a=3 t:/test/a=3 t:/test/b=2 b:/test/b=2 ");
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/prefs/callbacks/order", TestPrefs, NULL,
+	           test_prefs_setup, test_prefs_callbacks_order,
+	           test_prefs_teardown);
+	g_test_add("/prefs/batch/coalesce", TestPrefs, NULL,
+	           test_prefs_setup, test_prefs_batch_coalesce,
+	           test_prefs_teardown);
+	g_test_add("/prefs/ui/callbacks/order", TestPrefs, NULL,
+	           test_prefs_ui_setup, test_prefs_ui_callbacks_order,
+	           test_prefs_ui_teardown);
+	g_test_add("/prefs/ui/batch/coalesce", TestPrefs, NULL,
+	           test_prefs_ui_setup, test_prefs_ui_batch_coalesce,
+	           test_prefs_ui_teardown);
+
+	return g_test_run();
+}
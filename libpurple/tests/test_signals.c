@@ -0,0 +1,289 @@
+/*
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ *
+ */
+#include <glib.h>
+
+#include "../signals.h"
+
+#define TEST_SIGNALS_PERF_EMITS 1000000
+
+static int test_instance;
+static int test_handle;
+static int test_other_handle;
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static void
+test_signals_setup(void) {
+	purple_signals_init();
+
+	purple_signal_register(&test_instance, "test-void",
+	                       purple_marshal_VOID__POINTER, G_TYPE_NONE, 1,
+	                       G_TYPE_POINTER);
+	purple_signal_register(&test_instance, "test-return",
+	                       purple_marshal_POINTER__POINTER, G_TYPE_POINTER, 1,
+	                       G_TYPE_POINTER);
+}
+
+static void
+test_signals_teardown(void) {
+	purple_signals_uninit();
+}
+
+static void
+test_signals_append_a(GString *str, gpointer data) {
+	g_string_append_c(str, 'a');
+}
+
+static void
+test_signals_append_b(GString *str, gpointer data) {
+	g_string_append_c(str, 'b');
+}
+
+static void
+test_signals_append_c(GString *str, gpointer data) {
+	g_string_append_c(str, 'c');
+}
+
+static gpointer
+test_signals_return_null(gpointer arg, gpointer data) {
+	return NULL;
+}
+
+static gpointer
+test_signals_return_data(gpointer arg, gpointer data) {
+	return data;
+}
+
+static void
+test_signals_count(gpointer arg, gpointer data) {
+	(*(guint *)data)++;
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_signals_lookup(void) {
+	gulong id;
+
+	test_signals_setup();
+
+	id = purple_signal_lookup(&test_instance, "test-void");
+	g_assert_cmpuint(id, !=, 0);
+	g_assert_cmpuint(id, !=, purple_signal_lookup(&test_instance, "test-return"));
+	g_assert_cmpuint(purple_signal_lookup(&test_instance, "nonexistent"), ==, 0);
+	g_assert_cmpuint(purple_signal_lookup(&test_other_handle, "test-void"), ==, 0);
+
+	purple_signal_unregister(&test_instance, "test-void");
+	g_assert_cmpuint(purple_signal_lookup(&test_instance, "test-void"), ==, 0);
+
+	/* emitting "no signal" is a no-op, not a warning */
+	purple_signal_emit_by_id(0, NULL);
+	g_assert_null(purple_signal_emit_return_1_by_id(0, NULL));
+
+	test_signals_teardown();
+}
+
+static void
+test_signals_priority(void) {
+	GString *str = g_string_new(NULL);
+
+	test_signals_setup();
+
+	purple_signal_connect_priority(&test_instance, "test-void", &test_handle,
+	                               PURPLE_CALLBACK(test_signals_append_a), NULL,
+	                               PURPLE_SIGNAL_PRIORITY_HIGHEST);
+	purple_signal_connect(&test_instance, "test-void", &test_handle,
+	                      PURPLE_CALLBACK(test_signals_append_b), NULL);
+	purple_signal_connect_priority(&test_instance, "test-void", &test_handle,
+	                               PURPLE_CALLBACK(test_signals_append_c), NULL,
+	                               PURPLE_SIGNAL_PRIORITY_LOWEST);
+
+	purple_signal_emit(&test_instance, "test-void", str);
+	g_assert_cmpstr(str->str, ==, "cba");
+
+	/* handlers of the same priority run newest first */
+	purple_signal_connect(&test_instance, "test-void", &test_other_handle,
+	                      PURPLE_CALLBACK(test_signals_append_a), NULL);
+	g_string_truncate(str, 0);
+	purple_signal_emit_by_id(purple_signal_lookup(&test_instance, "test-void"),
+	                         str);
+	g_assert_cmpstr(str->str, ==, "caba");
+
+	purple_signals_disconnect_by_handle(&test_handle);
+	g_string_truncate(str, 0);
+	purple_signal_emit(&test_instance, "test-void", str);
+	g_assert_cmpstr(str->str, ==, "a");
+
+	test_signals_teardown();
+	g_string_free(str, TRUE);
+}
+
+static void
+test_signals_has_handlers(void) {
+	test_signals_setup();
+
+	g_assert_false(purple_signal_has_handlers(&test_instance, "test-void"));
+
+	purple_signal_connect(&test_instance, "test-void", &test_handle,
+	                      PURPLE_CALLBACK(test_signals_append_a), NULL);
+	g_assert_true(purple_signal_has_handlers(&test_instance, "test-void"));
+
+	purple_signal_disconnect(&test_instance, "test-void", &test_handle,
+	                         PURPLE_CALLBACK(test_signals_append_a));
+	g_assert_false(purple_signal_has_handlers(&test_instance, "test-void"));
+
+	test_signals_teardown();
+}
+
+static void
+test_signals_disconnect_self(GString *str, gpointer data) {
+	g_string_append_c(str, 'd');
+
+	purple_signal_disconnect(&test_instance, "test-void", &test_handle,
+	                         PURPLE_CALLBACK(test_signals_disconnect_self));
+	purple_signal_disconnect(&test_instance, "test-void", &test_handle,
+	                         PURPLE_CALLBACK(test_signals_append_a));
+	purple_signal_connect_priority(&test_instance, "test-void",
+	                               &test_other_handle,
+	                               PURPLE_CALLBACK(test_signals_append_c),
+	                               NULL, PURPLE_SIGNAL_PRIORITY_HIGHEST);
+}
+
+static void
+test_signals_modify_while_emitting(void) {
+	GString *str = g_string_new(NULL);
+
+	test_signals_setup();
+
+	purple_signal_connect(&test_instance, "test-void", &test_handle,
+	                      PURPLE_CALLBACK(test_signals_append_a), NULL);
+	purple_signal_connect(&test_instance, "test-void", &test_handle,
+	                      PURPLE_CALLBACK(test_signals_append_b), NULL);
+	purple_signal_connect_priority(&test_instance, "test-void", &test_handle,
+	                               PURPLE_CALLBACK(test_signals_disconnect_self),
+	                               NULL, PURPLE_SIGNAL_PRIORITY_LOWEST);
+
+	/* the removed handler is skipped, the new one runs at the end */
+	purple_signal_emit(&test_instance, "test-void", str);
+	g_assert_cmpstr(str->str, ==, "dbc");
+
+	/* and once the emission is done, it takes its place */
+	g_string_truncate(str, 0);
+	purple_signal_emit(&test_instance, "test-void", str);
+	g_assert_cmpstr(str->str, ==, "bc");
+
+	test_signals_teardown();
+	g_string_free(str, TRUE);
+}
+
+static void
+test_signals_return_1(void) {
+	int value = 42;
+	gulong id;
+
+	test_signals_setup();
+
+	id = purple_signal_lookup(&test_instance, "test-return");
+	g_assert_null(purple_signal_emit_return_1_by_id(id, NULL));
+
+	purple_signal_connect(&test_instance, "test-return", &test_handle,
+	                      PURPLE_CALLBACK(test_signals_return_data), &value);
+	purple_signal_connect(&test_instance, "test-return", &test_handle,
+	                      PURPLE_CALLBACK(test_signals_return_null), NULL);
+
+	g_assert_true(purple_signal_emit_return_1_by_id(id, NULL) == &value);
+	g_assert_true(purple_signal_emit_return_1(&test_instance, "test-return",
+	                                          NULL) == &value);
+
+	test_signals_teardown();
+}
+
+/******************************************************************************
+ * Benchmarks
+ *****************************************************************************/
+static void
+test_signals_perf_emit(gconstpointer data) {
+	guint n_handlers = GPOINTER_TO_UINT(data);
+	guint count = 0, i;
+	gulong id;
+	gdouble elapsed;
+
+	test_signals_setup();
+
+	for (i = 0; i < n_handlers; i++) {
+		purple_signal_connect(&test_instance, "test-void",
+		                      GUINT_TO_POINTER(i + 1),
+		                      PURPLE_CALLBACK(test_signals_count), &count);
+	}
+
+	g_test_timer_start();
+	for (i = 0; i < TEST_SIGNALS_PERF_EMITS; i++)
+		purple_signal_emit(&test_instance, "test-void", NULL);
+	elapsed = g_test_timer_elapsed();
+	g_test_minimized_result(elapsed, "emit by name, %u handlers: %.3fs",
+	                        n_handlers, elapsed);
+
+	id = purple_signal_lookup(&test_instance, "test-void");
+	g_test_timer_start();
+	for (i = 0; i < TEST_SIGNALS_PERF_EMITS; i++)
+		purple_signal_emit_by_id(id, NULL);
+	elapsed = g_test_timer_elapsed();
+	g_test_minimized_result(elapsed, "emit by id, %u handlers: %.3fs",
+	                        n_handlers, elapsed);
+
+	g_assert_cmpuint(count, ==, 2 * TEST_SIGNALS_PERF_EMITS * n_handlers);
+
+	test_signals_teardown();
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/signals/lookup",
+	                test_signals_lookup);
+	g_test_add_func("/signals/priority",
+	                test_signals_priority);
+	g_test_add_func("/signals/has handlers",
+	                test_signals_has_handlers);
+	g_test_add_func("/signals/modify while emitting",
+	                test_signals_modify_while_emitting);
+	g_test_add_func("/signals/return 1",
+	                test_signals_return_1);
+
+	if (g_test_perf()) {
+		g_test_add_data_func("/signals/perf/emit 0 handlers",
+		                     GUINT_TO_POINTER(0), test_signals_perf_emit);
+		g_test_add_data_func("/signals/perf/emit 1 handler",
+		                     GUINT_TO_POINTER(1), test_signals_perf_emit);
+		g_test_add_data_func("/signals/perf/emit 20 handlers",
+		                     GUINT_TO_POINTER(20), test_signals_perf_emit);
+	}
+
+	return g_test_run();
+}
@@ -0,0 +1,1021 @@
+/*
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ *
+ */
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../internal.h"
+#include "../account.h"
+#include "../core.h"
+#include "../debug.h"
+#include "../eventloop.h"
+#include "../util.h"
+#include "../xfer.h"
+
+#define TEST_XFER_UI "test-xfer"
+#define TEST_XFER_CHUNK_SIZE 1024
+
+#define TEST_XFER_PERF_SIZE       (32 * 1024 * 1024)
+#define TEST_XFER_PERF_CHUNK_SIZE (256 * 1024)
+#define TEST_XFER_PERF_LATENCY    (5 * 1000)
+#define TEST_XFER_PERF_MAX_STREAMS 8
+
+#define TEST_XFER_STREAM_SIZE (512 * 1024 + 123)
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+#define TEST_XFER_HAVE_SENDFILE TRUE
+#else
+#define TEST_XFER_HAVE_SENDFILE FALSE
+#endif
+
+#ifdef HAVE_SPLICE
+#define TEST_XFER_HAVE_SPLICE TRUE
+#else
+#define TEST_XFER_HAVE_SPLICE FALSE
+#endif
+
+/* When the zero-copy transfers are made to fall back to stdio */
+typedef enum {
+	TEST_XFER_FALLBACK_NONE,
+	TEST_XFER_FALLBACK_START,
+	TEST_XFER_FALLBACK_MIDWAY
+} TestXferFallback;
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+typedef struct {
+	PurpleInputFunction function;
+	gpointer data;
+} TestXferIOClosure;
+
+static gboolean
+test_xfer_io_invoke(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+	TestXferIOClosure *closure = data;
+	PurpleInputCondition purple_cond = 0;
+
+	if (condition & (G_IO_IN | G_IO_HUP | G_IO_ERR))
+		purple_cond |= PURPLE_INPUT_READ;
+	if (condition & (G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL))
+		purple_cond |= PURPLE_INPUT_WRITE;
+
+	closure->function(closure->data, g_io_channel_unix_get_fd(source),
+	                  purple_cond);
+
+	return TRUE;
+}
+
+static guint
+test_xfer_input_add(gint fd, PurpleInputCondition condition,
+                    PurpleInputFunction function, gpointer data)
+{
+	TestXferIOClosure *closure = g_new0(TestXferIOClosure, 1);
+	GIOChannel *channel = g_io_channel_unix_new(fd);
+	GIOCondition cond = 0;
+	guint ret;
+
+	closure->function = function;
+	closure->data = data;
+
+	if (condition & PURPLE_INPUT_READ)
+		cond |= G_IO_IN | G_IO_HUP | G_IO_ERR;
+	if (condition & PURPLE_INPUT_WRITE)
+		cond |= G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL;
+
+	ret = g_io_add_watch_full(channel, G_PRIORITY_DEFAULT, cond,
+	                          test_xfer_io_invoke, closure, g_free);
+	g_io_channel_unref(channel);
+
+	return ret;
+}
+
+static PurpleEventLoopUiOps test_eventloop_ops = {
+	g_timeout_add,
+	g_source_remove,
+	test_xfer_input_add,
+	g_source_remove,
+	NULL,
+	g_timeout_add_seconds,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+/* Transfers need the core running, for their signals and for the
+ * conversations they write to. */
+typedef struct {
+	gchar *dir;
+	PurpleAccount *account;
+} TestXfer;
+
+static void
+test_xfer_setup(TestXfer *test, gconstpointer data) {
+	test->dir = g_dir_make_tmp("purple-xfer-XXXXXX", NULL);
+	g_assert_nonnull(test->dir);
+	purple_util_set_user_dir(test->dir);
+
+	purple_eventloop_set_ui_ops(&test_eventloop_ops);
+	g_assert_true(purple_core_init(TEST_XFER_UI));
+
+	test->account = purple_account_new("test", "prpl-test");
+}
+
+static void
+test_xfer_remove_dir(const gchar *path) {
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const gchar *name;
+
+	while (dir && (name = g_dir_read_name(dir)) != NULL) {
+		gchar *child = g_build_filename(path, name, NULL);
+
+		if (g_file_test(child, G_FILE_TEST_IS_DIR))
+			test_xfer_remove_dir(child);
+		else
+			g_unlink(child);
+		g_free(child);
+	}
+
+	if (dir)
+		g_dir_close(dir);
+	g_rmdir(path);
+}
+
+static void
+test_xfer_teardown(TestXfer *test, gconstpointer data) {
+	g_object_unref(test->account);
+	purple_core_quit();
+
+	test_xfer_remove_dir(test->dir);
+	g_free(test->dir);
+}
+
+/* Creates a transfer of a file of size bytes, which the protocol moves
+ * itself rather than through a file descriptor. */
+static PurpleXfer *
+test_xfer_new(TestXfer *test, PurpleXferType type, const gchar *filename,
+              goffset size)
+{
+	PurpleXfer *xfer;
+
+	xfer = g_object_new(PURPLE_TYPE_XFER,
+	                    "account", test->account,
+	                    "type", type,
+	                    "remote-user", "peer",
+	                    NULL);
+	purple_xfer_set_local_filename(xfer, filename);
+	purple_xfer_set_size(xfer, size);
+
+	return xfer;
+}
+
+static guchar *
+test_xfer_make_data(gsize size) {
+	guchar *data = g_malloc(size);
+	gsize i;
+
+	for (i = 0; i < size; i++)
+		data[i] = i * 7 + (i >> 12);
+
+	return data;
+}
+
+static void
+test_xfer_assert_file(const gchar *filename, const guchar *data, gsize size) {
+	gchar *contents;
+	gsize len;
+
+	g_assert_true(g_file_get_contents(filename, &contents, &len, NULL));
+	g_assert_cmpuint(len, ==, size);
+	g_assert_true(memcmp(contents, data, size) == 0);
+	g_free(contents);
+}
+
+/* Counts the transfers that found they couldn't be zero-copy */
+static guint test_xfer_fallbacks = 0;
+
+static void
+test_xfer_debug_print(PurpleDebugLevel level, const char *category,
+                      const char *arg_s)
+{
+	if (g_strcmp0(category, "xfer") == 0 &&
+	    g_str_has_prefix(arg_s, "Zero-copy transfer not possible"))
+		test_xfer_fallbacks++;
+}
+
+static PurpleDebugUiOps test_debug_ops = {
+	test_xfer_debug_print,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+/* Connects two loopback sockets, the first of them non-blocking for the
+ * transfer to use. */
+static void
+test_xfer_socket_pair(int fds[2]) {
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	int listener;
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	g_assert_cmpint(listener, >=, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	g_assert_cmpint(bind(listener, (struct sockaddr *)&addr, sizeof(addr)), ==, 0);
+	g_assert_cmpint(listen(listener, 1), ==, 0);
+	g_assert_cmpint(getsockname(listener, (struct sockaddr *)&addr, &addr_len), ==, 0);
+
+	fds[1] = socket(AF_INET, SOCK_STREAM, 0);
+	g_assert_cmpint(connect(fds[1], (struct sockaddr *)&addr, sizeof(addr)), ==, 0);
+	fds[0] = accept(listener, NULL, NULL);
+	g_assert_cmpint(fds[0], >=, 0);
+	close(listener);
+
+	g_assert_cmpint(fcntl(fds[0], F_SETFL,
+	                      fcntl(fds[0], F_GETFL) | O_NONBLOCK), ==, 0);
+}
+
+/* Neither sendfile() nor splice() will write to a file opened for
+ * appending, which is how the tests make them fail with EINVAL. */
+static void
+test_xfer_set_append(int fd) {
+	g_assert_cmpint(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_APPEND), ==, 0);
+}
+
+/* Finds the descriptor the transfer opened its file with. */
+static int
+test_xfer_find_file_fd(const gchar *filename) {
+	GStatBuf file_st;
+	struct stat fd_st;
+	int fd;
+
+	g_assert_cmpint(g_stat(filename, &file_st), ==, 0);
+
+	for (fd = 3; fd < 1024; fd++) {
+		if (fstat(fd, &fd_st) == 0 && fd_st.st_dev == file_st.st_dev &&
+		    fd_st.st_ino == file_st.st_ino)
+			return fd;
+	}
+
+	g_assert_not_reached();
+	return -1;
+}
+
+/* Reads whatever is waiting on a non-blocking socket.  Returns FALSE once
+ * the other end has closed it. */
+static gboolean
+test_xfer_read_available(int fd, GByteArray *received) {
+	guchar buffer[65536];
+	gssize r;
+
+	while ((r = read(fd, buffer, sizeof(buffer))) > 0)
+		g_byte_array_append(received, buffer, r);
+
+	if (r < 0)
+		g_assert_true(errno == EAGAIN || errno == EINTR);
+
+	return r != 0;
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_xfer_chunk_map_claim(void) {
+	PurpleXferChunkMap *map;
+	goffset offset;
+	gsize size;
+	gint i;
+
+	map = purple_xfer_chunk_map_new(10 * TEST_XFER_CHUNK_SIZE + 100,
+	                                TEST_XFER_CHUNK_SIZE);
+
+	for (i = 0; i < 10; i++) {
+		g_assert_true(purple_xfer_chunk_map_claim(map, &offset, &size));
+		g_assert_cmpint(offset, ==, i * TEST_XFER_CHUNK_SIZE);
+		g_assert_cmpuint(size, ==, TEST_XFER_CHUNK_SIZE);
+	}
+
+	/* the last chunk is whatever is left of the file */
+	g_assert_true(purple_xfer_chunk_map_claim(map, &offset, &size));
+	g_assert_cmpint(offset, ==, 10 * TEST_XFER_CHUNK_SIZE);
+	g_assert_cmpuint(size, ==, 100);
+	g_assert_false(purple_xfer_chunk_map_claim(map, NULL, NULL));
+
+	/* a chunk that's given back is handed out again */
+	purple_xfer_chunk_map_release(map, 3 * TEST_XFER_CHUNK_SIZE);
+	g_assert_true(purple_xfer_chunk_map_claim(map, &offset, &size));
+	g_assert_cmpint(offset, ==, 3 * TEST_XFER_CHUNK_SIZE);
+	g_assert_false(purple_xfer_chunk_map_claim(map, NULL, NULL));
+
+	purple_xfer_chunk_map_free(map);
+}
+
+static void
+test_xfer_chunk_map_mark(void) {
+	PurpleXferChunkMap *map;
+	goffset offset;
+
+	map = purple_xfer_chunk_map_new(4 * TEST_XFER_CHUNK_SIZE,
+	                                TEST_XFER_CHUNK_SIZE);
+
+	/* a range across a chunk boundary only completes the first chunk */
+	g_assert_true(purple_xfer_chunk_map_mark(map, 0, TEST_XFER_CHUNK_SIZE + 10));
+	g_assert_cmpint(purple_xfer_chunk_map_get_completed_size(map), ==,
+	                TEST_XFER_CHUNK_SIZE);
+
+	/* the rest of the second chunk comes in pieces */
+	g_assert_false(purple_xfer_chunk_map_mark(map, TEST_XFER_CHUNK_SIZE + 10,
+	                                          100));
+	g_assert_true(purple_xfer_chunk_map_mark(map, TEST_XFER_CHUNK_SIZE + 110,
+	                                         TEST_XFER_CHUNK_SIZE - 110));
+	g_assert_cmpint(purple_xfer_chunk_map_get_completed_size(map), ==,
+	                2 * TEST_XFER_CHUNK_SIZE);
+
+	/* completed chunks aren't handed out */
+	g_assert_true(purple_xfer_chunk_map_claim(map, &offset, NULL));
+	g_assert_cmpint(offset, ==, 2 * TEST_XFER_CHUNK_SIZE);
+
+	/* giving back a partly transferred chunk throws away its progress */
+	g_assert_false(purple_xfer_chunk_map_mark(map, offset, 10));
+	purple_xfer_chunk_map_release(map, offset);
+	g_assert_true(purple_xfer_chunk_map_claim(map, &offset, NULL));
+	g_assert_cmpint(offset, ==, 2 * TEST_XFER_CHUNK_SIZE);
+	g_assert_false(purple_xfer_chunk_map_mark(map, offset,
+	                                          TEST_XFER_CHUNK_SIZE - 1));
+
+	g_assert_false(purple_xfer_chunk_map_is_complete(map));
+	g_assert_true(purple_xfer_chunk_map_mark(map, 3 * TEST_XFER_CHUNK_SIZE - 1,
+	                                         TEST_XFER_CHUNK_SIZE + 1));
+	g_assert_true(purple_xfer_chunk_map_is_complete(map));
+	g_assert_false(purple_xfer_chunk_map_claim(map, NULL, NULL));
+
+	purple_xfer_chunk_map_free(map);
+}
+
+static void
+test_xfer_chunk_map_save_load(void) {
+	PurpleXferChunkMap *map;
+	gchar *dir, *filename;
+	goffset offset;
+	goffset expected[] = { 1, 2, 3, 4, 6, 7, 8, 9 };
+	guint i;
+
+	dir = g_dir_make_tmp("purple-xfer-XXXXXX", NULL);
+	g_assert_nonnull(dir);
+	filename = g_build_filename(dir, "chunks", NULL);
+
+	map = purple_xfer_chunk_map_new(10 * TEST_XFER_CHUNK_SIZE + 100,
+	                                TEST_XFER_CHUNK_SIZE);
+	purple_xfer_chunk_map_mark(map, 0, TEST_XFER_CHUNK_SIZE);
+	purple_xfer_chunk_map_mark(map, 5 * TEST_XFER_CHUNK_SIZE,
+	                           TEST_XFER_CHUNK_SIZE);
+	purple_xfer_chunk_map_mark(map, 10 * TEST_XFER_CHUNK_SIZE, 100);
+	purple_xfer_chunk_map_mark(map, 7 * TEST_XFER_CHUNK_SIZE, 10);
+	g_assert_true(purple_xfer_chunk_map_save(map, filename));
+	purple_xfer_chunk_map_free(map);
+
+	map = purple_xfer_chunk_map_load(filename,
+	                                 10 * TEST_XFER_CHUNK_SIZE + 100,
+	                                 TEST_XFER_CHUNK_SIZE);
+	g_assert_nonnull(map);
+	g_assert_cmpint(purple_xfer_chunk_map_get_completed_size(map), ==,
+	                2 * TEST_XFER_CHUNK_SIZE + 100);
+
+	/* only the chunks that weren't completed are left, including the one
+	 * that was partly done */
+	for (i = 0; i < G_N_ELEMENTS(expected); i++) {
+		g_assert_true(purple_xfer_chunk_map_claim(map, &offset, NULL));
+		g_assert_cmpint(offset, ==, expected[i] * TEST_XFER_CHUNK_SIZE);
+	}
+	g_assert_false(purple_xfer_chunk_map_claim(map, NULL, NULL));
+	purple_xfer_chunk_map_free(map);
+
+	/* a map saved for a different file isn't used */
+	g_assert_null(purple_xfer_chunk_map_load(filename,
+	                                         10 * TEST_XFER_CHUNK_SIZE,
+	                                         TEST_XFER_CHUNK_SIZE));
+	g_assert_null(purple_xfer_chunk_map_load(filename,
+	                                         10 * TEST_XFER_CHUNK_SIZE + 100,
+	                                         2 * TEST_XFER_CHUNK_SIZE));
+
+	g_unlink(filename);
+	g_rmdir(dir);
+	g_free(filename);
+	g_free(dir);
+}
+
+static void
+test_xfer_chunked_receive(TestXfer *test, gconstpointer data) {
+	PurpleXfer *xfer;
+	gchar *filename, *map_filename;
+	guchar *source;
+	gsize size = 4 * TEST_XFER_CHUNK_SIZE + 100;
+
+	source = test_xfer_make_data(size);
+	filename = g_build_filename(test->dir, "received", NULL);
+	map_filename = g_strconcat(filename, ".chunks", NULL);
+
+	xfer = test_xfer_new(test, PURPLE_XFER_TYPE_RECEIVE, filename, size);
+	g_assert_false(purple_xfer_set_chunk_size(xfer, TEST_XFER_CHUNK_SIZE));
+	g_assert_nonnull(purple_xfer_get_chunk_map(xfer));
+	purple_xfer_start(xfer, -1, NULL, 0);
+
+	/* the streams can finish their chunks in any order */
+	g_assert_true(purple_xfer_write_file_at(xfer, 4 * TEST_XFER_CHUNK_SIZE,
+	                                        source + 4 * TEST_XFER_CHUNK_SIZE,
+	                                        100));
+	g_assert_true(purple_xfer_write_file_at(xfer, TEST_XFER_CHUNK_SIZE,
+	                                        source + TEST_XFER_CHUNK_SIZE,
+	                                        3 * TEST_XFER_CHUNK_SIZE));
+	g_assert_cmpint(purple_xfer_get_bytes_sent(xfer), ==,
+	                3 * TEST_XFER_CHUNK_SIZE + 100);
+	g_assert_false(purple_xfer_is_completed(xfer));
+
+	g_assert_true(purple_xfer_write_file_at(xfer, 0, source,
+	                                        TEST_XFER_CHUNK_SIZE));
+	g_assert_true(purple_xfer_is_completed(xfer));
+	g_assert_false(g_file_test(map_filename, G_FILE_TEST_EXISTS));
+	purple_xfer_end(xfer);
+
+	test_xfer_assert_file(filename, source, size);
+
+	g_unlink(filename);
+	g_free(map_filename);
+	g_free(filename);
+	g_free(source);
+}
+
+static void
+test_xfer_chunked_resume(TestXfer *test, gconstpointer data) {
+	PurpleXfer *xfer;
+	PurpleXferChunkMap *map;
+	gchar *filename, *map_filename;
+	guchar *source;
+	goffset offset;
+	gsize size = 4 * TEST_XFER_CHUNK_SIZE, chunk_size;
+
+	source = test_xfer_make_data(size);
+	filename = g_build_filename(test->dir, "received", NULL);
+	map_filename = g_strconcat(filename, ".chunks", NULL);
+
+	/* the first attempt gets the first and third chunks, and part of the
+	 * fourth, before it is cancelled */
+	xfer = test_xfer_new(test, PURPLE_XFER_TYPE_RECEIVE, filename, size);
+	g_assert_false(purple_xfer_set_chunk_size(xfer, TEST_XFER_CHUNK_SIZE));
+	purple_xfer_start(xfer, -1, NULL, 0);
+	g_assert_true(purple_xfer_write_file_at(xfer, 0, source,
+	                                        TEST_XFER_CHUNK_SIZE));
+	g_assert_true(purple_xfer_write_file_at(xfer, 2 * TEST_XFER_CHUNK_SIZE,
+	                                        source + 2 * TEST_XFER_CHUNK_SIZE,
+	                                        TEST_XFER_CHUNK_SIZE));
+	g_assert_true(purple_xfer_write_file_at(xfer, 3 * TEST_XFER_CHUNK_SIZE,
+	                                        source + 3 * TEST_XFER_CHUNK_SIZE,
+	                                        10));
+	purple_xfer_cancel_local(xfer);
+	g_assert_true(g_file_test(map_filename, G_FILE_TEST_IS_REGULAR));
+
+	/* the second attempt picks up the chunks that were completed, and
+	 * reopens the file without truncating it */
+	xfer = test_xfer_new(test, PURPLE_XFER_TYPE_RECEIVE, filename, size);
+	g_assert_true(purple_xfer_set_chunk_size(xfer, TEST_XFER_CHUNK_SIZE));
+	g_assert_cmpint(purple_xfer_get_bytes_sent(xfer), ==,
+	                2 * TEST_XFER_CHUNK_SIZE);
+	purple_xfer_start(xfer, -1, NULL, 0);
+
+	map = purple_xfer_get_chunk_map(xfer);
+	while (purple_xfer_chunk_map_claim(map, &offset, &chunk_size)) {
+		g_assert_true(offset == TEST_XFER_CHUNK_SIZE ||
+		              offset == 3 * TEST_XFER_CHUNK_SIZE);
+		g_assert_true(purple_xfer_write_file_at(xfer, offset,
+		                                        source + offset,
+		                                        chunk_size));
+	}
+	g_assert_true(purple_xfer_is_completed(xfer));
+	g_assert_false(g_file_test(map_filename, G_FILE_TEST_EXISTS));
+	purple_xfer_end(xfer);
+
+	test_xfer_assert_file(filename, source, size);
+
+	g_unlink(filename);
+	g_free(map_filename);
+	g_free(filename);
+	g_free(source);
+}
+
+static void
+test_xfer_chunked_send(TestXfer *test, gconstpointer data) {
+	PurpleXfer *xfer;
+	PurpleXferChunkMap *map;
+	gchar *filename;
+	guchar *source, *buffer;
+	goffset offset;
+	gsize size = 2 * TEST_XFER_CHUNK_SIZE + 100, chunk_size;
+
+	source = test_xfer_make_data(size);
+	buffer = g_malloc(TEST_XFER_CHUNK_SIZE);
+	filename = g_build_filename(test->dir, "sent", NULL);
+	g_assert_true(g_file_set_contents(filename, (gchar *)source, size, NULL));
+
+	xfer = test_xfer_new(test, PURPLE_XFER_TYPE_SEND, filename, size);
+	g_assert_false(purple_xfer_set_chunk_size(xfer, TEST_XFER_CHUNK_SIZE));
+	purple_xfer_start(xfer, -1, NULL, 0);
+	map = purple_xfer_get_chunk_map(xfer);
+
+	/* reading a chunk doesn't count it as sent */
+	g_assert_true(purple_xfer_chunk_map_claim(map, &offset, &chunk_size));
+	g_assert_cmpint(purple_xfer_read_file_at(xfer, offset, buffer, chunk_size),
+	                ==, TEST_XFER_CHUNK_SIZE);
+	g_assert_true(memcmp(buffer, source, TEST_XFER_CHUNK_SIZE) == 0);
+	g_assert_cmpint(purple_xfer_get_bytes_sent(xfer), ==, 0);
+
+	/* so a stream that fails to send it can give it back */
+	purple_xfer_chunk_map_release(map, offset);
+	g_assert_true(purple_xfer_chunk_map_claim(map, &offset, NULL));
+	g_assert_cmpint(offset, ==, 0);
+	purple_xfer_chunk_map_release(map, offset);
+
+	while (purple_xfer_chunk_map_claim(map, &offset, &chunk_size)) {
+		gssize r = purple_xfer_read_file_at(xfer, offset, buffer, chunk_size);
+
+		g_assert_cmpint(r, ==, chunk_size);
+		g_assert_true(memcmp(buffer, source + offset, r) == 0);
+		purple_xfer_chunk_sent(xfer, offset, r);
+		g_assert_cmpint(purple_xfer_get_bytes_sent(xfer), ==, offset + r);
+	}
+	g_assert_true(purple_xfer_is_completed(xfer));
+	purple_xfer_end(xfer);
+
+	g_unlink(filename);
+	g_free(filename);
+	g_free(buffer);
+	g_free(source);
+}
+
+static void
+test_xfer_zero_copy_send(TestXfer *test, gconstpointer data) {
+	TestXferFallback fallback = GPOINTER_TO_INT(data);
+	PurpleXfer *xfer;
+	GByteArray *received;
+	gchar *filename;
+	guchar *source;
+	gboolean switched = FALSE;
+	int fds[2];
+
+	source = test_xfer_make_data(TEST_XFER_STREAM_SIZE);
+	filename = g_build_filename(test->dir, "sent", NULL);
+	g_assert_true(g_file_set_contents(filename, (gchar *)source,
+	                                  TEST_XFER_STREAM_SIZE, NULL));
+
+	test_xfer_socket_pair(fds);
+	g_assert_cmpint(fcntl(fds[1], F_SETFL,
+	                      fcntl(fds[1], F_GETFL) | O_NONBLOCK), ==, 0);
+	if (fallback == TEST_XFER_FALLBACK_START)
+		test_xfer_set_append(fds[0]);
+
+	test_xfer_fallbacks = 0;
+	purple_debug_set_ui_ops(&test_debug_ops);
+
+	/* purple_xfer_end() drops the transfer's own reference */
+	xfer = test_xfer_new(test, PURPLE_XFER_TYPE_SEND, filename,
+	                     TEST_XFER_STREAM_SIZE);
+	g_object_ref(xfer);
+	purple_xfer_start(xfer, fds[0], NULL, 0);
+
+	received = g_byte_array_new();
+	while (!purple_xfer_is_completed(xfer)) {
+		/* the stream is put back where sendfile() got to */
+		if (fallback == TEST_XFER_FALLBACK_MIDWAY && !switched &&
+		    purple_xfer_get_bytes_sent(xfer) >= TEST_XFER_STREAM_SIZE / 4) {
+			test_xfer_set_append(fds[0]);
+			switched = TRUE;
+		}
+
+		g_main_context_iteration(NULL, FALSE);
+		test_xfer_read_available(fds[1], received);
+	}
+	g_assert_true(switched || fallback != TEST_XFER_FALLBACK_MIDWAY);
+
+	/* the transfer closed its end when it finished */
+	while (test_xfer_read_available(fds[1], received))
+		g_usleep(1000);
+	close(fds[1]);
+
+	g_assert_cmpuint(received->len, ==, TEST_XFER_STREAM_SIZE);
+	g_assert_true(memcmp(received->data, source, TEST_XFER_STREAM_SIZE) == 0);
+	g_assert_cmpuint(test_xfer_fallbacks, ==,
+	                 (fallback != TEST_XFER_FALLBACK_NONE &&
+	                  TEST_XFER_HAVE_SENDFILE) ? 1 : 0);
+
+	purple_debug_set_ui_ops(NULL);
+	g_object_unref(xfer);
+	g_byte_array_free(received, TRUE);
+	g_unlink(filename);
+	g_free(filename);
+	g_free(source);
+}
+
+static void
+test_xfer_zero_copy_receive(TestXfer *test, gconstpointer data) {
+	TestXferFallback fallback = GPOINTER_TO_INT(data);
+	PurpleXfer *xfer;
+	gchar *filename;
+	guchar *source;
+	gsize offset = 0;
+	gboolean switched = FALSE;
+	int fds[2];
+
+	source = test_xfer_make_data(TEST_XFER_STREAM_SIZE);
+	filename = g_build_filename(test->dir, "received", NULL);
+
+	test_xfer_socket_pair(fds);
+	g_assert_cmpint(fcntl(fds[1], F_SETFL,
+	                      fcntl(fds[1], F_GETFL) | O_NONBLOCK), ==, 0);
+
+	test_xfer_fallbacks = 0;
+	purple_debug_set_ui_ops(&test_debug_ops);
+
+	xfer = test_xfer_new(test, PURPLE_XFER_TYPE_RECEIVE, filename,
+	                     TEST_XFER_STREAM_SIZE);
+	g_object_ref(xfer);
+	purple_xfer_start(xfer, fds[0], NULL, 0);
+
+	/* the data is already in the pipe when the file won't take it, so
+	 * it has to be drained into the file by hand */
+	if (fallback == TEST_XFER_FALLBACK_START) {
+		test_xfer_set_append(test_xfer_find_file_fd(filename));
+		switched = TRUE;
+	}
+
+	while (!purple_xfer_is_completed(xfer)) {
+		gssize w;
+
+		if (fallback == TEST_XFER_FALLBACK_MIDWAY && !switched &&
+		    purple_xfer_get_bytes_sent(xfer) >= TEST_XFER_STREAM_SIZE / 4) {
+			test_xfer_set_append(test_xfer_find_file_fd(filename));
+			switched = TRUE;
+		}
+
+		if (offset < TEST_XFER_STREAM_SIZE) {
+			w = write(fds[1], source + offset,
+			          MIN(TEST_XFER_STREAM_SIZE - offset, 32 * 1024));
+			if (w < 0)
+				g_assert_true(errno == EAGAIN || errno == EINTR);
+			else
+				offset += w;
+		}
+
+		g_main_context_iteration(NULL, FALSE);
+	}
+	g_assert_true(switched || fallback == TEST_XFER_FALLBACK_NONE);
+	close(fds[1]);
+
+	test_xfer_assert_file(filename, source, TEST_XFER_STREAM_SIZE);
+	g_assert_cmpuint(test_xfer_fallbacks, ==,
+	                 (fallback != TEST_XFER_FALLBACK_NONE &&
+	                  TEST_XFER_HAVE_SPLICE) ? 1 : 0);
+
+	purple_debug_set_ui_ops(NULL);
+	g_object_unref(xfer);
+	g_unlink(filename);
+	g_free(filename);
+	g_free(source);
+}
+
+/* Takes at most 1000 bytes at a time, and nothing every third time. */
+static gssize
+test_xfer_partial_write(const guchar *buffer, size_t size, PurpleXfer *xfer)
+{
+	GByteArray *written = purple_xfer_get_protocol_data(xfer);
+	static guint calls = 0;
+
+	if (++calls % 3 == 0)
+		return 0;
+
+	size = MIN(size, 1000);
+	g_byte_array_append(written, buffer, size);
+
+	return size;
+}
+
+static void
+test_xfer_partial_writes(TestXfer *test, gconstpointer data) {
+	PurpleXfer *xfer;
+	GByteArray *written;
+	gchar *filename;
+	guchar *source;
+	gsize size = 64 * 1024 + 123;
+	int fds[2];
+
+	source = test_xfer_make_data(size);
+	filename = g_build_filename(test->dir, "sent", NULL);
+	g_assert_true(g_file_set_contents(filename, (gchar *)source, size, NULL));
+
+	/* the socket is only there to say when to write */
+	test_xfer_socket_pair(fds);
+
+	written = g_byte_array_new();
+	xfer = test_xfer_new(test, PURPLE_XFER_TYPE_SEND, filename, size);
+	purple_xfer_set_protocol_data(xfer, written);
+	purple_xfer_set_write_fnc(xfer, test_xfer_partial_write);
+	g_object_ref(xfer);
+	purple_xfer_start(xfer, fds[0], NULL, 0);
+
+	/* the file is all read before the last of it is written, but the
+	 * transfer isn't done until that has been written too */
+	while (!purple_xfer_is_completed(xfer))
+		g_main_context_iteration(NULL, TRUE);
+
+	g_assert_cmpuint(written->len, ==, size);
+	g_assert_true(memcmp(written->data, source, size) == 0);
+	g_assert_cmpint(purple_xfer_get_bytes_sent(xfer), ==, size);
+
+	close(fds[1]);
+	g_object_unref(xfer);
+	g_byte_array_free(written, TRUE);
+	g_unlink(filename);
+	g_free(filename);
+	g_free(source);
+}
+
+/******************************************************************************
+ * Benchmarks
+ *****************************************************************************/
+typedef struct {
+	PurpleXferChunkMap *map;
+	GMutex lock;
+	const guchar *data;
+} TestXferSender;
+
+typedef struct {
+	TestXferSender *sender;
+	int send_fd;
+	int recv_fd;
+
+	/* what the receiving end is in the middle of */
+	guint64 header[2];
+	gsize header_len;
+	goffset offset;
+	gsize remaining;
+} TestXferStream;
+
+static void
+test_xfer_write_all(int fd, gconstpointer data, gsize size) {
+	const guchar *p = data;
+
+	while (size > 0) {
+		gssize w = write(fd, p, size);
+
+		if (w < 0 && errno == EINTR)
+			continue;
+
+		g_assert_cmpint(w, >, 0);
+		p += w;
+		size -= w;
+	}
+}
+
+static gpointer
+test_xfer_perf_send(gpointer data) {
+	TestXferStream *stream = data;
+	TestXferSender *sender = stream->sender;
+	guint64 header[2];
+	goffset offset;
+	gsize size;
+
+	for (;;) {
+		gboolean claimed;
+
+		g_mutex_lock(&sender->lock);
+		claimed = purple_xfer_chunk_map_claim(sender->map, &offset, &size);
+		g_mutex_unlock(&sender->lock);
+
+		if (!claimed)
+			break;
+
+		/* every chunk waits a round trip for the peer to ask for it */
+		g_usleep(TEST_XFER_PERF_LATENCY);
+
+		header[0] = offset;
+		header[1] = size;
+		test_xfer_write_all(stream->send_fd, header, sizeof(header));
+		test_xfer_write_all(stream->send_fd, sender->data + offset, size);
+	}
+
+	return NULL;
+}
+
+/* Moves whatever is waiting on a stream into the file. */
+static void
+test_xfer_perf_recv(TestXferStream *stream, PurpleXfer *xfer, guchar *buffer)
+{
+	gssize r;
+
+	if (stream->remaining == 0) {
+		r = read(stream->recv_fd, (guchar *)stream->header + stream->header_len,
+		         sizeof(stream->header) - stream->header_len);
+		g_assert_cmpint(r, >, 0);
+
+		stream->header_len += r;
+		if (stream->header_len == sizeof(stream->header)) {
+			stream->offset = stream->header[0];
+			stream->remaining = stream->header[1];
+			stream->header_len = 0;
+		}
+		return;
+	}
+
+	r = read(stream->recv_fd, buffer, MIN(stream->remaining, 65536));
+	g_assert_cmpint(r, >, 0);
+	g_assert_true(purple_xfer_write_file_at(xfer, stream->offset, buffer, r));
+
+	stream->offset += r;
+	stream->remaining -= r;
+}
+
+static void
+test_xfer_perf_streams(TestXfer *test, gconstpointer data) {
+	guint n_streams = GPOINTER_TO_UINT(data);
+	TestXferSender sender;
+	TestXferStream streams[TEST_XFER_PERF_MAX_STREAMS];
+	GThread *threads[TEST_XFER_PERF_MAX_STREAMS];
+	struct pollfd fds[TEST_XFER_PERF_MAX_STREAMS];
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	PurpleXfer *xfer;
+	guchar *source, *buffer;
+	gchar *filename;
+	int listener;
+	gdouble elapsed;
+	guint i;
+
+	source = test_xfer_make_data(TEST_XFER_PERF_SIZE);
+	buffer = g_malloc(65536);
+	filename = g_build_filename(test->dir, "received", NULL);
+
+	/* one loopback connection per stream */
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	g_assert_cmpint(listener, >=, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	g_assert_cmpint(bind(listener, (struct sockaddr *)&addr, sizeof(addr)), ==, 0);
+	g_assert_cmpint(listen(listener, n_streams), ==, 0);
+	g_assert_cmpint(getsockname(listener, (struct sockaddr *)&addr, &addr_len), ==, 0);
+
+	/* the peer sending the file only needs to hand out the chunks */
+	sender.map = purple_xfer_chunk_map_new(TEST_XFER_PERF_SIZE,
+	                                       TEST_XFER_PERF_CHUNK_SIZE);
+	sender.data = source;
+	g_mutex_init(&sender.lock);
+
+	xfer = test_xfer_new(test, PURPLE_XFER_TYPE_RECEIVE, filename,
+	                     TEST_XFER_PERF_SIZE);
+	g_assert_false(purple_xfer_set_chunk_size(xfer, TEST_XFER_PERF_CHUNK_SIZE));
+	purple_xfer_start(xfer, -1, NULL, 0);
+
+	for (i = 0; i < n_streams; i++) {
+		memset(&streams[i], 0, sizeof(TestXferStream));
+		streams[i].sender = &sender;
+		streams[i].send_fd = socket(AF_INET, SOCK_STREAM, 0);
+		g_assert_cmpint(connect(streams[i].send_fd, (struct sockaddr *)&addr,
+		                        sizeof(addr)), ==, 0);
+
+		streams[i].recv_fd = accept(listener, NULL, NULL);
+		g_assert_cmpint(streams[i].recv_fd, >=, 0);
+		fds[i].fd = streams[i].recv_fd;
+		fds[i].events = POLLIN;
+	}
+
+	g_test_timer_start();
+
+	for (i = 0; i < n_streams; i++)
+		threads[i] = g_thread_new("sender", test_xfer_perf_send, &streams[i]);
+
+	while (!purple_xfer_is_completed(xfer)) {
+		g_assert_cmpint(poll(fds, n_streams, -1), >, 0);
+
+		for (i = 0; i < n_streams; i++) {
+			if (fds[i].revents & POLLIN)
+				test_xfer_perf_recv(&streams[i], xfer, buffer);
+		}
+	}
+
+	elapsed = g_test_timer_elapsed();
+
+	purple_xfer_end(xfer);
+
+	for (i = 0; i < n_streams; i++) {
+		g_thread_join(threads[i]);
+		close(streams[i].send_fd);
+		close(streams[i].recv_fd);
+	}
+
+	g_test_maximized_result(TEST_XFER_PERF_SIZE / elapsed / (1024 * 1024),
+	                        "%u streams, %dms latency: %.1f MiB/s", n_streams,
+	                        TEST_XFER_PERF_LATENCY / 1000,
+	                        TEST_XFER_PERF_SIZE / elapsed / (1024 * 1024));
+
+	/* and the file came out the same, whichever stream each chunk took */
+	test_xfer_assert_file(filename, source, TEST_XFER_PERF_SIZE);
+
+	close(listener);
+	g_unlink(filename);
+	g_mutex_clear(&sender.lock);
+	purple_xfer_chunk_map_free(sender.map);
+	g_free(filename);
+	g_free(buffer);
+	g_free(source);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/xfer/chunk map/claim",
+	                test_xfer_chunk_map_claim);
+	g_test_add_func("/xfer/chunk map/mark",
+	                test_xfer_chunk_map_mark);
+	g_test_add_func("/xfer/chunk map/save load",
+	                test_xfer_chunk_map_save_load);
+
+	g_test_add("/xfer/chunked/receive", TestXfer, NULL,
+	           test_xfer_setup, test_xfer_chunked_receive, test_xfer_teardown);
+	g_test_add("/xfer/chunked/resume", TestXfer, NULL,
+	           test_xfer_setup, test_xfer_chunked_resume, test_xfer_teardown);
+	g_test_add("/xfer/chunked/send", TestXfer, NULL,
+	           test_xfer_setup, test_xfer_chunked_send, test_xfer_teardown);
+
+	g_test_add("/xfer/zero copy/send", TestXfer,
+	           GINT_TO_POINTER(TEST_XFER_FALLBACK_NONE),
+	           test_xfer_setup, test_xfer_zero_copy_send, test_xfer_teardown);
+	g_test_add("/xfer/zero copy/send fallback", TestXfer,
+	           GINT_TO_POINTER(TEST_XFER_FALLBACK_START),
+	           test_xfer_setup, test_xfer_zero_copy_send, test_xfer_teardown);
+	g_test_add("/xfer/zero copy/send fallback midway", TestXfer,
+	           GINT_TO_POINTER(TEST_XFER_FALLBACK_MIDWAY),
+	           test_xfer_setup, test_xfer_zero_copy_send, test_xfer_teardown);
+	g_test_add("/xfer/zero copy/receive", TestXfer,
+	           GINT_TO_POINTER(TEST_XFER_FALLBACK_NONE),
+	           test_xfer_setup, test_xfer_zero_copy_receive,
+	           test_xfer_teardown);
+	g_test_add("/xfer/zero copy/receive fallback", TestXfer,
+	           GINT_TO_POINTER(TEST_XFER_FALLBACK_START),
+	           test_xfer_setup, test_xfer_zero_copy_receive,
+	           test_xfer_teardown);
+	g_test_add("/xfer/zero copy/receive fallback midway", TestXfer,
+	           GINT_TO_POINTER(TEST_XFER_FALLBACK_MIDWAY),
+	           test_xfer_setup, test_xfer_zero_copy_receive,
+	           test_xfer_teardown);
+
+	g_test_add("/xfer/send/partial writes", TestXfer, NULL,
+	           test_xfer_setup, test_xfer_partial_writes, test_xfer_teardown);
+
+	if (g_test_perf()) {
+		g_test_add("/xfer/perf/1 stream", TestXfer, GUINT_TO_POINTER(1),
+		           test_xfer_setup, test_xfer_perf_streams,
+		           test_xfer_teardown);
+		g_test_add("/xfer/perf/4 streams", TestXfer, GUINT_TO_POINTER(4),
+		           test_xfer_setup, test_xfer_perf_streams,
+		           test_xfer_teardown);
+	}
+
+	return g_test_run();
+}
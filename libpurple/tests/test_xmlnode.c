@@ -133,6 +133,51 @@ test_strip_prefixes(void) {
 	purple_xmlnode_free(xml);
 }
 
+static void
+test_xmlnode_pooled(void) {
+	const char *xml_doc =
+		"<iq type='get' xmlns='jabber:client' xmlns:ping='urn:xmpp:ping'>"
+			"<ping:ping>"
+				"<child1 attr='a &amp; b'>"
+					"<ping:child2>text</ping:child2>"
+				"</child1>"
+			"</ping:ping>"
+		"</iq>";
+	char *str, *pooled_str;
+	PurpleXmlNode *xml, *pooled, *copy;
+
+	xml = purple_xmlnode_from_str(xml_doc, -1);
+	g_assert_nonnull(xml);
+	pooled = purple_xmlnode_from_str_pooled(xml_doc, -1);
+	g_assert_nonnull(pooled);
+	g_assert_nonnull(pooled->pool);
+
+	/* modifying a pooled tree must keep it within the pool */
+	purple_xmlnode_set_attrib(pooled, "id", "purple");
+	purple_xmlnode_set_attrib(xml, "id", "purple");
+	g_assert_cmpstr("a & b", ==, purple_xmlnode_get_attrib(
+		purple_xmlnode_get_child(pooled, "ping/child1"), "attr"));
+
+	str = purple_xmlnode_to_str(xml, NULL);
+	pooled_str = purple_xmlnode_to_str(pooled, NULL);
+	g_assert_cmpstr(str, ==, pooled_str);
+	g_free(pooled_str);
+
+	/* copies are plain, heap-allocated trees */
+	copy = purple_xmlnode_copy(pooled);
+	g_assert_null(copy->pool);
+	check_doc_structure(pooled);
+	purple_xmlnode_free(pooled);
+
+	pooled_str = purple_xmlnode_to_str(copy, NULL);
+	g_assert_cmpstr(str, ==, pooled_str);
+	g_free(pooled_str);
+	g_free(str);
+
+	purple_xmlnode_free(copy);
+	purple_xmlnode_free(xml);
+}
+
 gint
 main(gint argc, gchar **argv) {
 	g_test_init(&argc, &argv, NULL);
@@ -143,6 +188,8 @@ main(gint argc, gchar **argv) {
 	                test_xmlnode_prefixes);
 	g_test_add_func("/xmlnode/strip_prefixes",
 	                test_strip_prefixes);
+	g_test_add_func("/xmlnode/pooled",
+	                test_xmlnode_pooled);
 
 	return g_test_run();
 }
@@ -3136,6 +3136,80 @@ purple_util_write_data_to_file_absolute(const char *filename_full, const char *d
 	return TRUE;
 }
 
+gboolean
+purple_util_append_data_to_file(const char *filename, const char *data, gssize size)
+{
+	const char *user_dir = purple_user_dir();
+	gchar *filename_full;
+	FILE *file;
+	gsize real_size, byteswritten;
+	gboolean ret = TRUE;
+
+	g_return_val_if_fail(user_dir != NULL, FALSE);
+	g_return_val_if_fail((size >= -1), FALSE);
+
+	if (!g_file_test(user_dir, G_FILE_TEST_IS_DIR))
+	{
+		if (g_mkdir(user_dir, S_IRUSR | S_IWUSR | S_IXUSR) == -1)
+		{
+			purple_debug_error("util", "Error creating directory %s: %s\n",
+							 user_dir, g_strerror(errno));
+			return FALSE;
+		}
+	}
+
+	filename_full = g_strdup_printf("%s" G_DIR_SEPARATOR_S "%s", user_dir, filename);
+
+	file = g_fopen(filename_full, "ab");
+	if (file == NULL)
+	{
+		purple_debug_error("util", "Error opening file %s for "
+				   "appending: %s\n",
+				   filename_full, g_strerror(errno));
+		g_free(filename_full);
+		return FALSE;
+	}
+
+	real_size = (size == -1) ? strlen(data) : (size_t) size;
+	byteswritten = fwrite(data, 1, real_size, file);
+
+	if (byteswritten != real_size)
+	{
+		purple_debug_error("util", "Error appending to file %s: Wrote %"
+				   G_GSIZE_FORMAT " bytes "
+				   "but should have written %" G_GSIZE_FORMAT
+				   "; is your disk full?\n",
+				   filename_full, byteswritten, real_size);
+		ret = FALSE;
+	}
+
+#ifdef HAVE_FILENO
+#ifndef _WIN32
+	if (fchmod(fileno(file), S_IRUSR | S_IWUSR) == -1) {
+		purple_debug_error("util", "Error setting permissions of "
+			"file %s: %s\n", filename_full, g_strerror(errno));
+	}
+#endif
+
+	if (fflush(file) < 0 || fsync(fileno(file)) < 0) {
+		purple_debug_error("util", "Error syncing file contents for %s: %s\n",
+				   filename_full, g_strerror(errno));
+		ret = FALSE;
+	}
+#endif
+
+	if (fclose(file) != 0)
+	{
+		purple_debug_error("util", "Error closing file %s: %s\n",
+				   filename_full, g_strerror(errno));
+		ret = FALSE;
+	}
+
+	g_free(filename_full);
+
+	return ret;
+}
+
 PurpleXmlNode *
 purple_util_read_xml_from_file(const char *filename, const char *description)
 {
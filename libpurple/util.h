@@ -847,6 +847,24 @@ gboolean purple_util_write_data_to_file(const char *filename, const char *data,
 gboolean
 purple_util_write_data_to_file_absolute(const char *filename_full, const char *data, gssize size);
 
+/**
+ * purple_util_append_data_to_file:
+ * @filename: The basename of the file to append to in the purple_user_dir.
+ * @data:     The data to append.
+ * @size:     The size of the data to append.  If data is
+ *                 null-terminated you can pass in -1.
+ *
+ * Appends data to a file of the given name in the Purple user directory,
+ * creating it if needed, and flushes it to the disk.  Unlike
+ * purple_util_write_data_to_file(), this doesn't rewrite the whole file, so
+ * it suits journals which are only ever added to.
+ *
+ * Returns: TRUE if all the data was written.  FALSE otherwise, in which case
+ *          some of it may still have made it to the file.
+ */
+gboolean purple_util_append_data_to_file(const char *filename,
+									   const char *data, gssize size);
+
 /**
  * purple_util_read_xml_from_file:
  * @filename:    The basename of the file to open in the purple_user_dir.
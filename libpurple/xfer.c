@@ -19,6 +19,11 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
  *
  */
+/* for splice() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "internal.h"
 #include "glibcompat.h"
 
@@ -34,8 +39,23 @@
 #include "util.h"
 #include "debug.h"
 
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
 #define FT_INITIAL_BUFFER_SIZE 4096
 #define FT_MAX_BUFFER_SIZE     65535
+/* Transfers straight over a socket aren't limited by any protocol framing */
+#define FT_MAX_FD_BUFFER_SIZE  (1024 * 1024)
+/* How many unused transfer buffers to keep around for the next transfer */
+#define FT_BUFFER_POOL_SIZE    4
+/* Save the chunk map of a chunked download every so many chunks */
+#define FT_CHUNK_MAP_SAVE_INTERVAL 16
+#define FT_CHUNK_MAP_HEADER    "purple-xfer-chunks 1 %" G_GOFFSET_FORMAT " %" G_GSIZE_FORMAT "\n"
+
+#define CHUNK_BIT_TEST(bits, i)  ((bits)[(i) / 8] & (1 << ((i) % 8)))
+#define CHUNK_BIT_SET(bits, i)   ((bits)[(i) / 8] |= (1 << ((i) % 8)))
+#define CHUNK_BIT_CLEAR(bits, i) ((bits)[(i) / 8] &= ~(1 << ((i) % 8)))
 
 #define PURPLE_XFER_GET_PRIVATE(obj) \
 	(G_TYPE_INSTANCE_GET_PRIVATE((obj), PURPLE_TYPE_XFER, PurpleXferPrivate))
@@ -45,6 +65,33 @@ typedef struct _PurpleXferPrivate  PurpleXferPrivate;
 static PurpleXferUiOps *xfer_ui_ops = NULL;
 static GList *xfers;
 
+typedef struct
+{
+	gsize size;
+	guchar *data;
+} PurpleXferBuffer;
+
+static GSList *buffer_pool = NULL;
+
+struct _PurpleXferChunkMap
+{
+	goffset size;                /* The size of the file.               */
+	gsize chunk_size;            /* The size of each chunk.             */
+	guint n_chunks;
+
+	guint8 *done;                /* A bit for each completed chunk.     */
+	guint8 *claimed;             /* A bit for each chunk a stream is
+	                                working on.                         */
+	GHashTable *progress;        /* Chunk -> bytes of it transferred,
+	                                for chunks that are partly done.    */
+	guint next;                  /* No chunk before this one is free.   */
+
+	guint n_done;
+	goffset done_size;           /* Bytes in the completed chunks.      */
+	goffset transferred;         /* Bytes transferred, completed chunks
+	                                and partly done ones.               */
+};
+
 /* Private data for a file transfer */
 struct _PurpleXferPrivate {
 	PurpleXferType type;         /* The type of transfer.               */
@@ -74,6 +121,17 @@ struct _PurpleXferPrivate {
 
 	size_t current_buffer_size;  /* This gradually increases for fast
 	                                 network connections.               */
+	PurpleXferBuffer *chunk;     /* Buffer the core reads chunks into.  */
+
+	gboolean zero_copy;          /* Data goes between the file and the
+	                                socket without passing through us.  */
+	int splice_pipe[2];          /* Pipe splice() moves received data
+	                                through on its way to the file.     */
+
+	PurpleXferChunkMap *chunks;  /* Set when the protocol moves the file
+	                                in chunks, over one or more streams. */
+	guint chunks_unsaved;        /* Chunks completed since the chunk map
+	                                was last saved.                     */
 
 	PurpleXferStatus status;     /* File Transfer's status.             */
 
@@ -1156,13 +1214,121 @@ purple_xfer_set_cancel_recv_fnc(PurpleXfer *xfer, void (*fnc)(PurpleXfer *))
 	priv->ops.cancel_recv = fnc;
 }
 
+/**************************************************************************
+ * Transfer buffers
+ **************************************************************************/
+static PurpleXferBuffer *
+xfer_buffer_new(gsize size)
+{
+	GSList *l;
+	PurpleXferBuffer *buf;
+
+	for (l = buffer_pool; l != NULL; l = l->next) {
+		buf = l->data;
+		if (buf->size >= size) {
+			buffer_pool = g_slist_delete_link(buffer_pool, l);
+			return buf;
+		}
+	}
+
+	buf = g_new(PurpleXferBuffer, 1);
+	buf->size = size;
+	buf->data = g_malloc(size);
+
+	return buf;
+}
+
+static void
+xfer_buffer_release(PurpleXferBuffer *buf)
+{
+	if (buf == NULL)
+		return;
+
+	if (g_slist_length(buffer_pool) < FT_BUFFER_POOL_SIZE) {
+		buffer_pool = g_slist_prepend(buffer_pool, buf);
+	} else {
+		g_free(buf->data);
+		g_free(buf);
+	}
+}
+
+/*
+ * Returns the transfer's buffer for reading a chunk of @size bytes into,
+ * trading it in for a bigger one as the transfer speeds up.
+ */
+static guchar *
+purple_xfer_get_chunk_buffer(PurpleXfer *xfer, gsize size)
+{
+	PurpleXferPrivate *priv = PURPLE_XFER_GET_PRIVATE(xfer);
+
+	if (priv->chunk == NULL || priv->chunk->size < size) {
+		xfer_buffer_release(priv->chunk);
+		priv->chunk = xfer_buffer_new(MAX(size, priv->current_buffer_size));
+	}
+
+	return priv->chunk->data;
+}
+
+/*
+ * Gives back the chunk buffer and closes the splice() pipe once the
+ * transfer is over, so a finished transfer that is kept around by the UI
+ * doesn't hold on to them.
+ */
+static void
+purple_xfer_release_buffers(PurpleXfer *xfer)
+{
+	PurpleXferPrivate *priv = PURPLE_XFER_GET_PRIVATE(xfer);
+
+	xfer_buffer_release(priv->chunk);
+	priv->chunk = NULL;
+
+	if (priv->splice_pipe[0] != -1) {
+		close(priv->splice_pipe[0]);
+		close(priv->splice_pipe[1]);
+		priv->splice_pipe[0] = priv->splice_pipe[1] = -1;
+	}
+}
+
 static void
 purple_xfer_increase_buffer_size(PurpleXfer *xfer)
 {
 	PurpleXferPrivate *priv = PURPLE_XFER_GET_PRIVATE(xfer);
+	gsize max = FT_MAX_BUFFER_SIZE;
+
+	/* Protocols may not be able to frame anything bigger */
+	if (priv->ops.read == NULL && priv->ops.write == NULL)
+		max = FT_MAX_FD_BUFFER_SIZE;
 
-	priv->current_buffer_size = MIN(priv->current_buffer_size * 1.5,
-			FT_MAX_BUFFER_SIZE);
+	priv->current_buffer_size = MIN(priv->current_buffer_size * 1.5, max);
+}
+
+static gsize
+purple_xfer_get_read_size(PurpleXfer *xfer)
+{
+	PurpleXferPrivate *priv = PURPLE_XFER_GET_PRIVATE(xfer);
+
+	if (purple_xfer_get_size(xfer) == 0)
+		return priv->current_buffer_size;
+
+	return MIN((gsize)purple_xfer_get_bytes_remaining(xfer),
+			priv->current_buffer_size);
+}
+
+static gssize
+do_read(PurpleXfer *xfer, guchar *buffer, gsize size)
+{
+	PurpleXferPrivate *priv = PURPLE_XFER_GET_PRIVATE(xfer);
+	gssize r;
+
+	r = read(priv->fd, buffer, size);
+	if (r < 0 && errno == EAGAIN)
+		r = 0;
+	else if (r < 0)
+		r = -1;
+	else if (r == 0)
+		r = -1;
+
+	return r;
 }
 
 gssize
@@ -1174,10 +1340,7 @@ purple_xfer_read(PurpleXfer *xfer, guchar **buffer)
 	g_return_val_if_fail(priv   != NULL, 0);
 	g_return_val_if_fail(buffer != NULL, 0);
 
-	if (purple_xfer_get_size(xfer) == 0)
-		s = priv->current_buffer_size;
-	else
-		s = MIN((gssize)purple_xfer_get_bytes_remaining(xfer), (gssize)priv->current_buffer_size);
+	s = purple_xfer_get_read_size(xfer);
 
 	if (priv->ops.read != NULL)	{
 		r = (priv->ops.read)(buffer, s, xfer);
@@ -1185,13 +1348,7 @@ purple_xfer_read(PurpleXfer *xfer, guchar **buffer)
 	else {
 		*buffer = g_malloc0(s);
 
-		r = read(priv->fd, *buffer, s);
-		if (r < 0 && errno == EAGAIN)
-			r = 0;
-		else if (r < 0)
-			r = -1;
-		else if (r == 0)
-			r = -1;
+		r = do_read(xfer, *buffer, s);
 	}
 
 	if (r >= 0 && (gsize)r == priv->current_buffer_size)
@@ -1239,6 +1396,174 @@ purple_xfer_write(PurpleXfer *xfer, const guchar *buffer, gsize size)
 	return do_write(xfer, buffer, s);
 }
 
+/**************************************************************************
+ * Zero-copy transfers
+ **************************************************************************/
+/*
+ * If nobody needs to see the data on its way, the kernel can move it
+ * between the file and the socket.  Protocols that frame the data, or
+ * look at it when it's acknowledged, get it the usual way.
+ */
+static gboolean
+xfer_can_zero_copy(PurpleXfer *xfer)
+{
+	PurpleXferPrivate *priv = PURPLE_XFER_GET_PRIVATE(xfer);
+
+	if (priv->fd == -1 || priv->dest_fp == NULL || priv->chunks != NULL ||
+			priv->ops.read != NULL || priv->ops.write != NULL ||
+			priv->ops.ack != NULL)
+		return FALSE;
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+	if (priv->type == PURPLE_XFER_TYPE_SEND)
+		return TRUE;
+#endif
+#ifdef HAVE_SPLICE
+	if (priv->type == PURPLE_XFER_TYPE_RECEIVE)
+		return TRUE;
+#endif
+
+	return FALSE;
+}
+
+#if (defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)) || defined(HAVE_SPLICE)
+/*
+ * Go back to moving the data through stdio, for files or sockets the
+ * kernel can't move it between by itself.  The zero-copy calls advance
+ * the file descriptor's offset behind the stream's back, so put the
+ * stream where the transfer has got to.
+ */
+static gboolean
+xfer_zero_copy_disable(PurpleXfer *xfer)
+{
+	PurpleXferPrivate *priv = PURPLE_XFER_GET_PRIVATE(xfer);
+
+	purple_debug_info("xfer", "Zero-copy transfer not possible for %s: %s\n",
+			purple_xfer_get_local_filename(xfer), g_strerror(errno));
+
+	priv->zero_copy = FALSE;
+
+	if (fseek(priv->dest_fp, priv->bytes_sent, SEEK_SET) != 0) {
+		purple_debug_error("xfer", "couldn't seek\n");
+		purple_xfer_show_file_error(xfer, purple_xfer_get_local_filename(xfer));
+		purple_xfer_cancel_local(xfer);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+#endif
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+/*
+ * Sends up to @size bytes of the file.  Returns FALSE if the transfer
+ * was cancelled, otherwise @r is set the way do_write() would set it.
+ */
+static gboolean
+xfer_sendfile(PurpleXfer *xfer, gsize size, gssize *r)
+{
+	PurpleXferPrivate *priv = PURPLE_XFER_GET_PRIVATE(xfer);
+
+	*r = sendfile(priv->fd, fileno(priv->dest_fp), NULL, size);
+
+	if (*r < 0) {
+		if (errno == EAGAIN) {
+			*r = 0;
+		} else if (errno == EINVAL || errno == ENOSYS) {
+			*r = 0;
+			return xfer_zero_copy_disable(xfer);
+		}
+		return TRUE;
+	}
+
+	if (*r == 0) {
+		/* The file shrank since we started */
+		purple_debug_error("xfer", "Unable to read file.\n");
+		purple_xfer_cancel_local(xfer);
+		return FALSE;
+	}
+
+	purple_xfer_set_bytes_sent(xfer, purple_xfer_get_bytes_sent(xfer) + *r);
+
+	return TRUE;
+}
+#endif
+
+#ifdef HAVE_SPLICE
+/*
+ * Moves up to @size bytes from the socket into the file.  Returns FALSE
+ * if the transfer was cancelled, otherwise @r is set the way do_read()
+ * would set it.
+ */
+static gboolean
+xfer_splice(PurpleXfer *xfer, gsize size, gssize *r)
+{
+	PurpleXferPrivate *priv = PURPLE_XFER_GET_PRIVATE(xfer);
+	gssize written = 0, w;
+	int pipe_out = priv->splice_pipe[0];
+
+	*r = 0;
+
+	if (priv->splice_pipe[0] == -1) {
+		if (pipe(priv->splice_pipe) != 0)
+			return xfer_zero_copy_disable(xfer);
+#ifdef F_SETPIPE_SZ
+		fcntl(priv->splice_pipe[1], F_SETPIPE_SZ, FT_MAX_FD_BUFFER_SIZE);
+#endif
+		pipe_out = priv->splice_pipe[0];
+	}
+
+	*r = splice(priv->fd, NULL, priv->splice_pipe[1], NULL, size,
+			SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+	if (*r < 0) {
+		if (errno == EAGAIN) {
+			*r = 0;
+		} else if (errno == EINVAL || errno == ENOSYS) {
+			*r = 0;
+			return xfer_zero_copy_disable(xfer);
+		} else {
+			*r = -1;
+		}
+		return TRUE;
+	} else if (*r == 0) {
+		*r = -1;
+		return TRUE;
+	}
+
+	while (written < *r) {
+		w = splice(pipe_out, NULL, fileno(priv->dest_fp), NULL,
+				*r - written, SPLICE_F_MOVE);
+
+		if (w > 0) {
+			written += w;
+			purple_xfer_set_bytes_sent(xfer,
+					purple_xfer_get_bytes_sent(xfer) + w);
+			continue;
+		}
+
+		if (w < 0 && (errno == EINVAL || errno == ENOSYS)) {
+			/* The data's already out of the socket, so move what's
+			 * left of it into the file ourselves */
+			guchar *buffer = purple_xfer_get_chunk_buffer(xfer, *r - written);
+
+			if (!xfer_zero_copy_disable(xfer))
+				return FALSE;
+
+			w = read(pipe_out, buffer, *r - written);
+			if (w == *r - written)
+				return purple_xfer_write_file(xfer, buffer, w);
+		}
+
+		purple_debug_error("xfer", "Unable to write whole buffer.\n");
+		purple_xfer_cancel_local(xfer);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+#endif
+
 gboolean
 purple_xfer_write_file(PurpleXfer *xfer, const guchar *buffer, gsize size)
 {
@@ -1339,37 +1664,285 @@ purple_xfer_read_file(PurpleXfer *xfer, guchar *buffer, gsize size)
 	return got_len;
 }
 
+/**************************************************************************
+ * Chunked transfers
+ **************************************************************************/
+static char *
+purple_xfer_get_chunk_map_filename(PurpleXfer *xfer)
+{
+	PurpleXferPrivate *priv = PURPLE_XFER_GET_PRIVATE(xfer);
+
+	return g_strconcat(priv->local_filename, ".chunks", NULL);
+}
+
+static void
+purple_xfer_save_chunk_map(PurpleXfer *xfer)
+{
+	PurpleXferPrivate *priv = PURPLE_XFER_GET_PRIVATE(xfer);
+	char *filename;
+
+	/* Only the receiving end can resume */
+	if (priv->chunks == NULL || priv->type != PURPLE_XFER_TYPE_RECEIVE ||
+			priv->local_filename == NULL ||
+			purple_xfer_chunk_map_is_complete(priv->chunks))
+		return;
+
+	filename = purple_xfer_get_chunk_map_filename(xfer);
+	purple_xfer_chunk_map_save(priv->chunks, filename);
+	g_free(filename);
+
+	priv->chunks_unsaved = 0;
+}
+
+gboolean
+purple_xfer_set_chunk_size(PurpleXfer *xfer, gsize chunk_size)
+{
+	PurpleXferPrivate *priv = PURPLE_XFER_GET_PRIVATE(xfer);
+	char *filename;
+
+	g_return_val_if_fail(priv != NULL, FALSE);
+	g_return_val_if_fail(chunk_size > 0, FALSE);
+	g_return_val_if_fail(priv->size > 0, FALSE);
+	g_return_val_if_fail(priv->start_time == 0, FALSE);
+
+	if (priv->chunks != NULL) {
+		purple_xfer_chunk_map_free(priv->chunks);
+		priv->chunks = NULL;
+	}
+
+	if (priv->type == PURPLE_XFER_TYPE_RECEIVE && priv->local_filename != NULL &&
+			g_file_test(priv->local_filename, G_FILE_TEST_IS_REGULAR)) {
+		filename = purple_xfer_get_chunk_map_filename(xfer);
+		priv->chunks = purple_xfer_chunk_map_load(filename, priv->size,
+				chunk_size);
+		g_free(filename);
+	}
+
+	if (priv->chunks != NULL && priv->chunks->transferred > 0) {
+		purple_debug_info("xfer", "Resuming %s with %" G_GOFFSET_FORMAT
+				" of %" G_GOFFSET_FORMAT " bytes already received\n",
+				priv->local_filename, priv->chunks->transferred, priv->size);
+		purple_xfer_set_bytes_sent(xfer, priv->chunks->transferred);
+		return TRUE;
+	}
+
+	if (priv->chunks == NULL)
+		priv->chunks = purple_xfer_chunk_map_new(priv->size, chunk_size);
+
+	return FALSE;
+}
+
+PurpleXferChunkMap *
+purple_xfer_get_chunk_map(const PurpleXfer *xfer)
+{
+	PurpleXferPrivate *priv = PURPLE_XFER_GET_PRIVATE(xfer);
+
+	g_return_val_if_fail(priv != NULL, NULL);
+
+	return priv->chunks;
+}
+
+/* Records a range moved by one of the streams of a chunked transfer. */
+static void
+purple_xfer_chunk_done(PurpleXfer *xfer, goffset offset, gsize size)
+{
+	PurpleXferPrivate *priv = PURPLE_XFER_GET_PRIVATE(xfer);
+	PurpleXferUiOps *ui_ops = purple_xfer_get_ui_ops(xfer);
+
+	if (purple_xfer_chunk_map_mark(priv->chunks, offset, size) &&
+			++priv->chunks_unsaved >= FT_CHUNK_MAP_SAVE_INTERVAL)
+		purple_xfer_save_chunk_map(xfer);
+
+	/* Chunks given back and transferred again don't count twice */
+	purple_xfer_set_bytes_sent(xfer, priv->chunks->transferred);
+
+	if (ui_ops != NULL && ui_ops->update_progress != NULL)
+		ui_ops->update_progress(xfer, purple_xfer_get_progress(xfer));
+
+	if (purple_xfer_chunk_map_is_complete(priv->chunks) &&
+			!purple_xfer_is_completed(xfer)) {
+		if (priv->type == PURPLE_XFER_TYPE_RECEIVE &&
+				priv->local_filename != NULL) {
+			char *filename = purple_xfer_get_chunk_map_filename(xfer);
+			g_unlink(filename);
+			g_free(filename);
+		}
+
+		purple_xfer_set_completed(xfer, TRUE);
+	}
+}
+
+gboolean
+purple_xfer_write_file_at(PurpleXfer *xfer, goffset offset,
+		const guchar *buffer, gsize size)
+{
+	PurpleXferPrivate *priv = PURPLE_XFER_GET_PRIVATE(xfer);
+	gssize wc = 0;
+
+	g_return_val_if_fail(priv != NULL, FALSE);
+	g_return_val_if_fail(priv->chunks != NULL, FALSE);
+	g_return_val_if_fail(buffer != NULL, FALSE);
+
+	if (offset < 0 || offset + (goffset)size > priv->size) {
+		purple_debug_error("xfer",
+			"Got data outside of the file (%" G_GSIZE_FORMAT " bytes at %"
+			G_GOFFSET_FORMAT ").\n", size, offset);
+		purple_xfer_cancel_local(xfer);
+		return FALSE;
+	}
+
+	if (priv->dest_fp == NULL) {
+		purple_debug_error("xfer",
+			"File is not opened for writing\n");
+		purple_xfer_cancel_local(xfer);
+		return FALSE;
+	}
+
+#ifdef HAVE_PWRITE
+	while ((gsize)wc < size) {
+		gssize r = pwrite(fileno(priv->dest_fp), buffer + wc, size - wc,
+				offset + wc);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			break;
+		wc += r;
+	}
+#else
+	if (fseek(priv->dest_fp, offset, SEEK_SET) == 0)
+		wc = fwrite(buffer, 1, size, priv->dest_fp);
+#endif
+
+	if ((gsize)wc != size) {
+		purple_debug_error("xfer",
+			"Unable to write whole buffer.\n");
+		purple_xfer_cancel_local(xfer);
+		return FALSE;
+	}
+
+	purple_xfer_chunk_done(xfer, offset, size);
+
+	return TRUE;
+}
+
+gssize
+purple_xfer_read_file_at(PurpleXfer *xfer, goffset offset, guchar *buffer,
+		gsize size)
+{
+	PurpleXferPrivate *priv = PURPLE_XFER_GET_PRIVATE(xfer);
+	gssize got_len;
+
+	g_return_val_if_fail(priv != NULL, -1);
+	g_return_val_if_fail(priv->chunks != NULL, -1);
+	g_return_val_if_fail(buffer != NULL, -1);
+	g_return_val_if_fail(offset >= 0 && offset < priv->size, -1);
+
+	if (priv->dest_fp == NULL) {
+		purple_debug_error("xfer",
+			"File is not opened for reading\n");
+		purple_xfer_cancel_local(xfer);
+		return -1;
+	}
+
+	size = MIN((goffset)size, priv->size - offset);
+
+#ifdef HAVE_PREAD
+	do {
+		got_len = pread(fileno(priv->dest_fp), buffer, size, offset);
+	} while (got_len < 0 && errno == EINTR);
+#else
+	if (fseek(priv->dest_fp, offset, SEEK_SET) == 0)
+		got_len = fread(buffer, 1, size, priv->dest_fp);
+	else
+		got_len = -1;
+#endif
+
+	/* Running into the end of the file means it shrank */
+	if (got_len < 0 || (size > 0 && got_len == 0)) {
+		purple_debug_error("xfer",
+			"Unable to read file.\n");
+		purple_xfer_cancel_local(xfer);
+		return -1;
+	}
+
+	return got_len;
+}
+
+void
+purple_xfer_chunk_sent(PurpleXfer *xfer, goffset offset, gsize size)
+{
+	PurpleXferPrivate *priv = PURPLE_XFER_GET_PRIVATE(xfer);
+
+	g_return_if_fail(priv != NULL);
+	g_return_if_fail(priv->chunks != NULL);
+	g_return_if_fail(priv->type == PURPLE_XFER_TYPE_SEND);
+
+	if (size > 0)
+		purple_xfer_chunk_done(xfer, offset, size);
+}
+
 static void
 do_transfer(PurpleXfer *xfer)
 {
 	PurpleXferPrivate *priv = PURPLE_XFER_GET_PRIVATE(xfer);
 	PurpleXferUiOps *ui_ops;
 	guchar *buffer = NULL;
+	guchar *allocated = NULL;
 	gssize r = 0;
+	gsize pending = 0;
 
 	ui_ops = purple_xfer_get_ui_ops(xfer);
 
 	if (priv->type == PURPLE_XFER_TYPE_RECEIVE) {
-		r = purple_xfer_read(xfer, &buffer);
-		if (r > 0) {
-			if (!purple_xfer_write_file(xfer, buffer, r)) {
-				g_free(buffer);
+		gsize s = purple_xfer_get_read_size(xfer);
+
+#ifdef HAVE_SPLICE
+		if (priv->zero_copy && !xfer_splice(xfer, s, &r))
+			return;
+#endif
+
+		/* Including when it just turned out zero-copy isn't possible */
+		if (!priv->zero_copy && r == 0) {
+			if (priv->ops.read != NULL) {
+				/* The protocol hands us a buffer of its own */
+				r = purple_xfer_read(xfer, &allocated);
+				buffer = allocated;
+			} else {
+				buffer = purple_xfer_get_chunk_buffer(xfer, s);
+				r = do_read(xfer, buffer, s);
+			}
+
+			if (r > 0 && !purple_xfer_write_file(xfer, buffer, r)) {
+				g_free(allocated);
 				return;
 			}
+		}
 
-		} else if(r < 0) {
+		if (r < 0) {
 			purple_xfer_cancel_remote(xfer);
-			g_free(buffer);
+			g_free(allocated);
 			return;
 		}
+
+		if (priv->ops.read == NULL && (gsize)r == priv->current_buffer_size)
+			/*
+			 * We managed to read the entire buffer.  This means our this
+			 * network is fast and our buffer is too small, so make it
+			 * bigger.
+			 */
+			purple_xfer_increase_buffer_size(xfer);
+
 	} else if (priv->type == PURPLE_XFER_TYPE_SEND) {
 		gssize result = 0;
 		gsize s = MIN((gsize)purple_xfer_get_bytes_remaining(xfer), (gsize)priv->current_buffer_size);
-		gboolean read = TRUE;
+
+		/* Whatever didn't get written last time goes first */
+		if (priv->buffer)
+			pending = priv->buffer->len;
 
 		/* this is so the protocol can keep the connection open
 		   if it needs to for some odd reason. */
-		if (s == 0) {
+		if (s == 0 && pending == 0) {
 			if (priv->watcher) {
 				purple_input_remove(priv->watcher);
 				purple_xfer_set_watcher(xfer, 0);
@@ -1377,53 +1950,50 @@ do_transfer(PurpleXfer *xfer)
 			return;
 		}
 
-		if (priv->buffer) {
-			if (priv->buffer->len < s) {
-				s -= priv->buffer->len;
-				read = TRUE;
-			} else {
-				read = FALSE;
-			}
-		}
+		result = s;
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+		if (priv->zero_copy && !xfer_sendfile(xfer, s, &r))
+			return;
+#endif
 
-		if (read) {
-			buffer = g_new(guchar, s);
-			result = purple_xfer_read_file(xfer, buffer, s);
-			if (result == 0) {
-				/*
-				 * The UI claimed it was ready, but didn't have any data for
-				 * us...  It will call purple_xfer_ui_ready when ready, which
-				 * sets back up this watcher.
-				 */
-				if (priv->watcher != 0) {
-					purple_input_remove(priv->watcher);
-					purple_xfer_set_watcher(xfer, 0);
+		if (!priv->zero_copy && r == 0) {
+			if (pending < s) {
+				buffer = purple_xfer_get_chunk_buffer(xfer, s - pending);
+				result = purple_xfer_read_file(xfer, buffer, s - pending);
+				if (result == 0) {
+					/*
+					 * The UI claimed it was ready, but didn't have any data for
+					 * us...  It will call purple_xfer_ui_ready when ready, which
+					 * sets back up this watcher.
+					 */
+					if (priv->watcher != 0) {
+						purple_input_remove(priv->watcher);
+						purple_xfer_set_watcher(xfer, 0);
+					}
+
+					/* Need to indicate the protocol is still ready... */
+					priv->ready |= PURPLE_XFER_READY_PROTOCOL;
+
+					g_return_if_reached();
 				}
+				if (result < 0)
+					return;
+			} else {
+				result = 0;
+			}
 
-				/* Need to indicate the protocol is still ready... */
-				priv->ready |= PURPLE_XFER_READY_PROTOCOL;
-
-				g_return_if_reached();
+			if (pending > 0) {
+				if (result > 0)
+					g_byte_array_append(priv->buffer, buffer, result);
+				buffer = priv->buffer->data;
+				result = priv->buffer->len;
 			}
-			if (result < 0)
-				return;
-		}
 
-		if (priv->buffer) {
-			g_byte_array_append(priv->buffer, buffer, result);
-			g_free(buffer);
-			buffer = priv->buffer->data;
-			result = priv->buffer->len;
+			r = do_write(xfer, buffer, result);
 		}
 
-		r = do_write(xfer, buffer, result);
-
 		if (r == -1) {
 			purple_xfer_cancel_remote(xfer);
-			if (!priv->buffer)
-				/* We don't free buffer if priv->buffer is set, because in
-				   that case buffer doesn't belong to us. */
-				g_free(buffer);
 			return;
 		} else if (r == result) {
 			/*
@@ -1432,19 +2002,13 @@ do_transfer(PurpleXfer *xfer)
 			 * bigger.
 			 */
 			purple_xfer_increase_buffer_size(xfer);
-		} else {
+		} else if (!priv->zero_copy) {
 			if (ui_ops && ui_ops->data_not_sent)
 				ui_ops->data_not_sent(xfer, buffer + r, result - r);
-		}
 
-		if (priv->buffer) {
-			/*
-			 * Remove what we wrote
-			 * If we wrote the whole buffer the byte array will be empty
-			 * Otherwise we'll keep what wasn't sent for next time.
-			 */
-			buffer = NULL;
-			g_byte_array_remove_range(priv->buffer, 0, r);
+			/* Keep what wasn't sent for next time */
+			if (priv->buffer && pending == 0)
+				g_byte_array_append(priv->buffer, buffer + r, result - r);
 		}
 	}
 
@@ -1452,14 +2016,20 @@ do_transfer(PurpleXfer *xfer)
 		if (priv->ops.ack != NULL)
 			priv->ops.ack(xfer, buffer, r);
 
-		g_free(buffer);
-
 		if (ui_ops != NULL && ui_ops->update_progress != NULL)
 			ui_ops->update_progress(xfer,
 				purple_xfer_get_progress(xfer));
 	}
 
+	/* Remove what we wrote out of what was left over */
+	if (pending > 0)
+		g_byte_array_remove_range(priv->buffer, 0, r);
+	g_free(allocated);
+
+	/* The whole file has been read once the last of it is pending, but
+	 * it isn't sent until that's written too */
 	if (purple_xfer_get_bytes_sent(xfer) >= purple_xfer_get_size(xfer) &&
+			!(priv->buffer && priv->buffer->len > 0) &&
 			!purple_xfer_is_completed(xfer)) {
 		purple_xfer_set_completed(xfer, TRUE);
 	}
@@ -1509,8 +2079,14 @@ begin_transfer(PurpleXfer *xfer, PurpleInputCondition cond)
 	}
 
 	if (ui_ops == NULL || (ui_ops->ui_read == NULL && ui_ops->ui_write == NULL)) {
-		priv->dest_fp = g_fopen(purple_xfer_get_local_filename(xfer),
-		                        type == PURPLE_XFER_TYPE_RECEIVE ? "wb" : "rb");
+		const char *mode = (type == PURPLE_XFER_TYPE_RECEIVE) ? "wb" : "rb";
+
+		/* Don't throw away what an earlier attempt already received */
+		if (type == PURPLE_XFER_TYPE_RECEIVE && priv->chunks != NULL &&
+				priv->chunks->transferred > 0)
+			mode = "r+b";
+
+		priv->dest_fp = g_fopen(purple_xfer_get_local_filename(xfer), mode);
 
 		if (priv->dest_fp == NULL) {
 			purple_xfer_show_file_error(xfer, purple_xfer_get_local_filename(xfer));
@@ -1524,6 +2100,8 @@ begin_transfer(PurpleXfer *xfer, PurpleInputCondition cond)
 			purple_xfer_cancel_local(xfer);
 			return;
 		}
+
+		priv->zero_copy = xfer_can_zero_copy(xfer);
 	}
 
 	if (priv->fd != -1)
@@ -1694,6 +2272,8 @@ purple_xfer_end(PurpleXfer *xfer)
 		priv->dest_fp = NULL;
 	}
 
+	purple_xfer_release_buffers(xfer);
+
 	g_object_unref(xfer);
 }
 
@@ -1774,6 +2354,11 @@ purple_xfer_cancel_local(PurpleXfer *xfer)
 		priv->dest_fp = NULL;
 	}
 
+	purple_xfer_release_buffers(xfer);
+
+	/* So the transfer can pick up from here next time */
+	purple_xfer_save_chunk_map(xfer);
+
 	ui_ops = purple_xfer_get_ui_ops(xfer);
 
 	if (ui_ops != NULL && ui_ops->cancel_local != NULL)
@@ -1840,6 +2425,11 @@ purple_xfer_cancel_remote(PurpleXfer *xfer)
 		priv->dest_fp = NULL;
 	}
 
+	purple_xfer_release_buffers(xfer);
+
+	/* So the transfer can pick up from here next time */
+	purple_xfer_save_chunk_map(xfer);
+
 	ui_ops = purple_xfer_get_ui_ops(xfer);
 
 	if (ui_ops != NULL && ui_ops->cancel_remote != NULL)
@@ -2117,6 +2707,7 @@ purple_xfer_init(GTypeInstance *instance, gpointer klass)
 	priv->ui_ops = purple_xfers_get_ui_ops();
 	priv->current_buffer_size = FT_INITIAL_BUFFER_SIZE;
 	priv->fd = -1;
+	priv->splice_pipe[0] = priv->splice_pipe[1] = -1;
 	priv->ready = PURPLE_XFER_READY_NONE;
 }
 
@@ -2174,6 +2765,11 @@ purple_xfer_finalize(GObject *object)
 	if (priv->buffer)
 		g_byte_array_free(priv->buffer, TRUE);
 
+	purple_xfer_release_buffers(xfer);
+
+	if (priv->chunks)
+		purple_xfer_chunk_map_free(priv->chunks);
+
 	g_free(priv->thumbnail_data);
 	g_free(priv->thumbnail_mimetype);
 
@@ -2366,6 +2962,231 @@ purple_xfer_new(PurpleAccount *account, PurpleXferType type, const char *who)
 	return xfer;
 }
 
+/**************************************************************************
+ * File Transfer Chunk Map API
+ **************************************************************************/
+static gsize
+chunk_map_get_chunk_size(const PurpleXferChunkMap *map, guint chunk)
+{
+	goffset start = (goffset)chunk * map->chunk_size;
+
+	return MIN((goffset)map->chunk_size, map->size - start);
+}
+
+PurpleXferChunkMap *
+purple_xfer_chunk_map_new(goffset size, gsize chunk_size)
+{
+	PurpleXferChunkMap *map;
+	goffset n_chunks;
+
+	g_return_val_if_fail(size > 0, NULL);
+	g_return_val_if_fail(chunk_size > 0, NULL);
+
+	n_chunks = (size + chunk_size - 1) / chunk_size;
+	g_return_val_if_fail(n_chunks <= G_MAXUINT, NULL);
+
+	map = g_new0(PurpleXferChunkMap, 1);
+	map->size = size;
+	map->chunk_size = chunk_size;
+	map->n_chunks = n_chunks;
+	map->done = g_new0(guint8, (map->n_chunks + 7) / 8);
+	map->claimed = g_new0(guint8, (map->n_chunks + 7) / 8);
+	map->progress = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	return map;
+}
+
+void
+purple_xfer_chunk_map_free(PurpleXferChunkMap *map)
+{
+	g_return_if_fail(map != NULL);
+
+	g_hash_table_destroy(map->progress);
+	g_free(map->done);
+	g_free(map->claimed);
+	g_free(map);
+}
+
+gboolean
+purple_xfer_chunk_map_claim(PurpleXferChunkMap *map, goffset *offset,
+		gsize *size)
+{
+	guint i;
+
+	g_return_val_if_fail(map != NULL, FALSE);
+
+	for (i = map->next; i < map->n_chunks; i++) {
+		if (!CHUNK_BIT_TEST(map->done, i) && !CHUNK_BIT_TEST(map->claimed, i))
+			break;
+	}
+
+	if (i == map->n_chunks) {
+		map->next = i;
+		return FALSE;
+	}
+
+	CHUNK_BIT_SET(map->claimed, i);
+	map->next = i + 1;
+
+	if (offset)
+		*offset = (goffset)i * map->chunk_size;
+	if (size)
+		*size = chunk_map_get_chunk_size(map, i);
+
+	return TRUE;
+}
+
+void
+purple_xfer_chunk_map_release(PurpleXferChunkMap *map, goffset offset)
+{
+	guint i;
+
+	g_return_if_fail(map != NULL);
+	g_return_if_fail(offset >= 0 && offset < map->size);
+
+	i = offset / map->chunk_size;
+	if (CHUNK_BIT_TEST(map->done, i))
+		return;
+
+	map->transferred -= GPOINTER_TO_SIZE(g_hash_table_lookup(map->progress,
+			GUINT_TO_POINTER(i)));
+	g_hash_table_remove(map->progress, GUINT_TO_POINTER(i));
+
+	CHUNK_BIT_CLEAR(map->claimed, i);
+	map->next = MIN(map->next, i);
+}
+
+gboolean
+purple_xfer_chunk_map_mark(PurpleXferChunkMap *map, goffset offset,
+		gsize size)
+{
+	gboolean completed = FALSE;
+
+	g_return_val_if_fail(map != NULL, FALSE);
+	g_return_val_if_fail(offset >= 0, FALSE);
+	g_return_val_if_fail(offset + (goffset)size <= map->size, FALSE);
+
+	while (size > 0) {
+		guint i = offset / map->chunk_size;
+		gsize len = chunk_map_get_chunk_size(map, i);
+		gsize part = MIN((goffset)size,
+				(goffset)i * map->chunk_size + len - offset);
+
+		if (!CHUNK_BIT_TEST(map->done, i)) {
+			gsize filled = GPOINTER_TO_SIZE(g_hash_table_lookup(
+					map->progress, GUINT_TO_POINTER(i)));
+			gsize added = MIN(part, len - filled);
+
+			filled += added;
+			map->transferred += added;
+
+			if (filled == len) {
+				g_hash_table_remove(map->progress, GUINT_TO_POINTER(i));
+				CHUNK_BIT_SET(map->done, i);
+				CHUNK_BIT_CLEAR(map->claimed, i);
+				map->n_done++;
+				map->done_size += len;
+				completed = TRUE;
+			} else {
+				g_hash_table_insert(map->progress, GUINT_TO_POINTER(i),
+						GSIZE_TO_POINTER(filled));
+			}
+		}
+
+		offset += part;
+		size -= part;
+	}
+
+	return completed;
+}
+
+goffset
+purple_xfer_chunk_map_get_completed_size(const PurpleXferChunkMap *map)
+{
+	g_return_val_if_fail(map != NULL, 0);
+
+	return map->done_size;
+}
+
+gboolean
+purple_xfer_chunk_map_is_complete(const PurpleXferChunkMap *map)
+{
+	g_return_val_if_fail(map != NULL, FALSE);
+
+	return map->n_done == map->n_chunks;
+}
+
+gboolean
+purple_xfer_chunk_map_save(const PurpleXferChunkMap *map, const char *filename)
+{
+	GString *data;
+	gboolean ret;
+
+	g_return_val_if_fail(map != NULL, FALSE);
+	g_return_val_if_fail(filename != NULL, FALSE);
+
+	data = g_string_new(NULL);
+	g_string_printf(data, FT_CHUNK_MAP_HEADER, map->size, map->chunk_size);
+	g_string_append_len(data, (const gchar *)map->done,
+			(map->n_chunks + 7) / 8);
+
+	ret = purple_util_write_data_to_file_absolute(filename, data->str,
+			data->len);
+
+	g_string_free(data, TRUE);
+
+	return ret;
+}
+
+PurpleXferChunkMap *
+purple_xfer_chunk_map_load(const char *filename, goffset size,
+		gsize chunk_size)
+{
+	PurpleXferChunkMap *map;
+	gchar *contents, *header;
+	gsize length, header_len, i;
+
+	g_return_val_if_fail(filename != NULL, NULL);
+
+	if (!g_file_get_contents(filename, &contents, &length, NULL))
+		return NULL;
+
+	map = purple_xfer_chunk_map_new(size, chunk_size);
+	header = g_strdup_printf(FT_CHUNK_MAP_HEADER, size, chunk_size);
+	header_len = strlen(header);
+
+	/* It has to have been saved for this very file */
+	if (map == NULL || length != header_len + (map->n_chunks + 7) / 8 ||
+			strncmp(contents, header, header_len) != 0) {
+		purple_debug_warning("xfer", "Ignoring chunk map %s, it doesn't "
+				"match the file being transferred\n", filename);
+		if (map != NULL)
+			purple_xfer_chunk_map_free(map);
+		g_free(header);
+		g_free(contents);
+		return NULL;
+	}
+
+	memcpy(map->done, contents + header_len, (map->n_chunks + 7) / 8);
+	g_free(header);
+	g_free(contents);
+
+	for (i = 0; i < map->n_chunks; i++) {
+		if (CHUNK_BIT_TEST(map->done, i)) {
+			map->n_done++;
+			map->done_size += chunk_map_get_chunk_size(map, i);
+		}
+	}
+
+	/* Don't trust any stray bits past the last chunk */
+	for (; i < (map->n_chunks + 7) / 8 * 8; i++)
+		CHUNK_BIT_CLEAR(map->done, i);
+
+	map->transferred = map->done_size;
+
+	return map;
+}
+
 /**************************************************************************
  * File Transfer Subsystem API
  **************************************************************************/
@@ -2423,6 +3244,14 @@ purple_xfers_uninit(void)
 
 	purple_signals_disconnect_by_handle(handle);
 	purple_signals_unregister_by_instance(handle);
+
+	while (buffer_pool != NULL) {
+		PurpleXferBuffer *buf = buffer_pool->data;
+
+		buffer_pool = g_slist_delete_link(buffer_pool, buffer_pool);
+		g_free(buf->data);
+		g_free(buf);
+	}
 }
 
 void
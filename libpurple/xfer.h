@@ -46,6 +46,15 @@ typedef struct _PurpleXferClass PurpleXferClass;
 
 typedef struct _PurpleXferUiOps PurpleXferUiOps;
 
+/**
+ * PurpleXferChunkMap:
+ *
+ * Keeps track of which fixed-size chunks of a file have been transferred,
+ * so that several streams can each fill a different range of the file,
+ * and an interrupted transfer can pick up where it left off.
+ */
+typedef struct _PurpleXferChunkMap PurpleXferChunkMap;
+
 #include <glib.h>
 #include <stdio.h>
 
@@ -694,6 +703,89 @@ purple_xfer_write_file(PurpleXfer *xfer, const guchar *buffer, gsize size);
 gssize
 purple_xfer_read_file(PurpleXfer *xfer, guchar *buffer, gsize size);
 
+/**
+ * purple_xfer_set_chunk_size:
+ * @xfer:       The file transfer.
+ * @chunk_size: The size of each chunk, in bytes.
+ *
+ * Switches a file transfer to chunked mode, in which the protocol moves
+ * the file in chunks of @chunk_size bytes, possibly over several streams
+ * at once.  Each stream claims a range to transfer from the chunk map
+ * returned by purple_xfer_get_chunk_map(), and moves the data with
+ * purple_xfer_write_file_at() or purple_xfer_read_file_at().  A stream
+ * sending the file reports what it has sent with purple_xfer_chunk_sent().
+ *
+ * When receiving, the chunks that have been written are saved next to the
+ * local file, and if a previous attempt at receiving it was interrupted,
+ * the transfer resumes from the chunks it had already completed.  Call
+ * this after the local filename and the size of the file are set, and
+ * before the transfer starts.
+ *
+ * Once every chunk is in, the transfer is marked completed, and the
+ * protocol should end it with purple_xfer_end().
+ *
+ * Returns: %TRUE if the transfer picks up where a previous one left off.
+ */
+gboolean purple_xfer_set_chunk_size(PurpleXfer *xfer, gsize chunk_size);
+
+/**
+ * purple_xfer_get_chunk_map:
+ * @xfer: The file transfer.
+ *
+ * Returns the chunk map of a file transfer in chunked mode.
+ *
+ * Returns: (transfer none): The chunk map, or %NULL if the transfer isn't
+ *          in chunked mode.
+ */
+PurpleXferChunkMap *purple_xfer_get_chunk_map(const PurpleXfer *xfer);
+
+/**
+ * purple_xfer_write_file_at:
+ * @xfer:   The file transfer.
+ * @offset: Where in the file the data goes.
+ * @buffer: The buffer to read the data from.
+ * @size:   The number of bytes to write.
+ *
+ * Writes a range of a file being received in chunked mode.  Ranges written
+ * by different streams must not overlap.
+ *
+ * Returns: TRUE on success, FALSE otherwise.
+ */
+gboolean
+purple_xfer_write_file_at(PurpleXfer *xfer, goffset offset,
+		const guchar *buffer, gsize size);
+
+/**
+ * purple_xfer_read_file_at:
+ * @xfer:   The file transfer.
+ * @offset: Where in the file to read from.
+ * @buffer: The buffer to write the data to.
+ * @size:   The size of buffer.
+ *
+ * Reads a range of a file being sent in chunked mode.  Ranges read by
+ * different streams must not overlap.  Reading a range doesn't count it as
+ * sent; call purple_xfer_chunk_sent() once the data is out.
+ *
+ * Returns: Number of bytes read, or -1 on failure.
+ */
+gssize
+purple_xfer_read_file_at(PurpleXfer *xfer, goffset offset, guchar *buffer,
+		gsize size);
+
+/**
+ * purple_xfer_chunk_sent:
+ * @xfer:   The file transfer.
+ * @offset: Where in the file the data came from.
+ * @size:   The number of bytes sent.
+ *
+ * Records that a stream of a file being sent in chunked mode has sent a
+ * range read with purple_xfer_read_file_at().  This updates the progress,
+ * and once every chunk has been sent the transfer is marked completed.
+ * A chunk whose data couldn't be sent should be given back with
+ * purple_xfer_chunk_map_release() instead.
+ */
+void purple_xfer_chunk_sent(PurpleXfer *xfer, goffset offset, gsize size);
+
 /**
  * purple_xfer_start:
  * @xfer: The file transfer.
@@ -886,6 +978,119 @@ void purple_xfer_set_ui_data(PurpleXfer *xfer, gpointer ui_data);
  */
 gpointer purple_xfer_get_ui_data(const PurpleXfer *xfer);
 
+/**************************************************************************/
+/* File Transfer Chunk Map API                                            */
+/**************************************************************************/
+
+/**
+ * purple_xfer_chunk_map_new:
+ * @size:       The size of the file.
+ * @chunk_size: The size of each chunk, in bytes.
+ *
+ * Creates a chunk map for a file with none of its chunks transferred.
+ *
+ * Returns: The new chunk map.
+ */
+PurpleXferChunkMap *purple_xfer_chunk_map_new(goffset size, gsize chunk_size);
+
+/**
+ * purple_xfer_chunk_map_free:
+ * @map: The chunk map.
+ *
+ * Frees a chunk map.
+ */
+void purple_xfer_chunk_map_free(PurpleXferChunkMap *map);
+
+/**
+ * purple_xfer_chunk_map_claim:
+ * @map:    The chunk map.
+ * @offset: (out): Return location for the offset of the chunk.
+ * @size:   (out): Return location for the size of the chunk.
+ *
+ * Hands out the first chunk that is neither transferred nor claimed by
+ * another stream.  The chunk stays claimed until it has been transferred
+ * completely, or until it's given back with
+ * purple_xfer_chunk_map_release().
+ *
+ * Returns: %TRUE if a chunk was claimed, %FALSE if there are none left.
+ */
+gboolean purple_xfer_chunk_map_claim(PurpleXferChunkMap *map, goffset *offset,
+		gsize *size);
+
+/**
+ * purple_xfer_chunk_map_release:
+ * @map:    The chunk map.
+ * @offset: The offset of the chunk.
+ *
+ * Gives back a claimed chunk, for instance because its stream failed, so
+ * another stream can claim it.  Whatever had been transferred of it will
+ * be transferred again.
+ */
+void purple_xfer_chunk_map_release(PurpleXferChunkMap *map, goffset offset);
+
+/**
+ * purple_xfer_chunk_map_mark:
+ * @map:    The chunk map.
+ * @offset: The offset of the range.
+ * @size:   The size of the range.
+ *
+ * Records that a range of the file has been transferred.  The range may
+ * span several chunks.
+ *
+ * Returns: %TRUE if this completed at least one chunk.
+ */
+gboolean purple_xfer_chunk_map_mark(PurpleXferChunkMap *map, goffset offset,
+		gsize size);
+
+/**
+ * purple_xfer_chunk_map_get_completed_size:
+ * @map: The chunk map.
+ *
+ * Returns the number of bytes in the chunks that have been transferred
+ * completely.
+ *
+ * Returns: The number of bytes.
+ */
+goffset purple_xfer_chunk_map_get_completed_size(const PurpleXferChunkMap *map);
+
+/**
+ * purple_xfer_chunk_map_is_complete:
+ * @map: The chunk map.
+ *
+ * Returns whether every chunk of the file has been transferred.
+ *
+ * Returns: %TRUE if the whole file has been transferred.
+ */
+gboolean purple_xfer_chunk_map_is_complete(const PurpleXferChunkMap *map);
+
+/**
+ * purple_xfer_chunk_map_save:
+ * @map:      The chunk map.
+ * @filename: The file to save it to.
+ *
+ * Saves which chunks have been transferred completely, so the transfer
+ * can be resumed with purple_xfer_chunk_map_load().
+ *
+ * Returns: %TRUE if the map was saved.
+ */
+gboolean purple_xfer_chunk_map_save(const PurpleXferChunkMap *map,
+		const char *filename);
+
+/**
+ * purple_xfer_chunk_map_load:
+ * @filename:   The file the map was saved to.
+ * @size:       The size of the file being transferred.
+ * @chunk_size: The size of each chunk, in bytes.
+ *
+ * Loads a chunk map saved with purple_xfer_chunk_map_save().  Chunks that
+ * were only partly transferred, or claimed, when it was saved start over.
+ *
+ * Returns: The chunk map, or %NULL if it couldn't be read or was saved for
+ *          a different file size or chunk size.
+ */
+PurpleXferChunkMap *purple_xfer_chunk_map_load(const char *filename,
+		goffset size, gsize chunk_size);
+
 /**************************************************************************/
 /* File Transfer Subsystem API                                            */
 /**************************************************************************/
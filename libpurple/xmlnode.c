@@ -42,12 +42,79 @@
 # define NEWLINE_S "\n"
 #endif
 
+/* Pooled trees are usually short-lived, parsed stanzas, so a block should fit
+ * a typical one at once. */
+#define PURPLE_XMLNODE_POOL_BLOCK_SIZE 4096
+
+static gchar *
+node_strdup(const PurpleXmlNode *node, const char *str)
+{
+	if (node->pool == NULL)
+		return g_strdup(str);
+
+	return purple_memory_pool_strdup(node->pool, str);
+}
+
+/* Element, attribute and namespace names come from a small vocabulary, so
+ * pooled nodes share the ones that are already interned instead of copying
+ * them. New names are never interned here, so a peer sending random names
+ * can't grow the quark table. */
+static gchar *
+node_strdup_name(const PurpleXmlNode *node, const char *str)
+{
+	GQuark quark;
+
+	if (node->pool == NULL)
+		return g_strdup(str);
+
+	if (str == NULL)
+		return NULL;
+
+	quark = g_quark_try_string(str);
+	if (quark != 0)
+		return (gchar *)g_quark_to_string(quark);
+
+	return purple_memory_pool_strdup(node->pool, str);
+}
+
+static gpointer
+node_memdup(const PurpleXmlNode *node, gconstpointer mem, gsize size)
+{
+	gpointer dup;
+
+	if (node->pool == NULL)
+		return g_memdup(mem, size);
+
+	dup = purple_memory_pool_alloc(node->pool, size, sizeof(gchar));
+	if (dup != NULL)
+		memcpy(dup, mem, size);
+
+	return dup;
+}
+
+static void
+node_str_free(const PurpleXmlNode *node, gchar *str)
+{
+	/* pooled strings are released along with the whole tree */
+	if (node->pool == NULL)
+		g_free(str);
+}
+
 static PurpleXmlNode*
-new_node(const char *name, PurpleXmlNodeType type)
+new_node(const char *name, PurpleXmlNodeType type, PurpleMemoryPool *pool)
 {
-	PurpleXmlNode *node = g_new0(PurpleXmlNode, 1);
+	PurpleXmlNode *node;
 
-	node->name = g_strdup(name);
+	if (pool != NULL) {
+		node = purple_memory_pool_alloc0(pool, sizeof(PurpleXmlNode),
+			sizeof(gpointer));
+		g_return_val_if_fail(node != NULL, NULL);
+		node->pool = pool;
+	} else {
+		node = g_new0(PurpleXmlNode, 1);
+	}
+
+	node->name = node_strdup_name(node, name);
 	node->type = type;
 
 //	PURPLE_DBUS_REGISTER_POINTER(node, PurpleXmlNode);
@@ -60,7 +127,24 @@ purple_xmlnode_new(const char *name)
 {
 	g_return_val_if_fail(name != NULL && *name != '\0', NULL);
 
-	return new_node(name, PURPLE_XMLNODE_TYPE_TAG);
+	return new_node(name, PURPLE_XMLNODE_TYPE_TAG, NULL);
+}
+
+PurpleXmlNode *
+purple_xmlnode_new_with_pool(const char *name, PurpleMemoryPool *pool)
+{
+	PurpleXmlNode *node;
+
+	g_return_val_if_fail(name != NULL && *name != '\0', NULL);
+	g_return_val_if_fail(PURPLE_IS_MEMORY_POOL(pool), NULL);
+
+	node = new_node(name, PURPLE_XMLNODE_TYPE_TAG, pool);
+	g_return_val_if_fail(node != NULL, NULL);
+
+	/* released by purple_xmlnode_free(), as this node is the tree root */
+	g_object_ref(pool);
+
+	return node;
 }
 
 PurpleXmlNode *
@@ -71,7 +155,7 @@ purple_xmlnode_new_child(PurpleXmlNode *parent, const char *name)
 	g_return_val_if_fail(parent != NULL, NULL);
 	g_return_val_if_fail(name != NULL && *name != '\0', NULL);
 
-	node = new_node(name, PURPLE_XMLNODE_TYPE_TAG);
+	node = new_node(name, PURPLE_XMLNODE_TYPE_TAG, parent->pool);
 
 	purple_xmlnode_insert_child(parent, node);
 #if 0
@@ -120,9 +204,10 @@ purple_xmlnode_insert_data(PurpleXmlNode *node, const char *data, gssize size)
 
 	real_size = size == -1 ? strlen(data) : (gsize)size;
 
-	child = new_node(NULL, PURPLE_XMLNODE_TYPE_DATA);
+	child = new_node(NULL, PURPLE_XMLNODE_TYPE_DATA, node->pool);
+	g_return_if_fail(child != NULL);
 
-	child->data = g_memdup(data, real_size);
+	child->data = node_memdup(child, data, real_size);
 	child->data_sz = real_size;
 
 	purple_xmlnode_insert_child(node, child);
@@ -209,11 +294,12 @@ purple_xmlnode_set_attrib_full(PurpleXmlNode *node, const char *attr, const char
 	g_return_if_fail(value != NULL);
 
 	purple_xmlnode_remove_attrib_with_namespace(node, attr, xmlns);
-	attrib_node = new_node(attr, PURPLE_XMLNODE_TYPE_ATTRIB);
+	attrib_node = new_node(attr, PURPLE_XMLNODE_TYPE_ATTRIB, node->pool);
+	g_return_if_fail(attrib_node != NULL);
 
-	attrib_node->data = g_strdup(value);
-	attrib_node->xmlns = g_strdup(xmlns);
-	attrib_node->prefix = g_strdup(prefix);
+	attrib_node->data = node_strdup(attrib_node, value);
+	attrib_node->xmlns = node_strdup_name(attrib_node, xmlns);
+	attrib_node->prefix = node_strdup_name(attrib_node, prefix);
 
 	purple_xmlnode_insert_child(node, attrib_node);
 }
@@ -262,14 +348,14 @@ void purple_xmlnode_set_namespace(PurpleXmlNode *node, const char *xmlns)
 	g_return_if_fail(node != NULL);
 
 	tmp = node->xmlns;
-	node->xmlns = g_strdup(xmlns);
+	node->xmlns = node_strdup_name(node, xmlns);
 
 	if (node->namespace_map) {
 		g_hash_table_insert(node->namespace_map,
-			g_strdup(""), g_strdup(xmlns));
+			node_strdup(node, ""), node_strdup(node, xmlns));
 	}
 
-	g_free(tmp);
+	node_str_free(node, tmp);
 }
 
 const char *purple_xmlnode_get_namespace(const PurpleXmlNode *node)
@@ -309,8 +395,8 @@ void purple_xmlnode_set_prefix(PurpleXmlNode *node, const char *prefix)
 {
 	g_return_if_fail(node != NULL);
 
-	g_free(node->prefix);
-	node->prefix = g_strdup(prefix);
+	node_str_free(node, node->prefix);
+	node->prefix = node_strdup_name(node, prefix);
 }
 
 const char *purple_xmlnode_get_prefix(const PurpleXmlNode *node)
@@ -406,6 +492,20 @@ purple_xmlnode_free(PurpleXmlNode *node)
 		x = y;
 	}
 
+	if (node->pool != NULL) {
+		PurpleMemoryPool *pool = node->pool;
+
+		/* the namespace map is the only thing living outside of the pool */
+		if (node->namespace_map)
+			g_hash_table_destroy(node->namespace_map);
+
+		/* the root of a pooled tree owns a reference to the pool */
+		if (node->parent == NULL)
+			g_object_unref(pool);
+
+		return;
+	}
+
 	/* now dispose of ourselves */
 	g_free(node->name);
 	g_free(node->data);
@@ -635,6 +735,7 @@ purple_xmlnode_to_formatted_str(const PurpleXmlNode *node, int *len)
 
 struct _xmlnode_parser_data {
 	PurpleXmlNode *current;
+	PurpleMemoryPool *pool;
 	gboolean error;
 };
 
@@ -653,6 +754,8 @@ purple_xmlnode_parser_element_start_libxml(void *user_data,
 	} else {
 		if(xpd->current)
 			node = purple_xmlnode_new_child(xpd->current, (const char*) element_name);
+		else if (xpd->pool)
+			node = purple_xmlnode_new_with_pool((const char *)element_name, xpd->pool);
 		else
 			node = purple_xmlnode_new((const char *) element_name);
 
@@ -660,14 +763,20 @@ purple_xmlnode_parser_element_start_libxml(void *user_data,
 		purple_xmlnode_set_prefix(node, (const char *)prefix);
 
 		if (nb_namespaces != 0) {
-			node->namespace_map = g_hash_table_new_full(
-				g_str_hash, g_str_equal, g_free, g_free);
+			if (node->pool) {
+				node->namespace_map = g_hash_table_new(
+					g_str_hash, g_str_equal);
+			} else {
+				node->namespace_map = g_hash_table_new_full(
+					g_str_hash, g_str_equal, g_free, g_free);
+			}
 
 			for (i = 0, j = 0; i < nb_namespaces; i++, j += 2) {
 				const char *key = (const char *)namespaces[j];
 				const char *val = (const char *)namespaces[j + 1];
 				g_hash_table_insert(node->namespace_map,
-					g_strdup(key ? key : ""), g_strdup(val ? val : ""));
+					node_strdup(node, key ? key : ""),
+					node_strdup(node, val ? val : ""));
 			}
 		}
 
@@ -790,8 +899,9 @@ static xmlSAXHandler purple_xmlnode_parser_libxml = {
 	purple_xmlnode_parser_structural_error_libxml, /* serror */
 };
 
-PurpleXmlNode *
-purple_xmlnode_from_str(const char *str, gssize size)
+static PurpleXmlNode *
+purple_xmlnode_from_str_helper(const char *str, gssize size,
+	PurpleMemoryPool *pool)
 {
 	struct _xmlnode_parser_data *xpd;
 	PurpleXmlNode *ret;
@@ -801,6 +911,7 @@ purple_xmlnode_from_str(const char *str, gssize size)
 
 	real_size = size < 0 ? strlen(str) : (gsize)size;
 	xpd = g_new0(struct _xmlnode_parser_data, 1);
+	xpd->pool = pool;
 
 	if (xmlSAXUserParseMemory(&purple_xmlnode_parser_libxml, xpd, str, real_size) < 0) {
 		while(xpd->current && xpd->current->parent)
@@ -820,6 +931,30 @@ purple_xmlnode_from_str(const char *str, gssize size)
 	return ret;
 }
 
+PurpleXmlNode *
+purple_xmlnode_from_str(const char *str, gssize size)
+{
+	return purple_xmlnode_from_str_helper(str, size, NULL);
+}
+
+PurpleXmlNode *
+purple_xmlnode_from_str_pooled(const char *str, gssize size)
+{
+	PurpleMemoryPool *pool;
+	PurpleXmlNode *ret;
+
+	g_return_val_if_fail(str != NULL, NULL);
+
+	pool = purple_memory_pool_new();
+	purple_memory_pool_set_block_size(pool, PURPLE_XMLNODE_POOL_BLOCK_SIZE);
+
+	/* the returned tree holds its own reference on the pool */
+	ret = purple_xmlnode_from_str_helper(str, size, pool);
+	g_object_unref(pool);
+
+	return ret;
+}
+
 PurpleXmlNode *
 purple_xmlnode_from_file(const char *dir,const char *filename, const char *description, const char *process)
 {
@@ -908,7 +1043,7 @@ purple_xmlnode_copy(const PurpleXmlNode *src)
 
 	g_return_val_if_fail(src != NULL, NULL);
 
-	ret = new_node(src->name, src->type);
+	ret = new_node(src->name, src->type, NULL);
 	ret->xmlns = g_strdup(src->xmlns);
 	if (src->data) {
 		if (src->data_sz) {
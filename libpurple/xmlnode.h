@@ -31,6 +31,8 @@
 #include <glib.h>
 #include <glib-object.h>
 
+#include "memorypool.h"
+
 #define PURPLE_TYPE_XMLNODE  (purple_xmlnode_get_type())
 
 /**
@@ -64,6 +66,11 @@ typedef enum
  * @namespace_map: The namespace map.
  *
  * An PurpleXmlNode.
+ *
+ * Nodes created with purple_xmlnode_new_with_pool() (and all the children,
+ * attributes and data added to them later) are allocated within a
+ * #PurpleMemoryPool. Their strings must not be modified or freed directly,
+ * and the whole tree is released at once when its root is freed.
  */
 typedef struct _PurpleXmlNode PurpleXmlNode;
 struct _PurpleXmlNode
@@ -79,6 +86,9 @@ struct _PurpleXmlNode
 	PurpleXmlNode *next;
 	char *prefix;
 	GHashTable *namespace_map;
+
+	/*< private >*/
+	PurpleMemoryPool *pool;
 };
 
 G_BEGIN_DECLS
@@ -100,6 +110,26 @@ GType purple_xmlnode_get_type(void);
  */
 PurpleXmlNode *purple_xmlnode_new(const char *name);
 
+/**
+ * purple_xmlnode_new_with_pool:
+ * @name: The name of the node.
+ * @pool: The memory pool to allocate the tree within.
+ *
+ * Creates a new PurpleXmlNode allocated within @pool. Every child, attribute
+ * and data node inserted into it with purple_xmlnode_new_child(),
+ * purple_xmlnode_set_attrib() or purple_xmlnode_insert_data() is allocated
+ * within the same pool. Element and namespace names already interned with
+ * g_intern_string() are shared instead of being copied.
+ *
+ * The returned node holds a reference on @pool, which is released when the
+ * node is freed with purple_xmlnode_free(). Nodes of such tree must not
+ * outlive it; use purple_xmlnode_copy() to keep a part of it.
+ *
+ * Returns: The new node.
+ */
+PurpleXmlNode *purple_xmlnode_new_with_pool(const char *name,
+	PurpleMemoryPool *pool);
+
 /**
  * purple_xmlnode_new_child:
  * @parent: The parent node.
@@ -386,6 +416,21 @@ char *purple_xmlnode_to_formatted_str(const PurpleXmlNode *node, int *len);
  */
 PurpleXmlNode *purple_xmlnode_from_str(const char *str, gssize size);
 
+/**
+ * purple_xmlnode_from_str_pooled:
+ * @str:  The string of xml.
+ * @size: The size of the string, or -1 if @str is
+ *             NUL-terminated.
+ *
+ * Creates a node from a string of XML, just like purple_xmlnode_from_str(),
+ * but allocates the whole tree within a single #PurpleMemoryPool (see
+ * purple_xmlnode_new_with_pool()). This is much cheaper for short-lived trees,
+ * that are parsed, inspected and freed.
+ *
+ * Returns: The new node.
+ */
+PurpleXmlNode *purple_xmlnode_from_str_pooled(const char *str, gssize size);
+
 /**
  * purple_xmlnode_copy:
  * @src: The node to copy.
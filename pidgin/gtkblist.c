@@ -150,6 +150,8 @@ static void sort_method_none(PurpleBlistNode *node, PurpleBuddyList *blist, GtkT
 static void sort_method_alphabetical(PurpleBlistNode *node, PurpleBuddyList *blist, GtkTreeIter groupiter, GtkTreeIter *cur, GtkTreeIter *iter);
 static void sort_method_status(PurpleBlistNode *node, PurpleBuddyList *blist, GtkTreeIter groupiter, GtkTreeIter *cur, GtkTreeIter *iter);
 static void sort_method_log_activity(PurpleBlistNode *node, PurpleBuddyList *blist, GtkTreeIter groupiter, GtkTreeIter *cur, GtkTreeIter *iter);
+static void sort_index_remove(PurpleBlistNode *node);
+static void sort_index_clear(PurpleBlistNode *gnode);
 static guint sort_merge_id;
 static GtkActionGroup *sort_action_group = NULL;
 
@@ -186,6 +188,20 @@ typedef struct _pidgin_blist_node {
 		time_t last_message;          /* timestamp for last displayed message */
 		PidginBlistNodeFlags flags;
 	} conv;
+	/* The built-in sort methods keep the contacts and chats of each
+	 * group in an ordered index, so they don't have to compare a node
+	 * against all of its siblings to find where it goes. */
+	GSequence *sorted;            /* groups: the children in sorted order */
+	GSequenceIter *sorted_pos;    /* this node's place in its group's index */
+	gchar *sort_key;              /* collation key of the name it's sorted by */
+	int activity_score;           /* log activity score when last sorted */
+	struct {
+		gboolean known;               /* whether there was a priority buddy */
+		gboolean online;
+		int score;
+		time_t idle_time;
+	} presence;                   /* priority buddy's presence when last sorted */
+	guint sort_serial;            /* order the node was first sorted in */
 } PidginBlistNode;
 
 /***************************************************
@@ -649,6 +665,8 @@ chat_components_edit_ok(PurpleChat *chat, PurpleRequestFields *allfields)
 			}
 		}
 	}
+
+	purple_blist_update_chats_cache(chat);
 }
 
 static void chat_components_edit(GtkWidget *w, PurpleBlistNode *node)
@@ -4513,6 +4531,11 @@ static void pidgin_blist_hide_node(PurpleBuddyList *list, PurpleBlistNode *node,
 	if (!gtknode || !gtknode->row || !gtkblist)
 		return;
 
+	if (PURPLE_IS_GROUP(node))
+		sort_index_clear(node);
+	else
+		sort_index_remove(node);
+
 	if(gtkblist->selected_node == node)
 		gtkblist->selected_node = NULL;
 	if (get_iter_from_node(node, &iter)) {
@@ -6221,6 +6244,9 @@ static void pidgin_blist_remove(PurpleBuddyList *list, PurpleBlistNode *node)
 			purple_timeout_remove(gtknode->recent_signonoff_timer);
 
 		purple_signals_disconnect_by_handle(gtknode);
+		sort_index_clear(node);
+		sort_index_remove(node);
+		g_free(gtknode->sort_key);
 		g_free(gtknode);
 		purple_blist_node_set_ui_data(node, NULL);
 	}
@@ -6282,18 +6308,19 @@ static gboolean insert_node(PurpleBuddyList *list, PurpleBlistNode *node, GtkTre
 	if(get_iter_from_node(node, &cur))
 		curptr = &cur;
 
+	/* The sort methods may keep their own data on the node */
+	if(gtknode == NULL) {
+		pidgin_blist_new_node(node);
+		gtknode = purple_blist_node_get_ui_data(node);
+	}
+
 	if(PURPLE_IS_CONTACT(node) || PURPLE_IS_CHAT(node)) {
 		current_sort_method->func(node, list, parent_iter, curptr, iter);
 	} else {
 		sort_method_none(node, list, parent_iter, curptr, iter);
 	}
 
-	if(gtknode != NULL) {
-		gtk_tree_row_reference_free(gtknode->row);
-	} else {
-		pidgin_blist_new_node(node);
-		gtknode = purple_blist_node_get_ui_data(node);
-	}
+	gtk_tree_row_reference_free(gtknode->row);
 
 	newpath = gtk_tree_model_get_path(GTK_TREE_MODEL(gtkblist->treemodel),
 			iter);
@@ -7646,6 +7673,7 @@ void pidgin_blist_sort_method_unreg(const char *id)
 
 void pidgin_blist_sort_method_set(const char *id){
 	GList *l = pidgin_blist_sort_methods;
+	PurpleBlistNode *gnode;
 
 	if(!id)
 		id = "none";
@@ -7659,6 +7687,11 @@ void pidgin_blist_sort_method_set(const char *id){
 		pidgin_blist_sort_method_set("none");
 		return;
 	}
+
+	/* The indexes are ordered for the old method, so start over */
+	for (gnode = purple_blist_get_root(); gnode; gnode = gnode->next)
+		sort_index_clear(gnode);
+
 	if (!strcmp(id, "none")) {
 		redo_buddy_list(purple_blist_get_buddy_list(), TRUE, FALSE);
 	} else {
@@ -7689,233 +7722,253 @@ static void sort_method_none(PurpleBlistNode *node, PurpleBuddyList *blist, GtkT
 			sibling ? &sibling_iter : NULL);
 }
 
-static void sort_method_alphabetical(PurpleBlistNode *node, PurpleBuddyList *blist, GtkTreeIter groupiter, GtkTreeIter *cur, GtkTreeIter *iter)
+/* Drop a node from the sort index of its group. */
+static void sort_index_remove(PurpleBlistNode *node)
 {
-	GtkTreeIter more_z;
+	PidginBlistNode *gtknode = purple_blist_node_get_ui_data(node);
+
+	if (gtknode && gtknode->sorted_pos) {
+		g_sequence_remove(gtknode->sorted_pos);
+		gtknode->sorted_pos = NULL;
+	}
+}
 
-	const char *my_name;
+/* Throw away the sort index of a group. */
+static void sort_index_clear(PurpleBlistNode *gnode)
+{
+	PidginBlistNode *gtkgroup = purple_blist_node_get_ui_data(gnode);
+	GSequenceIter *pos;
 
-	if(PURPLE_IS_CONTACT(node)) {
-		my_name = purple_contact_get_alias((PurpleContact*)node);
-	} else if(PURPLE_IS_CHAT(node)) {
-		my_name = purple_chat_get_name((PurpleChat*)node);
-	} else {
-		sort_method_none(node, blist, groupiter, cur, iter);
+	if (!gtkgroup || !gtkgroup->sorted)
 		return;
+
+	for (pos = g_sequence_get_begin_iter(gtkgroup->sorted);
+	     !g_sequence_iter_is_end(pos); pos = g_sequence_iter_next(pos)) {
+		PidginBlistNode *gtknode = purple_blist_node_get_ui_data(g_sequence_get(pos));
+		gtknode->sorted_pos = NULL;
 	}
 
-	if (!gtk_tree_model_iter_children(GTK_TREE_MODEL(gtkblist->treemodel), &more_z, &groupiter)) {
-		gtk_tree_store_insert(gtkblist->treemodel, iter, &groupiter, 0);
-		return;
+	g_sequence_free(gtkgroup->sorted);
+	gtkgroup->sorted = NULL;
+}
+
+/*
+ * Refresh the values a node is compared by.  This is only done when the
+ * node itself is placed, so the index stays consistent with the values
+ * its members were sorted with.
+ */
+static void sort_index_update_keys(PurpleBlistNode *node, gboolean activity)
+{
+	static guint serial = 0;
+	PidginBlistNode *gtknode = purple_blist_node_get_ui_data(node);
+	const char *name = NULL;
+
+	if (gtknode->sort_serial == 0)
+		gtknode->sort_serial = ++serial;
+
+	if (PURPLE_IS_CONTACT(node))
+		name = purple_contact_get_alias((PurpleContact*)node);
+	else if (PURPLE_IS_CHAT(node))
+		name = purple_chat_get_name((PurpleChat*)node);
+
+	g_free(gtknode->sort_key);
+	gtknode->sort_key = NULL;
+	if (name && g_utf8_validate(name, -1, NULL)) {
+		gchar *folded = g_utf8_casefold(name, -1);
+		gtknode->sort_key = g_utf8_collate_key(folded, -1);
+		g_free(folded);
 	}
 
-	do {
-		PurpleBlistNode *n;
-		const char *this_name;
-		int cmp;
+	if (PURPLE_IS_CONTACT(node)) {
+		PurpleBuddy *buddy = purple_contact_get_priority_buddy((PurpleContact*)node);
 
-		gtk_tree_model_get(GTK_TREE_MODEL(gtkblist->treemodel), &more_z, NODE_COLUMN, &n, -1);
+		gtknode->presence.known = (buddy != NULL);
+		if (buddy) {
+			PurpleBuddyPresence *presence =
+				PURPLE_BUDDY_PRESENCE(purple_buddy_get_presence(buddy));
 
-		if(PURPLE_IS_CONTACT(n)) {
-			this_name = purple_contact_get_alias((PurpleContact*)n);
-		} else if(PURPLE_IS_CHAT(n)) {
-			this_name = purple_chat_get_name((PurpleChat*)n);
-		} else {
-			this_name = NULL;
+			gtknode->presence.online = purple_presence_is_online(PURPLE_PRESENCE(presence));
+			gtknode->presence.score = purple_buddy_presence_compute_score(presence);
+			gtknode->presence.idle_time = purple_presence_get_idle_time(PURPLE_PRESENCE(presence));
 		}
+	}
 
-		cmp = purple_utf8_strcasecmp(my_name, this_name);
+	if (activity && PURPLE_IS_CONTACT(node)) {
+		PurpleBlistNode *n;
 
-		if(this_name && (cmp < 0 || (cmp == 0 && node < n))) {
-			if(cur) {
-				gtk_tree_store_move_before(gtkblist->treemodel, cur, &more_z);
-				*iter = *cur;
-				return;
-			} else {
-				gtk_tree_store_insert_before(gtkblist->treemodel, iter,
-						&groupiter, &more_z);
-				return;
-			}
+		gtknode->activity_score = 0;
+		for (n = node->child; n; n = n->next) {
+			PurpleBuddy *buddy = (PurpleBuddy*)n;
+			gtknode->activity_score += purple_log_get_activity_score(PURPLE_LOG_IM,
+					purple_buddy_get_name(buddy), purple_buddy_get_account(buddy));
 		}
-	} while (gtk_tree_model_iter_next (GTK_TREE_MODEL(gtkblist->treemodel), &more_z));
-
-	if(cur) {
-		gtk_tree_store_move_before(gtkblist->treemodel, cur, NULL);
-		*iter = *cur;
-		return;
-	} else {
-		gtk_tree_store_append(gtkblist->treemodel, iter, &groupiter);
-		return;
 	}
 }
 
-static void sort_method_status(PurpleBlistNode *node, PurpleBuddyList *blist, GtkTreeIter groupiter, GtkTreeIter *cur, GtkTreeIter *iter)
+/*
+ * Place a contact or chat in its group's index and move its row, or
+ * create one, just before the row of the node that follows it.
+ */
+static void sort_index_insert(PurpleBlistNode *node, GtkTreeIter groupiter,
+		GtkTreeIter *cur, GtkTreeIter *iter, GCompareDataFunc compare)
 {
-	GtkTreeIter more_z;
+	PidginBlistNode *gtknode = purple_blist_node_get_ui_data(node);
+	PidginBlistNode *gtkgroup = purple_blist_node_get_ui_data(node->parent);
+	GSequenceIter *next;
+	GtkTreeIter next_iter;
 
-	PurpleBuddy *my_buddy, *this_buddy;
+	if (gtkgroup->sorted == NULL)
+		gtkgroup->sorted = g_sequence_new(NULL);
 
-	if(PURPLE_IS_CONTACT(node)) {
-		my_buddy = purple_contact_get_priority_buddy((PurpleContact*)node);
-	} else if(PURPLE_IS_CHAT(node)) {
-		if (cur != NULL) {
-			*iter = *cur;
-			return;
-		}
+	gtknode->sorted_pos = g_sequence_insert_sorted(gtkgroup->sorted, node,
+			compare, NULL);
+
+	/* Skip over anything whose row has gone away behind our back */
+	next = g_sequence_iter_next(gtknode->sorted_pos);
+	while (!g_sequence_iter_is_end(next) &&
+	       !get_iter_from_node(g_sequence_get(next), &next_iter)) {
+		GSequenceIter *stale = next;
 
+		next = g_sequence_iter_next(next);
+		sort_index_remove(g_sequence_get(stale));
+	}
+
+	if (cur) {
+		gtk_tree_store_move_before(gtkblist->treemodel, cur,
+				g_sequence_iter_is_end(next) ? NULL : &next_iter);
+		*iter = *cur;
+	} else if (g_sequence_iter_is_end(next)) {
 		gtk_tree_store_append(gtkblist->treemodel, iter, &groupiter);
-		return;
 	} else {
-		sort_method_alphabetical(node, blist, groupiter, cur, iter);
-		return;
+		gtk_tree_store_insert_before(gtkblist->treemodel, iter,
+				&groupiter, &next_iter);
 	}
+}
 
+/* Break ties by address, like the sort methods always have. */
+static gint sort_compare_address(gconstpointer a, gconstpointer b)
+{
+	return (a < b) ? -1 : (a > b);
+}
 
-	if (!gtk_tree_model_iter_children(GTK_TREE_MODEL(gtkblist->treemodel), &more_z, &groupiter)) {
-		gtk_tree_store_insert(gtkblist->treemodel, iter, &groupiter, 0);
-		return;
-	}
+static gint sort_compare_name(gconstpointer a, gconstpointer b)
+{
+	PidginBlistNode *gtka = purple_blist_node_get_ui_data((PurpleBlistNode*)a);
+	PidginBlistNode *gtkb = purple_blist_node_get_ui_data((PurpleBlistNode*)b);
+	gint ret = g_strcmp0(gtka->sort_key, gtkb->sort_key);
 
-	do {
-		PurpleBlistNode *n;
-		gint name_cmp;
-		gint presence_cmp;
+	return ret ? ret : sort_compare_address(a, b);
+}
 
-		gtk_tree_model_get(GTK_TREE_MODEL(gtkblist->treemodel), &more_z, NODE_COLUMN, &n, -1);
+/* Contacts come first; chats follow in the order they were added. */
+static gint sort_compare_chats_last(gconstpointer a, gconstpointer b)
+{
+	PidginBlistNode *gtka = purple_blist_node_get_ui_data((PurpleBlistNode*)a);
+	PidginBlistNode *gtkb = purple_blist_node_get_ui_data((PurpleBlistNode*)b);
+	gboolean chat_a = !PURPLE_IS_CONTACT(a), chat_b = !PURPLE_IS_CONTACT(b);
 
-		if(PURPLE_IS_CONTACT(n)) {
-			this_buddy = purple_contact_get_priority_buddy((PurpleContact*)n);
-		} else {
-			this_buddy = NULL;
-		}
+	if (chat_a != chat_b)
+		return chat_a ? 1 : -1;
+	if (chat_a && gtka->sort_serial != gtkb->sort_serial)
+		return (gtka->sort_serial < gtkb->sort_serial) ? -1 : 1;
 
-		name_cmp = purple_utf8_strcasecmp(
-			purple_contact_get_alias(purple_buddy_get_contact(my_buddy)),
-			(this_buddy
-			 ? purple_contact_get_alias(purple_buddy_get_contact(this_buddy))
-			 : NULL));
+	return 0;
+}
 
-		presence_cmp = purple_buddy_presence_compare(
-			PURPLE_BUDDY_PRESENCE(purple_buddy_get_presence(my_buddy)),
-			this_buddy ? PURPLE_BUDDY_PRESENCE(purple_buddy_get_presence(this_buddy)) : NULL);
+static gint sort_compare_alphabetical(gconstpointer a, gconstpointer b, gpointer data)
+{
+	return sort_compare_name(a, b);
+}
 
-		if (this_buddy == NULL ||
-			(presence_cmp < 0 ||
-			 (presence_cmp == 0 &&
-			  (name_cmp < 0 || (name_cmp == 0 && node < n)))))
-		{
-			if (cur != NULL)
-			{
-				gtk_tree_store_move_before(gtkblist->treemodel, cur, &more_z);
-				*iter = *cur;
-				return;
-			}
-			else
-			{
-				gtk_tree_store_insert_before(gtkblist->treemodel, iter,
-											 &groupiter, &more_z);
-				return;
-			}
-		}
-	}
-	while (gtk_tree_model_iter_next(GTK_TREE_MODEL(gtkblist->treemodel),
-									&more_z));
+/*
+ * The same order as purple_buddy_presence_compare(), but on the presences
+ * as they were when the contacts were placed, so contacts already in the
+ * index don't move under a search when their presence changes.
+ */
+static gint sort_compare_status(gconstpointer a, gconstpointer b, gpointer data)
+{
+	PidginBlistNode *gtka = purple_blist_node_get_ui_data((PurpleBlistNode*)a);
+	PidginBlistNode *gtkb = purple_blist_node_get_ui_data((PurpleBlistNode*)b);
+	int score_a, score_b;
+	gint ret;
 
-	if (cur) {
-		gtk_tree_store_move_before(gtkblist->treemodel, cur, NULL);
-		*iter = *cur;
-		return;
-	} else {
-		gtk_tree_store_append(gtkblist->treemodel, iter, &groupiter);
-		return;
+	if ((ret = sort_compare_chats_last(a, b)) || !PURPLE_IS_CONTACT(a))
+		return ret ? ret : sort_compare_address(a, b);
+
+	if (gtka->presence.known != gtkb->presence.known)
+		return gtka->presence.known ? -1 : 1;
+
+	if (gtka->presence.known) {
+		if (gtka->presence.online != gtkb->presence.online)
+			return gtka->presence.online ? -1 : 1;
+
+		/* The one that has been idle for longer gets the idle time score */
+		score_a = gtka->presence.score;
+		score_b = gtkb->presence.score;
+		if (gtka->presence.idle_time < gtkb->presence.idle_time)
+			score_a += purple_prefs_get_int("/purple/status/scores/idle_time");
+		else if (gtka->presence.idle_time > gtkb->presence.idle_time)
+			score_b += purple_prefs_get_int("/purple/status/scores/idle_time");
+
+		if (score_a != score_b)
+			return (score_a > score_b) ? -1 : 1;
 	}
+
+	return sort_compare_name(a, b);
 }
 
-static void sort_method_log_activity(PurpleBlistNode *node, PurpleBuddyList *blist, GtkTreeIter groupiter, GtkTreeIter *cur, GtkTreeIter *iter)
+static gint sort_compare_log_activity(gconstpointer a, gconstpointer b, gpointer data)
 {
-	GtkTreeIter more_z;
+	PidginBlistNode *gtka = purple_blist_node_get_ui_data((PurpleBlistNode*)a);
+	PidginBlistNode *gtkb = purple_blist_node_get_ui_data((PurpleBlistNode*)b);
+	gint ret;
 
-	int activity_score = 0, this_log_activity_score = 0;
-	const char *buddy_name, *this_buddy_name;
+	if ((ret = sort_compare_chats_last(a, b)) || !PURPLE_IS_CONTACT(a))
+		return ret ? ret : sort_compare_address(a, b);
 
-	if(cur && (gtk_tree_model_iter_n_children(GTK_TREE_MODEL(gtkblist->treemodel), &groupiter) == 1)) {
-		*iter = *cur;
-		return;
-	}
+	/* More active contacts first */
+	if (gtka->activity_score != gtkb->activity_score)
+		return (gtka->activity_score > gtkb->activity_score) ? -1 : 1;
 
-	if(PURPLE_IS_CONTACT(node)) {
-		PurpleBlistNode *n;
-		PurpleBuddy *buddy;
-		for (n = node->child; n; n = n->next) {
-			buddy = (PurpleBuddy*)n;
-			activity_score += purple_log_get_activity_score(PURPLE_LOG_IM, purple_buddy_get_name(buddy), purple_buddy_get_account(buddy));
-		}
-		buddy_name = purple_contact_get_alias((PurpleContact*)node);
-	} else if(PURPLE_IS_CHAT(node)) {
-		/* we don't have a reliable way of getting the log filename
-		 * from the chat info in the blist, yet */
-		if (cur != NULL) {
-			*iter = *cur;
-			return;
-		}
+	return sort_compare_name(a, b);
+}
 
-		gtk_tree_store_append(gtkblist->treemodel, iter, &groupiter);
-		return;
-	} else {
+static void sort_method_alphabetical(PurpleBlistNode *node, PurpleBuddyList *blist, GtkTreeIter groupiter, GtkTreeIter *cur, GtkTreeIter *iter)
+{
+	if(!PURPLE_IS_CONTACT(node) && !PURPLE_IS_CHAT(node)) {
 		sort_method_none(node, blist, groupiter, cur, iter);
 		return;
 	}
 
+	sort_index_remove(node);
+	sort_index_update_keys(node, FALSE);
+	sort_index_insert(node, groupiter, cur, iter, sort_compare_alphabetical);
+}
 
-	if (!gtk_tree_model_iter_children(GTK_TREE_MODEL(gtkblist->treemodel), &more_z, &groupiter)) {
-		gtk_tree_store_insert(gtkblist->treemodel, iter, &groupiter, 0);
+static void sort_method_status(PurpleBlistNode *node, PurpleBuddyList *blist, GtkTreeIter groupiter, GtkTreeIter *cur, GtkTreeIter *iter)
+{
+	if(!PURPLE_IS_CONTACT(node) && !PURPLE_IS_CHAT(node)) {
+		sort_method_alphabetical(node, blist, groupiter, cur, iter);
 		return;
 	}
 
-	do {
-		PurpleBlistNode *n;
-		PurpleBlistNode *n2;
-		PurpleBuddy *buddy;
-		int cmp;
-
-		gtk_tree_model_get(GTK_TREE_MODEL(gtkblist->treemodel), &more_z, NODE_COLUMN, &n, -1);
-		this_log_activity_score = 0;
-
-		if(PURPLE_IS_CONTACT(n)) {
-			for (n2 = n->child; n2; n2 = n2->next) {
-				buddy = (PurpleBuddy*)n2;
-				this_log_activity_score += purple_log_get_activity_score(PURPLE_LOG_IM, purple_buddy_get_name(buddy), purple_buddy_get_account(buddy));
-			}
-			this_buddy_name = purple_contact_get_alias((PurpleContact*)n);
-		} else {
-			this_buddy_name = NULL;
-		}
-
-		cmp = purple_utf8_strcasecmp(buddy_name, this_buddy_name);
-
-		if (!PURPLE_IS_CONTACT(n) || activity_score > this_log_activity_score ||
-				((activity_score == this_log_activity_score) &&
-				 (cmp < 0 || (cmp == 0 && node < n)))) {
-			if (cur != NULL) {
-				gtk_tree_store_move_before(gtkblist->treemodel, cur, &more_z);
-				*iter = *cur;
-				return;
-			} else {
-				gtk_tree_store_insert_before(gtkblist->treemodel, iter,
-						&groupiter, &more_z);
-				return;
-			}
-		}
-	} while (gtk_tree_model_iter_next (GTK_TREE_MODEL(gtkblist->treemodel), &more_z));
+	sort_index_remove(node);
+	sort_index_update_keys(node, FALSE);
+	sort_index_insert(node, groupiter, cur, iter, sort_compare_status);
+}
 
-	if (cur != NULL) {
-		gtk_tree_store_move_before(gtkblist->treemodel, cur, NULL);
-		*iter = *cur;
-		return;
-	} else {
-		gtk_tree_store_append(gtkblist->treemodel, iter, &groupiter);
+static void sort_method_log_activity(PurpleBlistNode *node, PurpleBuddyList *blist, GtkTreeIter groupiter, GtkTreeIter *cur, GtkTreeIter *iter)
+{
+	if(!PURPLE_IS_CONTACT(node) && !PURPLE_IS_CHAT(node)) {
+		sort_method_none(node, blist, groupiter, cur, iter);
 		return;
 	}
+
+	/* we don't have a reliable way of getting the log filename
+	 * from the chat info in the blist, yet, so chats just go last */
+	sort_index_remove(node);
+	sort_index_update_keys(node, TRUE);
+	sort_index_insert(node, groupiter, cur, iter, sort_compare_log_activity);
 }
 
 static void
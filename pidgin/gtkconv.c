@@ -6187,6 +6187,7 @@ pidgin_conv_destroy(PurpleConversation *conv)
 	if (gtkconv->attach_timer) {
 		g_source_remove(gtkconv->attach_timer);
 	}
+	g_list_free_full(gtkconv->attach_current, g_object_unref);
 
 	g_array_unref(gtkconv->nick_colors);
 
@@ -6762,10 +6763,9 @@ pidgin_conv_write_conv(PurpleConversation *conv, PurpleMessage *pmsg)
 			PIDGIN_CONVERSATION_THEME_TEMPLATE_OUTGOING_CONTENT);
 
 	} else if ((flags & PURPLE_MESSAGE_RECV) && (old_flags & PURPLE_MESSAGE_RECV)) {
-		GList *history = purple_conversation_get_message_history(gtkconv->last_conversed);
-		PurpleMessage *last_msg = history ? history->data : NULL;
+		PurpleMessage *last_msg = purple_conversation_get_message_history_nth(
+			gtkconv->last_conversed, 0);
 
-		g_assert(history != NULL);
 		g_assert(last_msg != NULL);
 
 		/* If the senders are the same, use appendNextMessage */
@@ -8502,6 +8502,22 @@ message_compare(gconstpointer p1, gconstpointer p2)
 	return (purple_message_get_time(m1) > purple_message_get_time(m2));
 }
 
+/* Returns a list of the message history of conv, the oldest message first,
+ * holding a reference on each message. */
+static GList *
+get_message_history(PurpleConversation *conv)
+{
+	PurpleConversationMessageHistoryIter iter;
+	PurpleMessage *msg;
+	GList *list = NULL;
+
+	purple_conversation_message_history_iter_init(&iter, conv);
+	while (purple_conversation_message_history_iter_next(&iter, &msg))
+		list = g_list_prepend(list, g_object_ref(msg));
+
+	return list;
+}
+
 /* Adds some message history to the gtkconv. This happens in a idle-callback. */
 static gboolean
 add_message_history_to_gtkconv(gpointer data)
@@ -8512,22 +8528,16 @@ add_message_history_to_gtkconv(gpointer data)
 	int timer = gtkconv->attach_timer;
 	time_t when = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(gtkconv->entry), "attach-start-time"));
 	gboolean im = (PURPLE_IS_IM_CONVERSATION(gtkconv->active_conv));
+	GList *msgs = NULL;
+	GList *iter;
 
 	gtkconv->attach_timer = 0;
 	while (gtkconv->attach_current && count < ADD_MESSAGE_HISTORY_AT_ONCE) {
 		PurpleMessage *msg = gtkconv->attach_current->data;
-		if (!im && when && (guint64)when < purple_message_get_time(msg)) {
-			pidgin_webview_append_html(webview, "<BR><HR>");
-			pidgin_webview_scroll_to_end(webview, TRUE);
-			g_object_set_data(G_OBJECT(gtkconv->entry), "attach-start-time", NULL);
-		}
 		/* XXX: should it be gtkconv->active_conv? */
 		pidgin_conv_write_conv(gtkconv->active_conv, msg);
-		if (im) {
-			gtkconv->attach_current = g_list_delete_link(gtkconv->attach_current, gtkconv->attach_current);
-		} else {
-			gtkconv->attach_current = gtkconv->attach_current->prev;
-		}
+		gtkconv->attach_current = g_list_delete_link(gtkconv->attach_current, gtkconv->attach_current);
+		g_object_unref(msg);
 		count++;
 	}
 	gtkconv->attach_timer = timer;
@@ -8536,28 +8546,32 @@ add_message_history_to_gtkconv(gpointer data)
 
 	g_source_remove(gtkconv->attach_timer);
 	gtkconv->attach_timer = 0;
-	if (im) {
-		/* Print any message that was sent while the old history was being added back. */
-		GList *msgs = NULL;
-		GList *iter = gtkconv->convs;
-		for (; iter; iter = iter->next) {
-			PurpleConversation *conv = iter->data;
-			GList *history = purple_conversation_get_message_history(conv);
-			for (; history; history = history->next) {
-				PurpleMessage *msg = history->data;
-				if (purple_message_get_time(msg) > (guint64)when)
-					msgs = g_list_prepend(msgs, msg);
-			}
-		}
-		msgs = g_list_sort(msgs, message_compare);
-		for (; msgs; msgs = g_list_delete_link(msgs, msgs)) {
-			PurpleMessage *msg = msgs->data;
-			/* XXX: see above - should it be active_conv? */
-			pidgin_conv_write_conv(gtkconv->active_conv, msg);
+
+	/* Print any message that was sent while the old history was being added back. */
+	for (iter = gtkconv->convs; iter; iter = iter->next) {
+		PurpleConversationMessageHistoryIter history;
+		PurpleMessage *msg;
+
+		purple_conversation_message_history_iter_init(&history, iter->data);
+		while (purple_conversation_message_history_iter_next(&history, &msg)) {
+			if (purple_message_get_time(msg) <= (guint64)when)
+				break;
+			msgs = g_list_prepend(msgs, msg);
 		}
+	}
+	msgs = g_list_sort(msgs, message_compare);
+	if (!im && msgs) {
+		pidgin_webview_append_html(webview, "<BR><HR>");
+		pidgin_webview_scroll_to_end(webview, TRUE);
+	}
+	for (; msgs; msgs = g_list_delete_link(msgs, msgs)) {
+		PurpleMessage *msg = msgs->data;
+		/* XXX: see above - should it be active_conv? */
+		pidgin_conv_write_conv(gtkconv->active_conv, msg);
+	}
+	if (im) {
 		pidgin_webview_append_html(webview, "<BR><HR>");
 		pidgin_webview_scroll_to_end(webview, TRUE);
-		g_object_set_data(G_OBJECT(gtkconv->entry), "attach-start-time", NULL);
 	}
 
 	g_object_set_data(G_OBJECT(gtkconv->entry), "attach-start-time", NULL);
@@ -8607,23 +8621,20 @@ gboolean pidgin_conv_attach_to_conversation(PurpleConversation *conv)
 	pidgin_conv_attach(conv);
 	gtkconv = PIDGIN_CONVERSATION(conv);
 
-	list = purple_conversation_get_message_history(conv);
+	list = get_message_history(conv);
 	if (list) {
 		if (PURPLE_IS_IM_CONVERSATION(conv)) {
 			GList *convs;
-			list = g_list_copy(list);
 			for (convs = purple_conversations_get_ims(); convs; convs = convs->next)
 				if (convs->data != conv &&
 						pidgin_conv_find_gtkconv(convs->data) == gtkconv) {
 					pidgin_conv_attach(convs->data);
-					list = g_list_concat(list, g_list_copy(purple_conversation_get_message_history(convs->data)));
+					list = g_list_concat(list, get_message_history(convs->data));
 				}
 			list = g_list_sort(list, message_compare);
-			gtkconv->attach_current = list;
-			list = g_list_last(list);
-		} else if (PURPLE_IS_CHAT_CONVERSATION(conv)) {
-			gtkconv->attach_current = g_list_last(list);
 		}
+		gtkconv->attach_current = list;
+		list = g_list_last(list);
 
 		g_object_set_data(G_OBJECT(gtkconv->entry), "attach-start-time",
 			GINT_TO_POINTER(purple_message_get_time(list->data)));
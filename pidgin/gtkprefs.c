@@ -1497,6 +1497,8 @@ formatting_toggle_cb(PidginWebView *webview, PidginWebViewButtons buttons, void
 
 	pidgin_webview_get_current_format(webview, &bold, &italic, &uline, &strike);
 
+	purple_prefs_begin_batch();
+
 	if (buttons & PIDGIN_WEBVIEW_BOLD)
 		purple_prefs_set_bool(PIDGIN_PREFS_ROOT "/conversations/send_bold",
 		                      bold);
@@ -1545,11 +1547,15 @@ formatting_toggle_cb(PidginWebView *webview, PidginWebViewButtons buttons, void
 
 		g_free(color);
 	}
+
+	purple_prefs_commit_batch();
 }
 
 static void
 formatting_clear_cb(PidginWebView *webview, void *data)
 {
+	purple_prefs_begin_batch();
+
 	purple_prefs_set_bool(PIDGIN_PREFS_ROOT "/conversations/send_bold", FALSE);
 	purple_prefs_set_bool(PIDGIN_PREFS_ROOT "/conversations/send_italic", FALSE);
 	purple_prefs_set_bool(PIDGIN_PREFS_ROOT "/conversations/send_underline", FALSE);
@@ -1560,6 +1566,8 @@ formatting_clear_cb(PidginWebView *webview, void *data)
 	purple_prefs_set_string(PIDGIN_PREFS_ROOT "/conversations/font_face", "");
 	purple_prefs_set_string(PIDGIN_PREFS_ROOT "/conversations/fgcolor", "");
 	purple_prefs_set_string(PIDGIN_PREFS_ROOT "/conversations/bgcolor", "");
+
+	purple_prefs_commit_batch();
 }
 
 static void